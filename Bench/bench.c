@@ -0,0 +1,1308 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains Benchmark code that times each phase of the
+*       VCPU scheduler and the memory coordinator cycles, and counts the
+*       allocations they make, as the number of domains and PCPUs grows.
+*       The policies run as the resource manager runs them on the
+*       simulated host of the replay engine (../Replay), so the times are
+*       those of the policies themselves - a hypervisor adds the cost of
+*       its calls on top.  Each configuration runs in its own process
+*
+*   FUNCTIONS
+*
+*       main
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <libvirt/libvirt.h>
+#include "bench_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static int  bench_options(int argc, char ** argv, BENCH_OPTIONS * options);
+static int  bench_range_parse(const char * text, int * min, int * max);
+static char ** bench_policy_argv(int argc, char ** argv, const char * name);
+static int  bench_config(const BENCH_OPTIONS * options, int num_domains, int num_pcpus, BENCH_RESULT * result);
+static int  bench_config_run(const BENCH_OPTIONS * options, BENCH_RESULT * result);
+static int  bench_host_init(const BENCH_OPTIONS * options, int num_domains, int num_pcpus);
+static int  bench_run(const BENCH_OPTIONS * options, BENCH_SAMPLES * samples, BENCH_RESULT * result);
+static int  bench_phases_name(const BENCH_OPTIONS * options, BENCH_RESULT * result);
+static void bench_span_start(unsigned long long * allocs, unsigned long long * bytes);
+static void bench_span_end(BENCH_SAMPLES * samples, unsigned long long allocs, unsigned long long bytes);
+static void bench_phases_result(BENCH_SAMPLES * samples, int num_cycles, BENCH_RESULT * result);
+static void bench_result_print(const BENCH_OPTIONS * options, const BENCH_RESULT * result);
+static void bench_budget(const BENCH_OPTIONS * options, const BENCH_RESULT * results, int num_results);
+static int  bench_ull_compare(const void * a, const void * b);
+
+/* Allocation functions wrapped by the linker (-Wl,--wrap) */
+void *      __real_malloc(size_t size);
+void *      __real_calloc(size_t num, size_t size);
+void *      __real_realloc(void * ptr, size_t size);
+void *      __wrap_malloc(size_t size);
+void *      __wrap_calloc(size_t num, size_t size);
+void *      __wrap_realloc(void * ptr, size_t size);
+
+/*****************************/
+/* LOCAL VARIABLES           */
+/*****************************/
+static char **              cpu_argv;       /* VCPU scheduler options (ending with -j 0) */
+static int                  cpu_argc;
+static char **              mem_argv;       /* Memory coordinator options (ending with -j 0) */
+static int                  mem_argc;
+static unsigned long long   bench_allocs;   /* Allocations made by the process */
+static unsigned long long   bench_bytes;    /* Bytes allocated by the process */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       main
+*
+*   DESCRIPTION
+*
+*       C entry function
+*
+*   INPUTS
+*
+*       argc                                Number of parameters
+*       argv                                Array of parameters
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Application successfully executed
+*       EXIT_FAILURE                        Error in running application
+*
+*************************************************************************/
+int main(int argc, char ** argv)
+{
+    int                 num_domains, num_pcpus, num_results = 0, status = EXIT_FAILURE;
+    BENCH_OPTIONS       options;
+    BENCH_RESULT *      results = NULL;
+
+
+    /* Check if command-line parameters are valid */
+    if (!bench_options(argc, argv, &options))
+    {
+        /* Print error / usage */
+        fprintf(stderr, "Usage:  %s [-D <min>,<max>] [-p <min>,<max>] [-v <vcpus>] [-n <cycles>] [-w <cycles>] [-b <percent>]\n\r", argv[0]);
+        fprintf(stderr, "           [-s <seed>] [-P cpu|mem|both] [-c] [-d] <time interval> [%s <scheduler options>] [%s <coordinator options>]\n\r",
+                BENCH_CPU_ARG, BENCH_MEM_ARG);
+        fprintf(stderr, "        where <time interval> = simulated time, in seconds, between cycles (ie 1, 0.5).\n\r");
+        fprintf(stderr, "              -D <min>,<max>  = domains swept, doubling (default %d,%d).\n\r", BENCH_MIN_DOMAINS, BENCH_MAX_DOMAINS);
+        fprintf(stderr, "              -p <min>,<max>  = PCPUs swept, doubling (default %d,%d).\n\r", BENCH_MIN_PCPUS, BENCH_MAX_PCPUS);
+        fprintf(stderr, "              -v <vcpus>      = VCPUs per domain (default %d).\n\r", BENCH_VCPUS);
+        fprintf(stderr, "              -n <cycles>     = cycles timed (default %d).\n\r", BENCH_CYCLES);
+        fprintf(stderr, "              -w <cycles>     = cycles run before timing (default %d).\n\r", BENCH_WARMUP_CYCLES);
+        fprintf(stderr, "              -b <percent>    = %% of the interval a cycle may take (default %d).\n\r", BENCH_BUDGET_PERCENT);
+        fprintf(stderr, "              -s <seed>       = seed of the workload (default 1).\n\r");
+        fprintf(stderr, "              -P <policies>   = policies benchmarked (default both).\n\r");
+        fprintf(stderr, "              -c              = print comma separated values.\n\r");
+        fprintf(stderr, "              -d              = show the output of the policies.\n\r");
+    }
+    else
+    {
+        /* Count configurations and allocate a result for each */
+        for (num_pcpus = options.min_pcpus; num_pcpus <= options.max_pcpus; num_pcpus *= 2)
+        {
+            for (num_domains = options.min_domains; num_domains <= options.max_domains; num_domains *= 2)
+            {
+                num_results++;
+            }
+        }
+        results = calloc(num_results, sizeof(BENCH_RESULT));
+        status = (results != NULL ? EXIT_SUCCESS : BENCH_NOMEM);
+        num_results = 0;
+
+        /* Check if results allocated */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Print column headings */
+            printf((options.csv ? "%s,%s,%s,%s,%s,%s,%s,%s,%s,%s,%s\n" : "%7s %5s %6s %-18s %10s %10s %10s %10s %10s %7s %7s\n"),
+                   "domains", "pcpus", "vcpus", "phase", "p50_us", "p99_us", "max_us", "allocs", "alloc_kb", "repins", "resizes");
+
+            /* Loop through each PCPU count and then each domain count */
+            for (num_pcpus = options.min_pcpus; num_pcpus <= options.max_pcpus; num_pcpus *= 2)
+            {
+                for (num_domains = options.min_domains; num_domains <= options.max_domains; num_domains *= 2)
+                {
+                    /* Run the configuration in its own process */
+                    bench_config(&options, num_domains, num_pcpus, &results[num_results]);
+
+                    /* Keep first error */
+                    status = ((status == EXIT_SUCCESS) ? results[num_results].status : status);
+
+                    /* Print the phases of the configuration and count it */
+                    bench_result_print(&options, &results[num_results]);
+                    num_results++;
+                }
+            }
+
+            /* Print largest configurations within budget (not needed for comma separated values) */
+            if (!options.csv)
+            {
+                bench_budget(&options, results, num_results);
+            }
+        }
+
+        /* Check if error returned */
+        if (status != EXIT_SUCCESS)
+        {
+            /* Print error (after the results) */
+            fflush(stdout);
+            fprintf(stderr, "Exit error code = %d\n\r", status);
+        }
+    }
+
+    /* Free results and policy options */
+    free(results);
+    free(cpu_argv);
+    free(mem_argv);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_options
+*
+*   DESCRIPTION
+*
+*       Parses the command-line parameters.  As for the resource manager
+*       the parameters are split at BENCH_CPU_ARG / BENCH_MEM_ARG, and
+*       "-j 0" is added to the options of each policy so stats are read
+*       and pins / resizes are made inline (and timed)
+*
+*   INPUTS
+*
+*       argc                                Number of parameters
+*       argv                                Array of parameters
+*       options                             Options to set up
+*
+*   OUTPUTS
+*
+*       1                                   Parameters valid
+*       0                                   Parameters invalid (show usage)
+*
+*************************************************************************/
+static int  bench_options(int argc, char ** argv, BENCH_OPTIONS * options)
+{
+    int     index, option, valid = 1;
+    int     bench_argc, cpu_index = 0, mem_index = 0;
+
+
+    /* Set defaults */
+    memset(options, 0, sizeof(*options));
+    options->min_domains = BENCH_MIN_DOMAINS;
+    options->max_domains = BENCH_MAX_DOMAINS;
+    options->min_pcpus = BENCH_MIN_PCPUS;
+    options->max_pcpus = BENCH_MAX_PCPUS;
+    options->vcpus = BENCH_VCPUS;
+    options->num_cycles = BENCH_CYCLES;
+    options->warmup_cycles = BENCH_WARMUP_CYCLES;
+    options->budget_percent = BENCH_BUDGET_PERCENT;
+    options->seed = 1;
+    options->policies = BENCH_POLICY_CPU | BENCH_POLICY_MEM;
+
+    /* Loop through each parameter looking for the start of each policy's options */
+    for (index = 1; index < argc; index++)
+    {
+        /* Check if VCPU scheduler options start here (only once) */
+        if ((strcmp(argv[index], BENCH_CPU_ARG) == 0) && (cpu_index == 0))
+        {
+            cpu_index = index;
+        }
+        /* Check if memory coordinator options start here (only once) */
+        else if ((strcmp(argv[index], BENCH_MEM_ARG) == 0) && (mem_index == 0))
+        {
+            mem_index = index;
+        }
+    }
+
+    /* Benchmark parameters end at the first policy's options */
+    bench_argc = ((cpu_index) && ((mem_index == 0) || (cpu_index < mem_index)) ? cpu_index :
+                  (mem_index) ? mem_index : argc);
+
+    /* Loop through each benchmark option */
+    while ((valid) && ((option = getopt(bench_argc, argv, "D:p:v:n:w:b:s:P:cd")) != -1))
+    {
+        switch (option)
+        {
+            /* Domains option */
+            case 'D':
+
+                /* Set range of domains */
+                valid = bench_range_parse(optarg, &options->min_domains, &options->max_domains);
+
+            break;
+
+            /* PCPUs option */
+            case 'p':
+
+                /* Set range of PCPUs */
+                valid = bench_range_parse(optarg, &options->min_pcpus, &options->max_pcpus);
+
+            break;
+
+            /* VCPUs option */
+            case 'v':
+
+                /* Set VCPUs per domain */
+                options->vcpus = atoi(optarg);
+                valid = (options->vcpus > 0);
+
+            break;
+
+            /* Cycles option */
+            case 'n':
+
+                /* Set cycles timed */
+                options->num_cycles = atoi(optarg);
+                valid = (options->num_cycles > 0);
+
+            break;
+
+            /* Warm up option */
+            case 'w':
+
+                /* Set cycles run before timing */
+                options->warmup_cycles = atoi(optarg);
+                valid = (options->warmup_cycles >= 0);
+
+            break;
+
+            /* Budget option */
+            case 'b':
+
+                /* Set % of the interval a cycle may take */
+                options->budget_percent = atoi(optarg);
+                valid = ((options->budget_percent > 0) && (options->budget_percent <= 100));
+
+            break;
+
+            /* Seed option */
+            case 's':
+
+                /* Set seed of the workload */
+                options->seed = (unsigned int)strtoul(optarg, NULL, 10);
+
+            break;
+
+            /* Policies option */
+            case 'P':
+
+                /* Set policies benchmarked */
+                options->policies = ((strcmp(optarg, "cpu") == 0) ? BENCH_POLICY_CPU :
+                                     (strcmp(optarg, "mem") == 0) ? BENCH_POLICY_MEM :
+                                     (strcmp(optarg, "both") == 0) ? (BENCH_POLICY_CPU | BENCH_POLICY_MEM) : 0);
+                valid = (options->policies != 0);
+
+            break;
+
+            /* Comma separated values option */
+            case 'c':
+
+                /* Print comma separated values */
+                options->csv = 1;
+
+            break;
+
+            /* Debug option */
+            case 'd':
+
+                /* Show the output of the policies */
+                options->debug = 1;
+
+            break;
+
+            /* Unknown option */
+            default:
+
+                /* Show usage */
+                valid = 0;
+
+            break;
+        }
+    }
+
+    /* Ensure single argument for time interval passed in and it's a valid time */
+    valid = ((valid) && (optind == (bench_argc - 1)) &&
+             (interval_parse((const char *)argv[optind], &options->interval_ms) == EXIT_SUCCESS));
+
+    /* Check if parameters valid so far */
+    if (valid)
+    {
+        /* Get the VCPU scheduler options (up to the memory coordinator options if they follow) */
+        index = (cpu_index ? (((mem_index > cpu_index) ? mem_index : argc) - cpu_index) : 0);
+        cpu_argv = bench_policy_argv(index, &argv[cpu_index], BENCH_CPU_ARG);
+
+        /* Get the memory coordinator options (up to the VCPU scheduler options if they follow) */
+        index = (mem_index ? (((cpu_index > mem_index) ? cpu_index : argc) - mem_index) : 0);
+        mem_argv = bench_policy_argv(index, &argv[mem_index], BENCH_MEM_ARG);
+
+        /* Ensure options allocated */
+        valid = ((cpu_argv != NULL) && (mem_argv != NULL));
+    }
+
+    /* Check if parameters valid so far */
+    if (valid)
+    {
+        /* Count the options of each policy */
+        for (cpu_argc = 0; cpu_argv[cpu_argc] != NULL; cpu_argc++);
+        for (mem_argc = 0; mem_argv[mem_argc] != NULL; mem_argc++);
+
+        /* Parse the VCPU scheduler options with the policy argument in place of the program name
+           NOTE:  optind of 0 restarts the scan on a new parameter list */
+        optind = 0;
+        valid = ((vcpu_policy_options(cpu_argc, cpu_argv)) && (optind == cpu_argc));
+    }
+
+    /* Check if VCPU scheduler options valid */
+    if (valid)
+    {
+        /* Parse the memory coordinator options */
+        optind = 0;
+        valid = ((mem_policy_options(mem_argc, mem_argv)) && (optind == mem_argc));
+    }
+
+    /* Return if parameters are valid to caller */
+    return (valid);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_range_parse
+*
+*   DESCRIPTION
+*
+*       Converts a range given as <min>,<max> (or a single value)
+*
+*   INPUTS
+*
+*       text                                Range given
+*       min                                 Pointer to return minimum
+*       max                                 Pointer to return maximum
+*
+*   OUTPUTS
+*
+*       1                                   Range valid
+*       0                                   Range invalid
+*
+*************************************************************************/
+static int  bench_range_parse(const char * text, int * min, int * max)
+{
+    const char *    comma = strchr(text, ',');
+
+
+    /* Get minimum and maximum (the same if a single value) */
+    *min = atoi(text);
+    *max = (comma != NULL ? atoi(comma + 1) : *min);
+
+    /* Return if range is valid to caller */
+    return ((*min > 0) && (*max >= *min));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_policy_argv
+*
+*   DESCRIPTION
+*
+*       Makes the option list of a policy - the options given (if any)
+*       followed by "-j 0" so the policy uses no workers
+*
+*   INPUTS
+*
+*       argc                                Number of options given
+*                                           (0 = none, including the
+*                                           policy argument)
+*       argv                                Options given
+*       name                                Policy argument
+*
+*   OUTPUTS
+*
+*       char **                             Option list (NULL terminated,
+*                                           NULL on allocation error)
+*
+*************************************************************************/
+static char ** bench_policy_argv(int argc, char ** argv, const char * name)
+{
+    int         index;
+    char **     list = calloc(argc + 4, sizeof(char *));
+
+
+    /* Check if allocated */
+    if (list != NULL)
+    {
+        /* Policy argument in place of the program name */
+        list[0] = (char *)name;
+
+        /* Loop through each option given after the policy argument */
+        for (index = 1; index < argc; index++)
+        {
+            /* Copy option */
+            list[index] = argv[index];
+        }
+
+        /* No workers - the simulated host isn't thread safe */
+        index = (argc ? argc : 1);
+        list[index++] = "-j";
+        list[index++] = "0";
+    }
+
+    /* Return list to caller */
+    return (list);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_config
+*
+*   DESCRIPTION
+*
+*       Runs a configuration in its own process - the policies keep their
+*       state in static variables, so each configuration starts them from
+*       scratch in a new process and sends its result back over a pipe
+*
+*   INPUTS
+*
+*       options                             Benchmark options
+*       num_domains                         Domains of the configuration
+*       num_pcpus                           PCPUs of the configuration
+*       result                              Result of the configuration
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Configuration run
+*       Others                              Error running configuration
+*
+*************************************************************************/
+static int  bench_config(const BENCH_OPTIONS * options, int num_domains, int num_pcpus, BENCH_RESULT * result)
+{
+    int         pipe_fds[2], null_fd, child_status, status = EXIT_SUCCESS;
+    ssize_t     num_bytes = 0, num_read = 1;
+    pid_t       pid;
+
+
+    /* No result yet */
+    memset(result, 0, sizeof(*result));
+
+    /* Write out anything buffered so the child doesn't write it again */
+    fflush(stdout);
+
+    /* Create pipe for the result and start the child */
+    if (pipe(pipe_fds) != 0)
+    {
+        /* Set error status */
+        status = BENCH_FORK_ERROR;
+    }
+    else if ((pid = fork()) < 0)
+    {
+        /* Set error status */
+        status = BENCH_FORK_ERROR;
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+    }
+    else if (pid == 0)
+    {
+        /* Check if output of the policies is hidden */
+        close(pipe_fds[0]);
+        if ((!options->debug) && ((null_fd = open("/dev/null", O_WRONLY)) >= 0))
+        {
+            /* Send the policies' output to nowhere */
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+
+        /* Set up the simulated host, run the configuration and send the result to the parent */
+        result->status = bench_host_init(options, num_domains, num_pcpus);
+        result->status = (result->status == EXIT_SUCCESS ? bench_config_run(options, result) : result->status);
+        replay_host_free();
+        num_bytes = write(pipe_fds[1], result, sizeof(*result));
+
+        /* Done with the child */
+        _exit((num_bytes == sizeof(*result)) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    else
+    {
+        /* Read the result until all of it is read or the child is gone */
+        close(pipe_fds[1]);
+        while ((num_bytes < (ssize_t)sizeof(*result)) && (num_read > 0))
+        {
+            num_read = read(pipe_fds[0], (char *)result + num_bytes, sizeof(*result) - num_bytes);
+            num_bytes += (num_read > 0 ? num_read : 0);
+        }
+        close(pipe_fds[0]);
+
+        /* Wait for the child to end */
+        waitpid(pid, &child_status, 0);
+
+        /* Check if the whole result was read */
+        if (num_bytes != sizeof(*result))
+        {
+            /* Child crashed (the result may be partly read) */
+            memset(result, 0, sizeof(*result));
+            status = BENCH_CRASH_ERROR;
+        }
+        else
+        {
+            /* Use status of the configuration */
+            status = result->status;
+        }
+    }
+
+    /* Return status to caller (the configuration is named even if it failed) */
+    result->status = status;
+    result->num_domains = num_domains;
+    result->num_pcpus = num_pcpus;
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_host_init
+*
+*   DESCRIPTION
+*
+*       Sets up the simulated host of a configuration - every domain has
+*       the same VCPUs, each starting with a random demand, and the same
+*       balloon, starting with a random memory use.  Each cycle
+*       BENCH_CHANGE_PERCENT % of the VCPUs change their demand and of
+*       the VMs change their memory use, so both policies keep having
+*       work to do.  The host has room for the balloons
+*
+*   INPUTS
+*
+*       options                             Benchmark options
+*       num_domains                         Domains of the configuration
+*       num_pcpus                           PCPUs of the configuration
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Host set up
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+static int  bench_host_init(const BENCH_OPTIONS * options, int num_domains, int num_pcpus)
+{
+    int             index, vcpu, sample, status;
+    int             num_vcpus = (options->vcpus < num_pcpus ? options->vcpus : num_pcpus);
+    unsigned int    state = options->seed;
+    char            name[REPLAY_NAME_LEN];
+    REPLAY_VM *     vm;
+
+
+    /* Allocate the host with a sample of every cycle (and startup) */
+    status = replay_host_init(num_pcpus, num_domains, options->warmup_cycles + options->num_cycles + 1);
+    snprintf(replay_host.name, sizeof(replay_host.name), "bench-%d-%d", num_domains, num_pcpus);
+    replay_host.num_cycles = options->warmup_cycles + options->num_cycles;
+    replay_host.host_used = REPLAY_HOST_MEM_USED;
+    replay_host.host_mem = REPLAY_HOST_MEM_USED + (num_domains * (REPLAY_VM_MEM_START + REPLAY_HOST_MEM_PER_VM));
+
+    /* Loop through each VM while no errors */
+    for (index = 0; (status == EXIT_SUCCESS) && (index < num_domains); index++)
+    {
+        /* Allocate the VM */
+        vm = &replay_host.vms[index];
+        snprintf(name, sizeof(name), "vm%d", index);
+        status = replay_vm_init(vm, name, num_vcpus);
+
+        /* Check if allocated */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Set memory of the VM and what it uses to start with (20% - 100% of the maximum) */
+            vm->mem_max = REPLAY_VM_MEM_MAX;
+            vm->balloon = REPLAY_VM_MEM_START;
+            vm->used[0] = (vm->mem_max * (20 + (rand_r(&state) % 81))) / 100;
+
+            /* Set demand of each VCPU to start with */
+            for (vcpu = 0; vcpu < num_vcpus; vcpu++)
+            {
+                vm->demand[vcpu] = rand_r(&state) % 101;
+            }
+
+            /* Loop through each sample after startup */
+            for (sample = 1; sample < replay_host.num_samples; sample++)
+            {
+                /* Change memory use of some VMs (keep the rest) */
+                vm->used[sample] = (((rand_r(&state) % 100) < BENCH_CHANGE_PERCENT) ?
+                                    (vm->mem_max * (20 + (rand_r(&state) % 81))) / 100 : vm->used[sample - 1]);
+
+                /* Change demand of some VCPUs (keep the rest) */
+                for (vcpu = 0; vcpu < num_vcpus; vcpu++)
+                {
+                    vm->demand[(sample * num_vcpus) + vcpu] = (((rand_r(&state) % 100) < BENCH_CHANGE_PERCENT) ?
+                                                               (int)(rand_r(&state) % 101) :
+                                                               vm->demand[((sample - 1) * num_vcpus) + vcpu]);
+                }
+            }
+        }
+    }
+
+    /* Start the host */
+    status = (status == EXIT_SUCCESS ? replay_host_start() : status);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_config_run
+*
+*   DESCRIPTION
+*
+*       Runs the cycles of a configuration and works out the time of
+*       each phase and the allocations made from the samples
+*
+*   INPUTS
+*
+*       options                             Benchmark options
+*       result                              Result of the configuration
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Configuration run
+*       Others                              Error running configuration
+*
+*************************************************************************/
+static int  bench_config_run(const BENCH_OPTIONS * options, BENCH_RESULT * result)
+{
+    int             index, status;
+    BENCH_SAMPLES   samples[BENCH_MAX_PHASES];
+
+
+    /* Allocate the samples of each phase */
+    memset(samples, 0, sizeof(samples));
+    status = EXIT_SUCCESS;
+    for (index = 0; index < BENCH_MAX_PHASES; index++)
+    {
+        samples[index].ns = calloc(options->num_cycles, sizeof(unsigned long long));
+        status = (samples[index].ns != NULL ? status : BENCH_NOMEM);
+    }
+
+    /* Run the cycles and work out the results from the samples */
+    status = (status == EXIT_SUCCESS ? bench_run(options, samples, result) : status);
+    if (status == EXIT_SUCCESS)
+    {
+        bench_phases_result(samples, options->num_cycles, result);
+    }
+
+    /* Free the samples */
+    for (index = 0; index < BENCH_MAX_PHASES; index++)
+    {
+        free(samples[index].ns);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_run
+*
+*   DESCRIPTION
+*
+*       Runs the policies on the simulated host as the resource manager
+*       does and samples each timed cycle:  the shared stats snapshot,
+*       each phase of each policy cycle (as timed by the policy), each
+*       policy cycle as a whole and the cycle as a whole (including
+*       freeing the snapshot).  Allocations are counted around the
+*       snapshot, each policy cycle and the whole cycle, less those made
+*       by the simulated hypervisor.  Stepping resizes between cycles
+*       isn't timed - it is where the simulated host runs
+*
+*   INPUTS
+*
+*       options                             Benchmark options
+*       samples                             Samples of each phase
+*       result                              Result of the configuration
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Cycles run
+*       Others                              Error from a policy
+*
+*************************************************************************/
+static int  bench_run(const BENCH_OPTIONS * options, BENCH_SAMPLES * samples, BENCH_RESULT * result)
+{
+    int                         index, cycle, phase, num_phases, sample, busy = 0, status = EXIT_SUCCESS;
+    int                         migrations = 0, resizes = 0;
+    unsigned long long          start, now, cycle_start;
+    unsigned long long          allocs, bytes, cycle_allocs, cycle_bytes;
+    const char * const *        names;
+    const unsigned long long *  phase_ns;
+    virConnectPtr               conn = virConnectOpen(NULL);
+    INTERVAL                    interval;
+    POLICY_SNAPSHOT             snapshot;
+
+
+    /* Start timing cycles on the simulated clock */
+    interval_init(&interval, options->interval_ms, 0, 0);
+
+    /* Initialize the policies benchmarked and name their phases */
+    status = ((options->policies & BENCH_POLICY_CPU) ? vcpu_policy_init(conn) : EXIT_SUCCESS);
+    status = ((status == EXIT_SUCCESS) && (options->policies & BENCH_POLICY_MEM) ? mem_policy_init(conn) : status);
+    status = (status == EXIT_SUCCESS ? bench_phases_name(options, result) : status);
+
+    /* Loop through each VM while no errors */
+    for (index = 0; (status == EXIT_SUCCESS) && (index < replay_host.num_vms); index++)
+    {
+        /* Add VM to the policies (placing its VCPUs isn't a migration) */
+        replay_host.adding = 1;
+        status = ((options->policies & BENCH_POLICY_CPU) ? vcpu_policy_domain_event(DOMAIN_EVENT_ADDED, &replay_host.vms[index]) : status);
+        status = ((status == EXIT_SUCCESS) && (options->policies & BENCH_POLICY_MEM) ?
+                  mem_policy_domain_event(DOMAIN_EVENT_ADDED, &replay_host.vms[index]) : status);
+        replay_host.adding = 0;
+    }
+
+    /* Loop through each cycle while no errors */
+    for (cycle = 1; (status == EXIT_SUCCESS) && (cycle <= replay_host.num_cycles); cycle++)
+    {
+        /* Start the cycle, step resizes still in progress and run the host until the end of the cycle */
+        replay_cycle_start(cycle);
+        status = ((options->policies & BENCH_POLICY_MEM) ? mem_policy_idle(interval_next(&interval)) : status);
+        interval_wait(&interval);
+
+        /* Get sample of this cycle (-1 = warming up) */
+        sample = cycle - options->warmup_cycles - 1;
+
+        /* Check if first cycle timed */
+        if (sample == 0)
+        {
+            /* Count repins / resizes from here */
+            migrations = replay_host.num_migrations;
+            resizes = replay_host.num_resizes;
+        }
+
+        /* Get VCPU and balloon stats for all running VMs in one call */
+        bench_span_start(&cycle_allocs, &cycle_bytes);
+        bench_span_start(&allocs, &bytes);
+        cycle_start = interval_clock();
+        memset(&snapshot, 0, sizeof(snapshot));
+        snapshot.num_records = virConnectGetAllDomainStats(conn, VIR_DOMAIN_STATS_VCPU | VIR_DOMAIN_STATS_BALLOON,
+                                                           &snapshot.records, VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE);
+        snapshot.now = interval_now();
+        snapshot.interval_ms = interval.interval_ms;
+        now = interval_clock();
+        phase = BENCH_PHASE_STATS;
+
+        /* Check if sampled */
+        if (sample >= 0)
+        {
+            /* Save time and allocations of the snapshot */
+            samples[phase].ns[sample] = now - cycle_start;
+            bench_span_end(&samples[phase], allocs, bytes);
+        }
+        phase++;
+
+        /* Check if stats records not obtained */
+        if (snapshot.num_records < 0)
+        {
+            /* Set stats error */
+            status = BENCH_STATS_ERROR;
+            snapshot.records = NULL;
+        }
+
+        /* Check if VCPU scheduler benchmarked */
+        if ((status == EXIT_SUCCESS) && (options->policies & BENCH_POLICY_CPU))
+        {
+            /* Adjust VCPU pinning */
+            bench_span_start(&allocs, &bytes);
+            start = interval_clock();
+            status = vcpu_policy_cycle(&snapshot, &busy);
+            now = interval_clock();
+            snapshot.cpu_saturated = vcpu_policy_cpu_saturated;
+            num_phases = vcpu_policy_phases(&names, &phase_ns);
+
+            /* Loop through each phase of the VCPU scheduler and then the cycle as a whole */
+            for (index = 0; index <= num_phases; index++, phase++)
+            {
+                /* Save time of the phase (if sampled) */
+                if (sample >= 0)
+                {
+                    samples[phase].ns[sample] = (index < num_phases ? phase_ns[index] : now - start);
+                }
+            }
+
+            /* Save allocations of the cycle (if sampled) */
+            if (sample >= 0)
+            {
+                bench_span_end(&samples[phase - 1], allocs, bytes);
+            }
+        }
+
+        /* Check if memory coordinator benchmarked */
+        if ((status == EXIT_SUCCESS) && (options->policies & BENCH_POLICY_MEM))
+        {
+            /* Adjust VM memory */
+            bench_span_start(&allocs, &bytes);
+            start = interval_clock();
+            status = mem_policy_cycle(&snapshot, &busy);
+            now = interval_clock();
+            num_phases = mem_policy_phases(&names, &phase_ns);
+
+            /* Loop through each phase of the memory coordinator and then the cycle as a whole */
+            for (index = 0; index <= num_phases; index++, phase++)
+            {
+                /* Save time of the phase (if sampled) */
+                if (sample >= 0)
+                {
+                    samples[phase].ns[sample] = (index < num_phases ? phase_ns[index] : now - start);
+                }
+            }
+
+            /* Save allocations of the cycle (if sampled) */
+            if (sample >= 0)
+            {
+                bench_span_end(&samples[phase - 1], allocs, bytes);
+            }
+        }
+
+        /* Free the records (if any) */
+        if (snapshot.records != NULL)
+        {
+            virDomainStatsRecordListFree(snapshot.records);
+        }
+
+        /* Save time and allocations of the whole cycle (if sampled) */
+        if (sample >= 0)
+        {
+            samples[phase].ns[sample] = interval_clock() - cycle_start;
+            bench_span_end(&samples[phase], cycle_allocs, cycle_bytes);
+        }
+    }
+
+    /* De-initialize the policies benchmarked */
+    if (options->policies & BENCH_POLICY_MEM)
+    {
+        mem_policy_deinit();
+    }
+    if (options->policies & BENCH_POLICY_CPU)
+    {
+        vcpu_policy_deinit();
+    }
+    virConnectClose(conn);
+
+    /* Save configuration and repins / resizes made over the cycles timed */
+    result->num_vcpus = replay_host.num_vcpus;
+    result->num_migrations = replay_host.num_migrations - migrations;
+    result->num_resizes = replay_host.num_resizes - resizes;
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_phases_name
+*
+*   DESCRIPTION
+*
+*       Names the phases timed in the order bench_run samples them - the
+*       stats snapshot, then each phase of each policy benchmarked
+*       followed by its whole cycle, and the whole cycle last.
+*       Allocations are only counted for the snapshot and the whole
+*       cycles
+*
+*   INPUTS
+*
+*       options                             Benchmark options
+*       result                              Result to name phases of
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Phases named
+*       BENCH_NOMEM                         More phases than room
+*
+*************************************************************************/
+static int  bench_phases_name(const BENCH_OPTIONS * options, BENCH_RESULT * result)
+{
+    int                         index, num_cpu = -1, num_mem = -1, status = EXIT_SUCCESS;
+    const char * const *        cpu_names;
+    const char * const *        mem_names;
+    const unsigned long long *  phase_ns;
+
+
+    /* Get phases of each policy benchmarked (-1 = not benchmarked) */
+    num_cpu = ((options->policies & BENCH_POLICY_CPU) ? vcpu_policy_phases(&cpu_names, &phase_ns) : num_cpu);
+    num_mem = ((options->policies & BENCH_POLICY_MEM) ? mem_policy_phases(&mem_names, &phase_ns) : num_mem);
+
+    /* Ensure the snapshot, the phases and whole cycle of each policy and the whole cycle fit */
+    if ((1 + (num_cpu + 1) + (num_mem + 1) + 1) > BENCH_MAX_PHASES)
+    {
+        /* No room */
+        status = BENCH_NOMEM;
+    }
+    else
+    {
+        /* Shared stats snapshot first */
+        snprintf(result->phases[result->num_phases].name, BENCH_NAME_LEN, "stats");
+        result->phases[result->num_phases++].counted = 1;
+
+        /* Loop through each phase of the VCPU scheduler and then its whole cycle (if benchmarked) */
+        for (index = 0; index <= num_cpu; index++)
+        {
+            snprintf(result->phases[result->num_phases].name, BENCH_NAME_LEN, "cpu.%s", (index < num_cpu ? cpu_names[index] : "cycle"));
+            result->phases[result->num_phases++].counted = (index == num_cpu);
+        }
+
+        /* Loop through each phase of the memory coordinator and then its whole cycle (if benchmarked) */
+        for (index = 0; index <= num_mem; index++)
+        {
+            snprintf(result->phases[result->num_phases].name, BENCH_NAME_LEN, "mem.%s", (index < num_mem ? mem_names[index] : "cycle"));
+            result->phases[result->num_phases++].counted = (index == num_mem);
+        }
+
+        /* Whole cycle last */
+        snprintf(result->phases[result->num_phases].name, BENCH_NAME_LEN, "cycle");
+        result->phases[result->num_phases++].counted = 1;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_span_start
+*
+*   DESCRIPTION
+*
+*       Starts counting the allocations of a span - the allocations of
+*       the process so far less those made by the simulated hypervisor
+*
+*   INPUTS
+*
+*       allocs                              Pointer to return allocations
+*       bytes                               Pointer to return bytes
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void bench_span_start(unsigned long long * allocs, unsigned long long * bytes)
+{
+    /* Return allocations so far not made by the simulated hypervisor */
+    *allocs = bench_allocs - replay_host.num_allocs;
+    *bytes = bench_bytes - replay_host.alloc_bytes;
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_span_end
+*
+*   DESCRIPTION
+*
+*       Adds the allocations made since a span started to the samples of
+*       a phase
+*
+*   INPUTS
+*
+*       samples                             Samples of the phase
+*       allocs                              Allocations at span start
+*       bytes                               Bytes at span start
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void bench_span_end(BENCH_SAMPLES * samples, unsigned long long allocs, unsigned long long bytes)
+{
+    /* Add allocations made in the span */
+    samples->allocs += (bench_allocs - replay_host.num_allocs) - allocs;
+    samples->alloc_bytes += (bench_bytes - replay_host.alloc_bytes) - bytes;
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_phases_result
+*
+*   DESCRIPTION
+*
+*       Works out the median, 99th percentile and longest time of each
+*       phase and its allocations per cycle from its samples
+*
+*   INPUTS
+*
+*       samples                             Samples of each phase
+*       num_cycles                          Cycles sampled
+*       result                              Result of the configuration
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void bench_phases_result(BENCH_SAMPLES * samples, int num_cycles, BENCH_RESULT * result)
+{
+    int             index;
+    BENCH_PHASE *   phase;
+
+
+    /* Loop through each phase named */
+    for (index = 0; index < result->num_phases; index++)
+    {
+        /* Sort times of the phase */
+        phase = &result->phases[index];
+        qsort(samples[index].ns, num_cycles, sizeof(unsigned long long), bench_ull_compare);
+
+        /* Get percentiles and longest time */
+        phase->p50_ns = samples[index].ns[num_cycles / 2];
+        phase->p99_ns = samples[index].ns[((num_cycles * 99) / 100 < num_cycles ? (num_cycles * 99) / 100 : num_cycles - 1)];
+        phase->max_ns = samples[index].ns[num_cycles - 1];
+
+        /* Get allocations per cycle */
+        phase->allocs = (double)samples[index].allocs / num_cycles;
+        phase->alloc_kb = ((double)samples[index].alloc_bytes / 1024) / num_cycles;
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_result_print
+*
+*   DESCRIPTION
+*
+*       Prints a row for each phase of a configuration.  Allocations of
+*       a phase they aren't counted for are shown as "-", and the repins
+*       / resizes made over the cycles timed are shown on the row of the
+*       whole cycle
+*
+*   INPUTS
+*
+*       options                             Benchmark options
+*       result                              Result of the configuration
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void bench_result_print(const BENCH_OPTIONS * options, const BENCH_RESULT * result)
+{
+    int                 index;
+    char                allocs[32], alloc_kb[32], repins[32], resizes[32];
+    const BENCH_PHASE * phase;
+
+
+    /* Check if configuration failed */
+    if (result->status != EXIT_SUCCESS)
+    {
+        /* Print error */
+        printf((options->csv ? "%d,%d,,error %d,,,,,,,\n" : "%7d %5d      - error %d\n"),
+               result->num_domains, result->num_pcpus, result->status);
+    }
+
+    /* Loop through each phase (none if failed) */
+    for (index = 0; (result->status == EXIT_SUCCESS) && (index < result->num_phases); index++)
+    {
+        /* Format allocations (if counted) */
+        phase = &result->phases[index];
+        snprintf(allocs, sizeof(allocs), (phase->counted ? "%.1f" : "-"), phase->allocs);
+        snprintf(alloc_kb, sizeof(alloc_kb), (phase->counted ? "%.1f" : "-"), phase->alloc_kb);
+
+        /* Format repins / resizes (whole cycle only) */
+        snprintf(repins, sizeof(repins), ((index == (result->num_phases - 1)) ? "%d" : "-"), result->num_migrations);
+        snprintf(resizes, sizeof(resizes), ((index == (result->num_phases - 1)) ? "%d" : "-"), result->num_resizes);
+
+        /* Print row */
+        printf((options->csv ? "%d,%d,%d,%s,%.1f,%.1f,%.1f,%s,%s,%s,%s\n" : "%7d %5d %6d %-18s %10.1f %10.1f %10.1f %10s %10s %7s %7s\n"),
+               result->num_domains, result->num_pcpus, result->num_vcpus, phase->name,
+               (double)phase->p50_ns / BENCH_NSECS_PER_USEC, (double)phase->p99_ns / BENCH_NSECS_PER_USEC,
+               (double)phase->max_ns / BENCH_NSECS_PER_USEC, allocs, alloc_kb, repins, resizes);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_budget
+*
+*   DESCRIPTION
+*
+*       Prints, for each PCPU count, the most domains whose whole cycle
+*       (p99) took at most the budget % of the interval - the scaling
+*       limit of the control loop on a host of that size
+*
+*   INPUTS
+*
+*       options                             Benchmark options
+*       results                             Results of each configuration
+*       num_results                         Number of results
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void bench_budget(const BENCH_OPTIONS * options, const BENCH_RESULT * results, int num_results)
+{
+    int                 index, limit_index, first = 0;
+    unsigned long long  budget_ns = (options->interval_ms * INTERVAL_NSECS_PER_MSEC * options->budget_percent) / 100;
+    const BENCH_PHASE * cycle;
+
+
+    /* Print heading */
+    printf("\nMost domains with a cycle p99 within %d%% of the %u ms interval:\n", options->budget_percent, options->interval_ms);
+
+    /* Loop through each PCPU count (results are grouped by PCPUs) */
+    while (first < num_results)
+    {
+        /* Loop through each result of this PCPU count keeping the last one within budget */
+        limit_index = -1;
+        for (index = first; (index < num_results) && (results[index].num_pcpus == results[first].num_pcpus); index++)
+        {
+            /* Check if configuration ran and its cycle (the last phase) is within budget */
+            cycle = &results[index].phases[results[index].num_phases - 1];
+            limit_index = (((results[index].status == EXIT_SUCCESS) && (results[index].num_phases) &&
+                            (cycle->p99_ns <= budget_ns)) ? index : limit_index);
+        }
+
+        /* Print most domains within budget (if any) */
+        if (limit_index >= 0)
+        {
+            printf("    %5d PCPUs:  %d domains (cycle p99 %.1f us)%s\n", results[first].num_pcpus, results[limit_index].num_domains,
+                   (double)results[limit_index].phases[results[limit_index].num_phases - 1].p99_ns / BENCH_NSECS_PER_USEC,
+                   ((limit_index == (index - 1)) ? " - all sizes run" : ""));
+        }
+        else
+        {
+            printf("    %5d PCPUs:  none\n", results[first].num_pcpus);
+        }
+
+        /* Move to next PCPU count */
+        first = index;
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bench_ull_compare
+*
+*   DESCRIPTION
+*
+*       Compares two times for qsort (ascending)
+*
+*   INPUTS
+*
+*       a                                   Pointer to first time
+*       b                                   Pointer to second time
+*
+*   OUTPUTS
+*
+*       <0, 0, >0                           a is less, equal or greater
+*
+*************************************************************************/
+static int  bench_ull_compare(const void * a, const void * b)
+{
+    /* Return comparison */
+    return ((*(const unsigned long long *)a > *(const unsigned long long *)b) -
+            (*(const unsigned long long *)a < *(const unsigned long long *)b));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       __wrap_malloc / __wrap_calloc / __wrap_realloc
+*
+*   DESCRIPTION
+*
+*       Count each allocation of the process and its bytes before making
+*       it (calls to malloc, calloc and realloc are sent here by the
+*       linker, see the Makefile).  Allocations made inside the C library
+*       (ie by strdup) aren't seen
+*
+*   INPUTS
+*
+*       ptr                                 Memory to resize (realloc)
+*       num                                 Number of elements (calloc)
+*       size                                Size to allocate
+*
+*   OUTPUTS
+*
+*       void *                              Memory allocated
+*
+*************************************************************************/
+void * __wrap_malloc(size_t size)
+{
+    /* Count allocation and allocate */
+    bench_allocs++;
+    bench_bytes += size;
+    return (__real_malloc(size));
+}
+
+void * __wrap_calloc(size_t num, size_t size)
+{
+    /* Count allocation and allocate */
+    bench_allocs++;
+    bench_bytes += (num * size);
+    return (__real_calloc(num, size));
+}
+
+void * __wrap_realloc(void * ptr, size_t size)
+{
+    /* Count allocation and resize */
+    bench_allocs++;
+    bench_bytes += size;
+    return (__real_realloc(ptr, size));
+}
@@ -0,0 +1,118 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains Benchmark macros, definitions, and structures
+*       used to time the phases of the VCPU scheduler and memory
+*       coordinator cycles on the simulated host of the replay engine
+*       (../Replay) over a range of domain and PCPU counts
+*
+***********************************************************************/
+#ifndef BENCH_DEFS_H
+#define BENCH_DEFS_H
+
+#include <stddef.h>
+#include <libvirt/libvirt.h>
+#include "interval_defs.h"
+#include "policy_defs.h"
+#include "replay_defs.h"
+
+/* Policy arguments - the parameters after each are the options of that policy */
+#define BENCH_CPU_ARG                       "--cpu"
+#define BENCH_MEM_ARG                       "--mem"
+
+/* Define policies benchmarked */
+#define BENCH_POLICY_CPU                    0x01
+#define BENCH_POLICY_MEM                    0x02
+
+/* Range of domains and PCPUs swept (doubling from the minimum to the maximum) */
+#define BENCH_MIN_DOMAINS                   4
+#define BENCH_MAX_DOMAINS                   512
+#define BENCH_MIN_PCPUS                     8
+#define BENCH_MAX_PCPUS                     256
+
+/* VCPUs per domain */
+#define BENCH_VCPUS                         2
+
+/* Cycles timed per configuration and cycles run before timing starts (VMs being placed) */
+#define BENCH_CYCLES                        100
+#define BENCH_WARMUP_CYCLES                 5
+
+/* % of VCPUs changing their demand / VMs changing their memory use each cycle */
+#define BENCH_CHANGE_PERCENT                10
+
+/* % of the interval a cycle (p99) may take to be within budget */
+#define BENCH_BUDGET_PERCENT                10
+
+/* Nanoseconds per microsecond (times are printed in microseconds) */
+#define BENCH_NSECS_PER_USEC                1000.0
+
+/* Maximum length of a phase name */
+#define BENCH_NAME_LEN                      32
+
+/* Define phases timed (policy phases as named by vcpu_policy_phases / mem_policy_phases) */
+#define BENCH_PHASE_STATS                   0       /* virConnectGetAllDomainStats shared by both policies */
+#define BENCH_MAX_PHASES                    12
+
+/* Define error codes */
+#define BENCH_NOMEM                         -1
+#define BENCH_FORK_ERROR                    -2
+#define BENCH_CRASH_ERROR                   -3
+#define BENCH_STATS_ERROR                   -4
+
+/* Structure for the timing of a phase over the cycles timed */
+typedef struct BENCH_PHASE_STRUCT
+{
+    char                name[BENCH_NAME_LEN];
+    unsigned long long  p50_ns;         /* Median time */
+    unsigned long long  p99_ns;         /* 99th percentile time */
+    unsigned long long  max_ns;         /* Longest time */
+    int                 counted;        /* Non-zero if allocations are counted for the phase */
+    double              allocs;         /* Allocations per cycle */
+    double              alloc_kb;       /* KB allocated per cycle */
+
+} BENCH_PHASE;
+
+/* Structure for the result of a configuration (sent from the child process running it) */
+typedef struct BENCH_RESULT_STRUCT
+{
+    int                 status;
+    int                 num_domains;
+    int                 num_pcpus;
+    int                 num_vcpus;      /* VCPUs of all domains */
+    int                 num_phases;
+    BENCH_PHASE         phases[BENCH_MAX_PHASES];
+    int                 num_migrations; /* VCPUs repinned over the cycles timed */
+    int                 num_resizes;    /* Balloon resizes made over the cycles timed */
+
+} BENCH_RESULT;
+
+/* Structure for the command-line options */
+typedef struct BENCH_OPTIONS_STRUCT
+{
+    unsigned int        interval_ms;    /* Simulated interval between cycles */
+    int                 min_domains;
+    int                 max_domains;
+    int                 min_pcpus;
+    int                 max_pcpus;
+    int                 vcpus;          /* VCPUs per domain (at most the PCPUs) */
+    int                 num_cycles;     /* Cycles timed */
+    int                 warmup_cycles;  /* Cycles run before timing */
+    int                 budget_percent; /* % of the interval a cycle may take */
+    unsigned int        seed;
+    int                 policies;       /* BENCH_POLICY_xxx */
+    int                 csv;            /* Non-zero to print comma separated values */
+    int                 debug;          /* Non-zero to show the output of the policies */
+
+} BENCH_OPTIONS;
+
+/* Structure for the samples of a phase being timed */
+typedef struct BENCH_SAMPLES_STRUCT
+{
+    unsigned long long *    ns;         /* Time of each cycle timed */
+    unsigned long long      allocs;     /* Allocations over the cycles timed */
+    unsigned long long      alloc_bytes; /* Bytes allocated over the cycles timed */
+
+} BENCH_SAMPLES;
+
+#endif /* BENCH_DEFS_H */
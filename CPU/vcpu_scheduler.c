@@ -9,7 +9,13 @@
 *   FUNCTIONS
 *
 *       main
-*       vcpu_schedule
+*       vcpu_policy_options
+*       vcpu_policy_init
+*       vcpu_policy_domain_event
+*       vcpu_policy_cycle
+*       vcpu_policy_cpu_saturated
+*       vcpu_policy_cpu_nodes
+*       vcpu_policy_deinit
 *
 ***********************************************************************/
 
@@ -17,6 +23,7 @@
 /* INCLUDE FILES             */
 /*****************************/
 #include <stdlib.h>
+#include <limits.h>
 #include <string.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -27,16 +34,72 @@
 /*****************************/
 /* LOCAL FUNCTION PROTOTYPES */
 /*****************************/
-static int  scheduler(unsigned int cycle_time);
-static int  collect_pcpu_stats(unsigned long long ns_cycle_time);
-static int  collect_vcpu_stats(unsigned long long ns_cycle_time);
-static int  virt_init(void);
+#ifndef RESOURCE_MANAGER
+static int  scheduler(unsigned int interval_ms);
+#endif  /* RESOURCE_MANAGER */
+static int  scheduler_cycle(int * busy);
+static int  collect_pcpu_stats(void);
+static int  collect_vcpu_stats(void);
+static int  collect_vcpu_stats_domain(void);
+#if (VCPU_SCHEDULER_BULK_STATS == 1)
+static int  collect_vcpu_stats_bulk(void);
+static void collect_vcpu_stats_records(virDomainStatsRecordPtr * records, int num_records, unsigned long long now);
+static DOMAIN_STATS * domain_stats_find(unsigned int dom_id, int hint);
+#endif  /* (VCPU_SCHEDULER_BULK_STATS == 1) */
+static void vcpu_stats_update(VCPU_STATS * vcpu, unsigned long long cpu_time,
+                              unsigned long long now);
+static int  virt_init(virConnectPtr conn);
+static int  sched_config_load(void);
+static void domain_config_apply(DOMAIN_STATS * domain);
 static int  pcpu_stats_init(void);
+static int  topology_init(void);
+static void topology_parse_cpus(const char * caps);
+static int  topology_parse_caches(const char * caps);
+static int  topology_link_siblings(void);
+static int  pcpu_core_idle(PCPU_STATS * pcpu, int use_plan);
+static int  topology_idle_core(int use_plan);
+static int  pcpu_placement_cost(PCPU_STATS * src, PCPU_STATS * dst, int idle_core, int use_plan);
 static int  vcpu_stats_init(void);
+static int  domain_stats_add(virDomainPtr domain);
+static void domain_stats_remove(DOMAIN_STATS * domain);
+static DOMAIN_STATS * domain_stats_lookup(virDomainPtr domain);
+static void domain_stats_trace(DOMAIN_STATS * domain);
+static int  vcpu_table_build(void);
+static PCPU_STATS * pcpu_initial_select(VCPU_STATS * vcpu);
+#ifndef RESOURCE_MANAGER
+static int  domain_events_process(void);
+#endif  /* RESOURCE_MANAGER */
 static void vcpu_unpin_from_pcpu(VCPU_STATS * vcpu, PCPU_STATS * pcpu);
 static int  vcpu_pin_on_pcpu(VCPU_STATS * vcpu, PCPU_STATS * pcpu);
+static void vcpu_pin_update(VCPU_STATS * vcpu, PCPU_STATS * pcpu);
+static int  vcpu_repin(VCPU_STATS * vcpu, PCPU_STATS * pcpu);
+static int  vcpu_repin_wait(void);
 static int  vcpu_pinning_adjust(void);
+static int  vcpu_pinning_adjust_greedy(void);
+static void vcpu_table_index(void);
+static void vcpu_best_fit(int pcpu_high, int pcpu_low, int idle_core, int * best_slot, int * best_delta);
+static void vcpu_fit_check(int slot, int pcpu_high, int pcpu_low, int high_util, int delta,
+                           int * best_slot, int * best_delta);
+static int  vcpu_pinning_adjust_binpack(void);
+static int  vcpu_pinning_consolidate(void);
+static int  pcpu_drain_plan(int pcpu, int num_moves);
+static int  pcpu_drain_compare(const void * a, const void * b);
+static void pcpu_parked_update(void);
+static int  pcpu_parked_publish(void);
+static int  vcpu_util_compare(const void * a, const void * b);
+static int  vcpu_util_avg_compare(const void * a, const void * b);
+static int  pcpu_has_planned_sibling(int pcpu, int slot);
+static int  vcpu_migration_allowed(VCPU_STATS * vcpu, int src_util, int dst_util, int num_moves);
+static int  pcpu_has_sibling(PCPU_STATS * pcpu, VCPU_STATS * vcpu);
+static int  domain_sched_adjust(void);
+static int  domain_sched_contended(DOMAIN_STATS * domain, int threshold);
+static int  domain_sched_set(DOMAIN_STATS * domain, unsigned long long shares, long long quota);
+static void domain_sched_refused(DOMAIN_STATS * domain);
+static void domain_sched_restore(void);
 static void virt_deinit(void);
+static void render_scheduler_metrics(void);
+static void render_scheduler_monitor(void);
+static void render_scheduler_shm(void);
 static int  pcpu_get_idle(int num_params, unsigned long long * idle_time);
 #if (VCPU_SCHEDULER_DEBUG == 1)
 static void dump_scheduler_stats(void);
@@ -47,9 +110,30 @@ static void dump_scheduler_stats(void);
 /*****************************/
 static VIRT_INFO            virt_info;
 static PCPU_STATS *         pcpu_stats;
-static VCPU_STATS *         vcpu_stats;
+static const char *         phase_names[VCPU_SCHEDULER_NUM_PHASES] = {"collect_pcpu", "collect_vcpu", "adjust", "events"};
+static DOMAIN_STATS **      domain_stats;
+static const POLICY_SNAPSHOT * policy_snapshot; /* Stats snapshot shared by the resource manager this cycle (NULL = none) */
+static VCPU_SCHEDULER_CONFIG sched_config =
+{
+    .spread_siblings    = VCPU_SCHEDULER_SPREAD_SIBLINGS,
+    .engine             = VCPU_SCHEDULER_ENGINE,
+    .topology_aware     = VCPU_SCHEDULER_TOPOLOGY,
+    .util_weight        = VCPU_SCHEDULER_UTIL_WEIGHT,
+    .min_residency      = VCPU_SCHEDULER_MIN_RESIDENCY,
+    .migration_budget   = VCPU_SCHEDULER_MIGRATION_BUDGET,
+    .migration_penalty  = VCPU_SCHEDULER_MIGRATION_PENALTY,
+    .num_workers        = VCPU_SCHEDULER_WORKERS,
+    .metrics_port       = VCPU_SCHEDULER_METRICS_PORT,
+    .high_threshold     = VCPU_SCHEDULER_PCPU_HIGH_THRESHOLD,
+    .pcpu_target        = VCPU_SCHEDULER_PCPU_TGT,
+    .low_threshold      = VCPU_SCHEDULER_PCPU_LOW_THRESHOLD,
+    .priority_control   = VCPU_SCHEDULER_PRIORITY_CONTROL,
+    .batch_quota        = VCPU_SCHEDULER_BATCH_QUOTA,
+    .consolidate        = VCPU_SCHEDULER_CONSOLIDATE,
+};
 
 
+#ifndef RESOURCE_MANAGER
 /*************************************************************************
 *
 *   FUNCTION
@@ -74,33 +158,70 @@ static VCPU_STATS *         vcpu_stats;
 int main(int argc, char ** argv)
 {
     int                 status = EXIT_FAILURE;
-    int                 seconds = 0;
+    unsigned int        interval_ms = 0;
+    int                 valid;
+
 
+    /* Parse command-line options */
+    valid = vcpu_policy_options(argc, argv);
 
     /* Ensure single argument for time interval passed in */
-    if (argc == 2)
+    if ((valid) && (optind == (argc - 1)))
     {
-        /* Convert string time value into integer */
-        seconds = atoi((const char *)argv[1]);
+        /* Convert string time value (in seconds) into milliseconds */
+        if (interval_parse((const char *)argv[optind], &interval_ms) != EXIT_SUCCESS)
+        {
+            /* Malformed time - show usage */
+            interval_ms = 0;
+        }
     }
 
     /* Check if 1st parameter (time interval) is a valid number */
-    if (seconds == 0)
+    if (interval_ms == 0)
     {
         /* Print error / usage */
-        fprintf(stderr, "Usage:  %s <time interval>\n\r", argv[0]);
-        fprintf(stderr, "        where <time interval> = time, in seconds, between cycles.\n\r");
+        fprintf(stderr, "Usage:  %s [-e <greedy|binpack>] [-s <0|1>] [-t <0|1>] [-w <weight>] [-r <cycles>]\n\r", argv[0]);
+        fprintf(stderr, "        [-b <budget>] [-p <penalty>] [-a <min>,<max>] [-j <workers>] [-m <port>] [-c <file>] [-q <0|1>]\n\r");
+        fprintf(stderr, "        [-k <0|1>] [-f <file>] [-o <file>] [-u <socket>] [-z <name>] <time interval>\n\r");
+        fprintf(stderr, "        where <time interval> = time, in seconds, between cycles (ie 1, 0.25).\n\r");
+        fprintf(stderr, "              -e <engine>     = rebalancing engine used to adjust VCPU pinning (default greedy).\n\r");
+        fprintf(stderr, "              -s <0|1>        = keep sibling VCPUs of a VM on different PCPUs (default %d).\n\r",
+                VCPU_SCHEDULER_SPREAD_SIBLINGS);
+        fprintf(stderr, "              -t <0|1>        = prefer PCPUs in the same NUMA node / L3 cache / idle cores (default %d).\n\r",
+                VCPU_SCHEDULER_TOPOLOGY);
+        fprintf(stderr, "              -w <weight>     = weight %% of latest cycle in smoothed VCPU utilization (default %d).\n\r",
+                VCPU_SCHEDULER_UTIL_WEIGHT);
+        fprintf(stderr, "              -r <cycles>     = minimum cycles a VCPU stays on a PCPU before moving (default %d).\n\r",
+                VCPU_SCHEDULER_MIN_RESIDENCY);
+        fprintf(stderr, "              -b <budget>     = maximum VCPUs repinned per cycle, 0 = no limit (default %d).\n\r",
+                VCPU_SCHEDULER_MIGRATION_BUDGET);
+        fprintf(stderr, "              -p <penalty>    = minimum %% reduction of busiest PCPU load to repin (default %d).\n\r",
+                VCPU_SCHEDULER_MIGRATION_PENALTY);
+        fprintf(stderr, "              -a <min>,<max>  = adapt time interval between <min> and <max> seconds (default off).\n\r");
+        fprintf(stderr, "              -j <workers>    = connections used to repin VCPUs concurrently, 0 = inline (default %d).\n\r",
+                VCPU_SCHEDULER_WORKERS);
+        fprintf(stderr, "              -m <port>       = serve OpenMetrics on http://%s:<port>/metrics (default off).\n\r",
+                METRICS_BIND_ADDR);
+        fprintf(stderr, "              -c <file>       = configuration file with thresholds / VM overrides, reloaded on SIGHUP.\n\r");
+        fprintf(stderr, "              -q <0|1>        = set CPU shares / VCPU quota of VMs by priority tier (default %d).\n\r",
+                VCPU_SCHEDULER_PRIORITY_CONTROL);
+        fprintf(stderr, "              -k <0|1>        = pack VCPUs onto fewer PCPUs while none is high, parking the rest (default %d).\n\r",
+                VCPU_SCHEDULER_CONSOLIDATE);
+        fprintf(stderr, "              -f <file>       = publish the parked PCPUs as a CPU list (ie for cpufreq / cpuidle tuning).\n\r");
+        fprintf(stderr, "              -o <file>       = record a binary trace of every cycle (read with trace_decode).\n\r");
+        fprintf(stderr, "              -u <socket>     = stream the stats of every cycle as JSON lines on a Unix socket.\n\r");
+        fprintf(stderr, "              -z <name>       = publish the stats of every cycle in a shared memory segment (ie /vcpu_scheduler).\n\r");
     }
     else
     {
-        /* Initialize the virtualization data */
-        status = virt_init();
+        /* Initialize the virtualization data (with its own connection) */
+        status = virt_init(NULL);
 
         /* Ensure virtualization init was successful */
         if (status == EXIT_SUCCESS)
         {
             /* Call VCPU scheduler with cycle time */
-            status = scheduler(seconds);
+            status = scheduler(interval_ms);
 
             /* Deinit the virtualization data */
             virt_deinit();
@@ -110,8 +231,259 @@ int main(int argc, char ** argv)
     /* Return status to caller */
     return (status);
 }
+#endif  /* RESOURCE_MANAGER */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_policy_options
+*
+*   DESCRIPTION
+*
+*       Parses the VCPU scheduler command-line options (the options after
+*       --cpu when run by the resource manager).  Parsing stops at the
+*       first argument that isn't an option (left in optind)
+*
+*   INPUTS
+*
+*       argc                                Number of parameters
+*       argv                                Array of parameters
+*
+*   OUTPUTS
+*
+*       1                                   Options valid
+*       0                                   Unknown or malformed option
+*
+*************************************************************************/
+int vcpu_policy_options(int argc, char ** argv)
+{
+    int     option, valid = 1;
+
+
+    /* Loop through each command-line option */
+    while ((option = getopt(argc, argv, "a:b:c:e:f:j:k:m:o:p:q:r:s:t:u:w:z:")) != -1)
+    {
+        switch (option)
+        {
+            /* Adaptive interval option */
+            case 'a':
+
+                /* Set shortest / longest adaptive interval */
+                if (interval_parse_range(optarg, &sched_config.adapt_min_ms, &sched_config.adapt_max_ms) != EXIT_SUCCESS)
+                {
+                    /* Malformed range - show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Configuration file option */
+            case 'c':
+
+                /* Set configuration file (read at startup and on SIGHUP) */
+                sched_config.config_path = optarg;
+
+            break;
+
+            /* Rebalancing engine option */
+            case 'e':
+
+                /* Check which engine is selected */
+                if (strcmp(optarg, "greedy") == 0)
+                {
+                    sched_config.engine = VCPU_SCHEDULER_ENGINE_GREEDY;
+                }
+                else if (strcmp(optarg, "binpack") == 0)
+                {
+                    sched_config.engine = VCPU_SCHEDULER_ENGINE_BINPACK;
+                }
+                else
+                {
+                    /* Unknown engine - show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Parked PCPUs file option */
+            case 'f':
+
+                /* Set file the parked PCPUs are published in */
+                sched_config.parked_path = optarg;
+
+            break;
+
+            /* Consolidation option */
+            case 'k':
+
+                /* Set packing of VCPUs onto fewer PCPUs (0 or 1) */
+                sched_config.consolidate = atoi(optarg);
+
+            break;
+
+            /* Spread sibling VCPUs option */
+            case 's':
+
+                /* Set spread siblings (0 or 1) */
+                sched_config.spread_siblings = atoi(optarg);
+
+            break;
+
+            /* Topology option */
+            case 't':
+
+                /* Set topology aware placement (0 or 1) */
+                sched_config.topology_aware = atoi(optarg);
+
+            break;
+
+            /* Migration budget option */
+            case 'b':
+
+                /* Set maximum VCPUs repinned per cycle */
+                sched_config.migration_budget = atoi(optarg);
+
+                /* Ensure value is a number that isn't negative (atoi takes anything else as 0) */
+                if ((optarg[0] == '\0') || (optarg[strspn(optarg, "0123456789")] != '\0'))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Workers option */
+            case 'j':
+
+                /* Set number of workers used to repin VCPUs (0 = repin inline) */
+                sched_config.num_workers = atoi(optarg);
+
+                /* Ensure number of workers is valid */
+                if ((sched_config.num_workers < 0) || (sched_config.num_workers > WORKER_POOL_MAX_WORKERS))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Metrics option */
+            case 'm':
+
+                /* Set port the metrics endpoint is served on (0 = no endpoint) */
+                sched_config.metrics_port = atoi(optarg);
+
+                /* Ensure port is valid */
+                if ((sched_config.metrics_port < 0) || (sched_config.metrics_port > 65535))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Trace option */
+            case 'o':
+
+                /* Set binary trace file */
+                sched_config.trace_path = optarg;
+
+            break;
+
+            /* Migration penalty option */
+            case 'p':
+
+                /* Set minimum % load reduction needed to repin */
+                sched_config.migration_penalty = atoi(optarg);
+
+                /* Ensure value is a number that isn't negative (atoi takes anything else as 0) */
+                if ((optarg[0] == '\0') || (optarg[strspn(optarg, "0123456789")] != '\0'))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Priority control option */
+            case 'q':
+
+                /* Set CPU shares / VCPU quota by priority tier (0 or 1) */
+                sched_config.priority_control = atoi(optarg);
+
+            break;
+
+            /* Minimum residency option */
+            case 'r':
+
+                /* Set minimum cycles a VCPU stays on a PCPU */
+                sched_config.min_residency = atoi(optarg);
+
+                /* Ensure value is a number that isn't negative (atoi takes anything else as 0) */
+                if ((optarg[0] == '\0') || (optarg[strspn(optarg, "0123456789")] != '\0'))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Monitor option */
+            case 'u':
+
+                /* Set Unix socket the stats of every cycle are streamed on */
+                sched_config.monitor_path = optarg;
+
+            break;
+
+            /* Utilization weight option */
+            case 'w':
+
+                /* Set weight % of latest cycle in smoothed utilization (1 - 100) */
+                sched_config.util_weight = atoi(optarg);
+
+                /* Ensure weight is valid */
+                if ((sched_config.util_weight <= 0) || (sched_config.util_weight > 100))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Shared memory option */
+            case 'z':
+
+                /* Set shared memory segment the stats of every cycle are published in */
+                sched_config.shm_name = optarg;
+
+                /* Ensure name is a segment name (/<name>) */
+                if ((optarg[0] != '/') || (strchr(optarg + 1, '/') != NULL) || (optarg[1] == '\0'))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Unknown option */
+            default:
+
+                /* Show usage */
+                valid = 0;
+
+            break;
+        }
+    }
+
+    /* Return if options are valid to caller */
+    return (valid);
+}
 
 
+#ifndef RESOURCE_MANAGER
 /*************************************************************************
 *
 *   FUNCTION
@@ -128,8 +500,9 @@ int main(int argc, char ** argv)
 *
 *   INPUTS
 *
-*       cycle_time                          Time, in seconds, to run
+*       interval_ms                         Time, in milliseconds, to run
 *                                           each cycle of the VCPU scheduler
+*                                           (starting time if adaptive)
 *
 *   OUTPUTS
 *
@@ -137,120 +510,169 @@ int main(int argc, char ** argv)
 *       Others                              Error during VCPU scheduling
 *
 *************************************************************************/
-static int  scheduler(unsigned int cycle_time)
+static int  scheduler(unsigned int interval_ms)
 {
     int                 status = EXIT_SUCCESS;
-    unsigned long long  ns_cycle_time = cycle_time * VCPU_SCHEDULER_SEC_TO_NANOSECS;
+    int                 busy;
+    unsigned long long  start;
+
 
+    /* Start timing cycles (adaptive if a range was set with -a) */
+    interval_init(&virt_info.interval, interval_ms, sched_config.adapt_min_ms, sched_config.adapt_max_ms);
 
     /* Loop while no errors and no key hit */
     while (status == EXIT_SUCCESS)
     {
-        /* Sleep for specified period of time */
-        sleep(cycle_time);
+        /* Sleep until the end of this cycle */
+        interval_wait(&virt_info.interval);
 
-        /* Collect PCPU stats */
-        status = collect_pcpu_stats(ns_cycle_time);
-
-        /* Ensure PCPU stats obtained successfully */
-        if (status == EXIT_SUCCESS)
-        {
-            /* Collect VCPU stats for all domains */
-            status = collect_vcpu_stats(ns_cycle_time);
-        }
+        /* Run a scheduling cycle */
+        status = scheduler_cycle(&busy);
 
-        /* Ensure VCPU stats obtained successfully */
+        /* Ensure cycle completed successfully */
         if (status == EXIT_SUCCESS)
         {
-            /* Adjust pinning of VCPUs to PCPUs based
-               on latest stats */
-            status = vcpu_pinning_adjust();
+            /* Add / remove domains that started / stopped since the last cycle
+               (VCPUs of added domains are first measured next cycle) */
+            start = interval_clock();
+            status = domain_events_process();
+            virt_info.phase_ns[VCPU_SCHEDULER_PHASE_EVENTS] = interval_clock() - start;
         }
-
-#if (VCPU_SCHEDULER_DEBUG == 1)
-        /* Dump stats */
-        dump_scheduler_stats();
-#endif  /* (VCPU_SCHEDULER_DEBUG == 1) */
     }
 
     /* Return status to caller */
     return (status);
 }
+#endif  /* RESOURCE_MANAGER */
 
 
 /*************************************************************************
 *
 *   FUNCTION
 *
-*       collect_pcpu_stats
+*       scheduler_cycle
 *
 *   DESCRIPTION
 *
-*       Collects PCPU stats
+*       Runs a single scheduling cycle - collects PCPU / VCPU stats and
+*       adjusts VCPU pinning, then outputs the stats and metrics of the
+*       cycle
 *
 *   INPUTS
 *
-*       ns_cycle_time                       Number of nanoseconds per cycle
+*       busy                                Set non-zero if PCPUs were
+*                                           imbalanced or VCPUs moved
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        PCPU stats collected
-*       Others                              Error trying to collect PCPU stats
+*       EXIT_SUCCESS                        Cycle successful
+*       Others                              Error during cycle
 *
 *************************************************************************/
-static int  collect_pcpu_stats(unsigned long long ns_cycle_time)
+static int  scheduler_cycle(int * busy)
 {
     int                 index, status = EXIT_SUCCESS;
-    unsigned long long  pcpu_idle;
+    int                 imbalanced;
+    unsigned long long  start, now;
 
 
-    /* Reset low / high PCPU utilization masks before each new collection */
-    virt_info.pcpu_high_mask = 0;
-    virt_info.pcpu_low_mask = 0;
+    /* Count this cycle */
+    virt_info.cycle++;
 
-    /* Loop through each PCPU */
-    for (index = 0; (index < virt_info.num_pcpus) && (status == EXIT_SUCCESS) ; index++)
+    /* Record start of cycle and check if the trace started a new file */
+    if (trace_cycle(&virt_info.trace, virt_info.cycle, interval_now(), virt_info.interval.interval_ms))
     {
-        /* Get this PCPUs information */
-        status = virNodeGetCPUStats(virt_info.conn, index, virt_info.params, &virt_info.num_params, 0);
+        /* Loop through each domain and name it in the new file */
+        for (index = 0; index < virt_info.num_domains; index++)
+        {
+            domain_stats_trace(domain_stats[index]);
+        }
+    }
 
-        /* See if PCPU stats obtained */
-        if (status == EXIT_SUCCESS)
+    /* Check if a configuration reload was requested (SIGHUP) since it was last loaded */
+    if ((sched_config.config_path != NULL) && (virt_info.config_generation != config_generation()))
+    {
+        /* Reload at this cycle boundary (stats already collected are kept) */
+        virt_info.config_generation = config_generation();
+
+        /* Check if the new configuration can't be used */
+        if (sched_config_load() != EXIT_SUCCESS)
         {
-            /* Try to get PCPU idle time */
-            status = pcpu_get_idle(virt_info.num_params, &pcpu_idle);
+            /* Keep running with the previous configuration */
+            fprintf(stderr, "%s: reload failed - previous configuration kept\n\r", sched_config.config_path);
+        }
+    }
 
-            /* Ensure PCPU idle obtained */
-            if (status == EXIT_SUCCESS)
-            {
-                /* Calculate PCPU utilization for last cycle (100 - idle time = CPU utilization) */
-                pcpu_stats[index].cpu_util = (100 - ((pcpu_idle - pcpu_stats[index].last_time) * 100) / ns_cycle_time);
+    /* Collect PCPU stats */
+    start = interval_clock();
+    status = collect_pcpu_stats();
+    now = interval_clock();
+    virt_info.phase_ns[VCPU_SCHEDULER_PHASE_PCPU] = now - start;
 
-                /* Update last idle time */
-                pcpu_stats[index].last_time = pcpu_idle;
+    /* Ensure PCPU stats obtained successfully */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Collect VCPU stats for all domains */
+        start = now;
+        status = collect_vcpu_stats();
+        now = interval_clock();
+        virt_info.phase_ns[VCPU_SCHEDULER_PHASE_VCPU] = now - start;
+    }
 
-                /* Check if PCPU utilization is above configured high threshold */
-                if (pcpu_stats[index].cpu_util > VCPU_SCHEDULER_PCPU_HIGH_THRESHOLD)
-                {
-                    /* Check if this PCPU has more than 1 VCPU pinned to it */
-                    if (pcpu_stats[index].num_pinned > 1)
-                    {
-                        /* Set bit in bitmask tracking this as candidate for
-                           repinning of VCPUs */
-                        virt_info.pcpu_high_mask |= (1 << index);
-                    }
-                }
-                else
-                {
-                    /* Check if PCPU utilization is below configured low threshold */
-                    if (pcpu_stats[index].cpu_util < VCPU_SCHEDULER_PCPU_LOW_THRESHOLD)
-                    {
-                        /* Set bit identifying this as a low CPU utilization PCPU */
-                        virt_info.pcpu_low_mask |= (1 << index);
-                    }
-                }
-            }
-        }
+    /* Check if PCPUs are imbalanced (both high and low PCPUs exist) before
+       rebalancing updates the masks */
+    imbalanced = ((!bitmask_empty(&virt_info.pcpu_high_mask)) && (!bitmask_empty(&virt_info.pcpu_low_mask)));
+
+    /* Save cycle if any PCPU is high (VCPUs are only packed again once it settles) */
+    virt_info.high_cycle = (bitmask_empty(&virt_info.pcpu_high_mask) ? virt_info.high_cycle : virt_info.cycle);
+
+    /* Ensure VCPU stats obtained successfully */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Adjust pinning of VCPUs to PCPUs based
+           on latest stats */
+        start = now;
+        status = vcpu_pinning_adjust();
+        virt_info.phase_ns[VCPU_SCHEDULER_PHASE_ADJUST] = interval_clock() - start;
+    }
+
+    /* Cycle is busy while PCPUs are imbalanced or VCPUs are moving */
+    *busy = (imbalanced || (virt_info.num_repins > 0));
+
+    /* Shorten the interval while busy and lengthen it once steady (only if adaptive) */
+    interval_adapt(&virt_info.interval, *busy);
+
+#if (VCPU_SCHEDULER_DEBUG == 1)
+    /* Dump stats */
+    dump_scheduler_stats();
+#endif  /* (VCPU_SCHEDULER_DEBUG == 1) */
+
+    /* Check if metrics endpoint is served */
+    if (sched_config.metrics_port)
+    {
+        /* Publish a snapshot of this cycle for scrapes */
+        render_scheduler_metrics();
+    }
+
+    /* Check if monitor stream is served */
+    if (sched_config.monitor_path != NULL)
+    {
+        /* Stream a sample of this cycle to the monitor clients */
+        render_scheduler_monitor();
+    }
+
+    /* Check if shared memory snapshot is published */
+    if (sched_config.shm_name != NULL)
+    {
+        /* Publish the stats of this cycle to the shared memory readers */
+        render_scheduler_shm();
+    }
+
+    /* Check if the parked PCPUs are published and changed since last published */
+    if ((sched_config.parked_path != NULL) && (virt_info.parked_changed))
+    {
+        /* Publish the parked PCPUs (warns and tries again next cycle if not published) */
+        pcpu_parked_publish();
     }
 
     /* Return status to caller */
@@ -262,55 +684,3979 @@ static int  collect_pcpu_stats(unsigned long long ns_cycle_time)
 *
 *   FUNCTION
 *
-*       collect_vcpu_stats
+*       sched_config_load
 *
 *   DESCRIPTION
 *
-*       Collects VCPU stats for each active VM
+*       Loads the configuration file - the PCPU thresholds and batch quota
+*       of the [cpu] section (settings not in the file keep their defaults) and the
+*       VM overrides, which are applied to the domains already tracked.
+*       Nothing is changed if the file has an error
 *
 *   INPUTS
 *
-*       ns_cycle_time                       Number of nanoseconds per cycle
+*       None
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        VCPU stats for each VM collected
-*       Others                              Error trying to collect VCPU stats
+*       EXIT_SUCCESS                        Configuration loaded
+*       EXIT_FAILURE                        Error in configuration file
+*                                           (printed to stderr)
 *
 *************************************************************************/
-static int  collect_vcpu_stats(unsigned long long ns_cycle_time)
+static int  sched_config_load(void)
 {
-    int                 index, status = EXIT_SUCCESS;
-    virVcpuInfo         info;
+    static const char * const   keys[] = {"high_threshold", "target", "low_threshold", "batch_quota", NULL};
+    int                         index, status;
+    int                         high = VCPU_SCHEDULER_PCPU_HIGH_THRESHOLD;
+    int                         target = VCPU_SCHEDULER_PCPU_TGT;
+    int                         low = VCPU_SCHEDULER_PCPU_LOW_THRESHOLD;
+    int                         batch_quota = VCPU_SCHEDULER_BATCH_QUOTA;
+    CONFIG                      config;
 
 
-    /* Loop through each VCPU */
-    for (index = 0; (index < virt_info.num_domains) && (status == EXIT_SUCCESS) ; index++)
+    /* Read the configuration file */
+    status = config_load(&config, sched_config.config_path);
+
+    /* Ensure only known settings are in the [cpu] section */
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_check(&config, VCPU_SCHEDULER_CONFIG_SECTION, keys);
+    }
+
+    /* Get each threshold (left at its default if not set) */
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, VCPU_SCHEDULER_CONFIG_SECTION, "high_threshold", &high);
+    }
+
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, VCPU_SCHEDULER_CONFIG_SECTION, "target", &target);
+    }
+
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, VCPU_SCHEDULER_CONFIG_SECTION, "low_threshold", &low);
+    }
+
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, VCPU_SCHEDULER_CONFIG_SECTION, "batch_quota", &batch_quota);
+    }
+
+    /* Ensure thresholds are ordered (0 <= low < target < high <= 100) */
+    if ((status == EXIT_SUCCESS) && ((low < 0) || (low >= target) || (target >= high) || (high > 100)))
+    {
+        /* Print error */
+        fprintf(stderr, "%s: [%s] thresholds must be 0 <= low_threshold < target < high_threshold <= 100\n\r",
+                sched_config.config_path, VCPU_SCHEDULER_CONFIG_SECTION);
+        status = EXIT_FAILURE;
+    }
+
+    /* Ensure batch quota is a % of the quota period (1 - 100) */
+    if ((status == EXIT_SUCCESS) && ((batch_quota <= 0) || (batch_quota > 100)))
+    {
+        /* Print error */
+        fprintf(stderr, "%s: [%s] batch_quota must be 1 - 100\n\r", sched_config.config_path, VCPU_SCHEDULER_CONFIG_SECTION);
+        status = EXIT_FAILURE;
+    }
+
+    /* Check if the configuration is valid */
+    if (status == EXIT_SUCCESS)
     {
-        /* Get this VCPUs information */
-        status = virDomainGetVcpus(vcpu_stats[index].domain_id, &info, 1, NULL, 0);
+        /* Replace the previous configuration */
+        config_free(&virt_info.config);
+        virt_info.config = config;
 
-        /* Check if VCPU info obtained */
-        if (status > 0)
+        /* Use the new thresholds from this cycle on */
+        sched_config.high_threshold = high;
+        sched_config.pcpu_target = target;
+        sched_config.low_threshold = low;
+        sched_config.batch_quota = batch_quota;
+
+        /* Loop through each tracked domain and apply its new overrides */
+        for (index = 0; index < virt_info.num_domains; index++)
         {
-            /* Calculate VCPU utilization for last cycle */
-            vcpu_stats[index].cpu_util = (int)(((info.cpuTime - vcpu_stats[index].last_time) * 100)/(ns_cycle_time));
+            domain_config_apply(domain_stats[index]);
+        }
+    }
+    else
+    {
+        /* Free the rejected configuration */
+        config_free(&config);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_config_apply
+*
+*   DESCRIPTION
+*
+*       Applies the configuration file overrides of a domain (found by
+*       its name).  A domain without a VM section gets no overrides
+*
+*   INPUTS
+*
+*       domain                              Pointer to domain stats
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void domain_config_apply(DOMAIN_STATS * domain)
+{
+    const CONFIG_VM *   vm = config_vm_find(&virt_info.config, domain->name);
+    int                 exclusive = ((vm != NULL) && (vm->exclusive));
+    int                 vcpu;
+
+
+    /* Loop through each VCPU of the domain (if already pinned) when the exclusive flag changes */
+    for (vcpu = 0; (vcpu < domain->num_vcpus) && (exclusive != domain->exclusive); vcpu++)
+    {
+        /* Check if VCPU is pinned */
+        if (domain->vcpus[vcpu].pcpu != NULL)
+        {
+            /* Move VCPU to / from the exclusive count of its PCPU */
+            domain->vcpus[vcpu].pcpu->num_exclusive += (exclusive ? 1 : -1);
+        }
+
+        /* Check if VCPU is in the VCPU table */
+        if (domain->vcpus[vcpu].slot >= 0)
+        {
+            /* Set exclusive flag in the table */
+            virt_info.vcpu_table.exclusive[domain->vcpus[vcpu].slot] = exclusive;
+        }
+    }
+
+    /* Set if other VCPUs are kept off the PCPUs of this domain */
+    domain->exclusive = exclusive;
+
+    /* Set priority tier (the CPU shares / VCPU quota follow at the end of the next cycle) */
+    domain->tier = ((vm == NULL) || (vm->priority == 0) ? VCPU_SCHEDULER_TIER_NORMAL :
+                    (vm->priority < 0 ? VCPU_SCHEDULER_TIER_BATCH : VCPU_SCHEDULER_TIER_CRITICAL));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_policy_init
+*
+*   DESCRIPTION
+*
+*       Initializes the VCPU scheduler on a hypervisor connection shared
+*       by the resource manager.  No domains are tracked until the
+*       resource manager reports them with vcpu_policy_domain_event
+*
+*   INPUTS
+*
+*       conn                                Shared hypervisor connection
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VCPU scheduler initialized
+*       Others                              Error during init
+*
+*************************************************************************/
+int vcpu_policy_init(virConnectPtr conn)
+{
+    /* Initialize the virtualization data on the shared connection */
+    return (virt_init(conn));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_policy_cycle
+*
+*   DESCRIPTION
+*
+*       Runs a single scheduling cycle for the resource manager using the
+*       stats snapshot it took for this cycle (VCPU times are read from
+*       the snapshot records when there are any)
+*
+*   INPUTS
+*
+*       snapshot                            Stats snapshot of this cycle
+*       busy                                Set non-zero if PCPUs were
+*                                           imbalanced or VCPUs moved
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Cycle successful
+*       Others                              Error during cycle
+*
+*************************************************************************/
+int vcpu_policy_cycle(const POLICY_SNAPSHOT * snapshot, int * busy)
+{
+    int     status;
+
+
+    /* Use the shared snapshot and the resource manager's interval for this cycle */
+    policy_snapshot = snapshot;
+    virt_info.interval.interval_ms = snapshot->interval_ms;
+
+    /* Run a scheduling cycle */
+    status = scheduler_cycle(busy);
+
+    /* Snapshot is freed by the resource manager after the cycle */
+    policy_snapshot = NULL;
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_policy_cpu_saturated
+*
+*   DESCRIPTION
+*
+*       Determines if a domain is CPU saturated on a busy PCPU - at least
+*       one of its VCPUs is pinned to a PCPU above the high threshold and
+*       uses at least the target % of its fair share of that PCPU (so it
+*       is one of the VCPUs keeping the PCPU busy)
+*
+*   INPUTS
+*
+*       domain                              Domain to check
+*
+*   OUTPUTS
+*
+*       1                                   Domain is CPU saturated
+*       0                                   Domain isn't CPU saturated
+*                                           (or isn't tracked)
+*
+*************************************************************************/
+int vcpu_policy_cpu_saturated(virDomainPtr domain)
+{
+    int             vcpu, saturated = 0;
+    DOMAIN_STATS *  stats = domain_stats_lookup(domain);
+    VCPU_STATS *    vcpu_stats;
+
+
+    /* Loop through each VCPU of the domain (if tracked) until a saturated VCPU is found */
+    for (vcpu = 0; (stats != NULL) && (vcpu < stats->num_vcpus) && (!saturated); vcpu++)
+    {
+        /* Get this VCPU's stats */
+        vcpu_stats = &stats->vcpus[vcpu];
+
+        /* Check if VCPU is on a busy PCPU and uses at least its fair share of it */
+        saturated = ((vcpu_stats->pcpu != NULL) &&
+                     (vcpu_stats->pcpu->cpu_util > sched_config.high_threshold) &&
+                     ((100 * vcpu_stats->cpu_util_avg * vcpu_stats->pcpu->num_pinned) >=
+                      (sched_config.pcpu_target * vcpu_stats->pcpu->cpu_util)));
+    }
+
+    /* Return if domain is saturated to caller */
+    return (saturated);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_policy_cpu_nodes
+*
+*   DESCRIPTION
+*
+*       Gets the NUMA nodes of the PCPUs a domain's VCPUs are pinned to,
+*       so the memory coordinator can keep the domain's memory on them.
+*       The nodes aren't known unless the topology is used
+*
+*   INPUTS
+*
+*       domain                              Domain to check
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Mask of nodes (bit n = node n,
+*                                           0 = not known / not tracked)
+*
+*************************************************************************/
+unsigned long long vcpu_policy_cpu_nodes(virDomainPtr domain)
+{
+    int                 vcpu;
+    unsigned long long  nodes = 0;
+    DOMAIN_STATS *      stats = (sched_config.topology_aware ? domain_stats_lookup(domain) : NULL);
+
+
+    /* Loop through each VCPU of the domain (if tracked) */
+    for (vcpu = 0; (stats != NULL) && (vcpu < stats->num_vcpus); vcpu++)
+    {
+        /* Add node of the PCPU the VCPU is pinned to (nodes past the mask aren't known) */
+        nodes |= (((stats->vcpus[vcpu].pcpu != NULL) && (stats->vcpus[vcpu].pcpu->node_id >= 0) &&
+                   (stats->vcpus[vcpu].pcpu->node_id < 64)) ? (1ULL << stats->vcpus[vcpu].pcpu->node_id) : 0);
+    }
+
+    /* Return nodes to caller */
+    return (nodes);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_policy_phases
+*
+*   DESCRIPTION
+*
+*       Gets the time spent in each phase of the last cycle (timed on the
+*       host clock, as served by the metrics endpoint).  Domain events
+*       are timed by the standalone daemon only, so just the phases of
+*       vcpu_policy_cycle are given
+*
+*   INPUTS
+*
+*       names                               Pointer to return phase names
+*       phase_ns                            Pointer to return time (ns)
+*                                           spent in each phase
+*
+*   OUTPUTS
+*
+*       int                                 Number of phases
+*
+*************************************************************************/
+int vcpu_policy_phases(const char * const ** names, const unsigned long long ** phase_ns)
+{
+    /* Return names and times of the phases (domain events are the last phase) */
+    *names = phase_names;
+    *phase_ns = virt_info.phase_ns;
+    return (VCPU_SCHEDULER_PHASE_EVENTS);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_policy_deinit
+*
+*   DESCRIPTION
+*
+*       De-initializes the VCPU scheduler run by the resource manager
+*       (the shared connection is left open)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void vcpu_policy_deinit(void)
+{
+    /* Deinit the virtualization data */
+    virt_deinit();
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       collect_pcpu_stats
+*
+*   DESCRIPTION
+*
+*       Collects PCPU stats.  Utilization is calculated over the actual
+*       time elapsed since each PCPU was last read (not the interval).  A
+*       PCPU running an exclusive VCPU is never low, and is high whenever
+*       another VCPU shares it
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        PCPU stats collected
+*       Others                              Error trying to collect PCPU stats
+*
+*************************************************************************/
+static int  collect_pcpu_stats(void)
+{
+    int                 index, status = EXIT_SUCCESS;
+    unsigned long long  pcpu_idle, now, elapsed;
+    TRACE_PCPU          record;
+
+
+    /* Reset low / high PCPU utilization masks before each new collection */
+    bitmask_zero(&virt_info.pcpu_high_mask);
+    bitmask_zero(&virt_info.pcpu_low_mask);
+
+    /* Loop through each PCPU */
+    for (index = 0; (index < virt_info.num_pcpus) && (status == EXIT_SUCCESS) ; index++)
+    {
+        /* Get this PCPUs information */
+        status = virNodeGetCPUStats(virt_info.conn, index, virt_info.params, &virt_info.num_params, 0);
+
+        /* Get time the stats were read */
+        now = interval_now();
+
+        /* See if PCPU stats obtained */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Try to get PCPU idle time */
+            status = pcpu_get_idle(virt_info.num_params, &pcpu_idle);
+
+            /* Ensure PCPU idle obtained */
+            if (status == EXIT_SUCCESS)
+            {
+                /* Get time elapsed since last read (at least 1ns) */
+                elapsed = ((now > pcpu_stats[index].last_ns) ? (now - pcpu_stats[index].last_ns) : 1);
+
+                /* Calculate PCPU utilization for last cycle (100 - idle time = CPU utilization) */
+                pcpu_stats[index].cpu_util = (int)(100 - (((pcpu_idle - pcpu_stats[index].last_time) * 100) / elapsed));
+
+                /* Keep utilization within 0 - 100% (idle time and elapsed time are read separately) */
+                pcpu_stats[index].cpu_util = (pcpu_stats[index].cpu_util < 0 ? 0 : pcpu_stats[index].cpu_util);
+
+                /* Record raw idle counter and utilization */
+                record.idle_time = pcpu_idle;
+                record.elapsed_ns = elapsed;
+                record.cpu_util = pcpu_stats[index].cpu_util;
+                record.num_pinned = pcpu_stats[index].num_pinned;
+                trace_write(&virt_info.trace, TRACE_REC_PCPU, index, &record, sizeof(record));
+
+                /* Update last idle time */
+                pcpu_stats[index].last_time = pcpu_idle;
+                pcpu_stats[index].last_ns = now;
+
+                /* Check if PCPU utilization is above configured high threshold
+                   OR an exclusive VCPU shares the PCPU */
+                if ((pcpu_stats[index].cpu_util > sched_config.high_threshold) || (pcpu_stats[index].num_exclusive))
+                {
+                    /* Check if this PCPU has more than 1 VCPU pinned to it */
+                    if (pcpu_stats[index].num_pinned > 1)
+                    {
+                        /* Set bit in bitmask tracking this as candidate for
+                           repinning of VCPUs */
+                        BITMASK_SET(&virt_info.pcpu_high_mask, index);
+                    }
+                }
+                else
+                {
+                    /* Check if PCPU utilization is below configured low threshold
+                       (a PCPU of an exclusive VCPU can't take more VCPUs) */
+                    if ((pcpu_stats[index].cpu_util < sched_config.low_threshold) && (!pcpu_stats[index].num_exclusive))
+                    {
+                        /* Set bit identifying this as a low CPU utilization PCPU */
+                        BITMASK_SET(&virt_info.pcpu_low_mask, index);
+                    }
+                }
+            }
+        }
+    }
+
+    /* Record PCPUs found high / low */
+    trace_mask(&virt_info.trace, TRACE_MASK_PCPU_HIGH, &virt_info.pcpu_high_mask);
+    trace_mask(&virt_info.trace, TRACE_MASK_PCPU_LOW, &virt_info.pcpu_low_mask);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       collect_vcpu_stats
+*
+*   DESCRIPTION
+*
+*       Collects VCPU stats for each active VM using bulk stats when
+*       supported by libvirt, otherwise using one call per domain.  When
+*       run by the resource manager the stats records it read for this
+*       cycle are used instead
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VCPU stats for each VM collected
+*       Others                              Error trying to collect VCPU stats
+*
+*************************************************************************/
+static int  collect_vcpu_stats(void)
+{
+    int                 status = EXIT_SUCCESS;
+    int                 per_domain = 1;
+
+
+#if (VCPU_SCHEDULER_BULK_STATS == 1)
+    /* Check if the resource manager already read the stats of all domains this cycle */
+    if ((policy_snapshot != NULL) && (policy_snapshot->records != NULL))
+    {
+        /* Fill in VCPU stats from the shared records */
+        collect_vcpu_stats_records(policy_snapshot->records, policy_snapshot->num_records, policy_snapshot->now);
+        per_domain = 0;
+    }
+    /* Check if bulk stats are supported (never read by the policy itself under the resource manager) */
+    else if ((policy_snapshot == NULL) && (virt_info.bulk_stats))
+    {
+        /* Get all VCPU stats with a single call */
+        status = collect_vcpu_stats_bulk();
+
+        /* Check if libvirt doesn't support bulk stats */
+        per_domain = (status == VCPU_SCHEDULER_BULK_STATS_UNSUPPORTED);
+
+        /* Don't try bulk stats again if not supported - use per-domain stats from now on */
+        virt_info.bulk_stats = !per_domain;
+    }
+#endif  /* (VCPU_SCHEDULER_BULK_STATS == 1) */
+
+    /* Check if neither shared records nor bulk stats were used */
+    if (per_domain)
+    {
+        /* Get VCPU stats one domain at a time */
+        status = collect_vcpu_stats_domain();
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       collect_vcpu_stats_domain
+*
+*   DESCRIPTION
+*
+*       Collects VCPU stats for each active VM with one call per domain
+*       (all VCPUs of a domain are read with the same call)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VCPU stats for each VM collected
+*       Others                              Error trying to collect VCPU stats
+*
+*************************************************************************/
+static int  collect_vcpu_stats_domain(void)
+{
+    int                 index, vcpu, status = EXIT_SUCCESS;
+    DOMAIN_STATS *      domain;
+    unsigned long long  now;
+
+
+    /* Loop through each domain */
+    for (index = 0; (index < virt_info.num_domains) && (status == EXIT_SUCCESS) ; index++)
+    {
+        /* Get this domain's stats */
+        domain = domain_stats[index];
+
+        /* Get information for all of this domain's VCPUs with a single call */
+        status = virDomainGetVcpus(domain->domain_id, virt_info.vcpu_info, domain->num_vcpus, NULL, 0);
+
+        /* Get time the VCPU info was read */
+        now = interval_now();
+
+        /* Check if info obtained for all VCPUs */
+        if (status == domain->num_vcpus)
+        {
+            /* Loop through each VCPU of this domain */
+            for (vcpu = 0; vcpu < domain->num_vcpus; vcpu++)
+            {
+                /* Update VCPU utilization with this cycle's CPU time */
+                vcpu_stats_update(&domain->vcpus[vcpu], virt_info.vcpu_info[vcpu].cpuTime, now);
+            }
+
+            /* Successful VCPU info */
+            status = EXIT_SUCCESS;
+        }
+        else if (domain_gone(domain->domain_id))
+        {
+            /* Domain stopped - skip it until its stop event removes it */
+            status = EXIT_SUCCESS;
+        }
+        else
+        {
+            /* Consider no info or error from API a problem */
+            status = VCPU_SCHEDULER_DOMAIN_INFO_ERROR;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+#if (VCPU_SCHEDULER_BULK_STATS == 1)
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       collect_vcpu_stats_bulk
+*
+*   DESCRIPTION
+*
+*       Collects VCPU stats for all active VMs with a single call to
+*       libvirt and fills in the VCPU stats from the returned typed
+*       parameters
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VCPU stats for each VM collected
+*       VCPU_SCHEDULER_BULK_STATS_UNSUPPORTED
+*                                           Bulk stats not supported by libvirt
+*       Others                              Error trying to collect VCPU stats
+*
+*************************************************************************/
+static int  collect_vcpu_stats_bulk(void)
+{
+    int                         num_records;
+    int                         status = EXIT_SUCCESS;
+    virDomainStatsRecordPtr *   records = NULL;
+    virErrorPtr                 error;
+    unsigned long long          now;
+
+
+    /* Get VCPU stats for all active domains in one call */
+    num_records = virConnectGetAllDomainStats(virt_info.conn, VIR_DOMAIN_STATS_VCPU, &records,
+                                              VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE);
+
+    /* Get time the stats were read (same for all records) */
+    now = interval_now();
+
+    /* Check if stats records obtained */
+    if (num_records >= 0)
+    {
+        /* Fill in VCPU stats from the records */
+        collect_vcpu_stats_records(records, num_records, now);
+
+        /* Free the records */
+        virDomainStatsRecordListFree(records);
+    }
+    else
+    {
+        /* Get error from libvirt */
+        error = virGetLastError();
+
+        /* Check if bulk stats not supported by the hypervisor */
+        if ((error != NULL) && (error->code == VIR_ERR_NO_SUPPORT))
+        {
+            /* Set unsupported status so per-domain stats will be used */
+            status = VCPU_SCHEDULER_BULK_STATS_UNSUPPORTED;
+        }
+        else
+        {
+            /* Set domain info error */
+            status = VCPU_SCHEDULER_DOMAIN_INFO_ERROR;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       collect_vcpu_stats_records
+*
+*   DESCRIPTION
+*
+*       Fills in the VCPU stats of the tracked domains from bulk stats
+*       records (read by this daemon or by the resource manager)
+*
+*   INPUTS
+*
+*       records                             Bulk stats records
+*       num_records                         Number of records
+*       now                                 Monotonic time (ns) records read
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void collect_vcpu_stats_records(virDomainStatsRecordPtr * records, int num_records, unsigned long long now)
+{
+    int                 vcpu, record;
+    DOMAIN_STATS *      domain;
+    unsigned long long  cpu_time;
+    char                param_name[VCPU_SCHEDULER_PARAM_NAME_LEN];
+
+
+    /* Loop through each record returned */
+    for (record = 0; record < num_records; record++)
+    {
+        /* Find the stats for this record's domain (records are normally returned
+           in the same order as the domain list - domains that just started and
+           aren't tracked yet are skipped) */
+        domain = domain_stats_find(virDomainGetID(records[record]->dom), record);
+
+        /* Loop through each VCPU of this domain (if the domain is tracked) */
+        for (vcpu = 0; (domain != NULL) && (vcpu < domain->num_vcpus); vcpu++)
+        {
+            /* Build name of the time parameter for this VCPU */
+            snprintf(param_name, sizeof(param_name), "vcpu.%u.time", domain->vcpus[vcpu].vcpu_num);
+
+            /* Ensure VCPU time is in the record */
+            if (virTypedParamsGetULLong(records[record]->params, records[record]->nparams,
+                                        param_name, &cpu_time) == 1)
+            {
+                /* Update VCPU utilization with this cycle's CPU time */
+                vcpu_stats_update(&domain->vcpus[vcpu], cpu_time, now);
+            }
+        }
+    }
+
+    /* NOTE:  A tracked domain missing from the records has stopped and is
+              removed when its stop event is processed */
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_stats_find
+*
+*   DESCRIPTION
+*
+*       Finds the domain stats for the specified domain
+*
+*   INPUTS
+*
+*       dom_id                              Hypervisor ID of domain
+*       hint                                Index to check first
+*
+*   OUTPUTS
+*
+*       DOMAIN_STATS *                      Pointer to domain stats
+*       NULL                                Domain not found
+*
+*************************************************************************/
+static DOMAIN_STATS * domain_stats_find(unsigned int dom_id, int hint)
+{
+    int     index;
+
+
+    /* Check hint first since this is almost always a match */
+    if ((hint < virt_info.num_domains) && (domain_stats[hint]->dom_id == dom_id))
+    {
+        /* Return hint */
+        return (domain_stats[hint]);
+    }
+
+    /* Loop through each domain looking for a match */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        /* Check if domain matches */
+        if (domain_stats[index]->dom_id == dom_id)
+        {
+            /* Return domain */
+            return (domain_stats[index]);
+        }
+    }
+
+    /* Not found */
+    return (NULL);
+}
+#endif  /* (VCPU_SCHEDULER_BULK_STATS == 1) */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_stats_update
+*
+*   DESCRIPTION
+*
+*       Updates VCPU utilization and smoothed VCPU utilization using
+*       the latest total VCPU time and the actual time elapsed since it
+*       was last read
+*
+*   INPUTS
+*
+*       vcpu                                Pointer to VCPU to update
+*       cpu_time                            Total CPU time of VCPU
+*       now                                 Monotonic time (ns) CPU time read
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void vcpu_stats_update(VCPU_STATS * vcpu, unsigned long long cpu_time,
+                              unsigned long long now)
+{
+    /* Get time elapsed since last read (at least 1ns) */
+    unsigned long long  elapsed = ((now > vcpu->last_ns) ? (now - vcpu->last_ns) : 1);
+    int                 last_util = vcpu->cpu_util;
+    TRACE_VCPU          record;
+
+
+    /* Calculate VCPU utilization for last cycle (a VCPU can't use more than 100% of a PCPU) */
+    vcpu->cpu_util = (int)(((cpu_time - vcpu->last_time) * 100) / elapsed);
+    vcpu->cpu_util = (vcpu->cpu_util > 100 ? 100 : vcpu->cpu_util);
+
+    /* Keep the VCPU load of its PCPU up to date */
+    vcpu->pcpu->vcpu_util += vcpu->cpu_util - last_util;
+
+    /* Check if this is the first utilization measured for this VCPU (1st cycle after its domain was added) */
+    if (virt_info.cycle <= (vcpu->domain->add_cycle + 1))
+    {
+        /* Start smoothed utilization at the measured utilization */
+        vcpu->cpu_util_avg = vcpu->cpu_util;
+    }
+    else
+    {
+        /* Update smoothed utilization (exponentially weighted moving average) */
+        vcpu->cpu_util_avg = ((sched_config.util_weight * vcpu->cpu_util) +
+                              ((100 - sched_config.util_weight) * vcpu->cpu_util_avg)) / 100;
+    }
+
+    /* Check if VCPU is in the VCPU table */
+    if (vcpu->slot >= 0)
+    {
+        /* Copy utilization to the table scanned by the rebalancing engines */
+        virt_info.vcpu_table.util[vcpu->slot] = vcpu->cpu_util;
+        virt_info.vcpu_table.util_avg[vcpu->slot] = vcpu->cpu_util_avg;
+    }
+
+    /* Save this cycle's CPU time */
+    vcpu->last_time = cpu_time;
+    vcpu->last_ns = now;
+
+    /* Record raw CPU time counter, utilization and placement */
+    record.vcpu_num = vcpu->vcpu_num;
+    record.pcpu = vcpu->pcpu->id;
+    record.cpu_time = cpu_time;
+    record.elapsed_ns = elapsed;
+    record.cpu_util = vcpu->cpu_util;
+    record.cpu_util_avg = vcpu->cpu_util_avg;
+    trace_write(&virt_info.trace, TRACE_REC_VCPU, vcpu->domain->dom_id, &record, sizeof(record));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       virt_init
+*
+*   DESCRIPTION
+*
+*       Initializes the virtualization connection and determines number of
+*       VMs, number of PCPUs, and sets up appropriate data structures used
+*       by the VCPU scheduling code.  When a connection is passed in (by
+*       the resource manager) it is shared - domain events and the domain
+*       list then come from the resource manager.  The configuration file
+*       (if given) is read first
+*
+*   INPUTS
+*
+*       conn                                Shared hypervisor connection
+*                                           (NULL = open own connection)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Virtualization init successful
+*       Others                              Problems associated with getting
+*                                           virtualization information
+*
+*************************************************************************/
+static int  virt_init(virConnectPtr conn)
+{
+    int     status = EXIT_SUCCESS;
+
+
+    /* Check if a configuration file was given */
+    if (sched_config.config_path != NULL)
+    {
+        /* Count reload requests (SIGHUP) from now on */
+        config_watch();
+        virt_info.config_generation = config_generation();
+
+        /* Read the configuration before any domain is added */
+        status = (sched_config_load() == EXIT_SUCCESS ? EXIT_SUCCESS : VCPU_SCHEDULER_CONFIG_ERROR);
+    }
+
+    /* Start recording the trace (if enabled) before any domain is added */
+    if ((status == EXIT_SUCCESS) && (sched_config.trace_path != NULL) &&
+        (trace_init(&virt_info.trace, sched_config.trace_path, TRACE_SOURCE_CPU) != EXIT_SUCCESS))
+    {
+        /* Set trace error */
+        status = VCPU_SCHEDULER_TRACE_ERROR;
+    }
+
+    /* Check if the connection is shared */
+    if ((status == EXIT_SUCCESS) && (conn != NULL))
+    {
+        /* Use the resource manager's connection (it tracks domains starting / stopping) */
+        virt_info.conn = conn;
+        virt_info.shared = 1;
+
+        /* Start the workers used to repin VCPUs concurrently (each with its own connection) */
+        if (worker_pool_init(&virt_info.workers, VCPU_SCHEDULER_URI, sched_config.num_workers,
+                             VCPU_SCHEDULER_CALL_TIMEOUT) != EXIT_SUCCESS)
+        {
+            /* Set worker error */
+            status = VCPU_SCHEDULER_WORKER_ERROR;
+        }
+    }
+    /* Start the event loop used to track domains starting / stopping
+       NOTE:  Must be done before connecting to the hypervisor */
+    else if ((status == EXIT_SUCCESS) && (domain_events_loop_init() != EXIT_SUCCESS))
+    {
+        /* Set event error */
+        status = VCPU_SCHEDULER_EVENT_ERROR;
+    }
+    else if (status == EXIT_SUCCESS)
+    {
+        /* Attempt to connect to the hypervisor */
+        virt_info.conn = virConnectOpen(VCPU_SCHEDULER_URI);
+
+        /* Check if connection to hypervisor was successful */
+        if (virt_info.conn == NULL)
+        {
+            /* Return error */
+            status = VCPU_SCHEDULER_CONN_ERROR;
+        }
+        /* Register for domain start / stop events before reading the domain list
+           so no domain starting in between is missed */
+        else if (domain_events_register(&virt_info.events, virt_info.conn) != EXIT_SUCCESS)
+        {
+            /* Set event error */
+            status = VCPU_SCHEDULER_EVENT_ERROR;
+        }
+        /* Start the workers used to repin VCPUs concurrently (each with its own connection) */
+        else if (worker_pool_init(&virt_info.workers, VCPU_SCHEDULER_URI, sched_config.num_workers,
+                                  VCPU_SCHEDULER_CALL_TIMEOUT) != EXIT_SUCCESS)
+        {
+            /* Set worker error */
+            status = VCPU_SCHEDULER_WORKER_ERROR;
+        }
+    }
+
+    /* Check if connected to the hypervisor */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Use bulk stats if configured (disabled later if libvirt doesn't support it) */
+        virt_info.bulk_stats = VCPU_SCHEDULER_BULK_STATS;
+
+        /* Get number of physical CPUs available on host */
+        virt_info.num_pcpus = virNodeGetCPUMap(virt_info.conn, NULL, NULL, 0);
+
+        /* Determine number of bytes needed for a cpumap covering all PCPUs */
+        virt_info.cpumap_len = VIR_CPU_MAPLEN(virt_info.num_pcpus);
+
+        /* Allocate low / high PCPU utilization masks for all PCPUs */
+        if ((bitmask_init(&virt_info.pcpu_high_mask, virt_info.num_pcpus) != EXIT_SUCCESS) ||
+            (bitmask_init(&virt_info.pcpu_low_mask, virt_info.num_pcpus) != EXIT_SUCCESS) ||
+            (bitmask_init(&virt_info.pcpu_parked_mask, virt_info.num_pcpus) != EXIT_SUCCESS) ||
+            ((virt_info.pcpu_drain = calloc(virt_info.num_pcpus, sizeof(int))) == NULL))
+        {
+            /* Set error status showing no memory available */
+            status = VCPU_SCHEDULER_NOMEM;
+        }
+        else
+        {
+            /* Determine size of params for PCPU params
+               NOTE:  This code assumes all PCPU's will have same size params */
+            status = virNodeGetCPUStats(virt_info.conn, 0, NULL, &virt_info.num_params, 0);
+        }
+
+        /* Ensure CPU stats returned successfully */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Allocate memory for params for a PCPU */
+            virt_info.params = calloc(virt_info.num_params * sizeof(virNodeCPUStats), 1);
+
+            /* Ensure param memory allocated */
+            if (virt_info.params != NULL)
+            {
+                /* Initialize PCPUs */
+                status = pcpu_stats_init();
+
+                /* Check if PCPUs initialized */
+                if (status == EXIT_SUCCESS)
+                {
+                    /* Build host topology on top of PCPUs */
+                    status = topology_init();
+                }
+
+                /* Check if topology initialized (domains of a shared connection are
+                   added by the resource manager) */
+                if ((status == EXIT_SUCCESS) && (!virt_info.shared))
+                {
+                    /* Add the domains already running */
+                    status = vcpu_stats_init();
+                }
+            }
+            else
+            {
+                /* Set error status showing no memory available */
+                status = VCPU_SCHEDULER_NOMEM;
+            }
+        }
+    }
+
+    /* Start serving the metrics endpoint (if enabled) once everything else is set up */
+    if ((status == EXIT_SUCCESS) && (sched_config.metrics_port) &&
+        (metrics_init(&virt_info.metrics, sched_config.metrics_port) != EXIT_SUCCESS))
+    {
+        /* Set metrics error */
+        status = VCPU_SCHEDULER_METRICS_ERROR;
+    }
+
+    /* Start serving the monitor stream (if enabled) */
+    if ((status == EXIT_SUCCESS) && (sched_config.monitor_path != NULL) &&
+        (monitor_init(&virt_info.monitor, sched_config.monitor_path) != EXIT_SUCCESS))
+    {
+        /* Set monitor error */
+        status = VCPU_SCHEDULER_MONITOR_ERROR;
+    }
+
+    /* Create the shared memory snapshot (if enabled) */
+    if ((status == EXIT_SUCCESS) && (sched_config.shm_name != NULL) &&
+        (stats_shm_init(&virt_info.shm, sched_config.shm_name, STATS_SHM_SOURCE_CPU) != EXIT_SUCCESS))
+    {
+        /* Set shared memory error */
+        status = VCPU_SCHEDULER_SHM_ERROR;
+    }
+
+    /* Publish that no PCPU is parked yet (if enabled), so the file never lists PCPUs of an earlier run */
+    if ((status == EXIT_SUCCESS) && (sched_config.parked_path != NULL))
+    {
+        /* Publish empty list */
+        status = pcpu_parked_publish();
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_stats_init
+*
+*   DESCRIPTION
+*
+*       Initialize the PCPU stats data structures
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        PCPU data structures initialized
+*       Other                               Error with memory allocation or
+*                                           using libvirt
+*
+*************************************************************************/
+static int pcpu_stats_init(void)
+{
+    int index, status = EXIT_SUCCESS;
+
+
+    /* Allocate memory for PCPU structures */
+    pcpu_stats = calloc(virt_info.num_pcpus * sizeof(PCPU_STATS), 1);
+
+    /* Ensure memory allocated */
+    if (pcpu_stats != NULL)
+    {
+        /* Loop through and initialize each PCPU status structure */
+        for (index = 0 ; (index < virt_info.num_pcpus) && (status == EXIT_SUCCESS) ; index++)
+        {
+            /* Set ID for each PCPU */
+            pcpu_stats[index].id = index;
+
+            /* Allocate cpu map for this PCPU */
+            pcpu_stats[index].cpumap = calloc(virt_info.cpumap_len, 1);
+
+            /* Ensure memory allocated */
+            if (pcpu_stats[index].cpumap != NULL)
+            {
+                /* Set cpu map so a VCPU is pinned exclusively to this PCPU */
+                VIR_USE_CPU(pcpu_stats[index].cpumap, index);
+
+                /* Get this PCPUs initial information */
+                status = virNodeGetCPUStats(virt_info.conn, index, virt_info.params, &virt_info.num_params, 0);
+
+                /* Ensure success here */
+                if (status == EXIT_SUCCESS)
+                {
+                    /* Get PCPU idle time */
+                    status = pcpu_get_idle(virt_info.num_params, &(pcpu_stats[index].last_time));
+                    pcpu_stats[index].last_ns = interval_now();
+                }
+            }
+            else
+            {
+                /* Set error status showing no memory available */
+                status = VCPU_SCHEDULER_NOMEM;
+            }
+        }   /* for loop */
+    }
+    else
+    {
+        /* Set error status showing no memory available */
+        status = VCPU_SCHEDULER_NOMEM;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       topology_init
+*
+*   DESCRIPTION
+*
+*       Reads the host NUMA node / socket / core / SMT thread and L3 cache
+*       topology from the hypervisor capabilities and builds the topology
+*       hierarchy on top of the PCPU stats.  If the capabilities don't
+*       include the topology, every PCPU is treated as its own core in a
+*       single NUMA node
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Topology initialized
+*       Other                               Error with memory allocation
+*
+*************************************************************************/
+static int  topology_init(void)
+{
+    int         index, status = EXIT_SUCCESS;
+    char *      caps = NULL;
+
+
+    /* Loop through each PCPU */
+    for (index = 0; index < virt_info.num_pcpus; index++)
+    {
+        /* Default to a flat topology - each PCPU is a core in node 0 with no SMT siblings */
+        pcpu_stats[index].node_id = 0;
+        pcpu_stats[index].socket_id = 0;
+        pcpu_stats[index].core_id = index;
+        pcpu_stats[index].l3_id = 0;
+    }
+
+    /* Check if topology is used */
+    if (sched_config.topology_aware)
+    {
+        /* Get host capabilities XML */
+        caps = virConnectGetCapabilities(virt_info.conn);
+
+        /* Ensure capabilities obtained */
+        if (caps != NULL)
+        {
+            /* Get node / socket / core of each PCPU */
+            topology_parse_cpus(caps);
+
+            /* Get L3 cache shared by each PCPU */
+            status = topology_parse_caches(caps);
+
+            /* Free capabilities */
+            free(caps);
+        }
+    }
+
+    /* Ensure success */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Link SMT sibling threads of each core and determine PCPU placement order */
+        status = topology_link_siblings();
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       topology_parse_cpus
+*
+*   DESCRIPTION
+*
+*       Parses the NUMA cells of the host topology in the capabilities
+*       XML to get the node, socket and core of each PCPU
+*
+*   INPUTS
+*
+*       caps                                Capabilities XML
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void topology_parse_cpus(const char * caps)
+{
+    const char *    topology;
+    const char *    topology_end;
+    const char *    cell;
+    const char *    cpu;
+    int             node = 0, id, value;
+
+
+    /* Find host NUMA topology (CPU model topology tag has attributes instead) */
+    topology = strstr(caps, "<topology>");
+    topology_end = (topology != NULL ? strstr(topology, "</topology>") : NULL);
+
+    /* Ensure host topology found */
+    if (topology_end != NULL)
+    {
+        /* Loop through each cell / cpu tag in the topology */
+        while (topology < topology_end)
+        {
+            /* Find next cell and next cpu */
+            cell = strstr(topology, "<cell ");
+            cpu = strstr(topology, "<cpu ");
+
+            /* Check if no more cpus in topology */
+            if ((cpu == NULL) || (cpu >= topology_end))
+            {
+                /* Done */
+                break;
+            }
+
+            /* Check if a new cell starts before the next cpu */
+            if ((cell != NULL) && (cell < cpu))
+            {
+                /* Get node ID of this cell */
+                xml_attr_int(cell, "id", &node);
+
+                /* Move past cell tag */
+                topology = cell + 1;
+            }
+            else
+            {
+                /* Get ID of this PCPU and ensure it's one being tracked */
+                if ((xml_attr_int(cpu, "id", &id) == EXIT_SUCCESS) && (id >= 0) && (id < virt_info.num_pcpus))
+                {
+                    /* Save node for this PCPU */
+                    pcpu_stats[id].node_id = node;
+
+                    /* Save socket for this PCPU (core IDs are only unique within a socket) */
+                    if (xml_attr_int(cpu, "socket_id", &value) == EXIT_SUCCESS)
+                    {
+                        pcpu_stats[id].socket_id = value;
+                    }
+
+                    /* Save core for this PCPU */
+                    if (xml_attr_int(cpu, "core_id", &value) == EXIT_SUCCESS)
+                    {
+                        pcpu_stats[id].core_id = value;
+                    }
+                }
+
+                /* Move past cpu tag */
+                topology = cpu + 1;
+            }
+        }
+    }
+
+    /* Loop through each PCPU */
+    for (id = 0; id < virt_info.num_pcpus; id++)
+    {
+        /* Default L3 cache to the socket (replaced below if the cache banks are reported) */
+        pcpu_stats[id].l3_id = pcpu_stats[id].socket_id;
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       topology_parse_caches
+*
+*   DESCRIPTION
+*
+*       Parses the level 3 cache banks in the capabilities XML to get
+*       the L3 cache shared by each PCPU
+*
+*   INPUTS
+*
+*       caps                                Capabilities XML
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Caches parsed
+*       VCPU_SCHEDULER_NOMEM                No memory for bank PCPU list
+*
+*************************************************************************/
+static int  topology_parse_caches(const char * caps)
+{
+    int             id, level, pcpu, status = EXIT_SUCCESS;
+    const char *    bank;
+    const char *    cpus;
+    BITMASK         bank_cpus;
+
+
+    /* Allocate a mask for the PCPUs of a cache bank */
+    if (bitmask_init(&bank_cpus, virt_info.num_pcpus) == EXIT_SUCCESS)
+    {
+        /* Loop through each cache bank */
+        for (bank = strstr(caps, "<bank "); bank != NULL; bank = strstr(bank + 1, "<bank "))
+        {
+            /* Get ID, level and PCPUs of bank and ensure this is an L3 cache */
+            cpus = xml_attr_find(bank, "cpus");
+            if ((xml_attr_int(bank, "id", &id) == EXIT_SUCCESS) &&
+                (xml_attr_int(bank, "level", &level) == EXIT_SUCCESS) &&
+                (level == 3) && (cpus != NULL))
+            {
+                /* Get the PCPUs sharing this cache */
+                bitmask_zero(&bank_cpus);
+                bitmask_parse_list(&bank_cpus, cpus);
+
+                /* Loop through each PCPU sharing this cache */
+                BITMASK_FOR_EACH(&bank_cpus, pcpu)
+                {
+                    /* Save L3 cache for this PCPU */
+                    pcpu_stats[pcpu].l3_id = id;
+                }
+            }
+        }
+
+        /* Free the mask */
+        bitmask_free(&bank_cpus);
+    }
+    else
+    {
+        /* Set error status showing no memory available */
+        status = VCPU_SCHEDULER_NOMEM;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       topology_link_siblings
+*
+*   DESCRIPTION
+*
+*       Links the SMT sibling threads of each core into a circular list
+*       and determines the order PCPUs are used for initial placement
+*       (first thread of every core, then second thread of every core,
+*       etc) so idle full cores are used before SMT siblings
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Siblings linked
+*       VCPU_SCHEDULER_NOMEM                No memory for placement order
+*
+*************************************************************************/
+static int  topology_link_siblings(void)
+{
+    int             index, other, order = 0, smt_index, status = EXIT_SUCCESS;
+    PCPU_STATS *    pcpu;
+    PCPU_STATS *    first;
+
+
+    /* Loop through each PCPU */
+    for (index = 0; index < virt_info.num_pcpus; index++)
+    {
+        /* Start with PCPU as only thread of its core */
+        pcpu = &pcpu_stats[index];
+        pcpu->smt_next = pcpu;
+        pcpu->smt_index = 0;
+        first = NULL;
+
+        /* Loop through lower PCPUs looking for other threads of the same core */
+        for (other = 0; other < index; other++)
+        {
+            /* Check if other PCPU is on the same core */
+            if ((pcpu_stats[other].node_id == pcpu->node_id) &&
+                (pcpu_stats[other].socket_id == pcpu->socket_id) &&
+                (pcpu_stats[other].core_id == pcpu->core_id))
+            {
+                /* Save first thread of the core */
+                first = (first == NULL ? &pcpu_stats[other] : first);
+
+                /* Count this thread's position within the core */
+                pcpu->smt_index++;
+            }
+        }
+
+        /* Check if other threads of the same core were found */
+        if (first != NULL)
+        {
+            /* Insert PCPU into the core's list of threads */
+            pcpu->smt_next = first->smt_next;
+            first->smt_next = pcpu;
+        }
+    }
+
+    /* Allocate PCPU placement order */
+    virt_info.pcpu_order = calloc(virt_info.num_pcpus * sizeof(int), 1);
+
+    /* Ensure memory allocated */
+    if (virt_info.pcpu_order != NULL)
+    {
+        /* Loop through each thread position within a core */
+        for (smt_index = 0; order < virt_info.num_pcpus; smt_index++)
+        {
+            /* Loop through each PCPU */
+            for (index = 0; index < virt_info.num_pcpus; index++)
+            {
+                /* Check if PCPU is at this thread position */
+                if (pcpu_stats[index].smt_index == smt_index)
+                {
+                    /* Add PCPU to placement order */
+                    virt_info.pcpu_order[order++] = index;
+                }
+            }
+        }
+    }
+    else
+    {
+        /* Set error status showing no memory available */
+        status = VCPU_SCHEDULER_NOMEM;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_core_idle
+*
+*   DESCRIPTION
+*
+*       Determines if every SMT thread of a PCPU's core is idle (below
+*       the low utilization threshold with no VCPUs)
+*
+*   INPUTS
+*
+*       pcpu                                Pointer to any PCPU of the core
+*       use_plan                            Non-zero to use planned (bin
+*                                           packing) rather than measured
+*                                           utilization and VCPUs
+*
+*   OUTPUTS
+*
+*       1                                   Full core is idle
+*       0                                   At least 1 thread of core is busy
+*
+*************************************************************************/
+static int  pcpu_core_idle(PCPU_STATS * pcpu, int use_plan)
+{
+    PCPU_STATS *    thread = pcpu;
+
+
+    /* Loop through each thread of the core */
+    do
+    {
+        /* Check if this thread is busy */
+        if (( use_plan && ((thread->plan_util >= sched_config.low_threshold) || (thread->plan_pinned > 0))) ||
+            (!use_plan && ((thread->cpu_util >= sched_config.low_threshold) || (thread->num_pinned > 0))))
+        {
+            /* Core not idle */
+            return (0);
+        }
+
+        /* Move to next thread */
+        thread = thread->smt_next;
+
+    /* Loop until back to start of core */
+    } while (thread != pcpu);
+
+    /* Core idle */
+    return (1);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       topology_idle_core
+*
+*   DESCRIPTION
+*
+*       Determines if any core with SMT siblings is completely idle
+*
+*   INPUTS
+*
+*       use_plan                            Non-zero to use planned (bin
+*                                           packing) rather than measured
+*                                           utilization and VCPUs
+*
+*   OUTPUTS
+*
+*       1                                   An idle full core is available
+*       0                                   No idle full core
+*
+*************************************************************************/
+static int  topology_idle_core(int use_plan)
+{
+    int     index;
+
+
+    /* Loop through each PCPU */
+    for (index = 0; (sched_config.topology_aware) && (index < virt_info.num_pcpus); index++)
+    {
+        /* Check first thread of each core that has SMT siblings */
+        if ((pcpu_stats[index].smt_index == 0) && (pcpu_stats[index].smt_next != &pcpu_stats[index]) &&
+            (pcpu_core_idle(&pcpu_stats[index], use_plan)))
+        {
+            /* Idle core found */
+            return (1);
+        }
+    }
+
+    /* No idle core */
+    return (0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_placement_cost
+*
+*   DESCRIPTION
+*
+*       Determines the cost (in % utilization) of moving a VCPU from its
+*       current PCPU to another PCPU based on the host topology.  Moving
+*       out of the L3 cache or NUMA node loses cache / memory locality and
+*       loading a PCPU whose SMT sibling is busy (while an idle full core
+*       is available) reduces the throughput of both threads
+*
+*   INPUTS
+*
+*       src                                 Pointer to current PCPU
+*       dst                                 Pointer to new PCPU
+*       idle_core                           Non-zero if an idle full core
+*                                           is available
+*       use_plan                            Non-zero to use planned (bin
+*                                           packing) rather than measured
+*                                           utilization and VCPUs
+*
+*   OUTPUTS
+*
+*       int                                 Placement cost
+*
+*************************************************************************/
+static int  pcpu_placement_cost(PCPU_STATS * src, PCPU_STATS * dst, int idle_core, int use_plan)
+{
+    int             cost = 0;
+    PCPU_STATS *    thread;
+
+
+    /* Check if topology is used */
+    if (sched_config.topology_aware)
+    {
+        /* Check if moving to a different NUMA node */
+        if (dst->node_id != src->node_id)
+        {
+            /* Add NUMA node cost */
+            cost += VCPU_SCHEDULER_NUMA_COST;
+        }
+        /* Check if moving to a different L3 cache */
+        else if (dst->l3_id != src->l3_id)
+        {
+            /* Add L3 cache cost */
+            cost += VCPU_SCHEDULER_L3_COST;
+        }
+
+        /* Check if an idle full core is available */
+        if (idle_core)
+        {
+            /* Loop through each SMT sibling thread of the new PCPU */
+            for (thread = dst->smt_next; thread != dst; thread = thread->smt_next)
+            {
+                /* Check if sibling thread is busy */
+                if ((use_plan ? thread->plan_util : thread->cpu_util) >= sched_config.low_threshold)
+                {
+                    /* Add SMT cost */
+                    cost += VCPU_SCHEDULER_SMT_COST;
+                    break;
+                }
+            }
+        }
+    }
+
+    /* Return cost to caller */
+    return (cost);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_stats_init
+*
+*   DESCRIPTION
+*
+*       Initialize the VCPU stats data structures for the domains running
+*       at startup (domains started later are added by domain events)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VCPU data structures initialized
+*       Other                               Error with memory allocation or
+*                                           using libvirt
+*
+*************************************************************************/
+static int vcpu_stats_init(void)
+{
+    int             index, num_domains, status = EXIT_SUCCESS;
+    virDomainPtr *  domain_list;
+
+
+    /* Get list of active domains */
+    num_domains = virConnectListAllDomains(virt_info.conn, &domain_list, VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+
+    /* Ensure list of domains obtained (no domains running yet is fine) */
+    if (num_domains >= 0)
+    {
+        /* Loop through each domain */
+        for (index = 0; index < num_domains; index++)
+        {
+            /* Check if no errors so far */
+            if (status == EXIT_SUCCESS)
+            {
+                /* Add domain and its VCPUs (domain reference is handed over) */
+                status = domain_stats_add(domain_list[index]);
+
+                /* Skip a domain that stopped or couldn't be read - it is added
+                   later if a start event is received for it */
+                if ((status == VCPU_SCHEDULER_DOMAIN_GONE) || (status == VCPU_SCHEDULER_DOMAIN_INFO_ERROR))
+                {
+                    status = EXIT_SUCCESS;
+                }
+            }
+            else
+            {
+                /* Release domains not added */
+                virDomainFree(domain_list[index]);
+            }
+        }
+
+        /* Free the list */
+        free(domain_list);
+    }
+    else
+    {
+        /* Set error status appropriately */
+        status = VCPU_SCHEDULER_DOMAIN_LIST_ERROR;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_stats_add
+*
+*   DESCRIPTION
+*
+*       Adds a domain and its VCPUs to the tracked domains.  Each of the
+*       domain's VCPUs is pinned to the PCPU with the fewest VCPUs pinned
+*       (using full cores before SMT siblings and keeping sibling VCPUs on
+*       different PCPUs when possible).  The domain reference is owned by
+*       the domain stats once added and is released otherwise
+*
+*   INPUTS
+*
+*       domain                              Domain to add
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Domain added
+*       VCPU_SCHEDULER_DOMAIN_GONE          Domain stopped while being added
+*       Other                               Error with memory allocation or
+*                                           using libvirt
+*
+*************************************************************************/
+static int domain_stats_add(virDomainPtr domain)
+{
+    int             vcpu, num_vcpus, num_info, status = EXIT_SUCCESS;
+    DOMAIN_STATS *  new_domain = NULL;
+    DOMAIN_STATS ** domain_list;
+    virVcpuInfo *   vcpu_info;
+    const char *    name;
+    unsigned long long now = 0;
+    PCPU_STATS *    pcpu;
+    TRACE_PIN       record;
+
+
+    /* Get number of active VCPUs for this domain */
+    num_vcpus = virDomainGetVcpusFlags(domain, VIR_DOMAIN_AFFECT_LIVE);
+
+    /* Ensure number of VCPUs obtained */
+    if (num_vcpus <= 0)
+    {
+        /* Set domain error (the domain may have stopped already) */
+        status = (domain_gone(domain) ? VCPU_SCHEDULER_DOMAIN_GONE : VCPU_SCHEDULER_DOMAIN_INFO_ERROR);
+    }
+
+    /* Check if the domain stats list is full */
+    if ((status == EXIT_SUCCESS) && (virt_info.num_domains == virt_info.max_domains))
+    {
+        /* Grow the list (doubling so adding domains one at a time stays cheap) */
+        domain_list = realloc(domain_stats, (virt_info.max_domains ? 2 * virt_info.max_domains : 8) * sizeof(DOMAIN_STATS *));
+
+        /* Ensure memory allocated */
+        if (domain_list != NULL)
+        {
+            /* Save new list */
+            domain_stats = domain_list;
+            virt_info.max_domains = (virt_info.max_domains ? 2 * virt_info.max_domains : 8);
+        }
+        else
+        {
+            /* Set error status */
+            status = VCPU_SCHEDULER_NOMEM;
+        }
+    }
+
+    /* Check if VCPU info is too small for this domain */
+    if ((status == EXIT_SUCCESS) && (num_vcpus > virt_info.max_domain_vcpus))
+    {
+        /* Grow the VCPU info used when reading all VCPUs of a domain */
+        vcpu_info = realloc(virt_info.vcpu_info, num_vcpus * sizeof(virVcpuInfo));
+
+        /* Ensure memory allocated */
+        if (vcpu_info != NULL)
+        {
+            /* Save new VCPU info and keep track of largest number of VCPUs in a domain */
+            virt_info.vcpu_info = vcpu_info;
+            virt_info.max_domain_vcpus = num_vcpus;
+        }
+        else
+        {
+            /* Set error status */
+            status = VCPU_SCHEDULER_NOMEM;
+        }
+    }
+
+    /* Check if no errors so far */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Allocate domain stats and its VCPU stats (1 per VCPU) */
+        new_domain = calloc(1, sizeof(DOMAIN_STATS));
+
+        /* Ensure memory allocated */
+        if (new_domain != NULL)
+        {
+            new_domain->vcpus = calloc(num_vcpus, sizeof(VCPU_STATS));
+        }
+
+        /* Ensure memory allocated */
+        if ((new_domain == NULL) || (new_domain->vcpus == NULL))
+        {
+            /* Set error status */
+            status = VCPU_SCHEDULER_NOMEM;
+        }
+    }
+
+    /* Check if no errors so far */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Get initial status of all VCPUs in this domain */
+        num_info = virDomainGetVcpus(domain, virt_info.vcpu_info, num_vcpus, NULL, 0);
+
+        /* Get time the initial status was read */
+        now = interval_now();
+
+        /* Check if initial status obtained for all VCPUs */
+        if (num_info != num_vcpus)
+        {
+            /* Set domain error (the domain may have stopped already) */
+            status = (domain_gone(domain) ? VCPU_SCHEDULER_DOMAIN_GONE : VCPU_SCHEDULER_DOMAIN_INFO_ERROR);
+        }
+    }
+
+    /* Check if domain can't be added */
+    if (status != EXIT_SUCCESS)
+    {
+        /* Free anything allocated for the domain and release the domain */
+        if (new_domain != NULL)
+        {
+            free(new_domain->vcpus);
+            free(new_domain);
+        }
+
+        virDomainFree(domain);
+    }
+    else
+    {
+        /* Assign domain IDs */
+        new_domain->domain_id = domain;
+        new_domain->dom_id = virDomainGetID(domain);
+        new_domain->num_vcpus = num_vcpus;
+
+        /* Domain and its VCPUs join the VCPU table once all VCPUs are pinned */
+        new_domain->first_slot = -1;
+
+        for (vcpu = 0; vcpu < num_vcpus; vcpu++)
+        {
+            new_domain->vcpus[vcpu].slot = -1;
+        }
+
+        /* Get name of the domain once so output never needs to ask for it */
+        name = virDomainGetName(domain);
+        snprintf(new_domain->name, VCPU_SCHEDULER_NAME_LEN, "%s", (name ? name : ""));
+
+        /* Save cycle the domain was added (its VCPUs are first measured next cycle) */
+        new_domain->add_cycle = virt_info.cycle;
+
+        /* Apply the domain's configuration file overrides before its VCPUs are placed */
+        domain_config_apply(new_domain);
+
+        /* Name the domain in the trace */
+        domain_stats_trace(new_domain);
+
+        /* Add domain to end of the domain stats list */
+        domain_stats[virt_info.num_domains] = new_domain;
+        virt_info.num_domains++;
+
+        /* Add to total number of VCPUs */
+        virt_info.num_vcpus += num_vcpus;
+
+        /* Loop through each VCPU of this domain */
+        for (vcpu = 0; (vcpu < num_vcpus) && (status == EXIT_SUCCESS); vcpu++)
+        {
+            /* Assign domain and VCPU number for VCPU */
+            new_domain->vcpus[vcpu].domain_id = domain;
+            new_domain->vcpus[vcpu].domain = new_domain;
+            new_domain->vcpus[vcpu].vcpu_num = virt_info.vcpu_info[vcpu].number;
+
+            /* Initialize VCPU stats with this information */
+            new_domain->vcpus[vcpu].last_time = virt_info.vcpu_info[vcpu].cpuTime;
+            new_domain->vcpus[vcpu].last_ns = now;
+
+            /* Pin VCPU to the PCPU with the fewest VCPUs */
+            pcpu = pcpu_initial_select(&new_domain->vcpus[vcpu]);
+            status = vcpu_pin_on_pcpu(&new_domain->vcpus[vcpu], pcpu);
+
+            /* Record initial placement (from no PCPU) and its result */
+            record.vcpu_num = new_domain->vcpus[vcpu].vcpu_num;
+            record.from = -1;
+            record.to = pcpu->id;
+            record.status = status;
+            trace_write(&virt_info.trace, TRACE_REC_PIN, new_domain->dom_id, &record, sizeof(record));
+        }
+
+        /* Check if all VCPUs pinned */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Add VCPUs to the table scanned by the rebalancing engines */
+            status = vcpu_table_build();
+        }
+        else
+        {
+            /* Remove partly added domain */
+            domain_stats_remove(new_domain);
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_stats_remove
+*
+*   DESCRIPTION
+*
+*       Removes a domain and its VCPUs from the tracked domains and frees
+*       the domain stats
+*
+*   INPUTS
+*
+*       domain                              Pointer to domain stats to remove
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void domain_stats_remove(DOMAIN_STATS * domain)
+{
+    int     index, vcpu;
+
+
+    /* Loop through each VCPU of this domain */
+    for (vcpu = 0; vcpu < domain->num_vcpus; vcpu++)
+    {
+        /* Remove VCPU from the counts of its PCPU */
+        vcpu_unpin_from_pcpu(&domain->vcpus[vcpu], domain->vcpus[vcpu].pcpu);
+    }
+
+    /* Find domain in the domain stats list */
+    for (index = 0; domain_stats[index] != domain; index++);
+
+    /* Remove domain from the list keeping the remaining domains in order */
+    virt_info.num_domains--;
+    memmove(&domain_stats[index], &domain_stats[index + 1], (virt_info.num_domains - index) * sizeof(DOMAIN_STATS *));
+
+    /* Remove domain's VCPUs from total number of VCPUs */
+    virt_info.num_vcpus -= domain->num_vcpus;
+
+    /* Release domain and free its stats */
+    virDomainFree(domain->domain_id);
+    free(domain->vcpus);
+    free(domain);
+
+    /* Rebuild VCPU table (table only shrinks so this can't fail) */
+    vcpu_table_build();
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_stats_lookup
+*
+*   DESCRIPTION
+*
+*       Finds the domain stats for the specified domain object
+*
+*   INPUTS
+*
+*       domain                              Domain to find
+*
+*   OUTPUTS
+*
+*       DOMAIN_STATS *                      Pointer to domain stats
+*       NULL                                Domain not tracked
+*
+*************************************************************************/
+static DOMAIN_STATS * domain_stats_lookup(virDomainPtr domain)
+{
+    int     index;
+
+
+    /* Loop through each domain looking for a match */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        /* Check if domain matches */
+        if (domain_same(domain_stats[index]->domain_id, domain))
+        {
+            /* Return domain */
+            return (domain_stats[index]);
+        }
+    }
+
+    /* Not found */
+    return (NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_stats_trace
+*
+*   DESCRIPTION
+*
+*       Records the name and number of VCPUs of a domain in the trace so
+*       the decoder can name the records of its domain ID
+*
+*   INPUTS
+*
+*       domain                              Pointer to domain stats
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void domain_stats_trace(DOMAIN_STATS * domain)
+{
+    TRACE_DOMAIN    record;
+
+
+    /* Fill in domain record */
+    memset(&record, 0, sizeof(record));
+    record.num_vcpus = domain->num_vcpus;
+    snprintf(record.name, TRACE_NAME_LEN, "%s", domain->name);
+
+    /* Record domain */
+    trace_write(&virt_info.trace, TRACE_REC_DOMAIN, domain->dom_id, &record, sizeof(record));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_table_build
+*
+*   DESCRIPTION
+*
+*       Rebuilds the VCPU table scanned by the rebalancing engines after
+*       domains are added / removed - the VCPUs of each domain are given
+*       consecutive slots in domain order and their utilization, PCPU and
+*       exclusive flag are copied into the table
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VCPU table built
+*       VCPU_SCHEDULER_NOMEM                No memory for VCPU table (the
+*                                           previous table is kept)
+*
+*************************************************************************/
+static int  vcpu_table_build(void)
+{
+    int             index, vcpu, slot = 0, status = EXIT_SUCCESS;
+    VCPU_TABLE *    table = &virt_info.vcpu_table;
+    VCPU_STATS *    vcpu_stats;
+    char *          block;
+    size_t          size;
+
+
+    /* Check if table is too small for all VCPUs */
+    if (virt_info.num_vcpus > table->max_slots)
+    {
+        /* Allocate all arrays in 1 block (pointers first so every array stays aligned) */
+        size = (virt_info.num_vcpus * sizeof(VCPU_STATS *)) + (virt_info.num_vcpus * 6 * sizeof(int)) +
+               virt_info.num_vcpus;
+        block = malloc(size);
+
+        /* Ensure memory allocated */
+        if (block != NULL)
+        {
+            /* Free old table (every slot is filled in again below) */
+            free(table->vcpu);
+
+            /* Carve the arrays out of the block */
+            table->vcpu = (VCPU_STATS **)block;
+            table->util = (int *)(block + (virt_info.num_vcpus * sizeof(VCPU_STATS *)));
+            table->util_avg = table->util + virt_info.num_vcpus;
+            table->pcpu = table->util_avg + virt_info.num_vcpus;
+            table->target = table->pcpu + virt_info.num_vcpus;
+            table->order = table->target + virt_info.num_vcpus;
+            table->index = table->order + virt_info.num_vcpus;
+            table->exclusive = (unsigned char *)(table->index + virt_info.num_vcpus);
+            table->max_slots = virt_info.num_vcpus;
+        }
+        else
+        {
+            /* Set error status */
+            status = VCPU_SCHEDULER_NOMEM;
+        }
+    }
+
+    /* Loop through each domain (if table is big enough) */
+    for (index = 0; (index < virt_info.num_domains) && (status == EXIT_SUCCESS); index++)
+    {
+        /* Give the domain's VCPUs consecutive slots */
+        domain_stats[index]->first_slot = slot;
+
+        /* Loop through each VCPU of the domain */
+        for (vcpu = 0; vcpu < domain_stats[index]->num_vcpus; vcpu++)
+        {
+            /* Copy VCPU state into its slot */
+            vcpu_stats = &domain_stats[index]->vcpus[vcpu];
+            vcpu_stats->slot = slot;
+            table->vcpu[slot] = vcpu_stats;
+            table->util[slot] = vcpu_stats->cpu_util;
+            table->util_avg[slot] = vcpu_stats->cpu_util_avg;
+            table->pcpu[slot] = (int)(vcpu_stats->pcpu - pcpu_stats);
+            table->target[slot] = -1;
+            table->order[slot] = slot;
+            table->exclusive[slot] = (domain_stats[index]->exclusive != 0);
+            slot++;
+        }
+    }
+
+    /* Check if table was built */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Save number of VCPUs in the table */
+        table->num_slots = slot;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_initial_select
+*
+*   DESCRIPTION
+*
+*       Selects the PCPU a newly added VCPU is first pinned to - the PCPU
+*       with the fewest VCPUs pinned, checking PCPUs in the initial
+*       placement order (full cores before SMT siblings).  When sibling
+*       spreading is enabled, PCPUs already running a sibling VCPU are
+*       only used if every PCPU runs a sibling.  PCPUs running an
+*       exclusive VCPU are only used if every PCPU runs one
+*
+*   INPUTS
+*
+*       vcpu                                Pointer to VCPU to place
+*
+*   OUTPUTS
+*
+*       PCPU_STATS *                        Pointer to selected PCPU
+*
+*************************************************************************/
+static PCPU_STATS * pcpu_initial_select(VCPU_STATS * vcpu)
+{
+    int             index, load, best_load = INT_MAX;
+    PCPU_STATS *    pcpu;
+    PCPU_STATS *    best_pcpu = NULL;
+
+
+    /* Loop through each PCPU in placement order */
+    for (index = 0; index < virt_info.num_pcpus; index++)
+    {
+        /* Get next PCPU */
+        pcpu = &pcpu_stats[virt_info.pcpu_order[index]];
+
+        /* Use number of VCPUs pinned as the load, making a PCPU with a sibling
+           VCPU worse than any PCPU without a sibling */
+        load = pcpu->num_pinned;
+        load += ((sched_config.spread_siblings && pcpu_has_sibling(pcpu, vcpu)) ? virt_info.num_vcpus : 0);
+
+        /* Make a PCPU running an exclusive VCPU worse than any other PCPU */
+        load += (pcpu->num_exclusive ? 2 * virt_info.num_vcpus : 0);
+
+        /* Check if this PCPU is less loaded (earliest PCPU wins ties) */
+        if (load < best_load)
+        {
+            /* Save best PCPU */
+            best_load = load;
+            best_pcpu = pcpu;
+        }
+    }
+
+    /* Return PCPU to caller */
+    return (best_pcpu);
+}
+
+
+#ifndef RESOURCE_MANAGER
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_process
+*
+*   DESCRIPTION
+*
+*       Processes domain start / stop events received since the last
+*       cycle - started domains are added and stopped domains are removed
+*       from the tracked domains (utilization history of all other domains
+*       is kept)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Domain events processed
+*       Other                               Error with memory allocation
+*
+*************************************************************************/
+static int  domain_events_process(void)
+{
+    int             status = EXIT_SUCCESS;
+    DOMAIN_EVENT *  event;
+    DOMAIN_EVENT *  next;
+
+
+    /* Loop through each event received (oldest first) */
+    for (event = domain_events_get(&virt_info.events); event != NULL; event = next)
+    {
+        /* Get next event before this one is freed */
+        next = event->next;
+
+        /* Check if no errors so far */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Add / remove the event's domain (domain reference is handed over) */
+            status = vcpu_policy_domain_event(event->type, event->domain);
+            event->domain = NULL;
+        }
+
+        /* Done with event */
+        domain_event_free(event);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+#endif  /* RESOURCE_MANAGER */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_policy_domain_event
+*
+*   DESCRIPTION
+*
+*       Adds a started domain to / removes a stopped domain from the
+*       tracked domains (used for this daemon's own events and by the
+*       resource manager).  The domain reference is handed over - it is
+*       owned by the domain stats if the domain is added and is released
+*       otherwise
+*
+*   INPUTS
+*
+*       type                                DOMAIN_EVENT_ADDED / REMOVED
+*       domain                              Domain started / stopped
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Domain event processed
+*       Other                               Error with memory allocation
+*
+*************************************************************************/
+int vcpu_policy_domain_event(int type, virDomainPtr domain)
+{
+    int             status = EXIT_SUCCESS;
+    DOMAIN_STATS *  stats = domain_stats_lookup(domain);
+
+
+    /* Check if domain started and isn't tracked yet (ie start event received
+       for a domain that was already in the domain list at startup) */
+    if ((type == DOMAIN_EVENT_ADDED) && (stats == NULL))
+    {
+        /* Add domain (domain reference is handed over) */
+        status = domain_stats_add(domain);
+
+        /* Skip a domain that stopped again or couldn't be read */
+        if ((status == VCPU_SCHEDULER_DOMAIN_GONE) || (status == VCPU_SCHEDULER_DOMAIN_INFO_ERROR))
+        {
+            status = EXIT_SUCCESS;
+        }
+    }
+    else
+    {
+        /* Check if a tracked domain stopped */
+        if ((type != DOMAIN_EVENT_ADDED) && (stats != NULL))
+        {
+            /* Remove domain */
+            domain_stats_remove(stats);
+        }
+
+        /* Release the domain reference (not kept) */
+        virDomainFree(domain);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_pinning_adjust
+*
+*   DESCRIPTION
+*
+*       Adjusts / changes VCPU to PCPU pinning using the configured
+*       rebalancing engine, then the CPU shares / VCPU quota of each
+*       domain from its priority tier
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Adjustment of pinning for VCPU
+*                                           was successful
+*       Other                               Error when pinning of VCPU
+*
+*************************************************************************/
+static int  vcpu_pinning_adjust(void)
+{
+    int     status;
+
+
+    /* Reset number of VCPUs repinned this cycle */
+    virt_info.num_repins = 0;
+
+    /* Check if VCPUs are packed onto fewer PCPUs (no PCPU has been high for the settle cycles) */
+    if ((sched_config.consolidate) && (bitmask_empty(&virt_info.pcpu_high_mask)) &&
+        ((virt_info.cycle - virt_info.high_cycle) >= VCPU_SCHEDULER_CONSOLIDATE_SETTLE))
+    {
+        /* Empty the least loaded PCPUs onto the others */
+        status = vcpu_pinning_consolidate();
+    }
+    /* Check which engine is configured */
+    else if (sched_config.engine == VCPU_SCHEDULER_ENGINE_BINPACK)
+    {
+        /* Compute full assignment and repin VCPUs that differ */
+        status = vcpu_pinning_adjust_binpack();
+    }
+    else
+    {
+        /* Move best fit VCPUs to low PCPUs */
+        status = vcpu_pinning_adjust_greedy();
+    }
+
+    /* Set CPU shares / VCPU quota of domains whose priority tier or contention changed */
+    status = (status == EXIT_SUCCESS ? domain_sched_adjust() : status);
+
+    /* Wait for the repins (and scheduler parameters) queued to the workers */
+    status = (status == EXIT_SUCCESS ? vcpu_repin_wait() : status);
+
+    /* Add VCPUs repinned this cycle to the total */
+    virt_info.total_repins += virt_info.num_repins;
+
+    /* Check if VCPUs are packed */
+    if (sched_config.consolidate)
+    {
+        /* Find the PCPUs left without VCPUs */
+        pcpu_parked_update();
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_pinning_adjust_greedy
+*
+*   DESCRIPTION
+*
+*       Adjusts / changes VCPU to PCPU pinning based on latest stats
+*       taken for VCPU and PCPU CPU utilization and specified
+*       thresholds for changing pinning.  The VCPUs of each PCPU are
+*       indexed by smoothed utilization once per cycle, so the best fit
+*       on each high PCPU for a low PCPU is found by a binary search
+*       (vcpu_best_fit) instead of comparing every VCPU
+*
+*       An exclusive VCPU is only moved off a PCPU shared with another
+*       exclusive VCPU (and only onto an empty PCPU) - other VCPUs sharing
+*       its PCPU are moved away instead, counting the PCPU as fully busy
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Adjustment of pinning for VCPU
+*                                           was successful
+*       Other                               Error when pinning of VCPU
+*
+*************************************************************************/
+static int  vcpu_pinning_adjust_greedy(void)
+{
+    VCPU_TABLE *    table = &virt_info.vcpu_table;
+    int             pcpu_high, pcpu_low, best_slot, vcpu_best_delta, idle_core, status = EXIT_SUCCESS;
+
+
+    /* Determine if an idle full core is available (to avoid loading SMT siblings) */
+    idle_core = topology_idle_core(0);
+
+    /* Index the VCPUs of each PCPU by smoothed utilization (only needed if any PCPU can be balanced) */
+    if ((!bitmask_empty(&virt_info.pcpu_high_mask)) && (!bitmask_empty(&virt_info.pcpu_low_mask)))
+    {
+        vcpu_table_index();
+    }
+
+
+    /* Loop through each low utilized PCPU until all low / high utilized
+       PCPUs are adjusted and no errors */
+    for (pcpu_low = bitmask_next_set(&virt_info.pcpu_low_mask, 0);
+         (pcpu_low >= 0) && (!bitmask_empty(&virt_info.pcpu_high_mask)) && (status == EXIT_SUCCESS);
+         pcpu_low = bitmask_next_set(&virt_info.pcpu_low_mask, pcpu_low + 1))
+    {
+        /* Reset best VCPU delta for best fit */
+        vcpu_best_delta = INT_MAX;
+
+        /* Set best VCPU slot to none */
+        best_slot = -1;
+
+        /* Loop through each high utilized PCPU looking for the best fit
+           on the low utilized PCPU among its VCPUs */
+        BITMASK_FOR_EACH(&virt_info.pcpu_high_mask, pcpu_high)
+        {
+            vcpu_best_fit(pcpu_high, pcpu_low, idle_core, &best_slot, &vcpu_best_delta);
+        }
+
+        /* Ensure the best VCPU was found */
+        if (best_slot >= 0)
+        {
+            /* Clear high PCPU mask bit for the VCPU being migrated (its index isn't
+               used again this cycle, so the move below doesn't have to update it) */
+            BITMASK_CLEAR(&virt_info.pcpu_high_mask, table->pcpu[best_slot]);
+
+            /* Move best fit VCPU from current PCPU to less loaded PCPU */
+            status = vcpu_repin(table->vcpu[best_slot], &pcpu_stats[pcpu_low]);
+
+            /* A domain that stopped since its stats were collected (or is still busy
+               with a repin that timed out) is skipped */
+            status = (((status == VCPU_SCHEDULER_DOMAIN_GONE) || (status == VCPU_SCHEDULER_DOMAIN_BUSY)) ?
+                      EXIT_SUCCESS : status);
+        }
+
+    }   /* for loop */
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_table_index
+*
+*   DESCRIPTION
+*
+*       Builds the PCPU index of the VCPU table - the slots of the VCPUs
+*       pinned to each PCPU are grouped together (starting at the PCPU's
+*       index_start) and each group is sorted by smoothed utilization
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void     vcpu_table_index(void)
+{
+    VCPU_TABLE *    table = &virt_info.vcpu_table;
+    int             pcpu, slot, start = 0;
+
+
+    /* Loop through each PCPU */
+    for (pcpu = 0; pcpu < virt_info.num_pcpus; pcpu++)
+    {
+        /* Give the PCPU a group large enough for its pinned VCPUs */
+        pcpu_stats[pcpu].index_start = start;
+        start += pcpu_stats[pcpu].num_pinned;
+    }
+
+    /* Loop through each VCPU in the table */
+    for (slot = 0; slot < table->num_slots; slot++)
+    {
+        /* Add slot to the group of its PCPU (index_start is moved past the group) */
+        table->index[pcpu_stats[table->pcpu[slot]].index_start++] = slot;
+    }
+
+    /* Loop through each PCPU */
+    for (pcpu = 0; pcpu < virt_info.num_pcpus; pcpu++)
+    {
+        /* Move index_start back to the start of the group and sort the group */
+        pcpu_stats[pcpu].index_start -= pcpu_stats[pcpu].num_pinned;
+        qsort(&table->index[pcpu_stats[pcpu].index_start], pcpu_stats[pcpu].num_pinned, sizeof(int),
+              vcpu_util_avg_compare);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_best_fit
+*
+*   DESCRIPTION
+*
+*       Finds the VCPU of a high PCPU that brings a low PCPU closest to
+*       the target utilization, if it fits better than the best fit found
+*       so far.  The placement cost is the same for every VCPU of the high
+*       PCPU, so the ideal VCPU has the target less the low PCPU's load -
+*       a binary search of the PCPU's index finds it and the search moves
+*       outward only while a VCPU could still fit better (a VCPU that
+*       can't move is passed over).  Ties go to the lowest slot
+*
+*   INPUTS
+*
+*       pcpu_high                           Index of high utilized PCPU
+*       pcpu_low                            Index of low utilized PCPU
+*       idle_core                           Non-zero if an idle full core
+*                                           is available
+*       best_slot                           Pointer to slot of best fit
+*                                           VCPU (-1 = none)
+*       best_delta                          Pointer to distance from target
+*                                           of best fit VCPU
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void     vcpu_best_fit(int pcpu_high, int pcpu_low, int idle_core, int * best_slot, int * best_delta)
+{
+    VCPU_TABLE *    table = &virt_info.vcpu_table;
+    int *           index = &table->index[pcpu_stats[pcpu_high].index_start];
+    int             low, high, middle, up, down, ideal, cost, high_util;
+
+
+    /* Calculate the ideal VCPU utilization and the cost of moving a VCPU away from its current
+       cache / NUMA node */
+    ideal = sched_config.pcpu_target - pcpu_stats[pcpu_low].cpu_util;
+    cost = pcpu_placement_cost(&pcpu_stats[pcpu_high], &pcpu_stats[pcpu_low], idle_core, 0);
+
+    /* Count a PCPU an exclusive VCPU shares as fully busy so the gain of
+       moving the other VCPUs away always beats the migration penalty */
+    high_util = (pcpu_stats[pcpu_high].num_exclusive ? 100 : pcpu_stats[pcpu_high].cpu_util);
+
+    /* Binary search for the first VCPU with at least the ideal utilization */
+    low = 0;
+    high = pcpu_stats[pcpu_high].num_pinned;
+
+    while (low < high)
+    {
+        /* Check the middle VCPU and keep the half containing the first VCPU at / above ideal */
+        middle = low + ((high - low) / 2);
+        low = ((table->util_avg[index[middle]] < ideal) ? (middle + 1) : low);
+        high = ((table->util_avg[index[middle]] < ideal) ? high : middle);
+    }
+
+    /* Check VCPUs at / above the ideal utilization, smallest first, while they could fit better
+       AND don't make the low PCPU high utilized */
+    for (up = low;
+         (up < pcpu_stats[pcpu_high].num_pinned) &&
+         ((table->util_avg[index[up]] - ideal + cost) <= *best_delta) &&
+         ((table->util_avg[index[up]] + pcpu_stats[pcpu_low].cpu_util) < sched_config.high_threshold);
+         up++)
+    {
+        vcpu_fit_check(index[up], pcpu_high, pcpu_low, high_util, table->util_avg[index[up]] - ideal + cost,
+                       best_slot, best_delta);
+    }
+
+    /* Check VCPUs below the ideal utilization, largest first, while they could fit better */
+    for (down = low - 1; (down >= 0) && ((ideal - table->util_avg[index[down]] + cost) <= *best_delta); down--)
+    {
+        vcpu_fit_check(index[down], pcpu_high, pcpu_low, high_util, ideal - table->util_avg[index[down]] + cost,
+                       best_slot, best_delta);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_fit_check
+*
+*   DESCRIPTION
+*
+*       Saves a VCPU of a high PCPU as the best fit for a low PCPU if it
+*       is closer to the target (or as close with a lower slot) AND it
+*       doesn't make the low PCPU high utilized AND it is movable AND (if configured) the low PCPU isn't already running a
+*       sibling of this VCPU AND the gain from moving it is worth the cost
+*       of migrating it.  An exclusive VCPU only moves off another
+*       exclusive VCPU's PCPU onto an empty PCPU
+*
+*   INPUTS
+*
+*       slot                                Slot of VCPU in the VCPU table
+*       pcpu_high                           Index of high utilized PCPU
+*       pcpu_low                            Index of low utilized PCPU
+*       high_util                           Utilization % the high PCPU
+*                                           counts as
+*       delta                               Distance from target of the low
+*                                           PCPU with this VCPU (including
+*                                           placement cost)
+*       best_slot                           Pointer to slot of best fit
+*                                           VCPU (-1 = none)
+*       best_delta                          Pointer to distance from target
+*                                           of best fit VCPU
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void     vcpu_fit_check(int slot, int pcpu_high, int pcpu_low, int high_util, int delta,
+                               int * best_slot, int * best_delta)
+{
+    VCPU_TABLE *    table = &virt_info.vcpu_table;
+
+
+    /* Check to see if this VCPU is best fit AND migration doesn't cause similar high PCPU load AND
+       it is movable AND (if configured) the low PCPU isn't already running a sibling of this VCPU
+       AND the gain from moving this VCPU is worth the cost of migrating it */
+    if (((delta < *best_delta) || ((delta == *best_delta) && (slot < *best_slot))) &&
+        ((table->util_avg[slot] + pcpu_stats[pcpu_low].cpu_util) < sched_config.high_threshold) &&
+        ((!table->exclusive[slot]) ||
+         ((pcpu_stats[pcpu_high].num_exclusive > 1) && (pcpu_stats[pcpu_low].num_pinned == 0))) &&
+        ((!sched_config.spread_siblings) || (!pcpu_has_sibling(&pcpu_stats[pcpu_low], table->vcpu[slot]))) &&
+        (vcpu_migration_allowed(table->vcpu[slot], high_util, pcpu_stats[pcpu_low].cpu_util, virt_info.num_repins)))
+    {
+        /* Save new best delta and slot of this VCPU */
+        *best_delta = delta;
+        *best_slot = slot;
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_pinning_adjust_binpack
+*
+*   DESCRIPTION
+*
+*       Adjusts / changes VCPU to PCPU pinning by computing a complete
+*       target assignment of all VCPUs each cycle and then only repinning
+*       the VCPUs whose target PCPU differs from their current PCPU
+*
+*       VCPUs are placed largest smoothed utilization first.  A VCPU stays
+*       on its current PCPU if it still fits under the target utilization
+*       there, otherwise it is placed on the least loaded PCPU (if the
+*       migration is allowed).  The gain of a move is judged against the
+*       measured PCPU loads with the moves planned so far applied, not
+*       against the partly built plan, so a host that is evenly loaded
+*       isn't churned.  No plan is made unless a PCPU is below the target
+*       and the spread between the most and least loaded PCPU exceeds the
+*       migration penalty
+*
+*       Exclusive VCPUs are placed before all others, each on a PCPU of
+*       its own (the least loaded PCPU not yet reserved if its current
+*       PCPU is taken by another exclusive VCPU), and the whole PCPU is
+*       reserved so no other VCPU is planned there
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Adjustment of pinning for VCPU
+*                                           was successful
+*       Other                               Error when pinning of VCPU
+*
+*************************************************************************/
+static int  vcpu_pinning_adjust_binpack(void)
+{
+    VCPU_TABLE *    table = &virt_info.vcpu_table;
+    int             index, slot, pcpu, target, num_moves = 0, status = EXIT_SUCCESS;
+    int             cost, best_cost = 0, idle_core;
+    int             util_min = 0, util_max = 0;
+
+
+    /* Loop through each PCPU finding the least and most loaded */
+    for (pcpu = 0; pcpu < virt_info.num_pcpus; pcpu++)
+    {
+        util_min = (((pcpu == 0) || (pcpu_stats[pcpu].cpu_util < util_min)) ? pcpu_stats[pcpu].cpu_util : util_min);
+        util_max = (((pcpu == 0) || (pcpu_stats[pcpu].cpu_util > util_max)) ? pcpu_stats[pcpu].cpu_util : util_max);
+    }
+
+    /* Only rebalance when at least 1 PCPU is overloaded, another PCPU has room below the target and the
+       spread between them is worth a migration - once balanced (or evenly overloaded) no more changes
+       are made to VCPU pinning */
+    if ((!bitmask_empty(&virt_info.pcpu_high_mask)) && (util_min < sched_config.pcpu_target) &&
+        ((util_max - util_min) > sched_config.migration_penalty))
+    {
+        /* Loop through each PCPU */
+        for (pcpu = 0; pcpu < virt_info.num_pcpus; pcpu++)
+        {
+            /* Start each PCPU's plan with only the load not from VCPUs (host processes, etc)
+               and no VCPUs - measurement differences aren't allowed to make it negative */
+            pcpu_stats[pcpu].plan_util = pcpu_stats[pcpu].cpu_util - pcpu_stats[pcpu].vcpu_util;
+            pcpu_stats[pcpu].plan_util = (pcpu_stats[pcpu].plan_util < 0 ? 0 : pcpu_stats[pcpu].plan_util);
+            pcpu_stats[pcpu].plan_pinned = 0;
+            pcpu_stats[pcpu].plan_exclusive = 0;
+            pcpu_stats[pcpu].plan_moved = 0;
+        }
+
+        /* Loop through each VCPU in the table */
+        for (slot = 0; slot < table->num_slots; slot++)
+        {
+            /* Clear planned target */
+            table->target[slot] = -1;
+        }
+
+        /* Order VCPUs from highest to lowest utilization (exclusive VCPUs first) */
+        qsort(table->order, table->num_slots, sizeof(int), vcpu_util_compare);
+
+        /* Loop through each VCPU, largest first, and plan its PCPU */
+        for (index = 0; index < table->num_slots; index++)
+        {
+            /* Get next largest VCPU and the PCPU it is pinned to */
+            slot = table->order[index];
+            pcpu = table->pcpu[slot];
+
+            /* Check if VCPU is exclusive */
+            if (table->exclusive[slot])
+            {
+                /* Keep VCPU where it is unless another exclusive VCPU is already planned there */
+                target = (pcpu_stats[pcpu].plan_exclusive ? -1 : pcpu);
+
+                /* Loop through each PCPU (if moving) looking for the least loaded PCPU not yet reserved */
+                for (pcpu = 0; (pcpu_stats[table->pcpu[slot]].plan_exclusive) && (pcpu < virt_info.num_pcpus); pcpu++)
+                {
+                    /* Check if PCPU is free AND less loaded */
+                    if ((!pcpu_stats[pcpu].plan_exclusive) && ((target < 0) || (pcpu_stats[pcpu].plan_util < best_cost)))
+                    {
+                        /* Save this PCPU as target */
+                        target = pcpu;
+                        best_cost = pcpu_stats[pcpu].plan_util;
+                    }
+                }
+
+                /* Keep VCPU where it is if every PCPU is already reserved (more exclusive VCPUs than PCPUs) */
+                target = (target < 0 ? table->pcpu[slot] : target);
+            }
+            /* Check if VCPU still fits on its current PCPU (not reserved by an exclusive VCPU) */
+            else if (((pcpu_stats[pcpu].plan_util + table->util_avg[slot]) <= sched_config.pcpu_target) &&
+                     (!pcpu_stats[pcpu].plan_exclusive) &&
+                     ((!sched_config.spread_siblings) || (!pcpu_has_planned_sibling(pcpu, slot))))
+            {
+                /* Keep VCPU where it is */
+                target = pcpu;
+            }
+            else
+            {
+                /* Start with no target */
+                target = -1;
+
+                /* Determine if an idle full core is still available in the plan */
+                idle_core = topology_idle_core(1);
+
+                /* Loop through each PCPU looking for the least loaded PCPU (including
+                   the cost of leaving the VCPU's cache / NUMA node) */
+                for (pcpu = 0; pcpu < virt_info.num_pcpus; pcpu++)
+                {
+                    /* Get planned load of this PCPU including placement cost */
+                    cost = pcpu_stats[pcpu].plan_util +
+                           pcpu_placement_cost(&pcpu_stats[table->pcpu[slot]], &pcpu_stats[pcpu], idle_core, 1);
+
+                    /* Check if PCPU is less loaded AND isn't reserved by an exclusive VCPU AND (if configured)
+                       doesn't already have a sibling planned */
+                    if (((target < 0) || (cost < best_cost)) && (!pcpu_stats[pcpu].plan_exclusive) &&
+                        ((!sched_config.spread_siblings) || (!pcpu_has_planned_sibling(pcpu, slot))))
+                    {
+                        /* Save this PCPU as target */
+                        target = pcpu;
+                        best_cost = cost;
+                    }
+                }
+
+                /* Get PCPU the VCPU is pinned to */
+                pcpu = table->pcpu[slot];
+
+                /* Check if every PCPU already has a sibling planned (more VCPUs in VM than PCPUs) or is
+                   reserved OR the gain from moving this VCPU isn't worth the cost of migrating it (judged
+                   against the measured loads with the moves planned so far) */
+                if ((target < 0) ||
+                    ((target != pcpu) &&
+                     (!vcpu_migration_allowed(table->vcpu[slot], pcpu_stats[pcpu].cpu_util + pcpu_stats[pcpu].plan_moved,
+                                              pcpu_stats[target].cpu_util + pcpu_stats[target].plan_moved, num_moves))))
+                {
+                    /* Keep VCPU where it is */
+                    target = pcpu;
+                }
+            }
+
+            /* Check if a move is planned */
+            if (target != table->pcpu[slot])
+            {
+                /* Count planned move and move the VCPU's load between the measured loads */
+                num_moves++;
+                pcpu_stats[table->pcpu[slot]].plan_moved -= table->util_avg[slot];
+                pcpu_stats[target].plan_moved += table->util_avg[slot];
+            }
+
+            /* Add VCPU load to target PCPU plan */
+            table->target[slot] = target;
+            pcpu_stats[target].plan_util += table->util_avg[slot];
+            pcpu_stats[target].plan_pinned++;
+
+            /* Check if VCPU is exclusive */
+            if (table->exclusive[slot])
+            {
+                /* Reserve the whole PCPU (also makes leaving it always worth a migration) */
+                pcpu_stats[target].plan_exclusive = 1;
+                pcpu_stats[target].plan_util = (pcpu_stats[target].plan_util > 100 ? pcpu_stats[target].plan_util : 100);
+            }
+        }
+
+        /* Loop through each VCPU, largest first, and repin only the VCPUs that are planned to move */
+        for (index = 0; (index < table->num_slots) && (status == EXIT_SUCCESS); index++)
+        {
+            /* Get VCPU */
+            slot = table->order[index];
+
+            /* Check if target differs from current placement */
+            if (table->target[slot] != table->pcpu[slot])
+            {
+                /* Move VCPU to its target PCPU */
+                status = vcpu_repin(table->vcpu[slot], &pcpu_stats[table->target[slot]]);
+
+                /* A domain that stopped since its stats were collected (or is still busy
+                   with a repin that timed out) is skipped */
+                status = (((status == VCPU_SCHEDULER_DOMAIN_GONE) || (status == VCPU_SCHEDULER_DOMAIN_BUSY)) ?
+                          EXIT_SUCCESS : status);
+            }
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_pinning_consolidate
+*
+*   DESCRIPTION
+*
+*       Packs VCPUs onto fewer PCPUs while no PCPU is "high" so the PCPUs
+*       left without VCPUs can be parked.  The plan starts from the
+*       current placement and PCPUs are emptied least loaded first - a
+*       PCPU is only emptied if every one of its VCPUs fits on another
+*       PCPU still running VCPUs without taking it above the target
+*       utilization (pcpu_drain_plan), so the VCPUs still busy keep the
+*       CPU time they use.  Only the VCPUs planned to move are repinned
+*
+*       PCPUs running an exclusive VCPU are neither emptied nor given
+*       more VCPUs
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Adjustment of pinning for VCPU
+*                                           was successful
+*       Other                               Error when pinning of VCPU
+*
+*************************************************************************/
+static int  vcpu_pinning_consolidate(void)
+{
+    VCPU_TABLE *    table = &virt_info.vcpu_table;
+    int             index, slot, pcpu, num_moves = 0, status = EXIT_SUCCESS;
+
+
+    /* Loop through each PCPU */
+    for (pcpu = 0; pcpu < virt_info.num_pcpus; pcpu++)
+    {
+        /* Start each PCPU's plan with only the load not from VCPUs (host processes, etc)
+           and no VCPUs - measurement differences aren't allowed to make it negative */
+        pcpu_stats[pcpu].plan_util = pcpu_stats[pcpu].cpu_util - pcpu_stats[pcpu].vcpu_util;
+        pcpu_stats[pcpu].plan_util = (pcpu_stats[pcpu].plan_util < 0 ? 0 : pcpu_stats[pcpu].plan_util);
+        pcpu_stats[pcpu].plan_pinned = 0;
+        pcpu_stats[pcpu].plan_exclusive = (pcpu_stats[pcpu].num_exclusive != 0);
+
+        /* Add PCPU to the drain order */
+        virt_info.pcpu_drain[pcpu] = pcpu;
+    }
+
+    /* Loop through each VCPU in the table */
+    for (slot = 0; slot < table->num_slots; slot++)
+    {
+        /* Plan VCPU on the PCPU it is pinned to */
+        pcpu = table->pcpu[slot];
+        table->target[slot] = pcpu;
+        pcpu_stats[pcpu].plan_util += table->util_avg[slot];
+        pcpu_stats[pcpu].plan_pinned++;
+    }
+
+    /* Order VCPUs from highest to lowest utilization (each PCPU is emptied largest VCPU first)
+       and PCPUs from lowest to highest planned load */
+    qsort(table->order, table->num_slots, sizeof(int), vcpu_util_compare);
+    qsort(virt_info.pcpu_drain, virt_info.num_pcpus, sizeof(int), pcpu_drain_compare);
+
+    /* Loop through each PCPU, least loaded first, until the migration budget is used up */
+    for (index = 0; (index < virt_info.num_pcpus) &&
+                    ((sched_config.migration_budget <= 0) || (num_moves < sched_config.migration_budget)); index++)
+    {
+        /* Get next least loaded PCPU */
+        pcpu = virt_info.pcpu_drain[index];
+
+        /* Try to empty PCPU if it runs VCPUs and none of them is exclusive */
+        num_moves += ((pcpu_stats[pcpu].plan_pinned && !pcpu_stats[pcpu].plan_exclusive) ?
+                      pcpu_drain_plan(pcpu, num_moves) : 0);
+    }
+
+    /* Loop through each VCPU, largest first, and repin only the VCPUs that are planned to move */
+    for (index = 0; (num_moves) && (index < table->num_slots) && (status == EXIT_SUCCESS); index++)
+    {
+        /* Get VCPU */
+        slot = table->order[index];
+
+        /* Check if target differs from current placement */
+        if (table->target[slot] != table->pcpu[slot])
+        {
+            /* Move VCPU to its target PCPU */
+            status = vcpu_repin(table->vcpu[slot], &pcpu_stats[table->target[slot]]);
+
+            /* A domain that stopped since its stats were collected (or is still busy
+               with a repin that timed out) is skipped */
+            status = (((status == VCPU_SCHEDULER_DOMAIN_GONE) || (status == VCPU_SCHEDULER_DOMAIN_BUSY)) ?
+                      EXIT_SUCCESS : status);
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_drain_plan
+*
+*   DESCRIPTION
+*
+*       Plans the VCPUs of a PCPU onto the other PCPUs still running VCPUs
+*       so the PCPU is left without VCPUs.  Each VCPU, largest first, goes
+*       to the PCPU it fits best on under the target utilization (the
+*       fullest, including the cost of leaving its cache / NUMA node).
+*       The PCPU is left as it was if any of its VCPUs can't move - it
+*       hasn't stayed for the minimum residency, already moved this cycle
+*       (was planned onto the PCPU), doesn't fit anywhere or the
+*       migration budget doesn't cover all of its VCPUs
+*
+*   INPUTS
+*
+*       pcpu                                Index of PCPU to empty
+*       num_moves                           Number of VCPUs already planned
+*                                           to move this cycle
+*
+*   OUTPUTS
+*
+*       int                                 Number of VCPUs planned to move
+*                                           (0 = PCPU not emptied)
+*
+*************************************************************************/
+static int  pcpu_drain_plan(int pcpu, int num_moves)
+{
+    VCPU_TABLE *    table = &virt_info.vcpu_table;
+    int             index, slot, dst, target, cost, best_cost = 0, num_planned = 0;
+    int             fits;
+
+
+    /* Check if the migration budget covers every VCPU of the PCPU */
+    fits = ((sched_config.migration_budget <= 0) ||
+            ((num_moves + pcpu_stats[pcpu].plan_pinned) <= sched_config.migration_budget));
+
+    /* Loop through each VCPU, largest first, while every VCPU so far found a PCPU */
+    for (index = 0; (fits) && (index < table->num_slots); index++)
+    {
+        /* Get next largest VCPU */
+        slot = table->order[index];
+
+        /* Check if VCPU is planned on this PCPU */
+        if (table->target[slot] == pcpu)
+        {
+            /* Start with no target */
+            target = -1;
+
+            /* Loop through each PCPU (if the VCPU was pinned here before this cycle and has stayed
+               for the minimum residency) looking for the best fit */
+            for (dst = 0; (table->pcpu[slot] == pcpu) && (dst < virt_info.num_pcpus) &&
+                          ((virt_info.cycle - table->vcpu[slot]->last_move_cycle) >=
+                           (unsigned long long)sched_config.min_residency); dst++)
+            {
+                /* Get room left under the target after the VCPU is added, plus the placement cost */
+                cost = (sched_config.pcpu_target - (pcpu_stats[dst].plan_util + table->util_avg[slot])) +
+                       pcpu_placement_cost(&pcpu_stats[pcpu], &pcpu_stats[dst], 0, 1);
+
+                /* Check if PCPU is another PCPU still running VCPUs AND isn't reserved by an exclusive
+                   VCPU AND the VCPU fits under the target AND (if configured) doesn't already have a
+                   sibling planned AND fits better */
+                if ((dst != pcpu) && (pcpu_stats[dst].plan_pinned) && (!pcpu_stats[dst].plan_exclusive) &&
+                    ((pcpu_stats[dst].plan_util + table->util_avg[slot]) <= sched_config.pcpu_target) &&
+                    ((!sched_config.spread_siblings) || (!pcpu_has_planned_sibling(dst, slot))) &&
+                    ((target < 0) || (cost < best_cost)))
+                {
+                    /* Save this PCPU as target */
+                    target = dst;
+                    best_cost = cost;
+                }
+            }
+
+            /* Check if a PCPU was found */
+            fits = (target >= 0);
+
+            /* Check if VCPU can move */
+            if (fits)
+            {
+                /* Move VCPU load from this PCPU to the target PCPU in the plan */
+                table->target[slot] = target;
+                pcpu_stats[target].plan_util += table->util_avg[slot];
+                pcpu_stats[target].plan_pinned++;
+                pcpu_stats[pcpu].plan_util -= table->util_avg[slot];
+                pcpu_stats[pcpu].plan_pinned--;
+                num_planned++;
+            }
+        }
+    }
+
+    /* Loop through each VCPU (if the PCPU can't be emptied) */
+    for (slot = 0; (!fits) && (slot < table->num_slots); slot++)
+    {
+        /* Check if VCPU was planned off this PCPU above (only VCPUs pinned here are moved and
+           the PCPU is only tried once per cycle) */
+        if ((table->pcpu[slot] == pcpu) && (table->target[slot] != pcpu))
+        {
+            /* Move VCPU load back to this PCPU in the plan */
+            pcpu_stats[table->target[slot]].plan_util -= table->util_avg[slot];
+            pcpu_stats[table->target[slot]].plan_pinned--;
+            pcpu_stats[pcpu].plan_util += table->util_avg[slot];
+            pcpu_stats[pcpu].plan_pinned++;
+            table->target[slot] = pcpu;
+        }
+    }
+
+    /* Return number of VCPUs planned to move to caller */
+    return (fits ? num_planned : 0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_drain_compare
+*
+*   DESCRIPTION
+*
+*       Compares planned load of 2 PCPUs for sorting PCPUs from lowest to
+*       highest load (ties by highest index first, so PCPUs are parked
+*       from the end and the low numbered PCPUs keep running)
+*
+*   INPUTS
+*
+*       a                                   Pointer to 1st PCPU index
+*       b                                   Pointer to 2nd PCPU index
+*
+*   OUTPUTS
+*
+*       < 0                                 1st PCPU goes first
+*       0                                   Same order
+*       > 0                                 2nd PCPU goes first
+*
+*************************************************************************/
+static int  pcpu_drain_compare(const void * a, const void * b)
+{
+    int     pcpu_a = *(const int *)a;
+    int     pcpu_b = *(const int *)b;
+
+
+    /* Compare planned load of PCPUs (lowest first), then indexes (highest first) */
+    return ((pcpu_stats[pcpu_a].plan_util != pcpu_stats[pcpu_b].plan_util) ?
+            (pcpu_stats[pcpu_a].plan_util - pcpu_stats[pcpu_b].plan_util) :
+            (pcpu_b - pcpu_a));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_parked_update
+*
+*   DESCRIPTION
+*
+*       Finds the PCPUs left without VCPUs once the repins of the cycle
+*       are made (consolidation only) and notes if they changed so they
+*       are published again
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void pcpu_parked_update(void)
+{
+    int     index, parked;
+
+
+    /* Reset number of PCPUs parked */
+    virt_info.num_parked = 0;
+
+    /* Loop through each PCPU */
+    for (index = 0; index < virt_info.num_pcpus; index++)
+    {
+        /* PCPU is parked while no VCPU is pinned to it */
+        parked = (pcpu_stats[index].num_pinned == 0);
+        virt_info.num_parked += parked;
+
+        /* Check if PCPU was parked / unparked this cycle */
+        if (parked != (int)BITMASK_TEST(&virt_info.pcpu_parked_mask, index))
+        {
+            /* Update mask and publish the change */
+            if (parked)
+            {
+                BITMASK_SET(&virt_info.pcpu_parked_mask, index);
+            }
+            else
+            {
+                BITMASK_CLEAR(&virt_info.pcpu_parked_mask, index);
+            }
+
+            virt_info.parked_changed = 1;
+        }
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_parked_publish
+*
+*   DESCRIPTION
+*
+*       Publishes the parked PCPUs as a Linux style CPU list (ie "4-7,9",
+*       an empty line if none) in the file given with -f, for the cpufreq /
+*       cpuidle governors or host housekeeping tasks to use.  The list is
+*       written to <file>.tmp and renamed over the file, so a reader always
+*       sees a complete list
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Parked PCPUs published
+*       VCPU_SCHEDULER_PARKED_ERROR         File couldn't be written
+*
+*************************************************************************/
+static int  pcpu_parked_publish(void)
+{
+    int     first, last, status = VCPU_SCHEDULER_PARKED_ERROR;
+    char    path[PATH_MAX];
+    const char * separator = "";
+    FILE *  file = NULL;
+
+
+    /* Get path of the file written before the rename and open it */
+    if (snprintf(path, sizeof(path), "%s.tmp", sched_config.parked_path) < (int)sizeof(path))
+    {
+        file = fopen(path, "w");
+    }
+
+    /* Ensure file opened */
+    if (file != NULL)
+    {
+        /* Loop through each range of parked PCPUs */
+        for (first = bitmask_next_set(&virt_info.pcpu_parked_mask, 0); first >= 0;
+             first = bitmask_next_set(&virt_info.pcpu_parked_mask, last + 1))
+        {
+            /* Find last PCPU of range */
+            for (last = first; (last + 1 < virt_info.num_pcpus) && (BITMASK_TEST(&virt_info.pcpu_parked_mask, last + 1)); last++);
+
+            /* Write first PCPU of range (the CPU ID of each PCPU is its index) */
+            fprintf(file, "%s%d", separator, first);
+            separator = ",";
+
+            /* Check if range has more than 1 PCPU */
+            if (last > first)
+            {
+                /* Write last PCPU of range */
+                fprintf(file, "-%d", last);
+            }
+        }
+
+        /* End list and check it was written before replacing the file */
+        fprintf(file, "\n");
+        status = (((fclose(file) == 0) && (rename(path, sched_config.parked_path) == 0)) ?
+                  EXIT_SUCCESS : VCPU_SCHEDULER_PARKED_ERROR);
+    }
+
+    /* Check if published (the change is published again next cycle if not) */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Change published */
+        virt_info.parked_changed = 0;
+        virt_info.parked_error = 0;
+    }
+    else if (!virt_info.parked_error)
+    {
+        /* Warn once until publishing works again */
+        fprintf(stderr, "%s: parked PCPUs couldn't be published\n\r", sched_config.parked_path);
+        virt_info.parked_error = 1;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_util_compare
+*
+*   DESCRIPTION
+*
+*       Compares smoothed utilization of 2 VCPUs in the VCPU table for
+*       sorting VCPUs from highest to lowest utilization, with exclusive
+*       VCPUs first
+*
+*   INPUTS
+*
+*       a                                   Pointer to 1st VCPU slot
+*       b                                   Pointer to 2nd VCPU slot
+*
+*   OUTPUTS
+*
+*       < 0                                 1st VCPU goes first
+*       0                                   Same order
+*       > 0                                 2nd VCPU goes first
+*
+*************************************************************************/
+static int  vcpu_util_compare(const void * a, const void * b)
+{
+    const VCPU_TABLE *  table = &virt_info.vcpu_table;
+    int                 slot_a = *(const int *)a;
+    int                 slot_b = *(const int *)b;
+
+
+    /* Compare exclusive flags (exclusive first), then smoothed utilization of VCPUs (highest first) */
+    return ((table->exclusive[slot_a] != table->exclusive[slot_b]) ?
+            (table->exclusive[slot_b] - table->exclusive[slot_a]) :
+            (table->util_avg[slot_b] - table->util_avg[slot_a]));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_util_avg_compare
+*
+*   DESCRIPTION
+*
+*       Compares smoothed utilization of 2 VCPUs in the VCPU table for
+*       sorting the PCPU index from lowest to highest utilization (ties in
+*       slot order)
+*
+*   INPUTS
+*
+*       a                                   Pointer to 1st VCPU slot
+*       b                                   Pointer to 2nd VCPU slot
+*
+*   OUTPUTS
+*
+*       < 0                                 1st VCPU goes first
+*       0                                   Same order
+*       > 0                                 2nd VCPU goes first
+*
+*************************************************************************/
+static int  vcpu_util_avg_compare(const void * a, const void * b)
+{
+    const VCPU_TABLE *  table = &virt_info.vcpu_table;
+    int                 slot_a = *(const int *)a;
+    int                 slot_b = *(const int *)b;
+
+
+    /* Compare smoothed utilization of VCPUs (lowest first), then slots */
+    return ((table->util_avg[slot_a] != table->util_avg[slot_b]) ?
+            (table->util_avg[slot_a] - table->util_avg[slot_b]) :
+            (slot_a - slot_b));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_has_planned_sibling
+*
+*   DESCRIPTION
+*
+*       Determines if a sibling of the specified VCPU has already been
+*       planned for a PCPU during bin packing (the VCPUs of a domain have
+*       consecutive slots in the VCPU table)
+*
+*   INPUTS
+*
+*       pcpu                                Index of PCPU to check
+*       slot                                Slot of VCPU in the VCPU table
+*
+*   OUTPUTS
+*
+*       1                                   Sibling VCPU planned for PCPU
+*       0                                   No sibling VCPU planned for PCPU
+*
+*************************************************************************/
+static int  pcpu_has_planned_sibling(int pcpu, int slot)
+{
+    VCPU_TABLE *    table = &virt_info.vcpu_table;
+    DOMAIN_STATS *  domain = table->vcpu[slot]->domain;
+    int             index;
+
+
+    /* Loop through each VCPU slot of this VCPU's domain */
+    for (index = domain->first_slot; index < (domain->first_slot + domain->num_vcpus); index++)
+    {
+        /* Check if sibling is planned for this PCPU */
+        if ((index != slot) && (table->target[index] == pcpu))
+        {
+            /* Sibling found */
+            return (1);
+        }
+    }
+
+    /* No sibling found */
+    return (0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       pcpu_has_sibling
+*
+*   DESCRIPTION
+*
+*       Determines if a PCPU has a VCPU pinned to it from the same
+*       domain as the specified VCPU
+*
+*   INPUTS
+*
+*       pcpu                                Pointer to PCPU to check
+*       vcpu                                Pointer to VCPU
+*
+*   OUTPUTS
+*
+*       1                                   Sibling VCPU pinned to PCPU
+*       0                                   No sibling VCPU pinned to PCPU
+*
+*************************************************************************/
+static int  pcpu_has_sibling(PCPU_STATS * pcpu, VCPU_STATS * vcpu)
+{
+    int     index;
+
+
+    /* Loop through each VCPU of this VCPU's domain */
+    for (index = 0; index < vcpu->domain->num_vcpus; index++)
+    {
+        /* Check if sibling (and not the VCPU itself) is pinned to this PCPU */
+        if ((&vcpu->domain->vcpus[index] != vcpu) && (vcpu->domain->vcpus[index].pcpu == pcpu))
+        {
+            /* Sibling found */
+            return (1);
+        }
+    }
+
+    /* No sibling found */
+    return (0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_migration_allowed
+*
+*   DESCRIPTION
+*
+*       Determines if a VCPU may be migrated (repinned) from its current
+*       PCPU to another PCPU.  A migration costs the VCPU its cache / TLB
+*       warmth, so the VCPU must have stayed on its PCPU for the minimum
+*       residency, the per-cycle migration budget must not be used up and
+*       the projected reduction of the busier PCPU's load must exceed the
+*       configured migration penalty
+*
+*   INPUTS
+*
+*       vcpu                                Pointer to VCPU to migrate
+*       src_util                            Utilization % of current PCPU
+*                                           (including this VCPU)
+*       dst_util                            Utilization % of new PCPU
+*       num_moves                           Number of VCPUs already moved
+*                                           this cycle
+*
+*   OUTPUTS
+*
+*       1                                   Migration allowed
+*       0                                   Migration not allowed
+*
+*************************************************************************/
+static int  vcpu_migration_allowed(VCPU_STATS * vcpu, int src_util, int dst_util, int num_moves)
+{
+    int     load_before, load_after;
+
+
+    /* Check if migration budget for this cycle is used up */
+    if ((sched_config.migration_budget > 0) && (num_moves >= sched_config.migration_budget))
+    {
+        /* Not allowed */
+        return (0);
+    }
+
+    /* Check if VCPU hasn't stayed on its PCPU long enough */
+    if ((virt_info.cycle - vcpu->last_move_cycle) < (unsigned long long)sched_config.min_residency)
+    {
+        /* Not allowed */
+        return (0);
+    }
+
+    /* Determine load of busier PCPU before and after the migration */
+    load_before = (src_util > dst_util ? src_util : dst_util);
+    load_after  = ((src_util - vcpu->cpu_util_avg) > (dst_util + vcpu->cpu_util_avg) ?
+                   (src_util - vcpu->cpu_util_avg) : (dst_util + vcpu->cpu_util_avg));
+
+    /* Allow migration only if projected gain beats the migration penalty */
+    return ((load_before - load_after) > sched_config.migration_penalty);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_unpin_from_pcpu
+*
+*   DESCRIPTION
+*
+*       Removes specified VCPU from the VCPU count, VCPU load and exclusive
+*       count of its PCPU
+*
+*   INPUTS
+*
+*       vcpu                                Pointer to VCPU to remove
+*       pcpu                                Pointer to PCPU which contains VCPU
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void     vcpu_unpin_from_pcpu(VCPU_STATS * vcpu, PCPU_STATS * pcpu)
+{
+    /* Ensure VCPU is currently pinned to this PCPU */
+    if ((vcpu->pcpu != NULL) && (vcpu->pcpu == pcpu))
+    {
+        /* Decrement number of VCPUs pinned to this PCPU and remove the VCPU's load */
+        pcpu->num_pinned--;
+        pcpu->vcpu_util -= vcpu->cpu_util;
+        pcpu->num_exclusive -= (vcpu->domain->exclusive != 0);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_pin_on_pcpu
+*
+*   DESCRIPTION
+*
+*       Pins the specified VCPU to the specified PCPU and keeps
+*       track of this association (vcpu_pin_update)
+*
+*   INPUTS
+*
+*       vcpu                                Pointer to VCPU to pin
+*       pcpu                                Pointer on which VCPU is pinned
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VCPU pinned
+*       VCPU_SCHEDULER_DOMAIN_GONE          Domain of VCPU has stopped
+*       Other                               Error pinning VCPU
+*
+*************************************************************************/
+static int  vcpu_pin_on_pcpu(VCPU_STATS * vcpu, PCPU_STATS * pcpu)
+{
+    int     status;
+
+
+    /* Pin this VCPU the specified PCPU */
+    status = virDomainPinVcpu(vcpu->domain_id, vcpu->vcpu_num, pcpu->cpumap, virt_info.cpumap_len);
+
+    /* Ensure VCPU successfully pinned to PCPU */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Move VCPU to the PCPU */
+        vcpu_pin_update(vcpu, pcpu);
+    }
+    else if (domain_gone(vcpu->domain_id))
+    {
+        /* Domain stopped - VCPU is untouched until the domain's stop event removes it */
+        status = VCPU_SCHEDULER_DOMAIN_GONE;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_pin_update
+*
+*   DESCRIPTION
+*
+*       Moves a VCPU from its current PCPU to the specified PCPU - the
+*       VCPU count, VCPU load and exclusive count of both PCPUs and the
+*       VCPU's slot in the VCPU table are updated
+*
+*   INPUTS
+*
+*       vcpu                                VCPU that was pinned
+*       pcpu                                PCPU it was pinned to
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void vcpu_pin_update(VCPU_STATS * vcpu, PCPU_STATS * pcpu)
+{
+    /* Ensure this VCPU is removed from it's current PCPU */
+    vcpu_unpin_from_pcpu(vcpu, vcpu->pcpu);
+
+    /* Point this VCPU structure to PCPU on which it is pinned */
+    vcpu->pcpu = pcpu;
+
+    /* Save the cycle this VCPU was pinned */
+    vcpu->last_move_cycle = virt_info.cycle;
+
+    /* Increment number of VCPUs pinned to this PCPU and add the VCPU's load */
+    pcpu->num_pinned++;
+    pcpu->vcpu_util += vcpu->cpu_util;
+    pcpu->num_exclusive += (vcpu->domain->exclusive != 0);
+
+    /* Check if VCPU is in the VCPU table */
+    if (vcpu->slot >= 0)
+    {
+        /* Save new PCPU in the table */
+        virt_info.vcpu_table.pcpu[vcpu->slot] = (int)(pcpu - pcpu_stats);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_repin
+*
+*   DESCRIPTION
+*
+*       Repins a VCPU during rebalancing.  When workers are used the pin
+*       is queued (so a slow domain doesn't hold up the repins of other
+*       domains) and the VCPU is moved to the new PCPU right away so the
+*       rest of the rebalancing sees the planned placement - the result
+*       is checked by vcpu_repin_wait.  Otherwise the VCPU is pinned inline.
+*       Only a repin made (or queued) is counted - a queued repin that
+*       fails is taken back out of the count by vcpu_repin_wait
+*
+*   INPUTS
+*
+*       vcpu                                VCPU to repin
+*       pcpu                                PCPU to pin it to
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VCPU repinned (or repin queued)
+*       VCPU_SCHEDULER_DOMAIN_GONE          Domain of VCPU has stopped
+*       VCPU_SCHEDULER_DOMAIN_BUSY          Earlier repin for the domain
+*                                           timed out and is still running
+*       Other                               Error when pinning VCPU
+*
+*************************************************************************/
+static int  vcpu_repin(VCPU_STATS * vcpu, PCPU_STATS * pcpu)
+{
+    int         status;
+    TRACE_PIN   record;
+
+
+    /* Save placement being changed for the trace */
+    record.vcpu_num = vcpu->vcpu_num;
+    record.from = vcpu->pcpu->id;
+    record.to = pcpu->id;
+
+    /* Check if workers are used */
+    if (virt_info.workers.num_workers)
+    {
+        /* Queue the pin to the workers */
+        status = worker_pool_pin_vcpu(&virt_info.workers, vcpu->domain_id, vcpu->vcpu_num,
+                                      pcpu->cpumap, virt_info.cpumap_len, vcpu);
+
+        /* Check if pin queued */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Move VCPU to the PCPU now */
+            vcpu_pin_update(vcpu, pcpu);
+        }
+        else
+        {
+            /* Set busy or no memory error status */
+            status = (status == WORKER_POOL_DOMAIN_BUSY ? VCPU_SCHEDULER_DOMAIN_BUSY : VCPU_SCHEDULER_NOMEM);
+        }
+    }
+    else
+    {
+        /* Pin VCPU inline */
+        status = vcpu_pin_on_pcpu(vcpu, pcpu);
+    }
+
+    /* Count repinned VCPU (not a domain that stopped or is busy) */
+    virt_info.num_repins += (status == EXIT_SUCCESS);
+
+    /* Record repin decision and its result */
+    record.status = status;
+    trace_write(&virt_info.trace, TRACE_REC_PIN, vcpu->domain->dom_id, &record, sizeof(record));
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vcpu_repin_wait
+*
+*   DESCRIPTION
+*
+*       Waits for the repins and scheduler parameter changes queued to
+*       the workers this cycle (up to VCPU_SCHEDULER_CALL_TIMEOUT for
+*       each) and checks their results.  A call that timed out is assumed
+*       to take effect once it returns
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        All repins successful (or
+*                                           their domains stopped)
+*       VCPU_SCHEDULER_PIN_ERROR            Error pinning a VCPU
+*
+*************************************************************************/
+static int  vcpu_repin_wait(void)
+{
+    int             status = EXIT_SUCCESS;
+    WORKER_JOB *    job;
+    WORKER_JOB *    next;
+    VCPU_STATS *    vcpu;
+    DOMAIN_STATS *  domain;
+
+
+    /* Check if workers are used */
+    if (virt_info.workers.num_workers)
+    {
+        /* Wait for the calls and count the ones that timed out */
+        virt_info.num_timeouts = worker_pool_wait(&virt_info.workers, &job);
+
+        /* Loop through each call that returned */
+        for (; job != NULL; job = next)
+        {
+            /* Save next call */
+            next = job->batch_next;
+
+            /* Check if call set scheduler parameters */
+            if (job->type == WORKER_JOB_SET_SCHED)
+            {
+                /* Get domain this call was for */
+                domain = job->context;
+
+                /* Check if call failed for a domain that is still running */
+                if ((job->status != EXIT_SUCCESS) && (!domain_gone(domain->domain_id)))
+                {
+                    /* Stop setting scheduler parameters for this domain (VCPUs are still pinned) */
+                    domain_sched_refused(domain);
+                }
+            }
+            else
+            {
+                /* Get VCPU this repin was for */
+                vcpu = job->context;
+
+                /* Take a pin that failed out of the VCPUs repinned this cycle */
+                virt_info.num_repins -= (job->status != EXIT_SUCCESS);
+
+                /* Check if pin failed for a domain that is still running */
+                if ((job->status != EXIT_SUCCESS) && (!domain_gone(vcpu->domain_id)))
+                {
+                    /* Set pin error */
+                    status = VCPU_SCHEDULER_PIN_ERROR;
+                }
+            }
+
+            /* Done with this repin */
+            worker_job_free(job);
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_sched_adjust
+*
+*   DESCRIPTION
+*
+*       Sets the CPU shares and VCPU quota of each domain from its
+*       priority tier so the hypervisor favors latency-critical VCPUs over
+*       batch VCPUs on a contended PCPU.  Batch domains get low shares and
+*       critical domains high shares (normal domains keep the hypervisor
+*       default).  A batch domain sharing a PCPU above the high threshold
+*       with a VCPU of a higher tier is also throttled to a quota of each
+*       period - the quota is cleared once every PCPU it shares with a
+*       higher tier is below the target and it has been throttled for the
+*       minimum residency.  Calls are only made when a value changes and
+*       are queued to the workers like repins
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Scheduler parameters set (or
+*                                           queued)
+*       Other                               Error with memory allocation
+*
+*************************************************************************/
+static int  domain_sched_adjust(void)
+{
+    int                 index, vcpu, tier, status = EXIT_SUCCESS;
+    unsigned long long  shares;
+    long long           quota;
+    DOMAIN_STATS *      domain;
+    PCPU_STATS *        pcpu;
+
+
+    /* Loop through each PCPU */
+    for (index = 0; index < virt_info.num_pcpus; index++)
+    {
+        /* Start with the lowest tier */
+        pcpu_stats[index].max_tier = VCPU_SCHEDULER_TIER_BATCH;
+    }
+
+    /* Loop through each VCPU of each domain */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        for (vcpu = 0; vcpu < domain_stats[index]->num_vcpus; vcpu++)
+        {
+            /* Raise highest tier of the PCPU the VCPU is pinned to (placement after this cycle's repins) */
+            pcpu = domain_stats[index]->vcpus[vcpu].pcpu;
+            pcpu->max_tier = (domain_stats[index]->tier > pcpu->max_tier ? domain_stats[index]->tier : pcpu->max_tier);
+        }
+    }
+
+    /* Loop through each domain while no errors */
+    for (index = 0; (index < virt_info.num_domains) && (status == EXIT_SUCCESS); index++)
+    {
+        /* Get domain */
+        domain = domain_stats[index];
+
+        /* Ensure the hypervisor hasn't refused scheduler parameters for this domain */
+        if (!domain->sched_failed)
+        {
+            /* Treat every domain as normal while priority control is off */
+            tier = (sched_config.priority_control ? domain->tier : VCPU_SCHEDULER_TIER_NORMAL);
+
+            /* Get shares of the tier (a normal domain is only set back if it was changed) */
+            shares = (tier == VCPU_SCHEDULER_TIER_BATCH ? VCPU_SCHEDULER_SHARES_BATCH :
+                      (tier == VCPU_SCHEDULER_TIER_CRITICAL ? VCPU_SCHEDULER_SHARES_CRITICAL :
+                       (domain->shares != 0 ? VCPU_SCHEDULER_SHARES_NORMAL : 0)));
+
+            /* Leave shares unchanged if already set */
+            shares = (shares == domain->shares ? 0 : shares);
+
+            /* Leave quota unchanged unless throttling starts / stops */
+            quota = 0;
+
+            /* Check if a batch domain is holding up a higher tier VCPU on a busy PCPU */
+            if ((tier == VCPU_SCHEDULER_TIER_BATCH) && (!domain->throttled) &&
+                (domain_sched_contended(domain, sched_config.high_threshold)))
+            {
+                /* Throttle each VCPU to a share of every period */
+                quota = (long long)VCPU_SCHEDULER_QUOTA_PERIOD * sched_config.batch_quota / 100;
+            }
+
+            /* Check if a throttled domain is no longer batch OR (has been throttled long enough
+               AND no PCPU it shares with a higher tier is above the target) */
+            else if ((domain->throttled) &&
+                     ((tier != VCPU_SCHEDULER_TIER_BATCH) ||
+                      (((virt_info.cycle - domain->throttle_cycle) >= (unsigned long long)sched_config.min_residency) &&
+                       (!domain_sched_contended(domain, sched_config.pcpu_target)))))
+            {
+                /* Remove quota */
+                quota = -1;
+            }
+
+            /* Check if anything changed */
+            if ((shares != 0) || (quota != 0))
+            {
+                /* Set new scheduler parameters */
+                status = domain_sched_set(domain, shares, quota);
+
+                /* A domain that stopped (or is still busy with a call that timed out) is skipped */
+                status = (((status == VCPU_SCHEDULER_DOMAIN_GONE) || (status == VCPU_SCHEDULER_DOMAIN_BUSY)) ?
+                          EXIT_SUCCESS : status);
+            }
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_sched_contended
+*
+*   DESCRIPTION
+*
+*       Checks if a VCPU of a domain is pinned to a PCPU above a
+*       utilization threshold that also runs a VCPU of a higher priority
+*       tier (placement after this cycle's repins, from the highest tier
+*       of each PCPU found by domain_sched_adjust)
+*
+*   INPUTS
+*
+*       domain                              Pointer to domain stats
+*       threshold                           PCPU utilization % the PCPU
+*                                           must be above
+*
+*   OUTPUTS
+*
+*       1                                   Domain shares a busy PCPU with
+*                                           a higher tier
+*       0                                   Domain doesn't
+*
+*************************************************************************/
+static int  domain_sched_contended(DOMAIN_STATS * domain, int threshold)
+{
+    int             vcpu, contended = 0;
+    PCPU_STATS *    pcpu;
+
 
-            /* Save this cycle's CPU time */
-            vcpu_stats[index].last_time = info.cpuTime;
+    /* Loop through each VCPU of the domain until a contended PCPU is found */
+    for (vcpu = 0; (vcpu < domain->num_vcpus) && (!contended); vcpu++)
+    {
+        /* Get PCPU the VCPU is pinned to */
+        pcpu = domain->vcpus[vcpu].pcpu;
 
-            /* Successful VCPU info */
-            status = EXIT_SUCCESS;
-        }
-        else
-        {
-            /* Consider no info or error from API a problem */
-            status = VCPU_SCHEDULER_DOMAIN_INFO_ERROR;
-        }
+        /* Check if PCPU is busy AND runs a VCPU of a higher tier */
+        contended = ((pcpu->cpu_util > threshold) && (pcpu->max_tier > domain->tier));
     }
 
-    /* Return status to caller */
-    return (status);
+    /* Return if domain is contended to caller */
+    return (contended);
 }
 
 
@@ -318,96 +4664,91 @@ static int  collect_vcpu_stats(unsigned long long ns_cycle_time)
 *
 *   FUNCTION
 *
-*       virt_init
+*       domain_sched_set
 *
 *   DESCRIPTION
 *
-*       Initializes the virtualization connection and determines number of
-*       VMs, number of PCPUs, and sets up appropriate data structures used
-*       by the VCPU scheduling code
+*       Sets the CPU shares and / or VCPU quota of a domain.  When workers
+*       are used the call is queued and the new values are recorded right
+*       away - the result is checked by vcpu_repin_wait.  Otherwise the
+*       call is made inline
 *
 *   INPUTS
 *
-*       None
+*       domain                              Pointer to domain stats
+*       shares                              New CPU shares (0 = unchanged)
+*       quota                               New VCPU quota in us per period
+*                                           (-1 = no quota, 0 = unchanged)
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        Virtualization init successful
-*       Others                              Problems associated with getting
-*                                           virtualization information
+*       EXIT_SUCCESS                        Parameters set (or queued, or
+*                                           refused by the hypervisor)
+*       VCPU_SCHEDULER_DOMAIN_GONE          Domain has stopped
+*       VCPU_SCHEDULER_DOMAIN_BUSY          Earlier call for the domain
+*                                           timed out and is still running
+*       VCPU_SCHEDULER_NOMEM                Error with memory allocation
 *
 *************************************************************************/
-static int  virt_init(void)
+static int  domain_sched_set(DOMAIN_STATS * domain, unsigned long long shares, long long quota)
 {
-    int     status = EXIT_SUCCESS;
-
+    int                 status;
+    unsigned long long  period = (quota > 0 ? VCPU_SCHEDULER_QUOTA_PERIOD : 0);
+    TRACE_SCHED         record;
 
-    /* Attempt to connect to the hypervisor */
-    virt_info.conn = virConnectOpen("qemu:///system");
 
-    /* Check if connection to hypervisor was successful */
-    if (virt_info.conn != NULL)
+    /* Check if workers are used */
+    if (virt_info.workers.num_workers)
     {
-        /* Get list of active domains */
-        virt_info.num_domains = virConnectListAllDomains(virt_info.conn,
-                                                         &virt_info.domain_list,
-                                                         VIR_CONNECT_LIST_DOMAINS_ACTIVE);
-
-        /* Ensure at least 1 domain active */
-        if (virt_info.num_domains > 0)
-        {
-            /* Get number of physical CPUs available on host */
-            virt_info.num_pcpus = virNodeGetCPUMap(virt_info.conn, NULL, NULL, 0);
-
-            /* Determine size of params for PCPU params
-               NOTE:  This code assumes all PCPU's will have same size params */
-            status = virNodeGetCPUStats(virt_info.conn, 0, NULL, &virt_info.num_params, 0);
-
-            /* Ensure CPU stats returned successfully */
-            if (status == EXIT_SUCCESS)
-            {
-                /* Allocate memory for params for a PCPU */
-                virt_info.params = calloc(virt_info.num_params * sizeof(virNodeCPUStats), 1);
+        /* Queue the call to the workers */
+        status = worker_pool_set_sched(&virt_info.workers, domain->domain_id, shares, quota, period, domain);
 
-                /* Ensure param memory allocated */
-                if (virt_info.params != NULL)
-                {
-                    /* Initialize PCPUs */
-                    status = pcpu_stats_init();
+        /* Set busy or no memory error status if not queued */
+        status = (status == EXIT_SUCCESS ? EXIT_SUCCESS :
+                  (status == WORKER_POOL_DOMAIN_BUSY ? VCPU_SCHEDULER_DOMAIN_BUSY : VCPU_SCHEDULER_NOMEM));
+    }
+    else
+    {
+        /* Set parameters inline */
+        status = worker_set_sched(domain->domain_id, shares, quota, period);
 
-                    /* Check if size of params determined */
-                    if (status == EXIT_SUCCESS)
-                    {
-                        /* Initialize VCPUs */
-                        status = vcpu_stats_init();
-                    }
-                }
-                else
-                {
-                    /* Set error status showing no memory available */
-                    status = VCPU_SCHEDULER_NOMEM;
-                }
-            }
-        }
-        else
+        /* Check if call failed */
+        if (status != EXIT_SUCCESS)
         {
-            /* Check if error returned when trying to get list of domains */
-            if (virt_info.num_domains < 0)
+            /* Check if domain stopped */
+            if (domain_gone(domain->domain_id))
             {
-                /* Set error status appropriately */
-                status = VCPU_SCHEDULER_DOMAIN_LIST_ERROR;
+                /* Domain is untouched until its stop event removes it */
+                status = VCPU_SCHEDULER_DOMAIN_GONE;
             }
             else
             {
-                /* Set error for no domains */
-                status = VCPU_SCHEDULER_NO_DOMAINS;
+                /* Stop setting scheduler parameters for this domain (VCPUs are still pinned) */
+                domain_sched_refused(domain);
+                status = EXIT_SUCCESS;
             }
         }
     }
-    else
+
+    /* Check if parameters set (or queued) */
+    if ((status == EXIT_SUCCESS) && (!domain->sched_failed))
     {
-        /* Return error */
-        status = VCPU_SCHEDULER_CONN_ERROR;
+        /* Record new parameters */
+        record.shares = shares;
+        record.quota = quota;
+        record.period = period;
+        trace_write(&virt_info.trace, TRACE_REC_SCHED, domain->dom_id, &record, sizeof(record));
+
+        /* Record new shares */
+        domain->shares = (shares != 0 ? shares : domain->shares);
+
+        /* Check if quota changed */
+        if (quota != 0)
+        {
+            /* Record if throttled and when */
+            domain->throttled = (quota > 0);
+            domain->throttle_cycle = virt_info.cycle;
+        }
     }
 
     /* Return status to caller */
@@ -419,60 +4760,32 @@ static int  virt_init(void)
 *
 *   FUNCTION
 *
-*       pcpu_stats_init
+*       domain_sched_refused
 *
 *   DESCRIPTION
 *
-*       Initialize the PCPU stats data structures
+*       Stops setting the scheduler parameters of a domain the hypervisor
+*       refused them for (ie no CPU controller for its cgroup).  Its VCPUs
+*       are still pinned
 *
 *   INPUTS
 *
-*       None
+*       domain                              Pointer to domain stats
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        PCPU data structures initialized
-*       Other                               Error with memory allocation or
-*                                           using libvirt
+*       None
 *
 *************************************************************************/
-static int pcpu_stats_init(void)
+static void domain_sched_refused(DOMAIN_STATS * domain)
 {
-    int index, status = EXIT_SUCCESS;
-
-
-    /* Allocate memory for PCPU structures */
-    pcpu_stats = calloc(virt_info.num_pcpus * sizeof(PCPU_STATS), 1);
-
-    /* Ensure memory allocated */
-    if (pcpu_stats != NULL)
-    {
-        /* Loop through and initialize each PCPU status structure */
-        for (index = 0 ; (index < virt_info.num_pcpus) && (status == EXIT_SUCCESS) ; index++)
-        {
-            /* Set ID and cpu mask for each PCPU */
-            pcpu_stats[index].id = index;
-            pcpu_stats[index].cpumap = (1 << index);
-
-            /* Get this PCPUs initial information */
-            status = virNodeGetCPUStats(virt_info.conn, index, virt_info.params, &virt_info.num_params, 0);
-
-            /* Ensure success here */
-            if (status == EXIT_SUCCESS)
-            {
-                /* Get PCPU idle time */
-                status = pcpu_get_idle(virt_info.num_params, &(pcpu_stats[index].last_time));
-            }
-        }   /* for loop */
-    }
-    else
-    {
-        /* Set error status showing no memory available */
-        status = VCPU_SCHEDULER_NOMEM;
-    }
+    /* Print warning (once per domain) */
+    fprintf(stderr, "%s: hypervisor refused CPU shares / quota - priority tier not applied\n\r", domain->name);
 
-    /* Return status to caller */
-    return (status);
+    /* Don't try again and don't restore values never set */
+    domain->sched_failed = 1;
+    domain->shares = 0;
+    domain->throttled = 0;
 }
 
 
@@ -480,11 +4793,13 @@ static int pcpu_stats_init(void)
 *
 *   FUNCTION
 *
-*       vcpu_stats_init
+*       domain_sched_restore
 *
 *   DESCRIPTION
 *
-*       Initialize the VCPU stats data structures
+*       Puts the CPU shares / VCPU quota of each domain changed by its
+*       priority tier back to the hypervisor defaults so no domain is left
+*       throttled once the VCPU scheduler stops
 *
 *   INPUTS
 *
@@ -492,67 +4807,29 @@ static int pcpu_stats_init(void)
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        VCPU data structures initialized
-*       Other                               Error with memory allocation or
-*                                           using libvirt
+*       None
 *
 *************************************************************************/
-static int vcpu_stats_init(void)
+static void domain_sched_restore(void)
 {
-    int             index, pcpu_index, status = EXIT_SUCCESS;
-    virVcpuInfo     info;
-
+    int             index;
+    DOMAIN_STATS *  domain;
 
-    /* Allocate memory for each of the VCPU stats structure (1 per domain) */
-    vcpu_stats = calloc(virt_info.num_domains * sizeof(VCPU_STATS), 1);
 
-    /* Ensure memory allocated */
-    if (vcpu_stats != NULL)
+    /* Loop through each domain */
+    for (index = 0; index < virt_info.num_domains; index++)
     {
-        /* Loop through and initialize each VCPU status structure */
-        for (index = 0 ; (index < virt_info.num_domains) && (status == EXIT_SUCCESS); index++)
-        {
-            /* Assign domain ID for VCPU */
-            vcpu_stats[index].domain_id = virt_info.domain_list[index];
-
-            /* Determine PCPU index to pin this VCPU - initially just balance all VCPUs
-               among available PCPUs */
-            pcpu_index = index % virt_info.num_pcpus;
-
-            /* Pin VCPU to the appropriate PCPU */
-            status = vcpu_pin_on_pcpu(&vcpu_stats[index], &pcpu_stats[pcpu_index]);
-
-            /* Make sure VCPU pinning worked */
-            if (status == EXIT_SUCCESS)
-            {
-                /* Get this VCPUs initial status */
-                status = virDomainGetVcpus(vcpu_stats[index].domain_id, &info, 1, NULL, 0);
-
-                /* Check if initial status obtained */
-                if (status > 0)
-                {
-                    /* Initialize VCPU stats with this information */
-                    vcpu_stats[index].last_time = info.cpuTime;
+        /* Get domain */
+        domain = domain_stats[index];
 
-                    /* Set success */
-                    status = EXIT_SUCCESS;
-                }
-                else
-                {
-                    /* Set domain info error */
-                    status = VCPU_SCHEDULER_DOMAIN_INFO_ERROR;
-                }
-            }
-        }   /* for loop */
-    }
-    else
-    {
-        /* Set error status */
-        status = VCPU_SCHEDULER_NOMEM;
+        /* Check if shares or quota were changed */
+        if ((domain->shares != 0) || (domain->throttled))
+        {
+            /* Set defaults inline (workers are stopped - failure is ignored as the daemon is exiting) */
+            (void)worker_set_sched(domain->domain_id, (domain->shares != 0 ? VCPU_SCHEDULER_SHARES_NORMAL : 0),
+                                   (domain->throttled ? -1 : 0), 0);
+        }
     }
-
-    /* Return status to caller */
-    return (status);
 }
 
 
@@ -560,13 +4837,12 @@ static int vcpu_stats_init(void)
 *
 *   FUNCTION
 *
-*       vcpu_pinning_adjust
+*       virt_deinit
 *
 *   DESCRIPTION
 *
-*       Adjusts / changes VCPU to PCPU pinning based on latest stats
-*       taken for VCPU and PCPU CPU utilization and specified
-*       thresholds for changing pinning
+*       De-initializes all the virtualization content - frees data structures,
+*       closes connections, etc.
 *
 *   INPUTS
 *
@@ -574,96 +4850,104 @@ static int vcpu_stats_init(void)
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        Adjustment of pinning for VCPU
-*                                           was successful
-*       Other                               Error when pinning of VCPU
+*       None
 *
 *************************************************************************/
-static int  vcpu_pinning_adjust(void)
+static void virt_deinit(void)
 {
-    int             pcpu_high, pcpu_low, status = EXIT_SUCCESS;
-    int             vcpu_delta, vcpu_best_delta, new_pcpu_util;
-    unsigned int    pcpu_high_mask, pcpu_low_mask;
-    VCPU_STATS *    vcpu;
-    VCPU_STATS *    best_vcpu;
-
+    int     index;
 
-    /* Make a local copy of the low PCPU utilization mask */
-    pcpu_low_mask = virt_info.pcpu_low_mask;
 
-    /* Loop until all low / high utilized PCPUs are adjusted and no errors */
-    while ((pcpu_low_mask) && (virt_info.pcpu_high_mask) && (status == EXIT_SUCCESS))
+    /* Stop serving the metrics endpoint */
+    if (sched_config.metrics_port)
     {
-        /* Get index of low loaded PCPU */
-        LOW_BIT_GET32(pcpu_low_mask, &pcpu_low);
+        metrics_deinit(&virt_info.metrics);
+    }
 
-        /* Make a local copy of the high PCPU Utilization mask */
-        pcpu_high_mask = virt_info.pcpu_high_mask;
+    /* Stop serving the monitor stream */
+    if (sched_config.monitor_path != NULL)
+    {
+        monitor_deinit(&virt_info.monitor);
+    }
 
-        /* Reset best VCPU delta for best fit */
-        vcpu_best_delta = 100;
+    /* Remove the shared memory snapshot */
+    if (sched_config.shm_name != NULL)
+    {
+        stats_shm_deinit(&virt_info.shm);
+    }
 
-        /* Set best VCPU pointer to NULL */
-        best_vcpu = NULL;
+    /* Stop the workers (waits for any repin still running) */
+    worker_pool_deinit(&virt_info.workers);
 
-        /* Loop until all high utilized PCPUs are processed for a best
-           fit on the low utilized PCPUs */
-        while ((pcpu_high_mask) && (status == EXIT_SUCCESS))
-        {
-            /* Get index of high loaded PCPU */
-            LOW_BIT_GET32(pcpu_high_mask, &pcpu_high);
+    /* Put the CPU shares / VCPU quota changed by priority tier back to the hypervisor defaults */
+    domain_sched_restore();
 
-            /* Get head of VCPU list from highly loaded PCPU */
-            vcpu = pcpu_stats[pcpu_high].head;
+    /* Loop through and remove each domain (frees domain / VCPU stats and releases the domain)
+       NOTE:  Done before PCPU stats are freed since VCPUs are removed from the PCPU counts */
+    while (virt_info.num_domains)
+    {
+        domain_stats_remove(domain_stats[virt_info.num_domains - 1]);
+    }
 
-            /* Find best fit VCPU to move to less loaded PCPU */
-            do
-            {
-                /* Calculate what PCPU utilization this will make for the currently low PCPU */
-                new_pcpu_util = (vcpu->cpu_util + pcpu_stats[pcpu_low].cpu_util);
+    /* Free the domain stats list */
+    free(domain_stats);
 
-                /* Calculate how close to target utilization repinning this VCPU will come */
-                vcpu_delta = abs(VCPU_SCHEDULER_PCPU_TGT - new_pcpu_util);
+    /* Deallocate params memory */
+    free(virt_info.params);
 
-                /* Check to see if this VCPU is best fit AND migration doesn't cause similar high PCPU load */
-                if ((vcpu_delta < vcpu_best_delta) && (new_pcpu_util < VCPU_SCHEDULER_PCPU_HIGH_THRESHOLD))
-                {
-                    /* Set new best delta */
-                    vcpu_best_delta = vcpu_delta;
+    /* Check if PCPU stats were allocated */
+    if (pcpu_stats != NULL)
+    {
+        /* Loop through and free each PCPU cpu map */
+        for (index = 0; index < virt_info.num_pcpus; index++)
+        {
+            free(pcpu_stats[index].cpumap);
+        }
 
-                    /* Save pointer to this VCPU */
-                    best_vcpu = vcpu;
-                }
+        /* Free PCPU stats */
+        free(pcpu_stats);
+    }
 
-                /* Move to next VCPU in list */
-                vcpu = vcpu->next;
+    /* Free VCPU info, VCPU table and PCPU ordering lists */
+    free(virt_info.vcpu_info);
+    free(virt_info.vcpu_table.vcpu);
+    free(virt_info.pcpu_order);
+    free(virt_info.pcpu_drain);
 
-            /* Loop until back to start of VCPU list */
-            } while (vcpu != pcpu_stats[pcpu_high].head);
+    /* Free low / high / parked PCPU masks */
+    bitmask_free(&virt_info.pcpu_high_mask);
+    bitmask_free(&virt_info.pcpu_low_mask);
+    bitmask_free(&virt_info.pcpu_parked_mask);
 
-            /* Clear PCPU high mask bit for this PCPU */
-            pcpu_high_mask &= ~(1 << pcpu_high);
-        }
+    /* Check if the parked PCPUs are published */
+    if (sched_config.parked_path != NULL)
+    {
+        /* Remove the file (the PCPUs are no longer kept free once the scheduler stops) */
+        unlink(sched_config.parked_path);
+    }
 
-        /* Clear PCPU low mask bit since we have looked through
-           every option to move a VCPU from all highly loaded PCPUs
-           to this low loaded PCPU */
-        pcpu_low_mask &=  ~(1 << pcpu_low);
+    /* Free the configuration */
+    config_free(&virt_info.config);
 
-        /* Ensure the best VCPU was found */
-        if (best_vcpu != NULL)
-        {
-            /* Clear high PCPU mask bit for the VCPU being migrated */
-            virt_info.pcpu_high_mask &= ~(1 << best_vcpu->pcpu->id);
+    /* Check if a trace is recorded */
+    if (sched_config.trace_path != NULL)
+    {
+        /* Write the records left and close the trace file */
+        trace_deinit(&virt_info.trace);
+    }
 
-            /* Move best fit VCPU from current PCPU to less loaded PCPU */
-            status = vcpu_pin_on_pcpu(best_vcpu, &pcpu_stats[pcpu_low]);
-        }
+    /* Check if connection is this daemon's own (a shared connection is closed by the resource manager) */
+    if (!virt_info.shared)
+    {
+        /* Stop receiving domain events */
+        domain_events_deregister(&virt_info.events);
 
-    }   /* while loop */
+        /* Close connection to hypervisor */
+        virConnectClose(virt_info.conn);
 
-    /* Return status to caller */
-    return (status);
+        /* Stop the event loop */
+        domain_events_loop_deinit();
+    }
 }
 
 
@@ -671,54 +4955,144 @@ static int  vcpu_pinning_adjust(void)
 *
 *   FUNCTION
 *
-*       vcpu_unpin_from_pcpu
+*       render_scheduler_metrics
 *
 *   DESCRIPTION
 *
-*       Unpins specified VCPU from PCPU and removes from PCPU list
+*       Renders the state of the VCPU scheduler at the end of a cycle in
+*       the OpenMetrics text format and publishes it for scrapes.  Only
+*       values already collected are used (no libvirt calls)
 *
 *   INPUTS
 *
-*       vcpu                                Pointer to VCPU to remove from list
-*       pcpu                                Pointer to PCPU which contains VCPU
+*       None
 *
 *   OUTPUTS
 *
 *       None
 *
 *************************************************************************/
-static void     vcpu_unpin_from_pcpu(VCPU_STATS * vcpu, PCPU_STATS * pcpu)
+static void render_scheduler_metrics(void)
 {
-    /* Ensure VCPU is currently on this PCPU list */
-    if ((vcpu->pcpu != NULL) && (vcpu->pcpu == pcpu))
+    METRICS *           metrics = &virt_info.metrics;
+    char                label[METRICS_LABEL_LEN];
+    int                 index, vcpu;
+    VCPU_STATS *        vcpu_stats;
+
+
+    /* Output scheduler totals */
+    metrics_family(metrics, "vcpu_scheduler_cycles", "counter", "Scheduling cycles run.");
+    metrics_printf(metrics, "vcpu_scheduler_cycles_total %llu\n", virt_info.cycle);
+    metrics_family(metrics, "vcpu_scheduler_repins", "counter", "VCPUs repinned.");
+    metrics_printf(metrics, "vcpu_scheduler_repins_total %llu\n", virt_info.total_repins);
+    metrics_family(metrics, "vcpu_scheduler_repin_timeouts", "counter", "VCPU repins that timed out.");
+    metrics_printf(metrics, "vcpu_scheduler_repin_timeouts_total %llu\n", virt_info.workers.num_timeouts);
+    metrics_family(metrics, "vcpu_scheduler_metrics_skipped", "counter", "Snapshots not published because a scrape was being copied.");
+    metrics_printf(metrics, "vcpu_scheduler_metrics_skipped_total %llu\n", metrics->snapshot.num_skipped);
+
+    /* Output cycle timing */
+    metrics_family(metrics, "vcpu_scheduler_interval_seconds", "gauge", "Time between scheduling cycles.");
+    metrics_printf(metrics, "vcpu_scheduler_interval_seconds %.3f\n", virt_info.interval.interval_ms / INTERVAL_MSECS_PER_SEC);
+    metrics_family(metrics, "vcpu_scheduler_phase_seconds", "gauge", "Time spent in each phase of the last cycle.");
+
+    /* Loop through each phase */
+    for (index = 0; index < VCPU_SCHEDULER_NUM_PHASES; index++)
     {
-        /* Decrement number of VCPUs pinned to this PCPU */
-        pcpu->num_pinned--;
+        metrics_printf(metrics, "vcpu_scheduler_phase_seconds{phase=\"%s\"} %.9f\n", phase_names[index],
+                       (double)virt_info.phase_ns[index] / INTERVAL_NSECS_PER_SEC);
+    }
+
+    /* Output number of domains / VCPUs scheduled */
+    metrics_family(metrics, "vcpu_scheduler_domains", "gauge", "Domains scheduled.");
+    metrics_printf(metrics, "vcpu_scheduler_domains %d\n", virt_info.num_domains);
+    metrics_family(metrics, "vcpu_scheduler_vcpus", "gauge", "VCPUs scheduled.");
+    metrics_printf(metrics, "vcpu_scheduler_vcpus %d\n", virt_info.num_vcpus);
+
+    /* Output utilization of each PCPU */
+    metrics_family(metrics, "vcpu_scheduler_pcpu_utilization_percent", "gauge", "PCPU utilization during the last cycle.");
+
+    /* Loop through each PCPU */
+    for (index = 0; index < virt_info.num_pcpus; index++)
+    {
+        metrics_printf(metrics, "vcpu_scheduler_pcpu_utilization_percent{pcpu=\"%d\",node=\"%d\",l3=\"%d\"} %d\n",
+                       pcpu_stats[index].id, pcpu_stats[index].node_id, pcpu_stats[index].l3_id, pcpu_stats[index].cpu_util);
+    }
+
+    /* Output number of VCPUs pinned to each PCPU */
+    metrics_family(metrics, "vcpu_scheduler_pcpu_pinned_vcpus", "gauge", "VCPUs pinned to the PCPU.");
+
+    /* Loop through each PCPU */
+    for (index = 0; index < virt_info.num_pcpus; index++)
+    {
+        metrics_printf(metrics, "vcpu_scheduler_pcpu_pinned_vcpus{pcpu=\"%d\"} %d\n",
+                       pcpu_stats[index].id, pcpu_stats[index].num_pinned);
+    }
+
+    /* Output PCPUs parked by consolidation */
+    metrics_family(metrics, "vcpu_scheduler_pcpus_parked", "gauge", "PCPUs left without VCPUs by consolidation.");
+    metrics_printf(metrics, "vcpu_scheduler_pcpus_parked %d\n", virt_info.num_parked);
+    metrics_family(metrics, "vcpu_scheduler_pcpu_parked", "gauge", "Non-zero while the PCPU is parked.");
+
+    /* Loop through each PCPU */
+    for (index = 0; index < virt_info.num_pcpus; index++)
+    {
+        metrics_printf(metrics, "vcpu_scheduler_pcpu_parked{pcpu=\"%d\"} %d\n",
+                       pcpu_stats[index].id, (int)BITMASK_TEST(&virt_info.pcpu_parked_mask, index));
+    }
+
+    /* Output utilization of each VCPU (latest cycle, then smoothed) */
+    metrics_family(metrics, "vcpu_scheduler_vcpu_utilization_percent", "gauge", "VCPU utilization during the last cycle.");
+
+    /* Loop through each VCPU of each domain */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, domain_stats[index]->name);
 
-        /* Check if only node on list */
-        if (vcpu->prev == vcpu)
+        for (vcpu = 0; vcpu < domain_stats[index]->num_vcpus; vcpu++)
         {
-            /* Set head pointer to NULL */
-            pcpu->head = NULL;
+            vcpu_stats = &domain_stats[index]->vcpus[vcpu];
+            metrics_printf(metrics, "vcpu_scheduler_vcpu_utilization_percent{domain=\"%s\",vcpu=\"%u\",pcpu=\"%d\"} %d\n",
+                           label, vcpu_stats->vcpu_num, vcpu_stats->pcpu->id, vcpu_stats->cpu_util);
         }
-        else
-        {
-            /* Adjust prev / next pointers of adjacent nodes in list */
-            vcpu->prev->next = vcpu->next;
-            vcpu->next->prev = vcpu->prev;
+    }
 
-            /* Check if this VCPU was at head of list */
-            if (pcpu->head == vcpu)
-            {
-                /* Set new head */
-                pcpu->head = vcpu->next;
-            }
+    metrics_family(metrics, "vcpu_scheduler_vcpu_utilization_avg_percent", "gauge", "Smoothed VCPU utilization used for scheduling.");
+
+    /* Loop through each VCPU of each domain */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, domain_stats[index]->name);
+
+        for (vcpu = 0; vcpu < domain_stats[index]->num_vcpus; vcpu++)
+        {
+            vcpu_stats = &domain_stats[index]->vcpus[vcpu];
+            metrics_printf(metrics, "vcpu_scheduler_vcpu_utilization_avg_percent{domain=\"%s\",vcpu=\"%u\",pcpu=\"%d\"} %d\n",
+                           label, vcpu_stats->vcpu_num, vcpu_stats->pcpu->id, vcpu_stats->cpu_util_avg);
         }
+    }
+
+    /* Output priority tier and throttling of each domain */
+    metrics_family(metrics, "vcpu_scheduler_domain_tier", "gauge", "Priority tier of the domain (-1 = batch, 0 = normal, 1 = critical).");
+
+    /* Loop through each domain */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, domain_stats[index]->name);
+        metrics_printf(metrics, "vcpu_scheduler_domain_tier{domain=\"%s\"} %d\n", label, domain_stats[index]->tier);
+    }
 
-        /* Set VCPU next / previous to NULL */
-        vcpu->next = NULL;
-        vcpu->prev = NULL;
+    metrics_family(metrics, "vcpu_scheduler_domain_throttled", "gauge", "Non-zero while the VCPU quota of a batch domain is set.");
+
+    /* Loop through each domain */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, domain_stats[index]->name);
+        metrics_printf(metrics, "vcpu_scheduler_domain_throttled{domain=\"%s\"} %d\n", label, domain_stats[index]->throttled);
     }
+
+    /* End snapshot and publish it */
+    metrics_printf(metrics, "# EOF\n");
+    metrics_publish(metrics);
 }
 
 
@@ -726,65 +5100,74 @@ static void     vcpu_unpin_from_pcpu(VCPU_STATS * vcpu, PCPU_STATS * pcpu)
 *
 *   FUNCTION
 *
-*       vcpu_pin_on_pcpu
+*       render_scheduler_monitor
 *
 *   DESCRIPTION
 *
-*       Pins the specified VCPU to the specified PCPU and keeps
-*       track of this association via a linked list
+*       Renders a sample of the VCPU scheduler at the end of a cycle as a
+*       single line JSON object (PCPU utilization, and the CPU time, PCPU
+*       and utilization of each VCPU) and streams it to the monitor
+*       clients.  Only values already collected are used (no libvirt
+*       calls)
 *
 *   INPUTS
 *
-*       vcpu                                Pointer to VCPU to pin
-*       pcpu                                Pointer on which VCPU is pinned
+*       None
 *
 *   OUTPUTS
 *
 *       None
 *
 *************************************************************************/
-static int  vcpu_pin_on_pcpu(VCPU_STATS * vcpu, PCPU_STATS * pcpu)
+static void render_scheduler_monitor(void)
 {
-    int     status;
+    MONITOR *           monitor = &virt_info.monitor;
+    char                name[MONITOR_STRING_LEN];
+    int                 index, vcpu;
+    VCPU_STATS *        vcpu_stats;
 
 
-    /* Pin this VCPU the specified PCPU
-       NOTE:  This implementation only supports configurations with single
-              VCPU per Domain/VM and a maximum of 8 PCPUs */
-    status = virDomainPinVcpu(vcpu->domain_id, 0, &(pcpu->cpumap), 1);
+    /* Output cycle, time (monotonic) and repins */
+    monitor_printf(monitor, "{\"daemon\":\"vcpu_scheduler\",\"cycle\":%llu,\"time\":%.9f,\"interval\":%.3f,"
+                   "\"repins\":%d,\"repins_total\":%llu,\"phase_ns\":{",
+                   virt_info.cycle, (double)interval_now() / INTERVAL_NSECS_PER_SEC,
+                   virt_info.interval.interval_ms / INTERVAL_MSECS_PER_SEC, virt_info.num_repins, virt_info.total_repins);
 
-    /* Ensure VCPU successfully pinned to PCPU */
-    if (status == EXIT_SUCCESS)
+    /* Loop through each phase */
+    for (index = 0; index < VCPU_SCHEDULER_NUM_PHASES; index++)
     {
-        /* Ensure this VCPU is removed from it's current PCPU list */
-        vcpu_unpin_from_pcpu(vcpu, vcpu->pcpu);
+        monitor_printf(monitor, "%s\"%s\":%llu", (index ? "," : ""), phase_names[index], virt_info.phase_ns[index]);
+    }
 
-        /* Point this VCPU structure to PCPU on which it is pinned */
-        vcpu->pcpu = pcpu;
+    /* Loop through each PCPU */
+    monitor_printf(monitor, "},\"pcpus\":[");
 
-        /* Increment number of VCPUs pinned to this PCPU */
-        pcpu->num_pinned++;
+    for (index = 0; index < virt_info.num_pcpus; index++)
+    {
+        monitor_printf(monitor, "%s{\"pcpu\":%d,\"util\":%d,\"pinned\":%d,\"parked\":%d}", (index ? "," : ""),
+                       pcpu_stats[index].id, pcpu_stats[index].cpu_util, pcpu_stats[index].num_pinned,
+                       (int)BITMASK_TEST(&virt_info.pcpu_parked_mask, index));
+    }
 
-        /* Check if the PCPU list of VCPUs is empty */
-        if (pcpu->head == NULL)
-        {
-            /* First VCPU on list - put at head of list and point to itself */
-            pcpu->head          = vcpu;
-            vcpu->next          = vcpu;
-            vcpu->prev          = vcpu;
-        }
-        else
+    /* Loop through each VCPU of each domain */
+    monitor_printf(monitor, "],\"vcpus\":[");
+
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        monitor_escape(name, domain_stats[index]->name);
+
+        for (vcpu = 0; vcpu < domain_stats[index]->num_vcpus; vcpu++)
         {
-            /* Not empty list - put this VCPU at end of the list */
-            vcpu->prev          = pcpu->head->prev;
-            vcpu->prev->next    = vcpu;
-            vcpu->next          = pcpu->head;
-            pcpu->head->prev    = vcpu;
+            vcpu_stats = &domain_stats[index]->vcpus[vcpu];
+            monitor_printf(monitor, "%s{\"domain\":\"%s\",\"vcpu\":%u,\"pcpu\":%d,\"cpu_time\":%llu,\"util\":%d,\"util_avg\":%d}",
+                           ((index || vcpu) ? "," : ""), name, vcpu_stats->vcpu_num, vcpu_stats->pcpu->id,
+                           vcpu_stats->last_time, vcpu_stats->cpu_util, vcpu_stats->cpu_util_avg);
         }
     }
 
-    /* Return status to caller */
-    return (status);
+    /* End sample and stream it */
+    monitor_printf(monitor, "]}\n");
+    monitor_publish(monitor);
 }
 
 
@@ -792,12 +5175,15 @@ static int  vcpu_pin_on_pcpu(VCPU_STATS * vcpu, PCPU_STATS * pcpu)
 *
 *   FUNCTION
 *
-*       virt_deinit
+*       render_scheduler_shm
 *
 *   DESCRIPTION
 *
-*       De-initializes all the virtualization content - frees data structures,
-*       closes connections, etc.
+*       Publishes the stats of the VCPU scheduler at the end of a cycle in
+*       the shared memory snapshot - a record for each PCPU, each domain
+*       and each VCPU of each domain.  Only values already collected are
+*       used (no libvirt calls) and the records are written in place, so
+*       publishing makes no system calls unless the segment has to grow
 *
 *   INPUTS
 *
@@ -808,28 +5194,77 @@ static int  vcpu_pin_on_pcpu(VCPU_STATS * vcpu, PCPU_STATS * pcpu)
 *       None
 *
 *************************************************************************/
-static void virt_deinit(void)
+static void render_scheduler_shm(void)
 {
-    /* Deallocate params memory */
-    free(virt_info.params);
+    STATS_SHM *         shm = &virt_info.shm;
+    STATS_SHM_HEADER *  header;
+    STATS_SHM_PCPU *    pcpu;
+    STATS_SHM_VCPU *    vcpu;
+    STATS_SHM_VM *      vm;
+    VCPU_STATS *        vcpu_stats;
+    int                 index, vcpu_index, num_vcpus = 0;
 
-    /* Loop through and free all domain names */
-    do
+
+    /* Start rewriting the snapshot (the VCPUs of the domains are counted as total VCPUs) */
+    header = stats_shm_begin(shm, virt_info.num_pcpus, virt_info.num_vcpus, virt_info.num_domains);
+
+    /* Ensure snapshot can be published */
+    if (header != NULL)
     {
-        /* Decrement number of domains to process */
-        virt_info.num_domains--;
+        /* Set cycle, interval, repins and phases */
+        header->cycle = virt_info.cycle;
+        header->interval_ms = virt_info.interval.interval_ms;
+        header->num_changes = virt_info.total_repins;
+
+        for (index = 0; index < VCPU_SCHEDULER_NUM_PHASES; index++)
+        {
+            header->phase_ns[index] = virt_info.phase_ns[index];
+        }
 
-        /* Free returned names */
-        virDomainFree(virt_info.domain_list[virt_info.num_domains]);
+        /* Loop through each PCPU */
+        for (index = 0; index < virt_info.num_pcpus; index++)
+        {
+            pcpu = stats_shm_pcpu(shm, index);
+            pcpu->id = pcpu_stats[index].id;
+            pcpu->cpu_util = pcpu_stats[index].cpu_util;
+            pcpu->num_pinned = pcpu_stats[index].num_pinned;
+            pcpu->node_id = pcpu_stats[index].node_id;
+            pcpu->socket_id = pcpu_stats[index].socket_id;
+            pcpu->core_id = pcpu_stats[index].core_id;
+            pcpu->l3_id = pcpu_stats[index].l3_id;
+            pcpu->smt_index = pcpu_stats[index].smt_index;
+            pcpu->parked = (int32_t)BITMASK_TEST(&virt_info.pcpu_parked_mask, index);
+        }
 
-    /* Keep looping until all domain names are free */
-    } while (virt_info.num_domains);
+        /* Loop through each domain */
+        for (index = 0; index < virt_info.num_domains; index++)
+        {
+            vm = stats_shm_vm(shm, index);
+            snprintf(vm->name, STATS_SHM_NAME_LEN, "%s", domain_stats[index]->name);
+            vm->dom_id = domain_stats[index]->dom_id;
+            vm->num_vcpus = domain_stats[index]->num_vcpus;
+            vm->first_vcpu = num_vcpus;
+            vm->tier = domain_stats[index]->tier;
+            vm->throttled = domain_stats[index]->throttled;
 
-    /* Free the list */
-    free(virt_info.domain_list);
+            /* Loop through each VCPU of the domain */
+            for (vcpu_index = 0; (vcpu_index < domain_stats[index]->num_vcpus) && (num_vcpus < virt_info.num_vcpus); vcpu_index++)
+            {
+                vcpu_stats = &domain_stats[index]->vcpus[vcpu_index];
+                vcpu = stats_shm_vcpu(shm, num_vcpus++);
+                vcpu->vm = index;
+                vcpu->vcpu_num = vcpu_stats->vcpu_num;
+                vcpu->pcpu = vcpu_stats->pcpu->id;
+                vcpu->cpu_util = vcpu_stats->cpu_util;
+                vcpu->cpu_util_avg = vcpu_stats->cpu_util_avg;
+                vcpu->cpu_time = vcpu_stats->last_time;
+                vcpu->last_move_cycle = vcpu_stats->last_move_cycle;
+            }
+        }
 
-    /* Close connection to hypervisor */
-    virConnectClose(virt_info.conn);
+        /* Publish snapshot */
+        stats_shm_end(shm);
+    }
 }
 
 
@@ -903,7 +5338,7 @@ static int  pcpu_get_idle(int num_params, unsigned long long * idle_time)
 *************************************************************************/
 static void dump_scheduler_stats(void)
 {
-    int     index;
+    int     index, vcpu;
 
 
     /* Output header */
@@ -915,24 +5350,42 @@ static void dump_scheduler_stats(void)
     {
         /* Output PCPU utilization time for this cycle */
         printf("PCPU = %d\n", index);
+        printf("    Node/L3  = %d/%d\n", pcpu_stats[index].node_id, pcpu_stats[index].l3_id);
         printf("    CPU Util = %d\n", pcpu_stats[index].cpu_util);
     }
 
+    /* Output number of VCPUs repinned this cycle and the current interval */
+    printf("\nRepins = %d\n", virt_info.num_repins);
+    printf("Interval = %u ms\n", virt_info.interval.interval_ms);
+    printf("Repin Timeouts = %d (total %llu)\n", virt_info.num_timeouts, virt_info.workers.num_timeouts);
+
     /* Output header */
     printf("\nVCPU Stats\n");
     printf("==========\n");
 
-    /* Loop through each VCPU */
+    /* Loop through each VCPU of each domain */
     for (index = 0; index < virt_info.num_domains ; index++)
     {
-        /* Output info for PCPU */
-        printf("VM name       = %s\n", virDomainGetName(vcpu_stats[index].domain_id));
+        for (vcpu = 0; vcpu < domain_stats[index]->num_vcpus; vcpu++)
+        {
+            /* Output info for PCPU */
+            printf("VM name       = %s\n", domain_stats[index]->name);
 
-        /* Output PCPU pinning info */
-        printf("    PCPU Pin = %d\n", vcpu_stats[index].pcpu->id);
+            /* Output priority tier of the VM and if it is throttled */
+            printf("    Tier     = %d%s\n", domain_stats[index]->tier, (domain_stats[index]->throttled ? " (throttled)" : ""));
 
-        /* Output CPU utilization over entire test */
-        printf("    CPU Util = %d\n", vcpu_stats[index].cpu_util);
+            /* Output VCPU number within the VM */
+            printf("    VCPU     = %u\n", domain_stats[index]->vcpus[vcpu].vcpu_num);
+
+            /* Output PCPU pinning info */
+            printf("    PCPU Pin = %d\n", domain_stats[index]->vcpus[vcpu].pcpu->id);
+
+            /* Output CPU utilization over entire test */
+            printf("    CPU Util = %d\n", domain_stats[index]->vcpus[vcpu].cpu_util);
+
+            /* Output smoothed CPU utilization */
+            printf("    CPU Avg  = %d\n", domain_stats[index]->vcpus[vcpu].cpu_util_avg);
+        }
     }
 }
 #endif  /* (VCPU_SCHEDULER_DEBUG == 1) */
@@ -9,14 +9,115 @@
 #ifndef VCPU_SCHEDULER_DEFS_H
 #define VCPU_SCHEDULER_DEFS_H
 
+#include "bitmask_defs.h"
+#include "xml_defs.h"
+#include "domain_events_defs.h"
+#include "interval_defs.h"
+#include "worker_pool_defs.h"
+#include "metrics_defs.h"
+#include "monitor_defs.h"
+#include "stats_shm_defs.h"
+#include "policy_defs.h"
+#include "config_defs.h"
+#include "trace_defs.h"
+
 /* Set debug to 1 for printf details of VCPU scheduler stats / 0 for no output */
 #define VCPU_SCHEDULER_DEBUG                1
 
-/* Configurable values used for making scheduling decisions for VCPUs */
+/* Set bulk stats to 1 to collect all VCPU times with a single libvirt call per cycle
+   (virConnectGetAllDomainStats) / 0 to always use one call per domain.
+   NOTE:  Per-domain collection is still used if libvirt doesn't support bulk stats */
+#if LIBVIR_CHECK_VERSION(1, 2, 8)
+#define VCPU_SCHEDULER_BULK_STATS           1
+#else
+#define VCPU_SCHEDULER_BULK_STATS           0
+#endif
+
+/* URI of the hypervisor the VCPU scheduler connects to */
+#define VCPU_SCHEDULER_URI                  "qemu:///system"
+
+/* Number of workers (each with its own hypervisor connection) used to repin VCPUs
+   concurrently so a slow domain doesn't hold up the repins of other domains / 0 to repin inline
+   NOTE:  May be overridden at runtime with the -j command-line option */
+#define VCPU_SCHEDULER_WORKERS              4
+
+/* Time (in milliseconds) each cycle waits for a repin before moving on (the repin keeps
+   running and the domain is skipped until it returns) */
+#define VCPU_SCHEDULER_CALL_TIMEOUT         2000
+
+/* TCP port (on METRICS_BIND_ADDR) the OpenMetrics endpoint (/metrics) is served on / 0 for no endpoint
+   NOTE:  May be overridden at runtime with the -m command-line option */
+#define VCPU_SCHEDULER_METRICS_PORT         0
+
+/* Set spread siblings to 1 so VCPUs of the same VM are not repinned onto a PCPU already
+   running one of its sibling VCPUs / 0 to allow sibling VCPUs to share a PCPU
+   NOTE:  May be overridden at runtime with the -s command-line option */
+#define VCPU_SCHEDULER_SPREAD_SIBLINGS      1
+
+/* Set topology to 1 to read the host NUMA node / L3 cache / SMT topology at startup and
+   prefer nearby PCPUs when repinning / 0 to treat all PCPUs as equally good targets
+   NOTE:  May be overridden at runtime with the -t command-line option */
+#define VCPU_SCHEDULER_TOPOLOGY             1
+
+/* Placement costs (in % utilization) added when comparing target PCPUs for a VCPU */
+#define VCPU_SCHEDULER_L3_COST              10      /* Target PCPU uses a different L3 cache (same NUMA node) */
+#define VCPU_SCHEDULER_NUMA_COST            20      /* Target PCPU is in a different NUMA node */
+#define VCPU_SCHEDULER_SMT_COST             15      /* Target PCPU's SMT sibling is busy while an idle full core exists */
+
+/* Define rebalancing engines used to adjust VCPU pinning */
+#define VCPU_SCHEDULER_ENGINE_GREEDY        0       /* Best fit of 1 VCPU per low PCPU each cycle */
+#define VCPU_SCHEDULER_ENGINE_BINPACK       1       /* Full target assignment each cycle (largest VCPU first) */
+
+/* Default rebalancing engine
+   NOTE:  May be overridden at runtime with the -e command-line option */
+#define VCPU_SCHEDULER_ENGINE               VCPU_SCHEDULER_ENGINE_GREEDY
+
+/* Configurable values used for making scheduling decisions for VCPUs
+   NOTE:  May be overridden at runtime in the [cpu] section of the configuration file (-c) */
 #define VCPU_SCHEDULER_PCPU_HIGH_THRESHOLD  90      /* PCPU utilization above this % considered "high" */
 #define VCPU_SCHEDULER_PCPU_TGT             80      /* PCPU target utilization % */
 #define VCPU_SCHEDULER_PCPU_LOW_THRESHOLD   70      /* PCPU utilization below this % considered "low" */
 
+/* Set consolidate to 1 to pack VCPUs onto fewer PCPUs (up to the target utilization) while no PCPU
+   is "high", parking the PCPUs left without VCPUs so they can idle deeply / be given to host
+   housekeeping and the busy cores gain turbo headroom / 0 to only balance
+   NOTE:  May be overridden at runtime with the -k command-line option */
+#define VCPU_SCHEDULER_CONSOLIDATE          0
+
+/* Number of cycles without a "high" PCPU before VCPUs are packed again (so PCPUs just unparked
+   for a burst aren't parked again on the next quiet cycle) */
+#define VCPU_SCHEDULER_CONSOLIDATE_SETTLE   10
+
+/* Section of the configuration file holding the VCPU scheduler settings */
+#define VCPU_SCHEDULER_CONFIG_SECTION       "cpu"
+
+/* Configurable values used to limit VCPU migrations (repins)
+   NOTE:  May be overridden at runtime with the -w, -r, -b and -p command-line options */
+#define VCPU_SCHEDULER_UTIL_WEIGHT          50      /* Weight % of latest cycle in smoothed VCPU utilization */
+#define VCPU_SCHEDULER_MIN_RESIDENCY        3       /* Minimum cycles a VCPU stays on a PCPU before it can move */
+#define VCPU_SCHEDULER_MIGRATION_BUDGET     4       /* Maximum VCPUs repinned per cycle (0 = no limit) */
+#define VCPU_SCHEDULER_MIGRATION_PENALTY    5       /* Minimum % reduction of busiest PCPU load needed to repin */
+
+/* Set to 1 to set the CPU shares / VCPU quota of each VM from its priority tier (priority of its
+   VM section in the configuration file) or 0 to only pin VCPUs
+   NOTE:  May be overridden at runtime with the -q command-line option */
+#define VCPU_SCHEDULER_PRIORITY_CONTROL     1
+
+/* Define priority tiers of VMs */
+#define VCPU_SCHEDULER_TIER_BATCH           -1      /* priority < 0 - throttled while it shares a busy PCPU */
+#define VCPU_SCHEDULER_TIER_NORMAL          0       /* priority = 0 (default) - left at hypervisor defaults */
+#define VCPU_SCHEDULER_TIER_CRITICAL        1       /* priority > 0 - latency-critical, favored on a busy PCPU */
+
+/* Define CPU shares (relative weight when a PCPU is contended) of each priority tier */
+#define VCPU_SCHEDULER_SHARES_BATCH         256
+#define VCPU_SCHEDULER_SHARES_NORMAL        1024    /* Hypervisor default */
+#define VCPU_SCHEDULER_SHARES_CRITICAL      4096
+
+/* Define VCPU quota period in microseconds and % of it each VCPU of a throttled batch VM may run
+   NOTE:  Quota may be overridden at runtime in the [cpu] section of the configuration file (-c) */
+#define VCPU_SCHEDULER_QUOTA_PERIOD         100000
+#define VCPU_SCHEDULER_BATCH_QUOTA          50
+
 /* Define status errors */
 #define VCPU_SCHEDULER_CONN_ERROR           -1
 #define VCPU_SCHEDULER_NO_DOMAINS           -2
@@ -24,34 +125,154 @@
 #define VCPU_SCHEDULER_NOMEM                -4
 #define VCPU_SCHEDULER_DOMAIN_INFO_ERROR    -5
 #define VCPU_SCHEDULER_PCPU_IDLE_ERROR      -6
+#define VCPU_SCHEDULER_BULK_STATS_UNSUPPORTED -7
+#define VCPU_SCHEDULER_DOMAIN_GONE          -8      /* Domain stopped - skipped until its stop event is processed */
+#define VCPU_SCHEDULER_EVENT_ERROR          -9
+#define VCPU_SCHEDULER_PIN_ERROR            -10
+#define VCPU_SCHEDULER_DOMAIN_BUSY          -11     /* Earlier repin for domain timed out - skipped until it returns */
+#define VCPU_SCHEDULER_WORKER_ERROR         -12
+#define VCPU_SCHEDULER_METRICS_ERROR        -13
+#define VCPU_SCHEDULER_CONFIG_ERROR         -14
+#define VCPU_SCHEDULER_TRACE_ERROR          -15
+#define VCPU_SCHEDULER_MONITOR_ERROR        -16
+#define VCPU_SCHEDULER_SHM_ERROR            -17
+#define VCPU_SCHEDULER_PARKED_ERROR         -18
+
+/* Maximum length of a typed parameter name (ie "vcpu.<num>.time") */
+#define VCPU_SCHEDULER_PARAM_NAME_LEN       32
+
+/* Maximum length of a domain name kept for output (longer names are truncated) */
+#define VCPU_SCHEDULER_NAME_LEN             64
+
+/* Define phases of a scheduling cycle timed for the metrics */
+#define VCPU_SCHEDULER_PHASE_PCPU           0       /* collect_pcpu_stats */
+#define VCPU_SCHEDULER_PHASE_VCPU           1       /* collect_vcpu_stats */
+#define VCPU_SCHEDULER_PHASE_ADJUST         2       /* vcpu_pinning_adjust (including waiting for repins) */
+#define VCPU_SCHEDULER_PHASE_EVENTS         3       /* domain_events_process (of the previous cycle) */
+#define VCPU_SCHEDULER_NUM_PHASES           4
+
+/* Structure of arrays holding the per-VCPU state scanned by the rebalancing engines - 1 slot per
+   VCPU with the VCPUs of each domain in consecutive slots.  The table is rebuilt when domains are
+   added / removed and kept up to date as VCPUs are measured and repinned, so a best fit scan reads
+   a few contiguous arrays instead of following pointers through the VCPU stats */
+typedef struct VCPU_TABLE_STRUCT
+{
+    int                         num_slots;  /* Number of VCPUs in the table */
+    int                         max_slots;  /* Number of slots allocated */
+    struct VCPU_STATS_STRUCT ** vcpu;       /* VCPU stats of each slot */
+    int *                       util;       /* Latest utilization % */
+    int *                       util_avg;   /* Smoothed utilization % */
+    int *                       pcpu;       /* Index of the PCPU the VCPU is pinned to */
+    int *                       target;     /* Index of the PCPU the VCPU is planned for (bin packing, -1 = none) */
+    int *                       order;      /* Slots sorted by utilization (bin packing - kept between cycles so ties keep their order) */
+    int *                       index;      /* Slots grouped by PCPU, each group sorted by smoothed utilization (greedy) */
+    unsigned char *             exclusive;  /* Non-zero if the domain of the VCPU is exclusive */
 
-/* Time conversion macros */
-#define VCPU_SCHEDULER_SEC_TO_NANOSECS      1000000000
+} VCPU_TABLE;
 
 /* Structure to keep track of all the virt library variables / data */
 typedef struct VIRT_INFO_STRUCT
 {
     virConnectPtr       conn;
+    int                 shared;         /* Non-zero if the connection and domain events belong to the resource manager */
     int                 num_domains;
     int                 num_pcpus;
-    unsigned int        pcpu_high_mask;
-    unsigned int        pcpu_low_mask;
+    int                 cpumap_len;     /* Number of bytes in a PCPU cpumap */
+    BITMASK             pcpu_high_mask;
+    BITMASK             pcpu_low_mask;
+    BITMASK             pcpu_parked_mask; /* PCPUs left without VCPUs by consolidation (-k) */
+    int                 num_parked;     /* Number of PCPUs parked */
+    int                 parked_changed; /* Non-zero while a change to the parked PCPUs isn't published (-f) */
+    int                 parked_error;   /* Non-zero once publishing the parked PCPUs failed (warned once) */
+    unsigned long long  high_cycle;     /* Last scheduling cycle a PCPU was "high" */
+    int *               pcpu_drain;     /* PCPU indexes in the order consolidation tries to empty them */
     virNodeCPUStats *   params;
     int                 num_params;
-    virDomainPtr *      domain_list;
+    int                 max_domains;    /* Number of entries allocated in domain stats list */
+    int                 num_vcpus;      /* Total number of VCPUs in all domains */
+    int                 max_domain_vcpus; /* Largest number of VCPUs in a single domain */
+    virVcpuInfo *       vcpu_info;      /* VCPU info for a single domain (max_domain_vcpus entries) */
+    VCPU_TABLE          vcpu_table;     /* Per-VCPU state scanned by the rebalancing engines */
+    int                 num_repins;     /* Number of VCPUs repinned during the last cycle */
+    unsigned long long  cycle;          /* Number of scheduling cycles run */
+    int *               pcpu_order;     /* PCPU indexes in initial placement order (full cores first) */
+    int                 bulk_stats;     /* Non-zero if bulk VCPU stats are supported */
+    DOMAIN_EVENTS       events;         /* Domain start / stop events waiting to be processed */
+    INTERVAL            interval;       /* Time between scheduling cycles */
+    WORKER_POOL         workers;        /* Workers used to repin VCPUs concurrently */
+    int                 num_timeouts;   /* Number of repins that timed out during the last cycle */
+    unsigned long long  total_repins;   /* Total number of VCPUs repinned */
+    unsigned long long  phase_ns[VCPU_SCHEDULER_NUM_PHASES]; /* Time spent in each phase of the last cycle */
+    METRICS             metrics;        /* OpenMetrics endpoint (if enabled with -m) */
+    MONITOR             monitor;        /* Monitor stream (if enabled with -u) */
+    STATS_SHM           shm;            /* Shared memory snapshot (if enabled with -z) */
+    CONFIG              config;         /* Configuration file last loaded (if given with -c) */
+    unsigned int        config_generation; /* Reload request the configuration was last loaded at */
+    TRACE               trace;          /* Binary trace of each cycle (if enabled with -o) */
 
 } VIRT_INFO;
 
-/* Structure to keep track of each VM's stats (CPU utilization, etc) and which
-   PCPU the VM is affined to (assumes each VM only has a single VCPU) */
+/* Structure to keep track of VCPU scheduler options set at runtime */
+typedef struct VCPU_SCHEDULER_CONFIG_STRUCT
+{
+    int                 spread_siblings; /* Non-zero to keep VCPUs of a VM on different PCPUs */
+    int                 engine;         /* Rebalancing engine used to adjust VCPU pinning */
+    int                 topology_aware; /* Non-zero to prefer nearby PCPUs using host topology */
+    int                 util_weight;    /* Weight % of latest cycle in smoothed VCPU utilization */
+    int                 min_residency;  /* Minimum cycles a VCPU stays on a PCPU before it can move */
+    int                 migration_budget; /* Maximum VCPUs repinned per cycle (0 = no limit) */
+    int                 migration_penalty; /* Minimum % reduction of busiest PCPU load needed to repin */
+    unsigned int        adapt_min_ms;   /* Shortest adaptive interval in milliseconds (0 = not adaptive) */
+    unsigned int        adapt_max_ms;   /* Longest adaptive interval in milliseconds */
+    int                 num_workers;    /* Number of workers used to repin VCPUs (0 = repin inline) */
+    int                 metrics_port;   /* Port the metrics endpoint is served on (0 = no endpoint) */
+    const char *        monitor_path;   /* Unix socket the monitor stream is served on (NULL = no stream) */
+    const char *        shm_name;       /* Shared memory segment the stats are published in (NULL = none) */
+    const char *        config_path;    /* Configuration file reloaded on SIGHUP (NULL = none) */
+    const char *        trace_path;     /* Binary trace file (NULL = no trace) */
+    int                 high_threshold; /* PCPU utilization above this % considered "high" */
+    int                 pcpu_target;    /* PCPU target utilization % */
+    int                 low_threshold;  /* PCPU utilization below this % considered "low" */
+    int                 priority_control; /* Non-zero to set CPU shares / VCPU quota by priority tier */
+    int                 batch_quota;    /* % of the quota period each VCPU of a throttled batch VM may run */
+    int                 consolidate;    /* Non-zero to pack VCPUs onto fewer PCPUs while no PCPU is "high" */
+    const char *        parked_path;    /* File the parked PCPUs are published in (NULL = not published) */
+
+} VCPU_SCHEDULER_CONFIG;
+
+/* Structure to keep track of each domain and the VCPUs that belong to it */
+typedef struct DOMAIN_STATS_STRUCT
+{
+    virDomainPtr                domain_id;  /* Domain ID */
+    unsigned int                dom_id;     /* Hypervisor ID of domain (used to match bulk stats records) */
+    int                         num_vcpus;  /* Number of VCPUs in this domain */
+    unsigned long long          add_cycle;  /* Scheduling cycle this domain was added (0 = at startup) */
+    int                         exclusive;  /* Non-zero to keep other VCPUs off the PCPUs of this domain (configuration file) */
+    int                         tier;       /* Priority tier from the configuration file (VCPU_SCHEDULER_TIER_*) */
+    unsigned long long          shares;     /* CPU shares last set (0 = never set - hypervisor default) */
+    int                         throttled;  /* Non-zero while the batch VCPU quota is set */
+    unsigned long long          throttle_cycle; /* Scheduling cycle the VCPU quota was last set / cleared */
+    int                         sched_failed; /* Non-zero once the hypervisor refused its scheduler parameters */
+    struct VCPU_STATS_STRUCT *  vcpus;      /* This domain's VCPU stats (num_vcpus entries) */
+    int                         first_slot; /* VCPU table slot of its first VCPU (-1 = not in the table yet) */
+    char                        name[VCPU_SCHEDULER_NAME_LEN]; /* Domain name (read once when the domain is added) */
+
+} DOMAIN_STATS;
+
+/* Structure to keep track of each VCPU's stats (CPU utilization, etc) and which
+   PCPU the VCPU is affined to (1 per domain / VCPU pair) */
 typedef struct VCPU_STATS_STRUCT
 {
     virDomainPtr                domain_id;  /* Domain ID which contains this VCPU */
+    struct DOMAIN_STATS_STRUCT * domain;    /* Pointer to domain stats containing this VCPU */
+    unsigned int                vcpu_num;   /* VCPU number within the domain */
     int                         cpu_util;   /* CPU Utilization for this VCPU in % */
+    int                         cpu_util_avg; /* Smoothed (moving average) CPU Utilization for this VCPU in % */
     unsigned long long int      last_time;  /* Last read total CPU time from VM boot */
+    unsigned long long          last_ns;    /* Monotonic time (ns) last_time was read */
+    unsigned long long          last_move_cycle; /* Scheduling cycle this VCPU was last pinned */
     struct PCPU_STATS_STRUCT *  pcpu;       /* Pointer to PCPU struct that this VCPU is pinned to */
-    struct VCPU_STATS_STRUCT *  next;       /* Pointer to next VCPU pinned to the same PCPU */
-    struct VCPU_STATS_STRUCT *  prev;       /* Pointer to previous VCPU pinned to the same PCPU */
+    int                         slot;       /* VCPU table slot of this VCPU (-1 = not in the table yet) */
 
 } VCPU_STATS;
 
@@ -60,24 +281,27 @@ typedef struct VCPU_STATS_STRUCT
 typedef struct PCPU_STATS_STRUCT
 {
     int                         id;         /* CPU ID for this PCPU */
-    unsigned char               cpumap;     /* CPU map to pin a VCPU exclusively to this PCPU */
+    unsigned char *             cpumap;     /* CPU map to pin a VCPU exclusively to this PCPU */
     int                         cpu_util;   /* CPU Utilization for this CPU in % */
     unsigned long long          last_time;  /* Last read CPU idle time for PCPU */
+    unsigned long long          last_ns;    /* Monotonic time (ns) last_time was read */
     int                         num_pinned; /* Total number of pinned VCPUs for this PCPU */
-    struct VCPU_STATS_STRUCT *  head;       /* Head of linked list of VCPUs pinned to this PCPU */
+    int                         vcpu_util;  /* Latest CPU Utilization of the pinned VCPUs in % (kept as VCPUs are
+                                               measured / pinned) */
+    int                         num_exclusive; /* Number of pinned VCPUs of exclusive domains */
+    int                         max_tier;   /* Highest priority tier of the pinned VCPUs (domain_sched_adjust) */
+    int                         index_start; /* Start of the group of its VCPUs in the VCPU table index (greedy) */
+    int                         plan_util;  /* Planned CPU Utilization for this CPU in % (bin packing) */
+    int                         plan_pinned; /* Planned number of VCPUs for this PCPU (bin packing) */
+    int                         plan_exclusive; /* Non-zero if an exclusive VCPU is planned for this PCPU (bin packing) */
+    int                         plan_moved; /* Utilization % planned to move onto (> 0) / off (< 0) this PCPU so far (bin packing) */
+    int                         node_id;    /* NUMA node (cell) containing this PCPU */
+    int                         socket_id;  /* Socket containing this PCPU */
+    int                         core_id;    /* Core (within socket) containing this PCPU */
+    int                         l3_id;      /* L3 cache used by this PCPU */
+    int                         smt_index;  /* Position of this PCPU's thread within its core (0 = first) */
+    struct PCPU_STATS_STRUCT *  smt_next;   /* Next SMT sibling thread of the same core (circular list) */
 
 } PCPU_STATS;
 
-/* Macro to get bit position of lowest set bit in a 32-bit value */
-#define LOW_BIT_GET32(value32, lowbit_ptr)                          \
-        {                                                           \
-            /* Initialize lowbit to 0 */                            \
-            *lowbit_ptr = 0;                                        \
-                                                                    \
-            /* Use bitscan forward assembly instruction */          \
-            asm volatile(" bsf  %0, %1"                             \
-                        : "=r" (*(unsigned int *)lowbit_ptr)        \
-                        : "r" ((unsigned int)value32));             \
-        }
-
 #endif /* VCPU_SCHEDULER_DEFS_H */
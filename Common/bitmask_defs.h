@@ -0,0 +1,440 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains a variable width bit mask used by both the
+*       VCPU scheduler and the memory coordinator to keep track of
+*       PCPUs / VMs of interest (ie "high" and "low" utilization sets)
+*
+***********************************************************************/
+#ifndef BITMASK_DEFS_H
+#define BITMASK_DEFS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+/* Type of each word in the bit mask - bits are searched a word at a time */
+typedef unsigned long   BITMASK_WORD;
+
+/* Number of bits in each bit mask word */
+#define BITMASK_WORD_BITS                   ((int)(sizeof(BITMASK_WORD) * 8))
+
+/* Number of words needed to hold the specified number of bits */
+#define BITMASK_NUM_WORDS(num_bits)         (((num_bits) + BITMASK_WORD_BITS - 1) / BITMASK_WORD_BITS)
+
+/* Structure for a variable width bit mask */
+typedef struct BITMASK_STRUCT
+{
+    int                 num_bits;   /* Number of usable bits in the mask */
+    int                 num_words;  /* Number of words allocated for the mask */
+    BITMASK_WORD *      words;      /* Bit mask words (bit 0 is LSB of word 0) */
+
+} BITMASK;
+
+/* Macros to set / clear / test a single bit in a bit mask */
+#define BITMASK_SET(mask_ptr, bit)                                  \
+        ((mask_ptr)->words[(bit) / BITMASK_WORD_BITS] |= ((BITMASK_WORD)1 << ((bit) % BITMASK_WORD_BITS)))
+#define BITMASK_CLEAR(mask_ptr, bit)                                \
+        ((mask_ptr)->words[(bit) / BITMASK_WORD_BITS] &= ~((BITMASK_WORD)1 << ((bit) % BITMASK_WORD_BITS)))
+#define BITMASK_TEST(mask_ptr, bit)                                 \
+        (((mask_ptr)->words[(bit) / BITMASK_WORD_BITS] >> ((bit) % BITMASK_WORD_BITS)) & 1)
+
+/* Macro to loop through each set bit in a bit mask (lowest bit first)
+   NOTE:  Bits at or below the current bit may be cleared while looping */
+#define BITMASK_FOR_EACH(mask_ptr, bit)                             \
+        for ((bit) = bitmask_next_set((mask_ptr), 0);               \
+             (bit) >= 0;                                            \
+             (bit) = bitmask_next_set((mask_ptr), (bit) + 1))
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bitmask_init
+*
+*   DESCRIPTION
+*
+*       Allocates a bit mask able to hold the specified number of bits
+*       with all bits cleared
+*
+*   INPUTS
+*
+*       mask                                Pointer to bit mask
+*       num_bits                            Number of bits needed
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Bit mask allocated
+*       EXIT_FAILURE                        No memory for bit mask
+*
+*************************************************************************/
+static inline int bitmask_init(BITMASK * mask, int num_bits)
+{
+    /* Set size of mask (always allocate at least 1 word) */
+    mask->num_bits = num_bits;
+    mask->num_words = (num_bits > 0 ? BITMASK_NUM_WORDS(num_bits) : 1);
+
+    /* Allocate cleared words for the mask */
+    mask->words = calloc(mask->num_words, sizeof(BITMASK_WORD));
+
+    /* Return status to caller */
+    return (mask->words != NULL ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bitmask_resize
+*
+*   DESCRIPTION
+*
+*       Changes the number of bits held by a bit mask - existing bits
+*       are kept and any new bits are cleared
+*
+*   INPUTS
+*
+*       mask                                Pointer to bit mask
+*       num_bits                            New number of bits needed
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Bit mask resized
+*       EXIT_FAILURE                        No memory for bit mask
+*
+*************************************************************************/
+static inline int bitmask_resize(BITMASK * mask, int num_bits)
+{
+    int             num_words = (num_bits > 0 ? BITMASK_NUM_WORDS(num_bits) : 1);
+    BITMASK_WORD *  words;
+
+
+    /* Check if more words are needed */
+    if (num_words > mask->num_words)
+    {
+        /* Grow the words */
+        words = realloc(mask->words, num_words * sizeof(BITMASK_WORD));
+
+        /* Ensure memory allocated */
+        if (words == NULL)
+        {
+            /* Return error - existing mask is unchanged */
+            return (EXIT_FAILURE);
+        }
+
+        /* Clear the new words */
+        memset(&words[mask->num_words], 0, (num_words - mask->num_words) * sizeof(BITMASK_WORD));
+
+        /* Save new words */
+        mask->words = words;
+        mask->num_words = num_words;
+    }
+    else if ((num_bits < mask->num_bits) && (num_bits % BITMASK_WORD_BITS))
+    {
+        /* Clear bits beyond the new size in the last used word */
+        mask->words[num_bits / BITMASK_WORD_BITS] &= (((BITMASK_WORD)1 << (num_bits % BITMASK_WORD_BITS)) - 1);
+    }
+
+    /* Clear any whole words beyond the new size */
+    if (BITMASK_NUM_WORDS(num_bits) < mask->num_words)
+    {
+        memset(&mask->words[BITMASK_NUM_WORDS(num_bits)], 0,
+               (mask->num_words - BITMASK_NUM_WORDS(num_bits)) * sizeof(BITMASK_WORD));
+    }
+
+    /* Set new number of bits */
+    mask->num_bits = num_bits;
+
+    /* Return success */
+    return (EXIT_SUCCESS);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bitmask_free
+*
+*   DESCRIPTION
+*
+*       Frees memory used by a bit mask
+*
+*   INPUTS
+*
+*       mask                                Pointer to bit mask
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static inline void bitmask_free(BITMASK * mask)
+{
+    /* Free words and clear size */
+    free(mask->words);
+    mask->words = NULL;
+    mask->num_words = 0;
+    mask->num_bits = 0;
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bitmask_zero
+*
+*   DESCRIPTION
+*
+*       Clears all bits in a bit mask
+*
+*   INPUTS
+*
+*       mask                                Pointer to bit mask
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static inline void bitmask_zero(BITMASK * mask)
+{
+    /* Clear all words */
+    memset(mask->words, 0, mask->num_words * sizeof(BITMASK_WORD));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bitmask_empty
+*
+*   DESCRIPTION
+*
+*       Determines if no bits are set in a bit mask
+*
+*   INPUTS
+*
+*       mask                                Pointer to bit mask
+*
+*   OUTPUTS
+*
+*       1                                   No bits set
+*       0                                   At least 1 bit set
+*
+*************************************************************************/
+static inline int bitmask_empty(const BITMASK * mask)
+{
+    int     index;
+
+
+    /* Loop through each word */
+    for (index = 0; index < mask->num_words; index++)
+    {
+        /* Check if any bit set in this word */
+        if (mask->words[index])
+        {
+            /* Not empty */
+            return (0);
+        }
+    }
+
+    /* Empty */
+    return (1);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bitmask_next_set
+*
+*   DESCRIPTION
+*
+*       Finds the lowest set bit at or above the specified bit position,
+*       searching a word at a time
+*
+*   INPUTS
+*
+*       mask                                Pointer to bit mask
+*       start                               First bit position to check
+*
+*   OUTPUTS
+*
+*       >= 0                                Position of next set bit
+*       -1                                  No more bits set
+*
+*************************************************************************/
+static inline int bitmask_next_set(const BITMASK * mask, int start)
+{
+    int             index = start / BITMASK_WORD_BITS;
+    BITMASK_WORD    word;
+
+
+    /* Ensure start is within the mask */
+    if ((start < 0) || (start >= mask->num_bits))
+    {
+        /* No more bits */
+        return (-1);
+    }
+
+    /* Get first word ignoring bits below start */
+    word = mask->words[index] & (~(BITMASK_WORD)0 << (start % BITMASK_WORD_BITS));
+
+    /* Loop until a word with a set bit is found */
+    while (word == 0)
+    {
+        /* Move to next word */
+        index++;
+
+        /* Check if all words searched */
+        if (index >= mask->num_words)
+        {
+            /* No more bits */
+            return (-1);
+        }
+
+        /* Get next word */
+        word = mask->words[index];
+    }
+
+    /* Return position of lowest set bit in this word */
+    return ((index * BITMASK_WORD_BITS) + __builtin_ctzl(word));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bitmask_count
+*
+*   DESCRIPTION
+*
+*       Counts the number of set bits in a bit mask
+*
+*   INPUTS
+*
+*       mask                                Pointer to bit mask
+*
+*   OUTPUTS
+*
+*       int                                 Number of set bits
+*
+*************************************************************************/
+static inline int bitmask_count(const BITMASK * mask)
+{
+    int     index, count = 0;
+
+
+    /* Loop through each word adding number of bits set */
+    for (index = 0; index < mask->num_words; index++)
+    {
+        count += __builtin_popcountl(mask->words[index]);
+    }
+
+    /* Return count to caller */
+    return (count);
+}
+
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       bitmask_parse_list
+*
+*   DESCRIPTION
+*
+*       Sets the bits listed in a libvirt / Linux style CPU or node list
+*       (ie "0-3,8,10-11" or "0-7,^4") - parsing stops at the first
+*       character that isn't part of the list (ie a closing quote).
+*       Bits beyond the size of the mask are ignored
+*
+*   INPUTS
+*
+*       mask                                Pointer to bit mask
+*       list                                List of bits to set
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        List parsed
+*       EXIT_FAILURE                        List is malformed
+*
+*************************************************************************/
+static inline int bitmask_parse_list(BITMASK * mask, const char * list)
+{
+    char *  end;
+    long    first, last, bit;
+    int     exclude, more;
+
+
+    /* Loop through each entry in the list */
+    do
+    {
+        /* Check if this entry excludes bits */
+        exclude = (*list == '^');
+        list += exclude;
+
+        /* Ensure entry starts with a number */
+        if (!isdigit((unsigned char)*list))
+        {
+            /* Malformed (or empty) list */
+            return (EXIT_FAILURE);
+        }
+
+        /* Get first bit of entry */
+        first = strtol(list, &end, 10);
+        last = first;
+        list = end;
+
+        /* Check if entry is a range */
+        if (*list == '-')
+        {
+            /* Get last bit of range */
+            last = strtol(list + 1, &end, 10);
+
+            /* Ensure range is valid */
+            if ((end == (list + 1)) || (last < first))
+            {
+                /* Malformed list */
+                return (EXIT_FAILURE);
+            }
+
+            /* Move past range */
+            list = end;
+        }
+
+        /* Loop through each bit in the entry within the size of the mask */
+        for (bit = first; (bit <= last) && (bit < mask->num_bits); bit++)
+        {
+            /* Set or clear bit */
+            if (exclude)
+            {
+                BITMASK_CLEAR(mask, bit);
+            }
+            else
+            {
+                BITMASK_SET(mask, bit);
+            }
+        }
+
+        /* Check if another entry follows */
+        more = (*list == ',');
+        list += more;
+
+    /* Loop while more entries in the list */
+    } while (more);
+
+    /* Return success */
+    return (EXIT_SUCCESS);
+}
+
+#endif /* BITMASK_DEFS_H */
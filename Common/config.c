@@ -0,0 +1,770 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains configuration file code shared by the VCPU
+*       scheduler and the memory coordinator.  The file is made of
+*       sections of "key = value" lines - a section for each daemon's
+*       thresholds (ie "[cpu]") and a section for each VM with overrides
+*       (ie "[vm web1]").  Blank lines and text after '#' are ignored.
+*       SIGHUP only counts a reload request - each daemon reads the file
+*       again at the start of its next cycle
+*
+*   FUNCTIONS
+*
+*       config_load
+*       config_free
+*       config_check
+*       config_get_int
+*       config_vm_find
+*       config_watch
+*       config_generation
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include <signal.h>
+#include "config_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static char * config_trim(char * text);
+static int  config_parse_int(const char * text, int * value);
+static int  config_add_setting(CONFIG * config, const char * section, const char * key, const char * value, int line);
+static CONFIG_VM * config_add_vm(CONFIG * config, const char * name);
+static int  config_set_vm(CONFIG_VM * vm, const char * key, const char * value);
+static void config_hangup(int signal_num);
+
+/*****************************/
+/* LOCAL VARIABLES           */
+/*****************************/
+static volatile sig_atomic_t    reload_generation;  /* Number of SIGHUPs received */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_load
+*
+*   DESCRIPTION
+*
+*       Reads a configuration file.  The configuration is always set up
+*       (empty if the file can't be read or has an error) so it can be
+*       freed with config_free
+*
+*   INPUTS
+*
+*       config                              Pointer to configuration to load
+*       path                                Path of configuration file
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Configuration loaded
+*       EXIT_FAILURE                        File can't be read or has an
+*                                           error (printed to stderr)
+*
+*************************************************************************/
+int config_load(CONFIG * config, const char * path)
+{
+    int             line = 0, status = EXIT_SUCCESS;
+    FILE *          file;
+    CONFIG_VM *     vm = NULL;
+    char *          text;
+    char *          value;
+    char            buffer[CONFIG_LINE_LEN];
+    char            section[CONFIG_KEY_LEN] = "";
+
+
+    /* Start with an empty configuration */
+    memset(config, 0, sizeof(CONFIG));
+    config->path = path;
+
+    /* Open the file */
+    file = fopen(path, "r");
+
+    /* Ensure file opened */
+    if (file == NULL)
+    {
+        /* Print error */
+        fprintf(stderr, "%s: can't be read\n\r", path);
+        status = EXIT_FAILURE;
+    }
+
+    /* Loop through each line of the file until an error */
+    while ((status == EXIT_SUCCESS) && (fgets(buffer, sizeof(buffer), file) != NULL))
+    {
+        /* Count line */
+        line++;
+
+        /* Check if line didn't fit (no end of line before the end of the file) */
+        if ((strchr(buffer, '\n') == NULL) && (!feof(file)))
+        {
+            /* Print error */
+            fprintf(stderr, "%s:%d: line longer than %d characters\n\r", path, line, CONFIG_LINE_LEN - 2);
+            status = EXIT_FAILURE;
+        }
+        else
+        {
+            /* Remove comment and surrounding spaces */
+            text = strchr(buffer, '#');
+            text = (text != NULL ? (*text = '\0', buffer) : buffer);
+            text = config_trim(text);
+
+            /* Check if line starts a section */
+            if (text[0] == '[')
+            {
+                /* Get section name (up to the closing bracket) */
+                value = strchr(text, ']');
+                text = config_trim(text + 1);
+
+                /* Ensure section is closed and named */
+                if ((value == NULL) || (value[1] != '\0') || (text == value))
+                {
+                    /* Print error */
+                    fprintf(stderr, "%s:%d: malformed section\n\r", path, line);
+                    status = EXIT_FAILURE;
+                }
+                else
+                {
+                    /* Remove closing bracket */
+                    *value = '\0';
+                    text = config_trim(text);
+
+                    /* Check if section is for a VM (ie "vm web1") */
+                    if ((strncmp(text, CONFIG_VM_SECTION, strlen(CONFIG_VM_SECTION)) == 0) &&
+                        (isspace((unsigned char)text[strlen(CONFIG_VM_SECTION)])))
+                    {
+                        /* Get VM overrides (added if first section for this VM) */
+                        vm = config_add_vm(config, config_trim(text + strlen(CONFIG_VM_SECTION)));
+                        section[0] = '\0';
+                        status = (vm != NULL ? EXIT_SUCCESS : EXIT_FAILURE);
+                    }
+                    /* Check if daemon section name fits */
+                    else if (strlen(text) < sizeof(section))
+                    {
+                        /* Save daemon section */
+                        strcpy(section, text);
+                        vm = NULL;
+                    }
+                    else
+                    {
+                        /* Print error */
+                        fprintf(stderr, "%s:%d: section name too long\n\r", path, line);
+                        status = EXIT_FAILURE;
+                    }
+                }
+            }
+            /* Check if line isn't blank */
+            else if (text[0] != '\0')
+            {
+                /* Split "key = value" */
+                value = strchr(text, '=');
+
+                /* Ensure line has a key and value within a section */
+                if ((value == NULL) || (value == text) || ((vm == NULL) && (section[0] == '\0')))
+                {
+                    /* Print error */
+                    fprintf(stderr, "%s:%d: expected \"key = value\" within a section\n\r", path, line);
+                    status = EXIT_FAILURE;
+                }
+                else
+                {
+                    /* Separate key and value */
+                    *value = '\0';
+                    text = config_trim(text);
+                    value = config_trim(value + 1);
+
+                    /* Save setting in its VM or daemon section */
+                    status = ((vm != NULL) ? config_set_vm(vm, text, value) :
+                              config_add_setting(config, section, text, value, line));
+
+                    /* Check if setting isn't valid */
+                    if (status != EXIT_SUCCESS)
+                    {
+                        /* Print error */
+                        fprintf(stderr, "%s:%d: invalid setting \"%s\"\n\r", path, line, text);
+                    }
+                }
+            }
+        }
+    }
+
+    /* Check if file was opened */
+    if (file != NULL)
+    {
+        /* Close the file */
+        fclose(file);
+    }
+
+    /* Check if the file had an error */
+    if (status != EXIT_SUCCESS)
+    {
+        /* Don't keep a partial configuration */
+        config_free(config);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_free
+*
+*   DESCRIPTION
+*
+*       Frees a configuration (leaving it empty)
+*
+*   INPUTS
+*
+*       config                              Pointer to configuration
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void config_free(CONFIG * config)
+{
+    /* Free the settings and VM overrides */
+    free(config->settings);
+    free(config->vms);
+
+    /* Leave configuration empty */
+    memset(config, 0, sizeof(CONFIG));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_check
+*
+*   DESCRIPTION
+*
+*       Checks that every setting of a daemon section is one the daemon
+*       knows (so a misspelled setting isn't silently ignored)
+*
+*   INPUTS
+*
+*       config                              Pointer to configuration
+*       section                             Daemon section (ie "cpu")
+*       keys                                Settings known in the section
+*                                           (NULL terminated)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        All settings known
+*       EXIT_FAILURE                        Unknown setting (printed to stderr)
+*
+*************************************************************************/
+int config_check(const CONFIG * config, const char * section, const char * const * keys)
+{
+    int     index, key, status = EXIT_SUCCESS;
+
+
+    /* Loop through each setting until an unknown one is found */
+    for (index = 0; (index < config->num_settings) && (status == EXIT_SUCCESS); index++)
+    {
+        /* Check if setting is in the section */
+        if (strcmp(config->settings[index].section, section) == 0)
+        {
+            /* Look for the setting in the known settings */
+            for (key = 0; (keys[key] != NULL) && (strcmp(keys[key], config->settings[index].key) != 0); key++);
+
+            /* Check if setting isn't known */
+            if (keys[key] == NULL)
+            {
+                /* Print error */
+                fprintf(stderr, "%s:%d: unknown setting \"%s\" in [%s]\n\r",
+                        config->path, config->settings[index].line, config->settings[index].key, section);
+                status = EXIT_FAILURE;
+            }
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_get_int
+*
+*   DESCRIPTION
+*
+*       Gets the integer value of a setting of a daemon section (the last
+*       one if set more than once).  The value is left unchanged if the
+*       setting isn't in the file
+*
+*   INPUTS
+*
+*       config                              Pointer to configuration
+*       section                             Daemon section (ie "cpu")
+*       key                                 Setting name
+*       value                               Pointer to return value
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Value returned (or not set)
+*       EXIT_FAILURE                        Value isn't an integer
+*                                           (printed to stderr)
+*
+*************************************************************************/
+int config_get_int(const CONFIG * config, const char * section, const char * key, int * value)
+{
+    int     index, status = EXIT_SUCCESS;
+
+
+    /* Loop through each setting */
+    for (index = 0; index < config->num_settings; index++)
+    {
+        /* Check if this is the setting */
+        if ((strcmp(config->settings[index].section, section) == 0) &&
+            (strcmp(config->settings[index].key, key) == 0))
+        {
+            /* Convert the value */
+            status = config_parse_int(config->settings[index].value, value);
+
+            /* Check if value isn't an integer */
+            if (status != EXIT_SUCCESS)
+            {
+                /* Print error */
+                fprintf(stderr, "%s:%d: \"%s\" isn't an integer\n\r",
+                        config->path, config->settings[index].line, config->settings[index].value);
+            }
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_vm_find
+*
+*   DESCRIPTION
+*
+*       Finds the overrides of a VM
+*
+*   INPUTS
+*
+*       config                              Pointer to configuration
+*       name                                VM (domain) name
+*
+*   OUTPUTS
+*
+*       CONFIG_VM *                         Pointer to VM overrides
+*       NULL                                No overrides for the VM
+*
+*************************************************************************/
+const CONFIG_VM * config_vm_find(const CONFIG * config, const char * name)
+{
+    int     index;
+
+
+    /* Loop through each VM looking for a match */
+    for (index = 0; index < config->num_vms; index++)
+    {
+        /* Check if VM matches */
+        if (strcmp(config->vms[index].name, name) == 0)
+        {
+            /* Return VM */
+            return (&config->vms[index]);
+        }
+    }
+
+    /* Not found */
+    return (NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_watch
+*
+*   DESCRIPTION
+*
+*       Starts counting SIGHUPs as configuration reload requests (safe to
+*       call more than once)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void config_watch(void)
+{
+    struct sigaction    action;
+
+
+    /* Count each SIGHUP (system calls interrupted by it are restarted) */
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = config_hangup;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGHUP, &action, NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_generation
+*
+*   DESCRIPTION
+*
+*       Gets the number of reload requests received so far - a daemon
+*       reloads its configuration when this differs from the number it
+*       last reloaded at (so each daemon sharing a process sees every
+*       request)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       unsigned int                        Number of SIGHUPs received
+*
+*************************************************************************/
+unsigned int config_generation(void)
+{
+    /* Return number of reload requests */
+    return ((unsigned int)reload_generation);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_trim
+*
+*   DESCRIPTION
+*
+*       Removes leading and trailing white space from text
+*
+*   INPUTS
+*
+*       text                                Text to trim (changed)
+*
+*   OUTPUTS
+*
+*       char *                              Start of trimmed text
+*
+*************************************************************************/
+static char * config_trim(char * text)
+{
+    char *  end;
+
+
+    /* Skip leading white space */
+    while (isspace((unsigned char)*text))
+    {
+        text++;
+    }
+
+    /* Remove trailing white space (including the end of line) */
+    end = text + strlen(text);
+    while ((end > text) && (isspace((unsigned char)end[-1])))
+    {
+        *--end = '\0';
+    }
+
+    /* Return trimmed text to caller */
+    return (text);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_parse_int
+*
+*   DESCRIPTION
+*
+*       Converts a setting value to an integer
+*
+*   INPUTS
+*
+*       text                                Value text
+*       value                               Pointer to return value
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Value converted
+*       EXIT_FAILURE                        Value isn't an integer
+*
+*************************************************************************/
+static int  config_parse_int(const char * text, int * value)
+{
+    char *  end;
+    long    number = strtol(text, &end, 10);
+
+
+    /* Ensure the whole value is a number that fits */
+    if ((end == text) || (*end != '\0') || (number < -2147483647L) || (number > 2147483647L))
+    {
+        return (EXIT_FAILURE);
+    }
+
+    /* Return value */
+    *value = (int)number;
+    return (EXIT_SUCCESS);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_add_setting
+*
+*   DESCRIPTION
+*
+*       Adds a setting of a daemon section (the settings list grows as
+*       needed)
+*
+*   INPUTS
+*
+*       config                              Pointer to configuration
+*       section                             Daemon section
+*       key                                 Setting name
+*       value                               Setting value
+*       line                                Line of the file
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Setting added
+*       EXIT_FAILURE                        Name / value too long or no
+*                                           memory available
+*
+*************************************************************************/
+static int  config_add_setting(CONFIG * config, const char * section, const char * key, const char * value, int line)
+{
+    int                 status = EXIT_SUCCESS;
+    CONFIG_SETTING *    settings;
+
+
+    /* Check if the settings list is full */
+    if (config->num_settings == config->max_settings)
+    {
+        /* Grow the list */
+        settings = realloc(config->settings, (config->max_settings + CONFIG_GROW_SIZE) * sizeof(CONFIG_SETTING));
+
+        /* Ensure list grew */
+        if (settings != NULL)
+        {
+            config->settings = settings;
+            config->max_settings += CONFIG_GROW_SIZE;
+        }
+        else
+        {
+            status = EXIT_FAILURE;
+        }
+    }
+
+    /* Ensure room for the setting and the name / value fit */
+    if ((status == EXIT_SUCCESS) && (strlen(key) < CONFIG_KEY_LEN) && (strlen(value) < CONFIG_VALUE_LEN))
+    {
+        /* Save setting */
+        strcpy(config->settings[config->num_settings].section, section);
+        strcpy(config->settings[config->num_settings].key, key);
+        strcpy(config->settings[config->num_settings].value, value);
+        config->settings[config->num_settings].line = line;
+        config->num_settings++;
+    }
+    else
+    {
+        status = EXIT_FAILURE;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_add_vm
+*
+*   DESCRIPTION
+*
+*       Gets the overrides of a VM, adding the VM (with no overrides) if
+*       this is its first section
+*
+*   INPUTS
+*
+*       config                              Pointer to configuration
+*       name                                VM (domain) name
+*
+*   OUTPUTS
+*
+*       CONFIG_VM *                         Pointer to VM overrides
+*       NULL                                Name too long or no memory
+*                                           available (printed to stderr)
+*
+*************************************************************************/
+static CONFIG_VM * config_add_vm(CONFIG * config, const char * name)
+{
+    CONFIG_VM *     vm = (CONFIG_VM *)config_vm_find(config, name);
+    CONFIG_VM *     vms;
+
+
+    /* Check if VM isn't in the configuration yet */
+    if (vm == NULL)
+    {
+        /* Check if the VM list is full */
+        if (config->num_vms == config->max_vms)
+        {
+            /* Grow the list */
+            vms = realloc(config->vms, (config->max_vms + CONFIG_GROW_SIZE) * sizeof(CONFIG_VM));
+
+            /* Ensure list grew */
+            if (vms != NULL)
+            {
+                config->vms = vms;
+                config->max_vms += CONFIG_GROW_SIZE;
+            }
+        }
+
+        /* Ensure room for the VM and its name fits */
+        if ((config->num_vms < config->max_vms) && (name[0] != '\0') && (strlen(name) < CONFIG_NAME_LEN))
+        {
+            /* Add VM with no overrides */
+            vm = &config->vms[config->num_vms++];
+            memset(vm, 0, sizeof(CONFIG_VM));
+            strcpy(vm->name, name);
+        }
+        else
+        {
+            /* Print error */
+            fprintf(stderr, "VM section \"%s\" can't be added\n\r", name);
+        }
+    }
+
+    /* Return VM to caller */
+    return (vm);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_set_vm
+*
+*   DESCRIPTION
+*
+*       Sets an override of a VM.  Memory sizes are given in MB and kept
+*       in KB (the unit used by libvirt)
+*
+*   INPUTS
+*
+*       vm                                  Pointer to VM overrides
+*       key                                 Setting name
+*       value                               Setting value
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Override set
+*       EXIT_FAILURE                        Unknown setting or bad value
+*
+*************************************************************************/
+static int  config_set_vm(CONFIG_VM * vm, const char * key, const char * value)
+{
+    int     number, status;
+
+
+    /* Convert the value (all VM overrides are integers) */
+    status = config_parse_int(value, &number);
+
+    /* Check if setting is the priority */
+    if ((status == EXIT_SUCCESS) && (strcmp(key, "priority") == 0))
+    {
+        vm->priority = number;
+    }
+    /* Check if setting is the smallest balloon size (MB) */
+    else if ((status == EXIT_SUCCESS) && (strcmp(key, "min_memory") == 0) && (number >= 0))
+    {
+        vm->min_mem = (unsigned long long)number * 1024;
+    }
+    /* Check if setting is the largest balloon size (MB) */
+    else if ((status == EXIT_SUCCESS) && (strcmp(key, "max_memory") == 0) && (number >= 0))
+    {
+        vm->max_mem = (unsigned long long)number * 1024;
+    }
+    /* Check if setting is the exclusive PCPU flag */
+    else if ((status == EXIT_SUCCESS) && (strcmp(key, "exclusive") == 0) && ((number == 0) || (number == 1)))
+    {
+        vm->exclusive = number;
+    }
+    else
+    {
+        /* Unknown setting or bad value */
+        status = EXIT_FAILURE;
+    }
+
+    /* Ensure smallest size isn't above largest size */
+    status = (((status == EXIT_SUCCESS) && (vm->max_mem) && (vm->min_mem > vm->max_mem)) ? EXIT_FAILURE : status);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       config_hangup
+*
+*   DESCRIPTION
+*
+*       SIGHUP handler - counts a reload request (the file is read by each
+*       daemon at the start of its next cycle, outside of the handler)
+*
+*   INPUTS
+*
+*       signal_num                          Signal received
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void config_hangup(int signal_num)
+{
+    /* Count reload request */
+    reload_generation++;
+}
@@ -0,0 +1,77 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains configuration file macros, definitions, and
+*       structures used by both the VCPU scheduler and the memory
+*       coordinator.  A configuration file holds the runtime thresholds
+*       of each daemon (one section per daemon) and overrides for single
+*       VMs (one section per VM).  The file is read at startup and read
+*       again each time SIGHUP is received - the daemons apply the new
+*       settings at the start of their next cycle without losing the
+*       stats already collected
+*
+***********************************************************************/
+#ifndef CONFIG_DEFS_H
+#define CONFIG_DEFS_H
+
+/* Maximum length of a line in a configuration file (longer lines are an error) */
+#define CONFIG_LINE_LEN                     256
+
+/* Maximum length of a section name, key or value */
+#define CONFIG_KEY_LEN                      32
+#define CONFIG_VALUE_LEN                    64
+
+/* Maximum length of a VM name in a VM section */
+#define CONFIG_NAME_LEN                     64
+
+/* Section name prefix of a VM section (ie "[vm web1]") */
+#define CONFIG_VM_SECTION                   "vm"
+
+/* Number of entries the setting / VM lists grow by when full */
+#define CONFIG_GROW_SIZE                    16
+
+/* Structure for a single "key = value" setting of a daemon section */
+typedef struct CONFIG_SETTING_STRUCT
+{
+    char                section[CONFIG_KEY_LEN];    /* Section the setting is in (ie "cpu") */
+    char                key[CONFIG_KEY_LEN];        /* Setting name */
+    char                value[CONFIG_VALUE_LEN];    /* Setting value (not parsed) */
+    int                 line;                       /* Line of the file the setting is on */
+
+} CONFIG_SETTING;
+
+/* Structure for the overrides of a single VM (from a VM section) */
+typedef struct CONFIG_VM_STRUCT
+{
+    char                name[CONFIG_NAME_LEN];  /* VM (domain) name */
+    int                 priority;               /* Priority of VM (0 = normal, > 0 = more important, < 0 = batch) */
+    unsigned long long  min_mem;                /* Smallest balloon size in KB (0 = no override) */
+    unsigned long long  max_mem;                /* Largest balloon size in KB (0 = no override) */
+    int                 exclusive;              /* Non-zero to keep other VCPUs off the PCPUs of this VM */
+
+} CONFIG_VM;
+
+/* Structure for a loaded configuration file */
+typedef struct CONFIG_STRUCT
+{
+    const char *        path;           /* Path of the file (used in error messages) */
+    CONFIG_SETTING *    settings;       /* Settings of the daemon sections */
+    int                 num_settings;   /* Number of settings */
+    int                 max_settings;   /* Number of settings allocated */
+    CONFIG_VM *         vms;            /* Overrides of each VM */
+    int                 num_vms;        /* Number of VMs */
+    int                 max_vms;        /* Number of VMs allocated */
+
+} CONFIG;
+
+/* Configuration functions (see config.c) */
+int                 config_load(CONFIG * config, const char * path);
+void                config_free(CONFIG * config);
+int                 config_check(const CONFIG * config, const char * section, const char * const * keys);
+int                 config_get_int(const CONFIG * config, const char * section, const char * key, int * value);
+const CONFIG_VM *   config_vm_find(const CONFIG * config, const char * name);
+void                config_watch(void);
+unsigned int        config_generation(void);
+
+#endif /* CONFIG_DEFS_H */
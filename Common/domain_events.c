@@ -0,0 +1,537 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains domain lifecycle event code shared by the
+*       VCPU scheduler and the memory coordinator.  A libvirt event
+*       loop is run on its own thread and domain start / stop events
+*       are queued so each daemon can add / remove domains from its
+*       tracking structures between cycles (without a restart).
+*
+*   FUNCTIONS
+*
+*       domain_events_loop_init
+*       domain_events_loop_deinit
+*       domain_events_register
+*       domain_events_deregister
+*       domain_events_get
+*       domain_event_free
+*       domain_same
+*       domain_gone
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "domain_events_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static void * domain_events_loop(void * arg);
+static void domain_events_timeout(int timer, void * opaque);
+static int  domain_events_lifecycle(virConnectPtr conn, virDomainPtr domain,
+                                    int event, int detail, void * opaque);
+
+/*****************************/
+/* LOCAL VARIABLES           */
+/*****************************/
+static pthread_mutex_t      loop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t            loop_thread;
+static volatile int         loop_run;
+static int                  loop_users;
+static int                  loop_registered;
+static int                  loop_timer = -1;
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_loop_init
+*
+*   DESCRIPTION
+*
+*       Registers the default libvirt event loop and starts the thread
+*       that runs it.  Must be called before the connection to the
+*       hypervisor is opened.  The event loop is shared, so only the
+*       first caller starts it
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Event loop running
+*       EXIT_FAILURE                        Error starting event loop
+*
+*************************************************************************/
+int domain_events_loop_init(void)
+{
+    int     status = EXIT_SUCCESS;
+
+
+    /* Protect event loop state */
+    pthread_mutex_lock(&loop_lock);
+
+    /* Check if event loop isn't running yet */
+    if (loop_users == 0)
+    {
+        /* Register the default event loop implementation (only allowed once) */
+        if (!loop_registered)
+        {
+            status = (virEventRegisterDefaultImpl() == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+            loop_registered = (status == EXIT_SUCCESS);
+        }
+
+        /* Ensure event loop registered */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Add a periodic timeout so the loop regularly checks if it should stop */
+            loop_timer = virEventAddTimeout(DOMAIN_EVENTS_LOOP_TIMEOUT, domain_events_timeout, NULL, NULL);
+
+            /* Ensure timeout added */
+            if (loop_timer < 0)
+            {
+                /* Set error status */
+                status = EXIT_FAILURE;
+            }
+        }
+
+        /* Ensure timeout added */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Start the event loop thread */
+            loop_run = 1;
+
+            /* Ensure thread started */
+            if (pthread_create(&loop_thread, NULL, domain_events_loop, NULL) != 0)
+            {
+                /* Remove timeout and set error status */
+                virEventRemoveTimeout(loop_timer);
+                loop_timer = -1;
+                loop_run = 0;
+                status = EXIT_FAILURE;
+            }
+        }
+    }
+
+    /* Count this user of the event loop */
+    loop_users += (status == EXIT_SUCCESS);
+
+    /* Done with event loop state */
+    pthread_mutex_unlock(&loop_lock);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_loop_deinit
+*
+*   DESCRIPTION
+*
+*       Stops the event loop thread once the last user is done with it
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void domain_events_loop_deinit(void)
+{
+    /* Protect event loop state */
+    pthread_mutex_lock(&loop_lock);
+
+    /* Check if this is the last user of a running event loop */
+    if ((loop_users > 0) && (--loop_users == 0))
+    {
+        /* Tell the loop to stop - it wakes up on the next periodic timeout */
+        loop_run = 0;
+
+        /* Wait for the loop thread to finish */
+        pthread_join(loop_thread, NULL);
+
+        /* Remove periodic timeout */
+        virEventRemoveTimeout(loop_timer);
+        loop_timer = -1;
+    }
+
+    /* Done with event loop state */
+    pthread_mutex_unlock(&loop_lock);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_register
+*
+*   DESCRIPTION
+*
+*       Registers for domain lifecycle events on the specified connection.
+*       Events received are queued until domain_events_get is called.
+*       Should be called before the list of active domains is read so no
+*       domain that starts in between is missed
+*
+*   INPUTS
+*
+*       events                              Pointer to domain events
+*       conn                                Connection to hypervisor
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Domain events registered
+*       EXIT_FAILURE                        Error registering domain events
+*
+*************************************************************************/
+int domain_events_register(DOMAIN_EVENTS * events, virConnectPtr conn)
+{
+    /* Initialize an empty list of events */
+    events->conn = conn;
+    events->head = NULL;
+    events->tail = NULL;
+    pthread_mutex_init(&events->lock, NULL);
+
+    /* Register callback for domain lifecycle events on all domains */
+    events->callback_id = virConnectDomainEventRegisterAny(conn, NULL, VIR_DOMAIN_EVENT_ID_LIFECYCLE,
+                                                           VIR_DOMAIN_EVENT_CALLBACK(domain_events_lifecycle),
+                                                           events, NULL);
+
+    /* Return status to caller */
+    return (events->callback_id >= 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_deregister
+*
+*   DESCRIPTION
+*
+*       Deregisters domain lifecycle events and frees any events that
+*       were never processed
+*
+*   INPUTS
+*
+*       events                              Pointer to domain events
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void domain_events_deregister(DOMAIN_EVENTS * events)
+{
+    DOMAIN_EVENT *  event;
+    DOMAIN_EVENT *  next;
+
+
+    /* Check if callback is registered */
+    if (events->callback_id >= 0)
+    {
+        /* Stop receiving events */
+        virConnectDomainEventDeregisterAny(events->conn, events->callback_id);
+        events->callback_id = -1;
+
+        /* Loop through and free each pending event */
+        for (event = domain_events_get(events); event != NULL; event = next)
+        {
+            next = event->next;
+            domain_event_free(event);
+        }
+
+        /* Done with the event list */
+        pthread_mutex_destroy(&events->lock);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_get
+*
+*   DESCRIPTION
+*
+*       Removes all pending domain events so they can be processed.
+*       The caller frees each event with domain_event_free (after
+*       taking the domain reference by setting the domain to NULL
+*       if it keeps the domain)
+*
+*   INPUTS
+*
+*       events                              Pointer to domain events
+*
+*   OUTPUTS
+*
+*       DOMAIN_EVENT *                      List of events (oldest first)
+*       NULL                                No events pending
+*
+*************************************************************************/
+DOMAIN_EVENT * domain_events_get(DOMAIN_EVENTS * events)
+{
+    DOMAIN_EVENT *  list;
+
+
+    /* Take the whole list while holding the lock */
+    pthread_mutex_lock(&events->lock);
+    list = events->head;
+    events->head = NULL;
+    events->tail = NULL;
+    pthread_mutex_unlock(&events->lock);
+
+    /* Return list to caller */
+    return (list);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_event_free
+*
+*   DESCRIPTION
+*
+*       Frees a domain event and the domain reference it holds
+*
+*   INPUTS
+*
+*       event                               Pointer to event to free
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void domain_event_free(DOMAIN_EVENT * event)
+{
+    /* Check if event still holds a domain reference */
+    if (event->domain != NULL)
+    {
+        /* Release domain */
+        virDomainFree(event->domain);
+    }
+
+    /* Free event */
+    free(event);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_same
+*
+*   DESCRIPTION
+*
+*       Determines if 2 domain objects refer to the same domain.  UUIDs
+*       are compared since the hypervisor ID changes each time a domain
+*       is started
+*
+*   INPUTS
+*
+*       domain_a                            1st domain
+*       domain_b                            2nd domain
+*
+*   OUTPUTS
+*
+*       1                                   Same domain
+*       0                                   Different domains
+*
+*************************************************************************/
+int domain_same(virDomainPtr domain_a, virDomainPtr domain_b)
+{
+    unsigned char   uuid_a[VIR_UUID_BUFLEN];
+    unsigned char   uuid_b[VIR_UUID_BUFLEN];
+
+
+    /* Compare UUIDs of both domains */
+    return ((virDomainGetUUID(domain_a, uuid_a) == 0) &&
+            (virDomainGetUUID(domain_b, uuid_b) == 0) &&
+            (memcmp(uuid_a, uuid_b, VIR_UUID_BUFLEN) == 0));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_gone
+*
+*   DESCRIPTION
+*
+*       Determines if a domain is no longer running.  Used after a libvirt
+*       call for a domain fails to tell a domain that is stopping (and will
+*       be removed when its stop event is processed) from a real error
+*
+*   INPUTS
+*
+*       domain                              Domain to check
+*
+*   OUTPUTS
+*
+*       1                                   Domain is no longer running
+*       0                                   Domain is still running
+*
+*************************************************************************/
+int domain_gone(virDomainPtr domain)
+{
+    /* Any answer other than active (including an error) means the domain is gone */
+    return (virDomainIsActive(domain) != 1);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_loop
+*
+*   DESCRIPTION
+*
+*       Event loop thread - runs the libvirt event loop (which calls the
+*       registered callbacks) until told to stop
+*
+*   INPUTS
+*
+*       arg                                 Not used
+*
+*   OUTPUTS
+*
+*       NULL                                Always
+*
+*************************************************************************/
+static void * domain_events_loop(void * arg)
+{
+    /* Loop until told to stop */
+    while (loop_run)
+    {
+        /* Wait for and dispatch the next event(s) */
+        virEventRunDefaultImpl();
+    }
+
+    /* Thread is done */
+    return (NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_timeout
+*
+*   DESCRIPTION
+*
+*       Periodic timeout callback - does nothing except wake up the
+*       event loop so it can check if it should stop
+*
+*   INPUTS
+*
+*       timer                               Timer ID (not used)
+*       opaque                              Not used
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void domain_events_timeout(int timer, void * opaque)
+{
+    /* Nothing to do */
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_lifecycle
+*
+*   DESCRIPTION
+*
+*       Domain lifecycle callback (runs on the event loop thread) - queues
+*       an added event when a domain starts and a removed event when a
+*       domain stops.  Other lifecycle events (suspend, resume, etc) don't
+*       change the set of active domains and are ignored
+*
+*   INPUTS
+*
+*       conn                                Connection to hypervisor
+*       domain                              Domain the event is for
+*       event                               Lifecycle event type
+*       detail                              Lifecycle event detail (not used)
+*       opaque                              Pointer to domain events
+*
+*   OUTPUTS
+*
+*       0                                   Always
+*
+*************************************************************************/
+static int  domain_events_lifecycle(virConnectPtr conn, virDomainPtr domain,
+                                    int event, int detail, void * opaque)
+{
+    DOMAIN_EVENTS *     events = opaque;
+    DOMAIN_EVENT *      new_event;
+
+
+    /* Only domains starting / stopping are of interest */
+    if ((event == VIR_DOMAIN_EVENT_STARTED) || (event == VIR_DOMAIN_EVENT_STOPPED))
+    {
+        /* Allocate event */
+        new_event = malloc(sizeof(DOMAIN_EVENT));
+
+        /* Ensure memory allocated (event is dropped otherwise) */
+        if (new_event != NULL)
+        {
+            /* Keep a reference to the domain since libvirt frees it after the callback */
+            virDomainRef(domain);
+
+            /* Fill in event */
+            new_event->domain = domain;
+            new_event->type = (event == VIR_DOMAIN_EVENT_STARTED ? DOMAIN_EVENT_ADDED : DOMAIN_EVENT_REMOVED);
+            new_event->next = NULL;
+
+            /* Add event to end of list */
+            pthread_mutex_lock(&events->lock);
+
+            if (events->tail == NULL)
+            {
+                events->head = new_event;
+            }
+            else
+            {
+                events->tail->next = new_event;
+            }
+
+            events->tail = new_event;
+
+            pthread_mutex_unlock(&events->lock);
+        }
+    }
+
+    /* Return to libvirt */
+    return (0);
+}
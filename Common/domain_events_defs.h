@@ -0,0 +1,53 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains domain lifecycle event macros, definitions,
+*       and structures used by both the VCPU scheduler and the memory
+*       coordinator to track domains that start / stop while running
+*
+***********************************************************************/
+#ifndef DOMAIN_EVENTS_DEFS_H
+#define DOMAIN_EVENTS_DEFS_H
+
+#include <pthread.h>
+#include <libvirt/libvirt.h>
+
+/* Define types of domain events passed to the daemons */
+#define DOMAIN_EVENT_ADDED                  0       /* Domain started (boot, restore or incoming migration) */
+#define DOMAIN_EVENT_REMOVED                1       /* Domain stopped (shutdown, destroy, crash or outgoing migration) */
+
+/* Maximum time (in milliseconds) the event loop waits before checking if it should stop */
+#define DOMAIN_EVENTS_LOOP_TIMEOUT          1000
+
+/* Structure for a single domain event waiting to be processed */
+typedef struct DOMAIN_EVENT_STRUCT
+{
+    virDomainPtr                    domain; /* Domain (reference is owned by the event) */
+    int                             type;   /* DOMAIN_EVENT_ADDED / DOMAIN_EVENT_REMOVED */
+    struct DOMAIN_EVENT_STRUCT *    next;   /* Next event (oldest event first) */
+
+} DOMAIN_EVENT;
+
+/* Structure to keep track of the domain events registered on a connection */
+typedef struct DOMAIN_EVENTS_STRUCT
+{
+    virConnectPtr       conn;           /* Connection the events are registered on */
+    int                 callback_id;    /* Lifecycle callback ID (-1 if not registered) */
+    pthread_mutex_t     lock;           /* Protects the pending event list */
+    DOMAIN_EVENT *      head;           /* Oldest pending event */
+    DOMAIN_EVENT *      tail;           /* Newest pending event */
+
+} DOMAIN_EVENTS;
+
+/* Domain event functions (see domain_events.c) */
+int             domain_events_loop_init(void);
+void            domain_events_loop_deinit(void);
+int             domain_events_register(DOMAIN_EVENTS * events, virConnectPtr conn);
+void            domain_events_deregister(DOMAIN_EVENTS * events);
+DOMAIN_EVENT *  domain_events_get(DOMAIN_EVENTS * events);
+void            domain_event_free(DOMAIN_EVENT * event);
+int             domain_same(virDomainPtr domain_a, virDomainPtr domain_b);
+int             domain_gone(virDomainPtr domain);
+
+#endif /* DOMAIN_EVENTS_DEFS_H */
@@ -0,0 +1,413 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the cycle interval timing used by both the
+*       VCPU scheduler and the memory coordinator.  Cycles run on
+*       millisecond resolution deadlines of the monotonic clock (so time
+*       spent in libvirt calls doesn't stretch the interval) and, when
+*       adaptive mode is enabled, the interval is shortened while the
+*       daemon is busy and lengthened once the system is steady
+*
+*       Built with REPLAY defined (../Replay) the clock is the simulated
+*       clock of the replay engine - it only moves when the policies
+*       sleep, so cycles run back to back without waiting
+*
+***********************************************************************/
+#ifndef INTERVAL_DEFS_H
+#define INTERVAL_DEFS_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+/* Time conversion macros */
+#define INTERVAL_NSECS_PER_SEC              1000000000ULL
+#define INTERVAL_NSECS_PER_MSEC             1000000ULL
+#define INTERVAL_MSECS_PER_SEC              1000.0
+
+/* Percent an adaptive interval is lengthened by after each steady cycle
+   (the interval is halved after each busy cycle) */
+#define INTERVAL_GROW_PERCENT               25
+
+/* Structure to keep track of the cycle interval */
+typedef struct INTERVAL_STRUCT
+{
+    unsigned int        interval_ms;    /* Current interval in milliseconds */
+    unsigned int        min_ms;         /* Shortest adaptive interval (0 = adaptive mode off) */
+    unsigned int        max_ms;         /* Longest adaptive interval */
+    unsigned long long  deadline;       /* Monotonic time (ns) the current cycle ends */
+
+} INTERVAL;
+
+#ifdef REPLAY
+/* Simulated clock of the replay engine (see ../Replay/replay_virt.c) */
+unsigned long long  replay_clock(void);
+void                replay_sleep_until(unsigned long long when);
+#endif  /* REPLAY */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       interval_clock
+*
+*   DESCRIPTION
+*
+*       Gets the current time of the monotonic clock of the host - used
+*       to time work done (ie the phases of a cycle), so it is never the
+*       simulated clock
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Current time in nanoseconds
+*
+*************************************************************************/
+static inline unsigned long long interval_clock(void)
+{
+    struct timespec     now;
+
+
+    /* Read monotonic clock (not affected by changes to the time of day) */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    /* Return time in nanoseconds */
+    return (((unsigned long long)now.tv_sec * INTERVAL_NSECS_PER_SEC) + now.tv_nsec);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       interval_now
+*
+*   DESCRIPTION
+*
+*       Gets the current time of the monotonic clock (the simulated clock
+*       when replaying)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Current time in nanoseconds
+*
+*************************************************************************/
+static inline unsigned long long interval_now(void)
+{
+#ifdef REPLAY
+    /* Return simulated time */
+    return (replay_clock());
+#else
+    /* Return time of the monotonic clock */
+    return (interval_clock());
+#endif  /* REPLAY */
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       interval_parse
+*
+*   DESCRIPTION
+*
+*       Converts a time in seconds (ie "1", "0.25") into milliseconds
+*
+*   INPUTS
+*
+*       text                                Time in seconds
+*       interval_ms                         Pointer to return milliseconds
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Time converted
+*       EXIT_FAILURE                        Time is malformed or less
+*                                           than 1 millisecond
+*
+*************************************************************************/
+static inline int interval_parse(const char * text, unsigned int * interval_ms)
+{
+    char *      end;
+    double      seconds;
+
+
+    /* Convert text to seconds */
+    seconds = strtod(text, &end);
+
+    /* Ensure whole text is a number of at least 1 millisecond (and not unreasonably long) */
+    if ((end == text) || (*end != '\0') || (seconds < (1 / INTERVAL_MSECS_PER_SEC)) || (seconds > 86400))
+    {
+        /* Malformed time */
+        return (EXIT_FAILURE);
+    }
+
+    /* Return time rounded to the nearest millisecond */
+    *interval_ms = (unsigned int)((seconds * INTERVAL_MSECS_PER_SEC) + 0.5);
+
+    /* Return success */
+    return (EXIT_SUCCESS);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       interval_parse_range
+*
+*   DESCRIPTION
+*
+*       Converts an adaptive interval range in seconds (ie "0.25,5") into
+*       minimum / maximum milliseconds
+*
+*   INPUTS
+*
+*       text                                Range as "<min>,<max>" seconds
+*       min_ms                              Pointer to return minimum
+*       max_ms                              Pointer to return maximum
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Range converted
+*       EXIT_FAILURE                        Range is malformed
+*
+*************************************************************************/
+static inline int interval_parse_range(const char * text, unsigned int * min_ms, unsigned int * max_ms)
+{
+    char        min_text[32];
+    const char *comma = strchr(text, ',');
+
+
+    /* Ensure range has a comma and the minimum fits */
+    if ((comma == NULL) || ((comma - text) >= (int)sizeof(min_text)))
+    {
+        /* Malformed range */
+        return (EXIT_FAILURE);
+    }
+
+    /* Copy minimum so it can be converted on its own */
+    memcpy(min_text, text, comma - text);
+    min_text[comma - text] = '\0';
+
+    /* Convert minimum / maximum and ensure minimum isn't above maximum */
+    return (((interval_parse(min_text, min_ms) == EXIT_SUCCESS) &&
+             (interval_parse(comma + 1, max_ms) == EXIT_SUCCESS) &&
+             (*min_ms <= *max_ms)) ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       interval_init
+*
+*   DESCRIPTION
+*
+*       Initializes the cycle interval - the first cycle ends 1 interval
+*       from now
+*
+*   INPUTS
+*
+*       interval                            Pointer to interval
+*       interval_ms                         Starting interval in milliseconds
+*       min_ms                              Shortest adaptive interval
+*                                           (0 = adaptive mode off)
+*       max_ms                              Longest adaptive interval
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static inline void interval_init(INTERVAL * interval, unsigned int interval_ms,
+                                 unsigned int min_ms, unsigned int max_ms)
+{
+    /* Save adaptive range */
+    interval->min_ms = min_ms;
+    interval->max_ms = max_ms;
+
+    /* Keep starting interval within the adaptive range (if adaptive) */
+    if (min_ms)
+    {
+        interval_ms = (interval_ms < min_ms ? min_ms : interval_ms);
+        interval_ms = (interval_ms > max_ms ? max_ms : interval_ms);
+    }
+
+    /* Save starting interval and start timing from now */
+    interval->interval_ms = interval_ms;
+    interval->deadline = interval_now();
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       interval_sleep_until
+*
+*   DESCRIPTION
+*
+*       Sleeps until a time of the monotonic clock (returns right away if
+*       the time has passed)
+*
+*   INPUTS
+*
+*       when                                Monotonic time (ns) to wake
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static inline void interval_sleep_until(unsigned long long when)
+{
+#ifdef REPLAY
+    /* Run the simulated host until the time */
+    replay_sleep_until(when);
+#else
+    struct timespec     deadline;
+
+
+    /* Convert time for clock_nanosleep */
+    deadline.tv_sec = when / INTERVAL_NSECS_PER_SEC;
+    deadline.tv_nsec = when % INTERVAL_NSECS_PER_SEC;
+
+    /* Sleep until the time (restarting if interrupted by a signal) */
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR);
+#endif  /* REPLAY */
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       interval_next
+*
+*   DESCRIPTION
+*
+*       Gets the time the next call to interval_wait will wake at (if the
+*       interval isn't changed first)
+*
+*   INPUTS
+*
+*       interval                            Pointer to interval
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Monotonic time (ns) the current
+*                                           cycle ends
+*
+*************************************************************************/
+static inline unsigned long long interval_next(const INTERVAL * interval)
+{
+    /* Return end of the current cycle */
+    return (interval->deadline + (interval->interval_ms * INTERVAL_NSECS_PER_MSEC));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       interval_wait
+*
+*   DESCRIPTION
+*
+*       Waits until the end of the current cycle.  Deadlines are absolute
+*       so the time spent running a cycle doesn't add to the interval.  If
+*       a cycle overran its deadline the next cycle starts right away
+*       (missed cycles aren't made up)
+*
+*   INPUTS
+*
+*       interval                            Pointer to interval
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static inline void interval_wait(INTERVAL * interval)
+{
+    unsigned long long  now = interval_now();
+
+
+    /* Move deadline to end of this cycle */
+    interval->deadline += (interval->interval_ms * INTERVAL_NSECS_PER_MSEC);
+
+    /* Check if the last cycle overran this deadline */
+    if (interval->deadline < now)
+    {
+        /* Restart timing from now */
+        interval->deadline = now;
+    }
+
+    /* Sleep until the deadline */
+    interval_sleep_until(interval->deadline);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       interval_adapt
+*
+*   DESCRIPTION
+*
+*       Adjusts an adaptive interval after a cycle - the interval is
+*       halved after a busy cycle (to react quickly) and lengthened by
+*       INTERVAL_GROW_PERCENT after a steady cycle (to keep overhead low),
+*       staying within the adaptive range.  Does nothing if adaptive
+*       mode is off
+*
+*   INPUTS
+*
+*       interval                            Pointer to interval
+*       busy                                Non-zero if the cycle found
+*                                           work to do
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static inline void interval_adapt(INTERVAL * interval, int busy)
+{
+    unsigned int    grow;
+
+
+    /* Check if adaptive mode is on */
+    if (interval->min_ms)
+    {
+        /* Check if cycle was busy */
+        if (busy)
+        {
+            /* Halve the interval (but not below minimum) */
+            interval->interval_ms /= 2;
+            interval->interval_ms = (interval->interval_ms < interval->min_ms ? interval->min_ms : interval->interval_ms);
+        }
+        else
+        {
+            /* Lengthen the interval by at least 1 millisecond (but not above maximum) */
+            grow = (interval->interval_ms * INTERVAL_GROW_PERCENT) / 100;
+            interval->interval_ms += (grow ? grow : 1);
+            interval->interval_ms = (interval->interval_ms > interval->max_ms ? interval->max_ms : interval->interval_ms);
+        }
+    }
+}
+
+#endif /* INTERVAL_DEFS_H */
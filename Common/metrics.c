@@ -0,0 +1,595 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the metrics exporter shared by the VCPU
+*       scheduler and the memory coordinator.  The control loop renders
+*       OpenMetrics text into a build buffer at the end of each cycle
+*       and publishes it by swapping it with the published buffer (see
+*       text_snapshot.c).  A server thread answers HTTP scrapes with a
+*       copy of the published buffer.  The control loop only ever tries the lock when
+*       publishing, so a slow scraper can delay a snapshot by a cycle
+*       but never blocks the control loop.
+*
+*   FUNCTIONS
+*
+*       metrics_init
+*       metrics_deinit
+*       metrics_family
+*       metrics_printf
+*       metrics_publish
+*       metrics_escape
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static void * metrics_server(void * arg);
+static void metrics_serve(METRICS * metrics, int fd);
+static int  metrics_send(METRICS * metrics, int fd, const char * data, size_t len, long long deadline);
+static int  metrics_poll(METRICS * metrics, struct pollfd * conn_poll, long long deadline);
+static long long metrics_now_ms(void);
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_init
+*
+*   DESCRIPTION
+*
+*       Opens the listening socket and starts the metrics server thread.
+*       Until the first snapshot is published, scrapes get an empty set
+*       of metrics
+*
+*   INPUTS
+*
+*       metrics                             Pointer to metrics
+*       port                                TCP port to listen on
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Metrics server running
+*       EXIT_FAILURE                        Error opening socket or
+*                                           starting thread
+*
+*************************************************************************/
+int metrics_init(METRICS * metrics, int port)
+{
+    int                 status = EXIT_SUCCESS, reuse = 1;
+    struct sockaddr_in  addr;
+
+
+    /* Initialize empty snapshots */
+    memset(metrics, 0, sizeof(METRICS));
+    text_snapshot_init(&metrics->snapshot);
+
+    /* Open listening socket */
+    metrics->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    /* Set listening address */
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((unsigned short)port);
+    inet_pton(AF_INET, METRICS_BIND_ADDR, &addr.sin_addr);
+
+    /* Ensure socket opened, bound (allowing a quick restart) and listening */
+    if ((metrics->listen_fd < 0) ||
+        (setsockopt(metrics->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0) ||
+        (bind(metrics->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+        (listen(metrics->listen_fd, 8) != 0))
+    {
+        /* Set error status */
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        /* Start server thread */
+        metrics->run = 1;
+
+        /* Ensure thread started */
+        if (pthread_create(&metrics->thread, NULL, metrics_server, metrics) != 0)
+        {
+            /* Set error status */
+            metrics->run = 0;
+            status = EXIT_FAILURE;
+        }
+    }
+
+    /* Check if server couldn't be started */
+    if ((status != EXIT_SUCCESS) && (metrics->listen_fd >= 0))
+    {
+        /* Close socket */
+        close(metrics->listen_fd);
+        metrics->listen_fd = -1;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_deinit
+*
+*   DESCRIPTION
+*
+*       Stops the metrics server thread and frees the snapshots
+*
+*   INPUTS
+*
+*       metrics                             Pointer to metrics
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void metrics_deinit(METRICS * metrics)
+{
+    /* Check if server is running */
+    if (metrics->listen_fd >= 0)
+    {
+        /* Tell the server to stop - it wakes up on the next poll timeout */
+        metrics->run = 0;
+
+        /* Wait for the server thread to finish */
+        pthread_join(metrics->thread, NULL);
+
+        /* Close socket */
+        close(metrics->listen_fd);
+        metrics->listen_fd = -1;
+    }
+
+    /* Free snapshots */
+    text_snapshot_deinit(&metrics->snapshot);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_family
+*
+*   DESCRIPTION
+*
+*       Starts a metric family in the snapshot being rendered (its type and
+*       help text).  The samples of the family must follow before the next
+*       family is started
+*
+*   INPUTS
+*
+*       metrics                             Pointer to metrics
+*       name                                Family name (counter samples
+*                                           add _total to it)
+*       type                                "gauge" / "counter"
+*       help                                Description of the family
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void metrics_family(METRICS * metrics, const char * name, const char * type, const char * help)
+{
+    /* Add type and help lines */
+    metrics_printf(metrics, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_printf
+*
+*   DESCRIPTION
+*
+*       Appends formatted text to the snapshot being rendered.  If memory
+*       runs out the snapshot is dropped when published
+*
+*   INPUTS
+*
+*       metrics                             Pointer to metrics
+*       format                              printf style format
+*       ...                                 Format arguments
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void metrics_printf(METRICS * metrics, const char * format, ...)
+{
+    va_list     args;
+
+
+    /* Append text to the snapshot */
+    va_start(args, format);
+    text_snapshot_vprintf(&metrics->snapshot, format, args);
+    va_end(args);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_publish
+*
+*   DESCRIPTION
+*
+*       Publishes the snapshot rendered since the last publish so scrapes
+*       are answered with it.  Only tries the lock - if a scrape is copying
+*       the published snapshot right now, this snapshot is skipped (the
+*       next cycle publishes a newer one) so the control loop never waits
+*
+*   INPUTS
+*
+*       metrics                             Pointer to metrics
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void metrics_publish(METRICS * metrics)
+{
+    /* Publish snapshot (skipped and counted if a scrape is copying) */
+    text_snapshot_publish(&metrics->snapshot);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_escape
+*
+*   DESCRIPTION
+*
+*       Escapes a label value (backslash, double quote and new line) so it
+*       can be placed inside double quotes.  Values too long are truncated
+*
+*   INPUTS
+*
+*       label                               Buffer of METRICS_LABEL_LEN
+*                                           bytes for the escaped value
+*       value                               Value to escape
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void metrics_escape(char * label, const char * value)
+{
+    int     len = 0;
+
+
+    /* Loop through each character that fits (room for an escape and the terminator) */
+    for (; (*value != '\0') && (len < (METRICS_LABEL_LEN - 3)); value++)
+    {
+        /* Check if character must be escaped */
+        if ((*value == '\\') || (*value == '"') || (*value == '\n'))
+        {
+            /* Add escape */
+            label[len++] = '\\';
+        }
+
+        /* Add character (new line is written as \n) */
+        label[len++] = (*value == '\n' ? 'n' : *value);
+    }
+
+    /* Terminate label */
+    label[len] = '\0';
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_server
+*
+*   DESCRIPTION
+*
+*       Metrics server thread - accepts scrape connections until told
+*       to stop.  Scrapes are answered one at a time
+*
+*   INPUTS
+*
+*       arg                                 Pointer to metrics
+*
+*   OUTPUTS
+*
+*       NULL                                Always
+*
+*************************************************************************/
+static void * metrics_server(void * arg)
+{
+    METRICS *       metrics = arg;
+    struct pollfd   listen_poll;
+    int             fd;
+
+
+    /* Wait for connections on the listening socket */
+    listen_poll.fd = metrics->listen_fd;
+    listen_poll.events = POLLIN;
+
+    /* Loop until told to stop */
+    while (metrics->run)
+    {
+        /* Wait for a connection (or the timeout to check if the server should stop) */
+        if (poll(&listen_poll, 1, METRICS_POLL_TIMEOUT) > 0)
+        {
+            /* Accept connection */
+            fd = accept(metrics->listen_fd, NULL, NULL);
+
+            /* Ensure connection accepted */
+            if (fd >= 0)
+            {
+                /* Don't block on the connection (a stalled scraper is dropped at the scrape timeout) */
+                fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+                /* Answer scrape and close connection */
+                metrics_serve(metrics, fd);
+                close(fd);
+            }
+        }
+    }
+
+    /* Thread is done */
+    return (NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_serve
+*
+*   DESCRIPTION
+*
+*       Answers a single HTTP request - GET /metrics returns the published
+*       snapshot, anything else returns 404.  The request and response
+*       must complete within METRICS_SCRAPE_TIMEOUT (the connection is
+*       dropped otherwise)
+*
+*   INPUTS
+*
+*       metrics                             Pointer to metrics
+*       fd                                  Connection to scraper
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void metrics_serve(METRICS * metrics, int fd)
+{
+    char            request[METRICS_REQUEST_SIZE];
+    char            header[256];
+    struct pollfd   conn_poll;
+    ssize_t         received;
+    size_t          len = 0;
+    int             header_len, found = 0;
+    long long       deadline;
+
+
+    /* Get time the scrape must be done by */
+    deadline = metrics_now_ms() + METRICS_SCRAPE_TIMEOUT;
+
+    /* Wait for data on the connection */
+    conn_poll.fd = fd;
+    conn_poll.events = POLLIN;
+
+    /* Read request until the end of the headers, the buffer is full or the scraper stalls */
+    while ((len < (sizeof(request) - 1)) && (metrics_poll(metrics, &conn_poll, deadline) > 0) &&
+           ((received = recv(fd, request + len, sizeof(request) - 1 - len, 0)) > 0))
+    {
+        len += received;
+        request[len] = '\0';
+
+        /* Check if end of headers received */
+        if (strstr(request, "\r\n\r\n") != NULL)
+        {
+            break;
+        }
+    }
+
+    /* Terminate request */
+    request[len] = '\0';
+
+    /* Check if metrics were requested */
+    if ((strncmp(request, "GET /metrics ", 13) == 0) || (strncmp(request, "GET /metrics?", 13) == 0))
+    {
+        /* Copy the published snapshot (the lock is only held while copying) */
+        found = (text_snapshot_copy(&metrics->snapshot) == EXIT_SUCCESS);
+    }
+
+    /* Check if snapshot is ready to send */
+    if (found)
+    {
+        /* Build header for the snapshot */
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 200 OK\r\n"
+                              "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                              "Content-Length: %zu\r\n"
+                              "Connection: close\r\n\r\n", metrics->snapshot.send.len);
+
+        /* Send header and snapshot */
+        if (metrics_send(metrics, fd, header, header_len, deadline) == EXIT_SUCCESS)
+        {
+            metrics_send(metrics, fd, metrics->snapshot.send.text, metrics->snapshot.send.len, deadline);
+        }
+    }
+    else
+    {
+        /* Build not found response */
+        header_len = snprintf(header, sizeof(header),
+                              "HTTP/1.0 404 Not Found\r\n"
+                              "Content-Length: 0\r\n"
+                              "Connection: close\r\n\r\n");
+
+        /* Send response */
+        metrics_send(metrics, fd, header, header_len, deadline);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_send
+*
+*   DESCRIPTION
+*
+*       Sends all data on a (non-blocking) connection, waiting for the
+*       scraper to take more until the scrape deadline
+*
+*   INPUTS
+*
+*       metrics                             Pointer to metrics
+*       fd                                  Connection to scraper
+*       data                                Data to send
+*       len                                 Number of bytes to send
+*       deadline                            Time (monotonic ms) the scrape
+*                                           must be done by
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        All data sent
+*       EXIT_FAILURE                        Connection closed / error /
+*                                           scraper stalled
+*
+*************************************************************************/
+static int  metrics_send(METRICS * metrics, int fd, const char * data, size_t len, long long deadline)
+{
+    struct pollfd   conn_poll;
+    ssize_t         sent = 0;
+
+
+    /* Wait for room on the connection */
+    conn_poll.fd = fd;
+    conn_poll.events = POLLOUT;
+
+    /* Loop until all data sent, an error or the scraper stalls (a scraper that went away doesn't raise SIGPIPE) */
+    while ((len > 0) && ((sent = send(fd, data, len, MSG_NOSIGNAL)) != 0) &&
+           ((sent > 0) || (((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) &&
+                           (metrics_poll(metrics, &conn_poll, deadline) > 0))))
+    {
+        /* Move past the data sent (none if the connection was full) */
+        data += (sent > 0 ? sent : 0);
+        len -= (sent > 0 ? (size_t)sent : 0);
+    }
+
+    /* Return status to caller */
+    return (len == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_poll
+*
+*   DESCRIPTION
+*
+*       Waits for a connection to be ready, up to METRICS_POLL_TIMEOUT at
+*       a time so the server still notices it was told to stop, until the
+*       scrape deadline
+*
+*   INPUTS
+*
+*       metrics                             Pointer to metrics
+*       conn_poll                           Connection and events to wait for
+*       deadline                            Time (monotonic ms) the scrape
+*                                           must be done by
+*
+*   OUTPUTS
+*
+*       > 0                                 Connection ready
+*       Others                              Deadline passed / server
+*                                           stopping / error
+*
+*************************************************************************/
+static int  metrics_poll(METRICS * metrics, struct pollfd * conn_poll, long long deadline)
+{
+    int         ready = 0;
+    long long   remaining = deadline - metrics_now_ms();
+
+
+    /* Loop while the connection isn't ready, the deadline hasn't passed and the server keeps running */
+    while ((ready == 0) && (remaining > 0) && (metrics->run))
+    {
+        /* Wait for the connection (no longer than the deadline) */
+        ready = poll(conn_poll, 1, (int)(remaining < METRICS_POLL_TIMEOUT ? remaining : METRICS_POLL_TIMEOUT));
+
+        /* Get time left before the deadline */
+        remaining = deadline - metrics_now_ms();
+    }
+
+    /* Return result to caller */
+    return (ready);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       metrics_now_ms
+*
+*   DESCRIPTION
+*
+*       Gets the time of the monotonic clock (the deadline of a scrape
+*       isn't affected by a change to the time of day)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       long long                           Monotonic time (ms)
+*
+*************************************************************************/
+static long long metrics_now_ms(void)
+{
+    struct timespec now;
+
+
+    /* Read monotonic clock */
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    /* Return time in milliseconds to caller */
+    return (((long long)now.tv_sec * 1000) + (now.tv_nsec / 1000000));
+}
@@ -0,0 +1,57 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains metrics exporter macros, definitions, and
+*       structures used by both the VCPU scheduler and the memory
+*       coordinator to serve their state over HTTP in the OpenMetrics
+*       (Prometheus) text format.  Each daemon renders a snapshot at
+*       the end of every cycle and a server thread answers scrapes from
+*       the last snapshot, so a scrape never makes libvirt calls or
+*       blocks the control loop
+*
+***********************************************************************/
+#ifndef METRICS_DEFS_H
+#define METRICS_DEFS_H
+
+#include <stddef.h>
+#include <signal.h>
+#include <pthread.h>
+#include "text_snapshot_defs.h"
+
+/* Address the metrics server listens on (loopback only - use a proxy to export further) */
+#define METRICS_BIND_ADDR                   "127.0.0.1"
+
+/* Maximum time (in milliseconds) the server waits for a connection before checking if it
+   should stop, and for a scraper to send its request */
+#define METRICS_POLL_TIMEOUT                1000
+
+/* Maximum time (in milliseconds) a scrape may take from its connection to the end of the
+   response (a scraper that stalls is dropped so it can't hold up the server thread) */
+#define METRICS_SCRAPE_TIMEOUT              5000
+
+/* Maximum size of a scrape request read (the rest is ignored) */
+#define METRICS_REQUEST_SIZE                1024
+
+/* Maximum length of an escaped label value (ie a VM name) */
+#define METRICS_LABEL_LEN                   256
+
+/* Structure to keep track of the metrics server */
+typedef struct METRICS_STRUCT
+{
+    int                 listen_fd;      /* Listening socket (-1 = server not running) */
+    pthread_t           thread;         /* Server thread */
+    volatile sig_atomic_t run;          /* Non-zero while the server should keep running */
+    TEXT_SNAPSHOT       snapshot;       /* Snapshot rendered by the control loop and served to scrapers */
+
+} METRICS;
+
+/* Metrics functions (see metrics.c) */
+int     metrics_init(METRICS * metrics, int port);
+void    metrics_deinit(METRICS * metrics);
+void    metrics_family(METRICS * metrics, const char * name, const char * type, const char * help);
+void    metrics_printf(METRICS * metrics, const char * format, ...) __attribute__((format(printf, 2, 3)));
+void    metrics_publish(METRICS * metrics);
+void    metrics_escape(char * label, const char * value);
+
+#endif /* METRICS_DEFS_H */
@@ -0,0 +1,588 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the monitor stream shared by the VCPU
+*       scheduler and the memory coordinator.  The control loop renders
+*       a sample of each cycle into a build buffer and publishes it by
+*       swapping it with the published buffer (see text_snapshot.c) and
+*       waking the server thread, which writes a copy to every connected client.  The
+*       control loop only ever tries the lock when publishing and a
+*       client that can't take a whole sample without blocking is
+*       closed, so a slow observer never slows the control loop or the
+*       other clients.
+*
+*   FUNCTIONS
+*
+*       monitor_init
+*       monitor_deinit
+*       monitor_printf
+*       monitor_publish
+*       monitor_escape
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "monitor_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static void * monitor_server(void * arg);
+static void monitor_accept(MONITOR * monitor);
+static void monitor_stream(MONITOR * monitor);
+static void monitor_close(MONITOR * monitor, int client);
+static void monitor_wake(MONITOR * monitor);
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_init
+*
+*   DESCRIPTION
+*
+*       Opens the listening Unix socket (replacing a socket file left by
+*       an earlier run) and starts the monitor server thread.  Clients get
+*       the samples published after they connect
+*
+*   INPUTS
+*
+*       monitor                             Pointer to monitor
+*       path                                Socket file to listen on
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Monitor server running
+*       EXIT_FAILURE                        Error opening socket or
+*                                           starting thread
+*
+*************************************************************************/
+int monitor_init(MONITOR * monitor, const char * path)
+{
+    int                 status = EXIT_SUCCESS, bound = 0;
+    struct sockaddr_un  addr;
+    struct stat         info;
+
+
+    /* Initialize empty samples */
+    memset(monitor, 0, sizeof(MONITOR));
+    text_snapshot_init(&monitor->sample);
+    monitor->wake_fd[0] = -1;
+    monitor->wake_fd[1] = -1;
+
+    /* Set listening address */
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+
+    /* Ensure path fits in the address */
+    if (strlen(path) < sizeof(addr.sun_path))
+    {
+        /* Save path (removed when the server stops) */
+        strcpy(addr.sun_path, path);
+        strcpy(monitor->path, path);
+
+        /* Remove a socket left by an earlier run (anything else at the path is kept and bind fails) */
+        if ((stat(path, &info) == 0) && (S_ISSOCK(info.st_mode)))
+        {
+            unlink(path);
+        }
+
+        /* Open listening socket */
+        monitor->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    }
+    else
+    {
+        /* Set error status */
+        monitor->listen_fd = -1;
+    }
+
+    /* Ensure socket opened, bound (the socket file is only removed on an error once it was created),
+       only usable by this user and listening */
+    if ((monitor->listen_fd < 0) ||
+        ((bound = (bind(monitor->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == 0)) == 0) ||
+        (chmod(path, MONITOR_SOCKET_MODE) != 0) ||
+        (listen(monitor->listen_fd, MONITOR_MAX_CLIENTS) != 0) ||
+        (pipe(monitor->wake_fd) != 0))
+    {
+        /* Set error status */
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        /* Never block the control loop on the wake pipe (a full pipe already wakes the server) */
+        fcntl(monitor->wake_fd[1], F_SETFL, fcntl(monitor->wake_fd[1], F_GETFL) | O_NONBLOCK);
+        fcntl(monitor->wake_fd[0], F_SETFL, fcntl(monitor->wake_fd[0], F_GETFL) | O_NONBLOCK);
+
+        /* Start server thread */
+        monitor->run = 1;
+
+        /* Ensure thread started */
+        if (pthread_create(&monitor->thread, NULL, monitor_server, monitor) != 0)
+        {
+            /* Set error status */
+            monitor->run = 0;
+            status = EXIT_FAILURE;
+        }
+    }
+
+    /* Check if server couldn't be started */
+    if (status != EXIT_SUCCESS)
+    {
+        /* Check if socket was opened */
+        if (monitor->listen_fd >= 0)
+        {
+            /* Close socket */
+            close(monitor->listen_fd);
+            monitor->listen_fd = -1;
+        }
+
+        /* Check if the socket file was created by the bind (anything else at the path is kept) */
+        if (bound)
+        {
+            /* Remove socket file */
+            unlink(monitor->path);
+        }
+
+        /* Check if wake pipe was opened */
+        if (monitor->wake_fd[0] >= 0)
+        {
+            /* Close pipe */
+            close(monitor->wake_fd[0]);
+            close(monitor->wake_fd[1]);
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_deinit
+*
+*   DESCRIPTION
+*
+*       Stops the monitor server thread, closes the clients, removes the
+*       socket file and frees the samples
+*
+*   INPUTS
+*
+*       monitor                             Pointer to monitor
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void monitor_deinit(MONITOR * monitor)
+{
+    /* Check if server is running */
+    if (monitor->listen_fd >= 0)
+    {
+        /* Tell the server to stop - it wakes up now or on the next poll timeout */
+        monitor->run = 0;
+        monitor_wake(monitor);
+
+        /* Wait for the server thread to finish (it closes the clients) */
+        pthread_join(monitor->thread, NULL);
+
+        /* Close socket, remove its file and close the wake pipe */
+        close(monitor->listen_fd);
+        unlink(monitor->path);
+        close(monitor->wake_fd[0]);
+        close(monitor->wake_fd[1]);
+        monitor->listen_fd = -1;
+    }
+
+    /* Free samples */
+    text_snapshot_deinit(&monitor->sample);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_printf
+*
+*   DESCRIPTION
+*
+*       Appends formatted text to the sample being rendered.  If memory
+*       runs out the sample is dropped when published
+*
+*   INPUTS
+*
+*       monitor                             Pointer to monitor
+*       format                              printf style format
+*       ...                                 Format arguments
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void monitor_printf(MONITOR * monitor, const char * format, ...)
+{
+    va_list     args;
+
+
+    /* Append text to the sample */
+    va_start(args, format);
+    text_snapshot_vprintf(&monitor->sample, format, args);
+    va_end(args);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_publish
+*
+*   DESCRIPTION
+*
+*       Publishes the sample rendered since the last publish and wakes
+*       the server thread to stream it.  Only tries the lock - if the
+*       server is still copying the last sample, this sample is skipped
+*       so the control loop never waits
+*
+*   INPUTS
+*
+*       monitor                             Pointer to monitor
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void monitor_publish(MONITOR * monitor)
+{
+    /* Publish sample (skipped and counted if the server is still copying the last one) */
+    if (text_snapshot_publish(&monitor->sample) == EXIT_SUCCESS)
+    {
+        /* Wake the server to stream it */
+        monitor_wake(monitor);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_escape
+*
+*   DESCRIPTION
+*
+*       Escapes a string value (backslash, double quote and control
+*       characters) so it can be placed inside a JSON string.  Values too
+*       long are truncated
+*
+*   INPUTS
+*
+*       string                              Buffer of MONITOR_STRING_LEN
+*                                           bytes for the escaped value
+*       value                               Value to escape
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void monitor_escape(char * string, const char * value)
+{
+    int     len = 0;
+
+
+    /* Loop through each character that fits (room for a \u escape and the terminator) */
+    for (; (*value != '\0') && (len < (MONITOR_STRING_LEN - 7)); value++)
+    {
+        /* Check if character must be escaped */
+        if ((*value == '\\') || (*value == '"'))
+        {
+            /* Add escape and character */
+            string[len++] = '\\';
+            string[len++] = *value;
+        }
+        else if ((unsigned char)*value < ' ')
+        {
+            /* Add control character as its code */
+            len += sprintf(string + len, "\\u%04x", (unsigned char)*value);
+        }
+        else
+        {
+            /* Add character */
+            string[len++] = *value;
+        }
+    }
+
+    /* Terminate string */
+    string[len] = '\0';
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_server
+*
+*   DESCRIPTION
+*
+*       Monitor server thread - accepts clients and streams each sample
+*       published to them until told to stop
+*
+*   INPUTS
+*
+*       arg                                 Pointer to monitor
+*
+*   OUTPUTS
+*
+*       NULL                                Always
+*
+*************************************************************************/
+static void * monitor_server(void * arg)
+{
+    MONITOR *       monitor = arg;
+    struct pollfd   fds[MONITOR_MAX_CLIENTS + 2];
+    char            wake[64];
+    int             client, num_fds;
+
+
+    /* Loop until told to stop */
+    while (monitor->run)
+    {
+        /* Wait for a publish, a connection or a client going away */
+        fds[0].fd = monitor->wake_fd[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = monitor->listen_fd;
+        fds[1].events = POLLIN;
+        num_fds = 2;
+
+        /* Loop through each client (data sent by a client is ignored) */
+        for (client = 0; client < monitor->num_clients; client++)
+        {
+            fds[num_fds].fd = monitor->clients[client];
+            fds[num_fds].events = POLLIN;
+            num_fds++;
+        }
+
+        /* Wait for an event (or the timeout to check if the server should stop) */
+        if (poll(fds, num_fds, MONITOR_POLL_TIMEOUT) > 0)
+        {
+            /* Loop through each client from the last (closing one moves the last into its place) */
+            for (client = monitor->num_clients - 1; client >= 0; client--)
+            {
+                /* Check if client hung up or sent data (read and ignored - end of file closes it) */
+                if ((fds[client + 2].revents & (POLLIN | POLLHUP | POLLERR)) &&
+                    (recv(monitor->clients[client], wake, sizeof(wake), MSG_DONTWAIT) <= 0))
+                {
+                    monitor_close(monitor, client);
+                }
+            }
+
+            /* Check if a sample was published */
+            if (fds[0].revents & POLLIN)
+            {
+                /* Empty the wake pipe and stream the last sample */
+                while (read(monitor->wake_fd[0], wake, sizeof(wake)) > 0)
+                {
+                    /* Several publishes since the last wake only stream the last sample */
+                }
+
+                monitor_stream(monitor);
+            }
+
+            /* Check if a client is connecting */
+            if (fds[1].revents & POLLIN)
+            {
+                monitor_accept(monitor);
+            }
+        }
+    }
+
+    /* Close every client */
+    while (monitor->num_clients)
+    {
+        monitor_close(monitor, monitor->num_clients - 1);
+    }
+
+    /* Thread is done */
+    return (NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_accept
+*
+*   DESCRIPTION
+*
+*       Accepts a client connecting - a client beyond MONITOR_MAX_CLIENTS
+*       is closed straight away
+*
+*   INPUTS
+*
+*       monitor                             Pointer to monitor
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void monitor_accept(MONITOR * monitor)
+{
+    int     fd;
+
+
+    /* Accept connection */
+    fd = accept(monitor->listen_fd, NULL, NULL);
+
+    /* Ensure connection accepted */
+    if (fd >= 0)
+    {
+        /* Check if there is room for the client */
+        if (monitor->num_clients < MONITOR_MAX_CLIENTS)
+        {
+            /* Add client */
+            monitor->clients[monitor->num_clients++] = fd;
+        }
+        else
+        {
+            /* Too many clients */
+            close(fd);
+        }
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_stream
+*
+*   DESCRIPTION
+*
+*       Sends a copy of the published sample to every client.  A client
+*       that can't take the whole sample without blocking is closed (a
+*       partial sample would break its stream)
+*
+*   INPUTS
+*
+*       monitor                             Pointer to monitor
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void monitor_stream(MONITOR * monitor)
+{
+    int         client, found = 0;
+    ssize_t     sent;
+
+
+    /* Copy the published sample (the lock is only held while copying) */
+    found = ((text_snapshot_copy(&monitor->sample) == EXIT_SUCCESS) && (monitor->sample.send.len > 0));
+
+    /* Loop through each client from the last (closing one moves the last into its place) */
+    for (client = monitor->num_clients - 1; (found) && (client >= 0); client--)
+    {
+        /* Send sample without blocking (a client that went away doesn't raise SIGPIPE) */
+        sent = send(monitor->clients[client], monitor->sample.send.text, monitor->sample.send.len,
+                    MSG_DONTWAIT | MSG_NOSIGNAL);
+
+        /* Check if client didn't take the whole sample */
+        if ((sent < 0) || ((size_t)sent != monitor->sample.send.len))
+        {
+            /* Close client that fell behind or went away */
+            monitor_close(monitor, client);
+            monitor->num_dropped++;
+        }
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_close
+*
+*   DESCRIPTION
+*
+*       Closes a client and moves the last client into its place
+*
+*   INPUTS
+*
+*       monitor                             Pointer to monitor
+*       client                              Index of client to close
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void monitor_close(MONITOR * monitor, int client)
+{
+    /* Close connection */
+    close(monitor->clients[client]);
+
+    /* Move last client into its place */
+    monitor->num_clients--;
+    monitor->clients[client] = monitor->clients[monitor->num_clients];
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       monitor_wake
+*
+*   DESCRIPTION
+*
+*       Wakes the server thread by writing to the wake pipe without
+*       blocking.  If the pipe is full the server hasn't emptied it yet
+*       and is woken anyway
+*
+*   INPUTS
+*
+*       monitor                             Pointer to monitor
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void monitor_wake(MONITOR * monitor)
+{
+    /* Write a byte (fails only if the pipe is full - the server is already being woken) */
+    if (write(monitor->wake_fd[1], "", 1) < 0)
+    {
+        /* Count wake already pending (nothing else to do) */
+        monitor->num_wakes_pending++;
+    }
+}
@@ -0,0 +1,61 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains monitor stream macros, definitions, and
+*       structures used by both the VCPU scheduler and the memory
+*       coordinator to stream the stats of every cycle over a Unix
+*       socket.  Each daemon renders a sample (one JSON object per line)
+*       from the stats the cycle already collected and a server thread
+*       writes it to every connected client, so observing the host
+*       costs no libvirt calls and never blocks the control loop
+*
+***********************************************************************/
+#ifndef MONITOR_DEFS_H
+#define MONITOR_DEFS_H
+
+#include <stddef.h>
+#include <signal.h>
+#include <pthread.h>
+#include "text_snapshot_defs.h"
+
+/* Maximum number of clients streamed to at once (more connections are closed) */
+#define MONITOR_MAX_CLIENTS                 8
+
+/* Permissions of the socket file (only the daemon's user may connect) */
+#define MONITOR_SOCKET_MODE                 0600
+
+/* Maximum time (in milliseconds) the server waits for a sample or a connection before
+   checking if it should stop */
+#define MONITOR_POLL_TIMEOUT                1000
+
+/* Maximum length of the socket file path (size of sun_path in struct sockaddr_un) */
+#define MONITOR_PATH_LEN                    108
+
+/* Maximum length of an escaped string value (ie a VM name) */
+#define MONITOR_STRING_LEN                  256
+
+/* Structure to keep track of the monitor server */
+typedef struct MONITOR_STRUCT
+{
+    int                 listen_fd;      /* Listening socket (-1 = server not running) */
+    int                 wake_fd[2];     /* Pipe the control loop wakes the server thread with on a publish */
+    pthread_t           thread;         /* Server thread */
+    volatile sig_atomic_t run;          /* Non-zero while the server should keep running */
+    TEXT_SNAPSHOT       sample;         /* Sample rendered by the control loop and streamed to the clients */
+    int                 clients[MONITOR_MAX_CLIENTS]; /* Connected clients (server thread) */
+    int                 num_clients;
+    unsigned long long  num_wakes_pending; /* Publishes the server was already being woken for */
+    unsigned long long  num_dropped;    /* Clients closed because they didn't keep up (server thread) */
+    char                path[MONITOR_PATH_LEN]; /* Socket file (removed when the server stops) */
+
+} MONITOR;
+
+/* Monitor functions (see monitor.c) */
+int     monitor_init(MONITOR * monitor, const char * path);
+void    monitor_deinit(MONITOR * monitor);
+void    monitor_printf(MONITOR * monitor, const char * format, ...) __attribute__((format(printf, 2, 3)));
+void    monitor_publish(MONITOR * monitor);
+void    monitor_escape(char * string, const char * value);
+
+#endif /* MONITOR_DEFS_H */
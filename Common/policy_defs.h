@@ -0,0 +1,53 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the policy entry points of the VCPU scheduler
+*       and the memory coordinator used by the resource manager to run
+*       both policies in a single daemon on one hypervisor connection,
+*       one domain list and one stats snapshot per cycle.  The standalone
+*       daemons are built from the same code (see ../Manager/Readme)
+*
+***********************************************************************/
+#ifndef POLICY_DEFS_H
+#define POLICY_DEFS_H
+
+#include <libvirt/libvirt.h>
+
+/* Structure for the state shared with the policies each cycle */
+typedef struct POLICY_SNAPSHOT_STRUCT
+{
+    virDomainStatsRecordPtr *   records;        /* VCPU + balloon stats of all active domains (NULL = not supported -
+                                                   each policy then collects its own stats one domain at a time) */
+    int                         num_records;    /* Number of records */
+    unsigned long long          now;            /* Monotonic time (ns) the records were read */
+    unsigned int                interval_ms;    /* Current cycle interval in milliseconds */
+    int                         (* cpu_saturated)(virDomainPtr domain);
+                                                /* Non-zero if a domain is CPU saturated on a busy PCPU
+                                                   (NULL = CPU state not known) */
+    unsigned long long          (* cpu_nodes)(virDomainPtr domain);
+                                                /* Mask of the NUMA nodes a domain's VCPUs are pinned to
+                                                   (NULL / 0 = not known) */
+
+} POLICY_SNAPSHOT;
+
+/* VCPU scheduler policy (see ../CPU/vcpu_scheduler.c) */
+int     vcpu_policy_options(int argc, char ** argv);
+int     vcpu_policy_init(virConnectPtr conn);
+int     vcpu_policy_domain_event(int type, virDomainPtr domain);
+int     vcpu_policy_cycle(const POLICY_SNAPSHOT * snapshot, int * busy);
+int     vcpu_policy_cpu_saturated(virDomainPtr domain);
+unsigned long long vcpu_policy_cpu_nodes(virDomainPtr domain);
+int     vcpu_policy_phases(const char * const ** names, const unsigned long long ** phase_ns);
+void    vcpu_policy_deinit(void);
+
+/* Memory coordinator policy (see ../Memory/memory_coordinator.c) */
+int     mem_policy_options(int argc, char ** argv);
+int     mem_policy_init(virConnectPtr conn);
+int     mem_policy_domain_event(int type, virDomainPtr domain);
+int     mem_policy_cycle(const POLICY_SNAPSHOT * snapshot, int * busy);
+int     mem_policy_idle(unsigned long long end);
+int     mem_policy_phases(const char * const ** names, const unsigned long long ** phase_ns);
+void    mem_policy_deinit(void);
+
+#endif /* POLICY_DEFS_H */
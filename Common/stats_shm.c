@@ -0,0 +1,743 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the shared memory snapshot shared by the VCPU
+*       scheduler and the memory coordinator, and the functions other
+*       tools read it with.  At the end of each cycle the control loop
+*       rewrites the records of the segment in place between two updates
+*       of the sequence - odd while writing, even once done.  A reader
+*       copies the records out and keeps the copy only if the sequence
+*       was even and unchanged across it, so neither side ever takes a
+*       lock or makes a system call (the segment is only grown, and
+*       mapped again by the readers, when the records no longer fit).
+*
+*   FUNCTIONS
+*
+*       stats_shm_init
+*       stats_shm_deinit
+*       stats_shm_begin
+*       stats_shm_pcpu
+*       stats_shm_vcpu
+*       stats_shm_vm
+*       stats_shm_end
+*       stats_shm_open
+*       stats_shm_read
+*       stats_shm_close
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "interval_defs.h"
+#include "stats_shm_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static size_t stats_shm_align(size_t len);
+static int  stats_shm_grow(STATS_SHM * shm, size_t size);
+static int  stats_shm_remap(STATS_SHM_READER * reader);
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_init
+*
+*   DESCRIPTION
+*
+*       Creates the shared memory segment (replacing a segment left by an
+*       earlier run) and writes its header.  The magic number is written
+*       last, so a reader opening the segment early is told it isn't a
+*       snapshot yet
+*
+*   INPUTS
+*
+*       shm                                 Pointer to snapshot
+*       name                                Segment name (ie /vcpu_scheduler)
+*       source                              STATS_SHM_SOURCE_CPU / MEM
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Segment created
+*       EXIT_FAILURE                        Error creating or mapping
+*                                           the segment
+*
+*************************************************************************/
+int stats_shm_init(STATS_SHM * shm, const char * name, int source)
+{
+    int                 status = EXIT_SUCCESS;
+    STATS_SHM_HEADER *  header;
+
+
+    /* Initialize empty snapshot */
+    memset(shm, 0, sizeof(STATS_SHM));
+    shm->fd = -1;
+
+    /* Ensure name fits */
+    if (strlen(name) < sizeof(shm->name))
+    {
+        /* Save name (removed when the daemon stops) */
+        strcpy(shm->name, name);
+
+        /* Remove a segment left by an earlier run (its readers keep their mapping of it) */
+        shm_unlink(name);
+
+        /* Create segment */
+        shm->fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, STATS_SHM_MODE);
+    }
+
+    /* Ensure segment created (umask can't take the read permissions of the other tools away) and mapped */
+    if ((shm->fd < 0) ||
+        (fchmod(shm->fd, STATS_SHM_MODE) != 0) ||
+        (stats_shm_grow(shm, STATS_SHM_INIT_SIZE) != EXIT_SUCCESS))
+    {
+        /* Set error status */
+        status = EXIT_FAILURE;
+
+        /* Check if segment was created */
+        if (shm->fd >= 0)
+        {
+            /* Close and remove segment */
+            close(shm->fd);
+            shm_unlink(shm->name);
+            shm->fd = -1;
+        }
+    }
+    else
+    {
+        /* Fill in header (the segment starts zeroed, so there are no records) */
+        header = shm->header;
+        header->version = STATS_SHM_VERSION;
+        header->source = source;
+        header->header_size = sizeof(STATS_SHM_HEADER);
+        header->size = shm->size;
+        header->pcpu_offset = sizeof(STATS_SHM_HEADER);
+        header->vcpu_offset = sizeof(STATS_SHM_HEADER);
+        header->vm_offset = sizeof(STATS_SHM_HEADER);
+        header->pcpu_size = sizeof(STATS_SHM_PCPU);
+        header->vcpu_size = sizeof(STATS_SHM_VCPU);
+        header->vm_size = sizeof(STATS_SHM_VM);
+
+        /* Mark segment ready */
+        __atomic_store_n(&header->magic, STATS_SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_deinit
+*
+*   DESCRIPTION
+*
+*       Marks the segment closed (readers holding it are told the daemon
+*       stopped), unmaps it and removes it
+*
+*   INPUTS
+*
+*       shm                                 Pointer to snapshot
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void stats_shm_deinit(STATS_SHM * shm)
+{
+    /* Check if segment was created */
+    if (shm->fd >= 0)
+    {
+        /* Tell the readers the daemon stopped */
+        __atomic_store_n(&shm->header->closed, 1, __ATOMIC_RELEASE);
+
+        /* Unmap, close and remove segment */
+        munmap(shm->header, shm->size);
+        close(shm->fd);
+        shm_unlink(shm->name);
+        shm->header = NULL;
+        shm->fd = -1;
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_begin
+*
+*   DESCRIPTION
+*
+*       Starts rewriting the snapshot - the sequence is made odd, so the
+*       readers keep the previous snapshot until stats_shm_end.  When the
+*       records don't fit the current layout the segment is grown first
+*       (room for twice the records, so it rarely grows again).  The
+*       caller fills the header fields of the cycle and each record before
+*       calling stats_shm_end
+*
+*   INPUTS
+*
+*       shm                                 Pointer to snapshot
+*       num_pcpus                           PCPU records of the snapshot
+*       num_vcpus                           VCPU records of the snapshot
+*       num_vms                             VM records of the snapshot
+*
+*   OUTPUTS
+*
+*       STATS_SHM_HEADER *                  Header of the segment
+*       NULL                                No segment, or the segment
+*                                           couldn't be grown (nothing
+*                                           is published)
+*
+*************************************************************************/
+STATS_SHM_HEADER * stats_shm_begin(STATS_SHM * shm, unsigned int num_pcpus, unsigned int num_vcpus, unsigned int num_vms)
+{
+    STATS_SHM_HEADER *  header = NULL;
+    int                 relayout = 0;
+    uint32_t            max_pcpus = shm->max_pcpus;
+    uint32_t            max_vcpus = shm->max_vcpus;
+    uint32_t            max_vms = shm->max_vms;
+    size_t              pcpu_offset;
+    size_t              vcpu_offset;
+    size_t              vm_offset;
+    size_t              size;
+    uint32_t            sequence;
+
+
+    /* Check if the records don't fit the current layout */
+    if ((num_pcpus > max_pcpus) || (num_vcpus > max_vcpus) || (num_vms > max_vms))
+    {
+        /* Make room for twice the records of each kind that grew */
+        max_pcpus = (num_pcpus > max_pcpus) ? (num_pcpus * 2) : max_pcpus;
+        max_vcpus = (num_vcpus > max_vcpus) ? (num_vcpus * 2) : max_vcpus;
+        max_vms = (num_vms > max_vms) ? (num_vms * 2) : max_vms;
+        relayout = 1;
+    }
+
+    /* Find where each kind of record starts */
+    pcpu_offset = stats_shm_align(sizeof(STATS_SHM_HEADER));
+    vcpu_offset = stats_shm_align(pcpu_offset + ((size_t)max_pcpus * sizeof(STATS_SHM_PCPU)));
+    vm_offset = stats_shm_align(vcpu_offset + ((size_t)max_vcpus * sizeof(STATS_SHM_VCPU)));
+    size = vm_offset + ((size_t)max_vms * sizeof(STATS_SHM_VM));
+
+    /* Ensure segment created and big enough (growing it never moves a reader's mapping) */
+    if ((shm->fd >= 0) && (shm->grow_error == 0) &&
+        ((size <= shm->size) || (stats_shm_grow(shm, size) == EXIT_SUCCESS)))
+    {
+        /* Start rewriting - the fence keeps the records from being written before the sequence is odd */
+        header = shm->header;
+        sequence = header->sequence;
+        __atomic_store_n(&header->sequence, sequence + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+
+        /* Check if the layout changed */
+        if (relayout != 0)
+        {
+            /* Save new layout */
+            shm->max_pcpus = max_pcpus;
+            shm->max_vcpus = max_vcpus;
+            shm->max_vms = max_vms;
+            header->pcpu_offset = pcpu_offset;
+            header->vcpu_offset = vcpu_offset;
+            header->vm_offset = vm_offset;
+        }
+
+        /* Set size and records of the snapshot */
+        header->size = shm->size;
+        header->num_pcpus = num_pcpus;
+        header->num_vcpus = num_vcpus;
+        header->num_vms = num_vms;
+    }
+    else
+    {
+        /* Stop publishing (the readers see the last snapshot stop changing) */
+        shm->grow_error = (shm->fd >= 0) ? 1 : 0;
+    }
+
+    /* Return header to caller */
+    return (header);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_pcpu / stats_shm_vcpu / stats_shm_vm
+*
+*   DESCRIPTION
+*
+*       Return a cleared record of the snapshot being rewritten (between
+*       stats_shm_begin and stats_shm_end) for the caller to fill in
+*
+*   INPUTS
+*
+*       shm                                 Pointer to snapshot
+*       index                               Record (less than the number
+*                                           given to stats_shm_begin)
+*
+*   OUTPUTS
+*
+*       STATS_SHM_PCPU * / STATS_SHM_VCPU * / STATS_SHM_VM *
+*
+*************************************************************************/
+STATS_SHM_PCPU * stats_shm_pcpu(STATS_SHM * shm, unsigned int index)
+{
+    STATS_SHM_PCPU *    record;
+
+
+    /* Find and clear record */
+    record = (STATS_SHM_PCPU *)((char *)shm->header + shm->header->pcpu_offset) + index;
+    memset(record, 0, sizeof(STATS_SHM_PCPU));
+
+    /* Return record to caller */
+    return (record);
+}
+
+STATS_SHM_VCPU * stats_shm_vcpu(STATS_SHM * shm, unsigned int index)
+{
+    STATS_SHM_VCPU *    record;
+
+
+    /* Find and clear record */
+    record = (STATS_SHM_VCPU *)((char *)shm->header + shm->header->vcpu_offset) + index;
+    memset(record, 0, sizeof(STATS_SHM_VCPU));
+
+    /* Return record to caller */
+    return (record);
+}
+
+STATS_SHM_VM * stats_shm_vm(STATS_SHM * shm, unsigned int index)
+{
+    STATS_SHM_VM *      record;
+
+
+    /* Find and clear record */
+    record = (STATS_SHM_VM *)((char *)shm->header + shm->header->vm_offset) + index;
+    memset(record, 0, sizeof(STATS_SHM_VM));
+
+    /* Return record to caller */
+    return (record);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_end
+*
+*   DESCRIPTION
+*
+*       Finishes rewriting the snapshot started by stats_shm_begin - the
+*       time is stamped and the sequence made even again, releasing the
+*       records to the readers
+*
+*   INPUTS
+*
+*       shm                                 Pointer to snapshot
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void stats_shm_end(STATS_SHM * shm)
+{
+    STATS_SHM_HEADER *  header = shm->header;
+
+
+    /* Stamp snapshot */
+    header->time_ns = interval_now();
+
+    /* Publish snapshot (the records are written before the sequence is even) */
+    __atomic_store_n(&header->sequence, header->sequence + 1, __ATOMIC_RELEASE);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_open
+*
+*   DESCRIPTION
+*
+*       Opens and maps (read only) the segment published by a daemon
+*
+*   INPUTS
+*
+*       reader                              Pointer to reader
+*       name                                Segment name given to the
+*                                           daemon with -z
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Segment mapped
+*       STATS_SHM_OPEN_ERROR                No such segment, it isn't a
+*                                           snapshot, it is of another
+*                                           version or out of memory
+*
+*************************************************************************/
+int stats_shm_open(STATS_SHM_READER * reader, const char * name)
+{
+    int     status = EXIT_SUCCESS;
+
+
+    /* Initialize empty reader */
+    memset(reader, 0, sizeof(STATS_SHM_READER));
+
+    /* Open segment */
+    reader->fd = shm_open(name, O_RDONLY | O_CLOEXEC, 0);
+
+    /* Allocate copy of the header (grown to hold the records when read) */
+    reader->copy = malloc(sizeof(STATS_SHM_HEADER));
+    reader->copy_size = (reader->copy != NULL) ? sizeof(STATS_SHM_HEADER) : 0;
+
+    /* Ensure segment opened, mapped and a snapshot of this version */
+    if ((reader->fd < 0) || (reader->copy == NULL) ||
+        (stats_shm_remap(reader) != EXIT_SUCCESS) ||
+        (__atomic_load_n(&reader->header->magic, __ATOMIC_ACQUIRE) != STATS_SHM_MAGIC) ||
+        (reader->header->version != STATS_SHM_VERSION))
+    {
+        /* Set error status */
+        status = STATS_SHM_OPEN_ERROR;
+
+        /* Close segment */
+        stats_shm_close(reader);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_read
+*
+*   DESCRIPTION
+*
+*       Copies the last snapshot published out of the segment.  A copy
+*       made while the daemon was rewriting it (the sequence was odd or
+*       changed) is made again, so the copy returned is always of a
+*       single cycle.  The segment is only mapped again if it grew
+*
+*   INPUTS
+*
+*       reader                              Pointer to reader
+*       snapshot                            Returns the header of the
+*                                           copy (valid until the next
+*                                           read - see STATS_SHM_PCPU_AT,
+*                                           STATS_SHM_VCPU_AT and
+*                                           STATS_SHM_VM_AT)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Snapshot copied
+*       STATS_SHM_CLOSED                    Daemon stopped
+*       STATS_SHM_BUSY                      Snapshot rewritten during
+*                                           every copy
+*       STATS_SHM_NOMEM / STATS_SHM_OPEN_ERROR
+*
+*************************************************************************/
+int stats_shm_read(STATS_SHM_READER * reader, const STATS_SHM_HEADER ** snapshot)
+{
+    int                 status = STATS_SHM_BUSY;
+    int                 retries = STATS_SHM_READ_RETRIES;
+    const STATS_SHM_HEADER * header;
+    STATS_SHM_HEADER *  copy;
+    uint32_t            sequence;
+    size_t              len;
+    size_t              end;
+
+
+    /* Copy snapshot until a copy isn't torn */
+    while ((status == STATS_SHM_BUSY) && (retries > 0))
+    {
+        /* Start copy */
+        header = reader->header;
+        sequence = __atomic_load_n(&header->sequence, __ATOMIC_ACQUIRE);
+        retries--;
+
+        /* Check if daemon stopped */
+        if (__atomic_load_n(&header->closed, __ATOMIC_ACQUIRE) != 0)
+        {
+            /* Set closed status */
+            status = STATS_SHM_CLOSED;
+        }
+        /* Check if segment grew since it was mapped */
+        else if (__atomic_load_n(&header->size, __ATOMIC_RELAXED) > reader->size)
+        {
+            /* Map segment again */
+            status = (stats_shm_remap(reader) == EXIT_SUCCESS) ? STATS_SHM_BUSY : STATS_SHM_OPEN_ERROR;
+        }
+        /* Ensure snapshot isn't being rewritten */
+        else if ((sequence & 1) == 0)
+        {
+            /* Copy header and find the end of the records from it */
+            memcpy(reader->copy, header, sizeof(STATS_SHM_HEADER));
+            copy = reader->copy;
+            end = (size_t)copy->pcpu_offset + ((size_t)copy->num_pcpus * copy->pcpu_size);
+            len = (size_t)copy->vcpu_offset + ((size_t)copy->num_vcpus * copy->vcpu_size);
+            end = (len > end) ? len : end;
+            len = (size_t)copy->vm_offset + ((size_t)copy->num_vms * copy->vm_size);
+            end = (len > end) ? len : end;
+
+            /* Check if the records are outside the mapping (a torn header is copied again) */
+            if ((end > reader->size) || (end < sizeof(STATS_SHM_HEADER)))
+            {
+                /* Retry copy */
+                status = STATS_SHM_BUSY;
+            }
+            /* Check if there isn't room for the records */
+            else if ((end > reader->copy_size) && ((copy = realloc(reader->copy, end)) == NULL))
+            {
+                /* Set error status */
+                status = STATS_SHM_NOMEM;
+            }
+            else
+            {
+                /* Save copy (realloc may have moved it) */
+                reader->copy = copy;
+                reader->copy_size = (end > reader->copy_size) ? end : reader->copy_size;
+
+                /* Copy records */
+                memcpy((char *)copy + sizeof(STATS_SHM_HEADER), (const char *)header + sizeof(STATS_SHM_HEADER),
+                       end - sizeof(STATS_SHM_HEADER));
+
+                /* Keep copy only if the snapshot wasn't rewritten during it (the fence keeps the copy before the check) */
+                __atomic_thread_fence(__ATOMIC_ACQUIRE);
+                if (__atomic_load_n(&header->sequence, __ATOMIC_RELAXED) == sequence)
+                {
+                    /* Return copy */
+                    *snapshot = copy;
+                    status = EXIT_SUCCESS;
+                }
+            }
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_close
+*
+*   DESCRIPTION
+*
+*       Unmaps and closes a segment opened with stats_shm_open and frees
+*       the copy
+*
+*   INPUTS
+*
+*       reader                              Pointer to reader
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void stats_shm_close(STATS_SHM_READER * reader)
+{
+    /* Check if segment is mapped */
+    if (reader->header != NULL)
+    {
+        /* Unmap segment */
+        munmap((void *)reader->header, reader->size);
+        reader->header = NULL;
+    }
+
+    /* Check if segment is open */
+    if (reader->fd >= 0)
+    {
+        /* Close segment */
+        close(reader->fd);
+        reader->fd = -1;
+    }
+
+    /* Free copy */
+    free(reader->copy);
+    reader->copy = NULL;
+    reader->copy_size = 0;
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_align
+*
+*   DESCRIPTION
+*
+*       Rounds a length up to the alignment of the 64-bit record fields
+*
+*   INPUTS
+*
+*       len                                 Length to round up
+*
+*   OUTPUTS
+*
+*       size_t                              Rounded length
+*
+*************************************************************************/
+static size_t stats_shm_align(size_t len)
+{
+    /* Round up to a multiple of 8 */
+    return ((len + 7) & ~(size_t)7);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_grow
+*
+*   DESCRIPTION
+*
+*       Grows the segment to at least the specified size (doubling it, so
+*       a host adding VMs one at a time rarely grows it) and maps it again.
+*       The segment is never shrunk, so a reader still mapping the smaller
+*       size never reads past its end
+*
+*   INPUTS
+*
+*       shm                                 Pointer to snapshot
+*       size                                Bytes needed
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Segment grown and mapped
+*       EXIT_FAILURE                        Error growing or mapping the
+*                                           segment (the old mapping is
+*                                           kept)
+*
+*************************************************************************/
+static int  stats_shm_grow(STATS_SHM * shm, size_t size)
+{
+    int     status = EXIT_SUCCESS;
+    size_t  new_size = (shm->size > 0) ? shm->size : STATS_SHM_INIT_SIZE;
+    void *  map;
+
+
+    /* Double size until the records fit */
+    while (new_size < size)
+    {
+        new_size *= 2;
+    }
+
+    /* Grow segment */
+    if (ftruncate(shm->fd, new_size) != 0)
+    {
+        /* Set error status */
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        /* Map grown segment */
+        map = mmap(NULL, new_size, PROT_READ | PROT_WRITE, MAP_SHARED, shm->fd, 0);
+
+        /* Ensure segment mapped */
+        if (map == MAP_FAILED)
+        {
+            /* Set error status */
+            status = EXIT_FAILURE;
+        }
+        else
+        {
+            /* Check if a smaller mapping was in use */
+            if (shm->header != NULL)
+            {
+                /* Unmap it (both mappings are of the same pages) */
+                munmap(shm->header, shm->size);
+            }
+
+            /* Save mapping */
+            shm->header = map;
+            shm->size = new_size;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       stats_shm_remap
+*
+*   DESCRIPTION
+*
+*       Maps (again) the whole of a segment being read
+*
+*   INPUTS
+*
+*       reader                              Pointer to reader
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Segment mapped
+*       EXIT_FAILURE                        Error mapping the segment, or
+*                                           it is too small to be a
+*                                           snapshot
+*
+*************************************************************************/
+static int  stats_shm_remap(STATS_SHM_READER * reader)
+{
+    int             status = EXIT_SUCCESS;
+    struct stat     info;
+    void *          map;
+
+
+    /* Ensure segment is big enough for a header and mapped */
+    if ((fstat(reader->fd, &info) != 0) ||
+        ((size_t)info.st_size < sizeof(STATS_SHM_HEADER)) ||
+        ((map = mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, reader->fd, 0)) == MAP_FAILED))
+    {
+        /* Set error status */
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        /* Check if the segment was mapped */
+        if (reader->header != NULL)
+        {
+            /* Unmap old mapping */
+            munmap((void *)reader->header, reader->size);
+        }
+
+        /* Save mapping */
+        reader->header = map;
+        reader->size = info.st_size;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
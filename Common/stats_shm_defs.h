@@ -0,0 +1,183 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains shared memory snapshot macros, definitions,
+*       and structures used by both the VCPU scheduler and the memory
+*       coordinator to publish the PCPU / VCPU / VM stats of every cycle
+*       in a POSIX shared memory segment, and by other tools on the host
+*       to read them.  The daemon rewrites the segment at the end of each
+*       cycle under a sequence lock - a reader copies it out and checks
+*       the sequence didn't change, so reading takes no locks or system
+*       calls and any number of readers costs the hypervisor nothing
+*
+*       All record fields are fixed width, each region is found from the
+*       offsets / record sizes in the header (a reader built for an older
+*       version reads the fields it knows) and a new field is only ever
+*       added to the end of a record
+*
+***********************************************************************/
+#ifndef STATS_SHM_DEFS_H
+#define STATS_SHM_DEFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Segment magic number ("VSHM" when read as bytes) and format version */
+#define STATS_SHM_MAGIC                     0x4d485356
+#define STATS_SHM_VERSION                   1
+
+/* Permissions of the segment (readable by the other tools on the host) */
+#define STATS_SHM_MODE                      0644
+
+/* Size the segment starts at in bytes (doubled when the records don't fit) */
+#define STATS_SHM_INIT_SIZE                 (64 << 10)
+
+/* Number of times a reader copies the segment while it is being rewritten before giving up */
+#define STATS_SHM_READ_RETRIES              1000
+
+/* Define daemons a segment is published by */
+#define STATS_SHM_SOURCE_CPU                1       /* VCPU scheduler */
+#define STATS_SHM_SOURCE_MEM                2       /* Memory coordinator */
+
+/* Maximum length of a domain name in a VM record */
+#define STATS_SHM_NAME_LEN                  64
+
+/* Define reader errors */
+#define STATS_SHM_OPEN_ERROR                -1      /* No segment / not a snapshot segment */
+#define STATS_SHM_NOMEM                     -2
+#define STATS_SHM_BUSY                      -3      /* Segment rewritten during every copy */
+#define STATS_SHM_CLOSED                    -4      /* Daemon stopped - open the segment again */
+
+/* Structure at the start of the segment */
+typedef struct STATS_SHM_HEADER_STRUCT
+{
+    uint32_t            magic;          /* STATS_SHM_MAGIC (set last when the segment is created) */
+    uint16_t            version;        /* STATS_SHM_VERSION */
+    uint16_t            source;         /* STATS_SHM_SOURCE_CPU / MEM */
+    uint32_t            header_size;    /* Size of this header */
+    uint32_t            sequence;       /* Sequence lock - odd while the snapshot is being rewritten */
+    uint64_t            size;           /* Bytes of the segment (a reader maps it again if it grew) */
+    uint32_t            closed;         /* Non-zero once the daemon stopped (the segment is removed) */
+    uint32_t            interval_ms;    /* Interval between cycles */
+    uint64_t            cycle;          /* Cycle of the snapshot (0 = no cycle run yet) */
+    uint64_t            time_ns;        /* Monotonic time (ns) the snapshot was published */
+    uint64_t            num_changes;    /* Total VCPUs repinned (VCPU scheduler) / balloon resizes (memory coordinator) */
+    uint64_t            phase_ns[4];    /* Time spent in each phase of the cycle (as the metrics) */
+    uint64_t            host_total_kb;  /* Host total memory (memory coordinator) */
+    uint64_t            host_free_kb;   /* Host free memory (memory coordinator) */
+    uint32_t            num_pcpus;      /* PCPU records (VCPU scheduler) */
+    uint32_t            num_vcpus;      /* VCPU records (VCPU scheduler) */
+    uint32_t            num_vms;        /* VM records */
+    uint32_t            reserved;
+    uint32_t            pcpu_offset;    /* Offset of the PCPU records from the start of the segment */
+    uint32_t            vcpu_offset;    /* Offset of the VCPU records */
+    uint32_t            vm_offset;      /* Offset of the VM records */
+    uint16_t            pcpu_size;      /* Size of a PCPU record */
+    uint16_t            vcpu_size;      /* Size of a VCPU record */
+    uint16_t            vm_size;        /* Size of a VM record */
+    uint16_t            reserved2[3];
+
+} STATS_SHM_HEADER;
+
+/* Structure for the stats of a PCPU (PCPU_STATS) */
+typedef struct STATS_SHM_PCPU_STRUCT
+{
+    int32_t             id;             /* CPU ID */
+    int32_t             cpu_util;       /* Utilization during the cycle % */
+    int32_t             num_pinned;     /* Number of VCPUs pinned */
+    int32_t             node_id;        /* NUMA node */
+    int32_t             socket_id;      /* Socket */
+    int32_t             core_id;        /* Core (within socket) */
+    int32_t             l3_id;          /* L3 cache */
+    int32_t             smt_index;      /* Position of its thread within its core (0 = first) */
+    int32_t             parked;         /* Non-zero while left without VCPUs by consolidation */
+    int32_t             reserved;
+
+} STATS_SHM_PCPU;
+
+/* Structure for the stats of a VCPU (VCPU_STATS) */
+typedef struct STATS_SHM_VCPU_STRUCT
+{
+    uint32_t            vm;             /* Index of the VM record of its domain */
+    uint32_t            vcpu_num;       /* VCPU number within the domain */
+    int32_t             pcpu;           /* CPU ID of the PCPU it is pinned to */
+    int32_t             cpu_util;       /* Utilization during the cycle % */
+    int32_t             cpu_util_avg;   /* Smoothed utilization used for scheduling % */
+    int32_t             reserved;
+    uint64_t            cpu_time;       /* Total CPU time (ns) last read */
+    uint64_t            last_move_cycle; /* Cycle the VCPU was last pinned */
+
+} STATS_SHM_VCPU;
+
+/* Structure for the stats of a VM (domain of the VCPU scheduler / VM_MEM_INFO of the memory
+   coordinator - the fields of the other daemon are 0) */
+typedef struct STATS_SHM_VM_STRUCT
+{
+    char                name[STATS_SHM_NAME_LEN]; /* Domain name (NUL terminated) */
+    uint32_t            dom_id;         /* Hypervisor ID of the domain */
+    int32_t             num_vcpus;      /* VCPUs of the domain (VCPU scheduler) */
+    uint32_t            first_vcpu;     /* Index of its first VCPU record (VCPU scheduler) */
+    int32_t             tier;           /* Priority tier (VCPU scheduler) */
+    int32_t             throttled;      /* Non-zero while its VCPU quota is set (VCPU scheduler) */
+    int32_t             pressure;       /* Memory pressure score 0 - 100 (memory coordinator) */
+    int32_t             percent_avail;  /* Unused memory % of the balloon (memory coordinator) */
+    int32_t             percent_usable; /* Available memory % of the balloon (memory coordinator) */
+    uint64_t            balloon_kb;     /* Balloon size (memory coordinator) */
+    uint64_t            unused_kb;      /* Unused memory */
+    uint64_t            available_kb;   /* Memory usable without swapping (or unused) */
+    uint64_t            max_kb;         /* Maximum memory */
+    uint64_t            target_kb;      /* Balloon size a resize is stepping towards (0 = none) */
+    uint64_t            swap_rate_kb;   /* Swap in + out (KB/s) over the cycle */
+    uint64_t            fault_rate;     /* Major page faults per second over the cycle */
+
+} STATS_SHM_VM;
+
+/* Structure to keep track of the segment published (daemon) */
+typedef struct STATS_SHM_STRUCT
+{
+    int                 fd;             /* Segment (-1 = not published) */
+    char                name[256];      /* Segment name (removed when the daemon stops) */
+    STATS_SHM_HEADER *  header;         /* Mapped segment */
+    size_t              size;           /* Bytes mapped */
+    uint32_t            max_pcpus;      /* Records the current layout has room for */
+    uint32_t            max_vcpus;
+    uint32_t            max_vms;
+    int                 grow_error;     /* Non-zero once the segment couldn't be grown (snapshots stop) */
+
+} STATS_SHM;
+
+/* Structure to keep track of a segment being read (other tools) */
+typedef struct STATS_SHM_READER_STRUCT
+{
+    int                 fd;             /* Segment (-1 = not open) */
+    const STATS_SHM_HEADER * header;    /* Mapped segment (read only) */
+    size_t              size;           /* Bytes mapped */
+    STATS_SHM_HEADER *  copy;           /* Last consistent copy */
+    size_t              copy_size;      /* Bytes allocated for the copy */
+
+} STATS_SHM_READER;
+
+/* Find the records of a snapshot (header of a copy returned by stats_shm_read) */
+#define STATS_SHM_PCPU_AT(header, index)    ((const STATS_SHM_PCPU *)((const char *)(header) + (header)->pcpu_offset + \
+                                                                      ((size_t)(index) * (header)->pcpu_size)))
+#define STATS_SHM_VCPU_AT(header, index)    ((const STATS_SHM_VCPU *)((const char *)(header) + (header)->vcpu_offset + \
+                                                                      ((size_t)(index) * (header)->vcpu_size)))
+#define STATS_SHM_VM_AT(header, index)      ((const STATS_SHM_VM *)((const char *)(header) + (header)->vm_offset + \
+                                                                    ((size_t)(index) * (header)->vm_size)))
+
+/* Snapshot functions for the daemons (see stats_shm.c) */
+int     stats_shm_init(STATS_SHM * shm, const char * name, int source);
+void    stats_shm_deinit(STATS_SHM * shm);
+STATS_SHM_HEADER * stats_shm_begin(STATS_SHM * shm, unsigned int num_pcpus, unsigned int num_vcpus, unsigned int num_vms);
+STATS_SHM_PCPU * stats_shm_pcpu(STATS_SHM * shm, unsigned int index);
+STATS_SHM_VCPU * stats_shm_vcpu(STATS_SHM * shm, unsigned int index);
+STATS_SHM_VM *   stats_shm_vm(STATS_SHM * shm, unsigned int index);
+void    stats_shm_end(STATS_SHM * shm);
+
+/* Snapshot functions for the readers (see stats_shm.c) */
+int     stats_shm_open(STATS_SHM_READER * reader, const char * name);
+int     stats_shm_read(STATS_SHM_READER * reader, const STATS_SHM_HEADER ** snapshot);
+void    stats_shm_close(STATS_SHM_READER * reader);
+
+#endif /* STATS_SHM_DEFS_H */
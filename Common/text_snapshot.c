@@ -0,0 +1,309 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the text snapshot shared by the metrics
+*       exporter and the monitor stream.  The control loop appends
+*       formatted text to a build buffer and publishes it by swapping it
+*       with the published buffer, only ever trying the lock - if a
+*       server thread is copying the published text right now the new
+*       text is skipped, so the control loop never waits.  The server
+*       thread copies the published text into its send buffer and sends
+*       it without holding the lock.
+*
+*   FUNCTIONS
+*
+*       text_snapshot_init
+*       text_snapshot_deinit
+*       text_snapshot_vprintf
+*       text_snapshot_publish
+*       text_snapshot_copy
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <pthread.h>
+#include "text_snapshot_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static int  text_buffer_reserve(TEXT_BUFFER * buffer, size_t len);
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       text_snapshot_init
+*
+*   DESCRIPTION
+*
+*       Initializes an empty text snapshot
+*
+*   INPUTS
+*
+*       snapshot                            Pointer to text snapshot
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void text_snapshot_init(TEXT_SNAPSHOT * snapshot)
+{
+    /* Initialize empty buffers */
+    memset(snapshot, 0, sizeof(TEXT_SNAPSHOT));
+    pthread_mutex_init(&snapshot->lock, NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       text_snapshot_deinit
+*
+*   DESCRIPTION
+*
+*       Frees the buffers of a text snapshot (no server thread may be
+*       using it)
+*
+*   INPUTS
+*
+*       snapshot                            Pointer to text snapshot
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void text_snapshot_deinit(TEXT_SNAPSHOT * snapshot)
+{
+    /* Free buffers */
+    free(snapshot->build.text);
+    free(snapshot->published.text);
+    free(snapshot->send.text);
+    memset(&snapshot->build, 0, sizeof(TEXT_BUFFER));
+    memset(&snapshot->published, 0, sizeof(TEXT_BUFFER));
+    memset(&snapshot->send, 0, sizeof(TEXT_BUFFER));
+
+    /* Done with the buffers */
+    pthread_mutex_destroy(&snapshot->lock);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       text_snapshot_vprintf
+*
+*   DESCRIPTION
+*
+*       Appends formatted text to the text being rendered.  If memory
+*       runs out the text is dropped when published
+*
+*   INPUTS
+*
+*       snapshot                            Pointer to text snapshot
+*       format                              printf style format
+*       args                                Format arguments
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void text_snapshot_vprintf(TEXT_SNAPSHOT * snapshot, const char * format, va_list args)
+{
+    va_list     copy;
+    int         len;
+
+
+    /* Get length of formatted text (the arguments are used again to append it) */
+    va_copy(copy, args);
+    len = vsnprintf(NULL, 0, format, copy);
+    va_end(copy);
+
+    /* Ensure there is room for the text (and its terminator) */
+    if ((len >= 0) && (!snapshot->build_error) &&
+        (text_buffer_reserve(&snapshot->build, snapshot->build.len + len + 1) == EXIT_SUCCESS))
+    {
+        /* Append text */
+        vsnprintf(snapshot->build.text + snapshot->build.len, len + 1, format, args);
+        snapshot->build.len += len;
+    }
+    else
+    {
+        /* Drop this text */
+        snapshot->build_error = 1;
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       text_snapshot_publish
+*
+*   DESCRIPTION
+*
+*       Publishes the text rendered since the last publish.  Only tries
+*       the lock - if the published text is being copied right now, this
+*       text is skipped (the next cycle publishes a newer one) so the
+*       control loop never waits
+*
+*   INPUTS
+*
+*       snapshot                            Pointer to text snapshot
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Text published
+*       EXIT_FAILURE                        Text skipped (out of memory or
+*                                           being copied)
+*
+*************************************************************************/
+int text_snapshot_publish(TEXT_SNAPSHOT * snapshot)
+{
+    int             status = EXIT_FAILURE;
+    TEXT_BUFFER     buffer;
+
+
+    /* Ensure text is complete and the published text isn't being copied */
+    if ((!snapshot->build_error) && (pthread_mutex_trylock(&snapshot->lock) == 0))
+    {
+        /* Swap the rendered and published texts (no copying) */
+        buffer = snapshot->published;
+        snapshot->published = snapshot->build;
+        snapshot->build = buffer;
+
+        pthread_mutex_unlock(&snapshot->lock);
+        status = EXIT_SUCCESS;
+    }
+    else
+    {
+        /* Count skipped text */
+        snapshot->num_skipped++;
+    }
+
+    /* Start the next text */
+    snapshot->build.len = 0;
+    snapshot->build_error = 0;
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       text_snapshot_copy
+*
+*   DESCRIPTION
+*
+*       Copies the published text into the send buffer (the lock is only
+*       held while copying) - called by the server thread
+*
+*   INPUTS
+*
+*       snapshot                            Pointer to text snapshot
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Published text copied to the
+*                                           send buffer
+*       EXIT_FAILURE                        Error with memory allocation
+*
+*************************************************************************/
+int text_snapshot_copy(TEXT_SNAPSHOT * snapshot)
+{
+    int     status;
+
+
+    /* Copy the published text */
+    pthread_mutex_lock(&snapshot->lock);
+
+    status = text_buffer_reserve(&snapshot->send, snapshot->published.len + 1);
+
+    if (status == EXIT_SUCCESS)
+    {
+        memcpy(snapshot->send.text, snapshot->published.text ? snapshot->published.text : "", snapshot->published.len);
+        snapshot->send.len = snapshot->published.len;
+    }
+
+    pthread_mutex_unlock(&snapshot->lock);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       text_buffer_reserve
+*
+*   DESCRIPTION
+*
+*       Ensures a text buffer can hold the specified number of bytes
+*       (doubling so rendering stays cheap)
+*
+*   INPUTS
+*
+*       buffer                              Pointer to text buffer
+*       len                                 Number of bytes needed
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Buffer large enough
+*       EXIT_FAILURE                        Error with memory allocation
+*
+*************************************************************************/
+static int  text_buffer_reserve(TEXT_BUFFER * buffer, size_t len)
+{
+    int     status = EXIT_SUCCESS;
+    size_t  size = (buffer->size ? buffer->size : TEXT_SNAPSHOT_BUFFER_SIZE);
+    char *  text;
+
+
+    /* Check if buffer is too small */
+    if (len > buffer->size)
+    {
+        /* Double size until large enough */
+        while (size < len)
+        {
+            size *= 2;
+        }
+
+        /* Grow buffer */
+        text = realloc(buffer->text, size);
+
+        /* Ensure memory allocated */
+        if (text != NULL)
+        {
+            /* Save new buffer */
+            buffer->text = text;
+            buffer->size = size;
+        }
+        else
+        {
+            /* Set error status */
+            status = EXIT_FAILURE;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
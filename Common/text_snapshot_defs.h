@@ -0,0 +1,51 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains text snapshot macros, definitions, and
+*       structures shared by the metrics exporter and the monitor
+*       stream.  The control loop renders text into a build buffer and
+*       publishes it by swapping it with the published buffer, and a
+*       server thread copies the published buffer out to send it, so
+*       rendering never waits on a reader
+*
+***********************************************************************/
+#ifndef TEXT_SNAPSHOT_DEFS_H
+#define TEXT_SNAPSHOT_DEFS_H
+
+#include <stddef.h>
+#include <stdarg.h>
+#include <pthread.h>
+
+/* Initial size of a snapshot buffer (grown as needed) */
+#define TEXT_SNAPSHOT_BUFFER_SIZE           4096
+
+/* Structure for a buffer of rendered text */
+typedef struct TEXT_BUFFER_STRUCT
+{
+    char *              text;           /* Rendered text */
+    size_t              len;            /* Length of text */
+    size_t              size;           /* Bytes allocated for text */
+
+} TEXT_BUFFER;
+
+/* Structure to keep track of a text snapshot */
+typedef struct TEXT_SNAPSHOT_STRUCT
+{
+    pthread_mutex_t     lock;           /* Protects the published text */
+    TEXT_BUFFER         build;          /* Text being rendered by the control loop */
+    TEXT_BUFFER         published;      /* Last complete text */
+    TEXT_BUFFER         send;           /* Copy of the published text being sent (server thread) */
+    int                 build_error;    /* Non-zero if the text being rendered ran out of memory */
+    unsigned long long  num_skipped;    /* Texts not published because the last one was being copied */
+
+} TEXT_SNAPSHOT;
+
+/* Text snapshot functions (see text_snapshot.c) */
+void    text_snapshot_init(TEXT_SNAPSHOT * snapshot);
+void    text_snapshot_deinit(TEXT_SNAPSHOT * snapshot);
+void    text_snapshot_vprintf(TEXT_SNAPSHOT * snapshot, const char * format, va_list args);
+int     text_snapshot_publish(TEXT_SNAPSHOT * snapshot);
+int     text_snapshot_copy(TEXT_SNAPSHOT * snapshot);
+
+#endif /* TEXT_SNAPSHOT_DEFS_H */
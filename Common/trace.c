@@ -0,0 +1,749 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the binary trace recorder shared by the VCPU
+*       scheduler and the memory coordinator.  The control loop copies
+*       each record into a single producer / single consumer ring - it
+*       never takes a lock, makes a system call or waits for the writer,
+*       and a record that doesn't fit because the ring is full is counted
+*       and dropped.  A writer thread wakes up every TRACE_POLL_MS to
+*       drain the ring into a memory mapped trace file, recording how
+*       many records were dropped, and starts a new file once the
+*       current one reaches TRACE_MAX_FILE_SIZE.
+*
+*   FUNCTIONS
+*
+*       trace_init
+*       trace_deinit
+*       trace_cycle
+*       trace_write
+*       trace_mask
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "interval_defs.h"
+#include "trace_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static void * trace_writer(void * arg);
+static void trace_drain(TRACE * trace);
+static int  trace_file_open(TRACE * trace);
+static void trace_file_close(TRACE * trace);
+static int  trace_file_map(TRACE * trace, size_t offset);
+static void trace_file_append(TRACE * trace, const void * data, size_t len);
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_init
+*
+*   DESCRIPTION
+*
+*       Allocates the ring, starts the trace file (replacing any file
+*       already at the path) and starts the writer thread
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*       path                                Path of the trace file
+*       source                              TRACE_SOURCE_CPU / MEM
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Trace being recorded
+*       EXIT_FAILURE                        Error with memory allocation,
+*                                           creating the file or starting
+*                                           the thread
+*
+*************************************************************************/
+int trace_init(TRACE * trace, const char * path, int source)
+{
+    int     status = EXIT_SUCCESS;
+
+
+    /* Initialize a trace that isn't recording */
+    memset(trace, 0, sizeof(TRACE));
+    trace->fd = -1;
+    trace->path = path;
+    trace->source = source;
+
+    /* Allocate ring (records are padded so aligning the ring keeps every record aligned) */
+    trace->ring = aligned_alloc(TRACE_ALIGN, TRACE_RING_SIZE);
+
+    /* Ensure ring allocated and the file started */
+    if ((trace->ring == NULL) || (trace_file_open(trace) != EXIT_SUCCESS))
+    {
+        /* Set error status */
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        /* Domains are recorded as they are added to the first file */
+        trace->files_seen = trace->num_files;
+
+        /* Start the writer thread */
+        trace->run = 1;
+
+        /* Ensure thread started */
+        if (pthread_create(&trace->thread, NULL, trace_writer, trace) != 0)
+        {
+            /* Set error status */
+            status = EXIT_FAILURE;
+        }
+        else
+        {
+            /* Thread running */
+            trace->started = 1;
+        }
+    }
+
+    /* Check if the trace couldn't be started */
+    if (status != EXIT_SUCCESS)
+    {
+        /* Free what was set up */
+        trace_deinit(trace);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_deinit
+*
+*   DESCRIPTION
+*
+*       Stops the writer thread once it has drained the records left in
+*       the ring, closes the trace file and frees the ring.  Safe to call
+*       on a trace that isn't recording
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void trace_deinit(TRACE * trace)
+{
+    /* Check if writer thread is running */
+    if (trace->started)
+    {
+        /* Tell the writer to stop - it drains the ring once more on its way out */
+        trace->run = 0;
+
+        /* Wait for the writer thread to finish */
+        pthread_join(trace->thread, NULL);
+        trace->started = 0;
+    }
+
+    /* Check if the file is open */
+    if (trace->fd >= 0)
+    {
+        /* Close file (trimmed to the records written) */
+        trace_file_close(trace);
+    }
+
+    /* Free ring (no more records are recorded) */
+    free(trace->ring);
+    trace->ring = NULL;
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_cycle
+*
+*   DESCRIPTION
+*
+*       Records the start of a cycle.  Records made until the next call
+*       are tagged with this cycle
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*       cycle                               Number of the cycle
+*       time_ns                             Monotonic time (ns) the cycle
+*                                           started
+*       interval_ms                         Interval between cycles
+*
+*   OUTPUTS
+*
+*       1                                   A new file was started since
+*                                           the last call - the caller
+*                                           records its domains again so
+*                                           each file names them
+*       0                                   Same file (or not recording)
+*
+*************************************************************************/
+int trace_cycle(TRACE * trace, unsigned long long cycle, unsigned long long time_ns, unsigned int interval_ms)
+{
+    TRACE_CYCLE     record;
+    unsigned int    num_files;
+    int             new_file = 0;
+
+
+    /* Check if recording */
+    if (trace->ring != NULL)
+    {
+        /* Tag the following records with this cycle */
+        __atomic_store_n(&trace->cycle, cycle, __ATOMIC_RELAXED);
+
+        /* Record start of cycle */
+        memset(&record, 0, sizeof(record));
+        record.time_ns = time_ns;
+        record.interval_ms = interval_ms;
+        trace_write(trace, TRACE_REC_CYCLE, 0, &record, sizeof(record));
+
+        /* Check if the writer started a new file since the last cycle */
+        num_files = __atomic_load_n(&trace->num_files, __ATOMIC_ACQUIRE);
+        new_file = (num_files != trace->files_seen);
+        trace->files_seen = num_files;
+    }
+
+    /* Return if a new file was started to caller */
+    return (new_file);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_write
+*
+*   DESCRIPTION
+*
+*       Copies a record into the ring.  Only called by the control loop
+*       (the single producer).  If the ring is full the record is counted
+*       as dropped instead of waiting for the writer
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*       type                                TRACE_REC_xxx
+*       id                                  Domain ID, PCPU or mask the
+*                                           record is for
+*       data                                Record data (after the header)
+*       len                                 Length of record data
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void trace_write(TRACE * trace, int type, unsigned int id, const void * data, size_t len)
+{
+    size_t          head, tail, offset, size, pad;
+    TRACE_RECORD *  record;
+
+
+    /* Check if recording */
+    if (trace->ring != NULL)
+    {
+        /* Get size of record with its padding and the space left to the end of the ring */
+        size = (sizeof(TRACE_RECORD) + len + TRACE_ALIGN - 1) & ~((size_t)TRACE_ALIGN - 1);
+        head = trace->head;
+        offset = head & (TRACE_RING_SIZE - 1);
+        pad = ((TRACE_RING_SIZE - offset) < size ? (TRACE_RING_SIZE - offset) : 0);
+
+        /* Get bytes the writer has drained (acquire so its reads of them are done) */
+        tail = __atomic_load_n(&trace->tail, __ATOMIC_ACQUIRE);
+
+        /* Check if the record (and any pad at the end of the ring) doesn't fit */
+        if ((size > TRACE_MAX_RECORD) || ((TRACE_RING_SIZE - (head - tail)) < (size + pad)))
+        {
+            /* Count dropped record (read by the writer) */
+            __atomic_store_n(&trace->num_dropped, trace->num_dropped + 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            /* Check if the record would straddle the end of the ring */
+            if (pad != 0)
+            {
+                /* Mark rest of the ring unused and start the record at the beginning */
+                record = (TRACE_RECORD *)(trace->ring + offset);
+                record->type = TRACE_REC_PAD;
+                record->size = 0;
+                head += pad;
+                offset = 0;
+            }
+
+            /* Fill in record header and data (padding is zeroed so files compress well) */
+            record = (TRACE_RECORD *)(trace->ring + offset);
+            record->type = type;
+            record->size = size;
+            record->id = id;
+            record->cycle = trace->cycle;
+            memcpy(record + 1, data, len);
+            memset((unsigned char *)(record + 1) + len, 0, size - sizeof(TRACE_RECORD) - len);
+
+            /* Publish record to the writer (release so the record is complete before head moves) */
+            __atomic_store_n(&trace->head, head + size, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_mask
+*
+*   DESCRIPTION
+*
+*       Records a bit mask (as many words as fit in TRACE_MAX_RECORD)
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*       mask_id                             TRACE_MASK_xxx
+*       mask                                Pointer to bit mask
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void trace_mask(TRACE * trace, unsigned int mask_id, const BITMASK * mask)
+{
+    unsigned char   buffer[TRACE_MAX_RECORD - sizeof(TRACE_RECORD)] __attribute__((aligned(8)));
+    TRACE_MASK *    record = (TRACE_MASK *)buffer;
+    int             bit, max_words;
+
+
+    /* Check if recording */
+    if (trace->ring != NULL)
+    {
+        /* Get number of 64 bit words that fit and clear them */
+        max_words = (sizeof(buffer) - sizeof(TRACE_MASK)) / sizeof(uint64_t);
+        record->num_bits = mask->num_bits;
+        record->num_words = (mask->num_bits + 63) / 64;
+        record->num_words = (record->num_words > (uint32_t)max_words ? (uint32_t)max_words : record->num_words);
+        memset(record->words, 0, record->num_words * sizeof(uint64_t));
+
+        /* Loop through each set bit that fits (the mask word size is host dependent) */
+        for (bit = bitmask_next_set(mask, 0);
+             (bit >= 0) && (bit < (int)record->num_words * 64);
+             bit = bitmask_next_set(mask, bit + 1))
+        {
+            /* Set bit in record */
+            record->words[bit / 64] |= ((uint64_t)1 << (bit % 64));
+        }
+
+        /* Record mask */
+        trace_write(trace, TRACE_REC_MASK, mask_id, record, sizeof(TRACE_MASK) + (record->num_words * sizeof(uint64_t)));
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_writer
+*
+*   DESCRIPTION
+*
+*       Writer thread - drains the ring into the trace file every
+*       TRACE_POLL_MS until the trace is stopped, then drains it once more
+*
+*   INPUTS
+*
+*       arg                                 Pointer to trace
+*
+*   OUTPUTS
+*
+*       NULL                                Always
+*
+*************************************************************************/
+static void * trace_writer(void * arg)
+{
+    TRACE *             trace = arg;
+    struct timespec     poll_time = {0, TRACE_POLL_MS * INTERVAL_NSECS_PER_MSEC};
+
+
+    /* Loop until told to stop */
+    while (trace->run)
+    {
+        /* Let records build up (the control loop never wakes the writer) */
+        nanosleep(&poll_time, NULL);
+
+        /* Write records made since the last drain */
+        trace_drain(trace);
+    }
+
+    /* Write records made before the trace was stopped */
+    trace_drain(trace);
+
+    /* Thread is done */
+    return (NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_drain
+*
+*   DESCRIPTION
+*
+*       Appends the records in the ring to the trace file (and a drop
+*       record if records were lost since the last drain), frees their
+*       space in the ring and updates the length in the file header
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void trace_drain(TRACE * trace)
+{
+    size_t              head, tail, offset;
+    unsigned long long  num_dropped;
+    TRACE_RECORD *      record;
+    unsigned char       drop[sizeof(TRACE_RECORD) + sizeof(TRACE_DROP)];
+    TRACE_DROP          lost;
+    uint64_t            data_len;
+
+
+    /* Get bytes published by the control loop (acquire so the records are complete) */
+    head = __atomic_load_n(&trace->head, __ATOMIC_ACQUIRE);
+
+    /* Loop through each record published */
+    for (tail = trace->tail; tail != head; )
+    {
+        /* Get record */
+        offset = tail & (TRACE_RING_SIZE - 1);
+        record = (TRACE_RECORD *)(trace->ring + offset);
+
+        /* Check if the rest of the ring is unused */
+        if (record->type == TRACE_REC_PAD)
+        {
+            /* Skip to the beginning of the ring */
+            tail += TRACE_RING_SIZE - offset;
+        }
+        else
+        {
+            /* Write record to the file */
+            trace_file_append(trace, record, record->size);
+            tail += record->size;
+        }
+    }
+
+    /* Free drained space for the control loop (release so the records were read first) */
+    __atomic_store_n(&trace->tail, tail, __ATOMIC_RELEASE);
+
+    /* Check if records were dropped since the last drain */
+    num_dropped = __atomic_load_n(&trace->num_dropped, __ATOMIC_RELAXED);
+
+    if (num_dropped != trace->drops_written)
+    {
+        /* Build drop record (tagged with the cycle being recorded) */
+        memset(drop, 0, sizeof(drop));
+        ((TRACE_RECORD *)drop)->type = TRACE_REC_DROP;
+        ((TRACE_RECORD *)drop)->size = sizeof(drop);
+        ((TRACE_RECORD *)drop)->cycle = __atomic_load_n(&trace->cycle, __ATOMIC_RELAXED);
+        lost.num_dropped = num_dropped - trace->drops_written;
+        memcpy(drop + sizeof(TRACE_RECORD), &lost, sizeof(lost));
+
+        /* Write drop record */
+        trace_file_append(trace, drop, sizeof(drop));
+        trace->drops_written = num_dropped;
+    }
+
+    /* Check if file is still being written */
+    if ((trace->fd >= 0) && (!trace->write_error))
+    {
+        /* Update length of records in the header (so a file of a daemon that died can be read) */
+        data_len = trace->file_len - sizeof(TRACE_FILE_HEADER);
+
+        if (pwrite(trace->fd, &data_len, sizeof(data_len), offsetof(TRACE_FILE_HEADER, data_len)) != sizeof(data_len))
+        {
+            /* Stop writing */
+            fprintf(stderr, "%s: error writing trace - tracing stopped\n\r", trace->path);
+            trace->write_error = 1;
+        }
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_file_open
+*
+*   DESCRIPTION
+*
+*       Creates a trace file (replacing any file at the path), maps its
+*       first chunk and writes the file header
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        File started
+*       EXIT_FAILURE                        Error creating or mapping the
+*                                           file (printed to stderr)
+*
+*************************************************************************/
+static int  trace_file_open(TRACE * trace)
+{
+    int                 status = EXIT_SUCCESS;
+    TRACE_FILE_HEADER   header;
+    struct timespec     now;
+
+
+    /* Start with an empty file */
+    trace->file_len = sizeof(TRACE_FILE_HEADER);
+
+    /* Create file */
+    trace->fd = open(trace->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    /* Ensure file created and its first chunk mapped */
+    if ((trace->fd < 0) || (trace_file_map(trace, 0) != EXIT_SUCCESS))
+    {
+        /* Print error */
+        fprintf(stderr, "%s: error creating trace file\n\r", trace->path);
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        /* Fill in header */
+        memset(&header, 0, sizeof(header));
+        clock_gettime(CLOCK_REALTIME, &now);
+        header.magic = TRACE_MAGIC;
+        header.version = TRACE_VERSION;
+        header.source = trace->source;
+        header.sequence = trace->sequence;
+        header.header_size = sizeof(TRACE_FILE_HEADER);
+        header.start_ns = interval_now();
+        header.start_real_ns = ((uint64_t)now.tv_sec * INTERVAL_NSECS_PER_SEC) + now.tv_nsec;
+
+        /* Write header at start of the file */
+        memcpy(trace->map, &header, sizeof(header));
+
+        /* Count file started (the control loop records its domains again) */
+        __atomic_store_n(&trace->num_files, trace->num_files + 1, __ATOMIC_RELEASE);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_file_close
+*
+*   DESCRIPTION
+*
+*       Writes the final length to the header, unmaps the file, trims the
+*       unused part of the last chunk and closes the file
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void trace_file_close(TRACE * trace)
+{
+    uint64_t    data_len = trace->file_len - sizeof(TRACE_FILE_HEADER);
+
+
+    /* Check if a window is mapped */
+    if (trace->map != NULL)
+    {
+        /* Unmap window (the kernel writes the dirty pages back) */
+        munmap(trace->map, trace->map_len);
+        trace->map = NULL;
+    }
+
+    /* Set length of records and trim the file to it (errors are ignored - the file is done) */
+    if (pwrite(trace->fd, &data_len, sizeof(data_len), offsetof(TRACE_FILE_HEADER, data_len)) == sizeof(data_len))
+    {
+        (void)ftruncate(trace->fd, trace->file_len);
+    }
+
+    /* Close file */
+    close(trace->fd);
+    trace->fd = -1;
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_file_map
+*
+*   DESCRIPTION
+*
+*       Maps a TRACE_FILE_CHUNK window of the file starting at the
+*       specified offset, growing the file to hold it
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*       offset                              Offset of window in the file
+*                                           (multiple of the page size)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Window mapped
+*       EXIT_FAILURE                        Error growing or mapping file
+*
+*************************************************************************/
+static int  trace_file_map(TRACE * trace, size_t offset)
+{
+    int     status = EXIT_SUCCESS;
+
+
+    /* Check if a window is mapped */
+    if (trace->map != NULL)
+    {
+        /* Unmap previous window */
+        munmap(trace->map, trace->map_len);
+        trace->map = NULL;
+    }
+
+    /* Grow file to hold the window
+       NOTE:  The file is sparse, so the unused part of the window takes no disk space */
+    if (ftruncate(trace->fd, offset + TRACE_FILE_CHUNK) != 0)
+    {
+        /* Set error status */
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        /* Map window */
+        trace->map = mmap(NULL, TRACE_FILE_CHUNK, PROT_READ | PROT_WRITE, MAP_SHARED, trace->fd, offset);
+
+        /* Ensure window mapped */
+        if (trace->map == MAP_FAILED)
+        {
+            /* Set error status */
+            trace->map = NULL;
+            status = EXIT_FAILURE;
+        }
+        else
+        {
+            /* Save window */
+            trace->map_offset = offset;
+            trace->map_len = TRACE_FILE_CHUNK;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       trace_file_append
+*
+*   DESCRIPTION
+*
+*       Appends a record to the trace file - mapping the next window when
+*       the current one is full and starting a new file (the current one
+*       renamed to <file>.1) when TRACE_MAX_FILE_SIZE is reached.  After a
+*       write error records are discarded
+*
+*   INPUTS
+*
+*       trace                               Pointer to trace
+*       data                                Record to append
+*       len                                 Length of record
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void trace_file_append(TRACE * trace, const void * data, size_t len)
+{
+    char    old_path[PATH_MAX];
+    size_t  page_size = sysconf(_SC_PAGESIZE);
+
+
+    /* Check if file is full */
+    if ((!trace->write_error) && ((trace->file_len + len) > TRACE_MAX_FILE_SIZE))
+    {
+        /* Close file and keep it as the previous file */
+        trace_file_close(trace);
+        snprintf(old_path, sizeof(old_path), "%s.1", trace->path);
+
+        /* Start next file */
+        trace->sequence++;
+
+        if ((rename(trace->path, old_path) != 0) || (trace_file_open(trace) != EXIT_SUCCESS))
+        {
+            /* Stop writing */
+            fprintf(stderr, "%s: error starting next trace file - tracing stopped\n\r", trace->path);
+            trace->write_error = 1;
+        }
+    }
+
+    /* Check if the record is past the mapped window */
+    if ((!trace->write_error) && ((trace->file_len + len) > (trace->map_offset + trace->map_len)))
+    {
+        /* Map window starting at the page holding the end of the file */
+        if (trace_file_map(trace, trace->file_len & ~(page_size - 1)) != EXIT_SUCCESS)
+        {
+            /* Stop writing */
+            fprintf(stderr, "%s: error growing trace file - tracing stopped\n\r", trace->path);
+            trace->write_error = 1;
+        }
+    }
+
+    /* Check if file is still being written */
+    if (!trace->write_error)
+    {
+        /* Copy record into the file */
+        memcpy(trace->map + (trace->file_len - trace->map_offset), data, len);
+        trace->file_len += len;
+    }
+}
@@ -0,0 +1,241 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains binary trace macros, definitions, and
+*       structures used by both the VCPU scheduler and the memory
+*       coordinator to record every control cycle (raw counters,
+*       computed utilizations / masks and each pin / resize decision)
+*       and by the trace decoder (../Trace) to read the records back.
+*       The control loop only copies fixed size records into a lock-free
+*       ring - a writer thread drains the ring into a memory mapped file,
+*       so tracing can stay on in production without slowing the loop
+*
+*       All record fields are fixed width and written in host byte order
+*       (the decoder checks the magic number for a byte order mismatch)
+*
+***********************************************************************/
+#ifndef TRACE_DEFS_H
+#define TRACE_DEFS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+#include "bitmask_defs.h"
+
+/* Trace file magic number ("VTRC" when read as bytes) and format version */
+#define TRACE_MAGIC                         0x43525456
+#define TRACE_VERSION                       1
+
+/* Size of the ring between the control loop and the writer thread in bytes (power of 2) */
+#define TRACE_RING_SIZE                     (1 << 20)
+
+/* Every record is padded to a multiple of this many bytes (so a record never straddles the end
+   of the ring - there is always room for a pad record) */
+#define TRACE_ALIGN                         16
+
+/* Largest record in bytes (a mask record of more bits is truncated) */
+#define TRACE_MAX_RECORD                    1024
+
+/* Time, in milliseconds, the writer thread sleeps between drains of the ring */
+#define TRACE_POLL_MS                       100
+
+/* The file is grown and mapped this many bytes at a time */
+#define TRACE_FILE_CHUNK                    (4 << 20)
+
+/* Once a file reaches this size it is renamed to <file>.1 (replacing the previous one) and a
+   new file is started, so continuous tracing uses at most twice this much disk */
+#define TRACE_MAX_FILE_SIZE                 (256 << 20)
+
+/* Define daemons a trace is recorded by */
+#define TRACE_SOURCE_CPU                    1       /* VCPU scheduler */
+#define TRACE_SOURCE_MEM                    2       /* Memory coordinator */
+
+/* Define record types (type 0 marks the end of the records in a file that wasn't closed) */
+#define TRACE_REC_END                       0
+#define TRACE_REC_PAD                       1       /* Rest of the ring is unused (never written to a file) */
+#define TRACE_REC_DROP                      2       /* Records lost because the ring was full */
+#define TRACE_REC_CYCLE                     3       /* Start of a cycle */
+#define TRACE_REC_DOMAIN                    4       /* Domain added (or all domains after a new file is started) */
+#define TRACE_REC_PCPU                      5       /* PCPU idle counter / utilization */
+#define TRACE_REC_VCPU                      6       /* VCPU time counter / utilization / placement */
+#define TRACE_REC_MASK                      7       /* High / low mask */
+#define TRACE_REC_PIN                       8       /* VCPU pinned (domain added) / repinned */
+#define TRACE_REC_SCHED                     9       /* CPU shares / VCPU quota set */
+#define TRACE_REC_HOST_MEM                  10      /* Host free memory */
+#define TRACE_REC_VM_MEM                    11      /* Balloon stats / pressure of a VM */
+#define TRACE_REC_RESIZE                    12      /* Balloon resized (or resize step) */
+#define TRACE_NUM_TYPES                     13
+
+/* Define masks of a mask record (id of the record) */
+#define TRACE_MASK_PCPU_HIGH                0
+#define TRACE_MASK_PCPU_LOW                 1
+#define TRACE_MASK_MEM_HIGH                 2
+#define TRACE_MASK_MEM_LOW                  3
+
+/* Maximum length of a domain name in a domain record */
+#define TRACE_NAME_LEN                      64
+
+/* Structure at the start of a trace file */
+typedef struct TRACE_FILE_HEADER_STRUCT
+{
+    uint32_t            magic;          /* TRACE_MAGIC */
+    uint16_t            version;        /* TRACE_VERSION */
+    uint16_t            source;         /* TRACE_SOURCE_CPU / MEM */
+    uint32_t            sequence;       /* Number of files started before this one (rotations) */
+    uint32_t            header_size;    /* Size of this header (records start here) */
+    uint64_t            start_ns;       /* Monotonic time (ns) the file was started */
+    uint64_t            start_real_ns;  /* Wall clock time (ns since the epoch) the file was started */
+    uint64_t            data_len;       /* Bytes of records after the header (updated after each drain) */
+    uint64_t            reserved;
+
+} TRACE_FILE_HEADER;
+
+/* Structure at the start of every record */
+typedef struct TRACE_RECORD_STRUCT
+{
+    uint16_t            type;           /* TRACE_REC_xxx */
+    uint16_t            size;           /* Size of the record with its padding */
+    uint32_t            id;             /* Domain ID, PCPU or mask the record is for */
+    uint64_t            cycle;          /* Cycle the record was made in (0 = startup) */
+
+} TRACE_RECORD;
+
+/* Structures for the data after the record header of each record type */
+typedef struct TRACE_DROP_STRUCT
+{
+    uint64_t            num_dropped;    /* Records lost since the last drop record */
+
+} TRACE_DROP;
+
+typedef struct TRACE_CYCLE_STRUCT
+{
+    uint64_t            time_ns;        /* Monotonic time (ns) the cycle started */
+    uint32_t            interval_ms;    /* Interval between cycles */
+    uint32_t            reserved;
+
+} TRACE_CYCLE;
+
+typedef struct TRACE_DOMAIN_STRUCT
+{
+    uint32_t            num_vcpus;      /* Number of VCPUs (VCPU scheduler) */
+    uint32_t            reserved;
+    uint64_t            mem_max;        /* Maximum balloon size in KB (memory coordinator) */
+    char                name[TRACE_NAME_LEN]; /* Domain name (NUL terminated) */
+
+} TRACE_DOMAIN;
+
+typedef struct TRACE_PCPU_STRUCT
+{
+    uint64_t            idle_time;      /* Idle time counter (ns) read */
+    uint64_t            elapsed_ns;     /* Time since the counter was last read */
+    int32_t             cpu_util;       /* Utilization computed % */
+    int32_t             num_pinned;     /* Number of VCPUs pinned */
+
+} TRACE_PCPU;
+
+typedef struct TRACE_VCPU_STRUCT
+{
+    uint32_t            vcpu_num;       /* VCPU number within the domain */
+    int32_t             pcpu;           /* PCPU the VCPU is pinned to */
+    uint64_t            cpu_time;       /* CPU time counter (ns) read */
+    uint64_t            elapsed_ns;     /* Time since the counter was last read */
+    int32_t             cpu_util;       /* Utilization computed % */
+    int32_t             cpu_util_avg;   /* Smoothed utilization % */
+
+} TRACE_VCPU;
+
+typedef struct TRACE_MASK_STRUCT
+{
+    uint32_t            num_bits;       /* Number of bits in the mask */
+    uint32_t            num_words;      /* Number of words recorded (may be fewer than the mask needs) */
+    uint64_t            words[];        /* Mask words (bit 0 is LSB of word 0) */
+
+} TRACE_MASK;
+
+typedef struct TRACE_PIN_STRUCT
+{
+    uint32_t            vcpu_num;       /* VCPU number within the domain */
+    int32_t             from;           /* PCPU the VCPU was pinned to */
+    int32_t             to;             /* PCPU the VCPU is pinned to */
+    int32_t             status;         /* Result of the pin (or of queuing it to the workers) */
+
+} TRACE_PIN;
+
+typedef struct TRACE_SCHED_STRUCT
+{
+    uint64_t            shares;         /* CPU shares set (0 = unchanged) */
+    int64_t             quota;          /* VCPU quota set in us (-1 = none, 0 = unchanged) */
+    uint64_t            period;         /* VCPU quota period set in us (0 = unchanged) */
+
+} TRACE_SCHED;
+
+typedef struct TRACE_HOST_MEM_STRUCT
+{
+    uint64_t            free_mem;       /* Host free memory in KB */
+    uint64_t            total_mem;      /* Host total memory in KB */
+    uint64_t            target_mem;     /* Host free memory target in KB */
+
+} TRACE_HOST_MEM;
+
+typedef struct TRACE_VM_MEM_STRUCT
+{
+    uint64_t            balloon;        /* Balloon size (actual) in KB */
+    uint64_t            unused;         /* Unused memory in KB */
+    uint64_t            usable;         /* Usable memory in KB (if reported) */
+    uint64_t            swap_in;        /* Swapped in since boot in KB (if reported) */
+    uint64_t            swap_out;       /* Swapped out since boot in KB (if reported) */
+    uint64_t            major_faults;   /* Major page faults since boot (if reported) */
+    uint32_t            reported;       /* Stats reported (bits of the daemon's MEM_COORD_STAT_xxx) */
+    int32_t             percent_avail;  /* Available memory computed % */
+    int32_t             pressure;       /* Pressure score computed (0 - 100) */
+    uint32_t            reserved;
+
+} TRACE_VM_MEM;
+
+typedef struct TRACE_RESIZE_STRUCT
+{
+    uint64_t            from;           /* Balloon size before the resize in KB */
+    uint64_t            to;             /* Balloon size set in KB */
+    uint64_t            target;         /* Balloon size the resize is stepping to in KB */
+    int32_t             status;         /* Result of the resize (or of queuing it to the workers) */
+    uint32_t            reserved;
+
+} TRACE_RESIZE;
+
+/* Structure to keep track of a trace being recorded
+   NOTE:  head is only written by the control loop and tail only by the writer thread - each is
+          on its own cache line so the two threads don't slow each other down */
+typedef struct TRACE_STRUCT
+{
+    unsigned char *     ring;           /* Ring of records (NULL = tracing off) */
+    int                 source;         /* TRACE_SOURCE_CPU / MEM */
+    unsigned long long  cycle;          /* Cycle records are made in (control loop) */
+    unsigned long long  num_dropped;    /* Total records lost because the ring was full (control loop) */
+    unsigned int        files_seen;     /* Files started when the control loop last checked */
+    size_t              head __attribute__((aligned(64))); /* Bytes written to the ring (control loop) */
+    size_t              tail __attribute__((aligned(64))); /* Bytes drained from the ring (writer thread) */
+    unsigned int        num_files;      /* Files started (writer thread) */
+    unsigned long long  drops_written;  /* Lost records already recorded in a drop record (writer thread) */
+    const char *        path;           /* Path of the trace file */
+    int                 fd;             /* Trace file (-1 = none) */
+    unsigned char *     map;            /* Mapped window of the file */
+    size_t              map_offset;     /* Offset in the file the window starts at */
+    size_t              map_len;        /* Length of the window */
+    size_t              file_len;       /* Bytes used in the file (header and records) */
+    uint32_t            sequence;       /* Sequence number of the current file */
+    int                 write_error;    /* Non-zero once the file couldn't be written (no more records) */
+    pthread_t           thread;         /* Writer thread */
+    volatile int        run;            /* Non-zero while the writer thread should keep running */
+    int                 started;        /* Non-zero if the writer thread is running */
+
+} TRACE;
+
+/* Trace functions (see trace.c) */
+int     trace_init(TRACE * trace, const char * path, int source);
+void    trace_deinit(TRACE * trace);
+int     trace_cycle(TRACE * trace, unsigned long long cycle, unsigned long long time_ns, unsigned int interval_ms);
+void    trace_write(TRACE * trace, int type, unsigned int id, const void * data, size_t len);
+void    trace_mask(TRACE * trace, unsigned int mask_id, const BITMASK * mask);
+
+#endif /* TRACE_DEFS_H */
@@ -0,0 +1,940 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains worker pool code shared by the VCPU scheduler
+*       and the memory coordinator.  Actuation calls (VCPU pinning /
+*       balloon resizing / CPU shares and quotas) are queued to a small pool of worker threads,
+*       each with its own connection to the hypervisor, so the calls for
+*       different domains run concurrently.  The caller waits for each
+*       batch of calls with a timeout so one unresponsive guest doesn't
+*       stall the whole cycle - calls that time out keep running in the
+*       background and are freed by the worker once they return.
+*
+*   FUNCTIONS
+*
+*       worker_pool_init
+*       worker_pool_deinit
+*       worker_pool_pin_vcpu
+*       worker_pool_set_memory
+*       worker_pool_set_sched
+*       worker_set_sched
+*       worker_pool_wait
+*       worker_job_free
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "interval_defs.h"
+#include "worker_pool_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static int  worker_pool_submit(WORKER_POOL * pool, WORKER_JOB * job, virDomainPtr domain);
+static void * worker_thread(void * arg);
+static void worker_run(WORKER * worker, WORKER_JOB * job);
+static virDomainPtr worker_lookup(WORKER * worker, const unsigned char * uuid);
+static void worker_forget(WORKER * worker, const unsigned char * uuid);
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_pool_init
+*
+*   DESCRIPTION
+*
+*       Opens a connection to the hypervisor for each worker and starts
+*       the worker threads.  A pool with 0 workers is valid but can't run
+*       jobs (callers make their libvirt calls directly instead)
+*
+*   INPUTS
+*
+*       pool                                Pointer to worker pool
+*       uri                                 URI of hypervisor to connect to
+*       num_workers                         Number of workers to start
+*       timeout_ms                          Time, in milliseconds, a caller
+*                                           waits for each call
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Worker pool running
+*       EXIT_FAILURE                        Error connecting to hypervisor,
+*                                           with memory allocation, or
+*                                           starting threads
+*
+*************************************************************************/
+int worker_pool_init(WORKER_POOL * pool, const char * uri, int num_workers, unsigned int timeout_ms)
+{
+    int                 index, status = EXIT_SUCCESS;
+    pthread_condattr_t  attr;
+
+
+    /* Initialize an empty pool */
+    memset(pool, 0, sizeof(WORKER_POOL));
+    pool->timeout_ms = timeout_ms;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+
+    /* Wait for done jobs using the monotonic clock (same as cycle deadlines) */
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&pool->done_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    /* Check if workers are used (and not too many) */
+    if ((num_workers > 0) && (num_workers <= WORKER_POOL_MAX_WORKERS))
+    {
+        /* Allocate workers */
+        pool->workers = calloc(num_workers, sizeof(WORKER));
+
+        /* Ensure memory allocated */
+        if (pool->workers == NULL)
+        {
+            /* Set error status */
+            status = EXIT_FAILURE;
+        }
+    }
+    else if (num_workers != 0)
+    {
+        /* Invalid number of workers */
+        status = EXIT_FAILURE;
+    }
+
+    /* Loop through each worker while no errors */
+    for (index = 0; (index < num_workers) && (status == EXIT_SUCCESS); index++)
+    {
+        /* Count this worker (so deinit cleans it up) */
+        pool->num_workers++;
+        pool->workers[index].pool = pool;
+
+        /* Open this worker's own connection so its calls don't wait on other workers' calls */
+        pool->workers[index].conn = virConnectOpen(uri);
+
+        /* Ensure connected and thread started */
+        if ((pool->workers[index].conn == NULL) ||
+            (pthread_create(&pool->workers[index].thread, NULL, worker_thread, &pool->workers[index]) != 0))
+        {
+            /* Set error status */
+            status = EXIT_FAILURE;
+        }
+        else
+        {
+            /* Thread running */
+            pool->workers[index].started = 1;
+        }
+    }
+
+    /* Check if pool couldn't be started */
+    if (status != EXIT_SUCCESS)
+    {
+        /* Stop the workers already started */
+        worker_pool_deinit(pool);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_pool_deinit
+*
+*   DESCRIPTION
+*
+*       Stops the worker threads, frees all jobs left in the pool and
+*       closes the worker connections.  Waits for any call still running
+*       to return
+*
+*   INPUTS
+*
+*       pool                                Pointer to worker pool
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void worker_pool_deinit(WORKER_POOL * pool)
+{
+    int             index, entry;
+    WORKER_JOB *    job;
+    WORKER_JOB *    next;
+
+
+    /* Tell the workers to stop */
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    /* Loop through each worker */
+    for (index = 0; index < pool->num_workers; index++)
+    {
+        /* Check if thread is running */
+        if (pool->workers[index].started)
+        {
+            /* Wait for the worker to finish its current call */
+            pthread_join(pool->workers[index].thread, NULL);
+            pool->workers[index].started = 0;
+        }
+
+        /* Release cached domains */
+        for (entry = 0; entry < WORKER_POOL_CACHE_SIZE; entry++)
+        {
+            if (pool->workers[index].cache[entry].domain != NULL)
+            {
+                virDomainFree(pool->workers[index].cache[entry].domain);
+            }
+        }
+
+        /* Close worker connection */
+        if (pool->workers[index].conn != NULL)
+        {
+            virConnectClose(pool->workers[index].conn);
+        }
+    }
+
+    /* Free jobs never waited for (every job left is on one of these lists) */
+    for (job = pool->batch; job != NULL; job = next)
+    {
+        next = job->batch_next;
+        worker_job_free(job);
+    }
+
+    for (job = pool->abandoned; job != NULL; job = next)
+    {
+        next = job->batch_next;
+        worker_job_free(job);
+    }
+
+    /* Free workers */
+    free(pool->workers);
+    pool->workers = NULL;
+    pool->num_workers = 0;
+    pool->head = NULL;
+    pool->tail = NULL;
+    pool->batch = NULL;
+    pool->abandoned = NULL;
+
+    /* Done with the pool */
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_pool_pin_vcpu
+*
+*   DESCRIPTION
+*
+*       Queues a call to pin a VCPU of a domain to the specified cpumap
+*
+*   INPUTS
+*
+*       pool                                Pointer to worker pool
+*       domain                              Domain (on the caller's connection)
+*       vcpu                                VCPU number to pin
+*       cpumap                              CPU map to pin the VCPU to
+*                                           (copied)
+*       maplen                              Number of bytes in cpumap
+*       context                             Caller's data returned with
+*                                           the result
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Call queued
+*       WORKER_POOL_DOMAIN_BUSY             Earlier call for the domain
+*                                           timed out and is still running
+*       EXIT_FAILURE                        Error with memory allocation
+*
+*************************************************************************/
+int worker_pool_pin_vcpu(WORKER_POOL * pool, virDomainPtr domain, unsigned int vcpu,
+                         const unsigned char * cpumap, int maplen, void * context)
+{
+    WORKER_JOB *    job;
+
+
+    /* Allocate job with room for a copy of the cpumap */
+    job = calloc(1, sizeof(WORKER_JOB) + maplen);
+
+    /* Ensure memory allocated */
+    if (job != NULL)
+    {
+        /* Fill in pin call */
+        job->type = WORKER_JOB_PIN_VCPU;
+        job->vcpu = vcpu;
+        job->cpumap = (unsigned char *)(job + 1);
+        job->maplen = maplen;
+        job->context = context;
+        memcpy(job->cpumap, cpumap, maplen);
+    }
+
+    /* Queue job */
+    return (worker_pool_submit(pool, job, domain));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_pool_set_memory
+*
+*   DESCRIPTION
+*
+*       Queues a call to set the balloon size of a domain
+*
+*   INPUTS
+*
+*       pool                                Pointer to worker pool
+*       domain                              Domain (on the caller's connection)
+*       memory                              New balloon size in KB
+*       context                             Caller's data returned with
+*                                           the result
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Call queued
+*       WORKER_POOL_DOMAIN_BUSY             Earlier call for the domain
+*                                           timed out and is still running
+*       EXIT_FAILURE                        Error with memory allocation
+*
+*************************************************************************/
+int worker_pool_set_memory(WORKER_POOL * pool, virDomainPtr domain, unsigned long memory, void * context)
+{
+    WORKER_JOB *    job;
+
+
+    /* Allocate job */
+    job = calloc(1, sizeof(WORKER_JOB));
+
+    /* Ensure memory allocated */
+    if (job != NULL)
+    {
+        /* Fill in set memory call */
+        job->type = WORKER_JOB_SET_MEMORY;
+        job->memory = memory;
+        job->context = context;
+    }
+
+    /* Queue job */
+    return (worker_pool_submit(pool, job, domain));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_pool_set_sched
+*
+*   DESCRIPTION
+*
+*       Queues a call to set the CPU shares and / or VCPU quota of a
+*       domain (see worker_set_sched)
+*
+*   INPUTS
+*
+*       pool                                Pointer to worker pool
+*       domain                              Domain (on the caller's connection)
+*       shares                              New CPU shares (0 = unchanged)
+*       quota                               New VCPU quota in us per period
+*                                           (-1 = no quota, 0 = unchanged)
+*       period                              New VCPU quota period in us
+*                                           (0 = unchanged)
+*       context                             Caller's data returned with
+*                                           the result
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Call queued
+*       WORKER_POOL_DOMAIN_BUSY             Earlier call for the domain
+*                                           timed out and is still running
+*       EXIT_FAILURE                        Error with memory allocation
+*
+*************************************************************************/
+int worker_pool_set_sched(WORKER_POOL * pool, virDomainPtr domain, unsigned long long shares,
+                          long long quota, unsigned long long period, void * context)
+{
+    WORKER_JOB *    job;
+
+
+    /* Allocate job */
+    job = calloc(1, sizeof(WORKER_JOB));
+
+    /* Ensure memory allocated */
+    if (job != NULL)
+    {
+        /* Fill in set sched call */
+        job->type = WORKER_JOB_SET_SCHED;
+        job->shares = shares;
+        job->quota = quota;
+        job->period = period;
+        job->context = context;
+    }
+
+    /* Queue job */
+    return (worker_pool_submit(pool, job, domain));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_set_sched
+*
+*   DESCRIPTION
+*
+*       Sets the CPU shares (relative weight of the domain when PCPUs are
+*       contended) and the VCPU quota (time each VCPU may run per period)
+*       of a running domain.  Only the parameters given are changed.  Used
+*       by the workers and by callers making the call directly
+*
+*   INPUTS
+*
+*       domain                              Domain to change
+*       shares                              New CPU shares (0 = unchanged)
+*       quota                               New VCPU quota in us per period
+*                                           (-1 = no quota, 0 = unchanged)
+*       period                              New VCPU quota period in us
+*                                           (0 = unchanged)
+*
+*   OUTPUTS
+*
+*       0                                   Parameters set
+*       -1                                  Error setting parameters (see
+*                                           virGetLastError)
+*
+*************************************************************************/
+int worker_set_sched(virDomainPtr domain, unsigned long long shares, long long quota, unsigned long long period)
+{
+    virTypedParameter   params[WORKER_SCHED_MAX_PARAMS];
+    int                 num_params = 0;
+
+
+    /* Clear parameters (field names must be NUL terminated) */
+    memset(params, 0, sizeof(params));
+
+    /* Check if shares are changed */
+    if (shares != 0)
+    {
+        /* Add CPU shares */
+        strncpy(params[num_params].field, VIR_DOMAIN_SCHEDULER_CPU_SHARES, VIR_TYPED_PARAM_FIELD_LENGTH - 1);
+        params[num_params].type = VIR_TYPED_PARAM_ULLONG;
+        params[num_params].value.ul = shares;
+        num_params++;
+    }
+
+    /* Check if period is changed (set before the quota it applies to) */
+    if (period != 0)
+    {
+        /* Add VCPU quota period */
+        strncpy(params[num_params].field, VIR_DOMAIN_SCHEDULER_VCPU_PERIOD, VIR_TYPED_PARAM_FIELD_LENGTH - 1);
+        params[num_params].type = VIR_TYPED_PARAM_ULLONG;
+        params[num_params].value.ul = period;
+        num_params++;
+    }
+
+    /* Check if quota is changed */
+    if (quota != 0)
+    {
+        /* Add VCPU quota */
+        strncpy(params[num_params].field, VIR_DOMAIN_SCHEDULER_VCPU_QUOTA, VIR_TYPED_PARAM_FIELD_LENGTH - 1);
+        params[num_params].type = VIR_TYPED_PARAM_LLONG;
+        params[num_params].value.l = quota;
+        num_params++;
+    }
+
+    /* Set parameters of the running domain (nothing to do if none changed) */
+    return ((num_params == 0) ? 0 : virDomainSetSchedulerParametersFlags(domain, params, num_params, VIR_DOMAIN_AFFECT_LIVE));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_pool_wait
+*
+*   DESCRIPTION
+*
+*       Waits for all calls queued since the last wait to return, or until
+*       the timeout of each call that hasn't returned has expired.  Calls
+*       that timed out keep running and are freed by the worker once they
+*       return (later calls for the same domain are refused until then)
+*
+*   INPUTS
+*
+*       pool                                Pointer to worker pool
+*       done                                Pointer to return list of
+*                                           calls that returned (linked by
+*                                           batch_next - caller frees each
+*                                           with worker_job_free)
+*
+*   OUTPUTS
+*
+*       int                                 Number of calls that timed out
+*
+*************************************************************************/
+int worker_pool_wait(WORKER_POOL * pool, WORKER_JOB ** done)
+{
+    WORKER_JOB *        job;
+    WORKER_JOB *        next;
+    unsigned long long  deadline = 0;
+    struct timespec     wait_time;
+    int                 pending, waiting = 1, num_timeouts = 0;
+
+
+    /* Start with no jobs done */
+    *done = NULL;
+
+    /* Protect job states */
+    pthread_mutex_lock(&pool->lock);
+
+    /* Loop until all jobs are done or the latest deadline passes */
+    while (waiting)
+    {
+        /* Count jobs not done yet and find the latest deadline */
+        for (pending = 0, job = pool->batch; job != NULL; job = job->batch_next)
+        {
+            pending += (job->state != WORKER_JOB_DONE);
+            deadline = ((job->deadline > deadline) ? job->deadline : deadline);
+        }
+
+        /* Check if still waiting on jobs */
+        if ((pending) && (interval_now() < deadline))
+        {
+            /* Wait for a job to be done (or the deadline) */
+            wait_time.tv_sec = deadline / INTERVAL_NSECS_PER_SEC;
+            wait_time.tv_nsec = deadline % INTERVAL_NSECS_PER_SEC;
+            pthread_cond_timedwait(&pool->done_cond, &pool->lock, &wait_time);
+        }
+        else
+        {
+            /* Done waiting */
+            waiting = 0;
+        }
+    }
+
+    /* Loop through each job in the batch */
+    for (job = pool->batch; job != NULL; job = next)
+    {
+        /* Save next job (the link is reused below) */
+        next = job->batch_next;
+
+        /* Check if job is done */
+        if (job->state == WORKER_JOB_DONE)
+        {
+            /* Return job to caller */
+            job->batch_next = *done;
+            *done = job;
+        }
+        else
+        {
+            /* Timed out - worker frees the job once it's done */
+            job->abandoned = 1;
+            job->batch_next = pool->abandoned;
+            pool->abandoned = job;
+
+            /* Count timed out call */
+            num_timeouts++;
+        }
+    }
+
+    /* Start a new batch */
+    pool->batch = NULL;
+    pool->num_timeouts += num_timeouts;
+
+    /* Done with job states */
+    pthread_mutex_unlock(&pool->lock);
+
+    /* Return number of timed out calls to caller */
+    return (num_timeouts);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_job_free
+*
+*   DESCRIPTION
+*
+*       Frees a job (and its copy of the cpumap)
+*
+*   INPUTS
+*
+*       job                                 Pointer to job to free
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void worker_job_free(WORKER_JOB * job)
+{
+    /* Free job (cpumap is allocated with the job) */
+    free(job);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_pool_submit
+*
+*   DESCRIPTION
+*
+*       Queues a filled in job for the next free worker and adds it to
+*       the current batch.  The job is freed if it can't be queued
+*
+*   INPUTS
+*
+*       pool                                Pointer to worker pool
+*       job                                 Job to queue (NULL if the
+*                                           job couldn't be allocated)
+*       domain                              Domain the job is for
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Job queued
+*       WORKER_POOL_DOMAIN_BUSY             Earlier call for the domain
+*                                           timed out and is still running
+*       EXIT_FAILURE                        Error with memory allocation,
+*                                           getting the domain UUID, or no
+*                                           workers in the pool
+*
+*************************************************************************/
+static int  worker_pool_submit(WORKER_POOL * pool, WORKER_JOB * job, virDomainPtr domain)
+{
+    int             status = EXIT_SUCCESS;
+    WORKER_JOB *    busy;
+
+
+    /* Ensure job allocated, the pool has workers and the domain UUID is known
+       (domains are looked up by UUID on each worker's connection) */
+    if ((job == NULL) || (pool->num_workers == 0) || (virDomainGetUUID(domain, job->uuid) != 0))
+    {
+        /* Set error status */
+        status = EXIT_FAILURE;
+    }
+    else
+    {
+        /* Protect job lists */
+        pthread_mutex_lock(&pool->lock);
+
+        /* Loop through timed out calls looking for one on the same domain */
+        for (busy = pool->abandoned;
+             (busy != NULL) && (memcmp(busy->uuid, job->uuid, VIR_UUID_BUFLEN) != 0);
+             busy = busy->batch_next);
+
+        /* Check if the domain is still busy with a timed out call */
+        if (busy != NULL)
+        {
+            /* Don't tie up another worker on this domain */
+            status = WORKER_POOL_DOMAIN_BUSY;
+        }
+        else
+        {
+            /* Set time the caller stops waiting for this call */
+            job->deadline = interval_now() + (pool->timeout_ms * INTERVAL_NSECS_PER_MSEC);
+            job->state = WORKER_JOB_QUEUED;
+
+            /* Add job to end of the queue */
+            if (pool->tail == NULL)
+            {
+                pool->head = job;
+            }
+            else
+            {
+                pool->tail->next = job;
+            }
+
+            pool->tail = job;
+
+            /* Add job to the current batch */
+            job->batch_next = pool->batch;
+            pool->batch = job;
+
+            /* Wake up a worker */
+            pthread_cond_signal(&pool->work_cond);
+        }
+
+        /* Done with job lists */
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    /* Check if job wasn't queued */
+    if ((status != EXIT_SUCCESS) && (job != NULL))
+    {
+        /* Free job */
+        worker_job_free(job);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_thread
+*
+*   DESCRIPTION
+*
+*       Worker thread - runs queued jobs (oldest first) until the pool
+*       is stopped
+*
+*   INPUTS
+*
+*       arg                                 Pointer to worker
+*
+*   OUTPUTS
+*
+*       NULL                                Always
+*
+*************************************************************************/
+static void * worker_thread(void * arg)
+{
+    WORKER *        worker = arg;
+    WORKER_POOL *   pool = worker->pool;
+    WORKER_JOB *    job;
+    WORKER_JOB **   link;
+
+
+    /* Protect job lists */
+    pthread_mutex_lock(&pool->lock);
+
+    /* Loop until told to stop */
+    while (!pool->stop)
+    {
+        /* Check if a job is waiting */
+        if (pool->head != NULL)
+        {
+            /* Take oldest job off the queue */
+            job = pool->head;
+            pool->head = job->next;
+            pool->tail = (pool->head == NULL ? NULL : pool->tail);
+            job->state = WORKER_JOB_RUNNING;
+
+            /* Make the libvirt call without holding the lock */
+            pthread_mutex_unlock(&pool->lock);
+            worker_run(worker, job);
+            pthread_mutex_lock(&pool->lock);
+
+            /* Job is done */
+            job->state = WORKER_JOB_DONE;
+
+            /* Check if the caller stopped waiting for this job */
+            if (job->abandoned)
+            {
+                /* Find and remove job from the timed out list */
+                for (link = &pool->abandoned; *link != job; link = &(*link)->batch_next);
+                *link = job->batch_next;
+
+                /* Free job */
+                worker_job_free(job);
+            }
+            else
+            {
+                /* Wake up the caller */
+                pthread_cond_broadcast(&pool->done_cond);
+            }
+        }
+        else
+        {
+            /* Wait for a job */
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+    }
+
+    /* Done with job lists */
+    pthread_mutex_unlock(&pool->lock);
+
+    /* Thread is done */
+    return (NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_run
+*
+*   DESCRIPTION
+*
+*       Makes the libvirt call for a job on the worker's connection and
+*       saves the result in the job
+*
+*   INPUTS
+*
+*       worker                              Pointer to worker
+*       job                                 Job to run
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void worker_run(WORKER * worker, WORKER_JOB * job)
+{
+    virDomainPtr    domain;
+    int             status = -1;
+
+
+    /* Get domain on this worker's connection */
+    domain = worker_lookup(worker, job->uuid);
+
+    /* Ensure domain found */
+    if (domain != NULL)
+    {
+        /* Check which call to make */
+        if (job->type == WORKER_JOB_PIN_VCPU)
+        {
+            /* Pin VCPU */
+            status = virDomainPinVcpu(domain, job->vcpu, job->cpumap, job->maplen);
+        }
+        else if (job->type == WORKER_JOB_SET_SCHED)
+        {
+            /* Set CPU shares / VCPU quota */
+            status = worker_set_sched(domain, job->shares, job->quota, job->period);
+        }
+        else
+        {
+            /* Set balloon size */
+            status = virDomainSetMemory(domain, job->memory);
+        }
+
+        /* Check if call failed */
+        if (status != 0)
+        {
+            /* Look the domain up again next time (it may have been restarted) */
+            worker_forget(worker, job->uuid);
+        }
+    }
+
+    /* Save result */
+    job->status = status;
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_lookup
+*
+*   DESCRIPTION
+*
+*       Gets a domain on the worker's connection by UUID.  Lookups are
+*       cached so each call doesn't need an extra round trip to the
+*       hypervisor - the oldest entry is replaced when the cache is full
+*
+*   INPUTS
+*
+*       worker                              Pointer to worker
+*       uuid                                UUID of domain
+*
+*   OUTPUTS
+*
+*       virDomainPtr                        Domain (owned by the cache)
+*       NULL                                Domain not found
+*
+*************************************************************************/
+static virDomainPtr worker_lookup(WORKER * worker, const unsigned char * uuid)
+{
+    int                     entry;
+    WORKER_CACHE_ENTRY *    cache = worker->cache;
+
+
+    /* Loop through cache looking for the domain */
+    for (entry = 0; entry < WORKER_POOL_CACHE_SIZE; entry++)
+    {
+        /* Check if domain is cached */
+        if ((cache[entry].domain != NULL) && (memcmp(cache[entry].uuid, uuid, VIR_UUID_BUFLEN) == 0))
+        {
+            /* Return cached domain */
+            return (cache[entry].domain);
+        }
+    }
+
+    /* Get entry to replace */
+    entry = worker->cache_next;
+    worker->cache_next = (worker->cache_next + 1) % WORKER_POOL_CACHE_SIZE;
+
+    /* Release domain being replaced */
+    if (cache[entry].domain != NULL)
+    {
+        virDomainFree(cache[entry].domain);
+    }
+
+    /* Look up domain and save it in the cache */
+    memcpy(cache[entry].uuid, uuid, VIR_UUID_BUFLEN);
+    cache[entry].domain = virDomainLookupByUUID(worker->conn, uuid);
+
+    /* Return domain (NULL if not found) */
+    return (cache[entry].domain);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       worker_forget
+*
+*   DESCRIPTION
+*
+*       Removes a domain from the worker's lookup cache
+*
+*   INPUTS
+*
+*       worker                              Pointer to worker
+*       uuid                                UUID of domain
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void worker_forget(WORKER * worker, const unsigned char * uuid)
+{
+    int                     entry;
+    WORKER_CACHE_ENTRY *    cache = worker->cache;
+
+
+    /* Loop through cache looking for the domain */
+    for (entry = 0; entry < WORKER_POOL_CACHE_SIZE; entry++)
+    {
+        /* Check if domain is cached */
+        if ((cache[entry].domain != NULL) && (memcmp(cache[entry].uuid, uuid, VIR_UUID_BUFLEN) == 0))
+        {
+            /* Release domain and free the entry */
+            virDomainFree(cache[entry].domain);
+            cache[entry].domain = NULL;
+        }
+    }
+}
@@ -0,0 +1,113 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains worker pool macros, definitions, and
+*       structures used by both the VCPU scheduler and the memory
+*       coordinator to issue libvirt actuation calls (VCPU pinning /
+*       balloon resizing / CPU shares and quotas) concurrently.  Each worker thread has its own
+*       connection to the hypervisor so a slow call for one domain
+*       doesn't hold up the calls for any other domain
+*
+***********************************************************************/
+#ifndef WORKER_POOL_DEFS_H
+#define WORKER_POOL_DEFS_H
+
+#include <pthread.h>
+#include <libvirt/libvirt.h>
+
+/* Define types of jobs a worker can run */
+#define WORKER_JOB_PIN_VCPU                 0       /* virDomainPinVcpu */
+#define WORKER_JOB_SET_MEMORY               1       /* virDomainSetMemory */
+#define WORKER_JOB_SET_SCHED                2       /* virDomainSetSchedulerParametersFlags */
+
+/* Number of scheduler parameters a set sched job can change (cpu_shares, vcpu_period, vcpu_quota) */
+#define WORKER_SCHED_MAX_PARAMS             3
+
+/* Define job states */
+#define WORKER_JOB_QUEUED                   0       /* Waiting for a worker */
+#define WORKER_JOB_RUNNING                  1       /* Worker is calling libvirt */
+#define WORKER_JOB_DONE                     2       /* Call returned (status is set) */
+
+/* Maximum number of workers (connections) in a pool */
+#define WORKER_POOL_MAX_WORKERS             32
+
+/* Number of domain lookups (by UUID) cached per worker connection */
+#define WORKER_POOL_CACHE_SIZE              32
+
+/* Define job submit status (in addition to EXIT_SUCCESS / EXIT_FAILURE) */
+#define WORKER_POOL_DOMAIN_BUSY             2       /* An earlier call for the domain timed out and is still running */
+
+/* Structure for a single libvirt call run by a worker */
+typedef struct WORKER_JOB_STRUCT
+{
+    int                             type;       /* WORKER_JOB_PIN_VCPU / SET_MEMORY / SET_SCHED */
+    unsigned char                   uuid[VIR_UUID_BUFLEN]; /* Domain the call is for */
+    unsigned int                    vcpu;       /* VCPU to pin (pin jobs) */
+    unsigned char *                 cpumap;     /* Copy of the cpumap to pin to (pin jobs) */
+    int                             maplen;     /* Number of bytes in cpumap (pin jobs) */
+    unsigned long                   memory;     /* New balloon size in KB (set memory jobs) */
+    unsigned long long              shares;     /* New CPU shares (set sched jobs - 0 = unchanged) */
+    long long                       quota;      /* New VCPU quota in us (set sched jobs - -1 = none, 0 = unchanged) */
+    unsigned long long              period;     /* New VCPU quota period in us (set sched jobs - 0 = unchanged) */
+    void *                          context;    /* Caller's data for matching the result */
+    int                             state;      /* WORKER_JOB_QUEUED / RUNNING / DONE */
+    int                             abandoned;  /* Non-zero once the caller stopped waiting (timed out) */
+    int                             status;     /* Result of the libvirt call (0 = success) */
+    unsigned long long              deadline;   /* Monotonic time (ns) the caller stops waiting */
+    struct WORKER_JOB_STRUCT *      next;       /* Next job waiting for a worker */
+    struct WORKER_JOB_STRUCT *      batch_next; /* Next job in the same batch / abandoned list */
+
+} WORKER_JOB;
+
+/* Structure for a domain looked up on a worker's connection */
+typedef struct WORKER_CACHE_ENTRY_STRUCT
+{
+    unsigned char                   uuid[VIR_UUID_BUFLEN];
+    virDomainPtr                    domain;     /* Domain on the worker's connection (NULL = unused) */
+
+} WORKER_CACHE_ENTRY;
+
+/* Structure to keep track of a single worker thread */
+typedef struct WORKER_STRUCT
+{
+    pthread_t                       thread;
+    virConnectPtr                   conn;       /* Worker's own connection to the hypervisor */
+    WORKER_CACHE_ENTRY              cache[WORKER_POOL_CACHE_SIZE];
+    int                             cache_next; /* Next cache entry to replace when full */
+    int                             started;    /* Non-zero if thread is running */
+    struct WORKER_POOL_STRUCT *     pool;       /* Pool this worker belongs to */
+
+} WORKER;
+
+/* Structure to keep track of a pool of workers */
+typedef struct WORKER_POOL_STRUCT
+{
+    int                 num_workers;    /* Number of workers (0 = pool not used) */
+    unsigned int        timeout_ms;     /* Time a caller waits for each call */
+    WORKER *            workers;
+    pthread_mutex_t     lock;           /* Protects the job lists / states */
+    pthread_cond_t      work_cond;      /* Signaled when a job is queued (or the pool stops) */
+    pthread_cond_t      done_cond;      /* Signaled when a job is done */
+    WORKER_JOB *        head;           /* Oldest job waiting for a worker */
+    WORKER_JOB *        tail;           /* Newest job waiting for a worker */
+    WORKER_JOB *        batch;          /* Jobs submitted since the last wait */
+    WORKER_JOB *        abandoned;      /* Timed out jobs not done yet (freed by the worker) */
+    int                 stop;           /* Non-zero when workers should exit */
+    unsigned long long  num_timeouts;   /* Total number of calls that timed out */
+
+} WORKER_POOL;
+
+/* Worker pool functions (see worker_pool.c) */
+int     worker_pool_init(WORKER_POOL * pool, const char * uri, int num_workers, unsigned int timeout_ms);
+void    worker_pool_deinit(WORKER_POOL * pool);
+int     worker_pool_pin_vcpu(WORKER_POOL * pool, virDomainPtr domain, unsigned int vcpu,
+                             const unsigned char * cpumap, int maplen, void * context);
+int     worker_pool_set_memory(WORKER_POOL * pool, virDomainPtr domain, unsigned long memory, void * context);
+int     worker_pool_set_sched(WORKER_POOL * pool, virDomainPtr domain, unsigned long long shares,
+                              long long quota, unsigned long long period, void * context);
+int     worker_set_sched(virDomainPtr domain, unsigned long long shares, long long quota, unsigned long long period);
+int     worker_pool_wait(WORKER_POOL * pool, WORKER_JOB ** done);
+void    worker_job_free(WORKER_JOB * job);
+
+#endif /* WORKER_POOL_DEFS_H */
@@ -0,0 +1,116 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the XML attribute helpers used by both the
+*       VCPU scheduler and the memory coordinator to read the few values
+*       they need from the XML libvirt returns (host capabilities /
+*       domain definitions) without an XML parser
+*
+***********************************************************************/
+#ifndef XML_DEFS_H
+#define XML_DEFS_H
+
+#include <stdlib.h>
+#include <string.h>
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       xml_attr_find
+*
+*   DESCRIPTION
+*
+*       Finds the value of an attribute within an XML tag
+*
+*   INPUTS
+*
+*       tag                                 Start of XML tag
+*       name                                Name of attribute
+*
+*   OUTPUTS
+*
+*       const char *                        Start of attribute value
+*                                           (after opening quote)
+*       NULL                                Attribute not in tag
+*
+*************************************************************************/
+static inline const char * xml_attr_find(const char * tag, const char * name)
+{
+    const char *    tag_end = strchr(tag, '>');
+    const char *    attr = tag;
+    size_t          name_len = strlen(name);
+
+
+    /* Loop through each occurrence of the name within the tag */
+    while ((tag_end != NULL) && ((attr = strstr(attr + 1, name)) != NULL) && (attr < tag_end))
+    {
+        /* Check if this is the whole attribute name followed by a quoted value */
+        if ((attr[-1] == ' ') && (attr[name_len] == '=') &&
+            ((attr[name_len + 1] == '\'') || (attr[name_len + 1] == '"')))
+        {
+            /* Return start of value */
+            return (&attr[name_len + 2]);
+        }
+    }
+
+    /* Not found */
+    return (NULL);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       xml_attr_int
+*
+*   DESCRIPTION
+*
+*       Gets the integer value of an attribute within an XML tag
+*
+*   INPUTS
+*
+*       tag                                 Start of XML tag
+*       name                                Name of attribute
+*       value                               Pointer to returned value
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Value returned
+*       EXIT_FAILURE                        Attribute not in tag or not
+*                                           an integer
+*
+*************************************************************************/
+static inline int xml_attr_int(const char * tag, const char * name, int * value)
+{
+    const char *    attr = xml_attr_find(tag, name);
+    char *          end;
+    long            number;
+
+
+    /* Ensure attribute found */
+    if (attr == NULL)
+    {
+        /* Not found */
+        return (EXIT_FAILURE);
+    }
+
+    /* Convert value */
+    number = strtol(attr, &end, 10);
+
+    /* Ensure value was a number */
+    if (end == attr)
+    {
+        /* Not a number */
+        return (EXIT_FAILURE);
+    }
+
+    /* Return value */
+    *value = (int)number;
+    return (EXIT_SUCCESS);
+}
+
+#endif /* XML_DEFS_H */
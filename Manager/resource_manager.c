@@ -0,0 +1,675 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains Resource Manager code that runs the VCPU
+*       scheduler and the memory coordinator policies in a single daemon.
+*       Both policies share one hypervisor connection, one set of domain
+*       events and one stats snapshot per cycle.
+*
+*   FUNCTIONS
+*
+*       main
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "resource_manager_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static int  manager_options(int argc, char ** argv, unsigned int * interval_ms);
+static int  manager(void);
+static int  manager_cycle(int * busy);
+static int  manager_init(void);
+static int  manager_domains_init(void);
+static int  manager_domain_event(int type, virDomainPtr domain);
+static int  domain_events_process(void);
+static void manager_deinit(void);
+
+/*****************************/
+/* LOCAL VARIABLES           */
+/*****************************/
+static MANAGER_INFO         mgr_info;
+static unsigned int         adapt_min_ms;   /* Shortest adaptive interval set with -a (0 = not adaptive) */
+static unsigned int         adapt_max_ms;   /* Longest adaptive interval set with -a */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       main
+*
+*   DESCRIPTION
+*
+*       C entry function
+*
+*   INPUTS
+*
+*       argc                                Number of parameters
+*       argv                                Array of parameters
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Application successfully executed
+*       EXIT_FAILURE                        Error in running application
+*
+*************************************************************************/
+int main(int argc, char ** argv)
+{
+    int                 status = EXIT_FAILURE;
+    unsigned int        interval_ms = 0;
+
+
+    /* Check if command-line parameters are valid */
+    if (!manager_options(argc, argv, &interval_ms))
+    {
+        /* Print error / usage */
+        fprintf(stderr, "Usage:  %s [-a <min>,<max>] <time interval> [%s <scheduler options>] [%s <coordinator options>]\n\r",
+                argv[0], RESOURCE_MANAGER_CPU_ARG, RESOURCE_MANAGER_MEM_ARG);
+        fprintf(stderr, "        where <time interval> = time, in seconds, between cycles of both policies (ie 1, 0.5).\n\r");
+        fprintf(stderr, "              -a <min>,<max>  = adapt time interval between <min> and <max> seconds (default off).\n\r");
+        fprintf(stderr, "              %s <options>  = vcpu_scheduler options (see ../CPU/Readme).\n\r",
+                RESOURCE_MANAGER_CPU_ARG);
+        fprintf(stderr, "              %s <options>  = memory_coordinator options (see ../Memory/Readme).\n\r",
+                RESOURCE_MANAGER_MEM_ARG);
+    }
+    else
+    {
+        /* Start timing cycles (adaptive if a range was set with -a) */
+        interval_init(&mgr_info.interval, interval_ms, adapt_min_ms, adapt_max_ms);
+
+        /* Connect to the hypervisor and register for domain events */
+        status = manager_init();
+
+        /* Ensure connected successfully */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Initialize the VCPU scheduler on the shared connection */
+            status = vcpu_policy_init(mgr_info.conn);
+
+            /* Ensure VCPU scheduler initialized */
+            if (status == EXIT_SUCCESS)
+            {
+                /* Initialize the memory coordinator on the shared connection */
+                status = mem_policy_init(mgr_info.conn);
+
+                /* Ensure memory coordinator initialized */
+                if (status == EXIT_SUCCESS)
+                {
+                    /* Add the domains already running to both policies */
+                    status = manager_domains_init();
+
+                    /* Check if domains added */
+                    if (status == EXIT_SUCCESS)
+                    {
+                        /* Run both policies each cycle */
+                        status = manager();
+                    }
+
+                    /* Deinit the memory coordinator */
+                    mem_policy_deinit();
+                }
+
+                /* Deinit the VCPU scheduler */
+                vcpu_policy_deinit();
+            }
+
+            /* Disconnect from the hypervisor */
+            manager_deinit();
+        }
+
+        /* Check if error returned */
+        if (status != EXIT_SUCCESS)
+        {
+            /* Print error */
+            fprintf(stderr, "Exit error code = %d\n\r", status);
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       manager_options
+*
+*   DESCRIPTION
+*
+*       Parses the command-line parameters.  The parameters are split at
+*       RESOURCE_MANAGER_CPU_ARG / RESOURCE_MANAGER_MEM_ARG - the resource
+*       manager's own options and time interval come first, followed by
+*       the options of each policy (parsed by the policy itself)
+*
+*   INPUTS
+*
+*       argc                                Number of parameters
+*       argv                                Array of parameters
+*       interval_ms                         Pointer to return time
+*                                           interval in milliseconds
+*
+*   OUTPUTS
+*
+*       1                                   Parameters valid
+*       0                                   Parameters invalid (show usage)
+*
+*************************************************************************/
+static int  manager_options(int argc, char ** argv, unsigned int * interval_ms)
+{
+    int     index, option, valid = 1;
+    int     mgr_argc, cpu_index = 0, mem_index = 0;
+
+
+    /* Loop through each parameter looking for the start of each policy's options */
+    for (index = 1; index < argc; index++)
+    {
+        /* Check if VCPU scheduler options start here (only once) */
+        if ((strcmp(argv[index], RESOURCE_MANAGER_CPU_ARG) == 0) && (cpu_index == 0))
+        {
+            cpu_index = index;
+        }
+        /* Check if memory coordinator options start here (only once) */
+        else if ((strcmp(argv[index], RESOURCE_MANAGER_MEM_ARG) == 0) && (mem_index == 0))
+        {
+            mem_index = index;
+        }
+    }
+
+    /* Resource manager parameters end at the first policy's options */
+    mgr_argc = ((cpu_index) && ((mem_index == 0) || (cpu_index < mem_index)) ? cpu_index :
+                (mem_index) ? mem_index : argc);
+
+    /* Loop through each resource manager option */
+    while ((option = getopt(mgr_argc, argv, "a:")) != -1)
+    {
+        switch (option)
+        {
+            /* Adaptive interval option */
+            case 'a':
+
+                /* Set shortest / longest adaptive interval */
+                if (interval_parse_range(optarg, &adapt_min_ms, &adapt_max_ms) != EXIT_SUCCESS)
+                {
+                    /* Malformed range - show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Unknown option */
+            default:
+
+                /* Show usage */
+                valid = 0;
+
+            break;
+        }
+    }
+
+    /* Ensure single argument for time interval passed in and it's a valid time */
+    valid = ((valid) && (optind == (mgr_argc - 1)) &&
+             (interval_parse((const char *)argv[optind], interval_ms) == EXIT_SUCCESS));
+
+    /* Check if VCPU scheduler options given */
+    if ((valid) && (cpu_index))
+    {
+        /* Parse the VCPU scheduler options (up to the memory coordinator options if they follow)
+           with the policy argument in place of the program name
+           NOTE:  optind of 0 restarts the scan on a new parameter list */
+        optind = 0;
+        index = ((mem_index > cpu_index) ? mem_index : argc) - cpu_index;
+        valid = ((vcpu_policy_options(index, &argv[cpu_index])) && (optind == index));
+    }
+
+    /* Check if memory coordinator options given */
+    if ((valid) && (mem_index))
+    {
+        /* Parse the memory coordinator options (up to the VCPU scheduler options if they follow) */
+        optind = 0;
+        index = ((cpu_index > mem_index) ? cpu_index : argc) - mem_index;
+        valid = ((mem_policy_options(index, &argv[mem_index])) && (optind == index));
+    }
+
+    /* Return if parameters are valid to caller */
+    return (valid);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       manager
+*
+*   DESCRIPTION
+*
+*       Runs both policies once per time interval.  Between cycles the
+*       memory coordinator steps the balloon resizes still in progress
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Resource management successful
+*       Others                              Error during resource management
+*
+*************************************************************************/
+static int  manager(void)
+{
+    int     status = EXIT_SUCCESS;
+    int     busy = 0;
+
+
+    /* Loop while no errors and no key hit */
+    while (status == EXIT_SUCCESS)
+    {
+        /* Step resizes still in progress each sub-interval, then sleep until the end of this cycle */
+        status = mem_policy_idle(interval_next(&mgr_info.interval));
+        interval_wait(&mgr_info.interval);
+
+        /* Ensure resizes stepped successfully */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Run both policies on this cycle's stats */
+            status = manager_cycle(&busy);
+        }
+
+        /* Ensure cycle completed successfully */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Add / remove domains that started / stopped since the last cycle */
+            status = domain_events_process();
+        }
+
+        /* Shorten the interval while either policy is busy and lengthen it once
+           both are steady (only if adaptive) */
+        interval_adapt(&mgr_info.interval, busy);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       manager_cycle
+*
+*   DESCRIPTION
+*
+*       Runs a single cycle of both policies - the VCPU and balloon stats
+*       of all active domains are read with one call and shared by the
+*       VCPU scheduler and then the memory coordinator, which is told
+*       which domains the VCPU scheduler found CPU saturated
+*
+*   INPUTS
+*
+*       busy                                Set non-zero if either policy
+*                                           was busy this cycle
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Cycle successful
+*       Others                              Error during cycle
+*
+*************************************************************************/
+static int  manager_cycle(int * busy)
+{
+    int                 status = EXIT_SUCCESS;
+    int                 cpu_busy = 0, mem_busy = 0;
+    POLICY_SNAPSHOT     snapshot;
+    virErrorPtr         error;
+
+
+    /* Count this cycle */
+    mgr_info.num_cycles++;
+
+    /* No stats records yet (each policy collects its own stats if none are read) */
+    memset(&snapshot, 0, sizeof(snapshot));
+
+#if (RESOURCE_MANAGER_BULK_STATS == 1)
+    /* Check if bulk stats are supported */
+    if (mgr_info.bulk_stats)
+    {
+        /* Get VCPU and balloon stats for all active domains in one call */
+        snapshot.num_records = virConnectGetAllDomainStats(mgr_info.conn, VIR_DOMAIN_STATS_VCPU | VIR_DOMAIN_STATS_BALLOON,
+                                                           &snapshot.records, VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE);
+
+        /* Check if stats records not obtained */
+        if (snapshot.num_records < 0)
+        {
+            /* Get error from libvirt */
+            error = virGetLastError();
+
+            /* Check if bulk stats not supported by the hypervisor */
+            if ((error != NULL) && (error->code == VIR_ERR_NO_SUPPORT))
+            {
+                /* Don't try bulk stats again - policies use per-domain stats from now on */
+                mgr_info.bulk_stats = 0;
+            }
+            else
+            {
+                /* Set stats error */
+                status = RESOURCE_MANAGER_STATS_ERROR;
+            }
+
+            /* No records */
+            snapshot.records = NULL;
+            snapshot.num_records = 0;
+        }
+    }
+#endif  /* (RESOURCE_MANAGER_BULK_STATS == 1) */
+
+    /* Get time the stats were read and the interval of this cycle */
+    snapshot.now = interval_now();
+    snapshot.interval_ms = mgr_info.interval.interval_ms;
+
+    /* Ensure stats obtained successfully */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Adjust VCPU pinning (CPU saturation isn't known until the VCPU scheduler has run) */
+        status = vcpu_policy_cycle(&snapshot, &cpu_busy);
+    }
+
+    /* Ensure VCPU pinning adjusted successfully */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Adjust VM memory using the CPU saturation found by the VCPU scheduler this cycle */
+        snapshot.cpu_saturated = vcpu_policy_cpu_saturated;
+        snapshot.cpu_nodes = vcpu_policy_cpu_nodes;
+        status = mem_policy_cycle(&snapshot, &mem_busy);
+    }
+
+    /* Free the records (if any) */
+    if (snapshot.records != NULL)
+    {
+        virDomainStatsRecordListFree(snapshot.records);
+    }
+
+    /* Cycle is busy if either policy is busy */
+    *busy = ((cpu_busy) || (mem_busy));
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       manager_init
+*
+*   DESCRIPTION
+*
+*       Starts the event loop, connects to the hypervisor and registers
+*       for domain start / stop events (the connection and events are
+*       shared by both policies)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Resource manager init successful
+*       Others                              Error connecting to the hypervisor
+*
+*************************************************************************/
+static int  manager_init(void)
+{
+    int     status = EXIT_SUCCESS;
+
+
+    /* Start the event loop used to track domains starting / stopping
+       NOTE:  Must be done before connecting to the hypervisor */
+    if (domain_events_loop_init() != EXIT_SUCCESS)
+    {
+        /* Set event error */
+        status = RESOURCE_MANAGER_EVENT_ERROR;
+    }
+    else
+    {
+        /* Attempt to connect to the hypervisor */
+        mgr_info.conn = virConnectOpen(RESOURCE_MANAGER_URI);
+
+        /* Check if connection to hypervisor was successful */
+        if (mgr_info.conn == NULL)
+        {
+            /* Return error */
+            status = RESOURCE_MANAGER_CONN_ERROR;
+        }
+        /* Register for domain start / stop events before reading the domain list
+           so no domain starting in between is missed */
+        else if (domain_events_register(&mgr_info.events, mgr_info.conn) != EXIT_SUCCESS)
+        {
+            /* Set event error */
+            status = RESOURCE_MANAGER_EVENT_ERROR;
+        }
+        else
+        {
+            /* Use bulk stats if configured (disabled later if libvirt doesn't support it) */
+            mgr_info.bulk_stats = RESOURCE_MANAGER_BULK_STATS;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       manager_domains_init
+*
+*   DESCRIPTION
+*
+*       Adds the domains running at startup to both policies (domains
+*       started later are added by domain events)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Domains added
+*       Other                               Error with memory allocation or
+*                                           using libvirt
+*
+*************************************************************************/
+static int  manager_domains_init(void)
+{
+    int             index, num_domains, status = EXIT_SUCCESS;
+    virDomainPtr *  domain_list;
+
+
+    /* Get list of active domains */
+    num_domains = virConnectListAllDomains(mgr_info.conn, &domain_list, VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+
+    /* Ensure list of domains obtained (no domains running yet is fine) */
+    if (num_domains >= 0)
+    {
+        /* Loop through each domain */
+        for (index = 0; index < num_domains; index++)
+        {
+            /* Check if no errors so far */
+            if (status == EXIT_SUCCESS)
+            {
+                /* Add domain to both policies (domain reference is handed over) */
+                status = manager_domain_event(DOMAIN_EVENT_ADDED, domain_list[index]);
+            }
+            else
+            {
+                /* Release domains not added */
+                virDomainFree(domain_list[index]);
+            }
+        }
+
+        /* Free the list */
+        free(domain_list);
+    }
+    else
+    {
+        /* Set error status appropriately */
+        status = RESOURCE_MANAGER_DOMAIN_LIST_ERROR;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       manager_domain_event
+*
+*   DESCRIPTION
+*
+*       Hands a domain start / stop to both policies.  Each policy is
+*       given its own reference to the domain (the reference passed in is
+*       handed over)
+*
+*   INPUTS
+*
+*       type                                DOMAIN_EVENT_ADDED / REMOVED
+*       domain                              Domain started / stopped
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Domain event processed
+*       Other                               Error with memory allocation
+*
+*************************************************************************/
+static int  manager_domain_event(int type, virDomainPtr domain)
+{
+    int     status;
+
+
+    /* Take a second reference so each policy owns one */
+    virDomainRef(domain);
+
+    /* Hand the domain to the VCPU scheduler */
+    status = vcpu_policy_domain_event(type, domain);
+
+    /* Check if VCPU scheduler processed the domain successfully */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Hand the domain to the memory coordinator */
+        status = mem_policy_domain_event(type, domain);
+    }
+    else
+    {
+        /* Release the memory coordinator's reference */
+        virDomainFree(domain);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_process
+*
+*   DESCRIPTION
+*
+*       Processes domain start / stop events received since the last
+*       cycle - each event is handed to both policies
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Domain events processed
+*       Other                               Error with memory allocation
+*
+*************************************************************************/
+static int  domain_events_process(void)
+{
+    int             status = EXIT_SUCCESS;
+    DOMAIN_EVENT *  event;
+    DOMAIN_EVENT *  next;
+
+
+    /* Loop through each event received (oldest first) */
+    for (event = domain_events_get(&mgr_info.events); event != NULL; event = next)
+    {
+        /* Get next event before this one is freed */
+        next = event->next;
+
+        /* Check if no errors so far */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Hand the event's domain to both policies (domain reference is handed over) */
+            status = manager_domain_event(event->type, event->domain);
+            event->domain = NULL;
+        }
+
+        /* Done with event */
+        domain_event_free(event);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       manager_deinit
+*
+*   DESCRIPTION
+*
+*       Stops receiving domain events, closes the shared connection and
+*       stops the event loop (after both policies are de-initialized)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void manager_deinit(void)
+{
+    /* Stop receiving domain events */
+    domain_events_deregister(&mgr_info.events);
+
+    /* Close connection to hypervisor */
+    virConnectClose(mgr_info.conn);
+
+    /* Stop the event loop */
+    domain_events_loop_deinit();
+}
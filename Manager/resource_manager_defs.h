@@ -0,0 +1,50 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains resource manager macros, definitions, and
+*       structures
+*
+***********************************************************************/
+#ifndef RESOURCE_MANAGER_DEFS_H
+#define RESOURCE_MANAGER_DEFS_H
+
+#include "domain_events_defs.h"
+#include "interval_defs.h"
+#include "policy_defs.h"
+
+/* Set bulk stats to 1 to read the VCPU and balloon stats of all domains with a single libvirt
+   call per cycle shared by both policies (virConnectGetAllDomainStats) / 0 to let each policy
+   collect its own stats one domain at a time.
+   NOTE:  Per-domain collection is still used if libvirt doesn't support bulk stats */
+#if LIBVIR_CHECK_VERSION(4, 6, 0)
+#define RESOURCE_MANAGER_BULK_STATS         1
+#else
+#define RESOURCE_MANAGER_BULK_STATS         0
+#endif
+
+/* URI of the hypervisor the resource manager connects to */
+#define RESOURCE_MANAGER_URI                "qemu:///system"
+
+/* Command-line arguments starting the options of each policy */
+#define RESOURCE_MANAGER_CPU_ARG            "--cpu"
+#define RESOURCE_MANAGER_MEM_ARG            "--mem"
+
+/* Define status errors */
+#define RESOURCE_MANAGER_CONN_ERROR         -1
+#define RESOURCE_MANAGER_DOMAIN_LIST_ERROR  -2
+#define RESOURCE_MANAGER_STATS_ERROR        -3
+#define RESOURCE_MANAGER_EVENT_ERROR        -4
+
+/* Structure to keep track of the state shared by both policies */
+typedef struct MANAGER_INFO_STRUCT
+{
+    virConnectPtr       conn;           /* Hypervisor connection shared by both policies */
+    DOMAIN_EVENTS       events;         /* Domain start / stop events waiting to be processed */
+    INTERVAL            interval;       /* Time between cycles (of both policies) */
+    int                 bulk_stats;     /* Non-zero if bulk stats are supported */
+    unsigned long long  num_cycles;     /* Total number of cycles run */
+
+} MANAGER_INFO;
+
+#endif /* RESOURCE_MANAGER_DEFS_H */
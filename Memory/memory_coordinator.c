@@ -9,6 +9,12 @@
 *   FUNCTIONS
 *
 *       main
+*       mem_policy_options
+*       mem_policy_init
+*       mem_policy_domain_event
+*       mem_policy_cycle
+*       mem_policy_idle
+*       mem_policy_deinit
 *
 ***********************************************************************/
 
@@ -26,12 +32,60 @@
 /*****************************/
 /* LOCAL FUNCTION PROTOTYPES */
 /*****************************/
-static int  coordinator(unsigned int cycle_time);
+#ifndef RESOURCE_MANAGER
+static int  coordinator(unsigned int interval_ms);
+#endif  /* RESOURCE_MANAGER */
+static int  coordinator_cycle(int * busy);
 static int  collect_mem_stats(void);
+static void host_mem_read(void);
+static void node_mem_init(void);
+static int  collect_mem_stats_domain(void);
+#if (MEM_COORD_BULK_STATS == 1)
+static int  collect_mem_stats_bulk(void);
+static void collect_mem_stats_records(virDomainStatsRecordPtr * records, int num_records);
+static int  vm_find(unsigned int dom_id, int hint);
+#endif  /* (MEM_COORD_BULK_STATS == 1) */
+static void vm_pressure_update(VM_MEM_INFO * mem_info, unsigned long long now);
+static void vm_trend_update(VM_MEM_INFO * mem_info, unsigned long long now);
+static long long vm_growth_headroom(VM_MEM_INFO * mem_info);
 static int  vm_memory_adjust(void);
-static int  virt_init(void);
+static unsigned long long vm_reclaim_capacity(int index, int tier);
+static int  vm_reclaim_plan(unsigned long long mem_needed, int num_tiers, unsigned long long node_mask, int exclude);
+static long long vm_numa_overflow(int index, long long mem_adj);
+static long long node_mem_room(unsigned long long node_mask, int percent);
+static void node_mem_adjust(unsigned long long node_mask, long long mem_change);
+static unsigned long long vm_host_credit(VM_MEM_INFO * mem_info, unsigned long long mem_take);
+static int  vm_set_memory(int index, int check);
+static int  vm_step_memory(int index, int check, unsigned long long now);
+static int  vm_step_memory_wait(unsigned long long end);
+static int  vm_set_memory_wait(void);
+static int  virt_init(virConnectPtr conn);
+static int  mem_config_load(void);
+static void vm_config_apply(int index);
+static unsigned long long vm_size_min(VM_MEM_INFO * mem_info);
+static unsigned long long vm_size_max(VM_MEM_INFO * mem_info);
+static unsigned long long vm_align_kb(VM_MEM_INFO * mem_info);
+static unsigned long long vm_reclaim_align(VM_MEM_INFO * mem_info, unsigned long long mem_take,
+                                           unsigned long long max_take);
+static unsigned long long vm_grant_align(VM_MEM_INFO * mem_info, unsigned long long size,
+                                         unsigned long long min_size, unsigned long long max_size);
 static int  vm_mem_info_init(void);
+static int  vm_add(virDomainPtr domain);
+static unsigned long long vm_page_size(const char * xml);
+static int  vm_free_reporting(const char * xml);
+static unsigned long long vm_numa_tune(const char * xml, int * strict);
+static void nodeset_format(unsigned long long node_mask, char * nodeset, size_t size);
+static unsigned long long xml_size_kb(const char * tag, const char * size_name, const char * unit_name);
+static void vm_remove(int index);
+static int  vm_lookup(virDomainPtr domain);
+static void vm_trace(int index);
+#ifndef RESOURCE_MANAGER
+static int  domain_events_process(void);
+#endif  /* RESOURCE_MANAGER */
 static void virt_deinit(void);
+static void render_mem_metrics(void);
+static void render_mem_monitor(void);
+static void render_mem_shm(void);
 #if (MEM_COORD_DEBUG == 1)
 static void dump_mem_stats(void);
 #endif  /* (MEM_COORD_DEBUG == 1) */
@@ -41,8 +95,32 @@ static void dump_mem_stats(void);
 /*****************************/
 static VIRT_INFO            virt_info;
 static VM_MEM_INFO *        vm_mem_info;
+static const char *         phase_names[MEM_COORD_NUM_PHASES] = {"collect", "adjust", "events"};
+static const POLICY_SNAPSHOT * policy_snapshot; /* Stats snapshot shared by the resource manager this cycle (NULL = none) */
+static unsigned int         adapt_min_ms;   /* Shortest adaptive interval set with -a (0 = not adaptive) */
+static unsigned int         adapt_max_ms;   /* Longest adaptive interval set with -a */
+static int                  num_workers = MEM_COORD_WORKERS; /* Workers used to resize balloons set with -j */
+static int                  metrics_port = MEM_COORD_METRICS_PORT; /* Port of the metrics endpoint set with -m (0 = none) */
+static int                  predict = MEM_COORD_PREDICT; /* Non-zero to size memory changes from usage trends set with -p */
+static unsigned int         inflate_rate = MEM_COORD_INFLATE_RATE; /* Maximum reclaim rate (MB/s) set with -r (0 = unlimited) */
+static unsigned int         deflate_rate = MEM_COORD_DEFLATE_RATE; /* Maximum grant rate (MB/s) set with -r (0 = unlimited) */
+static int                  align_mode = MEM_COORD_ALIGN; /* Alignment of balloon resizes set with -g (MEM_COORD_ALIGN_xxx) */
+static unsigned int         host_cache_percent = MEM_COORD_HOST_CACHE_PERCENT; /* % of host cache counted as available set with -k */
+static unsigned int         ksm_reserve_percent = MEM_COORD_KSM_RESERVE_PERCENT; /* % of KSM savings held back set with -k */
+static int                  numa_mode = MEM_COORD_NUMA; /* How VM memory is kept on its NUMA nodes set with -n (MEM_COORD_NUMA_xxx) */
+static const char *         config_path;    /* Configuration file set with -c, reloaded on SIGHUP (NULL = none) */
+static const char *         trace_path;     /* Binary trace file set with -o (NULL = no trace) */
+static const char *         monitor_path;   /* Unix socket of the monitor stream set with -u (NULL = no stream) */
+static const char *         shm_name;       /* Shared memory segment of the stats set with -z (NULL = none) */
+static int                  host_low_percent = MEM_COORD_AVAIL_HOST_LOW_PERCENT; /* Host low threshold (configuration file) */
+static int                  host_tgt_percent = MEM_COORD_AVAIL_HOST_TGT_PERCENT; /* Host target (configuration file) */
+static int                  vm_low_percent = MEM_COORD_AVAIL_VM_LOW_PERCENT; /* VM low threshold (configuration file) */
+static int                  vm_tgt_percent = MEM_COORD_AVAIL_VM_TGT_PERCENT; /* VM target (configuration file) */
+static int                  vm_high_percent = MEM_COORD_AVAIL_VM_HIGH_PERCENT; /* VM high threshold (configuration file) */
+static unsigned long long   vm_min_mem = MEM_COORD_VM_MIN_MEM; /* Minimum balloon size (KB) of a reclaim (configuration file) */
 
 
+#ifndef RESOURCE_MANAGER
 /*************************************************************************
 *
 *   FUNCTION
@@ -67,33 +145,64 @@ static VM_MEM_INFO *        vm_mem_info;
 int main(int argc, char ** argv)
 {
     int                 status = EXIT_FAILURE;
-    int                 seconds = 0;
+    unsigned int        interval_ms = 0;
+    int                 valid;
 
 
+    /* Parse command-line options */
+    valid = mem_policy_options(argc, argv);
+
     /* Ensure single argument for time interval passed in */
-    if (argc == 2)
+    if ((valid) && (optind == (argc - 1)))
     {
-        /* Convert string time value into integer */
-        seconds = atoi((const char *)argv[1]);
+        /* Convert string time value (in seconds) into milliseconds */
+        if (interval_parse((const char *)argv[optind], &interval_ms) != EXIT_SUCCESS)
+        {
+            /* Malformed time - show usage */
+            interval_ms = 0;
+        }
     }
 
     /* Check if 1st parameter (time interval) is a valid number */
-    if (seconds == 0)
+    if (interval_ms == 0)
     {
         /* Print error / usage */
-        fprintf(stderr, "Usage:  %s <time interval>\n\r", argv[0]);
-        fprintf(stderr, "        where <time interval> = time, in seconds, between cycles.\n\r");
+        fprintf(stderr, "Usage:  %s [-a <min>,<max>] [-j <workers>] [-m <port>] [-p <0|1>] [-r <inflate>,<deflate>] [-c <file>]\n\r",
+                argv[0]);
+        fprintf(stderr, "        [-g <0|1|2>] [-k <cache>,<ksm>] [-n <0|1|2>] [-o <file>] [-u <socket>] [-z <name>] <time interval>\n\r");
+        fprintf(stderr, "        where <time interval> = time, in seconds, between cycles (ie 1, 0.5).\n\r");
+        fprintf(stderr, "              -a <min>,<max>  = adapt time interval between <min> and <max> seconds (default off).\n\r");
+        fprintf(stderr, "              -j <workers>    = connections used to resize balloons concurrently, 0 = inline (default %d).\n\r",
+                MEM_COORD_WORKERS);
+        fprintf(stderr, "              -m <port>       = serve OpenMetrics on http://%s:<port>/metrics (default off).\n\r",
+                METRICS_BIND_ADDR);
+        fprintf(stderr, "              -p <0|1>        = size memory changes from VM usage trends (default %d).\n\r",
+                MEM_COORD_PREDICT);
+        fprintf(stderr, "              -r <inflate>,<deflate> = maximum MB/s reclaimed from / given to a VM, 0 = unlimited (default %d,%d).\n\r",
+                MEM_COORD_INFLATE_RATE, MEM_COORD_DEFLATE_RATE);
+        fprintf(stderr, "              -c <file>       = configuration file with thresholds / VM overrides, reloaded on SIGHUP.\n\r");
+        fprintf(stderr, "              -g <0|1|2>      = align resizes to the pages backing a VM: 0 = off, 1 = hugepages,\n\r");
+        fprintf(stderr, "                                2 = hugepages and %dKB transparent hugepages of other VMs (default %d).\n\r",
+                MEM_COORD_THP_KB, MEM_COORD_ALIGN);
+        fprintf(stderr, "              -k <cache>,<ksm> = %% of host page cache counted as available / %% of KSM savings held back\n\r");
+        fprintf(stderr, "                                (default %d,%d).\n\r", MEM_COORD_HOST_CACHE_PERCENT, MEM_COORD_KSM_RESERVE_PERCENT);
+        fprintf(stderr, "              -n <0|1|2>      = keep VM memory on its NUMA nodes: 0 = off, 1 = grow VMs from their nodes first,\n\r");
+        fprintf(stderr, "                                2 = also add a node to a bound VM whose nodes ran out (default %d).\n\r",
+                MEM_COORD_NUMA);
+        fprintf(stderr, "              -o <file>       = record a binary trace of every cycle (read with trace_decode).\n\r");
+        fprintf(stderr, "              -u <socket>     = stream the stats of every cycle as JSON lines on a Unix socket.\n\r");
+        fprintf(stderr, "              -z <name>       = publish the stats of every cycle in a shared memory segment (ie /memory_coordinator).\n\r");
     }
     else
     {
-        /* Initialize the virtualization data */
-        status = virt_init();
+        /* Initialize the virtualization data (with its own connection) */
+        status = virt_init(NULL);
 
         /* Ensure virtualization init was successful */
         if (status == EXIT_SUCCESS)
         {
             /* Call VCPU scheduler with cycle time */
-            status = coordinator(seconds);
+            status = coordinator(interval_ms);
 
             /* Deinit the virtualization data */
             virt_deinit();
@@ -110,8 +219,202 @@ int main(int argc, char ** argv)
     /* Return status to caller */
     return (status);
 }
+#endif  /* RESOURCE_MANAGER */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       mem_policy_options
+*
+*   DESCRIPTION
+*
+*       Parses the memory coordinator command-line options (the options
+*       after --mem when run by the resource manager).  Parsing stops at
+*       the first argument that isn't an option (left in optind)
+*
+*   INPUTS
+*
+*       argc                                Number of parameters
+*       argv                                Array of parameters
+*
+*   OUTPUTS
+*
+*       1                                   Options valid
+*       0                                   Unknown or malformed option
+*
+*************************************************************************/
+int mem_policy_options(int argc, char ** argv)
+{
+    int     option, valid = 1;
+
+
+    /* Loop through each command-line option */
+    while ((option = getopt(argc, argv, "a:c:g:j:k:m:n:o:p:r:u:z:")) != -1)
+    {
+        switch (option)
+        {
+            /* Adaptive interval option */
+            case 'a':
+
+                /* Set shortest / longest adaptive interval */
+                if (interval_parse_range(optarg, &adapt_min_ms, &adapt_max_ms) != EXIT_SUCCESS)
+                {
+                    /* Malformed range - show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Configuration file option */
+            case 'c':
+
+                /* Set configuration file (read at startup and on SIGHUP) */
+                config_path = optarg;
+
+            break;
+
+            /* Alignment option */
+            case 'g':
+
+                /* Set alignment of balloon resizes */
+                align_mode = atoi(optarg);
+
+                /* Ensure mode is valid */
+                if ((align_mode < MEM_COORD_ALIGN_OFF) || (align_mode > MEM_COORD_ALIGN_THP))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Workers option */
+            case 'j':
+
+                /* Set number of workers used to resize balloons (0 = resize inline) */
+                num_workers = atoi(optarg);
+
+                /* Ensure number of workers is valid */
+                if ((num_workers < 0) || (num_workers > WORKER_POOL_MAX_WORKERS))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Host memory model option */
+            case 'k':
+
+                /* Set % of host cache counted as available / % of KSM savings held back */
+                if ((sscanf(optarg, "%u,%u", &host_cache_percent, &ksm_reserve_percent) != 2) ||
+                    (host_cache_percent > 100) || (ksm_reserve_percent > 100))
+                {
+                    /* Malformed percents - show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Metrics option */
+            case 'm':
+
+                /* Set port the metrics endpoint is served on (0 = no endpoint) */
+                metrics_port = atoi(optarg);
+
+                /* Ensure port is valid */
+                if ((metrics_port < 0) || (metrics_port > 65535))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* NUMA option */
+            case 'n':
+
+                /* Set how the memory of each VM is kept on its NUMA nodes */
+                numa_mode = atoi(optarg);
+
+                /* Ensure mode is valid */
+                if ((numa_mode < MEM_COORD_NUMA_OFF) || (numa_mode > MEM_COORD_NUMA_SPREAD))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Trace option */
+            case 'o':
+
+                /* Set binary trace file */
+                trace_path = optarg;
+
+            break;
+
+            /* Predict option */
+            case 'p':
+
+                /* Set if memory changes are sized from usage trends */
+                predict = atoi(optarg);
+
+            break;
+
+            /* Resize rate option */
+            case 'r':
+
+                /* Set maximum reclaim / grant rates (0 = unlimited) */
+                if (sscanf(optarg, "%u,%u", &inflate_rate, &deflate_rate) != 2)
+                {
+                    /* Malformed rates - show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Monitor option */
+            case 'u':
+
+                /* Set Unix socket the stats of every cycle are streamed on */
+                monitor_path = optarg;
+
+            break;
+
+            /* Shared memory option */
+            case 'z':
+
+                /* Set shared memory segment the stats of every cycle are published in */
+                shm_name = optarg;
+
+                /* Ensure name is a segment name (/<name>) */
+                if ((optarg[0] != '/') || (strchr(optarg + 1, '/') != NULL) || (optarg[1] == '\0'))
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Unknown option */
+            default:
+
+                /* Show usage */
+                valid = 0;
+
+            break;
+        }
+    }
+
+    /* Return if options are valid to caller */
+    return (valid);
+}
 
 
+#ifndef RESOURCE_MANAGER
 /*************************************************************************
 *
 *   FUNCTION
@@ -124,8 +427,9 @@ int main(int argc, char ** argv)
 *
 *   INPUTS
 *
-*       cycle_time                          Time, in seconds, to run
+*       interval_ms                         Time, in milliseconds, to run
 *                                           each cycle of the memory coordinator
+*                                           (starting time if adaptive)
 *
 *   OUTPUTS
 *
@@ -133,152 +437,3396 @@ int main(int argc, char ** argv)
 *       Others                              Error during memory coordination
 *
 *************************************************************************/
-static int  coordinator(unsigned int cycle_time)
+static int  coordinator(unsigned int interval_ms)
+{
+    int                 status = EXIT_SUCCESS;
+    int                 pressure;
+    unsigned long long  start;
+
+
+    /* Start timing cycles (adaptive if a range was set with -a) */
+    interval_init(&virt_info.interval, interval_ms, adapt_min_ms, adapt_max_ms);
+
+    /* Loop while no errors and no key hit */
+    while (status == EXIT_SUCCESS)
+    {
+        /* Step resizes still in progress each sub-interval, then sleep until the end of this cycle */
+        status = vm_step_memory_wait(interval_next(&virt_info.interval));
+        interval_wait(&virt_info.interval);
+
+        /* Ensure resizes stepped successfully */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Run a coordination cycle */
+            status = coordinator_cycle(&pressure);
+        }
+
+        /* Ensure cycle completed successfully */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Add / remove VMs that started / stopped since the last cycle */
+            start = interval_clock();
+            status = domain_events_process();
+            virt_info.phase_ns[MEM_COORD_PHASE_EVENTS] = interval_clock() - start;
+        }
+
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+#endif  /* RESOURCE_MANAGER */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       coordinator_cycle
+*
+*   DESCRIPTION
+*
+*       Runs a single coordination cycle - collects VM memory stats and
+*       adjusts VM memory, then outputs the stats and metrics of the cycle
+*
+*   INPUTS
+*
+*       busy                                Set non-zero if under memory
+*                                           pressure this cycle
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Cycle successful
+*       Others                              Error during cycle
+*
+*************************************************************************/
+static int  coordinator_cycle(int * busy)
+{
+    int                 index, status = EXIT_SUCCESS;
+    unsigned long long  start, now;
+
+
+    /* Record start of cycle (numbered from 1) and check if the trace started a new file */
+    if (trace_cycle(&virt_info.trace, virt_info.num_cycles + 1, interval_now(), virt_info.interval.interval_ms))
+    {
+        /* Loop through each VM and name it in the new file */
+        for (index = 0; index < virt_info.num_domains; index++)
+        {
+            vm_trace(index);
+        }
+    }
+
+    /* Check if a configuration reload was requested (SIGHUP) since it was last loaded */
+    if ((config_path != NULL) && (virt_info.config_generation != config_generation()))
+    {
+        /* Reload at this cycle boundary (stats and trends already collected are kept) */
+        virt_info.config_generation = config_generation();
+
+        /* Check if the new configuration can't be used */
+        if (mem_config_load() != EXIT_SUCCESS)
+        {
+            /* Keep running with the previous configuration */
+            fprintf(stderr, "%s: reload failed - previous configuration kept\n\r", config_path);
+        }
+    }
+
+    /* Collect memory stats */
+    start = interval_clock();
+    status = collect_mem_stats();
+    now = interval_clock();
+    virt_info.phase_ns[MEM_COORD_PHASE_COLLECT] = now - start;
+
+    /* Check for memory pressure (VMs deficient / in excess or host below target)
+       before the adjustment updates the masks */
+    *busy = ((!bitmask_empty(&virt_info.low_mem_mask)) || (!bitmask_empty(&virt_info.high_mem_mask)) ||
+             (virt_info.host_free_mem < virt_info.host_tgt_mem));
+
+    /* Ensure VM stats obtained successfully */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Adjust memory assignment for each VM */
+        start = now;
+        status = vm_memory_adjust();
+        now = interval_clock();
+        virt_info.phase_ns[MEM_COORD_PHASE_ADJUST] = now - start;
+    }
+
+    /* Count cycle */
+    virt_info.num_cycles++;
+
+#if (MEM_COORD_DEBUG == 1)
+    /* Dump memory coordinator stats */
+    dump_mem_stats();
+#endif  /* (MEM_COORD_DEBUG == 1) */
+
+    /* Check if metrics endpoint is served */
+    if (metrics_port)
+    {
+        /* Publish a snapshot of this cycle for scrapes */
+        render_mem_metrics();
+    }
+
+    /* Check if monitor stream is served */
+    if (monitor_path != NULL)
+    {
+        /* Stream a sample of this cycle to the monitor clients */
+        render_mem_monitor();
+    }
+
+    /* Check if shared memory snapshot is published */
+    if (shm_name != NULL)
+    {
+        /* Publish the stats of this cycle to the shared memory readers */
+        render_mem_shm();
+    }
+
+    /* Shorten the interval under memory pressure and lengthen it once steady
+       (only if adaptive) */
+    interval_adapt(&virt_info.interval, *busy);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       mem_config_load
+*
+*   DESCRIPTION
+*
+*       Loads the configuration file - the thresholds of the [memory]
+*       section (settings not in the file keep their defaults) and the
+*       VM overrides, which are applied to the VMs already tracked.
+*       Nothing is changed if the file has an error
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Configuration loaded
+*       EXIT_FAILURE                        Error in configuration file
+*                                           (printed to stderr)
+*
+*************************************************************************/
+static int  mem_config_load(void)
+{
+    static const char * const   keys[] = {"host_low_percent", "host_target_percent", "vm_low_percent",
+                                          "vm_target_percent", "vm_high_percent", "vm_min_memory", NULL};
+    int                         index, status;
+    int                         host_low = MEM_COORD_AVAIL_HOST_LOW_PERCENT;
+    int                         host_tgt = MEM_COORD_AVAIL_HOST_TGT_PERCENT;
+    int                         vm_low = MEM_COORD_AVAIL_VM_LOW_PERCENT;
+    int                         vm_tgt = MEM_COORD_AVAIL_VM_TGT_PERCENT;
+    int                         vm_high = MEM_COORD_AVAIL_VM_HIGH_PERCENT;
+    int                         vm_min = MEM_COORD_VM_MIN_MEM / MEM_COORD_KB_SIZE;
+    CONFIG                      config;
+
+
+    /* Read the configuration file */
+    status = config_load(&config, config_path);
+
+    /* Ensure only known settings are in the [memory] section */
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_check(&config, MEM_COORD_CONFIG_SECTION, keys);
+    }
+
+    /* Get each threshold (left at its default if not set) */
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, MEM_COORD_CONFIG_SECTION, "host_low_percent", &host_low);
+    }
+
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, MEM_COORD_CONFIG_SECTION, "host_target_percent", &host_tgt);
+    }
+
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, MEM_COORD_CONFIG_SECTION, "vm_low_percent", &vm_low);
+    }
+
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, MEM_COORD_CONFIG_SECTION, "vm_target_percent", &vm_tgt);
+    }
+
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, MEM_COORD_CONFIG_SECTION, "vm_high_percent", &vm_high);
+    }
+
+    /* Get minimum balloon size of a reclaim (MB) */
+    if (status == EXIT_SUCCESS)
+    {
+        status = config_get_int(&config, MEM_COORD_CONFIG_SECTION, "vm_min_memory", &vm_min);
+    }
+
+    /* Ensure thresholds are ordered (0 <= low < target [< high] < 100) and the minimum size isn't negative */
+    if ((status == EXIT_SUCCESS) &&
+        ((host_low < 0) || (host_low >= host_tgt) || (host_tgt >= 100) ||
+         (vm_low < 0) || (vm_low >= vm_tgt) || (vm_tgt >= vm_high) || (vm_high >= 100) || (vm_min < 0)))
+    {
+        /* Print error */
+        fprintf(stderr, "%s: [%s] thresholds must be 0 <= low < target (< high) < 100 and vm_min_memory >= 0\n\r",
+                config_path, MEM_COORD_CONFIG_SECTION);
+        status = EXIT_FAILURE;
+    }
+
+    /* Check if the configuration is valid */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Replace the previous configuration */
+        config_free(&virt_info.config);
+        virt_info.config = config;
+
+        /* Use the new thresholds from this cycle on */
+        host_low_percent = host_low;
+        host_tgt_percent = host_tgt;
+        vm_low_percent = vm_low;
+        vm_tgt_percent = vm_tgt;
+        vm_high_percent = vm_high;
+        vm_min_mem = (unsigned long long)vm_min * MEM_COORD_KB_SIZE;
+
+        /* Recalculate target memory size for host (once the host size is known) */
+        virt_info.host_tgt_mem = (host_tgt_percent * virt_info.host_total_mem)/100;
+
+        /* Loop through each tracked VM and apply its new overrides */
+        for (index = 0; index < virt_info.num_domains; index++)
+        {
+            vm_config_apply(index);
+        }
+    }
+    else
+    {
+        /* Free the rejected configuration */
+        config_free(&config);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_config_apply
+*
+*   DESCRIPTION
+*
+*       Applies the configuration file overrides of a VM (found by its
+*       name).  A VM without a VM section gets no overrides
+*
+*   INPUTS
+*
+*       index                               Index of VM
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void vm_config_apply(int index)
+{
+    const CONFIG_VM *   vm = config_vm_find(&virt_info.config, vm_mem_info[index].name);
+
+
+    /* Set priority and smallest / largest balloon sizes (none without a VM section) */
+    vm_mem_info[index].priority = (vm != NULL ? vm->priority : 0);
+    vm_mem_info[index].min_mem = (vm != NULL ? vm->min_mem : 0);
+    vm_mem_info[index].max_mem = (vm != NULL ? vm->max_mem : 0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_size_min
+*
+*   DESCRIPTION
+*
+*       Gets the smallest balloon size a VM is reclaimed down to - the
+*       minimum size of a reclaim or the VM's own minimum from the
+*       configuration file, whichever is larger
+*
+*   INPUTS
+*
+*       mem_info                            Pointer to VM memory info
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Smallest balloon size (KB)
+*
+*************************************************************************/
+static unsigned long long vm_size_min(VM_MEM_INFO * mem_info)
+{
+    /* Return larger of the minimum sizes to caller */
+    return (mem_info->min_mem > vm_min_mem ? mem_info->min_mem : vm_min_mem);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_size_max
+*
+*   DESCRIPTION
+*
+*       Gets the largest balloon size a VM is given - its maximum memory
+*       or the VM's own maximum from the configuration file, whichever is
+*       smaller
+*
+*   INPUTS
+*
+*       mem_info                            Pointer to VM memory info
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Largest balloon size (KB)
+*
+*************************************************************************/
+static unsigned long long vm_size_max(VM_MEM_INFO * mem_info)
+{
+    /* Return smaller of the maximum sizes to caller (the configured maximum only if set) */
+    return (((mem_info->max_mem) && (mem_info->max_mem < mem_info->mem_max)) ? mem_info->max_mem : mem_info->mem_max);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_align_kb
+*
+*   DESCRIPTION
+*
+*       Gets the size balloon resizes of a VM are aligned to - the size of
+*       the hugepages backing the VM or (if configured) of a transparent
+*       hugepage for a VM backed by small pages
+*
+*   INPUTS
+*
+*       mem_info                            Pointer to VM memory info
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Alignment (KB - 1 = none)
+*
+*************************************************************************/
+static unsigned long long vm_align_kb(VM_MEM_INFO * mem_info)
+{
+    /* Return alignment of the mode to caller */
+    return ((align_mode == MEM_COORD_ALIGN_OFF) ? 1 :
+            (mem_info->page_kb > MEM_COORD_PAGE_KB) ? mem_info->page_kb :
+            (align_mode == MEM_COORD_ALIGN_THP) ? MEM_COORD_THP_KB : 1);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_reclaim_align
+*
+*   DESCRIPTION
+*
+*       Adjusts memory to reclaim from a VM so its balloon size stays a
+*       multiple of the pages backing it - rounded up to take more (up
+*       to the most that may be taken), otherwise rounded down to take
+*       less
+*
+*   INPUTS
+*
+*       mem_info                            Pointer to VM memory info
+*       mem_take                            Memory (KB) to reclaim
+*       max_take                            Most memory (KB) that may be
+*                                           reclaimed
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Memory (KB) to reclaim (0 = not
+*                                           a whole page)
+*
+*************************************************************************/
+static unsigned long long vm_reclaim_align(VM_MEM_INFO * mem_info, unsigned long long mem_take,
+                                           unsigned long long max_take)
+{
+    unsigned long long  align = vm_align_kb(mem_info);
+    unsigned long long  size_down, size_up;
+
+
+    /* Get balloon sizes at the pages either side of the reclaimed size */
+    size_down = MEM_COORD_ALIGN_DOWN(mem_info->mem_total - mem_take, align);
+    size_up = MEM_COORD_ALIGN_UP(mem_info->mem_total - mem_take, align);
+
+    /* Return memory to reclaim to caller (nothing if nothing was planned) */
+    return ((mem_take == 0) ? 0 :
+            ((mem_info->mem_total - size_down) <= max_take) ? (mem_info->mem_total - size_down) :
+            (size_up < mem_info->mem_total) ? (mem_info->mem_total - size_up) : 0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_grant_align
+*
+*   DESCRIPTION
+*
+*       Aligns the balloon size a VM is given memory up to so it stays a
+*       multiple of the pages backing it - rounded up to give more (up to
+*       the largest size), otherwise rounded down to give less (if it is
+*       still at least the smallest size)
+*
+*   INPUTS
+*
+*       mem_info                            Pointer to VM memory info
+*       size                                Balloon size (KB) planned
+*       min_size                            Smallest balloon size (KB)
+*       max_size                            Largest balloon size (KB)
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Balloon size (KB) to set
+*
+*************************************************************************/
+static unsigned long long vm_grant_align(VM_MEM_INFO * mem_info, unsigned long long size,
+                                         unsigned long long min_size, unsigned long long max_size)
+{
+    unsigned long long  align = vm_align_kb(mem_info);
+
+
+    /* Return aligned size to caller (the size planned if no page fits) */
+    return ((MEM_COORD_ALIGN_UP(size, align) <= max_size) ? MEM_COORD_ALIGN_UP(size, align) :
+            (MEM_COORD_ALIGN_DOWN(size, align) >= min_size) ? MEM_COORD_ALIGN_DOWN(size, align) : size);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       mem_policy_init
+*
+*   DESCRIPTION
+*
+*       Initializes the memory coordinator on a hypervisor connection
+*       shared by the resource manager.  No VMs are tracked until the
+*       resource manager reports them with mem_policy_domain_event
+*
+*   INPUTS
+*
+*       conn                                Shared hypervisor connection
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Memory coordinator initialized
+*       Others                              Error during init
+*
+*************************************************************************/
+int mem_policy_init(virConnectPtr conn)
+{
+    /* Initialize the virtualization data on the shared connection */
+    return (virt_init(conn));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       mem_policy_cycle
+*
+*   DESCRIPTION
+*
+*       Runs a single coordination cycle for the resource manager using
+*       the stats snapshot it took for this cycle (balloon stats are read
+*       from the snapshot records when there are any)
+*
+*   INPUTS
+*
+*       snapshot                            Stats snapshot of this cycle
+*       busy                                Set non-zero if under memory
+*                                           pressure this cycle
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Cycle successful
+*       Others                              Error during cycle
+*
+*************************************************************************/
+int mem_policy_cycle(const POLICY_SNAPSHOT * snapshot, int * busy)
+{
+    int     status;
+
+
+    /* Use the shared snapshot and the resource manager's interval for this cycle */
+    policy_snapshot = snapshot;
+    virt_info.interval.interval_ms = snapshot->interval_ms;
+
+    /* Run a coordination cycle */
+    status = coordinator_cycle(busy);
+
+    /* Snapshot is freed by the resource manager after the cycle */
+    policy_snapshot = NULL;
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       mem_policy_idle
+*
+*   DESCRIPTION
+*
+*       Steps the resizes still in progress between the resource manager's
+*       cycles
+*
+*   INPUTS
+*
+*       end                                 Monotonic time (ns) the next
+*                                           cycle starts
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Resizes stepped
+*       Other                               Error stepping resizes
+*
+*************************************************************************/
+int mem_policy_idle(unsigned long long end)
+{
+    /* Step resizes each sub-interval until the next cycle */
+    return (vm_step_memory_wait(end));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       mem_policy_phases
+*
+*   DESCRIPTION
+*
+*       Gets the time spent in each phase of the last cycle (timed on the
+*       host clock, as served by the metrics endpoint).  Domain events
+*       are timed by the standalone daemon only, so just the phases of
+*       mem_policy_cycle are given
+*
+*   INPUTS
+*
+*       names                               Pointer to return phase names
+*       phase_ns                            Pointer to return time (ns)
+*                                           spent in each phase
+*
+*   OUTPUTS
+*
+*       int                                 Number of phases
+*
+*************************************************************************/
+int mem_policy_phases(const char * const ** names, const unsigned long long ** phase_ns)
+{
+    /* Return names and times of the phases (domain events are the last phase) */
+    *names = phase_names;
+    *phase_ns = virt_info.phase_ns;
+    return (MEM_COORD_PHASE_EVENTS);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       mem_policy_deinit
+*
+*   DESCRIPTION
+*
+*       De-initializes the memory coordinator run by the resource manager
+*       (the shared connection is left open)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void mem_policy_deinit(void)
+{
+    /* Deinit the virtualization data */
+    virt_deinit();
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       collect_mem_stats
+*
+*   DESCRIPTION
+*
+*       Collects VM stats using bulk stats when supported by libvirt,
+*       otherwise using one call per VM, and marks VMs that are low /
+*       high in memory.  When run by the resource manager the stats
+*       records it read for this cycle are used instead, and a VM that
+*       is CPU saturated isn't marked high (its memory isn't reclaimed
+*       while it is busy)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VM stats collected
+*       Others                              Error trying to collect VM stats
+*
+*************************************************************************/
+static int  collect_mem_stats(void)
+{
+    int                 index, status = EXIT_SUCCESS;
+    int                 percent_next;
+    int                 per_vm = 1;
+    unsigned long long  now;
+    TRACE_VM_MEM        vm_record;
+    TRACE_HOST_MEM      host_record;
+
+
+    /* Reset low / high VM memory masks before each new collection */
+    bitmask_zero(&virt_info.high_mem_mask);
+    bitmask_zero(&virt_info.low_mem_mask);
+
+    /* First update the host memory available (tracked locally by the adjustment after this) */
+    host_mem_read();
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        /* No stats collected for this VM yet */
+        vm_mem_info[index].collected = 0;
+        vm_mem_info[index].reported = 0;
+        vm_mem_info[index].mem_change = 0;
+
+        /* Memory reclaimed by steps already made is in the host memory just read */
+        vm_mem_info[index].mem_credit = 0;
+    }
+
+#if (MEM_COORD_BULK_STATS == 1)
+    /* Check if the resource manager already read the stats of all VMs this cycle */
+    if ((policy_snapshot != NULL) && (policy_snapshot->records != NULL))
+    {
+        /* Fill in balloon stats from the shared records */
+        collect_mem_stats_records(policy_snapshot->records, policy_snapshot->num_records);
+        per_vm = 0;
+    }
+    /* Check if bulk stats are supported (never read by the policy itself under the resource manager) */
+    else if ((policy_snapshot == NULL) && (virt_info.bulk_stats))
+    {
+        /* Get all balloon stats with a single call */
+        status = collect_mem_stats_bulk();
+
+        /* Check if libvirt doesn't support bulk stats */
+        per_vm = (status == MEM_COORD_BULK_STATS_UNSUPPORTED);
+
+        /* Don't try bulk stats again if not supported - use per-VM stats from now on */
+        virt_info.bulk_stats = !per_vm;
+    }
+#endif  /* (MEM_COORD_BULK_STATS == 1) */
+
+    /* Check if neither shared records nor bulk stats were used */
+    if (per_vm)
+    {
+        /* Get memory stats one VM at a time */
+        status = collect_mem_stats_domain();
+    }
+
+    /* Get time the stats were collected */
+    now = interval_now();
+
+    /* Loop through each VM (a VM that stopped is skipped until its stop event removes it) */
+    for (index = 0; (index < virt_info.num_domains) && (status == EXIT_SUCCESS); index++)
+    {
+        /* Ensure appropriate stats available */
+        if ((vm_mem_info[index].collected) && (vm_mem_info[index].mem_total > 0))
+        {
+            /* Save balloon size collected (resize steps continue from it and it is output as the actual size) */
+            vm_mem_info[index].mem_balloon = vm_mem_info[index].mem_total;
+            vm_mem_info[index].mem_collected = vm_mem_info[index].mem_total;
+
+            /* Save unused memory the host already has back if the guest reports its free pages */
+            vm_mem_info[index].mem_reported = (vm_mem_info[index].free_reporting ? vm_mem_info[index].mem_free : 0);
+
+            /* Check if the VM is CPU saturated (only known when run by the resource manager) */
+            vm_mem_info[index].cpu_saturated = ((policy_snapshot != NULL) && (policy_snapshot->cpu_saturated != NULL) &&
+                                                (policy_snapshot->cpu_saturated(virt_info.domain_list[index])));
+
+            /* Get NUMA nodes the VM's memory is on - its numatune nodeset, otherwise the nodes its VCPUs are
+               pinned to (only known when run by the resource manager) */
+            vm_mem_info[index].node_mask = ((vm_mem_info[index].numa_mask != 0) ? vm_mem_info[index].numa_mask :
+                                            ((policy_snapshot != NULL) && (policy_snapshot->cpu_nodes != NULL)) ?
+                                            policy_snapshot->cpu_nodes(virt_info.domain_list[index]) : 0);
+
+            /* Score the VM's memory pressure from this cycle's guest memory stats */
+            vm_pressure_update(&vm_mem_info[index], now);
+
+            /* Add this cycle's used memory to the VM's trend */
+            vm_trend_update(&vm_mem_info[index], now);
+
+            /* Check if a hugepage allocation failed in the guest since the last cycle (its hugepage pool
+               is fully committed) */
+            if ((vm_mem_info[index].reported & MEM_COORD_STAT_HUGETLB_FAIL) &&
+                (vm_mem_info[index].hugetlb_fail > vm_mem_info[index].hugetlb_fail_last))
+            {
+                /* Save time of the failure */
+                vm_mem_info[index].hugetlb_fail_ns = now;
+            }
+
+            /* Save failures checked and keep the pool fully committed for a while after a failure */
+            vm_mem_info[index].hugetlb_fail_last = vm_mem_info[index].hugetlb_fail;
+            vm_mem_info[index].hugetlb_full = ((vm_mem_info[index].hugetlb_fail_ns != 0) &&
+                                               ((now - vm_mem_info[index].hugetlb_fail_ns) <
+                                                (MEM_COORD_HUGETLB_HOLD_SECS * INTERVAL_NSECS_PER_SEC)));
+
+            /* Calculate percent avail memory in VM */
+            vm_mem_info[index].percent_avail = (int)((100 * vm_mem_info[index].mem_free)/vm_mem_info[index].mem_total);
+
+            /* Cap percentage of available memory at 100%
+               NOTE:  Value can exceed 100% due to memory stats changing faster in VM than collected or due to order collected
+                      (ie not atomic collection of all stats) */
+            vm_mem_info[index].percent_avail = (vm_mem_info[index].percent_avail > 100 ? 100 : vm_mem_info[index].percent_avail);
+
+            /* Calculate percent usable memory predicted for the next cycle (current if not predicting) */
+            percent_next = (predict ?
+                            (int)((100 * ((long long)vm_mem_info[index].mem_avail - vm_mem_info[index].mem_growth)) /
+                                  (long long)vm_mem_info[index].mem_total) :
+                            vm_mem_info[index].percent_usable);
+
+            /* Check if this VM is under memory pressure (little usable memory or thrashing) or will
+               run low on usable memory before the next cycle or is below its configured minimum,
+               and size of VM isn't at max */
+            if (((vm_mem_info[index].pressure > (100 - vm_low_percent)) ||
+                 (percent_next < vm_low_percent) ||
+                 (vm_mem_info[index].mem_total < vm_mem_info[index].min_mem)) &&
+                (vm_mem_info[index].mem_total < vm_size_max(&vm_mem_info[index])))
+            {
+                /* Set bit for this VM in low mask */
+                BITMASK_SET(&virt_info.low_mem_mask, index);
+            }
+            /* Check if the VM is above its configured maximum OR unused memory for this VM is high (or above
+               target while usage is clearly falling) and the VM isn't under more pressure than its target
+               (ie swapping), CPU saturated or out of hugepages */
+            else if ((vm_mem_info[index].mem_total > vm_size_max(&vm_mem_info[index])) ||
+                     (((vm_mem_info[index].percent_avail > vm_high_percent) ||
+                       ((predict) && (vm_mem_info[index].trend_down) &&
+                        (vm_mem_info[index].percent_avail > vm_tgt_percent))) &&
+                      (vm_mem_info[index].pressure < (100 - vm_tgt_percent)) &&
+                      (!vm_mem_info[index].cpu_saturated) && (!vm_mem_info[index].hugetlb_full)))
+            {
+                /* Set bit for this VM in high mask */
+                BITMASK_SET(&virt_info.high_mem_mask, index);
+            }
+
+            /* Record raw balloon stats and memory computed */
+            vm_record.balloon = vm_mem_info[index].mem_total;
+            vm_record.unused = vm_mem_info[index].mem_free;
+            vm_record.usable = vm_mem_info[index].mem_usable;
+            vm_record.swap_in = vm_mem_info[index].swap_in;
+            vm_record.swap_out = vm_mem_info[index].swap_out;
+            vm_record.major_faults = vm_mem_info[index].major_faults;
+            vm_record.reported = vm_mem_info[index].reported;
+            vm_record.percent_avail = vm_mem_info[index].percent_avail;
+            vm_record.pressure = vm_mem_info[index].pressure;
+            vm_record.reserved = 0;
+            trace_write(&virt_info.trace, TRACE_REC_VM_MEM, vm_mem_info[index].dom_id, &vm_record, sizeof(vm_record));
+        }
+    }
+
+    /* Record host free memory and VMs found high / low */
+    host_record.free_mem = virt_info.host_unused_mem;
+    host_record.total_mem = virt_info.host_total_mem;
+    host_record.target_mem = virt_info.host_tgt_mem;
+    trace_write(&virt_info.trace, TRACE_REC_HOST_MEM, 0, &host_record, sizeof(host_record));
+    trace_mask(&virt_info.trace, TRACE_MASK_MEM_HIGH, &virt_info.high_mem_mask);
+    trace_mask(&virt_info.trace, TRACE_MASK_MEM_LOW, &virt_info.low_mem_mask);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       host_mem_read
+*
+*   DESCRIPTION
+*
+*       Reads the host memory stats and sets the memory available on the
+*       host - its free memory plus the part of its buffers / page cache
+*       that can be dropped without pressure (-k), less a reserve for the
+*       memory KSM saves (a guest writing to a shared page needs its own
+*       copy again).  Only the free memory is used if the node memory
+*       stats aren't supported.  The free memory of each NUMA node is
+*       also read on a host with more than 1 node
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void host_mem_read(void)
+{
+    virNodeMemoryStats  stats[MEM_COORD_HOST_PARAMS];
+    virTypedParameter   params[MEM_COORD_HOST_PARAMS];
+    unsigned long long  node_free[MEM_COORD_MAX_NODES];
+    int                 index, num_stats = virt_info.host_stats, num_params = virt_info.host_ksm;
+    unsigned long long  pages, available, reserve;
+
+
+    /* Reset host memory read */
+    virt_info.host_unused_mem = 0;
+    virt_info.host_cache_mem = 0;
+    virt_info.host_ksm_mem = 0;
+
+    /* Check if the node memory stats are supported and read (total, free, buffers and cached in KB) */
+    if ((num_stats > 0) &&
+        (virNodeGetMemoryStats(virt_info.conn, VIR_NODE_MEMORY_STATS_ALL_CELLS, stats, &num_stats, 0) == 0))
+    {
+        /* Loop through each stat */
+        for (index = 0; index < num_stats; index++)
+        {
+            /* Save free memory and add up buffers / page cache */
+            virt_info.host_unused_mem += (strcmp(stats[index].field, VIR_NODE_MEMORY_STATS_FREE) == 0 ?
+                                          stats[index].value : 0);
+            virt_info.host_cache_mem += (((strcmp(stats[index].field, VIR_NODE_MEMORY_STATS_BUFFERS) == 0) ||
+                                          (strcmp(stats[index].field, VIR_NODE_MEMORY_STATS_CACHED) == 0)) ?
+                                         stats[index].value : 0);
+        }
+    }
+    else
+    {
+        /* Get host free memory only */
+        virt_info.host_unused_mem = (virNodeGetFreeMemory(virt_info.conn) / MEM_COORD_KB_SIZE);
+    }
+
+    /* Check if KSM stats are supported and read the pages it saves (sites sharing a page) */
+    if ((num_params > 0) && (virNodeGetMemoryParameters(virt_info.conn, params, &num_params, 0) == 0) &&
+        (virTypedParamsGetULLong(params, num_params, VIR_NODE_MEMORY_SHARED_PAGES_SHARING, &pages) == 1))
+    {
+        /* Save memory saved by KSM */
+        virt_info.host_ksm_mem = pages * MEM_COORD_PAGE_KB;
+    }
+
+    /* Check if the host has more than 1 NUMA node and read the free memory of each (in bytes) */
+    if ((virt_info.num_nodes > 1) &&
+        (virNodeGetCellsFreeMemory(virt_info.conn, node_free, 0, virt_info.num_nodes) == virt_info.num_nodes))
+    {
+        /* Loop through each node */
+        for (index = 0; index < virt_info.num_nodes; index++)
+        {
+            /* Save free memory of node */
+            virt_info.node_free_mem[index] = node_free[index] / MEM_COORD_KB_SIZE;
+        }
+    }
+
+    /* Calculate memory available and the reserve held back for pages KSM may have to unshare */
+    available = virt_info.host_unused_mem + ((virt_info.host_cache_mem * host_cache_percent) / 100);
+    reserve = (virt_info.host_ksm_mem * ksm_reserve_percent) / 100;
+
+    /* Set host memory available (never below 0) and start the resize steps from it */
+    virt_info.host_free_mem = (available > reserve ? available - reserve : 0);
+    virt_info.host_step_mem = virt_info.host_free_mem;
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       node_mem_init
+*
+*   DESCRIPTION
+*
+*       Gets the NUMA nodes (cells) of the host with the free and total
+*       memory of each.  A node's total memory is split evenly from the
+*       host total if the node memory stats aren't supported, and a host
+*       whose nodes can't be read is a single node
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void node_mem_init(void)
+{
+    virNodeMemoryStats  stats[MEM_COORD_HOST_PARAMS];
+    unsigned long long  node_free[MEM_COORD_MAX_NODES];
+    int                 node, index, num_stats;
+
+
+    /* Get free memory (in bytes) of each node (as many as are tracked) */
+    virt_info.num_nodes = virNodeGetCellsFreeMemory(virt_info.conn, node_free, 0, MEM_COORD_MAX_NODES);
+    virt_info.num_nodes = (virt_info.num_nodes > 0 ? virt_info.num_nodes : 1);
+
+    /* Loop through each node */
+    for (node = 0; node < virt_info.num_nodes; node++)
+    {
+        /* Save free memory of node (the host free memory for a single node) and default its total to its share of the host */
+        virt_info.node_free_mem[node] = (virt_info.num_nodes > 1 ? node_free[node] / MEM_COORD_KB_SIZE : virt_info.host_unused_mem);
+        virt_info.node_total_mem[node] = virt_info.host_total_mem / virt_info.num_nodes;
+        num_stats = virt_info.host_stats;
+
+        /* Check if the node memory stats are supported and read for this node */
+        if ((num_stats > 0) && (virNodeGetMemoryStats(virt_info.conn, node, stats, &num_stats, 0) == 0))
+        {
+            /* Loop through each stat */
+            for (index = 0; index < num_stats; index++)
+            {
+                /* Save total memory of node */
+                virt_info.node_total_mem[node] = (strcmp(stats[index].field, VIR_NODE_MEMORY_STATS_TOTAL) == 0 ?
+                                                  stats[index].value : virt_info.node_total_mem[node]);
+            }
+        }
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       collect_mem_stats_domain
+*
+*   DESCRIPTION
+*
+*       Collects the balloon size and unused memory of each VM with one
+*       call per VM
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VM stats collected
+*       Others                              Error trying to collect VM stats
+*
+*************************************************************************/
+static int  collect_mem_stats_domain(void)
+{
+    int                         index, status = EXIT_SUCCESS;
+    virDomainMemoryStatStruct   mem_stats[VIR_DOMAIN_MEMORY_STAT_NR];
+    int                         num_stats;
+
+
+    /* Loop through each VM */
+    for (index = 0; (index < virt_info.num_domains) && (status == EXIT_SUCCESS) ; index++)
+    {
+        /* Get memory stats for this domain */
+        num_stats = virDomainMemoryStats(virt_info.domain_list[index], &mem_stats[0], VIR_DOMAIN_MEMORY_STAT_NR, 0);
+
+        /* Check if num stats is greater than 0  */
+        if (num_stats > 0)
+        {
+            /* Loop through all stats */
+            while (num_stats != 0)
+            {
+                /* Decrement number of stats to index into next stats array entry */
+                num_stats--;
+
+                /* Check if tag for this stat is one we want to keep */
+                switch (mem_stats[num_stats].tag)
+                {
+                    /* Get balloon size */
+                    case VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON:
+
+                        /* Save value in VM Memory info structure */
+                        vm_mem_info[index].mem_total = mem_stats[num_stats].val;
+
+                    break;
+
+                    /* Get domain unused memory */
+                    case VIR_DOMAIN_MEMORY_STAT_UNUSED:
+
+                        /* Save value as memory available */
+                        vm_mem_info[index].mem_free = mem_stats[num_stats].val;
+
+                    break;
+
+#if LIBVIR_CHECK_VERSION(2, 1, 0)
+                    /* Get domain memory usable without swapping */
+                    case VIR_DOMAIN_MEMORY_STAT_USABLE:
+
+                        /* Save value and mark it reported */
+                        vm_mem_info[index].mem_usable = mem_stats[num_stats].val;
+                        vm_mem_info[index].reported |= MEM_COORD_STAT_USABLE;
+
+                    break;
+#endif  /* LIBVIR_CHECK_VERSION(2, 1, 0) */
+
+#if LIBVIR_CHECK_VERSION(4, 6, 0)
+                    /* Get domain page cache */
+                    case VIR_DOMAIN_MEMORY_STAT_DISK_CACHES:
+
+                        /* Save value and mark it reported */
+                        vm_mem_info[index].mem_caches = mem_stats[num_stats].val;
+                        vm_mem_info[index].reported |= MEM_COORD_STAT_DISK_CACHES;
+
+                    break;
+#endif  /* LIBVIR_CHECK_VERSION(4, 6, 0) */
+
+#if LIBVIR_CHECK_VERSION(5, 4, 0)
+                    /* Get domain hugepage allocations that failed */
+                    case VIR_DOMAIN_MEMORY_STAT_HUGETLB_PGFAIL:
+
+                        /* Save value and mark it reported */
+                        vm_mem_info[index].hugetlb_fail = mem_stats[num_stats].val;
+                        vm_mem_info[index].reported |= MEM_COORD_STAT_HUGETLB_FAIL;
+
+                    break;
+#endif  /* LIBVIR_CHECK_VERSION(5, 4, 0) */
+
+                    /* Get domain total swapped in */
+                    case VIR_DOMAIN_MEMORY_STAT_SWAP_IN:
+
+                        /* Save value and mark swap reported */
+                        vm_mem_info[index].swap_in = mem_stats[num_stats].val;
+                        vm_mem_info[index].reported |= MEM_COORD_STAT_SWAP;
+
+                    break;
+
+                    /* Get domain total swapped out */
+                    case VIR_DOMAIN_MEMORY_STAT_SWAP_OUT:
+
+                        /* Save value and mark swap reported */
+                        vm_mem_info[index].swap_out = mem_stats[num_stats].val;
+                        vm_mem_info[index].reported |= MEM_COORD_STAT_SWAP;
+
+                    break;
+
+                    /* Get domain total major page faults */
+                    case VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT:
+
+                        /* Save value and mark it reported */
+                        vm_mem_info[index].major_faults = mem_stats[num_stats].val;
+                        vm_mem_info[index].reported |= MEM_COORD_STAT_MAJOR_FAULT;
+
+                    break;
+
+                    /* Default */
+                    default:
+
+                        /* Do nothing - just skip these stats */
+
+                    break;
+                }
+            }   /* while loop */
+
+            /* Stats collected for this VM */
+            vm_mem_info[index].collected = 1;
+        }
+        else if (!domain_gone(virt_info.domain_list[index]))
+        {
+            /* Set error for VM memory stats not available */
+            status = MEM_COORD_DOMAIN_MEM_ERROR;
+        }
+
+        /* NOTE:  A VM that stopped is skipped until its stop event removes it */
+    }   /* for loop */
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+#if (MEM_COORD_BULK_STATS == 1)
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       collect_mem_stats_bulk
+*
+*   DESCRIPTION
+*
+*       Collects the balloon size and unused memory of all active VMs
+*       with a single call to libvirt
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VM stats collected
+*       MEM_COORD_BULK_STATS_UNSUPPORTED    Bulk stats not supported by libvirt
+*       Others                              Error trying to collect VM stats
+*
+*************************************************************************/
+static int  collect_mem_stats_bulk(void)
+{
+    int                         num_records;
+    int                         status = EXIT_SUCCESS;
+    virDomainStatsRecordPtr *   records = NULL;
+    virErrorPtr                 error;
+
+
+    /* Get balloon stats for all active VMs in one call */
+    num_records = virConnectGetAllDomainStats(virt_info.conn, VIR_DOMAIN_STATS_BALLOON, &records,
+                                              VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE);
+
+    /* Check if stats records obtained */
+    if (num_records >= 0)
+    {
+        /* Fill in balloon stats from the records */
+        collect_mem_stats_records(records, num_records);
+
+        /* Free the records */
+        virDomainStatsRecordListFree(records);
+    }
+    else
+    {
+        /* Get error from libvirt */
+        error = virGetLastError();
+
+        /* Check if bulk stats not supported by the hypervisor */
+        if ((error != NULL) && (error->code == VIR_ERR_NO_SUPPORT))
+        {
+            /* Set unsupported status so per-VM stats will be used */
+            status = MEM_COORD_BULK_STATS_UNSUPPORTED;
+        }
+        else
+        {
+            /* Set error for VM memory stats not available */
+            status = MEM_COORD_DOMAIN_MEM_ERROR;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       collect_mem_stats_records
+*
+*   DESCRIPTION
+*
+*       Fills in the balloon size and guest memory stats of the tracked
+*       VMs from bulk stats records (read by this daemon or by the
+*       resource manager)
+*
+*   INPUTS
+*
+*       records                             Bulk stats records
+*       num_records                         Number of records
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void collect_mem_stats_records(virDomainStatsRecordPtr * records, int num_records)
+{
+    int                 index, record;
+    unsigned long long  value;
+
+
+    /* Loop through each record returned */
+    for (record = 0; record < num_records; record++)
+    {
+        /* Find the VM for this record (records are normally returned in the same order
+           as the domain list - VMs that just started and aren't tracked yet are skipped) */
+        index = vm_find(virDomainGetID(records[record]->dom), record);
+
+        /* Ensure VM is tracked and its balloon size is in the record */
+        if ((index >= 0) &&
+            (virTypedParamsGetULLong(records[record]->params, records[record]->nparams, "balloon.current", &value) == 1))
+        {
+            /* Save balloon size */
+            vm_mem_info[index].mem_total = value;
+
+            /* Save unused memory as memory available (if reported by the guest) */
+            if (virTypedParamsGetULLong(records[record]->params, records[record]->nparams, "balloon.unused", &value) == 1)
+            {
+                vm_mem_info[index].mem_free = value;
+            }
+
+            /* Save the guest memory stats used to score pressure (if reported by the guest) */
+            if (virTypedParamsGetULLong(records[record]->params, records[record]->nparams, "balloon.usable", &value) == 1)
+            {
+                vm_mem_info[index].mem_usable = value;
+                vm_mem_info[index].reported |= MEM_COORD_STAT_USABLE;
+            }
+
+            if (virTypedParamsGetULLong(records[record]->params, records[record]->nparams, "balloon.disk_caches", &value) == 1)
+            {
+                vm_mem_info[index].mem_caches = value;
+                vm_mem_info[index].reported |= MEM_COORD_STAT_DISK_CACHES;
+            }
+
+            if (virTypedParamsGetULLong(records[record]->params, records[record]->nparams, "balloon.swap_in", &value) == 1)
+            {
+                vm_mem_info[index].swap_in = value;
+                vm_mem_info[index].reported |= MEM_COORD_STAT_SWAP;
+            }
+
+            if (virTypedParamsGetULLong(records[record]->params, records[record]->nparams, "balloon.swap_out", &value) == 1)
+            {
+                vm_mem_info[index].swap_out = value;
+                vm_mem_info[index].reported |= MEM_COORD_STAT_SWAP;
+            }
+
+            if (virTypedParamsGetULLong(records[record]->params, records[record]->nparams, "balloon.major_fault", &value) == 1)
+            {
+                vm_mem_info[index].major_faults = value;
+                vm_mem_info[index].reported |= MEM_COORD_STAT_MAJOR_FAULT;
+            }
+
+            if (virTypedParamsGetULLong(records[record]->params, records[record]->nparams, "balloon.hugetlb_pgfail", &value) == 1)
+            {
+                vm_mem_info[index].hugetlb_fail = value;
+                vm_mem_info[index].reported |= MEM_COORD_STAT_HUGETLB_FAIL;
+            }
+
+            /* Stats collected for this VM */
+            vm_mem_info[index].collected = 1;
+        }
+    }
+
+    /* NOTE:  A tracked VM missing from the records has stopped and is
+              removed when its stop event is processed */
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_find
+*
+*   DESCRIPTION
+*
+*       Finds the index of the VM with the specified hypervisor ID
+*
+*   INPUTS
+*
+*       dom_id                              Hypervisor ID of VM
+*       hint                                Index to check first
+*
+*   OUTPUTS
+*
+*       >= 0                                Index of VM
+*       -1                                  VM not tracked
+*
+*************************************************************************/
+static int  vm_find(unsigned int dom_id, int hint)
+{
+    int     index;
+
+
+    /* Check hint first since this is almost always a match */
+    if ((hint < virt_info.num_domains) && (vm_mem_info[hint].dom_id == dom_id))
+    {
+        /* Return hint */
+        return (hint);
+    }
+
+    /* Loop through each VM looking for a match */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        /* Check if VM matches */
+        if (vm_mem_info[index].dom_id == dom_id)
+        {
+            /* Return index */
+            return (index);
+        }
+    }
+
+    /* Not found */
+    return (-1);
+}
+#endif  /* (MEM_COORD_BULK_STATS == 1) */
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_pressure_update
+*
+*   DESCRIPTION
+*
+*       Scores the memory pressure of a VM (0 - 100) from the memory stats
+*       collected this cycle.  The available memory is the usable memory
+*       if the guest reports it (page cache counts as available), else
+*       the unused memory plus page cache.  A VM is scored by how little
+*       memory is available or, if higher, by how fast it is swapping /
+*       taking major page faults since the last cycle, so a VM that is
+*       thrashing is scored as under pressure even when it has memory
+*       left.  Stats the guest doesn't report are left out of the score
+*
+*   INPUTS
+*
+*       mem_info                            Pointer to VM memory info
+*       now                                 Monotonic time (ns) the stats
+*                                           were collected
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void vm_pressure_update(VM_MEM_INFO * mem_info, unsigned long long now)
+{
+    unsigned long long  swap, elapsed, thrash;
+
+
+    /* Calculate available memory (usable if reported, otherwise unused plus any page cache) */
+    mem_info->mem_avail = ((mem_info->reported & MEM_COORD_STAT_USABLE) ? mem_info->mem_usable :
+                           (mem_info->mem_free + ((mem_info->reported & MEM_COORD_STAT_DISK_CACHES) ? mem_info->mem_caches : 0)));
+
+    /* Cap available memory at the balloon size (stats aren't collected atomically) */
+    mem_info->mem_avail = (mem_info->mem_avail > mem_info->mem_total ? mem_info->mem_total : mem_info->mem_avail);
+    mem_info->percent_usable = (int)((100 * mem_info->mem_avail) / mem_info->mem_total);
+
+    /* Calculate used memory (unused memory may briefly exceed the balloon size) and working set */
+    mem_info->mem_used = (mem_info->mem_total > mem_info->mem_free ? mem_info->mem_total - mem_info->mem_free : 0);
+    mem_info->mem_ws = mem_info->mem_total - mem_info->mem_avail;
+
+    /* Get totals swapped in / out */
+    swap = mem_info->swap_in + mem_info->swap_out;
+
+    /* No swap / fault rates until the second cycle (or if the totals went backwards after a guest reboot) */
+    mem_info->swap_rate = 0;
+    mem_info->fault_rate = 0;
+    elapsed = now - mem_info->stats_ns;
+
+    /* Check if the VM was scored before */
+    if ((mem_info->stats_ns != 0) && (elapsed > 0))
+    {
+        /* Check if swap is reported and didn't go backwards */
+        if ((mem_info->reported & MEM_COORD_STAT_SWAP) && (swap >= mem_info->swap_last))
+        {
+            /* Calculate swap rate (KB/s) since the last cycle */
+            mem_info->swap_rate = ((swap - mem_info->swap_last) * INTERVAL_NSECS_PER_SEC) / elapsed;
+        }
+
+        /* Check if major page faults are reported and didn't go backwards */
+        if ((mem_info->reported & MEM_COORD_STAT_MAJOR_FAULT) && (mem_info->major_faults >= mem_info->faults_last))
+        {
+            /* Calculate major page fault rate since the last cycle */
+            mem_info->fault_rate = ((mem_info->major_faults - mem_info->faults_last) * INTERVAL_NSECS_PER_SEC) / elapsed;
+        }
+    }
+
+    /* Save totals for the next cycle */
+    mem_info->swap_last = swap;
+    mem_info->faults_last = mem_info->major_faults;
+    mem_info->stats_ns = now;
+
+    /* Score thrashing by the higher of the swap / major page fault rates (capped at full pressure) */
+    thrash = (mem_info->swap_rate * 100) / MEM_COORD_SWAP_THRASH_RATE;
+    thrash = ((mem_info->fault_rate * 100) / MEM_COORD_FAULT_THRASH_RATE > thrash ?
+              (mem_info->fault_rate * 100) / MEM_COORD_FAULT_THRASH_RATE : thrash);
+    thrash = (thrash > 100 ? 100 : thrash);
+
+    /* Score pressure by the higher of how little memory is available and thrashing */
+    mem_info->pressure = ((100 - mem_info->percent_usable) > (int)thrash ? (100 - mem_info->percent_usable) : (int)thrash);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_trend_update
+*
+*   DESCRIPTION
+*
+*       Adds the used memory (balloon size less available memory) collected
+*       this cycle to a VM's history and estimates how much more memory
+*       the VM will use before the next cycle from the rate its used
+*       memory changed over the history.  Used memory is tracked (not
+*       unused memory) so balloon resizes don't look like usage changes
+*
+*   INPUTS
+*
+*       mem_info                            Pointer to VM memory info
+*       now                                 Monotonic time (ns) the stats
+*                                           were collected
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void vm_trend_update(VM_MEM_INFO * mem_info, unsigned long long now)
+{
+    unsigned long long  used, elapsed;
+    int                 oldest, newest, sample, falling;
+
+
+    /* Track the working set as used memory */
+    used = mem_info->mem_ws;
+
+    /* Replace oldest sample in the history */
+    mem_info->used_hist[mem_info->next_hist] = used;
+    mem_info->time_hist[mem_info->next_hist] = now;
+    mem_info->next_hist = (mem_info->next_hist + 1) % MEM_COORD_TREND_SAMPLES;
+    mem_info->num_hist += (mem_info->num_hist < MEM_COORD_TREND_SAMPLES);
+
+    /* No trend until at least 2 samples are kept */
+    mem_info->mem_growth = 0;
+    mem_info->trend_down = 0;
+
+    /* Check if there are enough samples for a trend */
+    if (mem_info->num_hist >= 2)
+    {
+        /* Get oldest and newest samples */
+        oldest = (mem_info->next_hist + MEM_COORD_TREND_SAMPLES - mem_info->num_hist) % MEM_COORD_TREND_SAMPLES;
+        newest = (mem_info->next_hist + MEM_COORD_TREND_SAMPLES - 1) % MEM_COORD_TREND_SAMPLES;
+        elapsed = mem_info->time_hist[newest] - mem_info->time_hist[oldest];
+
+        /* Ensure time elapsed between samples */
+        if (elapsed > 0)
+        {
+            /* Predict change in used memory over the next interval from the rate over the history */
+            mem_info->mem_growth = ((long long)mem_info->used_hist[newest] - (long long)mem_info->used_hist[oldest]) *
+                                   (long long)virt_info.interval.interval_ms * (long long)INTERVAL_NSECS_PER_MSEC / (long long)elapsed;
+        }
+
+        /* Check if used memory fell between every pair of samples of a full history */
+        falling = (mem_info->num_hist == MEM_COORD_TREND_SAMPLES);
+
+        for (sample = oldest; (falling) && (sample != newest); sample = (sample + 1) % MEM_COORD_TREND_SAMPLES)
+        {
+            falling = (mem_info->used_hist[(sample + 1) % MEM_COORD_TREND_SAMPLES] < mem_info->used_hist[sample]);
+        }
+
+        /* Usage is clearly falling if it fell every cycle and by more than the configured % of the balloon per cycle */
+        mem_info->trend_down = ((falling) &&
+                                ((-mem_info->mem_growth * 100) > (long long)(mem_info->mem_total * MEM_COORD_TREND_DOWN_PERCENT)));
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_growth_headroom
+*
+*   DESCRIPTION
+*
+*       Calculates the extra balloon size a VM needs so that memory it is
+*       predicted to use before the next cycle doesn't eat into its target
+*       available memory
+*
+*   INPUTS
+*
+*       mem_info                            Pointer to VM memory info
+*
+*   OUTPUTS
+*
+*       long long                           Extra balloon size (0 if not
+*                                           predicting or usage not growing)
+*
+*************************************************************************/
+static long long vm_growth_headroom(VM_MEM_INFO * mem_info)
+{
+    /* Extra balloon with the target % available on top of the predicted growth */
+    return (((predict) && (mem_info->mem_growth > 0)) ?
+            ((mem_info->mem_growth * 100) / (100 - vm_tgt_percent)) : 0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_memory_adjust
+*
+*   DESCRIPTION
+*
+*       Adjusts memory allocated for each VM based on demands and available
+*       memory on the host
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Adjustment of memory for VM
+*                                           was successful
+*       Other                               Error when adjusting VM memory
+*
+*************************************************************************/
+static int  vm_memory_adjust(void)
+{
+    int                 index, status = EXIT_SUCCESS;
+    int                 host_precent_free;
+    long long           mem_adj, node_room;
+    unsigned long long  mem_old, mem_room, low_mem;
+
+
+    /* Reset number of resizes that timed out this cycle */
+    virt_info.num_timeouts = 0;
+
+    /* Loop through all VMs that have "high" memory and reclaim it */
+    for (index = bitmask_next_set(&virt_info.high_mem_mask, 0);
+         (index >= 0) && (status == EXIT_SUCCESS);
+         index = bitmask_next_set(&virt_info.high_mem_mask, index + 1))
+    {
+        /* Calculate reduced memory size of VM so VM will have configured target available percentage
+           (keeping the headroom it is predicted to use before the next cycle) */
+        mem_adj = (((long long)vm_mem_info[index].mem_total * (vm_mem_info[index].percent_avail - vm_tgt_percent)) / 100) -
+                  vm_growth_headroom(&vm_mem_info[index]);
+
+        /* Reclaim at least down to the VM's largest size (if above it) */
+        mem_adj = ((vm_mem_info[index].mem_total > vm_size_max(&vm_mem_info[index])) &&
+                   (mem_adj < (long long)(vm_mem_info[index].mem_total - vm_size_max(&vm_mem_info[index]))) ?
+                   (long long)(vm_mem_info[index].mem_total - vm_size_max(&vm_mem_info[index])) : mem_adj);
+
+        /* Never reclaim the VM below its configured minimum */
+        mem_adj = (((long long)vm_mem_info[index].mem_total - mem_adj) < (long long)vm_mem_info[index].min_mem ?
+                   (long long)vm_mem_info[index].mem_total - (long long)vm_mem_info[index].min_mem : mem_adj);
+
+        /* Reclaim whole pages backing the VM (never more than planned) */
+        mem_adj = (mem_adj > 0 ? (long long)vm_reclaim_align(&vm_mem_info[index], mem_adj, mem_adj) : mem_adj);
+
+        /* Check if there is memory to reclaim */
+        if (mem_adj > 0)
+        {
+            /* Decrease VM memory size */
+            vm_mem_info[index].mem_total -= mem_adj;
+            vm_mem_info[index].mem_change -= mem_adj;
+
+            /* Give memory taken from this VM back to host free memory (less what it already gave back) */
+            virt_info.host_free_mem += vm_host_credit(&vm_mem_info[index], (unsigned long long)mem_adj);
+
+            /* Set new memory size for VM */
+            status = vm_set_memory(index, 1);
+        }
+
+        /* Clear this VMs bit from high mask */
+        BITMASK_CLEAR(&virt_info.high_mem_mask, index);
+    }
+
+    /* NOTE:  Host free memory read by collect_mem_stats is tracked locally from here on
+              (memory reclaimed is added and memory given is subtracted) rather than read
+              again, since queued resizes may not have happened yet */
+
+    /* Loop through all VMs that have "low" memory and try to provide them more memory */
+    for (index = bitmask_next_set(&virt_info.low_mem_mask, 0);
+         (index >= 0) && (status == EXIT_SUCCESS);
+         index = bitmask_next_set(&virt_info.low_mem_mask, index + 1))
+    {
+        /* Calculate memory increase for VM to bring it to target (none if a thrashing VM is above target) */
+        mem_adj = (((long long)vm_mem_info[index].mem_total * (vm_tgt_percent - vm_mem_info[index].percent_avail)) / 100);
+        mem_adj = (mem_adj > 0 ? mem_adj : 0);
+
+        /* Increase at least up to the VM's configured minimum (if below it) */
+        mem_adj = (((long long)vm_mem_info[index].mem_total + mem_adj) < (long long)vm_mem_info[index].min_mem ?
+                   (long long)vm_mem_info[index].min_mem - (long long)vm_mem_info[index].mem_total : mem_adj);
+
+        /* Add the headroom it is predicted to use before the next cycle (so it still has its target then)
+           and the memory it swapped / faulted in over the last interval (its working set that doesn't fit) */
+        mem_adj += vm_growth_headroom(&vm_mem_info[index]) +
+                   (long long)(((vm_mem_info[index].swap_rate + (vm_mem_info[index].fault_rate * MEM_COORD_PAGE_KB)) *
+                                virt_info.interval.interval_ms) / INTERVAL_MSECS_PER_SEC);
+
+        /* Check if the VM's NUMA nodes would be left low on free memory by this adjustment (NUMA host only) */
+        if ((numa_mode != MEM_COORD_NUMA_OFF) && (virt_info.num_nodes > 1) && (vm_mem_info[index].node_mask != 0) &&
+            (node_mem_room(vm_mem_info[index].node_mask, host_low_percent) < mem_adj))
+        {
+            /* Reclaim memory the VMs on the same nodes can spare to cover the increase and bring the nodes to target */
+            status = vm_reclaim_plan((unsigned long long)(mem_adj - node_mem_room(vm_mem_info[index].node_mask, host_tgt_percent)),
+                                     MEM_COORD_RECLAIM_SPARE_TIERS, vm_mem_info[index].node_mask, index);
+
+            /* Check if the nodes still can't cover the increase (warn / add a node / grow by what they hold) */
+            mem_adj = (((status == EXIT_SUCCESS) && (node_mem_room(vm_mem_info[index].node_mask, host_low_percent) < mem_adj)) ?
+                       vm_numa_overflow(index, mem_adj) : mem_adj);
+        }
+        /* Check if the VM's nodes have room again after running out */
+        else if (vm_mem_info[index].numa_warned)
+        {
+            /* Warn again the next time they run out */
+            vm_mem_info[index].numa_warned = 0;
+        }
+
+        /* Calculate percent of host memory that is free / available AFTER adjustment to VM */
+        host_precent_free = (int)((((long long)virt_info.host_free_mem - mem_adj) * 100) / (long long)virt_info.host_total_mem);
+
+        /* Check if the host would be left low on memory by this adjustment */
+        if (host_precent_free <= host_low_percent)
+        {
+            /* Reclaim memory VMs not under pressure can spare to cover the increase and bring the host to target */
+            status = vm_reclaim_plan(virt_info.host_tgt_mem + mem_adj - virt_info.host_free_mem,
+                                     MEM_COORD_RECLAIM_SPARE_TIERS, 0, index);
+
+            /* Check if the host is still below target */
+            if ((status == EXIT_SUCCESS) && (virt_info.host_free_mem < virt_info.host_tgt_mem))
+            {
+                /* Reclaim down to each other VM's floor to bring the host back to target (not to cover the increase
+                   - and never from this VM, which is sized from its balloon before the reclaim) */
+                status = vm_reclaim_plan(virt_info.host_tgt_mem - virt_info.host_free_mem, MEM_COORD_RECLAIM_TIERS, 0, index);
+            }
+
+            /* Calculate percent of host memory that is free / available AFTER adjustment to VM (following the reclaim) */
+            host_precent_free = (int)((((long long)virt_info.host_free_mem - mem_adj) * 100) / (long long)virt_info.host_total_mem);
+        }
+
+        /* Check if the host is above the configured low memory threshold (after this memory adjustment) */
+        if ((status == EXIT_SUCCESS) && (host_precent_free > host_low_percent))
+        {
+            /* Save current VM memory size */
+            mem_old = vm_mem_info[index].mem_total;
+
+            /* Increase VM memory size */
+            vm_mem_info[index].mem_total += mem_adj;
+
+            /* Limit VM memory to maximum memory size (or its configured maximum) */
+            vm_mem_info[index].mem_total =
+                    (vm_mem_info[index].mem_total > vm_size_max(&vm_mem_info[index]) ?
+                     vm_size_max(&vm_mem_info[index]) : vm_mem_info[index].mem_total);
+
+            /* Give whole pages backing the VM */
+            vm_mem_info[index].mem_total = vm_grant_align(&vm_mem_info[index], vm_mem_info[index].mem_total, mem_old,
+                                                          vm_size_max(&vm_mem_info[index]));
+
+            /* Get host memory the VM may be given without leaving the host low - and without leaving its
+               nodes low if they covered the increase (rounding up to a page may add up to a whole page) */
+            low_mem = ((unsigned long long)host_low_percent * virt_info.host_total_mem) / 100;
+            mem_room = (virt_info.host_free_mem > low_mem ? virt_info.host_free_mem - low_mem : 0);
+            node_room = (((numa_mode != MEM_COORD_NUMA_OFF) && (virt_info.num_nodes > 1) &&
+                          (vm_mem_info[index].node_mask != 0)) ?
+                         node_mem_room(vm_mem_info[index].node_mask, host_low_percent) : -1);
+            mem_room = (((node_room >= mem_adj) && ((unsigned long long)node_room < mem_room)) ?
+                        (unsigned long long)node_room : mem_room);
+
+            /* Check if the aligned increase doesn't fit (give whole pages short of the room instead, never less
+               than the VM has) */
+            if ((vm_mem_info[index].mem_total - mem_old) > mem_room)
+            {
+                vm_mem_info[index].mem_total = MEM_COORD_ALIGN_DOWN(mem_old + mem_room, vm_align_kb(&vm_mem_info[index]));
+                vm_mem_info[index].mem_total = (vm_mem_info[index].mem_total < mem_old ? mem_old : vm_mem_info[index].mem_total);
+            }
+
+            /* Adjust VM memory (unless no whole page fits) */
+            status = ((vm_mem_info[index].mem_total != mem_old) ? vm_set_memory(index, 1) : EXIT_SUCCESS);
+
+            /* Take memory given to this VM out of host free memory (never below 0) and the free memory of its nodes */
+            virt_info.host_free_mem -= ((vm_mem_info[index].mem_total - mem_old) < virt_info.host_free_mem ?
+                                        (vm_mem_info[index].mem_total - mem_old) : virt_info.host_free_mem);
+            node_mem_adjust(vm_mem_info[index].node_mask, -(long long)(vm_mem_info[index].mem_total - mem_old));
+            vm_mem_info[index].mem_change += (long long)(vm_mem_info[index].mem_total - mem_old);
+        }
+
+        /* Clear this VMs bit from low mask (a VM the host can't cover is skipped until the next cycle) */
+        BITMASK_CLEAR(&virt_info.low_mem_mask, index);
+    }
+
+    /* Check if the host is low on memory (even if no VM needed more memory) */
+    if ((status == EXIT_SUCCESS) &&
+        (((virt_info.host_free_mem * 100) / virt_info.host_total_mem) <= (unsigned long long)host_low_percent))
+    {
+        /* Reclaim memory to bring the host back to target (down to each VM's floor if needed) */
+        status = vm_reclaim_plan(virt_info.host_tgt_mem - virt_info.host_free_mem, MEM_COORD_RECLAIM_TIERS, 0, -1);
+    }
+
+    /* Wait for the memory increases / host reclaims */
+    status = (status == EXIT_SUCCESS ? vm_set_memory_wait() : status);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_reclaim_capacity
+*
+*   DESCRIPTION
+*
+*       Calculates how much memory a VM can give up in a tier of the host
+*       reclaim.  Each tier lowers the balloon size a VM is reclaimed down
+*       to (keeping any headroom it is predicted to use before the next
+*       cycle), but never below the VM's floor - its working set or
+*       minimum size, whichever is larger.  A VM that is low on memory,
+*       was given memory this cycle, is under more pressure than its
+*       target, is CPU saturated, has a fully committed hugepage pool or
+*       has a raised priority (configuration file) only gives up memory
+*       in the last (floor) tier.  Levels are rounded up to the pages
+*       backing the VM
+*
+*   INPUTS
+*
+*       index                               Index of VM
+*       tier                                MEM_COORD_RECLAIM_xxx tier
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Memory (KB) the VM can give
+*                                           up in the tier
+*
+*************************************************************************/
+static unsigned long long vm_reclaim_capacity(int index, int tier)
+{
+    unsigned long long  level, floor, headroom, capacity = 0;
+    int                 needy;
+
+
+    /* Check if stats were collected for this VM this cycle */
+    if (vm_mem_info[index].collected)
+    {
+        /* Get headroom VM is predicted to use before the next cycle */
+        headroom = (unsigned long long)vm_growth_headroom(&vm_mem_info[index]);
+
+        /* Calculate floor VM is never reclaimed below */
+        floor = vm_mem_info[index].mem_ws + headroom;
+        floor = (floor > vm_size_min(&vm_mem_info[index]) ? floor : vm_size_min(&vm_mem_info[index]));
+
+        /* Check if VM needs its memory, is out of hugepages or has a raised priority (only the floor tier takes from it) */
+        needy = ((BITMASK_TEST(&virt_info.low_mem_mask, index)) || (vm_mem_info[index].mem_change > 0) ||
+                 (vm_mem_info[index].pressure >= (100 - vm_tgt_percent)) ||
+                 (vm_mem_info[index].cpu_saturated) || (vm_mem_info[index].hugetlb_full) ||
+                 (vm_mem_info[index].priority > 0));
+
+        /* Get balloon size VM is reclaimed down to in this tier (the largest size if the tier doesn't apply to the VM)
+           NOTE:  Sizes are rounded up so a VM reclaimed to its low threshold isn't seen as below it next cycle */
+        level = ((tier == MEM_COORD_RECLAIM_EXCESS) && (!needy) ?
+                 ((vm_mem_info[index].mem_used + headroom) * 100 + (100 - vm_tgt_percent - 1)) /
+                 (100 - vm_tgt_percent) :
+                 (tier == MEM_COORD_RECLAIM_SPARE) && (!needy) ?
+                 ((vm_mem_info[index].mem_used + headroom) * 100 + (100 - vm_low_percent - 1)) /
+                 (100 - vm_low_percent) :
+                 (tier == MEM_COORD_RECLAIM_FLOOR) ? floor : vm_mem_info[index].mem_total);
+
+        /* Never reclaim below the floor (or part of a page backing the VM) */
+        level = (level > floor ? level : floor);
+        level = MEM_COORD_ALIGN_UP(level, vm_align_kb(&vm_mem_info[index]));
+
+        /* Calculate memory VM has above this level */
+        capacity = (vm_mem_info[index].mem_total > level ? vm_mem_info[index].mem_total - level : 0);
+    }
+
+    /* Return capacity to caller */
+    return (capacity);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_reclaim_plan
+*
+*   DESCRIPTION
+*
+*       Plans and makes the balloon reductions that give the host the
+*       memory needed.  Tiers are taken in order, so memory is reclaimed
+*       above each VM's target before any VM is taken closer to its low
+*       threshold or floor.  Within a tier each VM gives up memory in
+*       proportion to what it has in that tier - if the tier has more
+*       than is needed the need is met exactly, otherwise the whole tier
+*       is taken and the rest is planned from the next tier.  So the host
+*       reaches its target in one cycle whenever the VMs can spare it.
+*       Memory needed by NUMA nodes is only reclaimed from the VMs known
+*       to be on them, and memory needed to grow a VM is never reclaimed
+*       from that VM
+*
+*   INPUTS
+*
+*       mem_needed                          Memory (KB) to reclaim
+*       num_tiers                           Number of tiers that may be
+*                                           taken (MEM_COORD_RECLAIM_TIERS
+*                                           to include the floor tier,
+*                                           MEM_COORD_RECLAIM_SPARE_TIERS
+*                                           to stop short of it)
+*       node_mask                           Nodes the memory is needed on
+*                                           (0 = anywhere on the host)
+*       exclude                             Index of VM never reclaimed
+*                                           from (-1 = none)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Reclaim planned (may be less
+*                                           than needed)
+*       Other                               Error waiting for resizes
+*
+*************************************************************************/
+static int  vm_reclaim_plan(unsigned long long mem_needed, int num_tiers, unsigned long long node_mask, int exclude)
+{
+    int                 vm, tier, status;
+    unsigned long long  capacity, tier_capacity, mem_take;
+
+
+    /* Wait for the resizes already queued so each VM's resizes happen in order */
+    status = vm_set_memory_wait();
+
+    /* Loop through each tier until the memory needed is planned */
+    for (tier = 0; (tier < num_tiers) && (mem_needed > 0) && (status == EXIT_SUCCESS); tier++)
+    {
+        /* Sum memory VMs can give up in this tier */
+        tier_capacity = 0;
+
+        for (vm = 0; vm < virt_info.num_domains; vm++)
+        {
+            tier_capacity += ((vm != exclude) && ((node_mask == 0) || (vm_mem_info[vm].node_mask & node_mask)) ?
+                              vm_reclaim_capacity(vm, tier) : 0);
+        }
+
+        /* Loop through each VM while this tier has memory to give up */
+        for (vm = 0; (vm < virt_info.num_domains) && (tier_capacity > 0); vm++)
+        {
+            /* Get memory this VM can give up in this tier (none if excluded or not on the nodes the memory is needed on) */
+            capacity = ((vm != exclude) && ((node_mask == 0) || (vm_mem_info[vm].node_mask & node_mask)) ?
+                        vm_reclaim_capacity(vm, tier) : 0);
+
+            /* Take all of it if the tier doesn't cover the need, otherwise its proportion of the need
+               (in whole pages backing the VM) */
+            mem_take = (tier_capacity <= mem_needed ? capacity : (capacity * mem_needed) / tier_capacity);
+            mem_take = vm_reclaim_align(&vm_mem_info[vm], mem_take, capacity);
+
+            /* Check if there is memory to take from this VM */
+            if (mem_take > 0)
+            {
+                /* Decrease VM memory size */
+                vm_mem_info[vm].mem_total -= mem_take;
+                vm_mem_info[vm].mem_change -= (long long)mem_take;
+
+                /* Give memory taken from this VM back to host free memory (less what it already gave back) */
+                virt_info.host_free_mem += vm_host_credit(&vm_mem_info[vm], mem_take);
+
+                /* Adjust VM memory ignoring any errors */
+                vm_set_memory(vm, 0);
+            }
+        }
+
+        /* Take memory from this tier out of the need */
+        mem_needed -= (tier_capacity < mem_needed ? tier_capacity : mem_needed);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_host_credit
+*
+*   DESCRIPTION
+*
+*       Calculates how much host memory a reclaim from a VM frees.  The
+*       balloon takes the guest's unused memory first, and a guest that
+*       reports its free pages has already given that memory back to the
+*       host - only the rest (ie page cache the guest drops) is freed.
+*       The memory freed is added to the free memory of the VM's nodes
+*       and is released to the grants by the VM's resize steps as they
+*       make it (vm_step_memory)
+*
+*   INPUTS
+*
+*       mem_info                            Pointer to VM memory info
+*       mem_take                            Memory (KB) reclaimed
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Host memory (KB) freed
+*
+*************************************************************************/
+static unsigned long long vm_host_credit(VM_MEM_INFO * mem_info, unsigned long long mem_take)
+{
+    unsigned long long  reported = (mem_take < mem_info->mem_reported ? mem_take : mem_info->mem_reported);
+
+
+    /* Take reclaimed memory the host already had out of the unused memory reported */
+    mem_info->mem_reported -= reported;
+
+    /* Hold back memory freed from the grants until the resize steps reclaim it */
+    mem_info->mem_credit += (mem_take - reported);
+
+    /* Give memory freed back to the free memory of the VM's NUMA nodes */
+    node_mem_adjust(mem_info->node_mask, (long long)(mem_take - reported));
+
+    /* Return host memory freed to caller */
+    return (mem_take - reported);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_numa_overflow
+*
+*   DESCRIPTION
+*
+*       Handles a VM growing on NUMA nodes that are out of free memory
+*       even after the VMs on them gave up what they can spare.  In
+*       spread mode (-n 2) the node with the most free memory is added to
+*       the nodeset of a VM bound to its nodes.  Otherwise the VM is
+*       warned about (once until its nodes have room again), and a VM
+*       bound to its nodes is only grown by what they hold - the rest of
+*       its memory couldn't be placed - while an unbound VM grows onto
+*       the other nodes
+*
+*   INPUTS
+*
+*       index                               Index of VM
+*       mem_adj                             Memory (KB) the VM is to be
+*                                           given
+*
+*   OUTPUTS
+*
+*       long long                           Memory (KB) to give the VM
+*
+*************************************************************************/
+static long long vm_numa_overflow(int index, long long mem_adj)
+{
+    virTypedParameterPtr    params = NULL;
+    int                     node, best = -1, num_params = 0, max_params = 0;
+    long long               room = node_mem_room(vm_mem_info[index].node_mask, host_low_percent);
+    char                    nodeset[MEM_COORD_NODESET_LEN];
+
+
+    /* Check if a node may be added to the nodeset of a VM bound to its nodes */
+    if ((numa_mode == MEM_COORD_NUMA_SPREAD) && (vm_mem_info[index].numa_strict) && (vm_mem_info[index].numa_mask != 0))
+    {
+        /* Loop through each node not in the nodeset */
+        for (node = 0; node < virt_info.num_nodes; node++)
+        {
+            /* Keep the node with the most memory above its low threshold */
+            best = (((!(vm_mem_info[index].numa_mask & (1ULL << node))) && (node_mem_room(1ULL << node, host_low_percent) > 0) &&
+                     ((best < 0) || (node_mem_room(1ULL << node, host_low_percent) > node_mem_room(1ULL << best, host_low_percent)))) ?
+                    node : best);
+        }
+
+        /* Check if a node with room was found */
+        if (best >= 0)
+        {
+            /* Get the nodeset with the node added */
+            nodeset_format(vm_mem_info[index].numa_mask | (1ULL << best), nodeset, sizeof(nodeset));
+
+            /* Check if the nodeset of the VM was set (live) */
+            if ((virTypedParamsAddString(&params, &num_params, &max_params, VIR_DOMAIN_NUMA_NODESET, nodeset) == 0) &&
+                (virDomainSetNumaParameters(virt_info.domain_list[index], params, num_params, VIR_DOMAIN_AFFECT_LIVE) == 0))
+            {
+                /* Save new nodes of the VM (its memory can now grow onto the node added) */
+                vm_mem_info[index].numa_mask |= (1ULL << best);
+                vm_mem_info[index].node_mask = vm_mem_info[index].numa_mask;
+                fprintf(stderr, "%s: NUMA nodes out of free memory - nodeset widened to %s\n\r", vm_mem_info[index].name, nodeset);
+            }
+            else
+            {
+                /* Not widened */
+                best = -1;
+            }
+
+            /* Free parameters */
+            virTypedParamsFree(params, num_params);
+        }
+    }
+
+    /* Check if the nodeset wasn't widened */
+    if (best < 0)
+    {
+        /* Check if not warned about yet */
+        if (!vm_mem_info[index].numa_warned)
+        {
+            /* Warn that the VM's nodes are out of free memory */
+            nodeset_format(vm_mem_info[index].node_mask, nodeset, sizeof(nodeset));
+            fprintf(stderr, "%s: NUMA nodes %s out of free memory - %s\n\r", vm_mem_info[index].name, nodeset,
+                    (vm_mem_info[index].numa_strict && vm_mem_info[index].numa_mask ? "growth limited to the nodes" :
+                                                                                      "growing onto other nodes"));
+            vm_mem_info[index].numa_warned = 1;
+        }
+
+        /* Only grow a VM bound to its nodes by the memory they hold (in whole pages backing it) */
+        mem_adj = ((vm_mem_info[index].numa_strict && vm_mem_info[index].numa_mask) ?
+                   (room > 0 ? (long long)MEM_COORD_ALIGN_DOWN((unsigned long long)(room < mem_adj ? room : mem_adj),
+                                                               vm_align_kb(&vm_mem_info[index])) : 0) :
+                   mem_adj);
+    }
+
+    /* Return memory to give the VM to caller */
+    return (mem_adj);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       node_mem_room
+*
+*   DESCRIPTION
+*
+*       Calculates the free memory of NUMA nodes above a % of their total
+*       memory (the host thresholds applied to the nodes)
+*
+*   INPUTS
+*
+*       node_mask                           Nodes to check
+*       percent                             % of node memory kept free
+*
+*   OUTPUTS
+*
+*       long long                           Free memory (KB) above the %
+*                                           (< 0 = below it)
+*
+*************************************************************************/
+static long long node_mem_room(unsigned long long node_mask, int percent)
+{
+    int                 node;
+    long long           room = 0;
+
+
+    /* Loop through each node in the mask */
+    for (node = 0; node < virt_info.num_nodes; node++)
+    {
+        /* Add free memory of node above its % */
+        room += ((node_mask & (1ULL << node)) ?
+                 (long long)virt_info.node_free_mem[node] - (long long)((virt_info.node_total_mem[node] * percent) / 100) : 0);
+    }
+
+    /* Return room to caller */
+    return (room);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       node_mem_adjust
+*
+*   DESCRIPTION
+*
+*       Tracks the free memory of NUMA nodes across a resize of a VM on
+*       them (as host free memory is tracked) - the change is split
+*       evenly between the nodes
+*
+*   INPUTS
+*
+*       node_mask                           Nodes of VM (0 = not known)
+*       mem_change                          Memory (KB) freed (< 0 = used)
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void node_mem_adjust(unsigned long long node_mask, long long mem_change)
+{
+    int                 node, num_nodes = 0;
+    long long           share;
+
+
+    /* Count nodes in the mask */
+    for (node = 0; node < virt_info.num_nodes; node++)
+    {
+        num_nodes += ((node_mask & (1ULL << node)) != 0);
+    }
+
+    /* Get share of the change for each node */
+    share = (num_nodes ? mem_change / num_nodes : 0);
+
+    /* Loop through each node in the mask */
+    for (node = 0; (node < virt_info.num_nodes) && (share != 0); node++)
+    {
+        /* Adjust free memory of node (never below 0) */
+        virt_info.node_free_mem[node] = (!(node_mask & (1ULL << node)) ? virt_info.node_free_mem[node] :
+                                         ((long long)virt_info.node_free_mem[node] + share > 0) ?
+                                         (unsigned long long)((long long)virt_info.node_free_mem[node] + share) : 0);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_set_memory
+*
+*   DESCRIPTION
+*
+*       Sets the balloon size of a VM to its memory total.  The memory
+*       total becomes the VM's target and the first step towards it is
+*       made now (see vm_step_memory) - the rest of a resize larger than
+*       the rate limits allow is stepped by vm_step_memory_wait
+*
+*   INPUTS
+*
+*       index                               Index of VM to resize
+*       check                               Non-zero if a failed resize is
+*                                           an error (0 = errors ignored)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VM resized (or resize queued or
+*                                           VM skipped)
+*       MEM_COORD_SET_MEM_ERROR             Error resizing VM
+*       MEM_COORD_NOMEM                     Error with memory allocation
+*
+*************************************************************************/
+static int  vm_set_memory(int index, int check)
+{
+    /* Save requested balloon size as the VM's target (replacing any resize still in progress) */
+    vm_mem_info[index].mem_target = vm_mem_info[index].mem_total;
+
+    /* Make the first resize step now and return status to caller */
+    return (vm_step_memory(index, check, interval_now()));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_step_memory
+*
+*   DESCRIPTION
+*
+*       Moves the balloon size of a VM towards its target by as much as
+*       the inflate (reclaim) or deflate (grant) rate allows since its
+*       last step, never more than one sub-interval's worth, so a guest's
+*       balloon driver isn't asked to give up hundreds of MB at once.
+*       Steps end on the pages backing the VM (a page larger than the rate
+*       allows in a sub-interval is stepped once the rate allows it).
+*       A grant is paced behind the reclaims that fund it - it never takes
+*       the host memory the steps made so far leave below the host low
+*       threshold, and a reclaim step releases the host memory credited
+*       for the part of the reclaim it made.
+*       When workers are used the step is queued (so a slow guest doesn't
+*       hold up the resizes of other VMs) and its result is checked by
+*       vm_set_memory_wait.  Otherwise the VM is resized inline.  An
+*       unchecked step that fails ends the resize (the next cycle decides
+*       again)
+*
+*   INPUTS
+*
+*       index                               Index of VM to resize
+*       check                               Non-zero if a failed resize is
+*                                           an error (0 = errors ignored)
+*       now                                 Monotonic time (ns) of the step
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VM resized (or resize queued or
+*                                           VM skipped)
+*       MEM_COORD_SET_MEM_ERROR             Error resizing VM
+*       MEM_COORD_NOMEM                     Error with memory allocation
+*
+*************************************************************************/
+static int  vm_step_memory(int index, int check, unsigned long long now)
+{
+    int                 status = EXIT_SUCCESS;
+    unsigned long long  mem_next, mem_step, elapsed, elapsed_max, rate, align;
+    unsigned long long  low_mem, budget, released;
+    VM_MEM_INFO *       mem_info = &vm_mem_info[index];
+    TRACE_RESIZE        record;
+
+
+    /* Get rate for this resize (inflating the balloon reclaims memory from the VM) */
+    rate = (mem_info->mem_target < mem_info->mem_balloon ? inflate_rate : deflate_rate);
+
+    /* Get alignment of the steps (pages backing the VM) */
+    align = vm_align_kb(mem_info);
+
+    /* Get longest time a step is made up of - one sub-interval, so an idle VM doesn't build up a large step,
+       or the time the rate allows one page in if longer */
+    elapsed_max = MEM_COORD_STEP_MS * INTERVAL_NSECS_PER_MSEC;
+    elapsed_max = ((rate) && (((align * INTERVAL_NSECS_PER_SEC) / (rate * MEM_COORD_KB_SIZE)) > elapsed_max) ?
+                   (align * INTERVAL_NSECS_PER_SEC) / (rate * MEM_COORD_KB_SIZE) : elapsed_max);
+
+    /* Get time since the last step */
+    elapsed = now - mem_info->step_ns;
+    elapsed = (elapsed > elapsed_max ? elapsed_max : elapsed);
+
+    /* Calculate largest step allowed (the whole resize if unlimited) */
+    mem_step = (rate ? (rate * MEM_COORD_KB_SIZE * elapsed) / INTERVAL_NSECS_PER_SEC :
+                (mem_info->mem_target < mem_info->mem_balloon ? mem_info->mem_balloon - mem_info->mem_target :
+                 mem_info->mem_target - mem_info->mem_balloon));
+
+    /* Get host memory the steps made so far leave above the host low threshold */
+    low_mem = ((unsigned long long)host_low_percent * virt_info.host_total_mem) / 100;
+    budget = (virt_info.host_step_mem > low_mem ? virt_info.host_step_mem - low_mem : 0);
+
+    /* Never grant more than that (a grant funded by reclaims waits for their steps to free the memory) */
+    mem_step = ((mem_info->mem_target > mem_info->mem_balloon) && (mem_step > budget) ? budget : mem_step);
+
+    /* Calculate balloon size of this step (not past the target) - a step short of the target ends
+       on a whole page (rounded back towards the current size) */
+    mem_next = (mem_info->mem_target < mem_info->mem_balloon ?
+                (mem_info->mem_balloon - mem_info->mem_target > mem_step ?
+                 MEM_COORD_ALIGN_UP(mem_info->mem_balloon - mem_step, align) : mem_info->mem_target) :
+                (mem_info->mem_target - mem_info->mem_balloon > mem_step ?
+                 MEM_COORD_ALIGN_DOWN(mem_info->mem_balloon + mem_step, align) : mem_info->mem_target));
+
+    /* Don't step back past the current size (a balloon not on a page boundary) */
+    mem_next = (((mem_info->mem_target < mem_info->mem_balloon) && (mem_next > mem_info->mem_balloon)) ||
+                ((mem_info->mem_target > mem_info->mem_balloon) && (mem_next < mem_info->mem_balloon)) ?
+                mem_info->mem_balloon : mem_next);
+
+    /* Check if there is a step to make (a step too small to allow yet waits for the next sub-interval) */
+    if ((mem_next != mem_info->mem_balloon) || (mem_next == mem_info->mem_target))
+    {
+        /* Save resize step being made for the trace */
+        record.from = mem_info->mem_balloon;
+        record.to = mem_next;
+        record.target = mem_info->mem_target;
+        record.reserved = 0;
+
+        /* Check if workers are used */
+        if (virt_info.workers.num_workers)
+        {
+            /* Queue the resize to the workers (the VM memory info is only passed if the result is checked) */
+            status = worker_pool_set_memory(&virt_info.workers, virt_info.domain_list[index], mem_next,
+                                            (check ? mem_info : NULL));
+
+            /* Count resize queued */
+            virt_info.num_resizes += (status == EXIT_SUCCESS);
+
+            /* Check if step was queued */
+            if (status == EXIT_SUCCESS)
+            {
+                /* Save step made */
+                mem_info->mem_balloon = mem_next;
+                mem_info->step_ns = now;
+            }
+
+            /* A VM still busy with a resize that timed out is skipped until it returns (the step is retried) */
+            status = ((status == WORKER_POOL_DOMAIN_BUSY) ? EXIT_SUCCESS : status);
+
+            /* Set no memory error status if resize not queued */
+            status = ((status == EXIT_SUCCESS) ? EXIT_SUCCESS : MEM_COORD_NOMEM);
+        }
+        else
+        {
+            /* Resize VM inline */
+            status = virDomainSetMemory(virt_info.domain_list[index], mem_next);
+
+            /* Count resize made */
+            virt_info.num_resizes += (status == EXIT_SUCCESS);
+
+            /* Check if step was made */
+            if (status == EXIT_SUCCESS)
+            {
+                /* Save step made */
+                mem_info->mem_balloon = mem_next;
+                mem_info->step_ns = now;
+            }
+            else if (!check)
+            {
+                /* End resize - errors are ignored */
+                mem_info->mem_target = mem_info->mem_balloon;
+            }
+
+            /* Errors are ignored if not checked and a VM that stopped since its stats were collected is skipped */
+            status = (((status == EXIT_SUCCESS) || (!check) || domain_gone(virt_info.domain_list[index])) ?
+                      EXIT_SUCCESS : MEM_COORD_SET_MEM_ERROR);
+        }
+
+        /* Record resize step and its result */
+        record.status = status;
+        trace_write(&virt_info.trace, TRACE_REC_RESIZE, mem_info->dom_id, &record, sizeof(record));
+
+        /* Check if the step reclaimed memory from the VM */
+        if (mem_info->mem_balloon < record.from)
+        {
+            /* Release the credit for the part of the reclaim this step made - the credit is the last part
+               of the reclaim (the guest's unused memory the host already has is taken first) */
+            released = mem_info->mem_credit -
+                       (mem_info->mem_credit < mem_info->mem_balloon - mem_info->mem_target ?
+                        mem_info->mem_credit : mem_info->mem_balloon - mem_info->mem_target);
+            mem_info->mem_credit -= released;
+            virt_info.host_step_mem += released;
+        }
+        /* Check if the step gave memory to the VM */
+        else if (mem_info->mem_balloon > record.from)
+        {
+            /* Take memory given out of the host memory the steps leave (never below 0) */
+            virt_info.host_step_mem = (virt_info.host_step_mem > mem_info->mem_balloon - record.from ?
+                                       virt_info.host_step_mem - (mem_info->mem_balloon - record.from) : 0);
+        }
+
+        /* Check if the VM reached its target */
+        if (mem_info->mem_balloon == mem_info->mem_target)
+        {
+            /* Resize done */
+            mem_info->mem_target = 0;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_step_memory_wait
+*
+*   DESCRIPTION
+*
+*       Steps the resizes still in progress each sub-interval (waiting for
+*       the steps queued to the workers) until no resize is in progress or
+*       the current cycle is about to end.  Steps are unchecked - a VM the
+*       next cycle finds still away from its target is sized again
+*
+*   INPUTS
+*
+*       end                                 Monotonic time (ns) the next
+*                                           cycle starts
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Resizes stepped
+*       Other                               Error stepping resizes
+*
+*************************************************************************/
+static int  vm_step_memory_wait(unsigned long long end)
+{
+    int                 index, pending, status = EXIT_SUCCESS;
+    unsigned long long  now, next;
+
+
+    /* Get time of the first step */
+    next = interval_now() + (MEM_COORD_STEP_MS * INTERVAL_NSECS_PER_MSEC);
+    pending = 1;
+
+    /* Loop while resizes are in progress and another step fits before the end of the cycle */
+    while ((status == EXIT_SUCCESS) && (pending) && (next < end))
+    {
+        /* Sleep until the next step */
+        interval_sleep_until(next);
+        now = interval_now();
+
+        /* No resizes in progress yet */
+        pending = 0;
+
+        /* Loop through each VM */
+        for (index = 0; (index < virt_info.num_domains) && (status == EXIT_SUCCESS); index++)
+        {
+            /* Check if a resize is in progress for this VM */
+            if (vm_mem_info[index].mem_target)
+            {
+                /* Make next step of resize */
+                status = vm_step_memory(index, 0, now);
+
+                /* Count resize still in progress */
+                pending += (vm_mem_info[index].mem_target != 0);
+            }
+        }
+
+        /* Wait for the steps queued */
+        status = (status == EXIT_SUCCESS ? vm_set_memory_wait() : status);
+
+        /* Get time of the next step (a sub-interval after this one, so a late step doesn't cause a burst) */
+        next = now + (MEM_COORD_STEP_MS * INTERVAL_NSECS_PER_MSEC);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_set_memory_wait
+*
+*   DESCRIPTION
+*
+*       Waits for the resizes queued to the workers (up to
+*       MEM_COORD_CALL_TIMEOUT for each) and checks their results.  A
+*       resize that timed out keeps running - its VM's stats show the
+*       result in a later cycle
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        All checked resizes successful
+*                                           (or their VMs stopped)
+*       MEM_COORD_SET_MEM_ERROR             Error resizing a VM
+*
+*************************************************************************/
+static int  vm_set_memory_wait(void)
+{
+    int             index, status = EXIT_SUCCESS;
+    WORKER_JOB *    job;
+    WORKER_JOB *    next;
+
+
+    /* Check if workers are used */
+    if (virt_info.workers.num_workers)
+    {
+        /* Wait for the resizes and count the ones that timed out */
+        virt_info.num_timeouts += worker_pool_wait(&virt_info.workers, &job);
+
+        /* Loop through each resize that returned */
+        for (; job != NULL; job = next)
+        {
+            /* Save next resize */
+            next = job->batch_next;
+
+            /* Check if a checked resize failed */
+            if ((job->context != NULL) && (job->status != EXIT_SUCCESS))
+            {
+                /* Get VM this resize was for */
+                index = (int)((VM_MEM_INFO *)job->context - vm_mem_info);
+
+                /* Set error unless the VM stopped since its stats were collected */
+                status = (domain_gone(virt_info.domain_list[index]) ? status : MEM_COORD_SET_MEM_ERROR);
+            }
+
+            /* Done with this resize */
+            worker_job_free(job);
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       virt_init
+*
+*   DESCRIPTION
+*
+*       Initializes the virtualization connection and determines number of
+*       VMs, number of PCPUs, and sets up appropriate data structures used
+*       by the VCPU scheduling code.  When a connection is passed in (by
+*       the resource manager) it is shared - domain events and the domain
+*       list then come from the resource manager.  The configuration file
+*       (if given) is read first
+*
+*   INPUTS
+*
+*       conn                                Shared hypervisor connection
+*                                           (NULL = open own connection)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Virtualization init successful
+*       Others                              Problems associated with getting
+*                                           virtualization information
+*
+*************************************************************************/
+static int  virt_init(virConnectPtr conn)
+{
+    int             status = EXIT_SUCCESS;
+    virNodeInfo     info;
+
+
+    /* Check if a configuration file was given */
+    if (config_path != NULL)
+    {
+        /* Count reload requests (SIGHUP) from now on */
+        config_watch();
+        virt_info.config_generation = config_generation();
+
+        /* Read the configuration before any VM is added */
+        status = (mem_config_load() == EXIT_SUCCESS ? EXIT_SUCCESS : MEM_COORD_CONFIG_ERROR);
+    }
+
+    /* Start recording the trace (if enabled) before any VM is added */
+    if ((status == EXIT_SUCCESS) && (trace_path != NULL) &&
+        (trace_init(&virt_info.trace, trace_path, TRACE_SOURCE_MEM) != EXIT_SUCCESS))
+    {
+        /* Set trace error */
+        status = MEM_COORD_TRACE_ERROR;
+    }
+
+    /* Check if the connection is shared */
+    if ((status == EXIT_SUCCESS) && (conn != NULL))
+    {
+        /* Use the resource manager's connection (it tracks VMs starting / stopping) */
+        virt_info.conn = conn;
+        virt_info.shared = 1;
+
+        /* Start the workers used to resize balloons concurrently (each with its own connection) */
+        if (worker_pool_init(&virt_info.workers, MEM_COORD_URI, num_workers, MEM_COORD_CALL_TIMEOUT) != EXIT_SUCCESS)
+        {
+            /* Set worker error */
+            status = MEM_COORD_WORKER_ERROR;
+        }
+    }
+    /* Start the event loop used to track VMs starting / stopping
+       NOTE:  Must be done before connecting to the hypervisor */
+    else if ((status == EXIT_SUCCESS) && (domain_events_loop_init() != EXIT_SUCCESS))
+    {
+        /* Set event error */
+        status = MEM_COORD_EVENT_ERROR;
+    }
+    else if (status == EXIT_SUCCESS)
+    {
+        /* Attempt to connect to the hypervisor */
+        virt_info.conn = virConnectOpen(MEM_COORD_URI);
+
+        /* Check if connection to hypervisor was successful */
+        if (virt_info.conn == NULL)
+        {
+            /* Return error */
+            status = MEM_COORD_CONN_ERROR;
+        }
+        /* Register for domain start / stop events before reading the domain list
+           so no VM starting in between is missed */
+        else if (domain_events_register(&virt_info.events, virt_info.conn) != EXIT_SUCCESS)
+        {
+            /* Set event error */
+            status = MEM_COORD_EVENT_ERROR;
+        }
+        /* Start the workers used to resize balloons concurrently (each with its own connection) */
+        else if (worker_pool_init(&virt_info.workers, MEM_COORD_URI, num_workers, MEM_COORD_CALL_TIMEOUT) != EXIT_SUCCESS)
+        {
+            /* Set worker error */
+            status = MEM_COORD_WORKER_ERROR;
+        }
+    }
+
+    /* Check if connected to the hypervisor */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Use bulk stats if configured (disabled later if libvirt doesn't support it) */
+        virt_info.bulk_stats = MEM_COORD_BULK_STATS;
+
+        /* Get number of node memory stats / KSM parameters the host has (0 = not supported or too many) */
+        virt_info.host_stats = 0;
+        virt_info.host_ksm = 0;
+        virt_info.host_stats = (((virNodeGetMemoryStats(virt_info.conn, VIR_NODE_MEMORY_STATS_ALL_CELLS, NULL,
+                                                        &virt_info.host_stats, 0) == 0) &&
+                                 (virt_info.host_stats <= MEM_COORD_HOST_PARAMS)) ? virt_info.host_stats : 0);
+        virt_info.host_ksm = (((virNodeGetMemoryParameters(virt_info.conn, NULL, &virt_info.host_ksm, 0) == 0) &&
+                               (virt_info.host_ksm <= MEM_COORD_HOST_PARAMS)) ? virt_info.host_ksm : 0);
+
+        /* Get host memory details */
+        host_mem_read();
+
+        /* Allocate low / high VM memory masks (resized as VMs are added / removed) */
+        if ((bitmask_init(&virt_info.high_mem_mask, 0) != EXIT_SUCCESS) ||
+            (bitmask_init(&virt_info.low_mem_mask, 0) != EXIT_SUCCESS))
+        {
+            /* Set error status */
+            status = MEM_COORD_NOMEM;
+        }
+        /* Check if error occurred */
+        else if (virt_info.host_unused_mem == 0)
+        {
+            /* Set host free memory error */
+            status = MEM_COORD_HOST_FREE_MEM_ERROR;
+        }
+        else
+        {
+            /* Get the host info to get memory available on the host */
+            status = virNodeGetInfo(virt_info.conn, &info);
+
+            /* Ensure host info obtained successfully */
+            if (status == EXIT_SUCCESS)
+            {
+                /* Set total memory available on host */
+                virt_info.host_total_mem = info.memory;
+
+                /* Get NUMA nodes of the host and their memory */
+                node_mem_init();
+
+                /* Calculate target memory size for host */
+                virt_info.host_tgt_mem = (host_tgt_percent * virt_info.host_total_mem)/100;
+
+                /* Initialize the memory info structures of the VMs already running
+                   (VMs of a shared connection are added by the resource manager) */
+                status = (virt_info.shared ? EXIT_SUCCESS : vm_mem_info_init());
+            }
+            else
+            {
+                /* Set error code */
+                status = MEM_COORD_DOMAIN_MEM_ERROR;
+            }
+        }
+    }
+
+    /* Start serving the metrics endpoint (if enabled) once everything else is set up */
+    if ((status == EXIT_SUCCESS) && (metrics_port) && (metrics_init(&virt_info.metrics, metrics_port) != EXIT_SUCCESS))
+    {
+        /* Set metrics error */
+        status = MEM_COORD_METRICS_ERROR;
+    }
+
+    /* Start serving the monitor stream (if enabled) */
+    if ((status == EXIT_SUCCESS) && (monitor_path != NULL) && (monitor_init(&virt_info.monitor, monitor_path) != EXIT_SUCCESS))
+    {
+        /* Set monitor error */
+        status = MEM_COORD_MONITOR_ERROR;
+    }
+
+    /* Create the shared memory snapshot (if enabled) */
+    if ((status == EXIT_SUCCESS) && (shm_name != NULL) &&
+        (stats_shm_init(&virt_info.shm, shm_name, STATS_SHM_SOURCE_MEM) != EXIT_SUCCESS))
+    {
+        /* Set shared memory error */
+        status = MEM_COORD_SHM_ERROR;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_mem_info_init
+*
+*   DESCRIPTION
+*
+*       Initialize the VM Memory Info data structures for the VMs running
+*       at startup (VMs started later are added by domain events)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VM Memory Info data structures initialized
+*       Other                               Error with memory allocation or
+*                                           using libvirt
+*
+*************************************************************************/
+static int vm_mem_info_init(void)
+{
+    int             index, num_domains, status = EXIT_SUCCESS;
+    virDomainPtr *  domain_list;
+
+
+    /* Get list of active domains */
+    num_domains = virConnectListAllDomains(virt_info.conn, &domain_list, VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+
+    /* Ensure list of domains obtained (no VMs running yet is fine) */
+    if (num_domains >= 0)
+    {
+        /* Loop through each domain */
+        for (index = 0; index < num_domains; index++)
+        {
+            /* Check if no errors so far */
+            if (status == EXIT_SUCCESS)
+            {
+                /* Add VM (domain reference is handed over) */
+                status = vm_add(domain_list[index]);
+
+                /* Skip a VM that stopped or couldn't be read - it is added
+                   later if a start event is received for it */
+                if ((status == MEM_COORD_DOMAIN_GONE) || (status == MEM_COORD_DOMAIN_MEM_ERROR))
+                {
+                    status = EXIT_SUCCESS;
+                }
+            }
+            else
+            {
+                /* Release domains not added */
+                virDomainFree(domain_list[index]);
+            }
+        }
+
+        /* Free the list */
+        free(domain_list);
+    }
+    else
+    {
+        /* Set error status appropriately */
+        status = MEM_COORD_DOMAIN_LIST_ERROR;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_add
+*
+*   DESCRIPTION
+*
+*       Adds a VM to the end of the domain list / VM memory info.  The
+*       domain reference is owned by the domain list once added and is
+*       released otherwise
+*
+*   INPUTS
+*
+*       domain                              Domain to add
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VM added
+*       MEM_COORD_DOMAIN_GONE               VM stopped while being added
+*       Other                               Error with memory allocation or
+*                                           using libvirt
+*
+*************************************************************************/
+static int  vm_add(virDomainPtr domain)
+{
+    int             max_domains, status = EXIT_SUCCESS;
+    virDomainPtr *  domain_list;
+    VM_MEM_INFO *   mem_info;
+    const char *    name;
+    char *          xml;
+
+
+    /* Check if the domain list / VM memory info is full */
+    if (virt_info.num_domains == virt_info.max_domains)
+    {
+        /* Grow both (doubling so adding VMs one at a time stays cheap) */
+        max_domains = (virt_info.max_domains ? 2 * virt_info.max_domains : 8);
+        domain_list = realloc(virt_info.domain_list, max_domains * sizeof(virDomainPtr));
+
+        /* Ensure memory allocated */
+        if (domain_list != NULL)
+        {
+            /* Save new domain list and grow VM memory info */
+            virt_info.domain_list = domain_list;
+            mem_info = realloc(vm_mem_info, max_domains * sizeof(VM_MEM_INFO));
+
+            /* Ensure memory allocated */
+            if (mem_info != NULL)
+            {
+                /* Save new VM memory info */
+                vm_mem_info = mem_info;
+                virt_info.max_domains = max_domains;
+            }
+        }
+
+        /* Check if either allocation failed */
+        if (virt_info.max_domains != max_domains)
+        {
+            /* Set error status */
+            status = MEM_COORD_NOMEM;
+        }
+    }
+
+    /* Grow the low / high VM memory masks to include this VM */
+    if ((status == EXIT_SUCCESS) &&
+        ((bitmask_resize(&virt_info.high_mem_mask, virt_info.num_domains + 1) != EXIT_SUCCESS) ||
+         (bitmask_resize(&virt_info.low_mem_mask, virt_info.num_domains + 1) != EXIT_SUCCESS)))
+    {
+        /* Set error status */
+        status = MEM_COORD_NOMEM;
+    }
+
+    /* Check if no errors so far */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Clear VM memory info for this VM */
+        memset(&vm_mem_info[virt_info.num_domains], 0, sizeof(VM_MEM_INFO));
+
+        /* Initialize the rate at which the balloon driver stats get updated to every 1 sec
+           NOTE:  1 sec is the shortest period supported - cycles shorter than this
+                  may see the same balloon stats more than once */
+        status = virDomainSetMemoryStatsPeriod(domain, 1, VIR_DOMAIN_AFFECT_LIVE);
+
+        /* Ensure memory stats period successfully updated */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Get maximum memory set for this VM */
+            vm_mem_info[virt_info.num_domains].mem_max = virDomainGetMaxMemory(domain);
+
+            /* Get hypervisor ID of the VM (used to match bulk stats records) */
+            vm_mem_info[virt_info.num_domains].dom_id = virDomainGetID(domain);
+
+            /* Get domain XML (the live definition - NULL if not available) */
+            xml = virDomainGetXMLDesc(domain, 0);
+
+            /* Get size of the pages backing the VM (resizes are aligned to it) and if the guest
+               reports its free pages to the host */
+            vm_mem_info[virt_info.num_domains].page_kb = vm_page_size(xml);
+            vm_mem_info[virt_info.num_domains].free_reporting = vm_free_reporting(xml);
+
+            /* Get NUMA nodes the VM's memory is bound to */
+            vm_mem_info[virt_info.num_domains].numa_mask = vm_numa_tune(xml, &vm_mem_info[virt_info.num_domains].numa_strict);
+
+            /* Free domain XML */
+            free(xml);
+
+            /* Get name of the VM once so output never needs to ask for it */
+            name = virDomainGetName(domain);
+            snprintf(vm_mem_info[virt_info.num_domains].name, MEM_COORD_NAME_LEN, "%s", (name ? name : ""));
+
+            /* Apply the VM's configuration file overrides */
+            vm_config_apply(virt_info.num_domains);
+
+            /* Check if max VM memory not obtained */
+            if (vm_mem_info[virt_info.num_domains].mem_max == 0)
+            {
+                /* Set status to error */
+                status = MEM_COORD_DOMAIN_MEM_ERROR;
+            }
+        }
+        else
+        {
+            /* Set status to error */
+            status = MEM_COORD_DOMAIN_MEM_ERROR;
+        }
+
+        /* Check if the VM stopped while being added */
+        if ((status != EXIT_SUCCESS) && (domain_gone(domain)))
+        {
+            /* Set domain gone status */
+            status = MEM_COORD_DOMAIN_GONE;
+        }
+    }
+
+    /* Check if VM was added */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Name the VM in the trace */
+        vm_trace(virt_info.num_domains);
+
+        /* Add domain to end of the domain list */
+        virt_info.domain_list[virt_info.num_domains] = domain;
+        virt_info.num_domains++;
+    }
+    else
+    {
+        /* Release domain */
+        virDomainFree(domain);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_page_size
+*
+*   DESCRIPTION
+*
+*       Gets the size of the hugepages backing a VM from the <hugepages>
+*       element of <memoryBacking> in its domain XML.  A VM with pages of
+*       more than 1 size (per NUMA node) uses the largest, so a resize is
+*       a whole page of every node, and <hugepages/> without a size is the
+*       host's default hugepage size
+*
+*   INPUTS
+*
+*       xml                                 Domain XML of VM (NULL = not
+*                                           available)
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Page size (KB - 0 = small pages
+*                                           or domain XML not available)
+*
+*************************************************************************/
+static unsigned long long vm_page_size(const char * xml)
+{
+    const char *        backing;
+    const char *        backing_end;
+    const char *        hugepages;
+    const char *        page;
+    unsigned long long  page_kb = 0, size;
+
+
+    /* Find memory backing of the VM and its hugepages (ignoring a <hugepages> outside of it) */
+    backing = (xml != NULL ? strstr(xml, "<memoryBacking>") : NULL);
+    backing_end = (backing != NULL ? strstr(backing, "</memoryBacking>") : NULL);
+    hugepages = (backing_end != NULL ? strstr(backing, "<hugepages") : NULL);
+
+    /* Check if the VM is backed by hugepages */
+    if ((hugepages != NULL) && (hugepages < backing_end))
+    {
+        /* Loop through each page size given */
+        for (page = strstr(hugepages, "<page "); (page != NULL) && (page < backing_end); page = strstr(page + 1, "<page "))
+        {
+            /* Keep largest page size */
+            size = xml_size_kb(page, "size", "unit");
+            page_kb = (size > page_kb ? size : page_kb);
+        }
+
+        /* Use the host's default hugepage size if no size was given */
+        page_kb = (page_kb ? page_kb : MEM_COORD_HUGEPAGE_KB);
+    }
+
+    /* Return page size to caller */
+    return (page_kb);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_free_reporting
+*
+*   DESCRIPTION
+*
+*       Checks if free page reporting is turned on for the balloon of a VM
+*       (freePageReporting of <memballoon> in its domain XML) - the guest
+*       gives its free pages back to the host as they are freed, so its
+*       unused memory is already free on the host
+*
+*   INPUTS
+*
+*       xml                                 Domain XML of VM (NULL = not
+*                                           available)
+*
+*   OUTPUTS
+*
+*       int                                 Non-zero if free page reporting
+*                                           is on
+*
+*************************************************************************/
+static int  vm_free_reporting(const char * xml)
+{
+    const char *        balloon = (xml != NULL ? strstr(xml, "<memballoon ") : NULL);
+    const char *        reporting = (balloon != NULL ? xml_attr_find(balloon, "freePageReporting") : NULL);
+
+
+    /* Return if free page reporting is on to caller */
+    return ((reporting != NULL) && (strncmp(reporting, "on", 2) == 0));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_numa_tune
+*
+*   DESCRIPTION
+*
+*       Gets the NUMA nodes a VM's memory is placed on from the <memory>
+*       element of <numatune> in its domain XML (a nodeset of node IDs
+*       and ranges, ie 0-1,3 or 0-3,^2) and if its memory may only come
+*       from them - the strict (default) and restrictive modes, unlike
+*       preferred and interleave
+*
+*   INPUTS
+*
+*       xml                                 Domain XML of VM (NULL = not
+*                                           available)
+*       strict                              Pointer to returned non-zero
+*                                           if the VM is bound to its nodes
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Mask of nodes (0 = no nodeset
+*                                           or domain XML not available)
+*
+*************************************************************************/
+static unsigned long long vm_numa_tune(const char * xml, int * strict)
+{
+    const char *        numatune = (xml != NULL ? strstr(xml, "<numatune>") : NULL);
+    const char *        numatune_end = (numatune != NULL ? strstr(numatune, "</numatune>") : NULL);
+    const char *        memory = (numatune_end != NULL ? strstr(numatune, "<memory ") : NULL);
+    const char *        mode;
+    const char *        nodeset;
+    char *              end;
+    unsigned long long  node_mask = 0, range;
+    long                first, last;
+    int                 exclude;
+
+
+    /* Default to not bound */
+    *strict = 0;
+
+    /* Get mode and nodeset of the memory placement (if within numatune) */
+    memory = ((memory != NULL) && (memory < numatune_end) ? memory : NULL);
+    mode = (memory != NULL ? xml_attr_find(memory, "mode") : NULL);
+    nodeset = (memory != NULL ? xml_attr_find(memory, "nodeset") : NULL);
+
+    /* Loop through each node ID / range of the nodeset */
+    while ((nodeset != NULL) && (*nodeset != '\'') && (*nodeset != '"') && (*nodeset != '\0'))
+    {
+        /* Check if the entry excludes nodes */
+        exclude = (*nodeset == '^');
+        nodeset += exclude;
+
+        /* Get first and last node of the entry (a single ID is a range of 1) */
+        first = strtol(nodeset, &end, 10);
+        last = ((end != nodeset) && (*end == '-') ? strtol(end + 1, &end, 10) : first);
+
+        /* Get mask of the nodes in the range (nodes past the mask are ignored) */
+        range = (((end == nodeset) || (first < 0) || (first >= MEM_COORD_MAX_NODES) || (last < first)) ? 0 :
+                 (last >= MEM_COORD_MAX_NODES - 1) ? ~0ULL << first :
+                 ((1ULL << (last + 1)) - 1) & (~0ULL << first));
+
+        /* Add / remove the nodes */
+        node_mask = (exclude ? node_mask & ~range : node_mask | range);
+
+        /* Move to next entry (stop at a malformed one) */
+        nodeset = ((end != nodeset) && (*end == ',') ? end + 1 : (end != nodeset) ? end : NULL);
+    }
+
+    /* Check if the VM is bound to its nodes (the mode defaults to strict) */
+    *strict = ((node_mask != 0) &&
+               ((mode == NULL) || (strncmp(mode, "strict", 6) == 0) || (strncmp(mode, "restrictive", 11) == 0)));
+
+    /* Return nodes to caller */
+    return (node_mask);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       nodeset_format
+*
+*   DESCRIPTION
+*
+*       Formats a mask of NUMA nodes as a libvirt nodeset (ie 0,2,3)
+*
+*   INPUTS
+*
+*       node_mask                           Mask of nodes
+*       nodeset                             Buffer for the nodeset
+*       size                                Size of buffer
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void nodeset_format(unsigned long long node_mask, char * nodeset, size_t size)
+{
+    int                 node;
+    size_t              len = 0;
+
+
+    /* Start with an empty nodeset */
+    nodeset[0] = '\0';
+
+    /* Loop through each node in the mask (while the buffer has room) */
+    for (node = 0; (node < MEM_COORD_MAX_NODES) && (len < size); node++)
+    {
+        /* Add node ID (after a comma if not the first) */
+        len += ((node_mask & (1ULL << node)) ? (size_t)snprintf(&nodeset[len], size - len, "%s%d", (len ? "," : ""), node) : 0);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       xml_size_kb
+*
+*   DESCRIPTION
+*
+*       Gets a size from the attributes of an XML tag in KB - the value
+*       and its libvirt unit (KiB if no unit is given)
+*
+*   INPUTS
+*
+*       tag                                 Start of XML tag
+*       size_name                           Name of size attribute
+*       unit_name                           Name of unit attribute
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Size (KB - 0 = no valid size)
+*
+*************************************************************************/
+static unsigned long long xml_size_kb(const char * tag, const char * size_name, const char * unit_name)
+{
+    const char *        unit = xml_attr_find(tag, unit_name);
+    unsigned long long  scale, base;
+    int                 value;
+
+
+    /* Get scale of the unit - b / bytes, k / KiB / KB, M / MiB / MB, G / GiB / GB and T / TiB / TB
+       (the units with a B after the letter are powers of 1000, the rest powers of 1024) */
+    base = (((unit != NULL) && (unit[0] != '\0') && (unit[1] == 'B')) ? 1000 : 1024);
+    scale = ((unit == NULL) ? 1024 :
+             (unit[0] == 'b') ? 1 :
+             ((unit[0] == 'k') || (unit[0] == 'K')) ? base :
+             (unit[0] == 'M') ? base * base :
+             (unit[0] == 'G') ? base * base * base :
+             (unit[0] == 'T') ? base * base * base * base : 0);
+
+    /* Return size in KB to caller (0 if not a valid size) */
+    return (((xml_attr_int(tag, size_name, &value) == EXIT_SUCCESS) && (value > 0)) ?
+            ((unsigned long long)value * scale) / 1024 : 0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_remove
+*
+*   DESCRIPTION
+*
+*       Removes a VM from the domain list / VM memory info (keeping the
+*       remaining VMs in order) and releases the domain
+*
+*   INPUTS
+*
+*       index                               Index of VM to remove
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void vm_remove(int index)
+{
+    /* Release domain */
+    virDomainFree(virt_info.domain_list[index]);
+
+    /* Remove VM from the domain list and VM memory info */
+    virt_info.num_domains--;
+    memmove(&virt_info.domain_list[index], &virt_info.domain_list[index + 1],
+            (virt_info.num_domains - index) * sizeof(virDomainPtr));
+    memmove(&vm_mem_info[index], &vm_mem_info[index + 1],
+            (virt_info.num_domains - index) * sizeof(VM_MEM_INFO));
+
+    /* Shrink the low / high VM memory masks (can't fail when shrinking)
+       NOTE:  Masks are rebuilt each cycle so shifted VM indexes don't matter */
+    bitmask_resize(&virt_info.high_mem_mask, virt_info.num_domains);
+    bitmask_resize(&virt_info.low_mem_mask, virt_info.num_domains);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_lookup
+*
+*   DESCRIPTION
+*
+*       Finds the index of the specified domain in the domain list
+*
+*   INPUTS
+*
+*       domain                              Domain to find
+*
+*   OUTPUTS
+*
+*       >= 0                                Index of VM
+*       -1                                  VM not tracked
+*
+*************************************************************************/
+static int  vm_lookup(virDomainPtr domain)
+{
+    int     index;
+
+
+    /* Loop through each VM looking for a match */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        /* Check if domain matches */
+        if (domain_same(virt_info.domain_list[index], domain))
+        {
+            /* Return index */
+            return (index);
+        }
+    }
+
+    /* Not found */
+    return (-1);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       vm_trace
+*
+*   DESCRIPTION
+*
+*       Records the name and maximum memory of a VM in the trace so the
+*       decoder can name the records of its domain ID
+*
+*   INPUTS
+*
+*       index                               Index of VM to record
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void vm_trace(int index)
+{
+    TRACE_DOMAIN    record;
+
+
+    /* Fill in domain record */
+    memset(&record, 0, sizeof(record));
+    record.mem_max = vm_mem_info[index].mem_max;
+    snprintf(record.name, TRACE_NAME_LEN, "%s", vm_mem_info[index].name);
+
+    /* Record domain */
+    trace_write(&virt_info.trace, TRACE_REC_DOMAIN, vm_mem_info[index].dom_id, &record, sizeof(record));
+}
+
+
+#ifndef RESOURCE_MANAGER
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       domain_events_process
+*
+*   DESCRIPTION
+*
+*       Processes domain start / stop events received since the last
+*       cycle - started VMs are added and stopped VMs are removed
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Domain events processed
+*       Other                               Error with memory allocation
+*
+*************************************************************************/
+static int  domain_events_process(void)
 {
-    int                 status = EXIT_SUCCESS;
+    int             status = EXIT_SUCCESS;
+    DOMAIN_EVENT *  event;
+    DOMAIN_EVENT *  next;
 
 
-    /* Loop while no errors and no key hit */
-    while (status == EXIT_SUCCESS)
+    /* Loop through each event received (oldest first) */
+    for (event = domain_events_get(&virt_info.events); event != NULL; event = next)
     {
-        /* Sleep for specified period of time */
-        sleep(cycle_time);
+        /* Get next event before this one is freed */
+        next = event->next;
 
-        /* Collect memory stats */
-        status = collect_mem_stats();
-
-        /* Ensure VM stats obtained successfully */
+        /* Check if no errors so far */
         if (status == EXIT_SUCCESS)
         {
-            /* Adjust memory assignment for each VM */
-            status = vm_memory_adjust();
+            /* Add / remove the event's VM (domain reference is handed over) */
+            status = mem_policy_domain_event(event->type, event->domain);
+            event->domain = NULL;
         }
 
-#if (MEM_COORD_DEBUG == 1)
-        /* Dump memory coordinator stats */
-        dump_mem_stats();
-#endif  /* (MEM_COORD_DEBUG == 1) */
+        /* Done with event */
+        domain_event_free(event);
     }
 
     /* Return status to caller */
     return (status);
 }
+#endif  /* RESOURCE_MANAGER */
 
 
 /*************************************************************************
 *
 *   FUNCTION
 *
-*       collect_mem_stats
+*       mem_policy_domain_event
 *
 *   DESCRIPTION
 *
-*       Collects VM stats
+*       Adds a started VM to / removes a stopped VM from the tracked VMs
+*       (used for this daemon's own events and by the resource manager).
+*       The domain reference is handed over - it is owned by the domain
+*       list if the VM is added and is released otherwise
 *
 *   INPUTS
 *
-*       None
+*       type                                DOMAIN_EVENT_ADDED / REMOVED
+*       domain                              Domain started / stopped
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        VM stats collected
-*       Others                              Error trying to collect VM stats
+*       EXIT_SUCCESS                        Domain event processed
+*       Other                               Error with memory allocation
 *
 *************************************************************************/
-static int  collect_mem_stats(void)
+int mem_policy_domain_event(int type, virDomainPtr domain)
 {
-    int                         index, status = EXIT_SUCCESS;
-    virDomainMemoryStatStruct   mem_stats[VIR_DOMAIN_MEMORY_STAT_NR];
-    int                         num_stats, num_stats_found;
+    int     status = EXIT_SUCCESS;
+    int     index = vm_lookup(domain);
 
 
-    /* First update the host memory available */
-    virt_info.host_free_mem = (virNodeGetFreeMemory(virt_info.conn) / MEM_COORD_KB_SIZE);
-
-    /* Loop through each VM */
-    for (index = 0; (index < virt_info.num_domains) && (status == EXIT_SUCCESS) ; index++)
+    /* Check if an untracked VM started (a start event may be received for
+       a VM that was already in the domain list at startup) */
+    if ((type == DOMAIN_EVENT_ADDED) && (index < 0))
     {
-        /* Get memory stats for this domain */
-        num_stats = virDomainMemoryStats(virt_info.domain_list[index], &mem_stats[0], VIR_DOMAIN_MEMORY_STAT_NR, 0);
+        /* Add VM (domain reference is handed over) */
+        status = vm_add(domain);
 
-        /* Check if num stats is greater than 0  */
-        if (num_stats > 0)
+        /* Skip a VM that stopped again or couldn't be read */
+        if ((status == MEM_COORD_DOMAIN_GONE) || (status == MEM_COORD_DOMAIN_MEM_ERROR))
         {
-            /* Clear number of stats found before each loop */
-            num_stats_found = 0;
-
-            /* Loop through all stats while number of found stats isn't reached */
-            while ((num_stats != 0) && (num_stats_found != MEM_COORD_NUM_STATS))
-            {
-                /* Decrement number of stats to index into next stats array entry */
-                num_stats--;
-
-                /* Check if tag for this stat is one we want to keep */
-                switch (mem_stats[num_stats].tag)
-                {
-                    /* Get balloon size */
-                    case VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON:
-
-                        /* Save value in VM Memory info structure */
-                        vm_mem_info[index].mem_total = mem_stats[num_stats].val;
-
-                        /* Increment number of stats found */
-                        num_stats_found++;
-
-                    break;
-
-                    /* Get domain unused memory */
-                    case VIR_DOMAIN_MEMORY_STAT_UNUSED:
-
-                        /* Save value as memory available */
-                        vm_mem_info[index].mem_free = mem_stats[num_stats].val;
-
-                        /* Increment number of stats found */
-                        num_stats_found++;
-
-                    break;
-
-                    /* Default */
-                    default:
-
-                        /* Do nothing - just skip these stats */
-
-                    break;
-                }
-            }   /* while loop */
-
-            /* Ensure appropriate stats available */
-            if (vm_mem_info[index].mem_total > 0)
-            {
-                /* Calculate percent avail memory in VM */
-                vm_mem_info[index].percent_avail = (int)((100 * vm_mem_info[index].mem_free)/vm_mem_info[index].mem_total);
-
-                /* Cap percentage of available memory at 100%
-                   NOTE:  Value can exceed 100% due to memory stats changing faster in VM than collected or due to order collected
-                          (ie not atomic collection of all stats) */
-                vm_mem_info[index].percent_avail = (vm_mem_info[index].percent_avail > 100 ? 100 : vm_mem_info[index].percent_avail);
-
-                /* Check if available memory for this VM is low and size of VM isn't at max */
-                if ((vm_mem_info[index].percent_avail < MEM_COORD_AVAIL_VM_LOW_PERCENT) &&
-                    (vm_mem_info[index].mem_total < vm_mem_info[index].mem_max))
-                {
-                    /* Set bit for this VM in low mask */
-                    virt_info.low_mem_mask |= (1 << index);
-                }
-                /* Check if available memory for this VM is high */
-                else if (vm_mem_info[index].percent_avail > MEM_COORD_AVAIL_VM_HIGH_PERCENT)
-                {
-                    /* Set bit for this VM in high mask */
-                    virt_info.high_mem_mask |= (1 << index);
-                }
-            }
+            status = EXIT_SUCCESS;
         }
-        else
+    }
+    else
+    {
+        /* Check if a tracked VM stopped */
+        if ((type == DOMAIN_EVENT_REMOVED) && (index >= 0))
         {
-            /* Set error for VM memory stats not available */
-            status = MEM_COORD_DOMAIN_MEM_ERROR;
+            /* Remove VM */
+            vm_remove(index);
         }
-    }   /* for loop */
+
+        /* Release the domain reference (not kept) */
+        virDomainFree(domain);
+    }
 
     /* Return status to caller */
     return (status);
@@ -289,12 +3837,12 @@ static int  collect_mem_stats(void)
 *
 *   FUNCTION
 *
-*       vm_memory_adjust
+*       virt_deinit
 *
 *   DESCRIPTION
 *
-*       Adjusts memory allocated for each VM based on demands and available
-*       memory on the host
+*       De-initializes all the virtualization content - frees data structures,
+*       closes connections, etc.
 *
 *   INPUTS
 *
@@ -302,99 +3850,72 @@ static int  collect_mem_stats(void)
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        Adjustment of memory for VM
-*                                           was successful
-*       Other                               Error when adjusting VM memory
+*       None
 *
 *************************************************************************/
-static int  vm_memory_adjust(void)
+static void virt_deinit(void)
 {
-    int                 index, status = EXIT_SUCCESS;
-    unsigned int        host_precent_free;
-    unsigned long       mem_adj;
-
-
-    /* Loop through all VMs that have "high" memory and reclaim it */
-    while ((virt_info.high_mem_mask != 0) && (status == EXIT_SUCCESS))
+    /* Stop serving the metrics endpoint */
+    if (metrics_port)
     {
-        /* Get index of high memory VM */
-        LOW_BIT_GET32(virt_info.high_mem_mask, &index);
-
-        /* Calculate reduced memory size of VM so VM will have configured target available percentage */
-        mem_adj = ((vm_mem_info[index].mem_total * (vm_mem_info[index].percent_avail - MEM_COORD_AVAIL_VM_TGT_PERCENT)) / 100);
-
-        /* Decrease VM memory size */
-        vm_mem_info[index].mem_total -= mem_adj;
-
-        /* Set new memory size for VM */
-        status = virDomainSetMemory(virt_info.domain_list[index], vm_mem_info[index].mem_total);
+        metrics_deinit(&virt_info.metrics);
+    }
 
-        /* Clear this VMs bit from high mask */
-        virt_info.high_mem_mask &= ~(1 << index);
+    /* Stop serving the monitor stream */
+    if (monitor_path != NULL)
+    {
+        monitor_deinit(&virt_info.monitor);
     }
 
-    /* Loop through all VMs that have "low" memory and try to provide them more memory */
-    while ((virt_info.low_mem_mask != 0) && (status == EXIT_SUCCESS))
+    /* Remove the shared memory snapshot */
+    if (shm_name != NULL)
     {
-        /* Get most recent host available memory value */
-        virt_info.host_free_mem = (virNodeGetFreeMemory(virt_info.conn) / MEM_COORD_KB_SIZE);
+        stats_shm_deinit(&virt_info.shm);
+    }
 
-        /* Get index of low memory VM */
-        LOW_BIT_GET32(virt_info.low_mem_mask, &index);
+    /* Stop the workers (waits for any balloon resize still running) */
+    worker_pool_deinit(&virt_info.workers);
 
-        /* Calculate memory increase for VM to bring it to target */
-        mem_adj = (vm_mem_info[index].mem_total * (MEM_COORD_AVAIL_VM_TGT_PERCENT - vm_mem_info[index].percent_avail)) / 100;
+    /* Loop through and free all domains */
+    while (virt_info.num_domains)
+    {
+        /* Decrement number of domains to process */
+        virt_info.num_domains--;
 
-        /* Calculate percent of host memory that is free / available AFTER adjustment to VM */
-        host_precent_free = ((virt_info.host_free_mem - mem_adj) * 100)/virt_info.host_total_mem;
+        /* Release domain */
+        virDomainFree(virt_info.domain_list[virt_info.num_domains]);
+    }
 
-        /* Check if the host is above the configured low memory threshold (after this memory adjustment) */
-        if (host_precent_free > MEM_COORD_AVAIL_HOST_LOW_PERCENT)
-        {
-            /* Increase VM memory size */
-            vm_mem_info[index].mem_total += mem_adj;
+    /* Free the list */
+    free(virt_info.domain_list);
 
-            /* Limit VM memory to maximum memory size */
-            vm_mem_info[index].mem_total =
-                    (vm_mem_info[index].mem_total > vm_mem_info[index].mem_max ? vm_mem_info[index].mem_max : vm_mem_info[index].mem_total);
+    /* Free VM memory info and low / high VM memory masks */
+    free(vm_mem_info);
+    bitmask_free(&virt_info.high_mem_mask);
+    bitmask_free(&virt_info.low_mem_mask);
 
-            /* Adjust VM memory */
-            status = virDomainSetMemory(virt_info.domain_list[index], vm_mem_info[index].mem_total);
+    /* Free the configuration */
+    config_free(&virt_info.config);
 
-            /* Clear this VMs bit from low mask */
-            virt_info.low_mem_mask &= ~(1 << index);
-        }
-        else
-        {
-            /* Check if current free memory is less than target memory for host */
-            if (virt_info.host_free_mem < virt_info.host_tgt_mem)
-            {
-                /* Calculate total memory adjustment needed for host to get back to target */
-                mem_adj = virt_info.host_tgt_mem - virt_info.host_free_mem;
+    /* Check if a trace is recorded */
+    if (trace_path != NULL)
+    {
+        /* Write the records left and close the trace file */
+        trace_deinit(&virt_info.trace);
+    }
 
-                /* Loop through each VM */
-                for (index = 0; index < virt_info.num_domains ; index++)
-                {
-                    /* Adjust VM memory based on fair share of memory used by this VM */
-                    vm_mem_info[index].mem_total -= ((mem_adj * ((100 * vm_mem_info[index].mem_total) / virt_info.host_total_mem))/100);
+    /* Check if connection is this daemon's own (a shared connection is closed by the resource manager) */
+    if (!virt_info.shared)
+    {
+        /* Stop receiving domain events */
+        domain_events_deregister(&virt_info.events);
 
-                    /* Adjust VM memory ignoring any errors */
-                    virDomainSetMemory(virt_info.domain_list[index], vm_mem_info[index].mem_total);
-                }
+        /* Close connection to hypervisor */
+        virConnectClose(virt_info.conn);
 
-                /* Host has low memory - skip all remaining low memory VM updates */
-                virt_info.low_mem_mask = 0;
-            }
-            else
-            {
-                /* Clear this VMs bit from low mask */
-                virt_info.low_mem_mask &= ~(1 << index);
-            }
-        }
+        /* Stop the event loop */
+        domain_events_loop_deinit();
     }
-
-    /* Return status to caller */
-    return (status);
 }
 
 
@@ -402,13 +3923,13 @@ static int  vm_memory_adjust(void)
 *
 *   FUNCTION
 *
-*       virt_init
+*       render_mem_metrics
 *
 *   DESCRIPTION
 *
-*       Initializes the virtualization connection and determines number of
-*       VMs, number of PCPUs, and sets up appropriate data structures used
-*       by the VCPU scheduling code
+*       Renders the state of the memory coordinator at the end of a cycle
+*       in the OpenMetrics text format and publishes it for scrapes.  Only
+*       values already collected are used (no libvirt calls)
 *
 *   INPUTS
 *
@@ -416,87 +3937,171 @@ static int  vm_memory_adjust(void)
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        Virtualization init successful
-*       Others                              Problems associated with getting
-*                                           virtualization information
+*       None
 *
 *************************************************************************/
-static int  virt_init(void)
+static void render_mem_metrics(void)
 {
-    int             status = EXIT_SUCCESS;
-    virNodeInfo     info;
+    METRICS *           metrics = &virt_info.metrics;
+    char                label[METRICS_LABEL_LEN];
+    int                 index;
 
 
-    /* Attempt to connect to the hypervisor */
-    virt_info.conn = virConnectOpen("qemu:///system");
+    /* Output coordinator totals */
+    metrics_family(metrics, "mem_coord_cycles", "counter", "Coordination cycles run.");
+    metrics_printf(metrics, "mem_coord_cycles_total %llu\n", virt_info.num_cycles);
+    metrics_family(metrics, "mem_coord_resizes", "counter", "Balloon resizes made.");
+    metrics_printf(metrics, "mem_coord_resizes_total %llu\n", virt_info.num_resizes);
+    metrics_family(metrics, "mem_coord_resize_timeouts", "counter", "Balloon resizes that timed out.");
+    metrics_printf(metrics, "mem_coord_resize_timeouts_total %llu\n", virt_info.workers.num_timeouts);
+    metrics_family(metrics, "mem_coord_metrics_skipped", "counter", "Snapshots not published because a scrape was being copied.");
+    metrics_printf(metrics, "mem_coord_metrics_skipped_total %llu\n", metrics->snapshot.num_skipped);
 
-    /* Check if connection to hypervisor was successful */
-    if (virt_info.conn != NULL)
+    /* Output cycle timing */
+    metrics_family(metrics, "mem_coord_interval_seconds", "gauge", "Time between coordination cycles.");
+    metrics_printf(metrics, "mem_coord_interval_seconds %.3f\n", virt_info.interval.interval_ms / INTERVAL_MSECS_PER_SEC);
+    metrics_family(metrics, "mem_coord_phase_seconds", "gauge", "Time spent in each phase of the last cycle.");
+
+    /* Loop through each phase */
+    for (index = 0; index < MEM_COORD_NUM_PHASES; index++)
     {
-        /* Get list of active domains */
-        virt_info.num_domains = virConnectListAllDomains(virt_info.conn,
-                                                         &virt_info.domain_list,
-                                                         VIR_CONNECT_LIST_DOMAINS_ACTIVE);
+        metrics_printf(metrics, "mem_coord_phase_seconds{phase=\"%s\"} %.9f\n", phase_names[index],
+                       (double)virt_info.phase_ns[index] / INTERVAL_NSECS_PER_SEC);
+    }
 
-        /* Ensure at least 1 domain active */
-        if (virt_info.num_domains > 0)
-        {
-            /* Get host memory details */
-            virt_info.host_free_mem = (virNodeGetFreeMemory(virt_info.conn) / MEM_COORD_KB_SIZE);
+    /* Output host memory */
+    metrics_family(metrics, "mem_coord_host_free_bytes", "gauge", "Host free memory.");
+    metrics_printf(metrics, "mem_coord_host_free_bytes %llu\n", virt_info.host_unused_mem * MEM_COORD_KB_SIZE);
+    metrics_family(metrics, "mem_coord_host_available_bytes", "gauge",
+                   "Host memory available (free memory and droppable page cache less the KSM reserve, after this cycle's resizes).");
+    metrics_printf(metrics, "mem_coord_host_available_bytes %llu\n", virt_info.host_free_mem * MEM_COORD_KB_SIZE);
+    metrics_family(metrics, "mem_coord_host_cache_bytes", "gauge", "Host buffers and page cache.");
+    metrics_printf(metrics, "mem_coord_host_cache_bytes %llu\n", virt_info.host_cache_mem * MEM_COORD_KB_SIZE);
+    metrics_family(metrics, "mem_coord_host_ksm_saved_bytes", "gauge", "Host memory saved by KSM.");
+    metrics_printf(metrics, "mem_coord_host_ksm_saved_bytes %llu\n", virt_info.host_ksm_mem * MEM_COORD_KB_SIZE);
+    metrics_family(metrics, "mem_coord_host_total_bytes", "gauge", "Host total memory.");
+    metrics_printf(metrics, "mem_coord_host_total_bytes %llu\n", (unsigned long long)virt_info.host_total_mem * MEM_COORD_KB_SIZE);
+    metrics_family(metrics, "mem_coord_node_free_bytes", "gauge", "NUMA node free memory (after this cycle's resizes).");
 
-            /* Check if error occurred */
-            if (virt_info.host_free_mem == 0)
-            {
-                /* Set host free memory error */
-                status = MEM_COORD_HOST_FREE_MEM_ERROR;
-            }
-            else
-            {
-                /* Get the host info to get memory available on the host */
-                status = virNodeGetInfo(virt_info.conn, &info);
+    /* Loop through each NUMA node */
+    for (index = 0; index < virt_info.num_nodes; index++)
+    {
+        metrics_printf(metrics, "mem_coord_node_free_bytes{node=\"%d\"} %llu\n", index,
+                       virt_info.node_free_mem[index] * MEM_COORD_KB_SIZE);
+    }
 
-                /* Ensure host info obtained successfully */
-                if (status == EXIT_SUCCESS)
-                {
-                    /* Set total memory available on host */
-                    virt_info.host_total_mem = info.memory;
+    metrics_family(metrics, "mem_coord_vms", "gauge", "VMs coordinated.");
+    metrics_printf(metrics, "mem_coord_vms %d\n", virt_info.num_domains);
 
-                    /* Calculate target memory size for host */
-                    virt_info.host_tgt_mem = (MEM_COORD_AVAIL_HOST_TGT_PERCENT * virt_info.host_total_mem)/100;
+    /* Output balloon size of each VM */
+    metrics_family(metrics, "mem_coord_vm_balloon_bytes", "gauge", "VM balloon size.");
 
-                    /* Initialize the memory info structures */
-                    status = vm_mem_info_init();
-                }
-                else
-                {
-                    /* Set error code */
-                    status = MEM_COORD_DOMAIN_MEM_ERROR;
-                }
-            }
-        }
-        else
-        {
-            /* Check if error returned when trying to get list of domains */
-            if (virt_info.num_domains < 0)
-            {
-                /* Set error status appropriately */
-                status = MEM_COORD_DOMAIN_LIST_ERROR;
-            }
-            else
-            {
-                /* Set error for no domains */
-                status = MEM_COORD_NO_DOMAINS;
-            }
-        }
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_balloon_bytes{vm=\"%s\"} %llu\n", label,
+                       vm_mem_info[index].mem_collected * MEM_COORD_KB_SIZE);
     }
-    else
+
+    /* Output unused memory of each VM */
+    metrics_family(metrics, "mem_coord_vm_unused_bytes", "gauge", "VM unused memory.");
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
     {
-        /* Return error */
-        status = MEM_COORD_CONN_ERROR;
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_unused_bytes{vm=\"%s\"} %llu\n", label,
+                       vm_mem_info[index].mem_free * MEM_COORD_KB_SIZE);
     }
 
-    /* Return status to caller */
-    return (status);
+    /* Output maximum memory of each VM */
+    metrics_family(metrics, "mem_coord_vm_max_bytes", "gauge", "VM maximum memory.");
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_max_bytes{vm=\"%s\"} %llu\n", label,
+                       (unsigned long long)vm_mem_info[index].mem_max * MEM_COORD_KB_SIZE);
+    }
+
+    /* Output percent available memory of each VM */
+    metrics_family(metrics, "mem_coord_vm_available_percent", "gauge", "VM unused memory as a percent of its balloon size.");
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_available_percent{vm=\"%s\"} %d\n", label, vm_mem_info[index].percent_avail);
+    }
+
+    /* Output predicted change in used memory of each VM */
+    metrics_family(metrics, "mem_coord_vm_growth_bytes", "gauge", "VM used memory change predicted before the next cycle.");
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_growth_bytes{vm=\"%s\"} %lld\n", label,
+                       vm_mem_info[index].mem_growth * MEM_COORD_KB_SIZE);
+    }
+
+    /* Output balloon size each VM's resize in progress is stepping towards */
+    metrics_family(metrics, "mem_coord_vm_target_bytes", "gauge", "VM balloon size a rate-limited resize is stepping towards (0 = none).");
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_target_bytes{vm=\"%s\"} %llu\n", label,
+                       vm_mem_info[index].mem_target * MEM_COORD_KB_SIZE);
+    }
+
+    /* Output percent usable memory of each VM */
+    metrics_family(metrics, "mem_coord_vm_usable_percent", "gauge", "VM memory usable without swapping as a percent of its balloon size.");
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_usable_percent{vm=\"%s\"} %d\n", label, vm_mem_info[index].percent_usable);
+    }
+
+    /* Output swap rate of each VM */
+    metrics_family(metrics, "mem_coord_vm_swap_bytes_per_second", "gauge", "VM swap in plus out rate over the last cycle.");
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_swap_bytes_per_second{vm=\"%s\"} %llu\n", label,
+                       vm_mem_info[index].swap_rate * MEM_COORD_KB_SIZE);
+    }
+
+    /* Output major page fault rate of each VM */
+    metrics_family(metrics, "mem_coord_vm_major_faults_per_second", "gauge", "VM major page fault rate over the last cycle.");
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_major_faults_per_second{vm=\"%s\"} %llu\n", label, vm_mem_info[index].fault_rate);
+    }
+
+    /* Output pressure score of each VM */
+    metrics_family(metrics, "mem_coord_vm_pressure", "gauge", "VM memory pressure score (0 = none, 100 = thrashing or no usable memory).");
+
+    /* Loop through each VM */
+    for (index = 0; index < virt_info.num_domains; index++)
+    {
+        metrics_escape(label, vm_mem_info[index].name);
+        metrics_printf(metrics, "mem_coord_vm_pressure{vm=\"%s\"} %d\n", label, vm_mem_info[index].pressure);
+    }
+
+    /* End snapshot and publish it */
+    metrics_printf(metrics, "# EOF\n");
+    metrics_publish(metrics);
 }
 
 
@@ -504,11 +4109,15 @@ static int  virt_init(void)
 *
 *   FUNCTION
 *
-*       vm_mem_info_init
+*       render_mem_monitor
 *
 *   DESCRIPTION
 *
-*       Initialize the VM Memory Info data structures
+*       Renders a sample of the memory coordinator at the end of a cycle
+*       as a single line JSON object (host free memory, and the balloon,
+*       unused and available memory of each VM) and streams it to the
+*       monitor clients.  Only values already collected are used (no
+*       libvirt calls)
 *
 *   INPUTS
 *
@@ -516,51 +4125,59 @@ static int  virt_init(void)
 *
 *   OUTPUTS
 *
-*       EXIT_SUCCESS                        VM Memory Info data structures initialized
-*       Other                               Error with memory allocation or
-*                                           using libvirt
+*       None
 *
 *************************************************************************/
-static int vm_mem_info_init(void)
+static void render_mem_monitor(void)
 {
-    int     index, status = EXIT_SUCCESS;
+    MONITOR *           monitor = &virt_info.monitor;
+    char                name[MONITOR_STRING_LEN];
+    char                nodeset[MEM_COORD_NODESET_LEN];
+    int                 index;
 
 
-    /* Allocate memory for VM memory information structure for each VM */
-    vm_mem_info = calloc(virt_info.num_domains * sizeof(VM_MEM_INFO), 1);
+    /* Output cycle, time (monotonic), resizes and host memory */
+    monitor_printf(monitor, "{\"daemon\":\"memory_coordinator\",\"cycle\":%llu,\"time\":%.9f,\"interval\":%.3f,"
+                   "\"resizes_total\":%llu,\"host_total_kb\":%lu,\"host_free_kb\":%llu,\"host_avail_kb\":%llu,"
+                   "\"host_cache_kb\":%llu,\"host_ksm_kb\":%llu,\"phase_ns\":{",
+                   virt_info.num_cycles, (double)interval_now() / INTERVAL_NSECS_PER_SEC,
+                   virt_info.interval.interval_ms / INTERVAL_MSECS_PER_SEC, virt_info.num_resizes,
+                   virt_info.host_total_mem, virt_info.host_unused_mem, virt_info.host_free_mem,
+                   virt_info.host_cache_mem, virt_info.host_ksm_mem);
 
-    /* Ensure memory allocated */
-    if (vm_mem_info != NULL)
+    /* Loop through each phase */
+    for (index = 0; index < MEM_COORD_NUM_PHASES; index++)
     {
-        /* Loop through each VM */
-        for (index = 0; (index < virt_info.num_domains) && (status == EXIT_SUCCESS) ; index++)
-        {
-            /* Initialize the rate at which the balloon driver stats get updated to every 1 sec */
-            status = virDomainSetMemoryStatsPeriod (virt_info.domain_list[index], 1, VIR_DOMAIN_AFFECT_LIVE);
+        monitor_printf(monitor, "%s\"%s\":%llu", (index ? "," : ""), phase_names[index], virt_info.phase_ns[index]);
+    }
 
-            /* Ensure memory stats period successfully updated */
-            if (status == EXIT_SUCCESS)
-            {
-                /* Get maximum memory set for this VM */
-                vm_mem_info[index].mem_max = virDomainGetMaxMemory(virt_info.domain_list[index]);
+    /* Loop through each NUMA node */
+    monitor_printf(monitor, "},\"node_free_kb\":[");
 
-                /* Check if max VM memory not obtained */
-                if (vm_mem_info[index].mem_max == 0)
-                {
-                    /* Set status to error */
-                    status = MEM_COORD_DOMAIN_MEM_ERROR;
-                }
-            }
-        }
+    for (index = 0; index < virt_info.num_nodes; index++)
+    {
+        monitor_printf(monitor, "%s%llu", (index ? "," : ""), virt_info.node_free_mem[index]);
     }
-    else
+
+    /* Loop through each VM */
+    monitor_printf(monitor, "],\"vms\":[");
+
+    for (index = 0; index < virt_info.num_domains; index++)
     {
-        /* Set error status */
-        status = MEM_COORD_NOMEM;
+        monitor_escape(name, vm_mem_info[index].name);
+        nodeset_format(vm_mem_info[index].node_mask, nodeset, sizeof(nodeset));
+        monitor_printf(monitor, "%s{\"vm\":\"%s\",\"balloon_kb\":%llu,\"unused_kb\":%llu,\"available_kb\":%llu,"
+                       "\"max_kb\":%lu,\"target_kb\":%llu,\"swap_rate_kb\":%llu,\"pressure\":%d,\"page_kb\":%llu,"
+                       "\"hugetlb_full\":%d,\"nodes\":\"%s\"}",
+                       (index ? "," : ""), name, vm_mem_info[index].mem_collected, vm_mem_info[index].mem_free,
+                       vm_mem_info[index].mem_avail, vm_mem_info[index].mem_max, vm_mem_info[index].mem_target,
+                       vm_mem_info[index].swap_rate, vm_mem_info[index].pressure, vm_mem_info[index].page_kb,
+                       vm_mem_info[index].hugetlb_full, nodeset);
     }
 
-    /* Return status to caller */
-    return (status);
+    /* End sample and stream it */
+    monitor_printf(monitor, "]}\n");
+    monitor_publish(monitor);
 }
 
 
@@ -568,12 +4185,15 @@ static int vm_mem_info_init(void)
 *
 *   FUNCTION
 *
-*       virt_deinit
+*       render_mem_shm
 *
 *   DESCRIPTION
 *
-*       De-initializes all the virtualization content - frees data structures,
-*       closes connections, etc.
+*       Publishes the stats of the memory coordinator at the end of a
+*       cycle in the shared memory snapshot - the host memory and a record
+*       for each VM.  Only values already collected are used (no libvirt
+*       calls) and the records are written in place, so publishing makes
+*       no system calls unless the segment has to grow
 *
 *   INPUTS
 *
@@ -584,25 +4204,53 @@ static int vm_mem_info_init(void)
 *       None
 *
 *************************************************************************/
-static void virt_deinit(void)
+static void render_mem_shm(void)
 {
-    /* Loop through and free all domain names */
-    do
-    {
-        /* Decrement number of domains to process */
-        virt_info.num_domains--;
+    STATS_SHM *         shm = &virt_info.shm;
+    STATS_SHM_HEADER *  header;
+    STATS_SHM_VM *      vm;
+    int                 index;
 
-        /* Free returned names */
-        virDomainFree(virt_info.domain_list[virt_info.num_domains]);
 
-    /* Keep looping until all domain names are free */
-    } while (virt_info.num_domains);
+    /* Start rewriting the snapshot (no PCPU / VCPU records) */
+    header = stats_shm_begin(shm, 0, 0, virt_info.num_domains);
 
-    /* Free the list */
-    free(virt_info.domain_list);
+    /* Ensure snapshot can be published */
+    if (header != NULL)
+    {
+        /* Set cycle, interval, resizes, phases and host memory */
+        header->cycle = virt_info.num_cycles;
+        header->interval_ms = virt_info.interval.interval_ms;
+        header->num_changes = virt_info.num_resizes;
+        header->host_total_kb = virt_info.host_total_mem;
+        header->host_free_kb = virt_info.host_unused_mem;
+
+        for (index = 0; index < MEM_COORD_NUM_PHASES; index++)
+        {
+            header->phase_ns[index] = virt_info.phase_ns[index];
+        }
+
+        /* Loop through each VM */
+        for (index = 0; index < virt_info.num_domains; index++)
+        {
+            vm = stats_shm_vm(shm, index);
+            snprintf(vm->name, STATS_SHM_NAME_LEN, "%s", vm_mem_info[index].name);
+            vm->dom_id = vm_mem_info[index].dom_id;
+            vm->pressure = vm_mem_info[index].pressure;
+            vm->percent_avail = vm_mem_info[index].percent_avail;
+            vm->percent_usable = vm_mem_info[index].percent_usable;
+            vm->balloon_kb = vm_mem_info[index].mem_collected;
+            vm->unused_kb = vm_mem_info[index].mem_free;
+            vm->available_kb = vm_mem_info[index].mem_avail;
+            vm->max_kb = vm_mem_info[index].mem_max;
+            vm->target_kb = vm_mem_info[index].mem_target;
+            vm->swap_rate_kb = vm_mem_info[index].swap_rate;
+            vm->fault_rate = vm_mem_info[index].fault_rate;
+        }
 
-    /* Close connection to hypervisor */
-    virConnectClose(virt_info.conn);
+        /* Publish snapshot */
+        stats_shm_end(shm);
+    }
 }
 
 
@@ -635,14 +4283,18 @@ static void dump_mem_stats(void)
     printf("\nMemory Stats\n");
     printf("============\n");
 
-    /* Output host free memory */
-    printf("Host Free Memory = %lld MBytes\n\n", (virt_info.host_free_mem / MEM_COORD_KB_SIZE));
+    /* Output host free memory and the current interval */
+    printf("Host Free Memory = %lld MBytes (available %lld MBytes, cache %lld MBytes, KSM saved %lld MBytes)\n",
+           (virt_info.host_unused_mem / MEM_COORD_KB_SIZE), (virt_info.host_free_mem / MEM_COORD_KB_SIZE),
+           (virt_info.host_cache_mem / MEM_COORD_KB_SIZE), (virt_info.host_ksm_mem / MEM_COORD_KB_SIZE));
+    printf("Interval         = %u ms\n", virt_info.interval.interval_ms);
+    printf("Resize Timeouts  = %d (total %llu)\n\n", virt_info.num_timeouts, virt_info.workers.num_timeouts);
 
     /* Loop through each VM */
     for (index = 0; index < virt_info.num_domains ; index++)
     {
         /* Print VM name */
-        printf("VM name          = %s\n", virDomainGetName(virt_info.domain_list[index]));
+        printf("VM name          = %s\n", vm_mem_info[index].name);
 
         /* Output VM balloon memory info */
         printf("    Balloon Size = %lld MBytes\n", (vm_mem_info[index].mem_total / MEM_COORD_KB_SIZE));
@@ -651,7 +4303,26 @@ static void dump_mem_stats(void)
         printf("    Avail Size   = %lld MBytes\n", (vm_mem_info[index].mem_free / MEM_COORD_KB_SIZE));
 
         /* Print % available memory for the VM */
-        printf("    Percent Avail= %d\n\n", vm_mem_info[index].percent_avail);
+        printf("    Percent Avail= %d\n", vm_mem_info[index].percent_avail);
+
+        /* Print % usable memory, swap / fault rates and pressure score for the VM */
+        printf("    Pct Usable   = %d\n", vm_mem_info[index].percent_usable);
+        printf("    Swap Rate    = %llu KBytes/s\n", vm_mem_info[index].swap_rate);
+        printf("    Fault Rate   = %llu /s\n", vm_mem_info[index].fault_rate);
+        printf("    Pressure     = %d\n", vm_mem_info[index].pressure);
+
+        /* Print balloon size change made this cycle */
+        printf("    Change       = %lld KBytes\n", vm_mem_info[index].mem_change);
+
+        /* Print balloon size a resize in progress is stepping towards */
+        if (vm_mem_info[index].mem_target)
+        {
+            printf("    Stepping To  = %llu MBytes\n", (vm_mem_info[index].mem_target / MEM_COORD_KB_SIZE));
+        }
+
+        /* Print predicted change in used memory before the next cycle */
+        printf("    Growth       = %lld KBytes%s\n\n", vm_mem_info[index].mem_growth,
+               (vm_mem_info[index].trend_down ? " (falling)" : ""));
     }
 }
 #endif  /* (MEM_COORD_DEBUG == 1) */
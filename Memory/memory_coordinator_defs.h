@@ -9,16 +9,119 @@
 #ifndef MEMORY_COORDINATOR_DEFS_H
 #define MEMORY_COORDINATOR_DEFS_H
 
+#include "bitmask_defs.h"
+#include "xml_defs.h"
+#include "domain_events_defs.h"
+#include "interval_defs.h"
+#include "worker_pool_defs.h"
+#include "metrics_defs.h"
+#include "monitor_defs.h"
+#include "stats_shm_defs.h"
+#include "policy_defs.h"
+#include "config_defs.h"
+#include "trace_defs.h"
+
 /* Set debug to 1 for printf details of memory stats collected / 0 for no output */
 #define MEM_COORD_DEBUG                     1
 
-/* Configurable values used for making memory changes for VMs */
+/* Set bulk stats to 1 to collect the balloon stats of all VMs with a single libvirt call per cycle
+   (virConnectGetAllDomainStats) / 0 to always use one call per VM.
+   NOTE:  Per-VM collection is still used if libvirt doesn't support bulk stats */
+#if LIBVIR_CHECK_VERSION(4, 6, 0)
+#define MEM_COORD_BULK_STATS                1
+#else
+#define MEM_COORD_BULK_STATS                0
+#endif
+
+/* URI of the hypervisor the memory coordinator connects to */
+#define MEM_COORD_URI                       "qemu:///system"
+
+/* Number of workers (each with its own hypervisor connection) used to resize balloons
+   concurrently so a slow guest doesn't delay memory changes for other VMs / 0 to resize inline
+   NOTE:  May be overridden at runtime with the -j command-line option */
+#define MEM_COORD_WORKERS                   4
+
+/* Time (in milliseconds) each cycle waits for a balloon resize before moving on (the resize
+   keeps running and the VM is skipped until it returns) */
+#define MEM_COORD_CALL_TIMEOUT              2000
+
+/* TCP port (on METRICS_BIND_ADDR) the OpenMetrics endpoint (/metrics) is served on / 0 for no endpoint
+   NOTE:  May be overridden at runtime with the -m command-line option */
+#define MEM_COORD_METRICS_PORT              0
+
+/* Configurable values used for making memory changes for VMs
+   NOTE:  May be overridden at runtime in the [memory] section of the configuration file (-c) */
 #define MEM_COORD_AVAIL_HOST_LOW_PERCENT    10      /* Host with less avail % than this is considered low in memory */
 #define MEM_COORD_AVAIL_HOST_TGT_PERCENT    15      /* Target % of available memory for host */
 #define MEM_COORD_AVAIL_VM_LOW_PERCENT      25      /* VM with less avail % than this are considered "deficient" in memory */
 #define MEM_COORD_AVAIL_VM_TGT_PERCENT      30      /* VM target percent of available memory */
 #define MEM_COORD_AVAIL_VM_HIGH_PERCENT     33      /* VMs with more avail % than this are considered to have "excess" memory */
 
+/* Configurable values used to predict VM memory use from its recent trend
+   NOTE:  Prediction may be turned off at runtime with the -p command-line option */
+#define MEM_COORD_PREDICT                   1       /* 1 to size memory changes from usage trends / 0 to use current usage only */
+#define MEM_COORD_TREND_SAMPLES             4       /* Cycles of used memory kept per VM to estimate its usage rate */
+#define MEM_COORD_TREND_DOWN_PERCENT        2       /* VM whose usage fell every cycle and by more than this % of its
+                                                       balloon per cycle has memory above target reclaimed early */
+
+/* Configurable values used to score the memory pressure of each VM (0 - 100) from the guest's
+   memory stats - a VM is scored by its least usable memory (page cache counts as usable) or, if
+   higher, by how fast it is swapping / taking major page faults */
+#define MEM_COORD_SWAP_THRASH_RATE          4096    /* Swap in + out (KB/s) scored as full pressure (100) */
+#define MEM_COORD_FAULT_THRASH_RATE         1000    /* Major page faults per second scored as full pressure (100) */
+
+/* Configurable values used to limit how fast balloons are resized - a resize larger than a rate
+   allows is made in steps, one each sub-interval, until the VM reaches its requested size
+   NOTE:  Rates may be overridden at runtime with the -r command-line option */
+#define MEM_COORD_INFLATE_RATE              128     /* Maximum rate (MB/s) memory is reclaimed from a VM (0 = unlimited) */
+#define MEM_COORD_DEFLATE_RATE              512     /* Maximum rate (MB/s) memory is given to a VM (0 = unlimited) */
+#define MEM_COORD_STEP_MS                   100     /* Sub-interval (milliseconds) between resize steps */
+
+/* Configurable values used to align balloon resizes to the pages backing a VM, so ballooning
+   doesn't break up the hugepages of the guest (a resize of part of a page can't be given back to
+   the host and leaves the rest of the page mapped with small pages)
+   NOTE:  Mode may be overridden at runtime with the -g command-line option */
+#define MEM_COORD_ALIGN                     MEM_COORD_ALIGN_HUGEPAGES /* Default alignment mode */
+#define MEM_COORD_HUGEPAGE_KB               2048    /* Page size (KB) of a VM backed by the host's default hugepages */
+#define MEM_COORD_THP_KB                    2048    /* Page size (KB) of a transparent hugepage */
+#define MEM_COORD_HUGETLB_HOLD_SECS         30      /* Time (seconds) a VM's hugepage pool counts as fully committed
+                                                       after a failed hugepage allocation in the guest */
+
+/* Define alignment modes of balloon resizes */
+#define MEM_COORD_ALIGN_OFF                 0       /* Resize by any amount */
+#define MEM_COORD_ALIGN_HUGEPAGES           1       /* Align VMs backed by hugepages (domain XML <memoryBacking>) */
+#define MEM_COORD_ALIGN_THP                 2       /* Also align other VMs to transparent hugepages */
+
+/* Configurable values used to model the memory available on the host - the free memory, the part of
+   the host's buffers / page cache it can drop without pressure, less a reserve for the memory KSM
+   saves (guests writing to shared pages unshare them again)
+   NOTE:  Percents may be overridden at runtime with the -k command-line option */
+#define MEM_COORD_HOST_CACHE_PERCENT        50      /* % of host buffers / page cache counted as available */
+#define MEM_COORD_KSM_RESERVE_PERCENT       10      /* % of the memory KSM saves held back (not counted as available) */
+
+/* Configurable values used to keep the memory of each VM on its NUMA nodes - the nodes of its
+   numatune nodeset (domain XML) or, when run by the resource manager, the nodes its VCPUs are
+   pinned to.  A VM growing on nodes low on free memory is given memory reclaimed from the VMs on
+   the same nodes first
+   NOTE:  Mode may be overridden at runtime with the -n command-line option */
+#define MEM_COORD_NUMA                      MEM_COORD_NUMA_LOCAL /* Default NUMA mode */
+#define MEM_COORD_MAX_NODES                 64      /* Most NUMA nodes tracked (nodes of a VM are kept in a 64 bit mask) */
+#define MEM_COORD_NODESET_LEN               256     /* Longest nodeset set on a VM (ie 0,1,2) */
+
+/* Define NUMA modes */
+#define MEM_COORD_NUMA_OFF                  0       /* Host memory is a single pool */
+#define MEM_COORD_NUMA_LOCAL                1       /* Grow VMs from their nodes first - warn when a node runs out
+                                                       (a VM bound to its nodes is only grown by what they hold) */
+#define MEM_COORD_NUMA_SPREAD               2       /* As local, then add the node with the most free memory to the
+                                                       nodeset of a VM bound to nodes that ran out */
+
+/* Configurable values used to plan memory reclaimed from VMs when the host is low on memory
+   NOTE:  May be overridden at runtime in the [memory] section of the configuration file (-c) */
+#define MEM_COORD_VM_MIN_MEM                262144  /* Minimum balloon size (KB) a reclaim leaves a VM with */
+
+/* Section of the configuration file holding the memory coordinator settings */
+#define MEM_COORD_CONFIG_SECTION            "memory"
+
 /* Define status errors */
 #define MEM_COORD_CONN_ERROR                -1
 #define MEM_COORD_NO_DOMAINS                -2
@@ -26,24 +129,91 @@
 #define MEM_COORD_NOMEM                     -4
 #define MEM_COORD_DOMAIN_MEM_ERROR          -5
 #define MEM_COORD_HOST_FREE_MEM_ERROR       -6
+#define MEM_COORD_DOMAIN_GONE               -7      /* Domain stopped - skipped until its stop event is processed */
+#define MEM_COORD_EVENT_ERROR               -8
+#define MEM_COORD_SET_MEM_ERROR             -9
+#define MEM_COORD_WORKER_ERROR              -10
+#define MEM_COORD_METRICS_ERROR             -11
+#define MEM_COORD_BULK_STATS_UNSUPPORTED    -12
+#define MEM_COORD_CONFIG_ERROR              -13
+#define MEM_COORD_TRACE_ERROR               -14
+#define MEM_COORD_MONITOR_ERROR             -15
+#define MEM_COORD_SHM_ERROR                 -16
+
+/* Round a balloon size (KB) down / up to a multiple of an alignment (KB) */
+#define MEM_COORD_ALIGN_DOWN(size, align)   (((size) / (align)) * (align))
+#define MEM_COORD_ALIGN_UP(size, align)     ((((size) + (align) - 1) / (align)) * (align))
 
 /* Define kilobyte memory size */
 #define MEM_COORD_KB_SIZE                   1024
 
-/* Define number of VM memory stats used by the memory coordinator */
-#define MEM_COORD_NUM_STATS                 2
+/* Define size of a guest page in KB (memory brought in by a major page fault / shared by KSM) */
+#define MEM_COORD_PAGE_KB                   4
+
+/* Number of node memory / KSM parameters read (libvirt returns up to this many) */
+#define MEM_COORD_HOST_PARAMS               8
+
+/* Define guest memory stats a VM may not report (besides balloon size and unused memory) */
+#define MEM_COORD_STAT_USABLE               0x01    /* Memory usable without swapping (includes page cache) */
+#define MEM_COORD_STAT_DISK_CACHES          0x02    /* Page cache that can be dropped */
+#define MEM_COORD_STAT_SWAP                 0x04    /* Total swapped in / out */
+#define MEM_COORD_STAT_MAJOR_FAULT          0x08    /* Total major page faults */
+#define MEM_COORD_STAT_HUGETLB_FAIL         0x10    /* Total hugepage allocations the guest couldn't make */
+
+/* Define tiers of memory the host reclaim planner takes from VMs (in order, each tier taken
+   from VMs in proportion to what they have in it before moving on to the next) */
+#define MEM_COORD_RECLAIM_EXCESS            0       /* Memory above the VM target (VMs not under pressure) */
+#define MEM_COORD_RECLAIM_SPARE             1       /* Memory above the VM low threshold (VMs not under pressure) */
+#define MEM_COORD_RECLAIM_FLOOR             2       /* Memory above the VM working set / minimum size (all VMs) */
+#define MEM_COORD_RECLAIM_TIERS             3
+#define MEM_COORD_RECLAIM_SPARE_TIERS       (MEM_COORD_RECLAIM_SPARE + 1) /* Number of tiers short of the floor tier */
+
+/* Define phases of a coordination cycle timed for the metrics */
+#define MEM_COORD_PHASE_COLLECT             0       /* collect_mem_stats */
+#define MEM_COORD_PHASE_ADJUST              1       /* vm_memory_adjust (including waiting for resizes) */
+#define MEM_COORD_PHASE_EVENTS              2       /* domain_events_process (of the previous cycle) */
+#define MEM_COORD_NUM_PHASES                3
+
+/* Maximum length of a VM name kept for output (longer names are truncated) */
+#define MEM_COORD_NAME_LEN                  64
 
 /* Structure to keep track of all the virt library variables / data */
 typedef struct VIRT_INFO_STRUCT
 {
     virConnectPtr       conn;
+    int                 shared;         /* Non-zero if the connection and domain events belong to the resource manager */
     int                 num_domains;
+    int                 max_domains;    /* Number of entries allocated in domain list / VM memory info */
     virDomainPtr *      domain_list;
-    unsigned long long  host_free_mem;
+    unsigned long long  host_free_mem;  /* Host memory available (free + droppable cache - KSM reserve) */
+    unsigned long long  host_step_mem;  /* Host memory available as the resize steps made so far leave it
+                                           (grants are paced behind it) */
+    unsigned long long  host_unused_mem; /* Host free memory read */
+    unsigned long long  host_cache_mem; /* Host buffers / page cache read (0 = node memory stats not supported) */
+    unsigned long long  host_ksm_mem;   /* Host memory saved by KSM (0 = not supported / KSM off) */
+    int                 host_stats;     /* Number of node memory stats (0 = not supported) */
+    int                 host_ksm;       /* Number of node memory parameters with the KSM stats (0 = not supported) */
+    int                 num_nodes;      /* Number of NUMA nodes (cells) of the host */
+    unsigned long long  node_free_mem[MEM_COORD_MAX_NODES]; /* Free memory (KB) of each node (tracked as host free memory) */
+    unsigned long long  node_total_mem[MEM_COORD_MAX_NODES]; /* Total memory (KB) of each node */
     unsigned long       host_total_mem;
     unsigned long       host_tgt_mem;
-    unsigned int        high_mem_mask;
-    unsigned int        low_mem_mask;
+    int                 bulk_stats;     /* Non-zero if bulk balloon stats are supported */
+    BITMASK             high_mem_mask;
+    BITMASK             low_mem_mask;
+    DOMAIN_EVENTS       events;         /* Domain start / stop events waiting to be processed */
+    INTERVAL            interval;       /* Time between coordination cycles */
+    WORKER_POOL         workers;        /* Workers used to resize balloons concurrently */
+    int                 num_timeouts;   /* Number of resizes that timed out during the last cycle */
+    unsigned long long  num_resizes;    /* Total number of balloon resizes made */
+    unsigned long long  num_cycles;     /* Total number of coordination cycles run */
+    unsigned long long  phase_ns[MEM_COORD_NUM_PHASES]; /* Time spent in each phase of the last cycle */
+    METRICS             metrics;        /* OpenMetrics endpoint (if enabled with -m) */
+    MONITOR             monitor;        /* Monitor stream (if enabled with -u) */
+    STATS_SHM           shm;            /* Shared memory snapshot (if enabled with -z) */
+    CONFIG              config;         /* Configuration file last loaded (if given with -c) */
+    unsigned int        config_generation; /* Reload request the configuration was last loaded at */
+    TRACE               trace;          /* Binary trace of each cycle (if enabled with -o) */
 
 } VIRT_INFO;
 
@@ -54,19 +224,56 @@ typedef struct VM_MEM_INFO_STRUCT
     unsigned long long  mem_total;
     unsigned long       mem_max;
     int                 percent_avail;
+    unsigned long long  mem_usable;     /* Memory usable without swapping (if reported) */
+    unsigned long long  mem_caches;     /* Page cache that can be dropped (if reported) */
+    unsigned long long  swap_in;        /* Total swapped in since boot (if reported) */
+    unsigned long long  swap_out;       /* Total swapped out since boot (if reported) */
+    unsigned long long  major_faults;   /* Total major page faults since boot (if reported) */
+    int                 reported;       /* MEM_COORD_STAT_xxx bits of stats reported this cycle */
+    unsigned long long  swap_last;      /* Swap in + out when the pressure was last scored */
+    unsigned long long  faults_last;    /* Major page faults when the pressure was last scored */
+    unsigned long long  stats_ns;       /* Monotonic time (ns) the pressure was last scored (0 = never) */
+    unsigned long long  mem_avail;      /* Memory available to the guest (usable if reported, otherwise unused) */
+    unsigned long long  mem_used;       /* Balloon size less unused memory */
+    unsigned long long  mem_ws;         /* Working set (balloon size less available memory) */
+    long long           mem_change;     /* Balloon size change made this cycle (< 0 = reclaimed) */
+    unsigned long long  mem_target;     /* Balloon size requested (0 = no resize in progress) */
+    unsigned long long  mem_balloon;    /* Balloon size last collected / set by a resize step */
+    unsigned long long  mem_collected;  /* Balloon size collected this cycle (output - mem_total is the size planned) */
+    unsigned long long  step_ns;        /* Monotonic time (ns) of the last resize step */
+    int                 percent_usable; /* Available memory as a % of the balloon size */
+    unsigned long long  swap_rate;      /* Swap in + out (KB/s) since the last cycle */
+    unsigned long long  fault_rate;     /* Major page faults per second since the last cycle */
+    int                 pressure;       /* Memory pressure score (0 = none - 100 = thrashing / no usable memory) */
+    int                 collected;      /* Non-zero if stats were collected this cycle */
+    int                 cpu_saturated;  /* Non-zero if the VM is CPU saturated this cycle (resource manager only) */
+    unsigned int        dom_id;         /* Hypervisor ID of VM (used to match bulk stats records) */
+    unsigned long long  used_hist[MEM_COORD_TREND_SAMPLES]; /* Used memory of recent cycles (circular) */
+    unsigned long long  time_hist[MEM_COORD_TREND_SAMPLES]; /* Monotonic time (ns) each used memory was collected */
+    int                 num_hist;       /* Number of used memory samples kept */
+    int                 next_hist;      /* Next used memory sample to replace */
+    long long           mem_growth;     /* Predicted increase in used memory before the next cycle (< 0 = decrease) */
+    int                 trend_down;     /* Non-zero if used memory is clearly falling */
+    unsigned long long  page_kb;        /* Size (KB) of the pages backing the VM (domain XML - 0 = small pages) */
+    int                 free_reporting; /* Non-zero if the guest reports its free pages to the host (domain XML) */
+    unsigned long long  mem_reported;   /* Unused memory already given back to the host by free page reporting
+                                           (a reclaim of it frees no host memory) */
+    unsigned long long  mem_credit;     /* Host memory credited for the VM's reclaim that its steps haven't freed yet */
+    unsigned long long  numa_mask;      /* Nodes of the VM's numatune nodeset (domain XML - 0 = none) */
+    int                 numa_strict;    /* Non-zero if the VM's memory may only come from its nodeset (strict /
+                                           restrictive numatune mode) */
+    unsigned long long  node_mask;      /* Nodes the VM's memory is on this cycle (0 = not known) */
+    int                 numa_warned;    /* Non-zero once a warning was given that the VM's nodes ran out of memory */
+    unsigned long long  hugetlb_fail;   /* Total hugepage allocations the guest couldn't make (if reported) */
+    unsigned long long  hugetlb_fail_last; /* Hugepage allocation failures when last checked */
+    unsigned long long  hugetlb_fail_ns; /* Monotonic time (ns) a hugepage allocation last failed (0 = never) */
+    int                 hugetlb_full;   /* Non-zero if the guest's hugepage pool is fully committed (an allocation
+                                           failed within MEM_COORD_HUGETLB_HOLD_SECS) - memory isn't reclaimed */
+    int                 priority;       /* Priority of VM from the configuration file (> 0 = only reclaimed to its floor) */
+    unsigned long long  min_mem;        /* Smallest balloon size (KB) from the configuration file (0 = none) */
+    unsigned long long  max_mem;        /* Largest balloon size (KB) from the configuration file (0 = none) */
+    char                name[MEM_COORD_NAME_LEN]; /* VM name (read once when the VM is added) */
 
 } VM_MEM_INFO;
 
-/* Macro to get bit position of lowest set bit in a 32-bit value */
-#define LOW_BIT_GET32(value32, lowbit_ptr)                          \
-        {                                                           \
-            /* Initialize lowbit to 0 */                            \
-            *lowbit_ptr = 0;                                        \
-                                                                    \
-            /* Use bitscan forward assembly instruction */          \
-            asm volatile(" bsf  %0, %1"                             \
-                        : "=r" (*(unsigned int *)lowbit_ptr)        \
-                        : "r" ((unsigned int)value32));             \
-        }
-
 #endif /* MEMORY_COORDINATOR_DEFS_H */
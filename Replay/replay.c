@@ -0,0 +1,2040 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains Replay Engine code that runs the VCPU
+*       scheduler and the memory coordinator policies against a simulated
+*       host (see replay_virt.c) instead of a hypervisor.  Scenarios are
+*       the testcases of ../test, random workloads or traces recorded by
+*       the daemons with -o - each runs in its own process on a
+*       simulated clock, so a policy change can be checked against
+*       thousands of scenarios in seconds.  The cycles of both policies
+*       are run as the resource manager runs them.
+*
+*   FUNCTIONS
+*
+*       main
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "replay_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static int  replay_options(int argc, char ** argv, REPLAY_OPTIONS * options, int * num_random, unsigned int * seed);
+static int  replay_testcase_parse(const char * text, REPLAY_SCENARIO * scenario);
+static char ** replay_policy_argv(int argc, char ** argv, const char * name);
+static int  replay_scenario(const REPLAY_OPTIONS * options, const REPLAY_SCENARIO * scenario, REPLAY_RESULT * result);
+static int  replay_scenario_run(const REPLAY_OPTIONS * options, const REPLAY_SCENARIO * scenario,
+                                REPLAY_RESULT * result, FILE * out);
+static int  replay_cpu_testcase(int number, int num_cycles);
+static int  replay_mem_testcase(int number, int num_cycles, unsigned int interval_ms);
+static void replay_mem_ramp(REPLAY_VM * vm, int free_cycle, unsigned int interval_ms);
+static int  replay_random(unsigned int seed, int num_cycles, int num_pcpus);
+static int  replay_trace_load(const char * path, int num_cycles);
+static int  replay_trace_read(REPLAY_TRACE * trace, const char * path);
+static int  replay_trace_scan(REPLAY_TRACE * trace);
+static int  replay_trace_fill(REPLAY_TRACE * trace);
+static int  replay_trace_domain(REPLAY_TRACE * trace, unsigned int dom_id);
+static int  replay_run(const REPLAY_OPTIONS * options, REPLAY_RESULT * result, FILE * out);
+static int  replay_cycle(const REPLAY_OPTIONS * options, virConnectPtr conn, unsigned int interval_ms);
+static int  replay_domains_update(const REPLAY_OPTIONS * options, int cycle);
+static int  replay_domain_event(const REPLAY_OPTIONS * options, int type, virDomainPtr domain);
+static void replay_result_print(const REPLAY_RESULT * result);
+static void replay_summary(const REPLAY_RESULT * results, int num_results);
+static int  replay_int_compare(const void * a, const void * b);
+
+/*****************************/
+/* LOCAL VARIABLES           */
+/*****************************/
+static char **              cpu_argv;       /* VCPU scheduler options (ending with -j 0) */
+static int                  cpu_argc;
+static char **              mem_argv;       /* Memory coordinator options (ending with -j 0) */
+static int                  mem_argc;
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       main
+*
+*   DESCRIPTION
+*
+*       C entry function
+*
+*   INPUTS
+*
+*       argc                                Number of parameters
+*       argv                                Array of parameters
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Application successfully executed
+*       EXIT_FAILURE                        Error in running application
+*
+*************************************************************************/
+int main(int argc, char ** argv)
+{
+    int                 index, num_random = 0, num_results = 0, status = EXIT_FAILURE;
+    unsigned int        seed = 1;
+    REPLAY_OPTIONS      options;
+    REPLAY_SCENARIO     scenario;
+    REPLAY_RESULT *     results = NULL;
+
+
+    /* No options yet */
+    memset(&options, 0, sizeof(options));
+
+    /* Check if command-line parameters are valid */
+    if (!replay_options(argc, argv, &options, &num_random, &seed))
+    {
+        /* Print error / usage */
+        fprintf(stderr, "Usage:  %s [-t <testcase>] [-f <trace>] [-r <count>] [-s <seed>] [-n <cycles>] [-p <pcpus>]\n\r", argv[0]);
+        fprintf(stderr, "           [-P cpu|mem|both] [-v] [-q] [-d] <time interval> [%s <scheduler options>] [%s <coordinator options>]\n\r",
+                REPLAY_CPU_ARG, REPLAY_MEM_ARG);
+        fprintf(stderr, "        where <time interval> = simulated time, in seconds, between cycles (ie 1, 0.5).\n\r");
+        fprintf(stderr, "              -t <testcase>   = replay a testcase of ../test (cpu1 - cpu%d, mem1 - mem%d).\n\r",
+                REPLAY_TC_CPU_NUM, REPLAY_TC_MEM_NUM);
+        fprintf(stderr, "              -f <trace>      = replay a trace recorded with -o.\n\r");
+        fprintf(stderr, "              -r <count>      = replay <count> random scenarios.\n\r");
+        fprintf(stderr, "              -s <seed>       = seed of the first random scenario (default 1).\n\r");
+        fprintf(stderr, "              -n <cycles>     = cycles to run each scenario for (default %d, or the length of a trace).\n\r",
+                REPLAY_CYCLES);
+        fprintf(stderr, "              -p <pcpus>      = PCPUs of the random scenarios (default random).\n\r");
+        fprintf(stderr, "              -P <policies>   = policies replayed (default both).\n\r");
+        fprintf(stderr, "              -v / -q         = print every cycle / print the summary only.\n\r");
+        fprintf(stderr, "              -d              = show the output of the policies.\n\r");
+        fprintf(stderr, "              With no -t, -f or -r every testcase is replayed.\n\r");
+    }
+    else
+    {
+        /* Allocate a result for every scenario */
+        results = calloc(options.num_scenarios + num_random + 1, sizeof(REPLAY_RESULT));
+        status = (results != NULL ? EXIT_SUCCESS : REPLAY_NOMEM);
+
+        /* Check if results allocated */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Check if results are printed one by one */
+            if (!options.quiet)
+            {
+                /* Print column headings */
+                printf("%-20s %5s %4s %6s | %8s %5s %8s %5s %5s | %8s %7s %13s %11s\n",
+                       "scenario", "pcpus", "vms", "cycles", "cpu conv", "moves", "imb mean", "final", "max",
+                       "mem conv", "resizes", "deficit MB*s", "free min MB");
+            }
+
+            /* Loop through each testcase / trace and then each random scenario */
+            for (index = 0; index < (options.num_scenarios + num_random); index++)
+            {
+                /* Get the scenario (random scenarios are numbered by their seed) */
+                if (index < options.num_scenarios)
+                {
+                    scenario = options.scenarios[index];
+                }
+                else
+                {
+                    scenario.type = REPLAY_SCENARIO_RANDOM;
+                    scenario.number = seed + (index - options.num_scenarios);
+                    scenario.path = NULL;
+                }
+
+                /* Replay the scenario in its own process */
+                replay_scenario(&options, &scenario, &results[num_results]);
+
+                /* Keep first error */
+                status = ((status == EXIT_SUCCESS) ? results[num_results].status : status);
+
+                /* Check if results are printed one by one */
+                if (!options.quiet)
+                {
+                    /* Print result of the scenario */
+                    replay_result_print(&results[num_results]);
+                }
+
+                /* Count result */
+                num_results++;
+            }
+
+            /* Print results of all scenarios */
+            replay_summary(results, num_results);
+        }
+
+        /* Check if error returned */
+        if (status != EXIT_SUCCESS)
+        {
+            /* Print error (after the results) */
+            fflush(stdout);
+            fprintf(stderr, "Exit error code = %d\n\r", status);
+        }
+    }
+
+    /* Free results, scenarios and policy options */
+    free(results);
+    free(options.scenarios);
+    free(cpu_argv);
+    free(mem_argv);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_options
+*
+*   DESCRIPTION
+*
+*       Parses the command-line parameters.  As for the resource manager
+*       the parameters are split at REPLAY_CPU_ARG / REPLAY_MEM_ARG - the
+*       replay engine's own options and time interval come first,
+*       followed by the options of each policy.  "-j 0" is added to the
+*       options of each policy, so stats are read and pins / resizes are
+*       made inline on the simulated host (a policy can still be given
+*       any other option, ie a configuration file or a trace)
+*
+*   INPUTS
+*
+*       argc                                Number of parameters
+*       argv                                Array of parameters
+*       options                             Options to set up
+*       num_random                          Pointer to return number of
+*                                           random scenarios
+*       seed                                Pointer to return seed of the
+*                                           first random scenario
+*
+*   OUTPUTS
+*
+*       1                                   Parameters valid
+*       0                                   Parameters invalid (show usage)
+*
+*************************************************************************/
+static int  replay_options(int argc, char ** argv, REPLAY_OPTIONS * options, int * num_random, unsigned int * seed)
+{
+    int     index, option, valid = 1;
+    int     replay_argc, cpu_index = 0, mem_index = 0;
+
+
+    /* Loop through each parameter looking for the start of each policy's options */
+    for (index = 1; index < argc; index++)
+    {
+        /* Check if VCPU scheduler options start here (only once) */
+        if ((strcmp(argv[index], REPLAY_CPU_ARG) == 0) && (cpu_index == 0))
+        {
+            cpu_index = index;
+        }
+        /* Check if memory coordinator options start here (only once) */
+        else if ((strcmp(argv[index], REPLAY_MEM_ARG) == 0) && (mem_index == 0))
+        {
+            mem_index = index;
+        }
+    }
+
+    /* Replay engine parameters end at the first policy's options */
+    replay_argc = ((cpu_index) && ((mem_index == 0) || (cpu_index < mem_index)) ? cpu_index :
+                   (mem_index) ? mem_index : argc);
+
+    /* Replay both policies by default and allocate room for every parameter to be a scenario */
+    options->policies = REPLAY_POLICY_CPU | REPLAY_POLICY_MEM;
+    options->scenarios = calloc(argc + REPLAY_TC_CPU_NUM + REPLAY_TC_MEM_NUM, sizeof(REPLAY_SCENARIO));
+    valid = (options->scenarios != NULL);
+
+    /* Loop through each replay engine option */
+    while ((valid) && ((option = getopt(replay_argc, argv, "t:f:r:s:n:p:P:vqd")) != -1))
+    {
+        switch (option)
+        {
+            /* Testcase option */
+            case 't':
+
+                /* Add testcase scenario (show usage if unknown) */
+                valid = replay_testcase_parse(optarg, &options->scenarios[options->num_scenarios++]);
+
+            break;
+
+            /* Trace option */
+            case 'f':
+
+                /* Add trace scenario */
+                options->scenarios[options->num_scenarios].type = REPLAY_SCENARIO_TRACE;
+                options->scenarios[options->num_scenarios++].path = optarg;
+
+            break;
+
+            /* Random scenarios option */
+            case 'r':
+
+                /* Set number of random scenarios */
+                *num_random = atoi(optarg);
+                valid = (*num_random > 0);
+
+            break;
+
+            /* Seed option */
+            case 's':
+
+                /* Set seed of the first random scenario */
+                *seed = (unsigned int)strtoul(optarg, NULL, 10);
+
+            break;
+
+            /* Cycles option */
+            case 'n':
+
+                /* Set cycles to run each scenario for */
+                options->num_cycles = atoi(optarg);
+                valid = (options->num_cycles > 0);
+
+            break;
+
+            /* PCPUs option */
+            case 'p':
+
+                /* Set PCPUs of the random scenarios */
+                options->num_pcpus = atoi(optarg);
+                valid = (options->num_pcpus > 0);
+
+            break;
+
+            /* Policies option */
+            case 'P':
+
+                /* Set policies replayed */
+                options->policies = ((strcmp(optarg, "cpu") == 0) ? REPLAY_POLICY_CPU :
+                                     (strcmp(optarg, "mem") == 0) ? REPLAY_POLICY_MEM :
+                                     (strcmp(optarg, "both") == 0) ? (REPLAY_POLICY_CPU | REPLAY_POLICY_MEM) : 0);
+                valid = (options->policies != 0);
+
+            break;
+
+            /* Verbose option */
+            case 'v':
+
+                /* Print every cycle */
+                options->verbose = 1;
+
+            break;
+
+            /* Quiet option */
+            case 'q':
+
+                /* Print the summary only */
+                options->quiet = 1;
+
+            break;
+
+            /* Debug option */
+            case 'd':
+
+                /* Show the output of the policies */
+                options->debug = 1;
+
+            break;
+
+            /* Unknown option */
+            default:
+
+                /* Show usage */
+                valid = 0;
+
+            break;
+        }
+    }
+
+    /* Ensure single argument for time interval passed in and it's a valid time */
+    valid = ((valid) && (optind == (replay_argc - 1)) &&
+             (interval_parse((const char *)argv[optind], &options->interval_ms) == EXIT_SUCCESS));
+
+    /* Check if no scenario given */
+    if ((valid) && (options->num_scenarios == 0) && (*num_random == 0))
+    {
+        /* Replay every CPU testcase */
+        for (index = 1; index <= REPLAY_TC_CPU_NUM; index++)
+        {
+            options->scenarios[options->num_scenarios].type = REPLAY_SCENARIO_CPU_TC;
+            options->scenarios[options->num_scenarios++].number = index;
+        }
+
+        /* Replay every memory testcase */
+        for (index = 1; index <= REPLAY_TC_MEM_NUM; index++)
+        {
+            options->scenarios[options->num_scenarios].type = REPLAY_SCENARIO_MEM_TC;
+            options->scenarios[options->num_scenarios++].number = index;
+        }
+    }
+
+    /* Check if parameters valid so far */
+    if (valid)
+    {
+        /* Get the VCPU scheduler options (up to the memory coordinator options if they follow) */
+        index = (cpu_index ? (((mem_index > cpu_index) ? mem_index : argc) - cpu_index) : 0);
+        cpu_argv = replay_policy_argv(index, &argv[cpu_index], REPLAY_CPU_ARG);
+
+        /* Get the memory coordinator options (up to the VCPU scheduler options if they follow) */
+        index = (mem_index ? (((cpu_index > mem_index) ? cpu_index : argc) - mem_index) : 0);
+        mem_argv = replay_policy_argv(index, &argv[mem_index], REPLAY_MEM_ARG);
+
+        /* Ensure options allocated */
+        valid = ((cpu_argv != NULL) && (mem_argv != NULL));
+    }
+
+    /* Check if parameters valid so far */
+    if (valid)
+    {
+        /* Count the options of each policy */
+        for (cpu_argc = 0; cpu_argv[cpu_argc] != NULL; cpu_argc++);
+        for (mem_argc = 0; mem_argv[mem_argc] != NULL; mem_argc++);
+
+        /* Parse the VCPU scheduler options with the policy argument in place of the program name
+           NOTE:  optind of 0 restarts the scan on a new parameter list */
+        optind = 0;
+        valid = ((vcpu_policy_options(cpu_argc, cpu_argv)) && (optind == cpu_argc));
+    }
+
+    /* Check if VCPU scheduler options valid */
+    if (valid)
+    {
+        /* Parse the memory coordinator options */
+        optind = 0;
+        valid = ((mem_policy_options(mem_argc, mem_argv)) && (optind == mem_argc));
+    }
+
+    /* Return if parameters are valid to caller */
+    return (valid);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_testcase_parse
+*
+*   DESCRIPTION
+*
+*       Converts a testcase name given with -t (cpu<n> / mem<n>) to a
+*       scenario
+*
+*   INPUTS
+*
+*       text                                Testcase name
+*       scenario                            Scenario to set
+*
+*   OUTPUTS
+*
+*       1                                   Testcase valid
+*       0                                   Unknown testcase
+*
+*************************************************************************/
+static int  replay_testcase_parse(const char * text, REPLAY_SCENARIO * scenario)
+{
+    int     number = atoi(text + strlen("cpu"));
+
+
+    /* Check if a CPU or a memory testcase */
+    scenario->type = ((strncmp(text, "cpu", strlen("cpu")) == 0) ? REPLAY_SCENARIO_CPU_TC :
+                      (strncmp(text, "mem", strlen("mem")) == 0) ? REPLAY_SCENARIO_MEM_TC : -1);
+    scenario->number = number;
+
+    /* Return if a known testcase to caller */
+    return (((scenario->type == REPLAY_SCENARIO_CPU_TC) && (number >= 1) && (number <= REPLAY_TC_CPU_NUM)) ||
+            ((scenario->type == REPLAY_SCENARIO_MEM_TC) && (number >= 1) && (number <= REPLAY_TC_MEM_NUM)));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_policy_argv
+*
+*   DESCRIPTION
+*
+*       Makes the option list of a policy - the options given (if any)
+*       followed by "-j 0" so the policy uses no workers
+*
+*   INPUTS
+*
+*       argc                                Number of options given
+*                                           (0 = none, including the
+*                                           policy argument)
+*       argv                                Options given
+*       name                                Policy argument
+*
+*   OUTPUTS
+*
+*       char **                             Option list (NULL terminated,
+*                                           NULL on allocation error)
+*
+*************************************************************************/
+static char ** replay_policy_argv(int argc, char ** argv, const char * name)
+{
+    int         index;
+    char **     list = calloc(argc + 4, sizeof(char *));
+
+
+    /* Check if allocated */
+    if (list != NULL)
+    {
+        /* Policy argument in place of the program name */
+        list[0] = (char *)name;
+
+        /* Loop through each option given after the policy argument */
+        for (index = 1; index < argc; index++)
+        {
+            /* Copy option */
+            list[index] = argv[index];
+        }
+
+        /* No workers - the simulated host isn't thread safe */
+        index = (argc ? argc : 1);
+        list[index++] = "-j";
+        list[index++] = "0";
+    }
+
+    /* Return list to caller */
+    return (list);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_scenario
+*
+*   DESCRIPTION
+*
+*       Replays a scenario in its own process - the policies keep their
+*       state in static variables, so each scenario starts them from
+*       scratch in a new process and sends its result back over a pipe
+*
+*   INPUTS
+*
+*       options                             Replay engine options
+*       scenario                            Scenario to replay
+*       result                              Result of the scenario
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Scenario replayed
+*       Others                              Error replaying the scenario
+*
+*************************************************************************/
+static int  replay_scenario(const REPLAY_OPTIONS * options, const REPLAY_SCENARIO * scenario, REPLAY_RESULT * result)
+{
+    int         pipe_fds[2], null_fd, child_status, status = EXIT_SUCCESS;
+    ssize_t     num_bytes = 0, num_read = 1;
+    pid_t       pid;
+    FILE *      out;
+
+
+    /* No result yet */
+    memset(result, 0, sizeof(*result));
+
+    /* Write out anything buffered so the child doesn't write it again */
+    fflush(stdout);
+
+    /* Create pipe for the result and start the child */
+    if (pipe(pipe_fds) != 0)
+    {
+        /* Set error status */
+        status = REPLAY_FORK_ERROR;
+    }
+    else if ((pid = fork()) < 0)
+    {
+        /* Set error status */
+        status = REPLAY_FORK_ERROR;
+        close(pipe_fds[0]);
+        close(pipe_fds[1]);
+    }
+    else if (pid == 0)
+    {
+        /* Child keeps its own copy of stdout for the cycles printed */
+        close(pipe_fds[0]);
+        out = fdopen(dup(STDOUT_FILENO), "w");
+
+        /* Check if output of the policies is hidden */
+        if ((!options->debug) && ((null_fd = open("/dev/null", O_WRONLY)) >= 0))
+        {
+            /* Send the policies' output to nowhere */
+            dup2(null_fd, STDOUT_FILENO);
+            close(null_fd);
+        }
+
+        /* Replay the scenario and send the result to the parent */
+        result->status = (out != NULL ? replay_scenario_run(options, scenario, result, out) : REPLAY_NOMEM);
+        num_bytes = write(pipe_fds[1], result, sizeof(*result));
+
+        /* Done with the child (nothing else to clean up) */
+        if (out != NULL)
+        {
+            fclose(out);
+        }
+        _exit((num_bytes == sizeof(*result)) ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    else
+    {
+        /* Read the result until all of it is read or the child is gone */
+        close(pipe_fds[1]);
+        while ((num_bytes < (ssize_t)sizeof(*result)) && (num_read > 0))
+        {
+            num_read = read(pipe_fds[0], (char *)result + num_bytes, sizeof(*result) - num_bytes);
+            num_bytes += (num_read > 0 ? num_read : 0);
+        }
+        close(pipe_fds[0]);
+
+        /* Wait for the child to end */
+        waitpid(pid, &child_status, 0);
+
+        /* Check if the whole result was read */
+        if (num_bytes != sizeof(*result))
+        {
+            /* Child crashed (the result may be partly read) */
+            memset(result, 0, sizeof(*result));
+            status = REPLAY_CRASH_ERROR;
+        }
+        else
+        {
+            /* Use status of the scenario */
+            status = result->status;
+        }
+    }
+
+    /* Check if no name was set (child didn't get that far) */
+    if (result->name[0] == '\0')
+    {
+        /* Name scenario by its source */
+        snprintf(result->name, sizeof(result->name), "%s", (scenario->path != NULL ? scenario->path : "?"));
+    }
+
+    /* Return status to caller */
+    result->status = status;
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_scenario_run
+*
+*   DESCRIPTION
+*
+*       Sets up the simulated host of a scenario and replays it (run in
+*       the child process of the scenario)
+*
+*   INPUTS
+*
+*       options                             Replay engine options
+*       scenario                            Scenario to replay
+*       result                              Result of the scenario
+*       out                                 Where the cycles are printed
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Scenario replayed
+*       Others                              Error replaying the scenario
+*
+*************************************************************************/
+static int  replay_scenario_run(const REPLAY_OPTIONS * options, const REPLAY_SCENARIO * scenario,
+                                REPLAY_RESULT * result, FILE * out)
+{
+    int     status;
+    int     num_cycles = (options->num_cycles ? options->num_cycles : REPLAY_CYCLES);
+
+
+    /* Set up the simulated host of the scenario */
+    switch (scenario->type)
+    {
+        /* CPU testcase */
+        case REPLAY_SCENARIO_CPU_TC:
+
+            status = replay_cpu_testcase(scenario->number, num_cycles);
+
+        break;
+
+        /* Memory testcase */
+        case REPLAY_SCENARIO_MEM_TC:
+
+            status = replay_mem_testcase(scenario->number, num_cycles, options->interval_ms);
+
+        break;
+
+        /* Random scenario */
+        case REPLAY_SCENARIO_RANDOM:
+
+            status = replay_random(scenario->number, num_cycles, options->num_pcpus);
+
+        break;
+
+        /* Trace (runs for as many cycles as recorded unless set) */
+        default:
+
+            status = replay_trace_load(scenario->path, options->num_cycles);
+
+        break;
+    }
+
+    /* Save the scenario */
+    snprintf(result->name, sizeof(result->name), "%s", replay_host.name);
+    result->num_pcpus = replay_host.num_pcpus;
+    result->num_vms = replay_host.num_vms;
+    result->num_cycles = replay_host.num_cycles;
+
+    /* Check if scenario set up */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Start the host and replay the scenario */
+        status = replay_host_start();
+        status = (status == EXIT_SUCCESS ? replay_run(options, result, out) : status);
+    }
+
+    /* Free the simulated host */
+    replay_host_free();
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_cpu_testcase
+*
+*   DESCRIPTION
+*
+*       Sets up a CPU testcase of ../test/cpu - 8 VMs with one VCPU each
+*       on 4 PCPUs:
+*
+*           1 - all VCPUs pinned to PCPU 0, all busy
+*           2 - 4 VCPUs pinned to PCPU 0 and 4 to the last PCPU, all busy
+*           3 - VCPUs already balanced (round robin), all busy
+*           4 - VCPUs not pinned (spread by the host), all busy
+*           5 - VCPUs not pinned, 4 busy and 4 light
+*
+*       The VMs don't use much memory (the memory coordinator sees them
+*       as idle)
+*
+*   INPUTS
+*
+*       number                              Testcase number
+*       num_cycles                          Cycles to run for
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Testcase set up
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+static int  replay_cpu_testcase(int number, int num_cycles)
+{
+    int         index, sample, status;
+    char        name[REPLAY_NAME_LEN];
+    REPLAY_VM * vm;
+
+
+    /* Allocate the host with a sample of every cycle (and startup) */
+    status = replay_host_init(REPLAY_TC_CPU_PCPUS, REPLAY_TC_CPU_VMS, num_cycles + 1);
+    snprintf(replay_host.name, sizeof(replay_host.name), "cpu%d", number);
+    replay_host.num_cycles = num_cycles;
+    replay_host.host_used = REPLAY_HOST_MEM_USED;
+    replay_host.host_mem = REPLAY_HOST_MEM_USED + (REPLAY_TC_CPU_VMS * (REPLAY_VM_MEM_START + REPLAY_HOST_MEM_PER_VM));
+
+    /* Loop through each VM while no errors */
+    for (index = 0; (status == EXIT_SUCCESS) && (index < REPLAY_TC_CPU_VMS); index++)
+    {
+        /* Allocate the VM with one VCPU */
+        vm = &replay_host.vms[index];
+        snprintf(name, sizeof(name), "vm%d", index);
+        status = replay_vm_init(vm, name, 1);
+
+        /* Check if allocated */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Pin VCPU as the testcase does (testcases 4 and 5 keep the host's spread) */
+            vm->pin[0] = ((number == 1) ? 0 :
+                          (number == 2) ? ((index < (REPLAY_TC_CPU_VMS / 2)) ? 0 : REPLAY_TC_CPU_PCPUS - 1) :
+                          (number == 3) ? (index % REPLAY_TC_CPU_PCPUS) : vm->pin[0]);
+
+            /* Set memory of an idle guest */
+            vm->mem_max = REPLAY_VM_MEM_MAX;
+            vm->balloon = REPLAY_VM_MEM_START;
+
+            /* Loop through each sample */
+            for (sample = 0; sample < replay_host.num_samples; sample++)
+            {
+                /* VCPU is busy (the second half of testcase 5 is light) */
+                vm->demand[sample] = (((number == 5) && (index >= (REPLAY_TC_CPU_VMS / 2))) ? REPLAY_TC_LIGHT : REPLAY_TC_BUSY);
+                vm->used[sample] = REPLAY_VM_MEM_USED;
+            }
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_mem_testcase
+*
+*   DESCRIPTION
+*
+*       Sets up a memory testcase of ../test/memory - 4 VMs with an idle
+*       VCPU each starting from a 512MB balloon:
+*
+*           1 - the first VM consumes memory and then frees it, the
+*               others stay idle
+*           2 - all VMs consume memory and then free it
+*           3 - all VMs consume memory, then the first two free it while
+*               the others keep consuming
+*
+*   INPUTS
+*
+*       number                              Testcase number
+*       num_cycles                          Cycles to run for
+*       interval_ms                         Interval between cycles
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Testcase set up
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+static int  replay_mem_testcase(int number, int num_cycles, unsigned int interval_ms)
+{
+    int         index, status, free_cycle;
+    char        name[REPLAY_NAME_LEN];
+    REPLAY_VM * vm;
+
+
+    /* Allocate the host with a sample of every cycle (and startup) */
+    status = replay_host_init(REPLAY_TC_MEM_PCPUS, REPLAY_TC_MEM_VMS, num_cycles + 1);
+    snprintf(replay_host.name, sizeof(replay_host.name), "mem%d", number);
+    replay_host.num_cycles = num_cycles;
+    replay_host.host_used = REPLAY_HOST_MEM_USED;
+    replay_host.host_mem = REPLAY_HOST_MEM_USED + (REPLAY_TC_MEM_VMS * (REPLAY_TC_MEM_START + REPLAY_HOST_MEM_PER_VM));
+
+    /* Loop through each VM while no errors */
+    for (index = 0; (status == EXIT_SUCCESS) && (index < REPLAY_TC_MEM_VMS); index++)
+    {
+        /* Allocate the VM with one idle VCPU */
+        vm = &replay_host.vms[index];
+        snprintf(name, sizeof(name), "vm%d", index);
+        status = replay_vm_init(vm, name, 1);
+
+        /* Check if allocated */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Set balloon of the testcase */
+            vm->mem_max = REPLAY_TC_MEM_MAX;
+            vm->balloon = REPLAY_TC_MEM_START;
+
+            /* Set cycle the VM starts freeing memory (-1 = stays idle, past the end = never) */
+            free_cycle = ((number == 1) ? ((index == 0) ? (num_cycles / 2) : -1) :
+                          (number == 2) ? (num_cycles / 2) :
+                          ((index < (REPLAY_TC_MEM_VMS / 2)) ? (num_cycles / 3) : (num_cycles + 1)));
+
+            /* Set memory used each cycle */
+            replay_mem_ramp(vm, free_cycle, interval_ms);
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_mem_ramp
+*
+*   DESCRIPTION
+*
+*       Sets the memory a guest running the memory testcase uses each
+*       cycle - it consumes memory until a cycle and then frees it
+*       (within what an idle guest uses and its maximum memory)
+*
+*   INPUTS
+*
+*       vm                                  VM to set
+*       free_cycle                          Cycle the VM starts freeing
+*                                           memory (-1 = VM stays idle)
+*       interval_ms                         Interval between cycles
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void replay_mem_ramp(REPLAY_VM * vm, int free_cycle, unsigned int interval_ms)
+{
+    int                 sample;
+    unsigned long long  used = REPLAY_TC_MEM_IDLE;
+    unsigned long long  step = (REPLAY_TC_MEM_GROW * interval_ms) / INTERVAL_MSECS_PER_SEC;
+
+
+    /* Loop through each sample */
+    for (sample = 0; sample < replay_host.num_samples; sample++)
+    {
+        /* Consume memory before the free cycle and free it after (if not idle) */
+        if ((free_cycle >= 0) && (sample > 0) && (sample < free_cycle))
+        {
+            used = ((used + step) < vm->mem_max ? (used + step) : vm->mem_max);
+        }
+        else if ((free_cycle >= 0) && (sample >= free_cycle))
+        {
+            used = ((used > (REPLAY_TC_MEM_IDLE + step)) ? (used - step) : REPLAY_TC_MEM_IDLE);
+        }
+
+        /* Set memory used and an idle VCPU */
+        vm->used[sample] = used;
+        vm->demand[sample] = 0;
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_random
+*
+*   DESCRIPTION
+*
+*       Sets up a random scenario - a random number of VMs with random
+*       VCPUs, CPU demand and memory use, some starting late / stopping
+*       early and each changing its demand and memory use once at a
+*       random cycle.  The same seed always gives the same scenario.  The
+*       host has at least REPLAY_RANDOM_HOST_HEADROOM % of the balloons
+*       the VMs start with
+*
+*   INPUTS
+*
+*       seed                                Seed of the scenario
+*       num_cycles                          Cycles to run for
+*       num_pcpus                           Number of PCPUs (0 = random)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Scenario set up
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+static int  replay_random(unsigned int seed, int num_cycles, int num_pcpus)
+{
+    int                 index, vcpu, sample, num_vms, max_vcpus, step_cycle, status;
+    int                 demand[2][REPLAY_RANDOM_MAX_VCPUS];
+    unsigned int        state = seed;
+    char                name[REPLAY_NAME_LEN];
+    unsigned long long  used[2], balloons = 0, mem_max = 0;
+    REPLAY_VM *         vm;
+
+
+    /* Pick PCPUs (unless set) and VMs */
+    num_pcpus = (num_pcpus ? num_pcpus : 2 + (rand_r(&state) % (REPLAY_RANDOM_MAX_PCPUS - 1)));
+    num_vms = 1 + (rand_r(&state) % (num_pcpus * REPLAY_RANDOM_VMS_PER_PCPU));
+    max_vcpus = (num_pcpus < REPLAY_RANDOM_MAX_VCPUS ? num_pcpus : REPLAY_RANDOM_MAX_VCPUS);
+
+    /* Allocate the host with a sample of every cycle (and startup) */
+    status = replay_host_init(num_pcpus, num_vms, num_cycles + 1);
+    snprintf(replay_host.name, sizeof(replay_host.name), "seed-%u", seed);
+    replay_host.num_cycles = num_cycles;
+    replay_host.host_used = REPLAY_HOST_MEM_USED;
+
+    /* Loop through each VM while no errors */
+    for (index = 0; (status == EXIT_SUCCESS) && (index < num_vms); index++)
+    {
+        /* Allocate the VM with random VCPUs */
+        vm = &replay_host.vms[index];
+        snprintf(name, sizeof(name), "vm%d", index);
+        status = replay_vm_init(vm, name, 1 + (rand_r(&state) % max_vcpus));
+
+        /* Check if allocated */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Pick maximum memory (at least 256MB) and a balloon of at least half of it */
+            vm->mem_max = (256 + (rand_r(&state) % (REPLAY_RANDOM_MAX_MEM_MB - 255))) * 1024ULL;
+            vm->balloon = (vm->mem_max / 2) + (rand_r(&state) % ((vm->mem_max / 2) + 1));
+
+            /* Pick memory used before / after the change (20% - 100% of the maximum) */
+            used[0] = (vm->mem_max * (20 + (rand_r(&state) % 81))) / 100;
+            used[1] = (vm->mem_max * (20 + (rand_r(&state) % 81))) / 100;
+
+            /* Pick demand of each VCPU before / after the change */
+            for (vcpu = 0; vcpu < vm->num_vcpus; vcpu++)
+            {
+                demand[0][vcpu] = rand_r(&state) % 101;
+                demand[1][vcpu] = rand_r(&state) % 101;
+            }
+
+            /* Pick cycle of the change (half of the VMs never change) */
+            step_cycle = ((rand_r(&state) % 2) ? 1 + (rand_r(&state) % num_cycles) : num_cycles + 1);
+
+            /* Start one VM in five late and stop one VM in ten early (after it starts) */
+            vm->start_cycle = (((rand_r(&state) % 5) == 0) ? 1 + (rand_r(&state) % ((num_cycles / 2) + 1)) : 0);
+            vm->stop_cycle = (((rand_r(&state) % 10) == 0) ? vm->start_cycle + 1 + (rand_r(&state) % num_cycles) : 0);
+            vm->stop_cycle = (vm->stop_cycle > num_cycles ? 0 : vm->stop_cycle);
+
+            /* Loop through each sample */
+            for (sample = 0; sample < replay_host.num_samples; sample++)
+            {
+                /* Set memory used and the demand of each VCPU of this sample */
+                vm->used[sample] = used[(sample >= step_cycle)];
+                for (vcpu = 0; vcpu < vm->num_vcpus; vcpu++)
+                {
+                    vm->demand[(sample * vm->num_vcpus) + vcpu] = demand[(sample >= step_cycle)][vcpu];
+                }
+            }
+
+            /* Add up the balloons and maximum memory */
+            balloons += vm->balloon;
+            mem_max += vm->mem_max;
+        }
+    }
+
+    /* Host has room for the balloons and a random part of the rest of the maximum memory */
+    replay_host.host_mem = REPLAY_HOST_MEM_USED + ((balloons * REPLAY_RANDOM_HOST_HEADROOM) / 100) +
+                           (rand_r(&state) % ((mem_max - balloons) + 1));
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_trace_load
+*
+*   DESCRIPTION
+*
+*       Sets up a scenario from a trace recorded by the VCPU scheduler or
+*       the memory coordinator with -o.  Each domain recorded becomes a
+*       VM - it runs while it was recorded, its VCPUs want the
+*       utilization recorded each cycle (what they got, which is less
+*       than they wanted on a busy PCPU) and it uses the memory of its
+*       balloon it didn't report as unused.  Domains of a VCPU scheduler
+*       trace get idle memory and domains of a memory coordinator trace
+*       get one idle VCPU
+*
+*   INPUTS
+*
+*       path                                Trace file
+*       num_cycles                          Cycles to run for (0 = the
+*                                           cycles recorded)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Scenario set up
+*       REPLAY_TRACE_ERROR                  Trace couldn't be read
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+static int  replay_trace_load(const char * path, int num_cycles)
+{
+    int             index, status;
+    int             num_samples;
+    REPLAY_TRACE    trace;
+
+
+    /* Read the trace and find its domains, PCPUs and cycles */
+    memset(&trace, 0, sizeof(trace));
+    snprintf(replay_host.name, sizeof(replay_host.name), "%s", path);
+    status = replay_trace_read(&trace, path);
+    status = (status == EXIT_SUCCESS ? replay_trace_scan(&trace) : status);
+
+    /* Check if the trace has cycles and domains */
+    if ((status == EXIT_SUCCESS) && ((trace.num_domains == 0) || (trace.last_cycle < trace.first_cycle)))
+    {
+        /* Nothing to replay */
+        status = REPLAY_TRACE_ERROR;
+    }
+
+    /* Check if trace scanned */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Allocate the host with a sample of every cycle recorded (and startup) */
+        num_samples = (int)(trace.last_cycle - trace.first_cycle) + 2;
+        status = replay_host_init((trace.num_pcpus ? trace.num_pcpus : REPLAY_TC_CPU_PCPUS), trace.num_domains, num_samples);
+        snprintf(replay_host.name, sizeof(replay_host.name), "%s", path);
+        replay_host.num_cycles = (num_cycles ? num_cycles : num_samples - 1);
+        replay_host.interval_ms = trace.interval_ms;
+
+        /* Loop through each domain while no errors */
+        for (index = 0; (status == EXIT_SUCCESS) && (index < trace.num_domains); index++)
+        {
+            /* Allocate the VM (one VCPU if none recorded) */
+            status = replay_vm_init(&replay_host.vms[index], trace.domains[index].name,
+                                    (trace.domains[index].num_vcpus ? trace.domains[index].num_vcpus : 1));
+        }
+
+        /* Set the samples of each VM from the records */
+        status = (status == EXIT_SUCCESS ? replay_trace_fill(&trace) : status);
+    }
+
+    /* Free the trace */
+    free(trace.data);
+    free(trace.domains);
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_trace_read
+*
+*   DESCRIPTION
+*
+*       Reads a whole trace file into memory and checks its header
+*
+*   INPUTS
+*
+*       trace                               Trace to read
+*       path                                Trace file
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Trace read
+*       REPLAY_TRACE_ERROR                  File can't be read or isn't
+*                                           a trace of this host
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+static int  replay_trace_read(REPLAY_TRACE * trace, const char * path)
+{
+    int                 status = EXIT_SUCCESS;
+    long                size;
+    FILE *              file = fopen(path, "rb");
+    TRACE_FILE_HEADER * header;
+
+
+    /* Get size of the file (if opened) */
+    size = (((file != NULL) && (fseek(file, 0, SEEK_END) == 0)) ? ftell(file) : -1);
+
+    /* Ensure file has a header */
+    if (size < (long)sizeof(TRACE_FILE_HEADER))
+    {
+        /* Set trace error */
+        status = REPLAY_TRACE_ERROR;
+    }
+    /* Allocate room for the whole file */
+    else if ((trace->data = malloc(size)) == NULL)
+    {
+        /* Set error status */
+        status = REPLAY_NOMEM;
+    }
+    /* Read the whole file */
+    else if ((fseek(file, 0, SEEK_SET) != 0) || (fread(trace->data, 1, size, file) != (size_t)size))
+    {
+        /* Set trace error */
+        status = REPLAY_TRACE_ERROR;
+    }
+    else
+    {
+        /* Check the header (from a recorder of this byte order) */
+        header = (TRACE_FILE_HEADER *)trace->data;
+        status = (((header->magic == TRACE_MAGIC) && (header->version == TRACE_VERSION) &&
+                   (header->header_size >= sizeof(TRACE_FILE_HEADER)) && (header->header_size <= (uint64_t)size)) ?
+                  EXIT_SUCCESS : REPLAY_TRACE_ERROR);
+
+        /* Records end at the length in the header (the file may be longer) */
+        trace->len = ((status == EXIT_SUCCESS) && ((header->header_size + header->data_len) < (uint64_t)size) ?
+                      (size_t)(header->header_size + header->data_len) : (size_t)size);
+    }
+
+    /* Close file (if opened) */
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_trace_scan
+*
+*   DESCRIPTION
+*
+*       Walks the records of a trace to find its domains (and the cycles
+*       each was recorded in), the number of PCPUs, the cycles recorded,
+*       the interval and the host memory
+*
+*   INPUTS
+*
+*       trace                               Trace read
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Trace scanned
+*       REPLAY_TRACE_ERROR                  Malformed record
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+static int  replay_trace_scan(REPLAY_TRACE * trace)
+{
+    int                 index, status = EXIT_SUCCESS;
+    size_t              offset = ((TRACE_FILE_HEADER *)trace->data)->header_size;
+    TRACE_RECORD *      record;
+    const void *        data;
+
+
+    /* No cycles yet */
+    trace->first_cycle = (unsigned long long)-1;
+
+    /* Loop through each record up to the end (or the first end record) while no errors */
+    while ((status == EXIT_SUCCESS) && ((offset + sizeof(TRACE_RECORD)) <= trace->len) &&
+           (((TRACE_RECORD *)(trace->data + offset))->type != TRACE_REC_END))
+    {
+        /* Get record and its data */
+        record = (TRACE_RECORD *)(trace->data + offset);
+        data = trace->data + offset + sizeof(TRACE_RECORD);
+
+        /* Ensure record is aligned, fits and is as large as its type */
+        if ((record->size < sizeof(TRACE_RECORD)) || ((record->size % TRACE_ALIGN) != 0) || ((offset + record->size) > trace->len) ||
+            ((record->type == TRACE_REC_CYCLE) && (record->size < (sizeof(TRACE_RECORD) + sizeof(TRACE_CYCLE)))) ||
+            ((record->type == TRACE_REC_DOMAIN) && (record->size < (sizeof(TRACE_RECORD) + sizeof(TRACE_DOMAIN)))) ||
+            ((record->type == TRACE_REC_PCPU) && (record->size < (sizeof(TRACE_RECORD) + sizeof(TRACE_PCPU)))) ||
+            ((record->type == TRACE_REC_VCPU) && (record->size < (sizeof(TRACE_RECORD) + sizeof(TRACE_VCPU)))) ||
+            ((record->type == TRACE_REC_HOST_MEM) && (record->size < (sizeof(TRACE_RECORD) + sizeof(TRACE_HOST_MEM)))) ||
+            ((record->type == TRACE_REC_VM_MEM) && (record->size < (sizeof(TRACE_RECORD) + sizeof(TRACE_VM_MEM)))))
+        {
+            /* Set trace error */
+            status = REPLAY_TRACE_ERROR;
+        }
+        else
+        {
+            /* Record the cycles seen (startup records aren't a cycle) */
+            if ((record->cycle) && (record->cycle < trace->first_cycle))
+            {
+                trace->first_cycle = record->cycle;
+            }
+            trace->last_cycle = (record->cycle > trace->last_cycle ? record->cycle : trace->last_cycle);
+
+            /* Check which record type */
+            switch (record->type)
+            {
+                /* Cycle - keep interval of the first cycle */
+                case TRACE_REC_CYCLE:
+
+                    trace->interval_ms = (trace->interval_ms ? trace->interval_ms : ((const TRACE_CYCLE *)data)->interval_ms);
+
+                break;
+
+                /* Domain - add domain with its VCPUs / maximum memory */
+                case TRACE_REC_DOMAIN:
+
+                    index = replay_trace_domain(trace, record->id);
+                    status = (index >= 0 ? EXIT_SUCCESS : REPLAY_NOMEM);
+
+                    /* Check if domain added */
+                    if (status == EXIT_SUCCESS)
+                    {
+                        /* Save name, VCPUs and maximum memory (if recorded) */
+                        snprintf(trace->domains[index].name, sizeof(trace->domains[index].name), "%.*s",
+                                 TRACE_NAME_LEN - 1, ((const TRACE_DOMAIN *)data)->name);
+                        trace->domains[index].num_vcpus = ((((const TRACE_DOMAIN *)data)->num_vcpus > (uint32_t)trace->domains[index].num_vcpus) ?
+                                                           (int)((const TRACE_DOMAIN *)data)->num_vcpus : trace->domains[index].num_vcpus);
+                        trace->domains[index].mem_max = (((const TRACE_DOMAIN *)data)->mem_max ?
+                                                         ((const TRACE_DOMAIN *)data)->mem_max : trace->domains[index].mem_max);
+                    }
+
+                break;
+
+                /* PCPU - count PCPUs */
+                case TRACE_REC_PCPU:
+
+                    trace->num_pcpus = ((int)record->id >= trace->num_pcpus ? (int)record->id + 1 : trace->num_pcpus);
+
+                break;
+
+                /* VCPU - count VCPUs of the domain and the cycles it was recorded in */
+                case TRACE_REC_VCPU:
+
+                    index = replay_trace_domain(trace, record->id);
+                    status = (index >= 0 ? EXIT_SUCCESS : REPLAY_NOMEM);
+
+                    /* Check if domain found */
+                    if (status == EXIT_SUCCESS)
+                    {
+                        /* Count VCPUs and PCPUs recorded */
+                        trace->domains[index].num_vcpus = ((((const TRACE_VCPU *)data)->vcpu_num >= (uint32_t)trace->domains[index].num_vcpus) ?
+                                                           (int)((const TRACE_VCPU *)data)->vcpu_num + 1 : trace->domains[index].num_vcpus);
+                        trace->num_pcpus = ((((const TRACE_VCPU *)data)->pcpu >= trace->num_pcpus) ?
+                                            ((const TRACE_VCPU *)data)->pcpu + 1 : trace->num_pcpus);
+                        trace->domains[index].first = (((trace->domains[index].first == 0) || ((int)record->cycle < trace->domains[index].first)) ?
+                                                       (int)record->cycle : trace->domains[index].first);
+                        trace->domains[index].last = ((int)record->cycle > trace->domains[index].last ? (int)record->cycle : trace->domains[index].last);
+                    }
+
+                break;
+
+                /* Host memory - keep host memory of the first record */
+                case TRACE_REC_HOST_MEM:
+
+                    trace->host_free = (trace->host_total ? trace->host_free : ((const TRACE_HOST_MEM *)data)->free_mem);
+                    trace->host_total = (trace->host_total ? trace->host_total : ((const TRACE_HOST_MEM *)data)->total_mem);
+
+                break;
+
+                /* VM memory - keep the first balloon of the domain and the cycles it was recorded in */
+                case TRACE_REC_VM_MEM:
+
+                    index = replay_trace_domain(trace, record->id);
+                    status = (index >= 0 ? EXIT_SUCCESS : REPLAY_NOMEM);
+
+                    /* Check if domain found */
+                    if (status == EXIT_SUCCESS)
+                    {
+                        /* Save first balloon and cycles */
+                        trace->domains[index].balloon = (trace->domains[index].balloon ? trace->domains[index].balloon :
+                                                         ((const TRACE_VM_MEM *)data)->balloon);
+                        trace->domains[index].first = (((trace->domains[index].first == 0) || ((int)record->cycle < trace->domains[index].first)) ?
+                                                       (int)record->cycle : trace->domains[index].first);
+                        trace->domains[index].last = ((int)record->cycle > trace->domains[index].last ? (int)record->cycle : trace->domains[index].last);
+                    }
+
+                break;
+
+                /* Records of the decisions made aren't replayed */
+                default:
+                break;
+            }
+
+            /* Move to next record */
+            offset += record->size;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_trace_fill
+*
+*   DESCRIPTION
+*
+*       Walks the records of a trace again to set the samples of each VM
+*       (see replay_trace_load).  A cycle a VM wasn't recorded in uses
+*       the sample before it, a VM first recorded after the first cycle
+*       starts late and a VM last recorded before the last cycle stops
+*       early.  The host uses the memory it didn't have free at the first
+*       host record that isn't the balloon of a VM
+*
+*   INPUTS
+*
+*       trace                               Trace scanned
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Samples set
+*
+*************************************************************************/
+static int  replay_trace_fill(REPLAY_TRACE * trace)
+{
+    int                 index, vcpu, sample;
+    size_t              offset = ((TRACE_FILE_HEADER *)trace->data)->header_size;
+    unsigned long long  unused, balloons = 0;
+    TRACE_RECORD *      record;
+    const void *        data;
+    REPLAY_VM *         vm;
+
+
+    /* Loop through each VM */
+    for (index = 0; index < replay_host.num_vms; index++)
+    {
+        /* Get VM */
+        vm = &replay_host.vms[index];
+
+        /* Mark every sample as not recorded */
+        for (sample = 0; sample < (replay_host.num_samples * vm->num_vcpus); sample++)
+        {
+            vm->demand[sample] = -1;
+        }
+
+        /* Use memory recorded (or of an idle guest) */
+        vm->mem_max = (trace->domains[index].mem_max ? trace->domains[index].mem_max : REPLAY_VM_MEM_MAX);
+        vm->balloon = (trace->domains[index].balloon ? trace->domains[index].balloon : REPLAY_VM_MEM_START);
+        vm->balloon = (vm->balloon > vm->mem_max ? vm->mem_max : vm->balloon);
+
+        /* Start late / stop early if not recorded for the whole trace */
+        vm->start_cycle = ((trace->domains[index].first > (int)trace->first_cycle) ?
+                           (trace->domains[index].first - (int)trace->first_cycle + 1) : 0);
+        vm->stop_cycle = (((trace->domains[index].last) && (trace->domains[index].last < (int)trace->last_cycle)) ?
+                          (trace->domains[index].last - (int)trace->first_cycle + 2) : 0);
+
+        /* Add up the balloons of the VMs running at startup */
+        balloons += (vm->start_cycle == 0 ? vm->balloon : 0);
+    }
+
+    /* Loop through each record up to the end (the records were checked by the scan) */
+    while (((offset + sizeof(TRACE_RECORD)) <= trace->len) &&
+           (((TRACE_RECORD *)(trace->data + offset))->type != TRACE_REC_END))
+    {
+        /* Get record, its data and the sample of its cycle (cycles start at sample 1) */
+        record = (TRACE_RECORD *)(trace->data + offset);
+        data = trace->data + offset + sizeof(TRACE_RECORD);
+        sample = (record->cycle ? (int)(record->cycle - trace->first_cycle) + 1 : 0);
+
+        /* Check if VCPU record */
+        if (record->type == TRACE_REC_VCPU)
+        {
+            /* Set demand of the VCPU to the utilization recorded */
+            vm = &replay_host.vms[replay_trace_domain(trace, record->id)];
+            vcpu = (int)((const TRACE_VCPU *)data)->vcpu_num;
+            vm->demand[(sample * vm->num_vcpus) + vcpu] = ((((const TRACE_VCPU *)data)->cpu_util < 0) ? 0 :
+                                                           (((const TRACE_VCPU *)data)->cpu_util > 100) ? 100 :
+                                                           ((const TRACE_VCPU *)data)->cpu_util);
+
+            /* Start VCPU on the PCPU it was first recorded on */
+            vm->pin[vcpu] = ((sample <= (vm->start_cycle ? vm->start_cycle : 1)) ? ((const TRACE_VCPU *)data)->pcpu : vm->pin[vcpu]);
+        }
+        /* Check if VM memory record */
+        else if (record->type == TRACE_REC_VM_MEM)
+        {
+            /* Set memory used to the balloon not reported as usable (or unused) */
+            vm = &replay_host.vms[replay_trace_domain(trace, record->id)];
+            unused = (((const TRACE_VM_MEM *)data)->usable ? ((const TRACE_VM_MEM *)data)->usable : ((const TRACE_VM_MEM *)data)->unused);
+            vm->used[sample] = ((((const TRACE_VM_MEM *)data)->balloon > unused) ? (((const TRACE_VM_MEM *)data)->balloon - unused) : 0);
+            vm->used[sample] += (vm->used[sample] == 0);
+        }
+
+        /* Move to next record */
+        offset += record->size;
+    }
+
+    /* Loop through each VM */
+    for (index = 0; index < replay_host.num_vms; index++)
+    {
+        /* Get VM */
+        vm = &replay_host.vms[index];
+
+        /* Loop through each sample after startup */
+        for (sample = 1; sample < replay_host.num_samples; sample++)
+        {
+            /* Use the memory of the sample before if not recorded */
+            vm->used[sample] = (vm->used[sample] ? vm->used[sample] : vm->used[sample - 1]);
+
+            /* Loop through each VCPU */
+            for (vcpu = 0; vcpu < vm->num_vcpus; vcpu++)
+            {
+                /* Use the demand of the sample before if not recorded */
+                vm->demand[(sample * vm->num_vcpus) + vcpu] = ((vm->demand[(sample * vm->num_vcpus) + vcpu] >= 0) ?
+                                                               vm->demand[(sample * vm->num_vcpus) + vcpu] :
+                                                               vm->demand[((sample - 1) * vm->num_vcpus) + vcpu]);
+            }
+        }
+
+        /* Loop back through each sample before the first recorded */
+        for (sample = replay_host.num_samples - 2; sample >= 0; sample--)
+        {
+            /* Use the memory / demand of the sample after if not recorded */
+            vm->used[sample] = (vm->used[sample] ? vm->used[sample] : vm->used[sample + 1]);
+            for (vcpu = 0; vcpu < vm->num_vcpus; vcpu++)
+            {
+                vm->demand[(sample * vm->num_vcpus) + vcpu] = ((vm->demand[(sample * vm->num_vcpus) + vcpu] >= 0) ?
+                                                               vm->demand[(sample * vm->num_vcpus) + vcpu] :
+                                                               vm->demand[((sample + 1) * vm->num_vcpus) + vcpu]);
+            }
+        }
+
+        /* Loop through each sample */
+        for (sample = 0; sample < replay_host.num_samples; sample++)
+        {
+            /* A VM without memory records uses the memory of an idle guest */
+            vm->used[sample] = (vm->used[sample] ? vm->used[sample] : REPLAY_VM_MEM_USED);
+
+            /* A VCPU never recorded is idle */
+            for (vcpu = 0; vcpu < vm->num_vcpus; vcpu++)
+            {
+                vm->demand[(sample * vm->num_vcpus) + vcpu] = ((vm->demand[(sample * vm->num_vcpus) + vcpu] >= 0) ?
+                                                               vm->demand[(sample * vm->num_vcpus) + vcpu] : 0);
+            }
+        }
+
+        /* Keep PCPUs within the host */
+        for (vcpu = 0; vcpu < vm->num_vcpus; vcpu++)
+        {
+            vm->pin[vcpu] = (((vm->pin[vcpu] >= 0) && (vm->pin[vcpu] < replay_host.num_pcpus)) ? vm->pin[vcpu] : 0);
+        }
+    }
+
+    /* Check if host memory was recorded */
+    if (trace->host_total)
+    {
+        /* Host uses the memory that wasn't free or a balloon */
+        replay_host.host_mem = trace->host_total;
+        replay_host.host_used = ((trace->host_total > (trace->host_free + balloons)) ?
+                                 (trace->host_total - trace->host_free - balloons) : 0);
+    }
+    else
+    {
+        /* Host has room for the balloons as a testcase host does */
+        replay_host.host_used = REPLAY_HOST_MEM_USED;
+        replay_host.host_mem = REPLAY_HOST_MEM_USED + balloons + (replay_host.num_vms * REPLAY_HOST_MEM_PER_VM);
+    }
+
+    /* Return status to caller */
+    return (EXIT_SUCCESS);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_trace_domain
+*
+*   DESCRIPTION
+*
+*       Finds a domain of a trace by its hypervisor ID, adding it if not
+*       seen before
+*
+*   INPUTS
+*
+*       trace                               Trace being scanned
+*       dom_id                              Hypervisor ID of the domain
+*
+*   OUTPUTS
+*
+*       int                                 Index of the domain (-1 on
+*                                           allocation error)
+*
+*************************************************************************/
+static int  replay_trace_domain(REPLAY_TRACE * trace, unsigned int dom_id)
+{
+    int                     index;
+    REPLAY_TRACE_DOMAIN *   domains;
+
+
+    /* Loop through each domain until the ID is found */
+    for (index = 0; (index < trace->num_domains) && (trace->domains[index].dom_id != dom_id); index++);
+
+    /* Check if domain not seen before */
+    if (index == trace->num_domains)
+    {
+        /* Check if the table is full */
+        if (trace->num_domains == trace->max_domains)
+        {
+            /* Double the table */
+            domains = realloc(trace->domains, (trace->max_domains ? 2 * trace->max_domains : REPLAY_TRACE_DOMAINS) *
+                                              sizeof(REPLAY_TRACE_DOMAIN));
+            trace->max_domains = (domains != NULL ? (trace->max_domains ? 2 * trace->max_domains : REPLAY_TRACE_DOMAINS) :
+                                  trace->max_domains);
+            trace->domains = (domains != NULL ? domains : trace->domains);
+        }
+
+        /* Check if there is room */
+        if (trace->num_domains < trace->max_domains)
+        {
+            /* Add domain (named by its ID until its domain record is seen) */
+            memset(&trace->domains[index], 0, sizeof(REPLAY_TRACE_DOMAIN));
+            trace->domains[index].dom_id = dom_id;
+            snprintf(trace->domains[index].name, sizeof(trace->domains[index].name), "dom%u", dom_id);
+            trace->num_domains++;
+        }
+        else
+        {
+            /* No room */
+            index = -1;
+        }
+    }
+
+    /* Return index to caller */
+    return (index);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_run
+*
+*   DESCRIPTION
+*
+*       Runs the policies against the simulated host of a scenario, one
+*       cycle after another as the resource manager runs them.  VMs start
+*       and stop between cycles.  The spread between the most and least
+*       utilized PCPU is measured over each cycle
+*
+*   INPUTS
+*
+*       options                             Replay engine options
+*       result                              Result of the scenario
+*       out                                 Where cycles are printed
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Scenario replayed
+*       Others                              Error from a policy
+*
+*************************************************************************/
+static int  replay_run(const REPLAY_OPTIONS * options, REPLAY_RESULT * result, FILE * out)
+{
+    int             cycle, pcpu, imbalance, status = EXIT_SUCCESS;
+    double          imbalance_sum = 0;
+    virConnectPtr   conn = virConnectOpen(NULL);
+    INTERVAL        interval;
+
+
+    /* Start timing cycles on the simulated clock (at the interval recorded for a trace) */
+    interval_init(&interval, (replay_host.interval_ms ? replay_host.interval_ms : options->interval_ms), 0, 0);
+
+    /* Initialize the VCPU scheduler on the simulated host (if replayed) */
+    if (options->policies & REPLAY_POLICY_CPU)
+    {
+        status = vcpu_policy_init(conn);
+    }
+
+    /* Initialize the memory coordinator on the simulated host (if replayed) */
+    if ((status == EXIT_SUCCESS) && (options->policies & REPLAY_POLICY_MEM))
+    {
+        status = mem_policy_init(conn);
+    }
+
+    /* Add the VMs running at startup */
+    status = (status == EXIT_SUCCESS ? replay_domains_update(options, 0) : status);
+
+    /* Check if cycles are printed */
+    if ((status == EXIT_SUCCESS) && (options->verbose))
+    {
+        /* Print scenario */
+        fprintf(out, "%s: %d PCPUs, %d VMs, %d cycles of %u ms\n", replay_host.name, replay_host.num_pcpus,
+                replay_host.num_vms, replay_host.num_cycles, interval.interval_ms);
+    }
+
+    /* Loop through each cycle while no errors */
+    for (cycle = 1; (status == EXIT_SUCCESS) && (cycle <= replay_host.num_cycles); cycle++)
+    {
+        /* Start / stop VMs and count what happens this cycle from now */
+        status = replay_domains_update(options, cycle);
+        replay_cycle_start(cycle);
+
+        /* Step resizes still in progress each sub-interval, then run the host until the end of this cycle */
+        if ((status == EXIT_SUCCESS) && (options->policies & REPLAY_POLICY_MEM))
+        {
+            status = mem_policy_idle(interval_next(&interval));
+        }
+        interval_wait(&interval);
+
+        /* Measure imbalance over the cycle (the first cycle is before any rebalancing) */
+        imbalance = replay_cycle_imbalance();
+        imbalance_sum += imbalance;
+        result->imbalance_final = imbalance;
+        result->imbalance_max = (((cycle > 1) && (imbalance > result->imbalance_max)) ? imbalance : result->imbalance_max);
+
+        /* Run the policies on this cycle's stats */
+        status = (status == EXIT_SUCCESS ? replay_cycle(options, conn, interval.interval_ms) : status);
+
+        /* Check if cycles are printed */
+        if (options->verbose)
+        {
+            /* Print utilization of each PCPU, imbalance, repins / resizes made and host free memory */
+            fprintf(out, "%6d util=", cycle);
+            for (pcpu = 0; pcpu < replay_host.num_pcpus; pcpu++)
+            {
+                fprintf(out, "%s%d", (pcpu ? "," : ""), replay_pcpu_util(pcpu));
+            }
+            fprintf(out, " imbalance=%d moves=%d resizes=%d free=%lluMB\n", imbalance, replay_host.cycle_migrations,
+                    replay_host.cycle_resizes, (virNodeGetFreeMemory(conn) / 1024) / 1024);
+        }
+    }
+
+    /* De-initialize the policies replayed */
+    if (options->policies & REPLAY_POLICY_MEM)
+    {
+        mem_policy_deinit();
+    }
+    if (options->policies & REPLAY_POLICY_CPU)
+    {
+        vcpu_policy_deinit();
+    }
+    virConnectClose(conn);
+
+    /* Save results (converged if nothing changed for the last REPLAY_SETTLE_CYCLES cycles) */
+    result->num_migrations = replay_host.num_migrations;
+    result->cpu_converged = ((replay_host.last_migration <= (replay_host.num_cycles - REPLAY_SETTLE_CYCLES)) ?
+                             replay_host.last_migration : -1);
+    result->imbalance_mean = (replay_host.num_cycles ? (imbalance_sum / replay_host.num_cycles) : 0);
+    result->num_resizes = replay_host.num_resizes;
+    result->mem_converged = ((replay_host.last_resize <= (replay_host.num_cycles - REPLAY_SETTLE_CYCLES)) ?
+                             replay_host.last_resize : -1);
+    result->deficit_mbs = replay_host.deficit_kbs / 1024;
+    result->host_free_min = replay_host.host_free_min;
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_cycle
+*
+*   DESCRIPTION
+*
+*       Runs a single cycle of the policies replayed as the resource
+*       manager does - the VCPU and balloon stats of all running VMs are
+*       read with one call and shared by the VCPU scheduler and then the
+*       memory coordinator
+*
+*   INPUTS
+*
+*       options                             Replay engine options
+*       conn                                Simulated connection
+*       interval_ms                         Interval of this cycle
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Cycle successful
+*       Others                              Error during cycle
+*
+*************************************************************************/
+static int  replay_cycle(const REPLAY_OPTIONS * options, virConnectPtr conn, unsigned int interval_ms)
+{
+    int                 status = EXIT_SUCCESS;
+    int                 busy = 0;
+    POLICY_SNAPSHOT     snapshot;
+
+
+    /* Get VCPU and balloon stats for all running VMs in one call */
+    memset(&snapshot, 0, sizeof(snapshot));
+    snapshot.num_records = virConnectGetAllDomainStats(conn, VIR_DOMAIN_STATS_VCPU | VIR_DOMAIN_STATS_BALLOON,
+                                                       &snapshot.records, VIR_CONNECT_GET_ALL_DOMAINS_STATS_ACTIVE);
+    snapshot.now = interval_now();
+    snapshot.interval_ms = interval_ms;
+
+    /* Check if stats records not obtained */
+    if (snapshot.num_records < 0)
+    {
+        /* Set stats error */
+        status = REPLAY_STATS_ERROR;
+        snapshot.records = NULL;
+    }
+
+    /* Adjust VCPU pinning (if replayed) */
+    if ((status == EXIT_SUCCESS) && (options->policies & REPLAY_POLICY_CPU))
+    {
+        status = vcpu_policy_cycle(&snapshot, &busy);
+        snapshot.cpu_saturated = vcpu_policy_cpu_saturated;
+        snapshot.cpu_nodes = vcpu_policy_cpu_nodes;
+    }
+
+    /* Adjust VM memory (if replayed) using the CPU saturation found by the VCPU scheduler */
+    if ((status == EXIT_SUCCESS) && (options->policies & REPLAY_POLICY_MEM))
+    {
+        status = mem_policy_cycle(&snapshot, &busy);
+    }
+
+    /* Free the records (if any) */
+    if (snapshot.records != NULL)
+    {
+        virDomainStatsRecordListFree(snapshot.records);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_domains_update
+*
+*   DESCRIPTION
+*
+*       Stops the VMs stopping and starts the VMs starting at a cycle and
+*       hands them to the policies as domain events.  Pins made by the
+*       VCPU scheduler when it adds a VM aren't counted as migrations
+*
+*   INPUTS
+*
+*       options                             Replay engine options
+*       cycle                               Cycle starting (0 = startup)
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VMs started / stopped
+*       Other                               Error with memory allocation
+*
+*************************************************************************/
+static int  replay_domains_update(const REPLAY_OPTIONS * options, int cycle)
+{
+    int         index, status = EXIT_SUCCESS;
+    REPLAY_VM * vm;
+
+
+    /* Loop through each VM while no errors */
+    for (index = 0; (status == EXIT_SUCCESS) && (index < replay_host.num_vms); index++)
+    {
+        /* Get VM */
+        vm = &replay_host.vms[index];
+
+        /* Check if VM stops this cycle */
+        if ((vm->active) && (vm->stop_cycle) && (vm->stop_cycle == cycle))
+        {
+            /* Stop VM and remove it from the policies */
+            vm->active = 0;
+            status = replay_domain_event(options, DOMAIN_EVENT_REMOVED, vm);
+        }
+        /* Check if VM is running at startup or starts this cycle */
+        else if (((cycle == 0) && (vm->active)) || ((cycle) && (!vm->active) && (vm->start_cycle == cycle)))
+        {
+            /* Start VM and add it to the policies (placing its VCPUs isn't a migration) */
+            vm->active = 1;
+            replay_host.adding = 1;
+            status = replay_domain_event(options, DOMAIN_EVENT_ADDED, vm);
+            replay_host.adding = 0;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_domain_event
+*
+*   DESCRIPTION
+*
+*       Hands a VM start / stop to the policies replayed
+*
+*   INPUTS
+*
+*       options                             Replay engine options
+*       type                                DOMAIN_EVENT_ADDED / REMOVED
+*       domain                              VM started / stopped
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Domain event processed
+*       Other                               Error with memory allocation
+*
+*************************************************************************/
+static int  replay_domain_event(const REPLAY_OPTIONS * options, int type, virDomainPtr domain)
+{
+    int     status = EXIT_SUCCESS;
+
+
+    /* Hand the VM to the VCPU scheduler (if replayed) */
+    if (options->policies & REPLAY_POLICY_CPU)
+    {
+        status = vcpu_policy_domain_event(type, domain);
+    }
+
+    /* Hand the VM to the memory coordinator (if replayed) */
+    if ((status == EXIT_SUCCESS) && (options->policies & REPLAY_POLICY_MEM))
+    {
+        status = mem_policy_domain_event(type, domain);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_result_print
+*
+*   DESCRIPTION
+*
+*       Prints the result of a scenario as a row of the results table.
+*       A policy that didn't converge is shown as "-"
+*
+*   INPUTS
+*
+*       result                              Result of the scenario
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void replay_result_print(const REPLAY_RESULT * result)
+{
+    char    cpu_conv[16], mem_conv[16];
+
+
+    /* Check if scenario failed */
+    if (result->status != EXIT_SUCCESS)
+    {
+        /* Print error */
+        printf("%-20s error %d\n", result->name, result->status);
+    }
+    else
+    {
+        /* Format the convergence cycles */
+        snprintf(cpu_conv, sizeof(cpu_conv), (result->cpu_converged >= 0 ? "%d" : "-"), result->cpu_converged);
+        snprintf(mem_conv, sizeof(mem_conv), (result->mem_converged >= 0 ? "%d" : "-"), result->mem_converged);
+
+        /* Print row */
+        printf("%-20.20s %5d %4d %6d | %8s %5d %8.1f %5d %5d | %8s %7d %13.1f %11llu\n",
+               result->name, result->num_pcpus, result->num_vms, result->num_cycles,
+               cpu_conv, result->num_migrations, result->imbalance_mean, result->imbalance_final, result->imbalance_max,
+               mem_conv, result->num_resizes, result->deficit_mbs, result->host_free_min / 1024);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_summary
+*
+*   DESCRIPTION
+*
+*       Prints the results of all scenarios - how many converged, the
+*       mean / median / 95th percentile cycles to converge and the mean
+*       migrations, imbalance, resizes and memory deficit
+*
+*   INPUTS
+*
+*       results                             Results of the scenarios
+*       num_results                         Number of results
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void replay_summary(const REPLAY_RESULT * results, int num_results)
+{
+    int         index, num_ok = 0, num_cpu = 0, num_mem = 0;
+    int *       cpu_cycles = calloc(num_results + 1, sizeof(int));
+    int *       mem_cycles = calloc(num_results + 1, sizeof(int));
+    double      cpu_sum = 0, mem_sum = 0, migrations = 0, imbalance = 0, imbalance_final = 0;
+    double      resizes = 0, deficit = 0;
+
+
+    /* Ensure allocated */
+    if ((cpu_cycles != NULL) && (mem_cycles != NULL))
+    {
+        /* Loop through each scenario that ran */
+        for (index = 0; index < num_results; index++)
+        {
+            /* Check if scenario ran */
+            if (results[index].status == EXIT_SUCCESS)
+            {
+                /* Count scenario and add up its results */
+                num_ok++;
+                migrations += results[index].num_migrations;
+                imbalance += results[index].imbalance_mean;
+                imbalance_final += results[index].imbalance_final;
+                resizes += results[index].num_resizes;
+                deficit += results[index].deficit_mbs;
+
+                /* Keep cycles to converge of each policy (if converged) */
+                if (results[index].cpu_converged >= 0)
+                {
+                    cpu_cycles[num_cpu++] = results[index].cpu_converged;
+                    cpu_sum += results[index].cpu_converged;
+                }
+                if (results[index].mem_converged >= 0)
+                {
+                    mem_cycles[num_mem++] = results[index].mem_converged;
+                    mem_sum += results[index].mem_converged;
+                }
+            }
+        }
+
+        /* Sort cycles to converge for the percentiles */
+        qsort(cpu_cycles, num_cpu, sizeof(int), replay_int_compare);
+        qsort(mem_cycles, num_mem, sizeof(int), replay_int_compare);
+
+        /* Print summary */
+        printf("\n%d scenarios replayed, %d failed\n", num_results, num_results - num_ok);
+        printf("cpu: %d converged (%.1f%%), cycles to converge mean %.1f p50 %d p95 %d, moves mean %.1f, imbalance mean %.1f final %.1f\n",
+               num_cpu, (num_ok ? (100.0 * num_cpu) / num_ok : 0), (num_cpu ? cpu_sum / num_cpu : 0),
+               (num_cpu ? cpu_cycles[num_cpu / 2] : 0), (num_cpu ? cpu_cycles[(num_cpu * 95) / 100] : 0),
+               (num_ok ? migrations / num_ok : 0), (num_ok ? imbalance / num_ok : 0), (num_ok ? imbalance_final / num_ok : 0));
+        printf("mem: %d converged (%.1f%%), cycles to converge mean %.1f p50 %d p95 %d, resizes mean %.1f, deficit mean %.1f MB*s\n",
+               num_mem, (num_ok ? (100.0 * num_mem) / num_ok : 0), (num_mem ? mem_sum / num_mem : 0),
+               (num_mem ? mem_cycles[num_mem / 2] : 0), (num_mem ? mem_cycles[(num_mem * 95) / 100] : 0),
+               (num_ok ? resizes / num_ok : 0), (num_ok ? deficit / num_ok : 0));
+    }
+
+    /* Free cycles */
+    free(cpu_cycles);
+    free(mem_cycles);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_int_compare
+*
+*   DESCRIPTION
+*
+*       Compares two integers for qsort (ascending)
+*
+*   INPUTS
+*
+*       a                                   Pointer to first integer
+*       b                                   Pointer to second integer
+*
+*   OUTPUTS
+*
+*       <0, 0, >0                           a is less, equal or greater
+*
+*************************************************************************/
+static int  replay_int_compare(const void * a, const void * b)
+{
+    /* Return comparison */
+    return ((*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b));
+}
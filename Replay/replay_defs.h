@@ -0,0 +1,265 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains replay engine macros, definitions, and
+*       structures - the scenarios replayed, the simulated host the
+*       policies run against (through the libvirt calls of
+*       replay_virt.c) and the results reported for each scenario
+*
+***********************************************************************/
+#ifndef REPLAY_DEFS_H
+#define REPLAY_DEFS_H
+
+#include <libvirt/libvirt.h>
+#include "domain_events_defs.h"
+#include "interval_defs.h"
+#include "policy_defs.h"
+#include "trace_defs.h"
+
+/* Command-line arguments starting the options of each policy (as for the resource manager) */
+#define REPLAY_CPU_ARG                      "--cpu"
+#define REPLAY_MEM_ARG                      "--mem"
+
+/* Define policies replayed (-P) */
+#define REPLAY_POLICY_CPU                   0x01    /* VCPU scheduler */
+#define REPLAY_POLICY_MEM                   0x02    /* Memory coordinator */
+
+/* Number of cycles each synthetic scenario is run for (-n, a trace runs for as many cycles as
+   it recorded) */
+#define REPLAY_CYCLES                       60
+
+/* Number of cycles at the end of a scenario without a repin / resize for it to count as
+   converged */
+#define REPLAY_SETTLE_CYCLES                10
+
+/* Simulated time (ns) a scenario starts at (0 is used by the policies as "never") */
+#define REPLAY_START_NS                     INTERVAL_NSECS_PER_SEC
+
+/* Define the CPU testcases of ../test/cpu (-t cpu1 - cpu5) - 8 VMs with 1 VCPU each on 4 PCPUs.
+   A VCPU running iambusy 100000 / 250000 is modelled as busy all of the time and one running
+   iambusy 30000 (the light VCPUs of testcase 5) as busy 30% of the time */
+#define REPLAY_TC_CPU_NUM                   5
+#define REPLAY_TC_CPU_PCPUS                 4
+#define REPLAY_TC_CPU_VMS                   8
+#define REPLAY_TC_BUSY                      100
+#define REPLAY_TC_LIGHT                     30
+
+/* Define the memory testcases of ../test/memory (-t mem1 - mem3) - 4 VMs with 1 idle VCPU each
+   starting from a 512MB balloon (setallmemory.py) with a 2GB maximum (setallmaxmemory.py).  A
+   guest running the testcase uses REPLAY_TC_MEM_GROW KB more (or less while freeing) each second
+   from REPLAY_TC_MEM_IDLE KB used by the idle guest, switching from consuming to freeing half way
+   through the scenario */
+#define REPLAY_TC_MEM_NUM                   3
+#define REPLAY_TC_MEM_PCPUS                 4
+#define REPLAY_TC_MEM_VMS                   4
+#define REPLAY_TC_MEM_START                 (512ULL * 1024)
+#define REPLAY_TC_MEM_MAX                   (2048ULL * 1024)
+#define REPLAY_TC_MEM_IDLE                  (192ULL * 1024)
+#define REPLAY_TC_MEM_GROW                  (48ULL * 1024)
+
+/* Memory of a VM that has no memory stats (CPU testcase or VCPU scheduler trace) in KB */
+#define REPLAY_VM_MEM_MAX                   (2048ULL * 1024)
+#define REPLAY_VM_MEM_START                 (1024ULL * 1024)
+#define REPLAY_VM_MEM_USED                  (512ULL * 1024)
+
+/* Memory of the host in KB - used by the host itself and free per VM of a testcase on top
+   of its balloon (random scenarios add a random amount to the balloons of their VMs) */
+#define REPLAY_HOST_MEM_USED                (1024ULL * 1024)
+#define REPLAY_HOST_MEM_PER_VM              (1024ULL * 1024)
+
+/* Define limits of a random scenario (-r) */
+#define REPLAY_RANDOM_MAX_PCPUS             16      /* PCPUs (unless set with -p) */
+#define REPLAY_RANDOM_VMS_PER_PCPU          3       /* Most VMs per PCPU */
+#define REPLAY_RANDOM_MAX_VCPUS             4       /* Most VCPUs per VM */
+#define REPLAY_RANDOM_MAX_MEM_MB            4096    /* Largest VM maximum memory */
+#define REPLAY_RANDOM_HOST_HEADROOM         110     /* Host memory % of the VM balloons at least */
+
+/* Default CPU shares of a VM (the hypervisor default) */
+#define REPLAY_SHARES_DEFAULT               1024
+
+/* Percent of the memory a VM is short of its used memory swapped in (and out) per second */
+#define REPLAY_SWAP_PERCENT                 10
+
+/* Size of a guest page in KB (memory brought in by a major page fault) */
+#define REPLAY_PAGE_KB                      4
+
+/* Maximum length of a scenario / VM name */
+#define REPLAY_NAME_LEN                     64
+
+/* Define types of scenario */
+#define REPLAY_SCENARIO_CPU_TC              0       /* CPU testcase (number 1 - REPLAY_TC_CPU_NUM) */
+#define REPLAY_SCENARIO_MEM_TC              1       /* Memory testcase (number 1 - REPLAY_TC_MEM_NUM) */
+#define REPLAY_SCENARIO_RANDOM              2       /* Random scenario (number = seed) */
+#define REPLAY_SCENARIO_TRACE               3       /* Recorded trace (path) */
+
+/* Number of domains the trace domain table starts with (doubled as needed) */
+#define REPLAY_TRACE_DOMAINS                16
+
+/* Define status errors */
+#define REPLAY_NOMEM                        -1
+#define REPLAY_TRACE_ERROR                  -2
+#define REPLAY_FORK_ERROR                   -3
+#define REPLAY_CRASH_ERROR                  -4
+#define REPLAY_CONN_ERROR                   -5
+#define REPLAY_STATS_ERROR                  -6
+
+/* Structure of a simulated VM (the libvirt domain handed to the policies)
+   NOTE:  Completes the libvirt virDomain type, so a virDomainPtr is a pointer to one of these */
+typedef struct _virDomain
+{
+    char                name[REPLAY_NAME_LEN];
+    unsigned int        id;             /* Hypervisor ID */
+    int                 index;          /* Index of the VM in the host */
+    int                 active;         /* Non-zero while running */
+    int                 start_cycle;    /* Cycle the VM starts at (0 = running at startup) */
+    int                 stop_cycle;     /* Cycle the VM stops at (0 = runs to the end) */
+    int                 num_vcpus;
+    int *               pin;            /* PCPU each VCPU is pinned to */
+    unsigned long long * cpu_time;      /* CPU time (ns) each VCPU has run */
+    int *               demand;         /* % of a PCPU each VCPU wants each cycle (num_vcpus per sample) */
+    unsigned long long * used;          /* Memory (KB) the guest uses each cycle (1 per sample) */
+    unsigned long long  mem_max;        /* Maximum balloon size in KB */
+    unsigned long long  balloon;        /* Balloon size in KB */
+    unsigned long long  swap_in;        /* Swapped in since boot in KB */
+    unsigned long long  swap_out;       /* Swapped out since boot in KB */
+    unsigned long long  major_faults;   /* Major page faults since boot */
+    unsigned long long  shares;         /* CPU shares set */
+    long long           quota;          /* VCPU quota set in us (<= 0 = none) */
+    unsigned long long  period;         /* VCPU quota period set in us */
+
+} REPLAY_VM;
+
+/* Structure for a VCPU sharing a PCPU while the host runs */
+typedef struct REPLAY_RUN_STRUCT
+{
+    REPLAY_VM *         vm;
+    int                 vcpu;           /* VCPU number within the VM */
+    double              want;           /* % of the PCPU the VCPU wants (capped by its quota) */
+    double              weight;         /* CPU shares of the VM */
+    double              got;            /* % of the PCPU the VCPU gets (-1 = not given yet) */
+
+} REPLAY_RUN;
+
+/* Structure of the simulated host a scenario runs on */
+typedef struct REPLAY_HOST_STRUCT
+{
+    char                name[REPLAY_NAME_LEN]; /* Scenario name */
+    int                 num_pcpus;
+    unsigned long long  host_mem;       /* Host memory in KB */
+    unsigned long long  host_used;      /* Host memory in KB used by the host itself */
+    int                 num_vms;
+    REPLAY_VM *         vms;
+    int                 num_samples;    /* Samples of VCPU demand / used memory of each VM (the last repeats) */
+    int                 num_cycles;     /* Cycles the scenario runs for */
+    unsigned int        interval_ms;    /* Interval between cycles (0 = interval given) */
+    unsigned long long  now;            /* Simulated time (ns) */
+    int                 cycle;          /* Cycle running (sample used) */
+    int                 adding;         /* Non-zero while domains are being added (pins aren't migrations) */
+    unsigned long long * pcpu_idle;     /* Idle time (ns) of each PCPU */
+    unsigned long long * pcpu_used;     /* Time (ns) each PCPU ran VCPUs */
+    unsigned long long * pcpu_mark;     /* Time (ns) each PCPU ran VCPUs when this cycle started */
+    unsigned long long  cycle_start;    /* Simulated time (ns) this cycle started */
+    REPLAY_RUN *        run;            /* VCPUs sharing a PCPU (one entry per VCPU of the host) */
+    int                 num_vcpus;      /* VCPUs of all VMs */
+    int                 num_migrations; /* VCPUs moved to another PCPU (after startup) */
+    int                 cycle_migrations; /* VCPUs moved this cycle */
+    int                 last_migration; /* Last cycle a VCPU moved (0 = never) */
+    int                 num_resizes;    /* Balloon resizes made */
+    int                 cycle_resizes;  /* Balloon resizes made this cycle */
+    int                 last_resize;    /* Last cycle a balloon was resized (0 = never) */
+    double              deficit_kbs;    /* Memory VMs were short of their used memory (KB x seconds) */
+    unsigned long long  host_free_min;  /* Lowest host free memory in KB */
+    int                 error_code;     /* Error code of the last call that failed (virGetLastError) */
+    unsigned long long  num_allocs;     /* Allocations returned to the caller by libvirt calls */
+    unsigned long long  alloc_bytes;    /* Bytes of those allocations */
+
+} REPLAY_HOST;
+
+/* Structure of the results of a scenario */
+typedef struct REPLAY_RESULT_STRUCT
+{
+    char                name[REPLAY_NAME_LEN]; /* Scenario name */
+    int                 status;         /* EXIT_SUCCESS or error of the run */
+    int                 num_pcpus;
+    int                 num_vms;
+    int                 num_cycles;
+    int                 num_migrations;
+    int                 cpu_converged;  /* Last cycle a VCPU moved (-1 = not converged) */
+    double              imbalance_mean; /* Mean of the PCPU utilization spread (max - min %) of each cycle */
+    int                 imbalance_final; /* Spread of the last cycle */
+    int                 imbalance_max;  /* Largest spread after the first cycle */
+    int                 num_resizes;
+    int                 mem_converged;  /* Last cycle a balloon was resized (-1 = not converged) */
+    double              deficit_mbs;    /* Memory VMs were short of their used memory (MB x seconds) */
+    unsigned long long  host_free_min;  /* Lowest host free memory in KB */
+
+} REPLAY_RESULT;
+
+/* Structure of a scenario to replay */
+typedef struct REPLAY_SCENARIO_STRUCT
+{
+    int                 type;           /* REPLAY_SCENARIO_xxx */
+    unsigned int        number;         /* Testcase number / random seed */
+    const char *        path;           /* Trace file */
+
+} REPLAY_SCENARIO;
+
+/* Structure of the replay engine options */
+typedef struct REPLAY_OPTIONS_STRUCT
+{
+    unsigned int        interval_ms;    /* Interval between cycles */
+    int                 num_cycles;     /* Cycles to run each scenario for (0 = scenario default) */
+    int                 num_pcpus;      /* PCPUs of a random scenario (0 = random) */
+    int                 policies;       /* REPLAY_POLICY_xxx replayed */
+    int                 verbose;        /* Non-zero to print every cycle of a scenario */
+    int                 quiet;          /* Non-zero to print the summary only */
+    int                 debug;          /* Non-zero to show the output of the policies */
+    REPLAY_SCENARIO *   scenarios;      /* Testcases and traces (random scenarios are added after) */
+    int                 num_scenarios;
+
+} REPLAY_OPTIONS;
+
+/* Structure for a domain of a trace being loaded */
+typedef struct REPLAY_TRACE_DOMAIN_STRUCT
+{
+    unsigned int        dom_id;         /* Hypervisor ID of the domain */
+    char                name[REPLAY_NAME_LEN];
+    int                 num_vcpus;      /* VCPUs (highest VCPU recorded + 1 if more) */
+    unsigned long long  mem_max;        /* Maximum balloon size in KB (0 = not recorded) */
+    unsigned long long  balloon;        /* First balloon size recorded in KB */
+    int                 first;          /* First / last cycle the domain was recorded in */
+    int                 last;
+
+} REPLAY_TRACE_DOMAIN;
+
+/* Structure to keep track of a trace being loaded */
+typedef struct REPLAY_TRACE_STRUCT
+{
+    unsigned char *     data;           /* Whole file read into memory */
+    size_t              len;            /* Bytes of the header and records */
+    REPLAY_TRACE_DOMAIN * domains;      /* Domains recorded (in the order first seen) */
+    int                 num_domains;
+    int                 max_domains;    /* Number of entries allocated in domains */
+    unsigned long long  first_cycle;    /* First / last cycle recorded */
+    unsigned long long  last_cycle;
+    int                 num_pcpus;      /* Highest PCPU recorded + 1 */
+    unsigned int        interval_ms;    /* Interval of the first cycle recorded */
+    unsigned long long  host_total;     /* Host total / free memory of the first host record in KB */
+    unsigned long long  host_free;
+
+} REPLAY_TRACE;
+
+/* Simulated host the libvirt calls of replay_virt.c act on */
+extern REPLAY_HOST          replay_host;
+
+/* Simulated host functions (see replay_virt.c) */
+int     replay_host_init(int num_pcpus, int num_vms, int num_samples);
+int     replay_vm_init(REPLAY_VM * vm, const char * name, int num_vcpus);
+int     replay_host_start(void);
+void    replay_host_free(void);
+void    replay_cycle_start(int cycle);
+int     replay_pcpu_util(int pcpu);
+int     replay_cycle_imbalance(void);
+
+#endif /* REPLAY_DEFS_H */
@@ -0,0 +1,1431 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the simulated host of the replay engine and
+*       the libvirt calls the VCPU scheduler and the memory coordinator
+*       make, acting on the simulated host instead of a hypervisor.  The
+*       host only runs while a policy sleeps (see interval_defs.h) - each
+*       PCPU is shared between the VCPUs pinned to it by their CPU shares
+*       (capped by their quota) and a VM using more memory than its
+*       balloon swaps, so every pin, scheduler parameter and resize made
+*       by a policy changes the stats it reads on the next cycle.
+*
+*   FUNCTIONS
+*
+*       replay_host_init
+*       replay_vm_init
+*       replay_host_start
+*       replay_host_free
+*       replay_cycle_start
+*       replay_pcpu_util
+*       replay_cycle_imbalance
+*       replay_clock
+*       replay_sleep_until
+*       vir* (libvirt calls made by the policies)
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <libvirt/libvirt.h>
+#include <libvirt/virterror.h>
+#include "replay_defs.h"
+
+/* Structure of the simulated hypervisor connection
+   NOTE:  Completes the libvirt virConnect type */
+struct _virConnect
+{
+    int                 num_opens;      /* Times the connection was opened */
+};
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static void replay_host_run(unsigned long long elapsed);
+static void replay_pcpu_run(int pcpu, unsigned long long elapsed);
+static void replay_vm_mem_run(REPLAY_VM * vm, unsigned long long elapsed);
+static unsigned long long replay_host_free_mem(void);
+static int  replay_vm_check(virDomainPtr domain);
+static int  replay_param_add(virDomainStatsRecordPtr record, int max_params, const char * field, unsigned long long value);
+static void * replay_calloc(size_t num, size_t size);
+
+/*****************************/
+/* GLOBAL VARIABLES          */
+/*****************************/
+REPLAY_HOST                 replay_host;
+
+/*****************************/
+/* LOCAL VARIABLES           */
+/*****************************/
+static struct _virConnect   replay_conn;
+static virError             replay_error;
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_host_init
+*
+*   DESCRIPTION
+*
+*       Allocates the simulated host of a scenario.  The VMs are set up
+*       by the scenario (replay_vm_init) before the host is started
+*
+*   INPUTS
+*
+*       num_pcpus                           Number of PCPUs of the host
+*       num_vms                             Number of VMs of the scenario
+*       num_samples                         Number of VCPU demand / used
+*                                           memory samples of each VM
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Host allocated
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+int replay_host_init(int num_pcpus, int num_vms, int num_samples)
+{
+    int     index, status = EXIT_SUCCESS;
+
+
+    /* Start with an empty host at the scenario's start time */
+    memset(&replay_host, 0, sizeof(replay_host));
+    replay_host.num_pcpus = num_pcpus;
+    replay_host.num_vms = num_vms;
+    replay_host.num_samples = num_samples;
+    replay_host.now = REPLAY_START_NS;
+    replay_host.cycle_start = REPLAY_START_NS;
+
+    /* Allocate the VMs and the PCPU counters */
+    replay_host.vms = calloc(num_vms, sizeof(REPLAY_VM));
+    replay_host.pcpu_idle = calloc(num_pcpus, sizeof(unsigned long long));
+    replay_host.pcpu_used = calloc(num_pcpus, sizeof(unsigned long long));
+    replay_host.pcpu_mark = calloc(num_pcpus, sizeof(unsigned long long));
+
+    /* Ensure allocated */
+    if ((replay_host.vms == NULL) || (replay_host.pcpu_idle == NULL) ||
+        (replay_host.pcpu_used == NULL) || (replay_host.pcpu_mark == NULL))
+    {
+        /* Set error status */
+        status = REPLAY_NOMEM;
+    }
+    else
+    {
+        /* Loop through each VM */
+        for (index = 0; index < num_vms; index++)
+        {
+            /* Save index of the VM (used as its hypervisor ID and UUID) */
+            replay_host.vms[index].index = index;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_vm_init
+*
+*   DESCRIPTION
+*
+*       Allocates the VCPUs and samples of a VM of the simulated host.
+*       The VM gets the default CPU shares, no quota and its VCPUs are
+*       spread over the PCPUs (as the host spreads unpinned VCPUs)
+*
+*   INPUTS
+*
+*       vm                                  VM to set up
+*       name                                Name of the VM
+*       num_vcpus                           Number of VCPUs of the VM
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        VM allocated
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+int replay_vm_init(REPLAY_VM * vm, const char * name, int num_vcpus)
+{
+    int     vcpu, status = EXIT_SUCCESS;
+
+
+    /* Save name, hypervisor ID and number of VCPUs */
+    snprintf(vm->name, sizeof(vm->name), "%s", name);
+    vm->id = vm->index + 1;
+    vm->num_vcpus = num_vcpus;
+    vm->shares = REPLAY_SHARES_DEFAULT;
+
+    /* Allocate the VCPUs and one sample of each VCPU per cycle */
+    vm->pin = calloc(num_vcpus, sizeof(int));
+    vm->cpu_time = calloc(num_vcpus, sizeof(unsigned long long));
+    vm->demand = calloc((size_t)num_vcpus * replay_host.num_samples, sizeof(int));
+    vm->used = calloc(replay_host.num_samples, sizeof(unsigned long long));
+
+    /* Ensure allocated */
+    if ((vm->pin == NULL) || (vm->cpu_time == NULL) || (vm->demand == NULL) || (vm->used == NULL))
+    {
+        /* Set error status */
+        status = REPLAY_NOMEM;
+    }
+    else
+    {
+        /* Loop through each VCPU */
+        for (vcpu = 0; vcpu < num_vcpus; vcpu++)
+        {
+            /* Spread VCPUs over the PCPUs in VM order */
+            vm->pin[vcpu] = (replay_host.num_vcpus + vcpu) % replay_host.num_pcpus;
+        }
+
+        /* Count VCPUs of the host */
+        replay_host.num_vcpus += num_vcpus;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_host_start
+*
+*   DESCRIPTION
+*
+*       Starts the simulated host once the scenario has set up its VMs -
+*       VMs running at startup are made active
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Host started
+*       REPLAY_NOMEM                        Error with memory allocation
+*
+*************************************************************************/
+int replay_host_start(void)
+{
+    int     index, status = EXIT_SUCCESS;
+
+
+    /* Allocate room for every VCPU to share one PCPU */
+    replay_host.run = calloc(replay_host.num_vcpus + 1, sizeof(REPLAY_RUN));
+
+    /* Ensure allocated */
+    if (replay_host.run == NULL)
+    {
+        /* Set error status */
+        status = REPLAY_NOMEM;
+    }
+    else
+    {
+        /* Loop through each VM */
+        for (index = 0; index < replay_host.num_vms; index++)
+        {
+            /* VMs without a start cycle run from startup */
+            replay_host.vms[index].active = (replay_host.vms[index].start_cycle == 0);
+        }
+
+        /* Lowest free memory so far is the free memory at startup */
+        replay_host.host_free_min = replay_host_free_mem();
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_host_free
+*
+*   DESCRIPTION
+*
+*       Frees the simulated host of a scenario
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void replay_host_free(void)
+{
+    int     index;
+
+
+    /* Loop through each VM (if allocated) */
+    for (index = 0; (replay_host.vms != NULL) && (index < replay_host.num_vms); index++)
+    {
+        /* Free VCPUs and samples */
+        free(replay_host.vms[index].pin);
+        free(replay_host.vms[index].cpu_time);
+        free(replay_host.vms[index].demand);
+        free(replay_host.vms[index].used);
+    }
+
+    /* Free VMs, PCPU counters and run list */
+    free(replay_host.vms);
+    free(replay_host.pcpu_idle);
+    free(replay_host.pcpu_used);
+    free(replay_host.pcpu_mark);
+    free(replay_host.run);
+    memset(&replay_host, 0, sizeof(replay_host));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_cycle_start
+*
+*   DESCRIPTION
+*
+*       Starts a cycle of the simulated host - VMs use the samples of the
+*       cycle and PCPU utilization / repins / resizes are counted from now
+*
+*   INPUTS
+*
+*       cycle                               Cycle starting
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void replay_cycle_start(int cycle)
+{
+    int     pcpu;
+
+
+    /* Use samples of this cycle (the last sample is used once they run out) */
+    replay_host.cycle = cycle;
+
+    /* Loop through each PCPU */
+    for (pcpu = 0; pcpu < replay_host.num_pcpus; pcpu++)
+    {
+        /* Mark time run so far */
+        replay_host.pcpu_mark[pcpu] = replay_host.pcpu_used[pcpu];
+    }
+
+    /* Count from now */
+    replay_host.cycle_start = replay_host.now;
+    replay_host.cycle_migrations = 0;
+    replay_host.cycle_resizes = 0;
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_pcpu_util
+*
+*   DESCRIPTION
+*
+*       Gets the utilization of a PCPU since the cycle started
+*
+*   INPUTS
+*
+*       pcpu                                PCPU number
+*
+*   OUTPUTS
+*
+*       int                                 Utilization %
+*
+*************************************************************************/
+int replay_pcpu_util(int pcpu)
+{
+    unsigned long long  elapsed = replay_host.now - replay_host.cycle_start;
+
+
+    /* Return % of the time elapsed the PCPU ran VCPUs (0 if no time elapsed) */
+    return (elapsed ? (int)(((replay_host.pcpu_used[pcpu] - replay_host.pcpu_mark[pcpu]) * 100 + (elapsed / 2)) / elapsed) : 0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_cycle_imbalance
+*
+*   DESCRIPTION
+*
+*       Gets the imbalance of the PCPUs since the cycle started - the
+*       spread between the most and least utilized PCPU
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       int                                 Spread (max - min %)
+*
+*************************************************************************/
+int replay_cycle_imbalance(void)
+{
+    int     pcpu, util, util_min = 100, util_max = 0;
+
+
+    /* Loop through each PCPU */
+    for (pcpu = 0; pcpu < replay_host.num_pcpus; pcpu++)
+    {
+        /* Get utilization and keep lowest / highest */
+        util = replay_pcpu_util(pcpu);
+        util_min = (util < util_min ? util : util_min);
+        util_max = (util > util_max ? util : util_max);
+    }
+
+    /* Return spread to caller (0 with no PCPUs) */
+    return ((util_max > util_min) ? (util_max - util_min) : 0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_clock
+*
+*   DESCRIPTION
+*
+*       Gets the simulated time (the clock read by interval_now)
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Simulated time in nanoseconds
+*
+*************************************************************************/
+unsigned long long replay_clock(void)
+{
+    /* Return simulated time */
+    return (replay_host.now);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_sleep_until
+*
+*   DESCRIPTION
+*
+*       Runs the simulated host until a time (called in place of a sleep
+*       by interval_sleep_until) - this is the only place simulated time
+*       moves
+*
+*   INPUTS
+*
+*       when                                Simulated time (ns) to run to
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+void replay_sleep_until(unsigned long long when)
+{
+    /* Check if the time is still to come */
+    if (when > replay_host.now)
+    {
+        /* Run the host for the time elapsed */
+        replay_host_run(when - replay_host.now);
+        replay_host.now = when;
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_host_run
+*
+*   DESCRIPTION
+*
+*       Runs the simulated host for a time - every PCPU runs the VCPUs
+*       pinned to it and every running VM uses the memory of its sample
+*
+*   INPUTS
+*
+*       elapsed                             Time (ns) to run for
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void replay_host_run(unsigned long long elapsed)
+{
+    int                 index;
+    unsigned long long  free_mem;
+
+
+    /* Loop through each PCPU */
+    for (index = 0; index < replay_host.num_pcpus; index++)
+    {
+        /* Run the VCPUs pinned to it */
+        replay_pcpu_run(index, elapsed);
+    }
+
+    /* Loop through each VM */
+    for (index = 0; index < replay_host.num_vms; index++)
+    {
+        /* Check if VM is running */
+        if (replay_host.vms[index].active)
+        {
+            /* Use the VM's memory */
+            replay_vm_mem_run(&replay_host.vms[index], elapsed);
+        }
+    }
+
+    /* Keep lowest free memory of the host */
+    free_mem = replay_host_free_mem();
+    replay_host.host_free_min = (free_mem < replay_host.host_free_min ? free_mem : replay_host.host_free_min);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_pcpu_run
+*
+*   DESCRIPTION
+*
+*       Runs the VCPUs pinned to a PCPU for a time.  The PCPU is shared
+*       by the CPU shares of the VCPUs (max-min fair) - a VCPU wanting
+*       less than its share gets what it wants and the rest is shared by
+*       the others.  A VM's quota caps what each of its VCPUs wants
+*
+*   INPUTS
+*
+*       pcpu                                PCPU number
+*       elapsed                             Time (ns) to run for
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void replay_pcpu_run(int pcpu, unsigned long long elapsed)
+{
+    int             index, vcpu, num_run = 0, num_given;
+    int             sample = (replay_host.cycle < replay_host.num_samples ? replay_host.cycle : replay_host.num_samples - 1);
+    double          left = 100.0, used, weight, share;
+    REPLAY_VM *     vm;
+    REPLAY_RUN *    run = replay_host.run;
+
+
+    /* Loop through each VM */
+    for (index = 0; index < replay_host.num_vms; index++)
+    {
+        /* Get VM */
+        vm = &replay_host.vms[index];
+
+        /* Loop through each VCPU of the VM (if running) pinned to this PCPU */
+        for (vcpu = 0; (vm->active) && (vcpu < vm->num_vcpus); vcpu++)
+        {
+            /* Check if VCPU is pinned to this PCPU */
+            if (vm->pin[vcpu] == pcpu)
+            {
+                /* Add VCPU with what it wants this cycle, capped by the VM's quota */
+                run[num_run].vm = vm;
+                run[num_run].vcpu = vcpu;
+                run[num_run].want = vm->demand[(sample * vm->num_vcpus) + vcpu];
+                run[num_run].want = (((vm->quota > 0) && (vm->period) && ((100.0 * vm->quota / vm->period) < run[num_run].want)) ?
+                                     (100.0 * vm->quota / vm->period) : run[num_run].want);
+                run[num_run].weight = (double)vm->shares;
+                run[num_run].got = -1;
+                num_run++;
+            }
+        }
+    }
+
+    /* Give VCPUs wanting less than their share what they want until none is left (each pass either
+       gives at least one VCPU what it wants or ends) */
+    do
+    {
+        /* Add up the weight of the VCPUs not given their time yet */
+        for (index = 0, weight = 0; index < num_run; index++)
+        {
+            weight += (run[index].got < 0 ? run[index].weight : 0);
+        }
+
+        /* Loop through each VCPU not given its time yet */
+        for (index = 0, num_given = 0, used = 0; index < num_run; index++)
+        {
+            /* Check if VCPU wants no more than its share of what is left */
+            if ((run[index].got < 0) && (weight > 0) && (run[index].want <= (left * run[index].weight / weight)))
+            {
+                /* Give VCPU what it wants */
+                run[index].got = run[index].want;
+                used += run[index].want;
+                num_given++;
+            }
+        }
+
+        /* Take the time given from what is left */
+        left -= used;
+
+    } while (num_given);
+
+    /* Loop through each VCPU */
+    for (index = 0, used = 0; index < num_run; index++)
+    {
+        /* Give a VCPU wanting more than its share just its share */
+        share = ((run[index].got < 0) ? (left * run[index].weight / weight) : run[index].got);
+
+        /* Run the VCPU for its part of the time */
+        run[index].vm->cpu_time[run[index].vcpu] += (unsigned long long)((share * elapsed) / 100);
+        used += share;
+    }
+
+    /* Count time the PCPU ran VCPUs and was idle */
+    used = (used > 100.0 ? 100.0 : used);
+    replay_host.pcpu_used[pcpu] += (unsigned long long)((used * elapsed) / 100);
+    replay_host.pcpu_idle[pcpu] += elapsed - (unsigned long long)((used * elapsed) / 100);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_vm_mem_run
+*
+*   DESCRIPTION
+*
+*       Uses the memory of a VM for a time.  A VM using more memory than
+*       its balloon keeps swapping part of what it is short of in and out
+*       (each page swapped in is a major fault)
+*
+*   INPUTS
+*
+*       vm                                  VM running
+*       elapsed                             Time (ns) to run for
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void replay_vm_mem_run(REPLAY_VM * vm, unsigned long long elapsed)
+{
+    int                 sample = (replay_host.cycle < replay_host.num_samples ? replay_host.cycle : replay_host.num_samples - 1);
+    unsigned long long  short_mem, swapped;
+    double              seconds = (double)elapsed / INTERVAL_NSECS_PER_SEC;
+
+
+    /* Check if VM uses more memory than its balloon */
+    if (vm->used[sample] > vm->balloon)
+    {
+        /* Count memory the VM is short of over the time */
+        short_mem = vm->used[sample] - vm->balloon;
+        replay_host.deficit_kbs += (short_mem * seconds);
+
+        /* Swap part of it in and out */
+        swapped = (unsigned long long)((short_mem * REPLAY_SWAP_PERCENT * seconds) / 100);
+        vm->swap_in += swapped;
+        vm->swap_out += swapped;
+        vm->major_faults += (swapped / REPLAY_PAGE_KB);
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_host_free_mem
+*
+*   DESCRIPTION
+*
+*       Gets the free memory of the simulated host - memory not used by
+*       the host itself or the balloon of a running VM
+*
+*   INPUTS
+*
+*       None
+*
+*   OUTPUTS
+*
+*       unsigned long long                  Free memory in KB
+*
+*************************************************************************/
+static unsigned long long replay_host_free_mem(void)
+{
+    int                 index;
+    unsigned long long  used = replay_host.host_used;
+
+
+    /* Loop through each VM */
+    for (index = 0; index < replay_host.num_vms; index++)
+    {
+        /* Add balloon of the VM (if running) */
+        used += (replay_host.vms[index].active ? replay_host.vms[index].balloon : 0);
+    }
+
+    /* Return memory left (none if overcommitted) */
+    return ((replay_host.host_mem > used) ? (replay_host.host_mem - used) : 0);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_vm_check
+*
+*   DESCRIPTION
+*
+*       Checks a domain passed to a libvirt call is running - the error
+*       of the call is set as libvirt would
+*
+*   INPUTS
+*
+*       domain                              Domain to check
+*
+*   OUTPUTS
+*
+*       1                                   Domain is running
+*       0                                   Domain isn't running
+*
+*************************************************************************/
+static int  replay_vm_check(virDomainPtr domain)
+{
+    /* Set error of the call (no error if running) */
+    replay_host.error_code = (((domain != NULL) && (domain->active)) ? VIR_ERR_OK : VIR_ERR_OPERATION_INVALID);
+
+    /* Return if running to caller */
+    return (replay_host.error_code == VIR_ERR_OK);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_param_add
+*
+*   DESCRIPTION
+*
+*       Adds a value to the parameters of a stats record
+*
+*   INPUTS
+*
+*       record                              Stats record
+*       max_params                          Parameters allocated
+*       field                               Name of the value
+*       value                               Value
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Value added
+*       EXIT_FAILURE                        No room for the value
+*
+*************************************************************************/
+static int  replay_param_add(virDomainStatsRecordPtr record, int max_params, const char * field, unsigned long long value)
+{
+    int     status = EXIT_FAILURE;
+
+
+    /* Check if there is room */
+    if (record->nparams < max_params)
+    {
+        /* Add value (field names are NUL terminated) */
+        snprintf(record->params[record->nparams].field, VIR_TYPED_PARAM_FIELD_LENGTH, "%s", field);
+        record->params[record->nparams].type = VIR_TYPED_PARAM_ULLONG;
+        record->params[record->nparams].value.ul = value;
+        record->nparams++;
+        status = EXIT_SUCCESS;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       replay_calloc
+*
+*   DESCRIPTION
+*
+*       Allocates memory returned to the caller of a libvirt call (freed
+*       by the caller), counting it so a benchmark (../Bench) can tell
+*       allocations made by the policies from those of the hypervisor
+*
+*   INPUTS
+*
+*       num                                 Number of elements
+*       size                                Size of an element
+*
+*   OUTPUTS
+*
+*       void *                              Memory allocated (zeroed,
+*                                           NULL on error)
+*
+*************************************************************************/
+static void * replay_calloc(size_t num, size_t size)
+{
+    /* Count allocation and its bytes */
+    replay_host.num_allocs++;
+    replay_host.alloc_bytes += (num * size);
+
+    /* Return memory allocated to caller */
+    return (calloc(num, size));
+}
+
+
+/*****************************/
+/* LIBVIRT CALLS             */
+/*****************************/
+
+/* Connection - there is one simulated host, so every connection is the same */
+virConnectPtr virConnectOpen(const char * name)
+{
+    /* Count opens and return the simulated connection */
+    replay_conn.num_opens++;
+    return (&replay_conn);
+}
+
+int virConnectClose(virConnectPtr conn)
+{
+    /* Count close and return references left */
+    replay_conn.num_opens--;
+    return (replay_conn.num_opens > 0 ? replay_conn.num_opens : 0);
+}
+
+virErrorPtr virGetLastError(void)
+{
+    /* Return error of the last call that failed */
+    replay_error.code = replay_host.error_code;
+    return (&replay_error);
+}
+
+char * virConnectGetCapabilities(virConnectPtr conn)
+{
+    /* No topology is reported (the VCPU scheduler treats every PCPU as its own core) */
+    replay_host.error_code = VIR_ERR_NO_SUPPORT;
+    return (NULL);
+}
+
+/* Host CPUs */
+int virNodeGetCPUMap(virConnectPtr conn, unsigned char ** cpumap, unsigned int * online, unsigned int flags)
+{
+    /* Check if map wanted */
+    if (cpumap != NULL)
+    {
+        /* Return map of all PCPUs online */
+        *cpumap = replay_calloc(1, VIR_CPU_MAPLEN(replay_host.num_pcpus));
+
+        /* Check if allocated */
+        if (*cpumap != NULL)
+        {
+            memset(*cpumap, 0xff, VIR_CPU_MAPLEN(replay_host.num_pcpus));
+        }
+    }
+
+    /* Check if number online wanted */
+    if (online != NULL)
+    {
+        /* All PCPUs are online */
+        *online = replay_host.num_pcpus;
+    }
+
+    /* Return number of PCPUs */
+    return (replay_host.num_pcpus);
+}
+
+int virNodeGetCPUStats(virConnectPtr conn, int cpuNum, virNodeCPUStatsPtr params, int * nparams, unsigned int flags)
+{
+    int     status = 0;
+
+
+    /* Check if only the number of stats is wanted */
+    if (params == NULL)
+    {
+        /* Return number of stats */
+        *nparams = 2;
+    }
+    /* Check if PCPU and room for the stats are valid */
+    else if ((cpuNum < 0) || (cpuNum >= replay_host.num_pcpus) || (*nparams < 2))
+    {
+        /* Set error */
+        replay_host.error_code = VIR_ERR_OPERATION_INVALID;
+        status = -1;
+    }
+    else
+    {
+        /* Return time the PCPU ran VCPUs and was idle */
+        snprintf(params[0].field, VIR_NODE_CPU_STATS_FIELD_LENGTH, "%s", VIR_NODE_CPU_STATS_USER);
+        params[0].value = replay_host.pcpu_used[cpuNum];
+        snprintf(params[1].field, VIR_NODE_CPU_STATS_FIELD_LENGTH, "%s", VIR_NODE_CPU_STATS_IDLE);
+        params[1].value = replay_host.pcpu_idle[cpuNum];
+        *nparams = 2;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+/* Host memory */
+int virNodeGetInfo(virConnectPtr conn, virNodeInfoPtr info)
+{
+    /* Return a single socket host with one thread per core */
+    memset(info, 0, sizeof(*info));
+    snprintf(info->model, sizeof(info->model), "replay");
+    info->memory = replay_host.host_mem;
+    info->cpus = replay_host.num_pcpus;
+    info->nodes = 1;
+    info->sockets = 1;
+    info->cores = replay_host.num_pcpus;
+    info->threads = 1;
+    return (0);
+}
+
+unsigned long long virNodeGetFreeMemory(virConnectPtr conn)
+{
+    /* Return free memory in bytes */
+    return (replay_host_free_mem() * 1024);
+}
+
+int virNodeGetMemoryStats(virConnectPtr conn, int cellNum, virNodeMemoryStats * params, int * nparams, unsigned int flags)
+{
+    int     status = 0;
+
+
+    /* Check if only the number of stats is wanted */
+    if (params == NULL)
+    {
+        /* Return number of stats */
+        *nparams = 4;
+    }
+    /* Check if cell and room for the stats are valid (the host is a single cell) */
+    else if (((cellNum != VIR_NODE_MEMORY_STATS_ALL_CELLS) && (cellNum != 0)) || (*nparams != 4))
+    {
+        /* Set error */
+        replay_host.error_code = VIR_ERR_OPERATION_INVALID;
+        status = -1;
+    }
+    else
+    {
+        /* Return total and free memory in KB (the host keeps no buffers / page cache) */
+        snprintf(params[0].field, VIR_NODE_MEMORY_STATS_FIELD_LENGTH, "%s", VIR_NODE_MEMORY_STATS_TOTAL);
+        params[0].value = replay_host.host_mem;
+        snprintf(params[1].field, VIR_NODE_MEMORY_STATS_FIELD_LENGTH, "%s", VIR_NODE_MEMORY_STATS_FREE);
+        params[1].value = replay_host_free_mem();
+        snprintf(params[2].field, VIR_NODE_MEMORY_STATS_FIELD_LENGTH, "%s", VIR_NODE_MEMORY_STATS_BUFFERS);
+        params[2].value = 0;
+        snprintf(params[3].field, VIR_NODE_MEMORY_STATS_FIELD_LENGTH, "%s", VIR_NODE_MEMORY_STATS_CACHED);
+        params[3].value = 0;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+int virNodeGetCellsFreeMemory(virConnectPtr conn, unsigned long long * freeMems, int startCell, int maxCells)
+{
+    /* Return free memory in bytes of the single cell of the host */
+    if ((startCell == 0) && (maxCells > 0))
+    {
+        freeMems[0] = replay_host_free_mem() * 1024;
+    }
+
+    /* Set error and return number of cells (-1 on error) */
+    replay_host.error_code = (((startCell == 0) && (maxCells > 0)) ? VIR_ERR_OK : VIR_ERR_OPERATION_INVALID);
+    return (((startCell == 0) && (maxCells > 0)) ? 1 : -1);
+}
+
+int virNodeGetMemoryParameters(virConnectPtr conn, virTypedParameterPtr params, int * nparams, unsigned int flags)
+{
+    /* No KSM stats are reported (the simulated host shares no pages) */
+    replay_host.error_code = VIR_ERR_NO_SUPPORT;
+    return (-1);
+}
+
+/* Domains */
+int virConnectListAllDomains(virConnectPtr conn, virDomainPtr ** domains, unsigned int flags)
+{
+    int     index, num_domains = 0;
+
+
+    /* Allocate list (NULL terminated) */
+    *domains = replay_calloc(replay_host.num_vms + 1, sizeof(virDomainPtr));
+
+    /* Loop through each VM (if allocated) */
+    for (index = 0; (*domains != NULL) && (index < replay_host.num_vms); index++)
+    {
+        /* Check if VM is running */
+        if (replay_host.vms[index].active)
+        {
+            /* Add VM */
+            (*domains)[num_domains++] = &replay_host.vms[index];
+        }
+    }
+
+    /* Return number of running VMs (-1 if list not allocated) */
+    return (*domains != NULL ? num_domains : -1);
+}
+
+virDomainPtr virDomainLookupByUUID(virConnectPtr conn, const unsigned char * uuid)
+{
+    int     index;
+
+
+    /* Get VM index from the UUID (see virDomainGetUUID) */
+    memcpy(&index, uuid, sizeof(index));
+
+    /* Return VM if valid */
+    return (((index >= 0) && (index < replay_host.num_vms)) ? &replay_host.vms[index] : NULL);
+}
+
+int virDomainRef(virDomainPtr domain)
+{
+    /* VMs live as long as the scenario (no reference count) */
+    return (0);
+}
+
+int virDomainFree(virDomainPtr domain)
+{
+    /* VMs live as long as the scenario (no reference count) */
+    return (0);
+}
+
+int virDomainIsActive(virDomainPtr domain)
+{
+    /* Return if VM is running */
+    return (domain->active ? 1 : 0);
+}
+
+const char * virDomainGetName(virDomainPtr domain)
+{
+    /* Return name */
+    return (domain->name);
+}
+
+unsigned int virDomainGetID(virDomainPtr domain)
+{
+    /* Return hypervisor ID */
+    return (domain->id);
+}
+
+int virDomainGetUUID(virDomainPtr domain, unsigned char * uuid)
+{
+    /* UUID is the VM index */
+    memset(uuid, 0, VIR_UUID_BUFLEN);
+    memcpy(uuid, &domain->index, sizeof(domain->index));
+    return (0);
+}
+
+char * virDomainGetXMLDesc(virDomainPtr domain, unsigned int flags)
+{
+    /* No domain XML is reported (the Memory Coordinator treats every VM as backed by small pages) */
+    replay_host.error_code = VIR_ERR_NO_SUPPORT;
+    return (NULL);
+}
+
+/* VCPUs */
+int virDomainGetVcpusFlags(virDomainPtr domain, unsigned int flags)
+{
+    /* Return number of VCPUs (if running) */
+    return (replay_vm_check(domain) ? domain->num_vcpus : -1);
+}
+
+int virDomainGetVcpus(virDomainPtr domain, virVcpuInfoPtr info, int maxinfo, unsigned char * cpumaps, int maplen)
+{
+    int     vcpu, num_info = -1;
+
+
+    /* Ensure VM is running */
+    if (replay_vm_check(domain))
+    {
+        /* Loop through each VCPU that fits */
+        for (vcpu = 0, num_info = 0; (vcpu < domain->num_vcpus) && (vcpu < maxinfo); vcpu++, num_info++)
+        {
+            /* Return CPU time and PCPU of the VCPU */
+            info[vcpu].number = vcpu;
+            info[vcpu].state = VIR_VCPU_RUNNING;
+            info[vcpu].cpuTime = domain->cpu_time[vcpu];
+            info[vcpu].cpu = domain->pin[vcpu];
+
+            /* Check if pinning wanted */
+            if (cpumaps != NULL)
+            {
+                /* Return map of the PCPU the VCPU is pinned to */
+                memset(VIR_GET_CPUMAP(cpumaps, maplen, vcpu), 0, maplen);
+                VIR_USE_CPU(VIR_GET_CPUMAP(cpumaps, maplen, vcpu), domain->pin[vcpu]);
+            }
+        }
+    }
+
+    /* Return number of VCPUs returned (-1 if not running) */
+    return (num_info);
+}
+
+int virDomainPinVcpu(virDomainPtr domain, unsigned int vcpu, unsigned char * cpumap, int maplen)
+{
+    int     pcpu, status = -1;
+
+
+    /* Ensure VM is running and VCPU is valid */
+    if ((replay_vm_check(domain)) && (vcpu < (unsigned int)domain->num_vcpus))
+    {
+        /* Loop through each PCPU of the map until the first one set */
+        for (pcpu = 0; (pcpu < (maplen * 8)) && (pcpu < replay_host.num_pcpus) && (status < 0); pcpu++)
+        {
+            /* Check if PCPU set */
+            if (VIR_CPU_USED(cpumap, pcpu))
+            {
+                /* Check if VCPU moves (a VCPU placed when its VM is added hasn't moved) */
+                if ((domain->pin[vcpu] != pcpu) && (!replay_host.adding))
+                {
+                    /* Count migration */
+                    replay_host.num_migrations++;
+                    replay_host.cycle_migrations++;
+                    replay_host.last_migration = replay_host.cycle;
+                }
+
+                /* Pin VCPU */
+                domain->pin[vcpu] = pcpu;
+                status = 0;
+            }
+        }
+
+        /* Set error if no PCPU set */
+        replay_host.error_code = (status == 0 ? VIR_ERR_OK : VIR_ERR_OPERATION_INVALID);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+int virDomainSetSchedulerParametersFlags(virDomainPtr domain, virTypedParameterPtr params, int nparams, unsigned int flags)
+{
+    int     index, status = -1;
+
+
+    /* Ensure VM is running */
+    if (replay_vm_check(domain))
+    {
+        /* Loop through each parameter */
+        for (index = 0; index < nparams; index++)
+        {
+            /* Save shares / period / quota */
+            if (strcmp(params[index].field, VIR_DOMAIN_SCHEDULER_CPU_SHARES) == 0)
+            {
+                domain->shares = params[index].value.ul;
+            }
+            else if (strcmp(params[index].field, VIR_DOMAIN_SCHEDULER_VCPU_PERIOD) == 0)
+            {
+                domain->period = params[index].value.ul;
+            }
+            else if (strcmp(params[index].field, VIR_DOMAIN_SCHEDULER_VCPU_QUOTA) == 0)
+            {
+                domain->quota = params[index].value.l;
+            }
+        }
+
+        /* Set */
+        status = 0;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+/* Memory */
+int virDomainSetNumaParameters(virDomainPtr domain, virTypedParameterPtr params, int nparams, unsigned int flags)
+{
+    /* The host is a single NUMA node */
+    replay_host.error_code = VIR_ERR_NO_SUPPORT;
+    return (-1);
+}
+
+unsigned long virDomainGetMaxMemory(virDomainPtr domain)
+{
+    /* Return maximum balloon size in KB (0 if not running) */
+    return (replay_vm_check(domain) ? domain->mem_max : 0);
+}
+
+int virDomainSetMemory(virDomainPtr domain, unsigned long memory)
+{
+    int     status = -1;
+
+
+    /* Ensure VM is running and size fits */
+    if ((replay_vm_check(domain)) && (memory <= domain->mem_max))
+    {
+        /* Check if balloon changes */
+        if (memory != domain->balloon)
+        {
+            /* Count resize */
+            replay_host.num_resizes++;
+            replay_host.cycle_resizes++;
+            replay_host.last_resize = replay_host.cycle;
+        }
+
+        /* Resize balloon */
+        domain->balloon = memory;
+        status = 0;
+    }
+    else
+    {
+        /* Set error */
+        replay_host.error_code = VIR_ERR_OPERATION_INVALID;
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+int virDomainSetMemoryStatsPeriod(virDomainPtr domain, int period, unsigned int flags)
+{
+    /* Stats are always up to date */
+    return (replay_vm_check(domain) ? 0 : -1);
+}
+
+int virDomainMemoryStats(virDomainPtr domain, virDomainMemoryStatPtr stats, unsigned int nr_stats, unsigned int flags)
+{
+    int                 num_stats = -1;
+    int                 sample = (replay_host.cycle < replay_host.num_samples ? replay_host.cycle : replay_host.num_samples - 1);
+    unsigned long long  unused;
+    virDomainMemoryStatStruct all[7];
+
+
+    /* Ensure VM is running */
+    if (replay_vm_check(domain))
+    {
+        /* Memory not used by the guest */
+        unused = (domain->balloon > domain->used[sample] ? domain->balloon - domain->used[sample] : 0);
+
+        /* Set all stats reported */
+        all[0].tag = VIR_DOMAIN_MEMORY_STAT_ACTUAL_BALLOON;
+        all[0].val = domain->balloon;
+        all[1].tag = VIR_DOMAIN_MEMORY_STAT_UNUSED;
+        all[1].val = unused;
+        all[2].tag = VIR_DOMAIN_MEMORY_STAT_USABLE;
+        all[2].val = unused;
+        all[3].tag = VIR_DOMAIN_MEMORY_STAT_AVAILABLE;
+        all[3].val = domain->balloon;
+        all[4].tag = VIR_DOMAIN_MEMORY_STAT_SWAP_IN;
+        all[4].val = domain->swap_in;
+        all[5].tag = VIR_DOMAIN_MEMORY_STAT_SWAP_OUT;
+        all[5].val = domain->swap_out;
+        all[6].tag = VIR_DOMAIN_MEMORY_STAT_MAJOR_FAULT;
+        all[6].val = domain->major_faults;
+
+        /* Return as many as fit */
+        num_stats = (nr_stats < 7 ? (int)nr_stats : 7);
+        memcpy(stats, all, num_stats * sizeof(all[0]));
+    }
+
+    /* Return number of stats (-1 if not running) */
+    return (num_stats);
+}
+
+/* Bulk stats */
+int virConnectGetAllDomainStats(virConnectPtr conn, unsigned int stats, virDomainStatsRecordPtr ** retStats, unsigned int flags)
+{
+    int                     index, vcpu, max_params, num_records = 0, status = EXIT_SUCCESS;
+    int                     sample = (replay_host.cycle < replay_host.num_samples ? replay_host.cycle : replay_host.num_samples - 1);
+    char                    field[VIR_TYPED_PARAM_FIELD_LENGTH];
+    unsigned long long      unused;
+    REPLAY_VM *             vm;
+    virDomainStatsRecordPtr record;
+
+
+    /* Allocate list (NULL terminated) */
+    *retStats = replay_calloc(replay_host.num_vms + 1, sizeof(virDomainStatsRecordPtr));
+    status = (*retStats != NULL ? EXIT_SUCCESS : REPLAY_NOMEM);
+
+    /* Loop through each VM while no errors */
+    for (index = 0; (status == EXIT_SUCCESS) && (index < replay_host.num_vms); index++)
+    {
+        /* Get VM */
+        vm = &replay_host.vms[index];
+
+        /* Check if VM is running */
+        if (vm->active)
+        {
+            /* Allocate record with room for the VCPU (2 + 2 per VCPU) and balloon stats (9) */
+            max_params = 2 + (2 * vm->num_vcpus) + 9;
+            record = replay_calloc(1, sizeof(*record));
+            (*retStats)[num_records] = record;
+            status = (record != NULL ? EXIT_SUCCESS : REPLAY_NOMEM);
+
+            /* Check if record allocated */
+            if (status == EXIT_SUCCESS)
+            {
+                /* Allocate the parameters */
+                record->dom = vm;
+                record->params = replay_calloc(max_params, sizeof(virTypedParameter));
+                status = (record->params != NULL ? EXIT_SUCCESS : REPLAY_NOMEM);
+                num_records++;
+            }
+
+            /* Check if VCPU stats wanted */
+            if ((status == EXIT_SUCCESS) && (stats & VIR_DOMAIN_STATS_VCPU))
+            {
+                /* Add number of VCPUs */
+                replay_param_add(record, max_params, "vcpu.current", vm->num_vcpus);
+                replay_param_add(record, max_params, "vcpu.maximum", vm->num_vcpus);
+
+                /* Loop through each VCPU */
+                for (vcpu = 0; vcpu < vm->num_vcpus; vcpu++)
+                {
+                    /* Add state and CPU time of the VCPU */
+                    snprintf(field, sizeof(field), "vcpu.%d.state", vcpu);
+                    replay_param_add(record, max_params, field, VIR_VCPU_RUNNING);
+                    snprintf(field, sizeof(field), "vcpu.%d.time", vcpu);
+                    replay_param_add(record, max_params, field, vm->cpu_time[vcpu]);
+                }
+            }
+
+            /* Check if balloon stats wanted */
+            if ((status == EXIT_SUCCESS) && (stats & VIR_DOMAIN_STATS_BALLOON))
+            {
+                /* Memory not used by the guest */
+                unused = (vm->balloon > vm->used[sample] ? vm->balloon - vm->used[sample] : 0);
+
+                /* Add balloon stats */
+                replay_param_add(record, max_params, "balloon.current", vm->balloon);
+                replay_param_add(record, max_params, "balloon.maximum", vm->mem_max);
+                replay_param_add(record, max_params, "balloon.swap_in", vm->swap_in);
+                replay_param_add(record, max_params, "balloon.swap_out", vm->swap_out);
+                replay_param_add(record, max_params, "balloon.major_fault", vm->major_faults);
+                replay_param_add(record, max_params, "balloon.unused", unused);
+                replay_param_add(record, max_params, "balloon.available", vm->balloon);
+                replay_param_add(record, max_params, "balloon.usable", unused);
+                replay_param_add(record, max_params, "balloon.disk_caches", 0);
+            }
+        }
+    }
+
+    /* Check if error occurred */
+    if ((status != EXIT_SUCCESS) && (*retStats != NULL))
+    {
+        /* Free records made so far */
+        virDomainStatsRecordListFree(*retStats);
+        *retStats = NULL;
+    }
+
+    /* Set error and return number of records (-1 on error) */
+    replay_host.error_code = (status == EXIT_SUCCESS ? VIR_ERR_OK : VIR_ERR_NO_MEMORY);
+    return (status == EXIT_SUCCESS ? num_records : -1);
+}
+
+void virDomainStatsRecordListFree(virDomainStatsRecordPtr * stats)
+{
+    int     index;
+
+
+    /* Loop through each record */
+    for (index = 0; stats[index] != NULL; index++)
+    {
+        /* Free parameters and record */
+        free(stats[index]->params);
+        free(stats[index]);
+    }
+
+    /* Free list */
+    free(stats);
+}
+
+int virTypedParamsGetULLong(virTypedParameterPtr params, int nparams, const char * name, unsigned long long * value)
+{
+    int     index, found = 0;
+
+
+    /* Loop through each parameter until the name is found */
+    for (index = 0; (index < nparams) && (!found); index++)
+    {
+        /* Check if this is the parameter */
+        if (strcmp(params[index].field, name) == 0)
+        {
+            /* Return value (all stats are unsigned long long) */
+            *value = params[index].value.ul;
+            found = 1;
+        }
+    }
+
+    /* Return if found to caller */
+    return (found);
+}
+
+int virTypedParamsAddString(virTypedParameterPtr * params, int * nparams, int * maxparams, const char * name, const char * value)
+{
+    /* Typed parameters are only built to set NUMA parameters (not supported by the single node host) */
+    replay_host.error_code = VIR_ERR_NO_SUPPORT;
+    return (-1);
+}
+
+void virTypedParamsFree(virTypedParameterPtr params, int nparams)
+{
+    /* Free parameters (no string values are ever added) */
+    free(params);
+}
+
+/* Events - domains start / stop at cycle boundaries of the scenario (see replay.c), so the
+   event loop is never run */
+int virEventRegisterDefaultImpl(void)
+{
+    return (0);
+}
+
+int virEventRunDefaultImpl(void)
+{
+    return (0);
+}
+
+int virEventAddTimeout(int timeout, virEventTimeoutCallback cb, void * opaque, virFreeCallback ff)
+{
+    return (1);
+}
+
+int virEventRemoveTimeout(int timer)
+{
+    return (0);
+}
+
+int virConnectDomainEventRegisterAny(virConnectPtr conn, virDomainPtr dom, int eventID,
+                                     virConnectDomainEventGenericCallback cb, void * opaque, virFreeCallback freecb)
+{
+    return (1);
+}
+
+int virConnectDomainEventDeregisterAny(virConnectPtr conn, int callbackID)
+{
+    return (0);
+}
@@ -0,0 +1,767 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains the trace decoder that reads a binary trace
+*       recorded by the VCPU scheduler or the memory coordinator (-o)
+*       and prints one line of text per record, or a count of the
+*       records of each type.
+*
+*   FUNCTIONS
+*
+*       main
+*
+***********************************************************************/
+
+/*****************************/
+/* INCLUDE FILES             */
+/*****************************/
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "trace_decode_defs.h"
+
+/*****************************/
+/* LOCAL FUNCTION PROTOTYPES */
+/*****************************/
+static int  decode_load(TRACE_DECODE * decode, const char * path);
+static int  decode_records(TRACE_DECODE * decode);
+static void decode_record(TRACE_DECODE * decode, const TRACE_RECORD * record, const unsigned char * data);
+static void decode_mask(const TRACE_RECORD * record, const unsigned char * data);
+static int  decode_name_add(TRACE_DECODE * decode, unsigned int dom_id, const char * name);
+static const char * decode_name(TRACE_DECODE * decode, unsigned int dom_id);
+static int  decode_type_parse(const char * type);
+static void decode_summary(TRACE_DECODE * decode);
+
+/*****************************/
+/* LOCAL VARIABLES           */
+/*****************************/
+static const char *         type_names[TRACE_NUM_TYPES] = {"end", "pad", "drop", "cycle", "domain", "pcpu", "vcpu",
+                                                           "mask", "pin", "sched", "host_mem", "vm_mem", "resize"};
+static const size_t         type_sizes[TRACE_NUM_TYPES] = {0, 0, sizeof(TRACE_DROP), sizeof(TRACE_CYCLE), sizeof(TRACE_DOMAIN),
+                                                           sizeof(TRACE_PCPU), sizeof(TRACE_VCPU), sizeof(TRACE_MASK),
+                                                           sizeof(TRACE_PIN), sizeof(TRACE_SCHED), sizeof(TRACE_HOST_MEM),
+                                                           sizeof(TRACE_VM_MEM), sizeof(TRACE_RESIZE)};
+static const char *         mask_names[] = {"pcpu_high", "pcpu_low", "mem_high", "mem_low"};
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       main
+*
+*   DESCRIPTION
+*
+*       Main function for the trace decoder
+*
+*   INPUTS
+*
+*       argc                                Number of parameters
+*       argv                                Array of parameters
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Trace decoded
+*       Others                              Error reading / decoding trace
+*
+*************************************************************************/
+int main(int argc, char ** argv)
+{
+    int                 status = EXIT_FAILURE;
+    int                 option, valid = 1;
+    TRACE_DECODE        decode;
+
+
+    /* Clear decoder (all record types printed) */
+    memset(&decode, 0, sizeof(decode));
+    decode.type_filter = -1;
+
+    /* Loop through each command-line option */
+    while ((option = getopt(argc, argv, "st:")) != -1)
+    {
+        switch (option)
+        {
+            /* Summary option */
+            case 's':
+
+                /* Print record counts instead of records */
+                decode.summary = 1;
+
+            break;
+
+            /* Type option */
+            case 't':
+
+                /* Set only record type printed */
+                decode.type_filter = decode_type_parse(optarg);
+
+                /* Ensure type is known */
+                if (decode.type_filter < 0)
+                {
+                    /* Show usage */
+                    valid = 0;
+                }
+
+            break;
+
+            /* Unknown option */
+            default:
+
+                /* Show usage */
+                valid = 0;
+
+            break;
+        }
+    }
+
+    /* Ensure single argument for trace file passed in */
+    if ((!valid) || (optind != (argc - 1)))
+    {
+        /* Print error / usage */
+        fprintf(stderr, "Usage:  %s [-s] [-t <type>] <trace file>\n\r", argv[0]);
+        fprintf(stderr, "        where <trace file> = file recorded with -o by vcpu_scheduler / memory_coordinator.\n\r");
+        fprintf(stderr, "              -s        = print the number of records of each type instead of the records.\n\r");
+        fprintf(stderr, "              -t <type> = only print records of <type> (ie cycle, vcpu, pin, vm_mem, resize).\n\r");
+    }
+    else
+    {
+        /* Read the trace file */
+        status = decode_load(&decode, argv[optind]);
+
+        /* Ensure file read successfully */
+        if (status == EXIT_SUCCESS)
+        {
+            /* Decode the records */
+            status = decode_records(&decode);
+
+            /* Check if summary was requested */
+            if (decode.summary)
+            {
+                /* Print record counts (of the records decoded before any error) */
+                decode_summary(&decode);
+            }
+        }
+
+        /* Check if error returned */
+        if (status != EXIT_SUCCESS)
+        {
+            /* Print error */
+            fprintf(stderr, "Exit error code = %d\n\r", status);
+        }
+
+        /* Free the file and the domain names */
+        free(decode.data);
+        free(decode.names);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       decode_load
+*
+*   DESCRIPTION
+*
+*       Reads a whole trace file into memory and checks its header
+*
+*   INPUTS
+*
+*       decode                              Pointer to decoder
+*       path                                Path of the trace file
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        File read
+*       TRACE_DECODE_OPEN_ERROR             Error opening file
+*       TRACE_DECODE_READ_ERROR             Error reading file
+*       TRACE_DECODE_FORMAT_ERROR           File isn't a trace (printed to
+*                                           stderr)
+*       TRACE_DECODE_NOMEM                  Error with memory allocation
+*
+*************************************************************************/
+static int  decode_load(TRACE_DECODE * decode, const char * path)
+{
+    int                 status = EXIT_SUCCESS;
+    FILE *              file;
+    long                len;
+
+
+    /* Open the trace file */
+    file = fopen(path, "rb");
+
+    /* Ensure file opened and get its size */
+    if ((file == NULL) || (fseek(file, 0, SEEK_END) != 0) || ((len = ftell(file)) < 0) ||
+        (fseek(file, 0, SEEK_SET) != 0))
+    {
+        /* Set open error */
+        perror(path);
+        status = TRACE_DECODE_OPEN_ERROR;
+    }
+    /* Ensure the file holds a header */
+    else if ((size_t)len < sizeof(TRACE_FILE_HEADER))
+    {
+        /* Set format error */
+        fprintf(stderr, "%s: too short to be a trace\n\r", path);
+        status = TRACE_DECODE_FORMAT_ERROR;
+    }
+    /* Allocate memory for the whole file */
+    else if ((decode->data = malloc(len)) == NULL)
+    {
+        /* Set error status */
+        status = TRACE_DECODE_NOMEM;
+    }
+    /* Read the whole file */
+    else if (fread(decode->data, 1, len, file) != (size_t)len)
+    {
+        /* Set read error */
+        perror(path);
+        status = TRACE_DECODE_READ_ERROR;
+    }
+    else
+    {
+        /* Save length read and copy the header */
+        decode->len = len;
+        memcpy(&decode->header, decode->data, sizeof(TRACE_FILE_HEADER));
+
+        /* Check if the file was recorded on a host with the other byte order */
+        if (decode->header.magic == __builtin_bswap32(TRACE_MAGIC))
+        {
+            /* Set format error */
+            fprintf(stderr, "%s: recorded on a host of the other byte order\n\r", path);
+            status = TRACE_DECODE_FORMAT_ERROR;
+        }
+        /* Ensure the file is a trace of a version and daemon known */
+        else if ((decode->header.magic != TRACE_MAGIC) || (decode->header.version != TRACE_VERSION) ||
+                 ((decode->header.source != TRACE_SOURCE_CPU) && (decode->header.source != TRACE_SOURCE_MEM)) ||
+                 (decode->header.header_size < sizeof(TRACE_FILE_HEADER)) || (decode->header.header_size > decode->len))
+        {
+            /* Set format error */
+            fprintf(stderr, "%s: not a trace file (or version %u not supported)\n\r", path,
+                    (unsigned int)decode->header.version);
+            status = TRACE_DECODE_FORMAT_ERROR;
+        }
+    }
+
+    /* Check if file was opened */
+    if (file != NULL)
+    {
+        /* Close the file */
+        fclose(file);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       decode_records
+*
+*   DESCRIPTION
+*
+*       Decodes each record of the trace file, up to the length of the
+*       records in the header (a file that wasn't closed may have more
+*       records than the header shows - they end at the first record of
+*       type TRACE_REC_END, ie zeroed space of the file)
+*
+*   INPUTS
+*
+*       decode                              Pointer to decoder
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Records decoded
+*       TRACE_DECODE_FORMAT_ERROR           Malformed record (printed to
+*                                           stderr)
+*       TRACE_DECODE_NOMEM                  Error with memory allocation
+*
+*************************************************************************/
+static int  decode_records(TRACE_DECODE * decode)
+{
+    int                 status = EXIT_SUCCESS;
+    size_t              offset, end;
+    TRACE_RECORD        record;
+    int                 done = 0;
+
+
+    /* Get end of the records (a header updated after the file was cut short ends at the file) */
+    end = decode->header.header_size + decode->header.data_len;
+    end = ((end > decode->len) || (end < decode->header.header_size) ? decode->len : end);
+
+    /* Print file details (unless only counting) */
+    if (!decode->summary)
+    {
+        printf("# %s trace, file %u, started %llu.%09llu (monotonic %llu ns), %llu bytes of records\n",
+               (decode->header.source == TRACE_SOURCE_CPU ? "vcpu_scheduler" : "memory_coordinator"),
+               (unsigned int)decode->header.sequence,
+               (unsigned long long)(decode->header.start_real_ns / 1000000000ULL),
+               (unsigned long long)(decode->header.start_real_ns % 1000000000ULL),
+               (unsigned long long)decode->header.start_ns,
+               (unsigned long long)(end - decode->header.header_size));
+    }
+
+    /* Loop through each record */
+    for (offset = decode->header.header_size; (!done) && (status == EXIT_SUCCESS) && (offset + sizeof(TRACE_RECORD) <= end); )
+    {
+        /* Get record header */
+        memcpy(&record, decode->data + offset, sizeof(TRACE_RECORD));
+
+        /* Check if the end of the records was reached */
+        if (record.type == TRACE_REC_END)
+        {
+            /* Stop decoding */
+            done = 1;
+        }
+        /* Ensure the whole record is in the file */
+        else if ((record.size > TRACE_MAX_RECORD) || (offset + record.size > end) ||
+                 (record.size < sizeof(TRACE_RECORD) + (record.type < TRACE_NUM_TYPES ? type_sizes[record.type] : 0)))
+        {
+            /* Set format error */
+            fprintf(stderr, "malformed record (type %u, size %u) at offset %zu\n\r", (unsigned int)record.type,
+                    (unsigned int)record.size, offset);
+            status = TRACE_DECODE_FORMAT_ERROR;
+        }
+        else
+        {
+            /* Check if a domain is named (kept even if domain records aren't printed) */
+            if (record.type == TRACE_REC_DOMAIN)
+            {
+                /* Save name of the domain ID */
+                status = decode_name_add(decode, record.id, ((const TRACE_DOMAIN *)(decode->data + offset + sizeof(TRACE_RECORD)))->name);
+            }
+
+            /* Check if records lost are reported */
+            if (record.type == TRACE_REC_DROP)
+            {
+                /* Count records lost */
+                decode->num_dropped += ((const TRACE_DROP *)(decode->data + offset + sizeof(TRACE_RECORD)))->num_dropped;
+            }
+
+            /* Count record (types from a newer recorder aren't counted) */
+            decode->counts[record.type < TRACE_NUM_TYPES ? record.type : TRACE_REC_END] += (record.type < TRACE_NUM_TYPES);
+
+            /* Check if record is printed */
+            if ((!decode->summary) && ((decode->type_filter < 0) || (decode->type_filter == record.type)))
+            {
+                /* Print record */
+                decode_record(decode, &record, decode->data + offset + sizeof(TRACE_RECORD));
+            }
+
+            /* Move to next record */
+            offset += record.size;
+        }
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       decode_record
+*
+*   DESCRIPTION
+*
+*       Prints one record as a line of text - the cycle it was made in,
+*       its type, the domain (name and ID) or PCPU it is for and its
+*       fields
+*
+*   INPUTS
+*
+*       decode                              Pointer to decoder
+*       record                              Record header
+*       data                                Record data (after the header)
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void decode_record(TRACE_DECODE * decode, const TRACE_RECORD * record, const unsigned char * data)
+{
+    TRACE_CYCLE         cycle;
+    TRACE_DOMAIN        domain;
+    TRACE_PCPU          pcpu;
+    TRACE_VCPU          vcpu;
+    TRACE_PIN           pin;
+    TRACE_SCHED         sched;
+    TRACE_HOST_MEM      host;
+    TRACE_VM_MEM        vm;
+    TRACE_RESIZE        resize;
+    TRACE_DROP          drop;
+
+
+    /* Print cycle and type of the record */
+    printf("%8llu %-8s ", (unsigned long long)record->cycle,
+           (record->type < TRACE_NUM_TYPES ? type_names[record->type] : "unknown"));
+
+    /* Print fields of each type of record (the record size was checked against the size of its type) */
+    switch (record->type)
+    {
+        case TRACE_REC_DROP:
+
+            memcpy(&drop, data, sizeof(drop));
+            printf("lost=%llu\n", (unsigned long long)drop.num_dropped);
+
+        break;
+
+        case TRACE_REC_CYCLE:
+
+            memcpy(&cycle, data, sizeof(cycle));
+            /* Print time since the file started (a cycle recorded just before the file was started is negative) */
+            printf("time=%+.3fs interval=%ums\n",
+                   (double)(long long)(cycle.time_ns - decode->header.start_ns) / 1000000000.0, (unsigned int)cycle.interval_ms);
+
+        break;
+
+        case TRACE_REC_DOMAIN:
+
+            memcpy(&domain, data, sizeof(domain));
+            printf("%s(%u) vcpus=%u mem_max=%lluKB\n", decode_name(decode, record->id), (unsigned int)record->id,
+                   (unsigned int)domain.num_vcpus, (unsigned long long)domain.mem_max);
+
+        break;
+
+        case TRACE_REC_PCPU:
+
+            memcpy(&pcpu, data, sizeof(pcpu));
+            printf("pcpu=%u idle=%llu elapsed=%llu util=%d%% pinned=%d\n", (unsigned int)record->id,
+                   (unsigned long long)pcpu.idle_time, (unsigned long long)pcpu.elapsed_ns, (int)pcpu.cpu_util,
+                   (int)pcpu.num_pinned);
+
+        break;
+
+        case TRACE_REC_VCPU:
+
+            memcpy(&vcpu, data, sizeof(vcpu));
+            printf("%s(%u) vcpu=%u pcpu=%d time=%llu elapsed=%llu util=%d%% avg=%d%%\n", decode_name(decode, record->id),
+                   (unsigned int)record->id, (unsigned int)vcpu.vcpu_num, (int)vcpu.pcpu,
+                   (unsigned long long)vcpu.cpu_time, (unsigned long long)vcpu.elapsed_ns, (int)vcpu.cpu_util,
+                   (int)vcpu.cpu_util_avg);
+
+        break;
+
+        case TRACE_REC_MASK:
+
+            decode_mask(record, data);
+
+        break;
+
+        case TRACE_REC_PIN:
+
+            memcpy(&pin, data, sizeof(pin));
+            printf("%s(%u) vcpu=%u from=%d to=%d status=%d\n", decode_name(decode, record->id), (unsigned int)record->id,
+                   (unsigned int)pin.vcpu_num, (int)pin.from, (int)pin.to, (int)pin.status);
+
+        break;
+
+        case TRACE_REC_SCHED:
+
+            memcpy(&sched, data, sizeof(sched));
+            printf("%s(%u) shares=%llu quota=%lld period=%llu\n", decode_name(decode, record->id), (unsigned int)record->id,
+                   (unsigned long long)sched.shares, (long long)sched.quota, (unsigned long long)sched.period);
+
+        break;
+
+        case TRACE_REC_HOST_MEM:
+
+            memcpy(&host, data, sizeof(host));
+            printf("free=%lluKB total=%lluKB target=%lluKB\n", (unsigned long long)host.free_mem,
+                   (unsigned long long)host.total_mem, (unsigned long long)host.target_mem);
+
+        break;
+
+        case TRACE_REC_VM_MEM:
+
+            memcpy(&vm, data, sizeof(vm));
+            printf("%s(%u) balloon=%lluKB unused=%lluKB usable=%lluKB swap_in=%lluKB swap_out=%lluKB faults=%llu "
+                   "reported=0x%x avail=%d%% pressure=%d\n", decode_name(decode, record->id), (unsigned int)record->id,
+                   (unsigned long long)vm.balloon, (unsigned long long)vm.unused, (unsigned long long)vm.usable,
+                   (unsigned long long)vm.swap_in, (unsigned long long)vm.swap_out, (unsigned long long)vm.major_faults,
+                   (unsigned int)vm.reported, (int)vm.percent_avail, (int)vm.pressure);
+
+        break;
+
+        case TRACE_REC_RESIZE:
+
+            memcpy(&resize, data, sizeof(resize));
+            printf("%s(%u) from=%lluKB to=%lluKB target=%lluKB status=%d\n", decode_name(decode, record->id),
+                   (unsigned int)record->id, (unsigned long long)resize.from, (unsigned long long)resize.to,
+                   (unsigned long long)resize.target, (int)resize.status);
+
+        break;
+
+        /* Record type from a newer recorder */
+        default:
+
+            printf("type=%u id=%u size=%u\n", (unsigned int)record->type, (unsigned int)record->id,
+                   (unsigned int)record->size);
+
+        break;
+    }
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       decode_mask
+*
+*   DESCRIPTION
+*
+*       Prints the bits set in a mask record as a list (ie 0,3-5,7).
+*       The bits are PCPU numbers (CPU masks) or VM indexes in the order
+*       the VMs were added (memory masks)
+*
+*   INPUTS
+*
+*       record                              Record header
+*       data                                Record data (after the header)
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void decode_mask(const TRACE_RECORD * record, const unsigned char * data)
+{
+    TRACE_MASK          mask;
+    uint64_t            word;
+    unsigned int        bit, num_bits, first = 0;
+    int                 set, in_run = 0, num_printed = 0;
+
+
+    /* Get mask size (never past the end of the record) */
+    memcpy(&mask, data, sizeof(mask));
+    mask.num_words = (mask.num_words > (record->size - sizeof(TRACE_RECORD) - sizeof(TRACE_MASK)) / sizeof(uint64_t) ?
+                      (record->size - sizeof(TRACE_RECORD) - sizeof(TRACE_MASK)) / sizeof(uint64_t) : mask.num_words);
+    num_bits = (mask.num_bits > (mask.num_words * 64) ? (mask.num_words * 64) : mask.num_bits);
+
+    /* Print name and size of the mask */
+    printf("%s bits=%u set=", (record->id < (sizeof(mask_names) / sizeof(mask_names[0])) ? mask_names[record->id] : "unknown"),
+           (unsigned int)mask.num_bits);
+
+    /* Loop through each bit (one past the last to end a run) */
+    for (bit = 0; bit <= num_bits; bit++)
+    {
+        /* Check if this bit is set */
+        set = 0;
+
+        if (bit < num_bits)
+        {
+            memcpy(&word, data + sizeof(TRACE_MASK) + ((bit / 64) * sizeof(uint64_t)), sizeof(word));
+            set = (int)((word >> (bit % 64)) & 1);
+        }
+
+        /* Check if a run of set bits starts */
+        if ((set) && (!in_run))
+        {
+            /* Save start of the run */
+            first = bit;
+            in_run = 1;
+        }
+        /* Check if a run of set bits ended */
+        else if ((!set) && (in_run))
+        {
+            /* Print run (a single bit or first-last) */
+            printf((first == bit - 1 ? "%s%u" : "%s%u-%u"), (num_printed ? "," : ""), first, bit - 1);
+            num_printed++;
+            in_run = 0;
+        }
+    }
+
+    /* End line (- for an empty mask) */
+    printf("%s\n", (num_printed ? "" : "-"));
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       decode_name_add
+*
+*   DESCRIPTION
+*
+*       Saves the name of a domain ID from a domain record (replacing the
+*       name of an ID that was reused)
+*
+*   INPUTS
+*
+*       decode                              Pointer to decoder
+*       dom_id                              Hypervisor ID of the domain
+*       name                                Name from the domain record
+*
+*   OUTPUTS
+*
+*       EXIT_SUCCESS                        Name saved
+*       TRACE_DECODE_NOMEM                  Error with memory allocation
+*
+*************************************************************************/
+static int  decode_name_add(TRACE_DECODE * decode, unsigned int dom_id, const char * name)
+{
+    int                 index, max_names, status = EXIT_SUCCESS;
+    TRACE_DECODE_NAME * names;
+
+
+    /* Loop through each name saved until the domain ID is found */
+    for (index = 0; (index < decode->num_names) && (decode->names[index].dom_id != dom_id); index++);
+
+    /* Check if the domain ID is new and the name table is full */
+    if ((index == decode->num_names) && (decode->num_names == decode->max_names))
+    {
+        /* Grow the name table */
+        max_names = (decode->max_names ? 2 * decode->max_names : TRACE_DECODE_NAMES);
+        names = realloc(decode->names, max_names * sizeof(TRACE_DECODE_NAME));
+
+        /* Ensure memory allocated */
+        if (names != NULL)
+        {
+            /* Save new name table */
+            decode->names = names;
+            decode->max_names = max_names;
+        }
+        else
+        {
+            /* Set error status */
+            status = TRACE_DECODE_NOMEM;
+        }
+    }
+
+    /* Check if there is room for the name */
+    if (status == EXIT_SUCCESS)
+    {
+        /* Save name (names are NUL terminated by the recorder - ensured here for a damaged file) */
+        decode->names[index].dom_id = dom_id;
+        snprintf(decode->names[index].name, TRACE_NAME_LEN, "%.*s", TRACE_NAME_LEN - 1, name);
+
+        /* Count the name if it is new */
+        decode->num_names += (index == decode->num_names);
+    }
+
+    /* Return status to caller */
+    return (status);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       decode_name
+*
+*   DESCRIPTION
+*
+*       Gets the name of a domain ID
+*
+*   INPUTS
+*
+*       decode                              Pointer to decoder
+*       dom_id                              Hypervisor ID of the domain
+*
+*   OUTPUTS
+*
+*       const char *                        Name of the domain ("?" if no
+*                                           domain record named it yet)
+*
+*************************************************************************/
+static const char * decode_name(TRACE_DECODE * decode, unsigned int dom_id)
+{
+    int                 index;
+
+
+    /* Loop through each name saved until the domain ID is found */
+    for (index = 0; (index < decode->num_names) && (decode->names[index].dom_id != dom_id); index++);
+
+    /* Return name to caller */
+    return (index < decode->num_names ? decode->names[index].name : "?");
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       decode_type_parse
+*
+*   DESCRIPTION
+*
+*       Converts a record type name (ie vcpu) to its TRACE_REC_xxx value
+*
+*   INPUTS
+*
+*       type                                Record type name
+*
+*   OUTPUTS
+*
+*       >= 0                                TRACE_REC_xxx of the type
+*       -1                                  Unknown type
+*
+*************************************************************************/
+static int  decode_type_parse(const char * type)
+{
+    int                 index;
+
+
+    /* Loop through each type (end and pad records are never printed) until the name is found */
+    for (index = TRACE_REC_DROP; (index < TRACE_NUM_TYPES) && (strcmp(type, type_names[index]) != 0); index++);
+
+    /* Return type to caller */
+    return (index < TRACE_NUM_TYPES ? index : -1);
+}
+
+
+/*************************************************************************
+*
+*   FUNCTION
+*
+*       decode_summary
+*
+*   DESCRIPTION
+*
+*       Prints the number of records of each type decoded, the number of
+*       cycles they cover and the number of records the recorder lost
+*
+*   INPUTS
+*
+*       decode                              Pointer to decoder
+*
+*   OUTPUTS
+*
+*       None
+*
+*************************************************************************/
+static void decode_summary(TRACE_DECODE * decode)
+{
+    int                 index;
+
+
+    /* Print file details */
+    printf("source    %s\n", (decode->header.source == TRACE_SOURCE_CPU ? "vcpu_scheduler" : "memory_coordinator"));
+    printf("file      %u\n", (unsigned int)decode->header.sequence);
+    printf("domains   %d\n", decode->num_names);
+
+    /* Loop through each record type written to files */
+    for (index = TRACE_REC_DROP; index < TRACE_NUM_TYPES; index++)
+    {
+        /* Print records of this type */
+        printf("%-9s %llu\n", type_names[index], decode->counts[index]);
+    }
+
+    /* Print records lost */
+    printf("lost      %llu\n", decode->num_dropped);
+}
@@ -0,0 +1,47 @@
+/************************************************************************
+*
+*   DESCRIPTION
+*
+*       This file contains trace decoder macros, definitions, and
+*       structures.
+*
+***********************************************************************/
+#ifndef TRACE_DECODE_DEFS_H
+#define TRACE_DECODE_DEFS_H
+
+#include "trace_defs.h"
+
+/* Define status errors */
+#define TRACE_DECODE_OPEN_ERROR             -1
+#define TRACE_DECODE_READ_ERROR             -2
+#define TRACE_DECODE_FORMAT_ERROR           -3
+#define TRACE_DECODE_NOMEM                  -4
+
+/* Number of domain names the name table starts with (doubled as needed) */
+#define TRACE_DECODE_NAMES                  16
+
+/* Structure to name the records of a domain ID */
+typedef struct TRACE_DECODE_NAME_STRUCT
+{
+    unsigned int        dom_id;         /* Hypervisor ID of the domain */
+    char                name[TRACE_NAME_LEN]; /* Domain name from its domain record */
+
+} TRACE_DECODE_NAME;
+
+/* Structure to keep track of a trace file being decoded */
+typedef struct TRACE_DECODE_STRUCT
+{
+    unsigned char *     data;           /* Whole file read into memory */
+    size_t              len;            /* Bytes read */
+    TRACE_FILE_HEADER   header;         /* Header of the file */
+    TRACE_DECODE_NAME * names;          /* Domain names seen so far */
+    int                 num_names;
+    int                 max_names;      /* Number of entries allocated in names */
+    int                 type_filter;    /* Only record type printed (-1 = all) */
+    int                 summary;        /* Non-zero to print record counts instead of records */
+    unsigned long long  counts[TRACE_NUM_TYPES]; /* Records of each type decoded */
+    unsigned long long  num_dropped;    /* Records lost by the recorder (from drop records) */
+
+} TRACE_DECODE;
+
+#endif /* TRACE_DECODE_DEFS_H */
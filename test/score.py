@@ -0,0 +1,314 @@
+#!/usr/bin/python
+
+from __future__ import print_function
+import libvirt
+import argparse
+import json
+import math
+import os
+import socket
+import subprocess
+import time
+
+CONFIG_FILE = 'vmlist.conf'
+TEST_DIR = os.path.dirname(os.path.abspath(__file__))
+
+# Testcases - suite folder, runtest script and seconds to sample for
+TESTCASES = [
+    ('cpu1', 'cpu', 'runtest1.py', 60),
+    ('cpu2', 'cpu', 'runtest2.py', 60),
+    ('cpu3', 'cpu', 'runtest3.py', 60),
+    ('cpu4', 'cpu', 'runtest4.py', 60),
+    ('cpu5', 'cpu', 'runtest5.py', 60),
+    ('cpu6', 'cpu', 'runtest6.py', 60),
+    ('mem1', 'memory', 'runtest1.py', 120),
+    ('mem2', 'memory', 'runtest2.py', 120),
+    ('mem3', 'memory', 'runtest3.py', 120),
+]
+
+# PCPU utilization stddev (%) a host is considered balanced at
+BALANCE_STDDEV = 5.0
+
+# Thresholds of the memory coordinator (MEM_COORD_AVAIL_xxx_LOW_PERCENT)
+HOST_LOW_PERCENT = 10
+VM_LOW_PERCENT = 25
+
+# Metrics compared with a baseline - absolute slack allowed on top of the tolerance (all are
+# lower is better)
+METRICS = {
+    'time_to_balance': 2.0,
+    'stddev_mean': 1.0,
+    'stddev_final': 1.0,
+    'repins': 2,
+    'deficit_area': 64.0,
+    'resizes': 4,
+    'floor_violations': 0,
+    'floor_seconds': 1.0,
+}
+
+
+def get_pcpu(conn):
+    hostinfo = conn.getInfo()
+    return hostinfo[4] * hostinfo[5] * hostinfo[6] * hostinfo[7]
+
+def stddev(values):
+    mean = sum(values) / len(values)
+    return math.sqrt(sum((value - mean) ** 2 for value in values) / len(values))
+
+def lookup_vms(conn):
+    vmlist = open(os.path.join(TEST_DIR, CONFIG_FILE), 'r').read().strip().split()
+    vmobjlist = []
+    for vmname in vmlist:
+        vm = conn.lookupByName(vmname)
+        if vm:
+            vmobjlist.append(vm)
+        else:
+            print('Unable to locate {}.'.format(vmname))
+            exit(-1)
+    return vmlist, vmobjlist
+
+def run_script(suite, script):
+    FNULL = open(os.devnull, 'w')
+    p = subprocess.Popen('./{}'.format(script), cwd=os.path.join(TEST_DIR, suite),
+                         stdout=FNULL, shell=True)
+    p.communicate()
+
+# One sample of the host - the CPU time and pinning of each VCPU, the balloon and usable memory of
+# each VM and the host free memory
+def sample(conn, vmlist, vmobjlist, suite):
+    result = {'time': time.time(), 'vms': {}}
+    for i in range(len(vmobjlist)):
+        vm = {}
+        if suite == 'cpu':
+            info, cpumaps = vmobjlist[i].vcpus()
+            vm['vcpus'] = [{'cpu': info[j][3], 'cpu_time': info[j][2], 'cpumap': list(cpumaps[j])}
+                           for j in range(len(info))]
+        else:
+            stats = vmobjlist[i].memoryStats()
+            vm['actual'] = stats.get('actual', 0)
+            if 'usable' in stats:
+                vm['usable'] = stats['usable']
+            else:
+                vm['usable'] = stats.get('unused', 0) + stats.get('disk_caches', 0)
+        result['vms'][vmlist[i]] = vm
+    if suite == 'memory':
+        result['host_total'] = conn.getInfo()[1] * 1024
+        result['host_free'] = conn.getFreeMemory() // 1024
+    return result
+
+# One sample of the host from a line of a daemon's monitor stream (-u) - only the VMs listed are
+# kept and a line missing one of them is skipped (None)
+def stream_sample(line, vmlist, suite):
+    cycle = json.loads(line)
+    result = {'time': cycle['time'], 'vms': {}}
+    if suite == 'cpu':
+        for vcpu in cycle['vcpus']:
+            if vcpu['domain'] in vmlist:
+                vm = result['vms'].setdefault(vcpu['domain'], {'vcpus': []})
+                vm['vcpus'].append({'cpu': vcpu['pcpu'], 'cpu_time': vcpu['cpu_time'], 'cpumap': [vcpu['pcpu']]})
+    else:
+        for vm in cycle['vms']:
+            if vm['vm'] in vmlist:
+                result['vms'][vm['vm']] = {'actual': vm['balloon_kb'], 'usable': vm['available_kb']}
+        result['host_total'] = cycle['host_total_kb']
+        result['host_free'] = cycle['host_free_kb']
+    if len(result['vms']) != len(vmlist):
+        result = None
+    return result
+
+# Samples of a testcase from a daemon's monitor stream - one per cycle of the daemon
+def stream_samples(path, vmlist, suite, duration):
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    sock.connect(path)
+    stream = sock.makefile('r')
+    samples = []
+    deadline = time.time() + duration
+    while time.time() < deadline:
+        line = stream.readline()
+        if not line:
+            print('Monitor stream {} closed.'.format(path))
+            exit(-1)
+        result = stream_sample(line, vmlist, suite)
+        if result is not None:
+            samples.append(result)
+    sock.close()
+    return samples
+
+# Utilization (%) of each PCPU between two samples from the CPU time of the VCPUs running on it
+def pcpu_util(prev, cur, numpcpu):
+    elapsed = cur['time'] - prev['time']
+    util = [0.0] * numpcpu
+    for name, vm in cur['vms'].items():
+        for j in range(len(vm['vcpus'])):
+            used = vm['vcpus'][j]['cpu_time'] - prev['vms'][name]['vcpus'][j]['cpu_time']
+            util[vm['vcpus'][j]['cpu']] += 100.0 * used / (elapsed * (10 ** 9))
+    return util
+
+def score_cpu(samples, numpcpu):
+    stddevs = []
+    repins = 0
+    last_repin = None
+    start = samples[0]['time']
+    for k in range(1, len(samples)):
+        util = pcpu_util(samples[k - 1], samples[k], numpcpu)
+        stddevs.append((samples[k]['time'] - start, stddev(util)))
+        samples[k]['pcpu_util'] = util
+        for name, vm in samples[k]['vms'].items():
+            for j in range(len(vm['vcpus'])):
+                if vm['vcpus'][j]['cpumap'] != samples[k - 1]['vms'][name]['vcpus'][j]['cpumap']:
+                    repins += 1
+                    last_repin = samples[k]['time'] - start
+
+    # Balanced from the first sample after which the stddev stays within BALANCE_STDDEV
+    time_to_balance = None
+    for when, value in stddevs:
+        if value > BALANCE_STDDEV:
+            time_to_balance = None
+        elif time_to_balance is None:
+            time_to_balance = when
+
+    final = [value for when, value in stddevs[len(stddevs) // 2:]]
+    return {
+        'time_to_balance': time_to_balance,
+        'stddev_mean': sum(value for when, value in stddevs) / len(stddevs),
+        'stddev_final': sum(final) / len(final),
+        'stddev_max': max(value for when, value in stddevs),
+        'repins': repins,
+        'last_repin': last_repin,
+    }
+
+def score_memory(samples, host_low, vm_low):
+    deficit_area = 0.0
+    per_vm = {}
+    resizes = 0
+    violations = 0
+    floor_seconds = 0.0
+    free_min = None
+    for k in range(1, len(samples)):
+        elapsed = samples[k]['time'] - samples[k - 1]['time']
+
+        # Memory a VM has usable below its low threshold, in MB * seconds
+        for name, vm in samples[k]['vms'].items():
+            deficit = max(0.0, vm_low * vm['actual'] / 100.0 - vm['usable']) / 1024.0
+            per_vm[name] = per_vm.get(name, 0.0) + deficit * elapsed
+            deficit_area += deficit * elapsed
+            if vm['actual'] != samples[k - 1]['vms'][name]['actual']:
+                resizes += 1
+
+        # Host free memory below its low threshold
+        floor = host_low * samples[k]['host_total'] / 100.0
+        if samples[k]['host_free'] < floor:
+            violations += 1
+            floor_seconds += elapsed
+        if free_min is None or samples[k]['host_free'] < free_min:
+            free_min = samples[k]['host_free']
+
+    return {
+        'deficit_area': deficit_area,
+        'deficit_area_vm': per_vm,
+        'resizes': resizes,
+        'floor_violations': violations,
+        'floor_seconds': floor_seconds,
+        'host_free_min_mb': free_min / 1024.0,
+    }
+
+def run_testcase(conn, vmlist, vmobjlist, testcase, args):
+    name, suite, script, duration = testcase
+    if args.duration:
+        duration = args.duration
+    print('Start {} ({} seconds).'.format(name, duration))
+
+    if suite == 'memory':
+        for vm in vmobjlist:
+            vm.setMemoryStatsPeriod(1)
+
+    run_script(suite, script)
+    path = (args.cpu_socket if suite == 'cpu' else args.mem_socket)
+    if path:
+        samples = stream_samples(path, vmlist, suite, duration)
+    else:
+        samples = [sample(conn, vmlist, vmobjlist, suite)]
+        deadline = samples[0]['time'] + duration
+        while samples[-1]['time'] + args.interval <= deadline:
+            time.sleep(max(0.0, samples[-1]['time'] + args.interval - time.time()))
+            samples.append(sample(conn, vmlist, vmobjlist, suite))
+    run_script(suite, 'killall.py')
+    if len(samples) < 2:
+        print('{}: not enough samples.'.format(name))
+        exit(-1)
+
+    if suite == 'cpu':
+        metrics = score_cpu(samples, get_pcpu(conn))
+    else:
+        metrics = score_memory(samples, args.host_low, args.vm_low)
+    result = {'suite': suite, 'duration': duration, 'metrics': metrics}
+    if args.samples:
+        result['samples'] = samples
+    return result
+
+# Compare with a baseline report - a metric regresses when it is over the baseline by more than
+# the tolerance and its slack
+def compare(report, baseline, tolerance):
+    regressions = []
+    for name, result in report['testcases'].items():
+        if name not in baseline['testcases']:
+            continue
+        base = baseline['testcases'][name]['metrics']
+        for metric, slack in METRICS.items():
+            if metric not in result['metrics'] or metric not in base:
+                continue
+            new, old = result['metrics'][metric], base[metric]
+            if old is None:
+                continue
+            if new is None or new > old * (1 + tolerance / 100.0) + slack:
+                regressions.append({'testcase': name, 'metric': metric, 'baseline': old, 'value': new})
+    return regressions
+
+if __name__ == '__main__':
+    parser = argparse.ArgumentParser(description='Run testcases and score the VCPU scheduler / memory coordinator.')
+    parser.add_argument('testcases', nargs='*', help='testcases to run (default all): ' +
+                        ' '.join(testcase[0] for testcase in TESTCASES))
+    parser.add_argument('-o', '--output', default='report.json', help='JSON report (default report.json)')
+    parser.add_argument('-i', '--interval', type=float, default=1.0, help='seconds between samples (default 1)')
+    parser.add_argument('-d', '--duration', type=float, help='seconds to sample each testcase for')
+    parser.add_argument('-b', '--baseline', help='JSON report to compare with (exit status 1 on a regression)')
+    parser.add_argument('-t', '--tolerance', type=float, default=10.0, help='%% a metric may exceed the baseline by (default 10)')
+    parser.add_argument('-L', '--host-low', type=int, default=HOST_LOW_PERCENT, help='host_low_percent of the coordinator')
+    parser.add_argument('-l', '--vm-low', type=int, default=VM_LOW_PERCENT, help='vm_low_percent of the coordinator')
+    parser.add_argument('-u', '--cpu-socket', help='read cpu samples from the vcpu_scheduler monitor stream (-u) instead of polling')
+    parser.add_argument('-U', '--mem-socket', help='read memory samples from the memory_coordinator monitor stream (-u) instead of polling')
+    parser.add_argument('-s', '--samples', action='store_true', help='include the samples in the report')
+    args = parser.parse_args()
+
+    if args.duration is not None and args.duration < 2 * args.interval:
+        print('Duration must be at least two intervals.')
+        exit(-1)
+
+    names = [testcase[0] for testcase in TESTCASES]
+    for name in args.testcases:
+        if name not in names:
+            print('Unknown testcase {}.'.format(name))
+            exit(-1)
+
+    conn = libvirt.open('qemu:///system')
+    vmlist, vmobjlist = lookup_vms(conn)
+
+    report = {'interval': args.interval, 'balance_stddev': BALANCE_STDDEV, 'host_low_percent': args.host_low,
+              'vm_low_percent': args.vm_low, 'testcases': {}}
+    for testcase in TESTCASES:
+        if not args.testcases or testcase[0] in args.testcases:
+            report['testcases'][testcase[0]] = run_testcase(conn, vmlist, vmobjlist, testcase, args)
+            print('{}: {}'.format(testcase[0], json.dumps(report['testcases'][testcase[0]]['metrics'], sort_keys=True)))
+
+    status = 0
+    if args.baseline:
+        report['regressions'] = compare(report, json.load(open(args.baseline, 'r')), args.tolerance)
+        for regression in report['regressions']:
+            print('Regression {testcase} {metric}: {value} (baseline {baseline}).'.format(**regression))
+        if report['regressions']:
+            status = 1
+
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+    print('Report written to {}.'.format(args.output))
+    exit(status)